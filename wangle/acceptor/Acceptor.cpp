@@ -10,22 +10,31 @@
 #include <wangle/acceptor/Acceptor.h>
 
 #include <wangle/acceptor/ManagedConnection.h>
+#include <wangle/concurrent/Codel.h>
+#include <wangle/concurrent/MetricsRegistry.h>
 #include <wangle/ssl/SSLContextManager.h>
 
+#include <algorithm>
 #include <boost/cast.hpp>
 #include <fcntl.h>
 #include <folly/ScopeGuard.h>
+#include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/EventBase.h>
 #include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <folly/io/async/AsyncSSLSocket.h>
 #include <folly/io/async/AsyncSocket.h>
+#include <folly/tracing/StaticTracepoint.h>
 #include <gflags/gflags.h>
 #include <unistd.h>
 
 using folly::wangle::ConnectionManager;
 using folly::wangle::ManagedConnection;
+using folly::wangle::MetricsRegistry;
 using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::filebuf;
@@ -46,6 +55,74 @@ const int32_t FLAGS_shutdown_idle_grace_ms = 5000;
 static const std::string empty_string;
 std::atomic<uint64_t> Acceptor::totalNumPendingSSLConns_{0};
 
+namespace {
+
+struct AcceptorMetrics {
+  MetricsRegistry::Counter connections;
+  MetricsRegistry::Counter acceptErrors;
+  MetricsRegistry::Counter sslHandshakes;
+  MetricsRegistry::Counter sslHandshakeErrors;
+};
+
+// In the default registry, shared by all acceptors
+const AcceptorMetrics& metrics() {
+  static const AcceptorMetrics m = [] {
+    auto& registry = MetricsRegistry::getDefault();
+    registry.setGauge("acceptor.pending_ssl_handshakes", [] {
+      return int64_t(Acceptor::getTotalNumPendingSSLConns());
+    });
+    return AcceptorMetrics{
+      registry.counter("acceptor.connections"),
+      registry.counter("acceptor.accept_errors"),
+      registry.counter("acceptor.ssl_handshakes"),
+      registry.counter("acceptor.ssl_handshake_errors"),
+    };
+  }();
+  return m;
+}
+
+}
+
+/**
+ * Times how late a timeout fires, every interval, which is how far behind
+ * the acceptor's event loop is running, and keeps the acceptor's
+ * loopOverloaded_ to what Codel makes of that lag.
+ */
+class AcceptorLoopLagProbe : public AsyncTimeout {
+ public:
+  AcceptorLoopLagProbe(Acceptor* acceptor, milliseconds interval)
+      : AsyncTimeout(acceptor->base_),
+        acceptor_(acceptor),
+        interval_(interval) {}
+
+  void start() {
+    due_ = std::chrono::steady_clock::now() + interval_;
+    scheduleTimeout(interval_);
+  }
+
+  void timeoutExpired() noexcept override {
+    auto lag = std::max<std::chrono::steady_clock::duration>(
+      std::chrono::steady_clock::now() - due_,
+      std::chrono::steady_clock::duration::zero());
+    bool overloaded = codel_.overloaded(
+      std::chrono::duration_cast<microseconds>(lag));
+    if (overloaded != acceptor_->isLoopOverloaded()) {
+      VLOG(2) << "Acceptor=" << acceptor_ << " event loop "
+              << (overloaded ? "lagging by " : "caught up at ")
+              << std::chrono::duration_cast<microseconds>(lag).count()
+              << "us";
+    }
+    acceptor_->loopOverloaded_.store(overloaded, std::memory_order_relaxed);
+    start();
+  }
+
+ private:
+  Acceptor* acceptor_;
+  const milliseconds interval_;
+  std::chrono::steady_clock::time_point due_;
+  folly::wangle::Codel codel_;
+};
+
 /**
  * Lightweight wrapper class to keep track of a newly
  * accepted connection during SSL handshaking.
@@ -63,8 +140,9 @@ class AcceptorHandshakeHelper :
       acceptTime_(acceptTime), clientAddr_(clientAddr),
       tinfo_(tinfo) {
     acceptor_->downstreamConnectionManager_->addConnection(this, true);
-    if(acceptor_->parseClientHello_)  {
-      socket_->enableClientHelloParsing();
+    parseClientHello_ = acceptor_->sampleClientHello(socket_.get());
+    if (acceptor_->handshakeAdmission_) {
+      acceptor_->handshakeAdmission_->onAccept(socket_.get(), acceptTime_);
     }
     socket_->sslAccept(this);
   }
@@ -90,56 +168,13 @@ class AcceptorHandshakeHelper :
  private:
   // AsyncSSLSocket::HandshakeCallback API
   void handshakeSuc(AsyncSSLSocket* sock) noexcept override {
-
-    const unsigned char* nextProto = nullptr;
-    unsigned nextProtoLength = 0;
-    sock->getSelectedNextProtocol(&nextProto, &nextProtoLength);
-    if (VLOG_IS_ON(3)) {
-      if (nextProto) {
-        VLOG(3) << "Client selected next protocol " <<
-            string((const char*)nextProto, nextProtoLength);
-      } else {
-        VLOG(3) << "Client did not select a next protocol";
-      }
+    if (acceptor_->handshakeAdmission_) {
+      acceptor_->handshakeAdmission_->onHandshakeDone(sock);
     }
 
-    // fill in SSL-related fields from TransportInfo
-    // the other fields like RTT are filled in the Acceptor
-    tinfo_.ssl = true;
-    tinfo_.acceptTime = acceptTime_;
-    tinfo_.sslSetupTime = std::chrono::duration_cast<std::chrono::milliseconds>(
-      std::chrono::steady_clock::now() - acceptTime_
-    );
-    tinfo_.sslSetupBytesRead = sock->getRawBytesReceived();
-    tinfo_.sslSetupBytesWritten = sock->getRawBytesWritten();
-    tinfo_.sslServerName = sock->getSSLServerName() ?
-      std::make_shared<std::string>(sock->getSSLServerName()) : nullptr;
-    tinfo_.sslCipher = sock->getNegotiatedCipherName() ?
-      std::make_shared<std::string>(sock->getNegotiatedCipherName()) : nullptr;
-    tinfo_.sslVersion = sock->getSSLVersion();
-    tinfo_.sslCertSize = sock->getSSLCertSize();
-    tinfo_.sslResume = SSLUtil::getResumeState(sock);
-    tinfo_.sslClientCiphers = std::make_shared<std::string>();
-    sock->getSSLClientCiphers(*tinfo_.sslClientCiphers);
-    tinfo_.sslServerCiphers = std::make_shared<std::string>();
-    sock->getSSLServerCiphers(*tinfo_.sslServerCiphers);
-    tinfo_.sslClientComprMethods =
-        std::make_shared<std::string>(sock->getSSLClientComprMethods());
-    tinfo_.sslClientExts =
-        std::make_shared<std::string>(sock->getSSLClientExts());
-    tinfo_.sslNextProtocol = std::make_shared<std::string>();
-    tinfo_.sslNextProtocol->assign(reinterpret_cast<const char*>(nextProto),
-                                  nextProtoLength);
-
-    acceptor_->updateSSLStats(
-      sock,
-      tinfo_.sslSetupTime,
-      SSLErrorEnum::NO_ERROR
-    );
     acceptor_->downstreamConnectionManager_->removeConnection(this);
-    acceptor_->sslConnectionReady(std::move(socket_), clientAddr_,
-        nextProto ? string((const char*)nextProto, nextProtoLength) :
-                                  empty_string, tinfo_);
+    acceptor_->sslHandshakeSucceeded(std::move(socket_), clientAddr_,
+                                     acceptTime_, parseClientHello_, tinfo_);
     delete this;
   }
 
@@ -150,8 +185,11 @@ class AcceptorHandshakeHelper :
         " ms; " << sock->getRawBytesReceived() << " bytes received & " <<
         sock->getRawBytesWritten() << " bytes sent: " <<
         ex.what();
-    acceptor_->updateSSLStats(sock, elapsedTime, sslError_);
-    acceptor_->sslConnectionError();
+    if (acceptor_->handshakeAdmission_ &&
+        acceptor_->handshakeAdmission_->onHandshakeDone(sock)) {
+      sslError_ = SSLErrorEnum::DROPPED;
+    }
+    acceptor_->sslHandshakeFailed(sock, elapsedTime, sslError_);
     delete this;
   }
 
@@ -161,24 +199,260 @@ class AcceptorHandshakeHelper :
   SocketAddress clientAddr_;
   TransportInfo tinfo_;
   SSLErrorEnum sslError_{SSLErrorEnum::NO_ERROR};
+  // This handshake's ClientHello was sampled
+  bool parseClientHello_{false};
+};
+
+/**
+ * What of an acceptor the handshakes it sends to the sslHandshakeExecutor
+ * come back to, and what they make their SSL contexts from.
+ *
+ * The SSLContextManagers' session caches and SNI lookups keep state for
+ * one thread, so each handshake EventBase gets a manager of its own, made
+ * from the acceptor's config the first time it's needed there and again
+ * after the acceptor's SSL context configs change.  Session IDs are
+ * cached per handshake thread, short of an SSLCacheProvider; tickets
+ * resume anywhere, with set initialTicketSeeds.
+ */
+class OffloadedSSLHandshakes {
+ public:
+  OffloadedSSLHandshakes(Acceptor* a, EventBase* b,
+                         const ServerSocketConfig& config,
+                         std::shared_ptr<SSLCacheProvider> cacheProvider)
+      : acceptor(a),
+        base(b),
+        config_(config),
+        cacheProvider_(std::move(cacheProvider)) {}
+
+  // From the acceptor's thread: null once the acceptor is done, and the
+  // handshakes are to be dropped
+  Acceptor* acceptor;
+  // Only to be used from its own thread; see handBack()
+  EventBase* const base;
+  // Counted in the acceptor's pending SSL connections
+  uint64_t inFlight{0};
+
+  // From the acceptor's thread, once it's done or going away
+  void detach() {
+    acceptor = nullptr;
+    std::lock_guard<std::mutex> g(lock_);
+    attached_ = false;
+  }
+
+  /**
+   * Runs func on base, unless the acceptor is already gone, and its
+   * EventBase may be too, in which case it returns false.
+   */
+  bool handBack(Func func) {
+    std::lock_guard<std::mutex> g(lock_);
+    if (!attached_) {
+      return false;
+    }
+    base->runInEventBaseThread(std::move(func));
+    return true;
+  }
+
+  void setContextConfigs(std::vector<SSLContextConfig> configs) {
+    std::lock_guard<std::mutex> g(lock_);
+    config_.sslContextConfigs = std::move(configs);
+    generation_++;
+  }
+
+  void addContextConfig(const SSLContextConfig& ctxConfig) {
+    std::lock_guard<std::mutex> g(lock_);
+    config_.sslContextConfigs.push_back(ctxConfig);
+    generation_++;
+  }
+
+  // evb's manager, from evb's thread; throws if the contexts won't load
+  std::shared_ptr<SSLContextManager> managerFor(EventBase* evb) {
+    ServerSocketConfig config;
+    uint64_t generation;
+    {
+      std::lock_guard<std::mutex> g(lock_);
+      auto it = managers_.find(evb);
+      if (it != managers_.end() && it->second.first == generation_) {
+        return it->second.second;
+      }
+      config = config_;
+      generation = generation_;
+    }
+    // Loading certificates takes a while, so not under the lock.  Only
+    // evb's thread replaces its manager, and the handshakes on the old one
+    // keep it until they're done.
+    auto manager = std::make_shared<SSLContextManager>(
+      evb, "vip_" + config.name, config.strictSSL, config.sslStats.get());
+    if (config.asyncCryptoProvider) {
+      manager->setAsyncCryptoProvider(config.asyncCryptoProvider);
+    }
+    for (const auto& ctxConfig : config.sslContextConfigs) {
+      manager->addSSLContextConfig(ctxConfig, config.sslCacheOptions,
+                                   &config.initialTicketSeeds,
+                                   config.bindAddress, cacheProvider_);
+    }
+    CHECK(manager->getDefaultSSLCtx());
+    std::lock_guard<std::mutex> g(lock_);
+    managers_[evb] = std::make_pair(generation, manager);
+    return manager;
+  }
+
+ private:
+  std::mutex lock_;
+  bool attached_{true};
+  ServerSocketConfig config_;
+  const std::shared_ptr<SSLCacheProvider> cacheProvider_;
+  uint64_t generation_{0};
+  // By handshake EventBase, with the generation each was made for.  They
+  // go away with this, once no handshake is using them, so nothing of
+  // theirs is pending on those EventBases.
+  std::map<EventBase*,
+           std::pair<uint64_t, std::shared_ptr<SSLContextManager>>> managers_;
+};
+
+/**
+ * An SSL handshake on an EventBase of the sslHandshakeExecutor.  The
+ * connection's socket is made there, with that EventBase's SSL contexts,
+ * and once done either way, is detached from it and attached to the
+ * acceptor's, which finishes it as one of its own.  If the acceptor is
+ * gone by then, the socket is closed where it is.  The handshake times
+ * out after connectionIdleTimeout, as it would on the acceptor's thread.
+ */
+class OffloadedHandshakeHelper : public AsyncSSLSocket::HandshakeCB {
+ public:
+  OffloadedHandshakeHelper(std::shared_ptr<OffloadedSSLHandshakes> handshakes,
+                           EventBase* evb,
+                           int fd,
+                           const SocketAddress& clientAddr,
+                           std::chrono::steady_clock::time_point acceptTime,
+                           bool clientHelloSampled,
+                           TransportInfo& tinfo,
+                           milliseconds timeout)
+      : handshakes_(std::move(handshakes)),
+        evb_(evb),
+        fd_(fd),
+        clientAddr_(clientAddr),
+        acceptTime_(acceptTime),
+        clientHelloSampled_(clientHelloSampled),
+        tinfo_(tinfo),
+        timeout_(timeout) {
+    handshakes_->inFlight++;
+    evb_->runInEventBaseThread([this] { start(); });
+  }
+
+ private:
+  void start() {
+    try {
+      manager_ = handshakes_->managerFor(evb_);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Failed to load the SSL contexts of an offloaded "
+                 << "handshake: " << ex.what();
+      ::close(fd_);
+      sslError_ = SSLErrorEnum::DROPPED;
+      handBack();
+      return;
+    }
+    socket_.reset(new AsyncSSLSocket(manager_->getDefaultSSLCtx(), evb_, fd_));
+    if (clientHelloSampled_) {
+      socket_->enableClientHelloParsing();
+    }
+    socket_->sslAccept(this, timeout_.count());
+  }
+
+  void handshakeSuc(AsyncSSLSocket* sock) noexcept override {
+    succeeded_ = true;
+    handBack();
+  }
+
+  void handshakeErr(AsyncSSLSocket* sock,
+                    const AsyncSocketException& ex) noexcept override {
+    elapsedTime_ = std::chrono::duration_cast<milliseconds>(
+      std::chrono::steady_clock::now() - acceptTime_);
+    VLOG(3) << "SSL handshake error after " << elapsedTime_.count() <<
+        " ms; " << sock->getRawBytesReceived() << " bytes received & " <<
+        sock->getRawBytesWritten() << " bytes sent: " << ex.what();
+    if (ex.getType() == AsyncSocketException::TIMED_OUT) {
+      sslError_ = SSLErrorEnum::TIMEOUT;
+    }
+    handBack();
+  }
+
+  // Once the socket is out of its callback, nothing of it is left on evb_
+  void handBack() {
+    evb_->runInLoop([this] {
+      if (socket_) {
+        socket_->detachEventBase();
+      }
+      if (!handshakes_->handBack([this] { finish(); })) {
+        if (socket_) {
+          socket_->attachEventBase(evb_);
+        }
+        delete this;
+      }
+    });
+  }
+
+  void finish() {
+    if (socket_) {
+      socket_->attachEventBase(handshakes_->base);
+    }
+    auto acceptor = handshakes_->acceptor;
+    if (acceptor) {
+      handshakes_->inFlight--;
+      if (!socket_) {
+        acceptor->sslConnectionError();
+      } else if (succeeded_) {
+        acceptor->sslHandshakeSucceeded(std::move(socket_), clientAddr_,
+                                        acceptTime_, clientHelloSampled_,
+                                        tinfo_);
+      } else {
+        acceptor->sslHandshakeFailed(socket_.get(), elapsedTime_, sslError_);
+      }
+    }
+    delete this;
+  }
+
+  std::shared_ptr<OffloadedSSLHandshakes> handshakes_;
+  EventBase* evb_;
+  int fd_;
+  // Holds the contexts its socket uses
+  std::shared_ptr<SSLContextManager> manager_;
+  AsyncSSLSocket::UniquePtr socket_;
+  SocketAddress clientAddr_;
+  std::chrono::steady_clock::time_point acceptTime_;
+  bool clientHelloSampled_;
+  TransportInfo tinfo_;
+  const milliseconds timeout_;
+  bool succeeded_{false};
+  milliseconds elapsedTime_{0};
+  SSLErrorEnum sslError_{SSLErrorEnum::NO_ERROR};
 };
 
 Acceptor::Acceptor(const ServerSocketConfig& accConfig) :
   accConfig_(accConfig),
-  socketOptions_(accConfig.getSocketOptions()) {
+  socketOptions_(accConfig.getAcceptedSocketOptions()),
+  memoryBudget_(accConfig.memoryBudget) {
 }
 
 void
 Acceptor::init(AsyncServerSocket* serverSocket,
                EventBase* eventBase) {
   CHECK(nullptr == this->base_);
+  // Registers the gauges ahead of the first connection
+  metrics();
 
   if (accConfig_.isSSL()) {
     if (!sslCtxManager_) {
       sslCtxManager_ = folly::make_unique<SSLContextManager>(
         eventBase,
         "vip_" + getName(),
-        accConfig_.strictSSL, nullptr);
+        accConfig_.strictSSL, accConfig_.sslStats.get());
+    }
+    if (accConfig_.asyncCryptoProvider) {
+      sslCtxManager_->setAsyncCryptoProvider(accConfig_.asyncCryptoProvider);
+    }
+    if (accConfig_.sslHandshakeAdmission) {
+      handshakeAdmission_ = folly::make_unique<SSLHandshakeAdmission>();
+      sslCtxManager_->setHandshakeAdmission(handshakeAdmission_.get());
     }
     for (const auto& sslCtxConfig : accConfig_.sslContextConfigs) {
       sslCtxManager_->addSSLContextConfig(
@@ -191,12 +465,50 @@ Acceptor::init(AsyncServerSocket* serverSocket,
     }
 
     CHECK(sslCtxManager_->getDefaultSSLCtx());
+
+    if (accConfig_.sslHandshakeExecutor) {
+      offloadedHandshakes_ = std::make_shared<OffloadedSSLHandshakes>(
+        this, eventBase, accConfig_, cacheProvider_);
+    }
   }
 
   base_ = eventBase;
   state_ = State::kRunning;
   downstreamConnectionManager_ = ConnectionManager::makeUnique(
     eventBase, accConfig_.connectionIdleTimeout, this);
+  downstreamConnectionManager_->setLazyIdleTimeouts(
+    accConfig_.lazyIdleTimeouts);
+  downstreamConnectionManager_->setDrainBatchSize(
+    std::max<uint32_t>(accConfig_.drainBatchSize, 1));
+  downstreamConnectionManager_->setDrainWindow(accConfig_.drainWindow);
+
+  ConnectionManager::MemoryPressureOptions memoryPressure;
+  memoryPressure.minIdleTimeout = accConfig_.minIdleTimeoutUnderPressure;
+  if (accConfig_.idleDropOnBudgetPressure && memoryBudget_) {
+    memoryPressure.pressure =
+      ConnectionManager::budgetPressure(memoryBudget_);
+  } else if (accConfig_.idleDropRssTarget > 0) {
+    memoryPressure.pressure =
+      ConnectionManager::rssPressure(accConfig_.idleDropRssTarget);
+  }
+  if (memoryPressure.pressure) {
+    base_->runInEventBaseThread([this, memoryPressure] {
+      if (downstreamConnectionManager_) {
+        downstreamConnectionManager_->setMemoryPressure(memoryPressure);
+      }
+    });
+  }
+
+  if (accConfig_.loopLagProbeInterval.count() > 0) {
+    loopLagProbe_ = folly::make_unique<AcceptorLoopLagProbe>(
+      this, accConfig_.loopLagProbeInterval);
+    // init() may not be called from eventBase's thread
+    base_->runInEventBaseThread([this] {
+      if (loopLagProbe_) {
+        loopLagProbe_->start();
+      }
+    });
+  }
 
   if (serverSocket) {
     serverSocket->addAcceptCallback(this, eventBase);
@@ -213,6 +525,9 @@ Acceptor::init(AsyncServerSocket* serverSocket,
 }
 
 Acceptor::~Acceptor(void) {
+  if (offloadedHandshakes_) {
+    offloadedHandshakes_->detach();
+  }
 }
 
 void Acceptor::addSSLContextConfig(const SSLContextConfig& sslCtxConfig) {
@@ -221,6 +536,27 @@ void Acceptor::addSSLContextConfig(const SSLContextConfig& sslCtxConfig) {
                                       &accConfig_.initialTicketSeeds,
                                       accConfig_.bindAddress,
                                       cacheProvider_);
+  if (offloadedHandshakes_) {
+    offloadedHandshakes_->addContextConfig(sslCtxConfig);
+  }
+}
+
+void Acceptor::resetSSLContextConfigs(
+  const std::vector<SSLContextConfig>& sslCtxConfigs,
+  folly::Executor* loader) {
+  sslCtxManager_->resetSSLContextConfigs(sslCtxConfigs,
+                                         accConfig_.sslCacheOptions,
+                                         &accConfig_.initialTicketSeeds,
+                                         accConfig_.bindAddress,
+                                         cacheProvider_,
+                                         loader);
+  if (offloadedHandshakes_) {
+    // Each handshake thread loads them anew with its next handshake
+    offloadedHandshakes_->setContextConfigs(sslCtxConfigs);
+  }
+  for (const auto& sslCtxConfig : sslCtxConfigs) {
+    parseClientHello_ |= sslCtxConfig.clientHelloParsingEnabled;
+  }
 }
 
 void
@@ -231,13 +567,92 @@ Acceptor::drainAllConnections() {
   }
 }
 
+void Acceptor::prewarm() {
+  CHECK(base_->isInEventBaseThread());
+  // Read buffers and the first writes, freed into the thread's caches
+  std::vector<std::unique_ptr<IOBuf>> bufs;
+  for (size_t size = 64; size <= 64 * 1024; size *= 4) {
+    for (int i = 0; i < 4; i++) {
+      bufs.push_back(IOBuf::create(size));
+    }
+  }
+  bufs.clear();
+
+  if (sslCtxManager_ && sslCtxManager_->getDefaultSSLCtx()) {
+    auto ssl = SSL_new(sslCtxManager_->getDefaultSSLCtx()->getSSLCtx());
+    if (ssl) {
+      SSL_free(ssl);
+    }
+  }
+}
+
 void Acceptor::setLoadShedConfig(const LoadShedConfiguration& from,
                        IConnectionCounter* counter) {
   loadShedConfig_ = from;
   connectionCounter_ = counter;
+  if (loadShedConfig_.hasSystemLoadLimits()) {
+    loadSampler_ = SystemLoadSampler::get(
+      loadShedConfig_.getLoadUpdatePeriod());
+  } else {
+    loadSampler_.reset();
+  }
+}
+
+bool Acceptor::isSystemOverloaded() const {
+  if (!loadSampler_) {
+    return false;
+  }
+  if (loadSampler_->getCpuUsage() > loadShedConfig_.getMaxCpuUsage()) {
+    VLOG(4) << "CPU usage " << loadSampler_->getCpuUsage() << " above "
+            << loadShedConfig_.getMaxCpuUsage();
+    return true;
+  }
+  if (loadSampler_->getMemUsage() > loadShedConfig_.getMaxMemUsage() ||
+      loadSampler_->getFreeMem() < loadShedConfig_.getMinFreeMem()) {
+    VLOG(4) << "Memory usage " << loadSampler_->getMemUsage() << " above "
+            << loadShedConfig_.getMaxMemUsage() << " or free memory "
+            << loadSampler_->getFreeMem() << " below "
+            << loadShedConfig_.getMinFreeMem();
+    return true;
+  }
+  return false;
 }
 
 bool Acceptor::canAccept(const SocketAddress& address) {
+  if (isSystemOverloaded()) {
+    if (loadShedConfig_.isWhitelisted(address)) {
+      return true;
+    }
+    VLOG(4) << address.describe() << " not whitelisted, system overloaded";
+    return false;
+  }
+
+  if (connectionLease_ && !connectionLease_->hasQuota()) {
+    if (loadShedConfig_.isWhitelisted(address)) {
+      return true;
+    }
+    VLOG(4) << address.describe() << " not whitelisted, connection limit "
+            << "reached";
+    return false;
+  }
+
+  if (memoryBudget_ && memoryBudget_->isOverloaded()) {
+    if (loadShedConfig_.isWhitelisted(address)) {
+      return true;
+    }
+    VLOG(4) << address.describe() << " not whitelisted, memory budget "
+            << "overloaded";
+    return false;
+  }
+
+  if (isLoopOverloaded()) {
+    if (loadShedConfig_.isWhitelisted(address)) {
+      return true;
+    }
+    VLOG(4) << address.describe() << " not whitelisted, event loop lagging";
+    return false;
+  }
+
   if (!connectionCounter_) {
     return true;
   }
@@ -267,14 +682,36 @@ bool Acceptor::canAccept(const SocketAddress& address) {
   return false;
 }
 
+uint64_t Acceptor::getAcceptHeadroom() {
+  if (isSystemOverloaded() || connectionLease_ || memoryBudget_ ||
+      isLoopOverloaded()) {
+    return 0;
+  }
+  if (!connectionCounter_) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  uint64_t maxConnections = connectionCounter_->getMaxConnections();
+  if (maxConnections == 0) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  uint64_t currentConnections = connectionCounter_->getNumConnections();
+  return currentConnections < maxConnections ?
+    maxConnections - currentConnections : 0;
+}
+
 void
 Acceptor::connectionAccepted(
     int fd, const SocketAddress& clientAddr) noexcept {
-  if (!canAccept(clientAddr)) {
+  if (acceptHeadroom_ > 0) {
+    acceptHeadroom_--;
+  } else if (!canAccept(clientAddr)) {
+    FOLLY_SDT(wangle, acceptor_connection_rejected, fd);
     close(fd);
     return;
   }
   auto acceptTime = std::chrono::steady_clock::now();
+  FOLLY_SDT(wangle, acceptor_connection_accepted, fd,
+            acceptTime.time_since_epoch().count());
   for (const auto& opt: socketOptions_) {
     opt.first.apply(fd, opt.second);
   }
@@ -282,6 +719,29 @@ Acceptor::connectionAccepted(
   onDoneAcceptingConnection(fd, clientAddr, acceptTime);
 }
 
+void
+Acceptor::connectionsAccepted(AcceptedConnections& conns) noexcept {
+  acceptHeadroom_ = getAcceptHeadroom();
+  for (auto& conn : conns) {
+    // Through the virtual, so subclasses' overrides see every connection
+    connectionAccepted(conn.first, conn.second);
+  }
+  acceptHeadroom_ = 0;
+}
+
+void
+Acceptor::transportAccepted(AsyncSocket::UniquePtr sock,
+                            const SocketAddress& clientAddr) noexcept {
+  if (!canAccept(clientAddr)) {
+    sock->closeNow();
+    return;
+  }
+  TransportInfo tinfo;
+  tinfo.ssl = false;
+  tinfo.acceptTime = std::chrono::steady_clock::now();
+  connectionReady(std::move(sock), clientAddr, empty_string, tinfo);
+}
+
 void Acceptor::onDoneAcceptingConnection(
     int fd,
     const SocketAddress& clientAddr,
@@ -308,9 +768,29 @@ Acceptor::processEstablishedConnection(
         " too many handshakes in progress";
       updateSSLStats(sslSock.get(), std::chrono::milliseconds(0),
                      SSLErrorEnum::DROPPED);
+      if (accConfig_.sslStats) {
+        accConfig_.sslStats->recordSSLHandshake(
+          false, SSLErrorEnum::DROPPED, SSLResumeEnum::NA, nullptr,
+          std::chrono::microseconds(0));
+      }
       sslConnectionError();
       return;
     }
+    if (offloadedHandshakes_) {
+      bool clientHelloSampled = sampleClientHello(sslSock.get());
+      // The handshake thread makes a socket of its own for it, with its
+      // own SSL contexts
+      new OffloadedHandshakeHelper(
+        offloadedHandshakes_,
+        accConfig_.sslHandshakeExecutor->getEventBase(),
+        sslSock->detachFd(),
+        clientAddr,
+        acceptTime,
+        clientHelloSampled,
+        tinfo,
+        accConfig_.connectionIdleTimeout);
+      return;
+    }
     new AcceptorHandshakeHelper(
       std::move(sslSock),
       this,
@@ -336,7 +816,11 @@ Acceptor::connectionReady(
   // both to keep memory usage under control and to prevent one fast-
   // writing client from starving other connections.
   sock->setMaxReadsPerEvent(16);
-  tinfo.initWithSocket(sock.get());
+  metrics().connections.add();
+  auto sampleRate = accConfig_.tcpInfoSampleRate;
+  if (sampleRate > 0 && ++tcpInfoCount_ % sampleRate == 0) {
+    tinfo.initWithSocket(sock.get());
+  }
   onNewConnection(std::move(sock), &clientAddr, nextProtocolName, tinfo);
 }
 
@@ -346,6 +830,7 @@ Acceptor::sslConnectionReady(AsyncSocket::UniquePtr sock,
                              const string& nextProtocol,
                              TransportInfo& tinfo) {
   CHECK(numPendingSSLConns_ > 0);
+  metrics().sslHandshakes.add();
   connectionReady(std::move(sock), clientAddr, nextProtocol, tinfo);
   --numPendingSSLConns_;
   --totalNumPendingSSLConns_;
@@ -354,9 +839,104 @@ Acceptor::sslConnectionReady(AsyncSocket::UniquePtr sock,
   }
 }
 
+bool Acceptor::sampleClientHello(AsyncSSLSocket* sock) {
+  auto sampleRate = accConfig_.clientHelloSampleRate;
+  if (parseClientHello_ && sampleRate > 0 &&
+      ++clientHelloCount_ % sampleRate == 0) {
+    sock->enableClientHelloParsing();
+    return true;
+  }
+  return false;
+}
+
+void
+Acceptor::sslHandshakeSucceeded(
+    AsyncSSLSocket::UniquePtr socket,
+    const SocketAddress& clientAddr,
+    std::chrono::steady_clock::time_point acceptTime,
+    bool clientHelloSampled,
+    TransportInfo& tinfo) {
+  auto sock = socket.get();
+  const unsigned char* nextProto = nullptr;
+  unsigned nextProtoLength = 0;
+  sock->getSelectedNextProtocol(&nextProto, &nextProtoLength);
+  if (VLOG_IS_ON(3)) {
+    if (nextProto) {
+      VLOG(3) << "Client selected next protocol " <<
+          string((const char*)nextProto, nextProtoLength);
+    } else {
+      VLOG(3) << "Client did not select a next protocol";
+    }
+  }
+
+  // fill in SSL-related fields from TransportInfo
+  // the other fields like RTT are filled in the Acceptor
+  tinfo.ssl = true;
+  tinfo.acceptTime = acceptTime;
+  tinfo.sslSetupTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - acceptTime
+  );
+  tinfo.sslSetupBytesRead = sock->getRawBytesReceived();
+  tinfo.sslSetupBytesWritten = sock->getRawBytesWritten();
+  tinfo.sslServerName = sock->getSSLServerName() ?
+    std::make_shared<std::string>(sock->getSSLServerName()) : nullptr;
+  tinfo.sslCipher = sock->getNegotiatedCipherName() ?
+    TransportInfo::internString(sock->getNegotiatedCipherName()) : nullptr;
+  tinfo.sslVersion = sock->getSSLVersion();
+  tinfo.sslCertSize = sock->getSSLCertSize();
+  tinfo.sslResume = SSLUtil::getResumeState(sock);
+  tinfo.sslServerCiphers = std::make_shared<std::string>();
+  sock->getSSLServerCiphers(*tinfo.sslServerCiphers);
+  if (clientHelloSampled) {
+    clientHelloStats_.record(sock);
+    if (accConfig_.clientHelloInTransportInfo) {
+      tinfo.sslClientCiphers = std::make_shared<std::string>();
+      sock->getSSLClientCiphers(*tinfo.sslClientCiphers);
+      tinfo.sslClientComprMethods =
+          std::make_shared<std::string>(sock->getSSLClientComprMethods());
+      tinfo.sslClientExts =
+          std::make_shared<std::string>(sock->getSSLClientExts());
+    }
+  }
+  tinfo.sslNextProtocol = TransportInfo::internString(
+    StringPiece(reinterpret_cast<const char*>(nextProto), nextProtoLength));
+
+  updateSSLStats(
+    sock,
+    tinfo.sslSetupTime,
+    SSLErrorEnum::NO_ERROR
+  );
+  if (accConfig_.sslStats) {
+    accConfig_.sslStats->recordSSLHandshake(
+      true,
+      SSLErrorEnum::NO_ERROR,
+      tinfo.sslResume,
+      sock->getNegotiatedCipherName(),
+      std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - acceptTime));
+  }
+  sslConnectionReady(std::move(socket), clientAddr,
+      nextProto ? string((const char*)nextProto, nextProtoLength) :
+                  empty_string, tinfo);
+}
+
+void
+Acceptor::sslHandshakeFailed(AsyncSSLSocket* sock,
+                             std::chrono::milliseconds elapsedTime,
+                             SSLErrorEnum error) {
+  updateSSLStats(sock, elapsedTime, error);
+  if (accConfig_.sslStats) {
+    accConfig_.sslStats->recordSSLHandshake(
+      false, error, SSLResumeEnum::NA, nullptr,
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsedTime));
+  }
+  sslConnectionError();
+}
+
 void
 Acceptor::sslConnectionError() {
   CHECK(numPendingSSLConns_ > 0);
+  metrics().sslHandshakeErrors.add();
   --numPendingSSLConns_;
   --totalNumPendingSSLConns_;
   if (state_ == State::kDraining) {
@@ -370,6 +950,7 @@ Acceptor::acceptError(const std::exception& ex) noexcept {
   // The most likely error is out of FDs.  AsyncServerSocket will back off
   // briefly if we are out of FDs, then continue accepting later.
   // Just log a message here.
+  metrics().acceptErrors.add();
   LOG(ERROR) << "error accepting on acceptor socket: " << ex.what();
 }
 
@@ -435,6 +1016,9 @@ Acceptor::forceStop() {
 
 void
 Acceptor::dropAllConnections() {
+  if (state_ == State::kDone) {
+    return;
+  }
   if (downstreamConnectionManager_) {
     VLOG(3) << "Dropping all connections from Acceptor=" << this <<
       " in thread " << base_;
@@ -444,7 +1028,16 @@ Acceptor::dropAllConnections() {
     CHECK(downstreamConnectionManager_->getNumConnections() == 0);
     downstreamConnectionManager_.reset();
   }
+  if (offloadedHandshakes_) {
+    // Dropped as they come back
+    numPendingSSLConns_ -= offloadedHandshakes_->inFlight;
+    totalNumPendingSSLConns_ -= offloadedHandshakes_->inFlight;
+    offloadedHandshakes_->detach();
+    offloadedHandshakes_.reset();
+  }
   CHECK(numPendingSSLConns_ == 0);
+  loopLagProbe_.reset();
+  loopOverloaded_ = false;
 
   state_ = State::kDone;
   onConnectionsDrained();
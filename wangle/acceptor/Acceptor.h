@@ -10,17 +10,24 @@
 #pragma once
 
 #include <wangle/acceptor/ServerSocketConfig.h>
+#include <wangle/acceptor/ClientHelloStats.h>
 #include <wangle/acceptor/ConnectionCounter.h>
 #include <wangle/acceptor/ConnectionManager.h>
+#include <wangle/acceptor/GlobalConnectionLimiter.h>
 #include <wangle/acceptor/LoadShedConfiguration.h>
+#include <wangle/acceptor/SystemLoadSampler.h>
 #include <wangle/ssl/SSLCacheProvider.h>
+#include <wangle/ssl/SSLHandshakeAdmission.h>
 #include <wangle/acceptor/TransportInfo.h>
+#include <wangle/channel/MemoryBudget.h>
 
+#include <atomic>
 #include <chrono>
 #include <event.h>
 #include <folly/io/async/AsyncSSLSocket.h>
 #include <folly/io/async/AsyncServerSocket.h>
 #include <folly/io/async/AsyncUDPServerSocket.h>
+#include <vector>
 
 namespace folly { namespace wangle {
 class ManagedConnection;
@@ -32,6 +39,8 @@ class SocketAddress;
 class SSLContext;
 class AsyncTransport;
 class SSLContextManager;
+class AcceptorLoopLagProbe;
+class OffloadedSSLHandshakes;
 
 /**
  * An abstract acceptor for TCP-based network services.
@@ -85,10 +94,27 @@ class Acceptor :
    */
   void addSSLContextConfig(const SSLContextConfig& sslCtxConfig);
 
+  /**
+   * Replace the SSLContextConfigs, reusing the contexts of the unchanged
+   * ones; see SSLContextManager::resetSSLContextConfigs().  Certificates
+   * are loaded on loader if given.  Call from this acceptor's EventBase.
+   */
+  void resetSSLContextConfigs(
+    const std::vector<SSLContextConfig>& sslCtxConfigs,
+    folly::Executor* loader = nullptr);
+
   SSLContextManager* getSSLContextManager() const {
     return sslCtxManager_.get();
   }
 
+  /**
+   * The admission control of SSL handshakes, if
+   * ServerSocketConfig::sslHandshakeAdmission is set; for its stats.
+   */
+  SSLHandshakeAdmission* getSSLHandshakeAdmission() const {
+    return handshakeAdmission_.get();
+  }
+
   /**
    * Return the number of outstanding connections in this service instance.
    */
@@ -97,6 +123,25 @@ class Acceptor :
       (uint32_t)downstreamConnectionManager_->getNumConnections() : 0;
   }
 
+  /**
+   * Like getNumConnections(), but safe to call from any thread, e.g. to
+   * balance new connections across acceptors.  Only kept up to date for
+   * subclasses that don't override onConnectionAdded() and
+   * onConnectionRemoved().
+   */
+  uint32_t getNumConnectionsRelaxed() const {
+    return numConnections_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Whether this acceptor's event loop is lagging, as last measured with
+   * ServerSocketConfig::loopLagProbeInterval set; false otherwise.  Safe
+   * to call from any thread.
+   */
+  bool isLoopOverloaded() const {
+    return loopOverloaded_.load(std::memory_order_relaxed);
+  }
+
   /**
    * Access the Acceptor's event base.
    */
@@ -148,10 +193,27 @@ class Acceptor :
    */
   virtual void forceStop();
 
+  /**
+   * Sets up, in the acceptor's thread, what its first connections would
+   * otherwise pay for: the thread's allocator caches for the buffers a
+   * connection starts with and, for SSL, an SSL object of the default
+   * context.  See ServerBootstrap::prewarm().
+   */
+  virtual void prewarm();
+
   bool isSSL() const { return accConfig_.isSSL(); }
 
   const ServerSocketConfig& getConfig() const { return accConfig_; }
 
+  /**
+   * Counts of what the sampled ClientHellos offered, see
+   * ServerSocketConfig::clientHelloSampleRate.  Only to be used from the
+   * acceptor's thread.
+   */
+  const ClientHelloStats& getClientHelloStats() const {
+    return clientHelloStats_;
+  }
+
   static uint64_t getTotalNumPendingSSLConns() {
     return totalNumPendingSSLConns_.load();
   }
@@ -186,12 +248,34 @@ class Acceptor :
    * Drop all connections.
    *
    * forceStop() schedules dropAllConnections() to be called in the acceptor's
-   * thread.
+   * thread.  Does nothing once the acceptor is done.
    */
   void dropAllConnections();
 
+  typedef std::vector<std::pair<int, folly::SocketAddress>>
+    AcceptedConnections;
+
+  /**
+   * Takes the connections accepted on another thread in one go, e.g. as
+   * handed over by ServerConnectionDispatcher.  Each connection goes
+   * through connectionAccepted(), overridden or not, but the load
+   * shedding limits are looked up once for the batch: connections that
+   * fit under them skip canAccept().
+   */
+  void connectionsAccepted(AcceptedConnections& conns) noexcept;
+
+  /**
+   * Takes a connection of a transport other than TCP, e.g. a ShmSocket,
+   * already attached to this acceptor's EventBase.  It's plaintext, and
+   * goes through canAccept() like any other.
+   */
+  void transportAccepted(AsyncSocket::UniquePtr sock,
+                         const folly::SocketAddress& clientAddr) noexcept;
+
  protected:
   friend class AcceptorHandshakeHelper;
+  friend class AcceptorLoopLagProbe;
+  friend class OffloadedHandshakeHelper;
 
   /**
    * Our event loop.
@@ -210,6 +294,19 @@ class Acceptor :
    */
   virtual bool canAccept(const folly::SocketAddress&);
 
+  /**
+   * How many more connections may be accepted without asking canAccept(),
+   * UINT64_MAX for no limit.  Subclasses whose canAccept() drops
+   * connections for reasons of its own should return 0.
+   */
+  virtual uint64_t getAcceptHeadroom();
+
+  /**
+   * Whether the system is past one of the CPU and memory limits of the
+   * load shedding configuration, as last sampled.
+   */
+  bool isSystemOverloaded() const;
+
   /**
    * Invoked when a new connection is created. This is where application starts
    * processing a new downstream connection.
@@ -275,8 +372,18 @@ class Acceptor :
 
   // ConnectionManager::Callback methods
   void onEmpty(const folly::wangle::ConnectionManager& cm);
-  void onConnectionAdded(const folly::wangle::ConnectionManager& /*cm*/) {}
-  void onConnectionRemoved(const folly::wangle::ConnectionManager& /*cm*/) {}
+  void onConnectionAdded(const folly::wangle::ConnectionManager& cm) {
+    numConnections_.store(cm.getNumConnections(), std::memory_order_relaxed);
+    if (connectionLease_) {
+      connectionLease_->onConnectionAdded();
+    }
+  }
+  void onConnectionRemoved(const folly::wangle::ConnectionManager& cm) {
+    numConnections_.store(cm.getNumConnections(), std::memory_order_relaxed);
+    if (connectionLease_) {
+      connectionLease_->onConnectionRemoved();
+    }
+  }
 
   /**
    * Process a connection that is to ready to receive L7 traffic.
@@ -294,6 +401,29 @@ class Acceptor :
     return loadShedConfig_;
   }
 
+  /**
+   * Count this acceptor's connections against limiter's cap, which the
+   * acceptors sharing it enforce together, and turn away non-whitelisted
+   * connections beyond it.  Connections already open when this is set
+   * aren't counted.  Call from the acceptor's thread; nullptr stops it.
+   */
+  void setConnectionLimiter(std::shared_ptr<GlobalConnectionLimiter> limiter) {
+    connectionLease_ = limiter ? limiter->newLease() : nullptr;
+  }
+
+  /**
+   * Turn away non-whitelisted connections while budget is overloaded.
+   * ServerBootstrap's acceptors also charge the pipelines they make to
+   * accounts of it; see MemoryBudget.
+   */
+  void setMemoryBudget(std::shared_ptr<folly::wangle::MemoryBudget> budget) {
+    memoryBudget_ = std::move(budget);
+  }
+
+  const std::shared_ptr<folly::wangle::MemoryBudget>& getMemoryBudget() const {
+    return memoryBudget_;
+  }
+
  protected:
   const ServerSocketConfig accConfig_;
   void setLoadShedConfig(const LoadShedConfiguration& from,
@@ -304,6 +434,8 @@ class Acceptor :
    */
   AsyncSocket::OptionMap socketOptions_;
 
+  // Ahead of sslCtxManager_, which refers to it
+  std::unique_ptr<SSLHandshakeAdmission> handshakeAdmission_;
   std::unique_ptr<SSLContextManager> sslCtxManager_;
 
   /**
@@ -334,16 +466,52 @@ class Acceptor :
    */
   void sslConnectionError();
 
+  /**
+   * Whether to parse sock's ClientHello, by clientHelloSampleRate; enables
+   * it if so.
+   */
+  bool sampleClientHello(AsyncSSLSocket* sock);
+
+  /**
+   * The rest of an SSL handshake that succeeded, from the TransportInfo
+   * and the stats on to sslConnectionReady(), or that failed, on to
+   * sslConnectionError(); for handshakes on this thread and on the
+   * sslHandshakeExecutor alike.
+   */
+  void sslHandshakeSucceeded(AsyncSSLSocket::UniquePtr sock,
+                             const folly::SocketAddress& clientAddr,
+                             std::chrono::steady_clock::time_point acceptTime,
+                             bool clientHelloSampled,
+                             TransportInfo& tinfo);
+  void sslHandshakeFailed(AsyncSSLSocket* sock,
+                          std::chrono::milliseconds elapsedTime,
+                          SSLErrorEnum error);
+
   void checkDrained();
 
   State state_{State::kInit};
   uint64_t numPendingSSLConns_{0};
+  std::atomic<uint32_t> numConnections_{0};
+  // Connections of the batch being taken that may skip canAccept()
+  uint64_t acceptHeadroom_{0};
 
   static std::atomic<uint64_t> totalNumPendingSSLConns_;
 
   bool forceShutdownInProgress_{false};
   LoadShedConfiguration loadShedConfig_;
   IConnectionCounter* connectionCounter_{nullptr};
+  std::shared_ptr<SystemLoadSampler> loadSampler_;
+  std::unique_ptr<GlobalConnectionLimiter::Lease> connectionLease_;
+  std::shared_ptr<folly::wangle::MemoryBudget> memoryBudget_;
+  std::unique_ptr<AcceptorLoopLagProbe> loopLagProbe_;
+  std::atomic<bool> loopOverloaded_{false};
+  // Created with the first handshake sent to the sslHandshakeExecutor
+  std::shared_ptr<OffloadedSSLHandshakes> offloadedHandshakes_;
+  // Connections made ready, for sampling their TCP_INFO
+  uint64_t tcpInfoCount_{0};
+  // SSL handshakes started, for sampling their ClientHellos
+  uint64_t clientHelloCount_{0};
+  ClientHelloStats clientHelloStats_;
   std::shared_ptr<SSLCacheProvider> cacheProvider_;
 };
 
@@ -0,0 +1,47 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/ClientHelloStats.h>
+
+#include <folly/io/async/AsyncSSLSocket.h>
+
+namespace folly {
+
+void ClientHelloStats::record(const AsyncSSLSocket* sock) {
+  std::string ciphers;
+  sock->getSSLClientCiphers(ciphers);
+  record(ciphers, sock->getSSLClientComprMethods(), sock->getSSLClientExts());
+}
+
+void ClientHelloStats::record(StringPiece ciphers,
+                              StringPiece comprMethods,
+                              StringPiece exts) {
+  ++samples_;
+  count(ciphers, ciphers_);
+  count(comprMethods, comprMethods_);
+  count(exts, extensions_);
+}
+
+void ClientHelloStats::clear() {
+  samples_ = 0;
+  ciphers_.clear();
+  comprMethods_.clear();
+  extensions_.clear();
+}
+
+void ClientHelloStats::count(StringPiece list, Histogram& histogram) {
+  while (!list.empty()) {
+    auto item = list.split_step(':');
+    if (!item.empty()) {
+      ++histogram[item.str()];
+    }
+  }
+}
+
+} // namespace
@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace folly {
+
+class AsyncSSLSocket;
+
+/**
+ * Counts what the sampled ClientHellos of an acceptor's handshakes
+ * offered: how often each cipher suite, compression method and TLS
+ * extension came up, for fingerprinting clients in aggregate rather
+ * than from a copy of the lists in every connection's TransportInfo.
+ *
+ * One per Acceptor, so it's only touched from the acceptor's thread;
+ * read it there too, e.g. from a runInEventBaseThread() when exporting.
+ */
+class ClientHelloStats {
+ public:
+  typedef std::map<std::string, uint64_t> Histogram;
+
+  // A socket whose ClientHello was parsed
+  void record(const AsyncSSLSocket* sock);
+
+  // The lists as AsyncSSLSocket has them, separated by ':'
+  void record(StringPiece ciphers,
+              StringPiece comprMethods,
+              StringPiece exts);
+
+  uint64_t getSamples() const {
+    return samples_;
+  }
+  const Histogram& getCiphers() const {
+    return ciphers_;
+  }
+  const Histogram& getComprMethods() const {
+    return comprMethods_;
+  }
+  const Histogram& getExtensions() const {
+    return extensions_;
+  }
+
+  void clear();
+
+ private:
+  static void count(StringPiece list, Histogram& histogram);
+
+  uint64_t samples_{0};
+  Histogram ciphers_;
+  Histogram comprMethods_;
+  Histogram extensions_;
+};
+
+} // namespace
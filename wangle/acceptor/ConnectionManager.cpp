@@ -9,25 +9,54 @@
  */
 
 #include <wangle/acceptor/ConnectionManager.h>
+#include <wangle/concurrent/MetricsRegistry.h>
 
+#include <algorithm>
+#include <cstdio>
 #include <glog/logging.h>
 #include <folly/io/async/EventBase.h>
+#include <folly/tracing/StaticTracepoint.h>
+
+#include <unistd.h>
 
 using folly::HHWheelTimer;
 using std::chrono::milliseconds;
 
 namespace folly { namespace wangle {
 
+namespace {
+
+struct Metrics {
+  MetricsRegistry::Counter added;
+  MetricsRegistry::Counter removed;
+};
+
+const Metrics& metrics() {
+  static const Metrics m = {
+    MetricsRegistry::getDefault().counter("connections.added"),
+    MetricsRegistry::getDefault().counter("connections.removed"),
+  };
+  return m;
+}
+
+}
+
 ConnectionManager::ConnectionManager(EventBase* eventBase,
     milliseconds timeout, Callback* callback)
   : connTimeouts_(new HHWheelTimer(eventBase)),
     callback_(callback),
     eventBase_(eventBase),
     idleIterator_(conns_.end()),
+    drainIterator_(conns_.end()),
     idleLoopCallback_(this),
+    drainPaceTimeout_(this),
     timeout_(timeout),
-    idleConnEarlyDropThreshold_(timeout_ / 2) {
-
+    idleConnEarlyDropThreshold_(timeout_ / 2),
+    memoryPressureTimeout_(this),
+    pressureIdleTimeout_(timeout_) {
+  for (auto& closed : numClosed_) {
+    closed.store(0, std::memory_order_relaxed);
+  }
 }
 
 void
@@ -39,7 +68,9 @@ ConnectionManager::addConnection(ManagedConnection* connection,
     if (oldMgr) {
       // 'connection' was being previously managed in a different thread.
       // We must remove it from that manager before adding it to this one.
-      oldMgr->removeConnection(connection);
+      oldMgr->removeConnection(connection, false);
+    } else {
+      connection->addedAt_ = std::chrono::steady_clock::now();
     }
 
     // put the connection into busy part first.  This should not matter at all
@@ -48,6 +79,9 @@ ConnectionManager::addConnection(ManagedConnection* connection,
     conns_.push_front(*connection);
 
     connection->setConnectionManager(this);
+    connection->idle_ = false;
+    increment(numAdded_);
+    metrics().added.add();
     if (callback_) {
       callback_->onConnectionAdded(*this);
     }
@@ -60,8 +94,18 @@ ConnectionManager::addConnection(ManagedConnection* connection,
 void
 ConnectionManager::scheduleTimeout(ManagedConnection* const connection,
     std::chrono::milliseconds timeout) {
-  if (timeout > std::chrono::milliseconds(0)) {
+  if (timeout <= std::chrono::milliseconds(0)) {
+    return;
+  }
+  if (!lazyIdleTimeouts_) {
     connTimeouts_->scheduleTimeout(connection, timeout);
+    return;
+  }
+  auto& lazy = connection->lazyIdleTimeout_;
+  lazy.deadline = std::chrono::steady_clock::now() + timeout;
+  if (!lazy.isScheduled() || lazy.deadline < lazy.firesAt) {
+    lazy.firesAt = lazy.deadline;
+    connTimeouts_->scheduleTimeout(&lazy, timeout);
   }
 }
 
@@ -71,11 +115,31 @@ void ConnectionManager::scheduleTimeout(
   connTimeouts_->scheduleTimeout(callback, timeout);
 }
 
+void
+ConnectionManager::cancelTimeout(ManagedConnection* const connection) {
+  connection->HHWheelTimer::Callback::cancelTimeout();
+  connection->lazyIdleTimeout_.cancelTimeout();
+}
+
 void
 ConnectionManager::removeConnection(ManagedConnection* connection) {
+  removeConnection(connection, true);
+}
+
+void
+ConnectionManager::removeConnection(ManagedConnection* connection,
+                                    bool closed) {
   if (connection->getConnectionManager() == this) {
-    connection->cancelTimeout();
+    cancelTimeout(connection);
     connection->setConnectionManager(nullptr);
+    increment(numRemoved_);
+    metrics().removed.add();
+    if (connection->idle_) {
+      increment(numIdle_, -1);
+    }
+    if (closed) {
+      onClosed(*connection);
+    }
 
     // Un-link the connection from our list, being careful to keep the iterator
     // that we're using for idle shedding valid
@@ -83,6 +147,9 @@ ConnectionManager::removeConnection(ManagedConnection* connection) {
     if (it == idleIterator_) {
       ++idleIterator_;
     }
+    if (it == drainIterator_) {
+      ++drainIterator_;
+    }
     conns_.erase(it);
 
     if (callback_) {
@@ -97,6 +164,7 @@ ConnectionManager::removeConnection(ManagedConnection* connection) {
 void
 ConnectionManager::initiateGracefulShutdown(
   std::chrono::milliseconds idleGrace) {
+  drainProgress_ = DrainProgress();
   if (idleGrace.count() > 0) {
     idleLoopCallback_.scheduleTimeout(idleGrace);
     VLOG(3) << "Scheduling idle grace period of " << idleGrace.count() << "ms";
@@ -112,13 +180,24 @@ ConnectionManager::drainAllConnections() {
   DestructorGuard g(this);
   size_t numCleared = 0;
   size_t numKept = 0;
+  size_t numNotified = 0;
 
-  auto it = idleIterator_ == conns_.end() ?
-    conns_.begin() : idleIterator_;
+  if (!draining_) {
+    drainIterator_ = conns_.begin();
+    draining_ = true;
+    drainProgress_.inProgress = true;
+    drainInterval_ = std::chrono::milliseconds(0);
+    if (drainWindow_.count() > 0 && !conns_.empty()) {
+      auto batches = (conns_.size() + drainBatchSize_ - 1) / drainBatchSize_;
+      drainInterval_ = drainWindow_ / batches;
+    }
+  }
 
-  while (it != conns_.end() && (numKept + numCleared) < 64) {
-    ManagedConnection& conn = *it++;
+  while (drainIterator_ != conns_.end() &&
+         (numNotified + numKept + numCleared) < drainBatchSize_) {
+    ManagedConnection& conn = *drainIterator_++;
     if (action_ == ShutdownAction::DRAIN1) {
+      numNotified++;
       conn.notifyPendingShutdown();
     } else {
       // Second time around: close idle sessions. If they aren't idle yet,
@@ -128,19 +207,40 @@ ConnectionManager::drainAllConnections() {
       } else {
         numCleared++;
       }
+      conn.setCloseReason(ManagedConnection::CloseReason::SHUTDOWN);
       conn.closeWhenIdle();
     }
   }
+  drainProgress_.notified += numNotified;
+  drainProgress_.closedIdle += numCleared;
+  drainProgress_.closeWhenIdle += numKept;
 
   if (action_ == ShutdownAction::DRAIN2) {
     VLOG(2) << "Idle connections cleared: " << numCleared <<
       ", busy conns kept: " << numKept;
   }
-  if (it != conns_.end()) {
-    idleIterator_ = it;
-    eventBase_->runInLoop(&idleLoopCallback_);
-  } else {
+  if (drainIterator_ != conns_.end()) {
+    scheduleDrainBatch();
+  } else if (action_ == ShutdownAction::DRAIN1) {
+    draining_ = false;
     action_ = ShutdownAction::DRAIN2;
+    drainProgress_.inProgress = idleLoopCallback_.isScheduled();
+    if (!idleLoopCallback_.isScheduled()) {
+      // The idle grace ran out while notifying
+      eventBase_->runInLoop(&idleLoopCallback_);
+    }
+  } else {
+    draining_ = false;
+    drainProgress_.inProgress = false;
+  }
+}
+
+void
+ConnectionManager::scheduleDrainBatch() {
+  if (drainInterval_.count() > 0) {
+    drainPaceTimeout_.scheduleTimeout(drainInterval_);
+  } else {
+    eventBase_->runInLoop(&idleLoopCallback_);
   }
 }
 
@@ -150,13 +250,20 @@ ConnectionManager::dropAllConnections() {
 
   // Iterate through our connection list, and drop each connection.
   VLOG(3) << "connections to drop: " << conns_.size();
+  FOLLY_SDT(wangle, connection_manager_drop_all, this, conns_.size());
   idleLoopCallback_.cancelTimeout();
+  drainPaceTimeout_.cancelTimeout();
+  memoryPressureTimeout_.cancelTimeout();
   unsigned i = 0;
   while (!conns_.empty()) {
     ManagedConnection& conn = conns_.front();
     conns_.pop_front();
-    conn.cancelTimeout();
+    cancelTimeout(&conn);
     conn.setConnectionManager(nullptr);
+    increment(numRemoved_);
+    metrics().removed.add();
+    conn.setCloseReason(ManagedConnection::CloseReason::DROPPED);
+    onClosed(conn);
     // For debugging purposes, dump information about the first few
     // connections.
     static const unsigned MAX_CONNS_TO_DUMP = 2;
@@ -166,6 +273,10 @@ ConnectionManager::dropAllConnections() {
     conn.dropConnection();
   }
   idleIterator_ = conns_.end();
+  drainIterator_ = conns_.end();
+  numIdle_.store(0, std::memory_order_relaxed);
+  draining_ = false;
+  drainProgress_.inProgress = false;
   idleLoopCallback_.cancelLoopCallback();
 
   if (callback_) {
@@ -175,17 +286,36 @@ ConnectionManager::dropAllConnections() {
 
 void
 ConnectionManager::onActivated(ManagedConnection& conn) {
+  if (conn.idle_) {
+    conn.idle_ = false;
+    increment(numIdle_, -1);
+  }
   auto it = conns_.iterator_to(conn);
   if (it == idleIterator_) {
     idleIterator_++;
   }
+  if (it == drainIterator_) {
+    drainIterator_++;
+  }
   conns_.erase(it);
   conns_.push_front(conn);
 }
 
 void
 ConnectionManager::onDeactivated(ManagedConnection& conn) {
+  if (!conn.idle_) {
+    conn.idle_ = true;
+    increment(numIdle_);
+  }
+  // Kept in the order of the idle list
+  conn.idleSince_ = std::chrono::steady_clock::now();
   auto it = conns_.iterator_to(conn);
+  if (it == idleIterator_) {
+    idleIterator_++;
+  }
+  if (it == drainIterator_) {
+    drainIterator_++;
+  }
   conns_.erase(it);
   conns_.push_back(conn);
   if (idleIterator_ == conns_.end()) {
@@ -193,13 +323,42 @@ ConnectionManager::onDeactivated(ManagedConnection& conn) {
   }
 }
 
+void
+ConnectionManager::onClosed(ManagedConnection& conn) {
+  increment(numClosed_[size_t(conn.getCloseReason())]);
+  lifetimes_.addValue(std::chrono::steady_clock::now() - conn.addedAt_);
+}
+
+ConnectionManager::Stats
+ConnectionManager::getStats() const {
+  Stats stats;
+  stats.numAdded = numAdded_.load(std::memory_order_relaxed);
+  stats.numRemoved = numRemoved_.load(std::memory_order_relaxed);
+  // The counters are read one by one, so this can be off while connections
+  // come and go
+  stats.numConnections = stats.numAdded > stats.numRemoved ?
+    stats.numAdded - stats.numRemoved : 0;
+  stats.numIdle = std::min(numIdle_.load(std::memory_order_relaxed),
+                           stats.numConnections);
+  for (size_t i = 0; i < size_t(ManagedConnection::CloseReason::MAX); i++) {
+    stats.numClosed[i] = numClosed_[i].load(std::memory_order_relaxed);
+  }
+  stats.lifetimes = lifetimes_;
+  return stats;
+}
+
 size_t
 ConnectionManager::dropIdleConnections(size_t num) {
   VLOG(4) << "attempt to drop " << num << " idle connections";
   if (idleConnEarlyDropThreshold_ >= timeout_) {
     return 0;
   }
+  return dropIdleConnectionsAbove(num, idleConnEarlyDropThreshold_);
+}
 
+size_t
+ConnectionManager::dropIdleConnectionsAbove(size_t num,
+                                            milliseconds threshold) {
   size_t count = 0;
   while(count < num) {
     auto it = idleIterator_;
@@ -208,14 +367,16 @@ ConnectionManager::dropIdleConnections(size_t num) {
     }
     auto idleTime = it->getIdleTime();
     if (idleTime == std::chrono::milliseconds(0) ||
-          idleTime <= idleConnEarlyDropThreshold_) {
+          idleTime <= threshold) {
       VLOG(4) << "conn's idletime: " << idleTime.count()
-              << ", earlyDropThreshold: " << idleConnEarlyDropThreshold_.count()
+              << ", earlyDropThreshold: " << threshold.count()
               << ", attempt to drop " << count << "/" << num;
       return count; // idleTime cannot be further reduced
     }
     ManagedConnection& conn = *it;
     idleIterator_++;
+    FOLLY_SDT(wangle, connection_manager_drop_idle, this, &conn,
+              idleTime.count());
     conn.timeoutExpired();
     count++;
   }
@@ -223,5 +384,74 @@ ConnectionManager::dropIdleConnections(size_t num) {
   return count;
 }
 
+void
+ConnectionManager::setMemoryPressure(MemoryPressureOptions options) {
+  CHECK(options.lowWatermark < options.highWatermark);
+  CHECK(options.interval.count() > 0);
+  memoryPressure_ = std::move(options);
+  pressureIdleTimeout_ = timeout_;
+  if (memoryPressure_.pressure) {
+    memoryPressureTimeout_.scheduleTimeout(memoryPressure_.interval);
+  } else {
+    memoryPressureTimeout_.cancelTimeout();
+  }
+}
+
+void
+ConnectionManager::checkMemoryPressure() {
+  DestructorGuard g(this);
+  memoryPressureTimeout_.scheduleTimeout(memoryPressure_.interval);
+
+  auto& options = memoryPressure_;
+  double pressure = options.pressure();
+  if (pressure <= options.lowWatermark) {
+    pressureIdleTimeout_ = timeout_;
+    return;
+  }
+  double fraction = std::min(
+    1.0, (pressure - options.lowWatermark) /
+         (options.highWatermark - options.lowWatermark));
+  auto minTimeout = std::min(options.minIdleTimeout, timeout_);
+  pressureIdleTimeout_ = timeout_ - milliseconds(int64_t(
+    (timeout_ - minTimeout).count() * fraction));
+  auto dropped = dropIdleConnectionsAbove(
+    numIdle_.load(std::memory_order_relaxed), pressureIdleTimeout_);
+  FOLLY_SDT(wangle, connection_manager_memory_pressure, this, pressure,
+            pressureIdleTimeout_.count(), dropped);
+  if (dropped > 0) {
+    VLOG(2) << "Memory pressure " << pressure << ": dropped " << dropped
+            << " connections idle for over " << pressureIdleTimeout_.count()
+            << "ms";
+  }
+}
+
+std::function<double()>
+ConnectionManager::rssPressure(uint64_t targetBytes) {
+  CHECK(targetBytes > 0);
+  static const long pageSize = sysconf(_SC_PAGESIZE);
+  return [targetBytes] {
+    // The second field is the resident pages
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) {
+      return 0.0;
+    }
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    int n = fscanf(f, "%lu %lu", &size, &resident);
+    fclose(f);
+    if (n != 2) {
+      return 0.0;
+    }
+    return double(resident) * pageSize / targetBytes;
+  };
+}
+
+std::function<double()>
+ConnectionManager::budgetPressure(std::shared_ptr<MemoryBudget> budget) {
+  CHECK(budget);
+  return [budget] {
+    return double(budget->getUsage()) / budget->getHighWatermark();
+  };
+}
 
 }} // folly::wangle
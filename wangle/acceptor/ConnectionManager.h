@@ -11,8 +11,13 @@
 #pragma once
 
 #include <wangle/acceptor/ManagedConnection.h>
+#include <wangle/channel/MemoryBudget.h>
+#include <wangle/concurrent/TaskLatencyHistogram.h>
 
+#include <atomic>
 #include <chrono>
+#include <functional>
+#include <memory>
 #include <folly/Memory.h>
 #include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/HHWheelTimer.h>
@@ -94,6 +99,11 @@ class ConnectionManager: public folly::DelayedDestruction,
   void scheduleTimeout(folly::HHWheelTimer::Callback* callback,
                        std::chrono::milliseconds timeout);
 
+  /**
+   * Cancel a connection's idle timeout, lazy or not.
+   */
+  void cancelTimeout(ManagedConnection* const connection);
+
   /**
    * Remove a connection from this ConnectionManager and, if
    * applicable, cancel the pending timeout callback that the
@@ -109,6 +119,44 @@ class ConnectionManager: public folly::DelayedDestruction,
    */
   void initiateGracefulShutdown(std::chrono::milliseconds idleGrace);
 
+  /**
+   * Progress of the last graceful shutdown, see initiateGracefulShutdown().
+   */
+  struct DrainProgress {
+    // Whether connections are still being notified or closed
+    bool inProgress{false};
+    // Connections told of the pending shutdown
+    uint64_t notified{0};
+    // Idle connections closed
+    uint64_t closedIdle{0};
+    // Busy connections told to close once idle
+    uint64_t closeWhenIdle{0};
+  };
+
+  const DrainProgress& getDrainProgress() const {
+    return drainProgress_;
+  }
+
+  /**
+   * Graceful shutdown notifies or closes at most this many connections per
+   * event loop iteration, so that in-flight requests keep being served.
+   */
+  void setDrainBatchSize(size_t batchSize) {
+    CHECK(batchSize > 0);
+    drainBatchSize_ = batchSize;
+  }
+
+  /**
+   * Spread each step of a graceful shutdown, notifying and then closing
+   * the connections, over about this long rather than going through the
+   * batches on consecutive loop iterations; 0, the default, doesn't wait.
+   * Keep it below the idle grace, or closing idle connections starts once
+   * all have been notified.
+   */
+  void setDrainWindow(std::chrono::milliseconds window) {
+    drainWindow_ = window;
+  }
+
   /**
    * Destroy all connections Managed by this ConnectionManager, even
    * the ones that are busy.
@@ -117,6 +165,30 @@ class ConnectionManager: public folly::DelayedDestruction,
 
   size_t getNumConnections() const { return conns_.size(); }
 
+  /**
+   * Aggregates over the connections of this manager.  The counters are
+   * totals since the manager was created; rates such as accepts or closes
+   * per second come from the difference between two snapshots.
+   */
+  struct Stats {
+    uint64_t numConnections{0};
+    // Connections with nothing outstanding, as of their last
+    // onActivated()/onDeactivated()
+    uint64_t numIdle{0};
+    uint64_t numAdded{0};
+    uint64_t numRemoved{0};
+    // Connections removed, by ManagedConnection::getCloseReason()
+    uint64_t numClosed[size_t(ManagedConnection::CloseReason::MAX)]{};
+    // How long the removed connections were managed
+    TaskLatencyHistogram lifetimes;
+  };
+
+  /**
+   * A snapshot of the stats, which only reads counters kept as connections
+   * come and go.  May be called from any thread.
+   */
+  Stats getStats() const;
+
   template <typename F>
   void iterateConns(F func) {
     auto it = conns_.begin();
@@ -136,12 +208,61 @@ class ConnectionManager: public folly::DelayedDestruction,
     idleConnEarlyDropThreshold_ = timeout;
   }
 
+  /**
+   * With lazy idle timeouts, resetting a connection's idle timeout, as done
+   * on every bit of activity, only records its new deadline instead of
+   * moving its timer; a timer that fires early is rescheduled for the
+   * remaining time.  This takes the timer churn off busy connections, at
+   * the cost of an extra timer per connection.  Cancelling it with
+   * ManagedConnection::cancelTimeout() cancels the lazy timer too.
+   * Set it before adding connections.
+   */
+  void setLazyIdleTimeouts(bool lazy) {
+    lazyIdleTimeouts_ = lazy;
+  }
+
   /**
    * try to drop num idle connections to release system resources.  Return the
    * actual number of dropped idle connections
    */
   size_t dropIdleConnections(size_t num);
 
+  /**
+   * Shortens the idle timeout as memory fills up, without anyone having to
+   * call setLoweredIdleTimeout() and dropIdleConnections() by hand.  Every
+   * interval, pressure() gives how full memory is, 1 being the target;
+   * between lowWatermark and highWatermark the idle timeout goes down in
+   * proportion, from the default one to minIdleTimeout, and idle
+   * connections idle for longer than it are closed, the longest idle
+   * first.  They come back to their own timeouts once pressure is below
+   * lowWatermark again.  See rssPressure() and budgetPressure().
+   */
+  struct MemoryPressureOptions {
+    std::function<double()> pressure;
+    double lowWatermark{0.8};
+    double highWatermark{1.0};
+    std::chrono::milliseconds minIdleTimeout{1000};
+    std::chrono::milliseconds interval{1000};
+  };
+
+  // From the event base thread; a null pressure turns it off
+  void setMemoryPressure(MemoryPressureOptions options);
+
+  // The process' resident memory against targetBytes
+  static std::function<double()> rssPressure(uint64_t targetBytes);
+
+  // The budget's usage against its high watermark
+  static std::function<double()> budgetPressure(
+      std::shared_ptr<MemoryBudget> budget);
+
+  /**
+   * The idle timeout memory pressure brought the connections down to, or
+   * the default one if there is none.
+   */
+  std::chrono::milliseconds getPressureIdleTimeout() const {
+    return pressureIdleTimeout_;
+  }
+
   /**
    * ManagedConnection::Callbacks
    */
@@ -165,6 +286,25 @@ class ConnectionManager: public folly::DelayedDestruction,
 
     void timeoutExpired() noexcept override {
       VLOG(3) << "Idle grace expired";
+      // A pass still notifying connections moves on to closing them once
+      // it is done
+      if (!manager_->draining_) {
+        manager_->drainAllConnections();
+      }
+    }
+
+   private:
+    ConnectionManager* manager_;
+  };
+
+  // Paces the drain batches when there is a drain window
+  class DrainPaceTimeout : public folly::AsyncTimeout {
+   public:
+    explicit DrainPaceTimeout(ConnectionManager* manager)
+        : folly::AsyncTimeout(manager->eventBase_),
+          manager_(manager) {}
+
+    void timeoutExpired() noexcept override {
       manager_->drainAllConnections();
     }
 
@@ -172,6 +312,21 @@ class ConnectionManager: public folly::DelayedDestruction,
     ConnectionManager* manager_;
   };
 
+  // Checks on memory pressure every MemoryPressureOptions::interval
+  class MemoryPressureTimeout : public folly::AsyncTimeout {
+   public:
+    explicit MemoryPressureTimeout(ConnectionManager* manager)
+        : folly::AsyncTimeout(manager->eventBase_),
+          manager_(manager) {}
+
+    void timeoutExpired() noexcept override {
+      manager_->checkMemoryPressure();
+    }
+
+   private:
+    ConnectionManager* manager_;
+  };
+
   enum class ShutdownAction : uint8_t {
     /**
      * Drain part 1: inform remote that you will soon reject new requests.
@@ -185,6 +340,16 @@ class ConnectionManager: public folly::DelayedDestruction,
 
   ~ConnectionManager() = default;
 
+  // Unlinks a connection; it only counts as closed if closed is set
+  void removeConnection(ManagedConnection* connection, bool closed);
+  void onClosed(ManagedConnection& conn);
+
+  static void increment(std::atomic<uint64_t>& counter, int64_t delta = 1) {
+    // Only the event base thread writes the counters
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
   ConnectionManager(const ConnectionManager&) = delete;
   ConnectionManager& operator=(ConnectionManager&) = delete;
 
@@ -195,11 +360,22 @@ class ConnectionManager: public folly::DelayedDestruction,
    */
   void drainAllConnections();
 
+  // Schedules the next batch of the current drain pass
+  void scheduleDrainBatch();
+
+  void checkMemoryPressure();
+
+  // Drops up to num of the idle connections idle for longer than threshold
+  size_t dropIdleConnectionsAbove(size_t num,
+                                  std::chrono::milliseconds threshold);
+
   /**
    * All the managed connections. idleIterator_ seperates them into two parts:
    * idle and busy ones.  [conns_.begin(), idleIterator_) are the busy ones,
    * while [idleIterator_, conns_.end()) are the idle one. Moreover, the idle
-   * ones are organized in the decreasing idle time order. */
+   * ones are organized in the decreasing idle time order, since they are
+   * appended as they go idle, so the longest idle ones can be found without
+   * looking at any other connection. */
   folly::CountedIntrusiveList<
     ManagedConnection,&ManagedConnection::listHook_> conns_;
 
@@ -212,11 +388,27 @@ class ConnectionManager: public folly::DelayedDestruction,
   /** Event base in which we run */
   folly::EventBase* eventBase_;
 
-  /** Iterator to the next connection to shed; used by drainAllConnections() */
-  folly::CountedIntrusiveList<
-    ManagedConnection,&ManagedConnection::listHook_>::iterator idleIterator_;
+  typedef folly::CountedIntrusiveList<
+    ManagedConnection,&ManagedConnection::listHook_>::iterator ConnIterator;
+
+  /** The first idle connection, or conns_.end() if none is idle */
+  ConnIterator idleIterator_;
+
+  /**
+   * Iterator to the next connection to shed; used by drainAllConnections().
+   * Kept apart from idleIterator_ so that shutting down doesn't disturb the
+   * idle ordering dropIdleConnections() relies on.
+   */
+  ConnIterator drainIterator_;
+  bool draining_{false};
   CloseIdleConnsCallback idleLoopCallback_;
+  DrainPaceTimeout drainPaceTimeout_;
   ShutdownAction action_{ShutdownAction::DRAIN1};
+  size_t drainBatchSize_{64};
+  std::chrono::milliseconds drainWindow_{0};
+  // Time between batches in the current pass, 0 for the next loop
+  std::chrono::milliseconds drainInterval_{0};
+  DrainProgress drainProgress_;
 
   /**
    * the default idle timeout for downstream sessions when no system resource
@@ -234,6 +426,18 @@ class ConnectionManager: public folly::DelayedDestruction,
    * time is less than idleConnEarlyDropThreshold_.
    */
   std::chrono::milliseconds idleConnEarlyDropThreshold_;
+
+  MemoryPressureOptions memoryPressure_;
+  MemoryPressureTimeout memoryPressureTimeout_;
+  std::chrono::milliseconds pressureIdleTimeout_;
+
+  bool lazyIdleTimeouts_{false};
+
+  std::atomic<uint64_t> numIdle_{0};
+  std::atomic<uint64_t> numAdded_{0};
+  std::atomic<uint64_t> numRemoved_{0};
+  std::atomic<uint64_t> numClosed_[size_t(ManagedConnection::CloseReason::MAX)];
+  TaskLatencyHistogram lifetimes_;
 };
 
 }} // folly::wangle
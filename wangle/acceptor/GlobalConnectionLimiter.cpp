@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/GlobalConnectionLimiter.h>
+
+#include <algorithm>
+
+namespace folly {
+
+std::unique_ptr<GlobalConnectionLimiter::Lease>
+GlobalConnectionLimiter::newLease() {
+  std::unique_ptr<Lease> lease(new Lease(shared_from_this()));
+  std::lock_guard<std::mutex> g(leasesLock_);
+  leases_.push_back(lease.get());
+  return lease;
+}
+
+int64_t GlobalConnectionLimiter::take(int64_t n) {
+  auto available = available_.load(std::memory_order_relaxed);
+  while (available > 0) {
+    auto got = std::min(available, n);
+    if (available_.compare_exchange_weak(
+          available, available - got, std::memory_order_relaxed)) {
+      return got;
+    }
+  }
+  return 0;
+}
+
+void GlobalConnectionLimiter::removeLease(Lease* lease) {
+  std::lock_guard<std::mutex> g(leasesLock_);
+  leases_.erase(std::remove(leases_.begin(), leases_.end(), lease),
+                leases_.end());
+}
+
+GlobalConnectionLimiter::Lease::~Lease() {
+  limiter_->removeLease(this);
+  // Connections still open count against the cap no more
+  auto held = spare_.load() + int64_t(numConnections_);
+  if (held > 0) {
+    limiter_->giveBack(held);
+  }
+}
+
+bool GlobalConnectionLimiter::Lease::hasQuota() {
+  return spare_.load(std::memory_order_relaxed) > 0 || refill();
+}
+
+void GlobalConnectionLimiter::Lease::onConnectionAdded() {
+  numConnections_++;
+  if (spare_.fetch_sub(1, std::memory_order_relaxed) <= 0) {
+    // Let in anyway; the debt is paid back from the next quota taken
+    refill();
+  }
+}
+
+void GlobalConnectionLimiter::Lease::onConnectionRemoved() {
+  if (numConnections_ == 0) {
+    return;
+  }
+  numConnections_--;
+  auto spare = spare_.fetch_add(1, std::memory_order_relaxed) + 1;
+  // Keep one lease worth around for the next connections
+  auto excess = spare - 2 * limiter_->leaseSize_;
+  if (excess > 0 &&
+      spare_.compare_exchange_strong(
+        spare, spare - excess, std::memory_order_relaxed)) {
+    limiter_->giveBack(excess);
+  }
+}
+
+bool GlobalConnectionLimiter::Lease::refill() {
+  auto spare = spare_.load(std::memory_order_relaxed);
+  // Enough to pay back any debt and have a lease worth left
+  auto want = limiter_->leaseSize_ - std::min<int64_t>(spare, 0);
+  auto got = limiter_->take(want);
+  if (got == 0) {
+    std::lock_guard<std::mutex> g(limiter_->leasesLock_);
+    for (auto lease : limiter_->leases_) {
+      if (lease != this) {
+        got += lease->steal();
+        if (got >= want) {
+          break;
+        }
+      }
+    }
+  }
+  if (got == 0) {
+    return false;
+  }
+  return spare_.fetch_add(got, std::memory_order_relaxed) + got > 0;
+}
+
+int64_t GlobalConnectionLimiter::Lease::steal() {
+  auto spare = spare_.load(std::memory_order_relaxed);
+  while (spare > 0) {
+    auto n = (spare + 1) / 2;
+    if (spare_.compare_exchange_weak(
+          spare, spare - n, std::memory_order_relaxed)) {
+      return n;
+    }
+  }
+  return 0;
+}
+
+}
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace folly {
+
+/**
+ * Caps the connections of all the Acceptors sharing it, see
+ * Acceptor::setConnectionLimiter(), without a shared counter on the
+ * accept and close paths.
+ *
+ * Each acceptor holds a Lease, which takes quota from the limiter in
+ * chunks of leaseSize connections and hands back what it doesn't need,
+ * so accepting and closing mostly touch only the lease's own counter.  A
+ * lease that runs out while the limiter has none left takes half of the
+ * spare quota of other leases.  The cap is approximate: connections
+ * whose handshake started before the quota ran out are let through.
+ */
+class GlobalConnectionLimiter
+    : public std::enable_shared_from_this<GlobalConnectionLimiter> {
+ public:
+  class Lease {
+   public:
+    ~Lease();
+
+    /**
+     * Whether another connection fits under the cap, taking quota from
+     * the limiter or other leases if this one has none left.
+     */
+    bool hasQuota();
+
+    // A connection was added or removed; from the lease owner's thread
+    void onConnectionAdded();
+    void onConnectionRemoved();
+
+    // Connections currently held by this lease
+    uint64_t getNumConnections() const {
+      return numConnections_;
+    }
+
+   private:
+    friend class GlobalConnectionLimiter;
+
+    explicit Lease(std::shared_ptr<GlobalConnectionLimiter> limiter)
+      : limiter_(std::move(limiter)) {}
+
+    bool refill();
+    // Takes half of the spare quota, rounded up; from any thread
+    int64_t steal();
+
+    std::shared_ptr<GlobalConnectionLimiter> limiter_;
+    // Quota taken from the limiter but not used yet; below zero while the
+    // lease holds more connections than it has quota for
+    std::atomic<int64_t> spare_{0};
+    uint64_t numConnections_{0};
+  };
+
+  static std::shared_ptr<GlobalConnectionLimiter> create(
+      uint64_t maxConnections, uint64_t leaseSize = 64) {
+    return std::shared_ptr<GlobalConnectionLimiter>(
+      new GlobalConnectionLimiter(maxConnections, leaseSize));
+  }
+
+  // A lease for one acceptor, to be used from its thread
+  std::unique_ptr<Lease> newLease();
+
+  uint64_t getMaxConnections() const {
+    return maxConnections_;
+  }
+
+  // Quota not leased out, which is an upper bound of the room left
+  uint64_t getUnleasedQuota() const {
+    auto available = available_.load(std::memory_order_relaxed);
+    return available > 0 ? available : 0;
+  }
+
+ private:
+  GlobalConnectionLimiter(uint64_t maxConnections, uint64_t leaseSize)
+    : maxConnections_(maxConnections),
+      leaseSize_(leaseSize > 0 ? leaseSize : 1),
+      available_(maxConnections) {}
+
+  // Takes up to n of the unleased quota; returns how much it got
+  int64_t take(int64_t n);
+  void giveBack(int64_t n) {
+    available_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  void removeLease(Lease* lease);
+
+  const uint64_t maxConnections_;
+  const int64_t leaseSize_;
+  std::atomic<int64_t> available_;
+
+  // Only looked at by leases that ran dry
+  std::mutex leasesLock_;
+  std::vector<Lease*> leases_;
+};
+
+}
@@ -20,24 +20,27 @@ void LoadShedConfiguration::addWhitelistAddr(folly::StringPiece input) {
   auto addr = input.str();
   size_t separator = addr.find_first_of('/');
   if (separator == string::npos) {
-    whitelistAddrs_.insert(SocketAddress(addr, 0));
+    SocketAddress address(addr, 0);
+    whitelistAddrs_.insert(address);
+    whitelistIPs_.insert(address.getIPAddress());
   } else {
     unsigned prefixLen = folly::to<unsigned>(addr.substr(separator + 1));
     addr.erase(separator);
-    whitelistNetworks_.insert(NetworkAddress(SocketAddress(addr, 0), prefixLen));
+    NetworkAddress network(SocketAddress(addr, 0), prefixLen);
+    whitelistNetworks_.insert(network);
+    whitelistTrie_.insert(network);
   }
 }
 
 bool LoadShedConfiguration::isWhitelisted(const SocketAddress& address) const {
-  if (whitelistAddrs_.find(address) != whitelistAddrs_.end()) {
-    return true;
+  if (address.getFamily() != AF_INET && address.getFamily() != AF_INET6) {
+    return false;
   }
-  for (auto& network : whitelistNetworks_) {
-    if (network.contains(address)) {
-      return true;
-    }
+  if (!whitelistIPs_.empty() &&
+      whitelistIPs_.count(address.getIPAddress()) > 0) {
+    return true;
   }
-  return false;
+  return whitelistTrie_.contains(address);
 }
 
 }
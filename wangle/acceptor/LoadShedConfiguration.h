@@ -16,8 +16,10 @@
 #include <list>
 #include <set>
 #include <string>
+#include <unordered_set>
 
 #include <wangle/acceptor/NetworkAddress.h>
+#include <wangle/acceptor/NetworkPrefixTrie.h>
 
 namespace folly {
 
@@ -49,7 +51,13 @@ class LoadShedConfiguration {
    * Set/get the set of IPs that should be whitelisted through even when we're
    * trying to shed load.
    */
-  void setWhitelistAddrs(const AddressSet& addrs) { whitelistAddrs_ = addrs; }
+  void setWhitelistAddrs(const AddressSet& addrs) {
+    whitelistAddrs_ = addrs;
+    whitelistIPs_.clear();
+    for (const auto& addr : whitelistAddrs_) {
+      whitelistIPs_.insert(addr.getIPAddress());
+    }
+  }
   const AddressSet& getWhitelistAddrs() const { return whitelistAddrs_; }
 
   /**
@@ -58,6 +66,10 @@ class LoadShedConfiguration {
    */
   void setWhitelistNetworks(const NetworkSet& networks) {
     whitelistNetworks_ = networks;
+    whitelistTrie_.clear();
+    for (const auto& network : whitelistNetworks_) {
+      whitelistTrie_.insert(network);
+    }
   }
   const NetworkSet& getWhitelistNetworks() const { return whitelistNetworks_; }
 
@@ -102,17 +114,31 @@ class LoadShedConfiguration {
   }
   std::chrono::milliseconds getLoadUpdatePeriod() const { return period_; }
 
+  /**
+   * Whether any of the CPU and memory limits is set; Acceptors then shed
+   * non-whitelisted connections while one of them is exceeded, sampling
+   * the system load every load update period.
+   */
+  bool hasSystemLoadLimits() const {
+    return period_.count() > 0 &&
+      (maxCpuUsage_ < 1.0 || maxMemUsage_ < 1.0 || minFreeMem_ > 0);
+  }
+
   bool isWhitelisted(const SocketAddress& addr) const;
 
  private:
 
   AddressSet whitelistAddrs_;
   NetworkSet whitelistNetworks_;
+  // Indexes of the above for isWhitelisted(), which runs on every accept
+  // while shedding load
+  std::unordered_set<IPAddress> whitelistIPs_;
+  NetworkPrefixTrie whitelistTrie_;
   uint64_t maxConnections_{0};
   uint64_t minFreeMem_{0};
-  double maxMemUsage_;
-  double maxCpuUsage_;
-  std::chrono::milliseconds period_;
+  double maxMemUsage_{1.0};
+  double maxCpuUsage_{1.0};
+  std::chrono::milliseconds period_{0};
 };
 
 }
@@ -12,6 +12,8 @@
 
 #include <wangle/acceptor/ConnectionManager.h>
 
+#include <algorithm>
+
 namespace folly { namespace wangle {
 
 ManagedConnection::ManagedConnection()
@@ -24,6 +26,15 @@ ManagedConnection::~ManagedConnection() {
   }
 }
 
+std::chrono::milliseconds
+ManagedConnection::getIdleTime() const {
+  if (!idle_) {
+    return std::chrono::milliseconds(0);
+  }
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - idleSince_);
+}
+
 void
 ManagedConnection::resetTimeout() {
   if (connectionManager_) {
@@ -38,6 +49,15 @@ ManagedConnection::resetTimeoutTo(std::chrono::milliseconds timeout) {
   }
 }
 
+void
+ManagedConnection::cancelTimeout() {
+  if (connectionManager_) {
+    connectionManager_->cancelTimeout(this);
+  } else {
+    HHWheelTimer::Callback::cancelTimeout();
+  }
+}
+
 void
 ManagedConnection::scheduleTimeout(
   folly::HHWheelTimer::Callback* callback,
@@ -47,6 +67,21 @@ ManagedConnection::scheduleTimeout(
   }
 }
 
+void
+ManagedConnection::LazyIdleTimeout::timeoutExpired() noexcept {
+  auto now = std::chrono::steady_clock::now();
+  if (now < deadline && conn_->connectionManager_) {
+    // There was activity since this was scheduled
+    auto remaining = std::max(
+      std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now),
+      std::chrono::milliseconds(1));
+    firesAt = deadline;
+    conn_->connectionManager_->scheduleTimeout(this, remaining);
+    return;
+  }
+  conn_->timeoutExpired();
+}
+
 ////////////////////// Globals /////////////////////
 
 std::ostream&
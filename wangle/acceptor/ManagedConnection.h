@@ -11,6 +11,7 @@
 #pragma once
 
 #include <folly/IntrusiveList.h>
+#include <chrono>
 #include <ostream>
 #include <folly/io/async/HHWheelTimer.h>
 #include <folly/io/async/DelayedDestruction.h>
@@ -30,6 +31,19 @@ class ManagedConnection:
 
   ManagedConnection();
 
+  /**
+   * Why a connection went away, as counted by ConnectionManager::getStats()
+   */
+  enum class CloseReason : uint8_t {
+    UNKNOWN = 0,
+    IDLE_TIMEOUT,
+    REMOTE_EOF,
+    TRANSPORT_ERROR,
+    SHUTDOWN,
+    DROPPED,
+    MAX,
+  };
+
   class Callback {
   public:
     virtual ~Callback() = default;
@@ -56,12 +70,12 @@ class ManagedConnection:
   virtual bool isBusy() const = 0;
 
   /**
-   * Get the idle time of the connection. If it returning 0, that means the idle
-   * connections will never be dropped during pre load shedding stage.
+   * Get the idle time of the connection: by default, since the connection
+   * manager was last told it went idle with onDeactivated(), and 0 while
+   * busy.  Connections with an idle time of 0 are never dropped during the
+   * pre load shedding stage.
    */
-  virtual std::chrono::milliseconds getIdleTime() const {
-    return std::chrono::milliseconds(0);
-  }
+  virtual std::chrono::milliseconds getIdleTime() const;
 
   /**
    * Notify the connection that a shutdown is pending. This method will be
@@ -105,6 +119,12 @@ class ManagedConnection:
    */
   void resetTimeoutTo(std::chrono::milliseconds);
 
+  /**
+   * Cancel the idle timeout.  Hides HHWheelTimer::Callback::cancelTimeout(),
+   * which would leave the timer of a lazy idle timeout to fire.
+   */
+  void cancelTimeout();
+
   // Schedule an arbitrary timeout on the HHWheelTimer
   virtual void scheduleTimeout(
     folly::HHWheelTimer::Callback* callback,
@@ -114,6 +134,19 @@ class ManagedConnection:
     return connectionManager_;
   }
 
+  /**
+   * Record why the connection is closing, for the connection manager's
+   * stats; the reason set last before the connection is removed from its
+   * manager counts.
+   */
+  void setCloseReason(CloseReason reason) {
+    closeReason_ = reason;
+  }
+
+  CloseReason getCloseReason() const {
+    return closeReason_;
+  }
+
  protected:
   virtual ~ManagedConnection();
 
@@ -124,7 +157,33 @@ class ManagedConnection:
     connectionManager_ = mgr;
   }
 
+  /**
+   * The idle timeout when the ConnectionManager has lazy idle timeouts on:
+   * resetting the timeout only moves deadline, and when the timer fires
+   * before it, it is rescheduled for the rest of the time.
+   */
+  class LazyIdleTimeout : public folly::HHWheelTimer::Callback {
+   public:
+    explicit LazyIdleTimeout(ManagedConnection* conn) : conn_(conn) {}
+
+    void timeoutExpired() noexcept override;
+
+    std::chrono::steady_clock::time_point deadline;
+    // When the timer is scheduled to fire, if it is
+    std::chrono::steady_clock::time_point firesAt;
+
+   private:
+    ManagedConnection* conn_;
+  };
+
   ConnectionManager* connectionManager_;
+  LazyIdleTimeout lazyIdleTimeout_{this};
+
+  // Kept up to date by the connection manager, for its stats
+  std::chrono::steady_clock::time_point addedAt_;
+  std::chrono::steady_clock::time_point idleSince_;
+  bool idle_{false};
+  CloseReason closeReason_{CloseReason::UNKNOWN};
 
   folly::SafeIntrusiveListHook listHook_;
 };
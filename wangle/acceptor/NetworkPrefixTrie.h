@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/IPAddress.h>
+#include <wangle/acceptor/NetworkAddress.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace folly {
+
+/**
+ * Binary trie of IPv4 and IPv6 networks, answering whether an address lies
+ * within any of them in one walk down the address' bits, however many
+ * networks there are.  Like NetworkAddress::contains(), IPv4 addresses
+ * only match IPv4 networks and IPv6 addresses IPv6 ones.
+ */
+class NetworkPrefixTrie {
+ public:
+  NetworkPrefixTrie() : v4_(1), v6_(1) {}
+
+  void insert(const NetworkAddress& network) {
+    const auto& ip = network.getAddress().getIPAddress();
+    auto& nodes = ip.isV4() ? v4_ : v6_;
+    auto bits = std::min<unsigned>(network.getPrefixLength(), ip.bitCount());
+    auto bytes = ip.bytes();
+    uint32_t node = 0;
+    for (unsigned i = 0; i < bits; i++) {
+      if (nodes[node].terminal) {
+        // Already covered by a shorter prefix
+        return;
+      }
+      auto bit = bitAt(bytes, i);
+      if (nodes[node].child[bit] == 0) {
+        nodes[node].child[bit] = nodes.size();
+        nodes.emplace_back();
+      }
+      node = nodes[node].child[bit];
+    }
+    nodes[node].terminal = true;
+  }
+
+  bool contains(const folly::SocketAddress& addr) const {
+    if (addr.getFamily() != AF_INET && addr.getFamily() != AF_INET6) {
+      return false;
+    }
+    const auto& ip = addr.getIPAddress();
+    const auto& nodes = ip.isV4() ? v4_ : v6_;
+    auto bits = ip.bitCount();
+    auto bytes = ip.bytes();
+    uint32_t node = 0;
+    for (unsigned i = 0; ; i++) {
+      if (nodes[node].terminal) {
+        return true;
+      }
+      if (i == bits) {
+        return false;
+      }
+      node = nodes[node].child[bitAt(bytes, i)];
+      if (node == 0) {
+        return false;
+      }
+    }
+  }
+
+  bool empty() const {
+    return v4_.size() == 1 && !v4_[0].terminal &&
+      v6_.size() == 1 && !v6_[0].terminal;
+  }
+
+  void clear() {
+    v4_.assign(1, Node());
+    v6_.assign(1, Node());
+  }
+
+ private:
+  struct Node {
+    // Index of the child for each bit value, 0 (the root) for none
+    uint32_t child[2]{0, 0};
+    bool terminal{false};
+  };
+
+  static unsigned bitAt(const unsigned char* bytes, unsigned i) {
+    return (bytes[i / 8] >> (7 - i % 8)) & 1;
+  }
+
+  std::vector<Node> v4_;
+  std::vector<Node> v6_;
+};
+
+} // namespace
@@ -9,11 +9,15 @@
  */
 #pragma once
 
+#include <wangle/ssl/AsyncCryptoProvider.h>
 #include <wangle/ssl/SSLCacheOptions.h>
 #include <wangle/ssl/SSLContextConfig.h>
+#include <wangle/ssl/SSLStats.h>
 #include <wangle/ssl/TLSTicketKeySeeds.h>
 #include <wangle/ssl/SSLUtil.h>
 #include <wangle/acceptor/SocketOptions.h>
+#include <wangle/channel/MemoryBudget.h>
+#include <wangle/concurrent/IOExecutor.h>
 
 #include <boost/optional.hpp>
 #include <chrono>
@@ -22,8 +26,12 @@
 #include <folly/SocketAddress.h>
 #include <folly/String.h>
 #include <folly/io/async/SSLContext.h>
+#include <glog/logging.h>
 #include <list>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <folly/io/async/AsyncSocket.h>
@@ -66,6 +74,58 @@ struct ServerSocketConfig {
     return socketOptions_;
   }
 
+  /**
+   * The options to apply on downstream connections: the socket options
+   * set above, plus the ones implied by the settings below that those
+   * don't already set.
+   */
+  AsyncSocket::OptionMap getAcceptedSocketOptions() const {
+    auto opts = socketOptions_;
+    if (tcpNoDelay) {
+      opts.emplace(AsyncSocket::OptionKey{IPPROTO_TCP, TCP_NODELAY}, 1);
+    }
+#ifdef TCP_QUICKACK
+    if (tcpQuickAck) {
+      opts.emplace(AsyncSocket::OptionKey{IPPROTO_TCP, TCP_QUICKACK}, 1);
+    }
+#endif
+#ifdef SO_BUSY_POLL
+    if (busyPoll.count() > 0) {
+      opts.emplace(AsyncSocket::OptionKey{SOL_SOCKET, SO_BUSY_POLL},
+                   busyPoll.count());
+    }
+#endif
+    return opts;
+  }
+
+  /**
+   * Applies the settings below that concern listening sockets to fd;
+   * options the system doesn't support are logged and skipped.
+   */
+  void applyListenerSocketOptions(int fd) const {
+    auto set = [fd](int level, int name, int value, const char* what) {
+      if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+        PLOG(WARNING) << "Unable to set " << what << " on listening socket";
+      }
+    };
+#ifdef TCP_FASTOPEN
+    if (fastOpenQueueSize > 0) {
+      set(IPPROTO_TCP, TCP_FASTOPEN, fastOpenQueueSize, "TCP_FASTOPEN");
+    }
+#endif
+#ifdef TCP_DEFER_ACCEPT
+    if (deferAccept.count() > 0) {
+      set(IPPROTO_TCP, TCP_DEFER_ACCEPT, deferAccept.count(),
+          "TCP_DEFER_ACCEPT");
+    }
+#endif
+#ifdef SO_INCOMING_CPU
+    if (incomingCpu >= 0) {
+      set(SOL_SOCKET, SO_INCOMING_CPU, incomingCpu, "SO_INCOMING_CPU");
+    }
+#endif
+  }
+
   bool hasExternalPrivateKey() const {
     for (const auto& cfg : sslContextConfigs) {
       if (!cfg.isLocalPrivateKey) {
@@ -90,6 +150,70 @@ struct ServerSocketConfig {
    */
   std::chrono::milliseconds connectionIdleTimeout{600000};
 
+  /**
+   * Track idle timeouts lazily, see ConnectionManager::setLazyIdleTimeouts().
+   */
+  bool lazyIdleTimeouts{false};
+
+  /**
+   * How many connections a graceful drain notifies or closes per loop
+   * iteration, and the time to spread each of its steps over; see
+   * ConnectionManager::setDrainBatchSize() and setDrainWindow().
+   */
+  uint32_t drainBatchSize{64};
+  std::chrono::milliseconds drainWindow{0};
+
+  /**
+   * Length of the TCP Fast Open queue of the listening sockets, which lets
+   * returning clients send their first request with the SYN; 0 disables
+   * it.  The net.ipv4.tcp_fastopen sysctl has to allow it, too.
+   */
+  uint32_t fastOpenQueueSize{0};
+
+  /**
+   * With TCP_DEFER_ACCEPT, connections are only accepted once the client
+   * sent data, for up to this long; 0 disables it.  Only suits protocols
+   * where the client speaks first.
+   */
+  std::chrono::seconds deferAccept{0};
+
+  /**
+   * Have the listening socket only take connections handled by this CPU
+   * (SO_INCOMING_CPU), for per-CPU SO_REUSEPORT listeners; -1 disables it.
+   */
+  int incomingCpu{-1};
+
+  /**
+   * How long to busy poll the device queue on blocking reads of downstream
+   * connections (SO_BUSY_POLL); 0 disables it.
+   */
+  std::chrono::microseconds busyPoll{0};
+
+  /**
+   * Defaults for downstream connections: disable Nagle's algorithm, and
+   * ack the first data right away instead of delaying the ack.
+   */
+  bool tcpNoDelay{false};
+  bool tcpQuickAck{false};
+
+  /**
+   * Fill in the TCP_INFO fields of the TransportInfo of every Nth
+   * connection, which costs a getsockopt() each; 0 never fills them in
+   * and leaves it to the application to call
+   * TransportInfo::initWithSocket() when it needs them.
+   */
+  uint32_t tcpInfoSampleRate{1};
+
+  /**
+   * With ClientHello parsing enabled by an SSLContextConfig, parse the
+   * ClientHello of every Nth SSL handshake only, and count what it
+   * offered in the acceptor's ClientHelloStats; 0 parses none.  Unless
+   * clientHelloInTransportInfo, the sampled lists go into the counts alone
+   * and not also into each connection's TransportInfo as strings.
+   */
+  uint32_t clientHelloSampleRate{1};
+  bool clientHelloInTransportInfo{true};
+
   /**
    * The address to bind to.
    */
@@ -98,7 +222,7 @@ struct ServerSocketConfig {
   /**
    * Options for controlling the SSL cache.
    */
-  SSLCacheOptions sslCacheOptions{std::chrono::seconds(600), 20480, 200};
+  SSLCacheOptions sslCacheOptions{std::chrono::seconds(600), 20480, 200, 0};
 
   /**
    * The initial TLS ticket seeds.
@@ -116,11 +240,70 @@ struct ServerSocketConfig {
    */
   bool strictSSL{true};
 
+  /**
+   * Performs the private key operations of the SSL contexts whose key
+   * isn't local, see hasExternalPrivateKey(); required for those.
+   */
+  std::shared_ptr<AsyncCryptoProvider> asyncCryptoProvider;
+
   /**
    * Maximum number of concurrent pending SSL handshakes
    */
   uint32_t maxConcurrentSSLHandshakes{30720};
 
+  /**
+   * Turn away full SSL handshakes, ahead of resumptions, while handshakes
+   * queue up on the acceptor's thread; see SSLHandshakeAdmission.  This
+   * adapts to the cost of the handshakes, which
+   * maxConcurrentSSLHandshakes, a plain count, can't.
+   */
+  bool sslHandshakeAdmission{false};
+
+  /**
+   * Where to run the SSL handshakes instead of the acceptor's thread, so
+   * a burst of full handshakes doesn't hold up the connections it serves:
+   * each goes to an EventBase of this executor, and its socket comes back
+   * to the acceptor once it's done.  Usually shared by all acceptors.
+   * Each of its EventBases gets SSL contexts and session caches of its
+   * own, for the acceptor, so sessions resume across them by ticket, with
+   * initialTicketSeeds set, or through an SSLCacheProvider.  Offloaded
+   * sockets aren't made with Acceptor::makeNewAsyncSSLSocket(), and
+   * sslHandshakeAdmission doesn't see these handshakes.
+   */
+  std::shared_ptr<folly::wangle::IOExecutor> sslHandshakeExecutor;
+
+  /**
+   * How often each acceptor measures how far behind its event loop runs,
+   * as the lateness of a timeout; 0 for never.  While Codel finds that
+   * lag too long (--codel_target_delay), the acceptor turns away new
+   * connections but whitelisted ones, and ServerWorkerPool hands them to
+   * other workers first.
+   */
+  std::chrono::milliseconds loopLagProbeInterval{0};
+
+  /**
+   * Where the acceptor, and its session caches and ticket key managers,
+   * record SSL stats; may be shared by acceptors.  See CountingSSLStats.
+   */
+  std::shared_ptr<SSLStats> sslStats;
+
+  /**
+   * Bounds what the acceptors' pipelines buffer, see
+   * Acceptor::setMemoryBudget(); usually shared by all of them.
+   */
+  std::shared_ptr<folly::wangle::MemoryBudget> memoryBudget;
+
+  /**
+   * Close idle connections early as memory fills up, see
+   * ConnectionManager::setMemoryPressure(): against this much resident
+   * memory of the process, or, with idleDropOnBudgetPressure, against the
+   * memoryBudget's high watermark.  Idle timeouts go down to
+   * minIdleTimeoutUnderPressure at most.
+   */
+  uint64_t idleDropRssTarget{0};
+  bool idleDropOnBudgetPressure{false};
+  std::chrono::milliseconds minIdleTimeoutUnderPressure{1000};
+
  private:
   AsyncSocket::OptionMap socketOptions_;
 };
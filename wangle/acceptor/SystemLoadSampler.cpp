@@ -0,0 +1,184 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/SystemLoadSampler.h>
+
+#include <folly/FileUtil.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace folly {
+
+namespace {
+
+bool parseUint(StringPiece s, uint64_t& value) {
+  if (s.empty()) {
+    return false;
+  }
+  value = 0;
+  for (auto c : s) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    value = value * 10 + (c - '0');
+  }
+  return true;
+}
+
+} // anonymous namespace
+
+std::shared_ptr<SystemLoadSampler> SystemLoadSampler::get(
+    std::chrono::milliseconds period) {
+  static std::mutex mutex;
+  static std::map<int64_t, std::weak_ptr<SystemLoadSampler>>* samplers =
+    new std::map<int64_t, std::weak_ptr<SystemLoadSampler>>();
+
+  std::lock_guard<std::mutex> g(mutex);
+  auto& weak = (*samplers)[period.count()];
+  auto sampler = weak.lock();
+  if (!sampler) {
+    sampler = std::make_shared<SystemLoadSampler>(period);
+    weak = sampler;
+  }
+  return sampler;
+}
+
+SystemLoadSampler::SystemLoadSampler(std::chrono::milliseconds period)
+    : period_(period) {
+  CHECK(period_ > std::chrono::milliseconds(0));
+  thread_ = std::thread([this]() { run(); });
+}
+
+SystemLoadSampler::~SystemLoadSampler() {
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void SystemLoadSampler::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    lock.unlock();
+    sample();
+    lock.lock();
+    cv_.wait_for(lock, period_, [this]() { return stopping_; });
+  }
+}
+
+void SystemLoadSampler::sample() {
+  std::string contents;
+  uint64_t busy, total;
+  if (readFile("/proc/stat", contents) &&
+      parseProcStat(contents, busy, total)) {
+    if (lastTotal_ > 0 && total > lastTotal_ && busy >= lastBusy_) {
+      cpuUsage_.store(double(busy - lastBusy_) / (total - lastTotal_),
+                      std::memory_order_relaxed);
+    }
+    lastBusy_ = busy;
+    lastTotal_ = total;
+  }
+
+  uint64_t available;
+  if (readFile("/proc/meminfo", contents) &&
+      parseMemInfo(contents, total, available) && total > 0) {
+    memUsage_.store(double(total - available) / total,
+                    std::memory_order_relaxed);
+    freeMem_.store(available, std::memory_order_relaxed);
+  }
+}
+
+bool SystemLoadSampler::parseProcStat(
+    StringPiece stat, uint64_t& busy, uint64_t& total) {
+  auto eol = stat.find('\n');
+  auto line = eol == StringPiece::npos ? stat : stat.subpiece(0, eol);
+  if (!line.startsWith("cpu ")) {
+    return false;
+  }
+  line.advance(4);
+  std::vector<StringPiece> fields;
+  split(' ', line, fields, true);
+  // user nice system idle [iowait irq softirq steal]; guest time is
+  // already counted in user
+  if (fields.size() < 4) {
+    return false;
+  }
+  total = 0;
+  uint64_t idle = 0;
+  for (size_t i = 0; i < fields.size() && i < 8; i++) {
+    uint64_t value;
+    if (!parseUint(fields[i], value)) {
+      return false;
+    }
+    total += value;
+    // idle and iowait
+    if (i == 3 || i == 4) {
+      idle += value;
+    }
+  }
+  busy = total - idle;
+  return true;
+}
+
+bool SystemLoadSampler::parseMemInfo(
+    StringPiece meminfo, uint64_t& total, uint64_t& available) {
+  uint64_t memTotal = 0, memAvailable = 0, memFree = 0, buffers = 0;
+  uint64_t cached = 0;
+  bool hasTotal = false, hasAvailable = false;
+
+  std::vector<StringPiece> lines;
+  split('\n', meminfo, lines, true);
+  for (auto line : lines) {
+    auto colon = line.find(':');
+    if (colon == StringPiece::npos) {
+      continue;
+    }
+    auto name = line.subpiece(0, colon);
+    auto rest = skipWhitespace(line.subpiece(colon + 1));
+    auto space = rest.find(' ');
+    uint64_t value;
+    if (!parseUint(
+          space == StringPiece::npos ? rest : rest.subpiece(0, space),
+          value)) {
+      continue;
+    }
+    // Values are in kB
+    auto bytes = value * 1024;
+    if (name == "MemTotal") {
+      memTotal = bytes;
+      hasTotal = true;
+    } else if (name == "MemAvailable") {
+      memAvailable = bytes;
+      hasAvailable = true;
+    } else if (name == "MemFree") {
+      memFree = bytes;
+    } else if (name == "Buffers") {
+      buffers = bytes;
+    } else if (name == "Cached") {
+      cached = bytes;
+    }
+  }
+  if (!hasTotal) {
+    return false;
+  }
+  total = memTotal;
+  available = hasAvailable ? memAvailable : memFree + buffers + cached;
+  if (available > total) {
+    available = total;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Range.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace folly {
+
+/**
+ * Samples the system's CPU and memory usage from /proc/stat and
+ * /proc/meminfo every period, on a thread of its own, and publishes the
+ * results in atomics so they are cheap to check on every accept.
+ *
+ * Acceptors share one sampler per period, see get().  Until the first
+ * period has passed, and on systems without /proc, the CPU usage reads 0
+ * and the memory is reported as all free.
+ */
+class SystemLoadSampler {
+ public:
+  /**
+   * The sampler with the given period, started on first use and stopped
+   * once the last user lets go of it.
+   */
+  static std::shared_ptr<SystemLoadSampler> get(
+    std::chrono::milliseconds period);
+
+  explicit SystemLoadSampler(std::chrono::milliseconds period);
+  ~SystemLoadSampler();
+
+  // Fraction of CPU time not idle over the last period, 0 to 1
+  double getCpuUsage() const {
+    return cpuUsage_.load(std::memory_order_relaxed);
+  }
+
+  // Fraction of memory in use, not counting reclaimable caches, 0 to 1
+  double getMemUsage() const {
+    return memUsage_.load(std::memory_order_relaxed);
+  }
+
+  // Bytes of memory available without swapping
+  uint64_t getFreeMem() const {
+    return freeMem_.load(std::memory_order_relaxed);
+  }
+
+  std::chrono::milliseconds getPeriod() const {
+    return period_;
+  }
+
+  /**
+   * Parses the aggregate "cpu" line of /proc/stat into the jiffies spent
+   * busy and in total.
+   */
+  static bool parseProcStat(
+    folly::StringPiece stat, uint64_t& busy, uint64_t& total);
+
+  /**
+   * Parses /proc/meminfo into the total and available memory, in bytes.
+   * Kernels without MemAvailable count free memory, buffers and the page
+   * cache as available.
+   */
+  static bool parseMemInfo(
+    folly::StringPiece meminfo, uint64_t& total, uint64_t& available);
+
+ private:
+  void run();
+  void sample();
+
+  const std::chrono::milliseconds period_;
+  std::atomic<double> cpuUsage_{0};
+  std::atomic<double> memUsage_{0};
+  std::atomic<uint64_t> freeMem_{std::numeric_limits<uint64_t>::max()};
+
+  // The last /proc/stat reading, for the next delta; sampler thread only
+  uint64_t lastBusy_{0};
+  uint64_t lastTotal_{0};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+  std::thread thread_;
+};
+
+}
@@ -11,8 +11,11 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <folly/ThreadLocal.h>
 #include <folly/io/async/AsyncSocket.h>
 
+#include <vector>
+
 using std::chrono::microseconds;
 using std::map;
 using std::string;
@@ -55,6 +58,25 @@ bool TransportInfo::initWithSocket(const AsyncSocket* sock) {
   return true;
 }
 
+std::shared_ptr<const std::string> TransportInfo::internString(
+    StringPiece s) {
+  // Beyond this many values, they are likely not few after all
+  static const size_t kMaxInterned = 64;
+  static ThreadLocal<std::vector<std::shared_ptr<const std::string>>> strings;
+
+  auto& interned = *strings;
+  for (const auto& str : interned) {
+    if (s == *str) {
+      return str;
+    }
+  }
+  auto str = std::make_shared<const std::string>(s.str());
+  if (interned.size() < kMaxInterned) {
+    interned.push_back(str);
+  }
+  return str;
+}
+
 int64_t TransportInfo::readRTT(const AsyncSocket* sock) {
 #if defined(__linux__) || defined(__FreeBSD__)
   struct tcp_info tcpinfo;
@@ -12,6 +12,8 @@
 #include <wangle/ssl/SSLUtil.h>
 
 #include <chrono>
+#include <folly/Range.h>
+#include <memory>
 #include <netinet/tcp.h>
 #include <string>
 
@@ -80,7 +82,7 @@ struct TransportInfo {
    * The name of the SSL ciphersuite used by the transaction's
    * transport.  Returns null if the transport is not SSL.
    */
-  std::shared_ptr<std::string> sslCipher{nullptr};
+  std::shared_ptr<const std::string> sslCipher{nullptr};
 
   /*
    * The SSL server name used by the transaction's
@@ -121,7 +123,7 @@ struct TransportInfo {
   /**
    * The result of SSL NPN negotiation.
    */
-  std::shared_ptr<std::string> sslNextProtocol{nullptr};
+  std::shared_ptr<const std::string> sslNextProtocol{nullptr};
 
   /*
    * total number of bytes sent over the connection
@@ -285,6 +287,15 @@ struct TransportInfo {
    */
   bool initWithSocket(const AsyncSocket* sock);
 
+  /*
+   * A shared copy of s, for the values of fields like sslCipher and
+   * sslNextProtocol that only take a few distinct values: connections of
+   * the same thread share one string per value instead of allocating
+   * their own, which is why it can't be modified.
+   */
+  static std::shared_ptr<const std::string> internString(
+      folly::StringPiece s);
+
   /*
    * Get the kernel's estimate of round-trip time (RTT) to the transport's peer
    * in microseconds. Returns -1 on error.
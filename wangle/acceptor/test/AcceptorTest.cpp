@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/Acceptor.h>
+#include <wangle/acceptor/TransportInfo.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+using namespace folly;
+
+namespace {
+
+// Records, for each connection, whether its tcp_info was read
+class SamplingAcceptor : public Acceptor {
+ public:
+  explicit SamplingAcceptor(const ServerSocketConfig& config)
+      : Acceptor(config) {}
+
+  void connect() {
+    TransportInfo tinfo;
+    AsyncSocket::UniquePtr sock(
+        new AsyncSocket(&evb_, socket(AF_INET, SOCK_STREAM, 0)));
+    connectionReady(std::move(sock), SocketAddress(), "", tinfo);
+  }
+
+  void onNewConnection(AsyncSocket::UniquePtr /*sock*/,
+                       const SocketAddress* /*address*/,
+                       const std::string& /*nextProtocolName*/,
+                       const TransportInfo& tinfo) override {
+    sampled.push_back(tinfo.validTcpinfo);
+  }
+
+  std::vector<bool> sampled;
+
+ private:
+  EventBase evb_;
+};
+
+std::vector<bool> sampleConnections(uint32_t rate, size_t n) {
+  ServerSocketConfig config;
+  config.tcpInfoSampleRate = rate;
+  SamplingAcceptor acceptor(config);
+  for (size_t i = 0; i < n; i++) {
+    acceptor.connect();
+  }
+  return acceptor.sampled;
+}
+
+}
+
+TEST(AcceptorTest, TcpInfoSampleRate) {
+  EXPECT_EQ(std::vector<bool>(4, true), sampleConnections(1, 4));
+  EXPECT_EQ((std::vector<bool>{false, false, true, false, false, true}),
+            sampleConnections(3, 6));
+  EXPECT_EQ(std::vector<bool>(4, false), sampleConnections(0, 4));
+}
+
+TEST(AcceptorTest, InternedStrings) {
+  const std::string* h2 = nullptr;
+  {
+    TransportInfo tinfo;
+    tinfo.sslNextProtocol = TransportInfo::internString("h2");
+    h2 = tinfo.sslNextProtocol.get();
+    EXPECT_EQ(h2, TransportInfo::internString("h2").get());
+  }
+  // Still there after the connection that made it is gone
+  auto again = TransportInfo::internString("h2");
+  EXPECT_EQ(h2, again.get());
+  EXPECT_EQ("h2", *again);
+
+  auto other = TransportInfo::internString("http/1.1");
+  EXPECT_NE(h2, other.get());
+  EXPECT_EQ("http/1.1", *other);
+}
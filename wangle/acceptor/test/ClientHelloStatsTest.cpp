@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/ClientHelloStats.h>
+
+#include <gtest/gtest.h>
+
+using namespace folly;
+
+TEST(ClientHelloStatsTest, CountsEachItem) {
+  ClientHelloStats stats;
+  stats.record("c02b:c02f:009e", "00", "0:10:11");
+  stats.record("c02f:0035", "01:00", "10");
+  EXPECT_EQ(2, stats.getSamples());
+
+  const auto& ciphers = stats.getCiphers();
+  EXPECT_EQ(4, ciphers.size());
+  EXPECT_EQ(1, ciphers.at("c02b"));
+  EXPECT_EQ(2, ciphers.at("c02f"));
+  EXPECT_EQ(1, ciphers.at("0035"));
+  EXPECT_EQ(2, stats.getComprMethods().at("00"));
+  EXPECT_EQ(1, stats.getComprMethods().at("01"));
+  EXPECT_EQ(2, stats.getExtensions().at("10"));
+  EXPECT_EQ(1, stats.getExtensions().at("11"));
+}
+
+TEST(ClientHelloStatsTest, SkipsEmptyItems) {
+  ClientHelloStats stats;
+  stats.record("", "", "::5:");
+  EXPECT_EQ(1, stats.getSamples());
+  EXPECT_TRUE(stats.getCiphers().empty());
+  EXPECT_TRUE(stats.getComprMethods().empty());
+  EXPECT_EQ(1, stats.getExtensions().size());
+  EXPECT_EQ(1, stats.getExtensions().at("5"));
+
+  stats.clear();
+  EXPECT_EQ(0, stats.getSamples());
+  EXPECT_TRUE(stats.getExtensions().empty());
+}
@@ -0,0 +1,338 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/ConnectionManager.h>
+
+#include <folly/io/async/EventBase.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace folly;
+using namespace folly::wangle;
+using namespace std::chrono;
+
+namespace {
+
+class TestConnection : public ManagedConnection {
+ public:
+  explicit TestConnection(std::vector<TestConnection*>* dropped)
+      : dropped_(dropped) {}
+
+  ~TestConnection() override = default;
+
+  void timeoutExpired() noexcept override {
+    dropped_->push_back(this);
+    getConnectionManager()->removeConnection(this);
+  }
+
+  void describe(std::ostream& os) const override {}
+  bool isBusy() const override { return busy; }
+  void notifyPendingShutdown() override {
+    notified = true;
+    notifications++;
+    if (deactivateOnNotify) {
+      getConnectionManager()->onDeactivated(*deactivateOnNotify);
+    }
+  }
+  void closeWhenIdle() override {
+    // A busy one closes once the test makes it idle
+    closing = true;
+    if (!busy) {
+      getConnectionManager()->removeConnection(this);
+    }
+  }
+  void dropConnection() override {
+    getConnectionManager()->removeConnection(this);
+  }
+  void dumpConnectionState(uint8_t loglevel) override {}
+
+  bool busy{false};
+  bool notified{false};
+  bool closing{false};
+  int notifications{0};
+  // Goes idle while this one is being notified
+  TestConnection* deactivateOnNotify{nullptr};
+
+ private:
+  std::vector<TestConnection*>* dropped_;
+};
+
+class EmptyCallback : public ConnectionManager::Callback {
+ public:
+  void onEmpty(const ConnectionManager&) override {
+    emptied++;
+    emptiedAt = steady_clock::now();
+  }
+  void onConnectionAdded(const ConnectionManager&) override {}
+  void onConnectionRemoved(const ConnectionManager&) override {}
+
+  int emptied{0};
+  steady_clock::time_point emptiedAt;
+};
+
+class ConnectionManagerTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    cm_ = ConnectionManager::makeUnique(&evb_, milliseconds(10000),
+                                        &callback_);
+  }
+
+  void setMemoryPressure(milliseconds minIdleTimeout) {
+    ConnectionManager::MemoryPressureOptions options;
+    options.pressure = [this] { return pressure_; };
+    options.lowWatermark = 0.8;
+    options.highWatermark = 1.0;
+    options.minIdleTimeout = minIdleTimeout;
+    options.interval = milliseconds(5);
+    cm_->setMemoryPressure(std::move(options));
+  }
+
+  void setLazyIdleTimeouts(milliseconds timeout) {
+    cm_ = ConnectionManager::makeUnique(&evb_, timeout);
+    cm_->setLazyIdleTimeouts(true);
+  }
+
+  TestConnection* addConnection() {
+    conns_.emplace_back(new TestConnection(&dropped_));
+    cm_->addConnection(conns_.back().get());
+    return conns_.back().get();
+  }
+
+  void loopFor(int ms) {
+    evb_.runAfterDelay([this] { evb_.terminateLoopSoon(); }, ms);
+    evb_.loop();
+  }
+
+  EventBase evb_;
+  EmptyCallback callback_;
+  ConnectionManager::UniquePtr cm_;
+  double pressure_{0};
+  std::vector<TestConnection*> dropped_;
+  // Destroyed before the manager
+  std::vector<std::unique_ptr<TestConnection>> conns_;
+};
+
+}
+
+TEST_F(ConnectionManagerTest, IdleTime) {
+  auto conn = addConnection();
+  EXPECT_EQ(milliseconds(0), conn->getIdleTime());
+  cm_->onDeactivated(*conn);
+  std::this_thread::sleep_for(milliseconds(20));
+  EXPECT_GE(conn->getIdleTime(), milliseconds(20));
+  cm_->onActivated(*conn);
+  EXPECT_EQ(milliseconds(0), conn->getIdleTime());
+}
+
+TEST_F(ConnectionManagerTest, TimeoutShrinksBetweenWatermarks) {
+  setMemoryPressure(milliseconds(1000));
+  EXPECT_EQ(milliseconds(10000), cm_->getPressureIdleTimeout());
+
+  pressure_ = 0.9;
+  loopFor(20);
+  EXPECT_EQ(milliseconds(5500), cm_->getPressureIdleTimeout());
+
+  pressure_ = 1.5;
+  loopFor(20);
+  EXPECT_EQ(milliseconds(1000), cm_->getPressureIdleTimeout());
+
+  // Back to normal below the low watermark
+  pressure_ = 0.5;
+  loopFor(20);
+  EXPECT_EQ(milliseconds(10000), cm_->getPressureIdleTimeout());
+}
+
+TEST_F(ConnectionManagerTest, LongestIdleDroppedFirst) {
+  setMemoryPressure(milliseconds(100));
+  auto busy = addConnection();
+  auto c = addConnection();
+  auto b = addConnection();
+  auto a = addConnection();
+  auto fresh = addConnection();
+  cm_->onDeactivated(*c);
+  cm_->onDeactivated(*a);
+  cm_->onDeactivated(*b);
+  std::this_thread::sleep_for(milliseconds(10));
+  // Going idle again puts it at the end
+  cm_->onActivated(*a);
+  cm_->onDeactivated(*a);
+  std::this_thread::sleep_for(milliseconds(150));
+  cm_->onDeactivated(*fresh);
+
+  // Under no pressure, nothing is dropped
+  loopFor(20);
+  EXPECT_TRUE(dropped_.empty());
+
+  pressure_ = 2;
+  loopFor(20);
+  EXPECT_EQ(milliseconds(100), cm_->getPressureIdleTimeout());
+  ASSERT_EQ(3, dropped_.size());
+  EXPECT_EQ(c, dropped_[0]);
+  EXPECT_EQ(b, dropped_[1]);
+  EXPECT_EQ(a, dropped_[2]);
+  EXPECT_EQ(2, cm_->getNumConnections());
+  EXPECT_EQ(cm_.get(), busy->getConnectionManager());
+  EXPECT_EQ(cm_.get(), fresh->getConnectionManager());
+
+  pressure_ = 0;
+  loopFor(20);
+  EXPECT_EQ(milliseconds(10000), cm_->getPressureIdleTimeout());
+}
+
+TEST_F(ConnectionManagerTest, ShutdownCloseReason) {
+  typedef ManagedConnection::CloseReason CloseReason;
+  for (int i = 0; i < 3; i++) {
+    addConnection();
+  }
+
+  // Closed as the graceful shutdown asks them to
+  cm_->initiateGracefulShutdown(milliseconds(0));
+  loopFor(20);
+  EXPECT_EQ(0, cm_->getNumConnections());
+  auto stats = cm_->getStats();
+  EXPECT_EQ(3, stats.numClosed[size_t(CloseReason::SHUTDOWN)]);
+  EXPECT_EQ(0, stats.numClosed[size_t(CloseReason::UNKNOWN)]);
+  EXPECT_EQ(0, stats.numClosed[size_t(CloseReason::DROPPED)]);
+}
+
+TEST_F(ConnectionManagerTest, DrainBatchPerLoop) {
+  for (int i = 0; i < 10; i++) {
+    addConnection();
+  }
+  cm_->setDrainBatchSize(3);
+
+  cm_->initiateGracefulShutdown(milliseconds(0));
+  EXPECT_EQ(7, cm_->getNumConnections());
+  EXPECT_EQ(3, cm_->getDrainProgress().closedIdle);
+  // One more batch each loop
+  evb_.loopOnce();
+  EXPECT_EQ(4, cm_->getNumConnections());
+  evb_.loopOnce();
+  EXPECT_EQ(1, cm_->getNumConnections());
+  EXPECT_TRUE(cm_->getDrainProgress().inProgress);
+  evb_.loopOnce();
+  EXPECT_EQ(0, cm_->getNumConnections());
+  EXPECT_EQ(10, cm_->getDrainProgress().closedIdle);
+  EXPECT_FALSE(cm_->getDrainProgress().inProgress);
+  EXPECT_EQ(1, callback_.emptied);
+}
+
+TEST_F(ConnectionManagerTest, DrainWindowSpreadsBatches) {
+  for (int i = 0; i < 9; i++) {
+    addConnection();
+  }
+  cm_->setDrainBatchSize(3);
+  // Three batches, 30ms apart
+  cm_->setDrainWindow(milliseconds(90));
+
+  auto start = steady_clock::now();
+  cm_->initiateGracefulShutdown(milliseconds(0));
+  EXPECT_EQ(6, cm_->getNumConnections());
+  loopFor(10);
+  EXPECT_EQ(6, cm_->getNumConnections());
+  loopFor(120);
+  EXPECT_EQ(0, cm_->getNumConnections());
+  ASSERT_EQ(1, callback_.emptied);
+  EXPECT_GE(callback_.emptiedAt - start, milliseconds(50));
+}
+
+TEST_F(ConnectionManagerTest, DrainProgress) {
+  std::vector<TestConnection*> conns;
+  for (int i = 0; i < 5; i++) {
+    conns.push_back(addConnection());
+  }
+  auto busy = conns[2];
+  busy->busy = true;
+  cm_->setDrainBatchSize(2);
+
+  cm_->initiateGracefulShutdown(milliseconds(50));
+  EXPECT_EQ(2, cm_->getDrainProgress().notified);
+  loopFor(20);
+  // All notified, waiting out the idle grace
+  EXPECT_EQ(5, cm_->getDrainProgress().notified);
+  EXPECT_EQ(0, cm_->getDrainProgress().closedIdle);
+  EXPECT_TRUE(cm_->getDrainProgress().inProgress);
+  for (auto conn : conns) {
+    EXPECT_TRUE(conn->notified);
+  }
+
+  loopFor(100);
+  EXPECT_EQ(4, cm_->getDrainProgress().closedIdle);
+  EXPECT_EQ(1, cm_->getDrainProgress().closeWhenIdle);
+  EXPECT_FALSE(cm_->getDrainProgress().inProgress);
+  EXPECT_TRUE(busy->closing);
+  EXPECT_EQ(1, cm_->getNumConnections());
+  EXPECT_EQ(0, callback_.emptied);
+
+  // Drained once the busy one finishes
+  busy->busy = false;
+  cm_->removeConnection(busy);
+  EXPECT_EQ(1, callback_.emptied);
+}
+
+TEST_F(ConnectionManagerTest, DrainSurvivesDeactivation) {
+  std::vector<TestConnection*> conns;
+  for (int i = 0; i < 6; i++) {
+    conns.push_back(addConnection());
+  }
+  cm_->setDrainBatchSize(2);
+  // Drained newest first.  The first batch ends with conns[4], which
+  // moves conns[3], where the drain goes on from, to the back
+  conns[4]->deactivateOnNotify = conns[3];
+
+  cm_->initiateGracefulShutdown(milliseconds(50));
+  loopFor(20);
+  EXPECT_EQ(6, cm_->getDrainProgress().notified);
+  for (auto conn : conns) {
+    EXPECT_EQ(1, conn->notifications);
+  }
+
+  loopFor(100);
+  EXPECT_EQ(6, cm_->getDrainProgress().closedIdle);
+  EXPECT_EQ(0, cm_->getNumConnections());
+}
+
+TEST_F(ConnectionManagerTest, LazyResetPushesDeadlineOut) {
+  setLazyIdleTimeouts(milliseconds(100));
+  auto conn = addConnection();
+  conn->resetTimeout();
+  loopFor(60);
+  conn->resetTimeout();
+  // Past the first deadline, not the second
+  loopFor(60);
+  EXPECT_TRUE(dropped_.empty());
+  loopFor(150);
+  ASSERT_EQ(1, dropped_.size());
+  EXPECT_EQ(conn, dropped_[0]);
+}
+
+TEST_F(ConnectionManagerTest, LazyCancelPreventsExpiry) {
+  setLazyIdleTimeouts(milliseconds(100));
+  auto conn = addConnection();
+  conn->resetTimeout();
+  loopFor(60);
+  conn->resetTimeout();
+  conn->cancelTimeout();
+  loopFor(250);
+  EXPECT_TRUE(dropped_.empty());
+  EXPECT_EQ(cm_.get(), conn->getConnectionManager());
+}
+
+TEST_F(ConnectionManagerTest, LazyRemovalCancels) {
+  setLazyIdleTimeouts(milliseconds(100));
+  auto conn = addConnection();
+  conn->resetTimeout();
+  cm_->removeConnection(conn);
+  loopFor(150);
+  EXPECT_TRUE(dropped_.empty());
+  EXPECT_EQ(0, cm_->getNumConnections());
+}
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/GlobalConnectionLimiter.h>
+
+#include <gtest/gtest.h>
+
+using namespace folly;
+
+TEST(GlobalConnectionLimiterTest, CapsAcrossLeases) {
+  auto limiter = GlobalConnectionLimiter::create(10, 4);
+  auto a = limiter->newLease();
+  auto b = limiter->newLease();
+
+  int accepted = 0;
+  for (int i = 0; i < 20; i++) {
+    auto& lease = i % 2 ? a : b;
+    if (lease->hasQuota()) {
+      lease->onConnectionAdded();
+      accepted++;
+    }
+  }
+  EXPECT_EQ(10, accepted);
+  EXPECT_FALSE(a->hasQuota());
+  EXPECT_FALSE(b->hasQuota());
+
+  // Room freed on one lease can be used by the other
+  a->onConnectionRemoved();
+  EXPECT_TRUE(b->hasQuota());
+  b->onConnectionAdded();
+  EXPECT_FALSE(a->hasQuota());
+}
+
+TEST(GlobalConnectionLimiterTest, IdleLeaseGivesBack) {
+  auto limiter = GlobalConnectionLimiter::create(100, 4);
+  auto a = limiter->newLease();
+  for (int i = 0; i < 50; i++) {
+    ASSERT_TRUE(a->hasQuota());
+    a->onConnectionAdded();
+  }
+  for (int i = 0; i < 50; i++) {
+    a->onConnectionRemoved();
+  }
+  // At most two leases' worth stays with a
+  EXPECT_GE(limiter->getUnleasedQuota(), 92);
+
+  a.reset();
+  EXPECT_EQ(100, limiter->getUnleasedQuota());
+}
+
+TEST(GlobalConnectionLimiterTest, DestroyedLeaseReleasesConnections) {
+  auto limiter = GlobalConnectionLimiter::create(8, 2);
+  auto a = limiter->newLease();
+  for (int i = 0; i < 8; i++) {
+    ASSERT_TRUE(a->hasQuota());
+    a->onConnectionAdded();
+  }
+  auto b = limiter->newLease();
+  EXPECT_FALSE(b->hasQuota());
+  a.reset();
+  EXPECT_TRUE(b->hasQuota());
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/LoadShedConfiguration.h>
+
+#include <gtest/gtest.h>
+
+using namespace folly;
+
+TEST(LoadShedConfigurationTest, WhitelistAddrs) {
+  LoadShedConfiguration config;
+  config.addWhitelistAddr("10.1.2.3");
+  config.addWhitelistAddr("2401:db00::1");
+
+  EXPECT_TRUE(config.isWhitelisted(SocketAddress("10.1.2.3", 1234)));
+  EXPECT_FALSE(config.isWhitelisted(SocketAddress("10.1.2.4", 1234)));
+  EXPECT_TRUE(config.isWhitelisted(SocketAddress("2401:db00::1", 80)));
+  EXPECT_FALSE(config.isWhitelisted(SocketAddress("2401:db00::2", 80)));
+}
+
+TEST(LoadShedConfigurationTest, WhitelistNetworks) {
+  LoadShedConfiguration config;
+  config.addWhitelistAddr("10.0.0.0/8");
+  config.addWhitelistAddr("192.168.1.128/25");
+  config.addWhitelistAddr("2401:db00::/32");
+
+  EXPECT_TRUE(config.isWhitelisted(SocketAddress("10.200.3.4", 0)));
+  EXPECT_FALSE(config.isWhitelisted(SocketAddress("11.0.0.1", 0)));
+  EXPECT_TRUE(config.isWhitelisted(SocketAddress("192.168.1.200", 0)));
+  EXPECT_FALSE(config.isWhitelisted(SocketAddress("192.168.1.100", 0)));
+  EXPECT_TRUE(config.isWhitelisted(SocketAddress("2401:db00:1::5", 0)));
+  EXPECT_FALSE(config.isWhitelisted(SocketAddress("2401:db01::5", 0)));
+  // Families don't mix
+  EXPECT_FALSE(config.isWhitelisted(SocketAddress("::a00:1", 0)));
+}
+
+TEST(LoadShedConfigurationTest, SetWhitelistNetworks) {
+  LoadShedConfiguration config;
+  LoadShedConfiguration::NetworkSet networks;
+  networks.insert(NetworkAddress(SocketAddress("172.16.0.0", 0), 12));
+  networks.insert(NetworkAddress(SocketAddress("0.0.0.0", 0), 0));
+  config.setWhitelistNetworks(networks);
+  EXPECT_TRUE(config.isWhitelisted(SocketAddress("8.8.8.8", 0)));
+
+  networks.clear();
+  networks.insert(NetworkAddress(SocketAddress("172.16.0.0", 0), 12));
+  config.setWhitelistNetworks(networks);
+  EXPECT_FALSE(config.isWhitelisted(SocketAddress("8.8.8.8", 0)));
+  EXPECT_TRUE(config.isWhitelisted(SocketAddress("172.31.0.1", 0)));
+}
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/SystemLoadSampler.h>
+
+#include <gtest/gtest.h>
+
+using namespace folly;
+
+TEST(SystemLoadSamplerTest, ParseProcStat) {
+  uint64_t busy, total;
+  EXPECT_TRUE(SystemLoadSampler::parseProcStat(
+    "cpu  100 5 50 800 20 3 2 0 0 0\n"
+    "cpu0 50 2 25 400 10 1 1 0 0 0\n",
+    busy, total));
+  EXPECT_EQ(980, total);
+  EXPECT_EQ(160, busy);
+
+  EXPECT_FALSE(SystemLoadSampler::parseProcStat("intr 1 2 3\n", busy, total));
+  EXPECT_FALSE(SystemLoadSampler::parseProcStat("cpu  1 x 3 4\n", busy, total));
+}
+
+TEST(SystemLoadSamplerTest, ParseMemInfo) {
+  uint64_t total, available;
+  EXPECT_TRUE(SystemLoadSampler::parseMemInfo(
+    "MemTotal:        1000 kB\n"
+    "MemFree:          100 kB\n"
+    "MemAvailable:     400 kB\n"
+    "Buffers:           50 kB\n"
+    "Cached:           200 kB\n",
+    total, available));
+  EXPECT_EQ(1000 * 1024, total);
+  EXPECT_EQ(400 * 1024, available);
+
+  // Without MemAvailable, caches count as free
+  EXPECT_TRUE(SystemLoadSampler::parseMemInfo(
+    "MemTotal:        1000 kB\n"
+    "MemFree:          100 kB\n"
+    "Buffers:           50 kB\n"
+    "Cached:           200 kB\n",
+    total, available));
+  EXPECT_EQ(350 * 1024, available);
+
+  EXPECT_FALSE(SystemLoadSampler::parseMemInfo("", total, available));
+}
+
+TEST(SystemLoadSamplerTest, SharedPerPeriod) {
+  auto a = SystemLoadSampler::get(std::chrono::milliseconds(10));
+  auto b = SystemLoadSampler::get(std::chrono::milliseconds(10));
+  auto c = SystemLoadSampler::get(std::chrono::milliseconds(20));
+  EXPECT_EQ(a, b);
+  EXPECT_NE(a, c);
+  EXPECT_GE(a->getCpuUsage(), 0);
+  EXPECT_LE(a->getCpuUsage(), 1);
+}
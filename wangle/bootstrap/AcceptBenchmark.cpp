@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Accepted connections per second under a connect storm; each iteration is
+// one connection, accepted, set up and closed by the server
+
+#include <folly/Benchmark.h>
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <gflags/gflags.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+
+using namespace folly;
+using namespace folly::wangle;
+
+DEFINE_int32(workers, 4, "Worker IO threads");
+DEFINE_int32(burst, 256, "Connections opened before waiting for the server");
+
+typedef Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> BytesPipeline;
+
+class CloseOnEOF : public BytesToBytesHandler {
+ public:
+  void read(Context* ctx, IOBufQueue& q) override {
+    q.clear();
+  }
+  void readEOF(Context* ctx) override {
+    ctx->fireClose();
+  }
+};
+
+class CountingPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new BytesPipeline());
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(CloseOnEOF());
+    pipeline->finalize();
+    accepted++;
+    return pipeline;
+  }
+
+  std::atomic<uint64_t> accepted{0};
+};
+
+void connectStorm(uint iters, bool dispatch) {
+  BenchmarkSuspender bs;
+  auto factory = std::make_shared<CountingPipelineFactory>();
+  ServerBootstrap<BytesPipeline> server;
+  server.socketConfig.acceptBacklog = 4 * FLAGS_burst;
+  server.childPipeline(factory);
+  if (dispatch) {
+    server.workerSelection(
+      ServerWorkerPool::WorkerSelection::POWER_OF_TWO_CHOICES);
+  }
+  server.group(
+    std::make_shared<IOThreadPoolExecutor>(1),
+    std::make_shared<IOThreadPoolExecutor>(FLAGS_workers));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  sockaddr_storage addr;
+  auto addrLen = address.getAddress(&addr);
+  bs.dismiss();
+
+  std::vector<int> fds;
+  for (uint i = 0; i < iters; ) {
+    for (int j = 0; j < FLAGS_burst && i < iters; j++, i++) {
+      int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+      CHECK_GE(fd, 0);
+      PCHECK(connect(fd, (sockaddr*)&addr, addrLen) == 0);
+      fds.push_back(fd);
+    }
+    while (factory->accepted.load() < i) {
+      std::this_thread::yield();
+    }
+    for (auto fd : fds) {
+      close(fd);
+    }
+    fds.clear();
+  }
+
+  bs.rehire();
+  server.stop();
+  server.join();
+}
+
+BENCHMARK(acceptOnEachWorker, iters) {
+  connectStorm(iters, false);
+}
+
+BENCHMARK_RELATIVE(acceptAndDispatchBatches, iters) {
+  connectStorm(iters, true);
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
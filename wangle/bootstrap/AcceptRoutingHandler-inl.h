@@ -3,74 +3,167 @@
 
 namespace folly { namespace wangle {
 
+template <typename Pipeline, typename R>
+const size_t AcceptRoutingHandler<Pipeline, R>::kRoutingBufferSize;
+
+template <typename Pipeline, typename R>
+const size_t AcceptRoutingHandler<Pipeline, R>::kMaxPooledBuffers;
+
+/**
+ * Reads a connection for lightweightRouting until the routing handler has
+ * its routing data, into buffers from the AcceptRoutingHandler's pool.
+ */
+template <typename Pipeline, typename R>
+class AcceptRoutingHandler<Pipeline, R>::RoutingReader
+    : public folly::AsyncSocket::ReadCallback {
+ public:
+  RoutingReader(AcceptRoutingHandler<Pipeline, R>* owner,
+                std::shared_ptr<folly::AsyncSocket> socket,
+                std::shared_ptr<RoutingDataHandler<R>> handler)
+      : owner_(owner),
+        socket_(std::move(socket)),
+        handler_(std::move(handler)) {}
+
+  ~RoutingReader() {
+    close();
+    while (!queue_.empty()) {
+      auto buf = queue_.pop_front();
+      if (!buf->isShared()) {
+        owner_->returnBuffer(std::move(buf));
+      }
+    }
+  }
+
+  void start() {
+    socket_->setReadCB(this);
+  }
+
+  // The socket, no longer read here
+  std::shared_ptr<folly::AsyncSocket> release() {
+    socket_->setReadCB(nullptr);
+    return std::move(socket_);
+  }
+
+  void close() {
+    if (socket_) {
+      socket_->setReadCB(nullptr);
+      socket_->closeNow();
+      socket_.reset();
+    }
+  }
+
+  // The callbacks may retire this, though not delete it
+  void getReadBuffer(void** bufReturn, size_t* lenReturn) override {
+    if (tailroom_ == 0) {
+      auto buf = owner_->takeBuffer();
+      tailroom_ = buf->tailroom();
+      queue_.append(std::move(buf));
+    }
+    auto tail = queue_.preallocate(1, tailroom_);
+    *bufReturn = tail.first;
+    *lenReturn = tail.second;
+  }
+
+  void readDataAvailable(size_t len) noexcept override {
+    queue_.postallocate(len);
+    tailroom_ -= len;
+    handler_->read(nullptr, queue_);
+    if (queue_.empty()) {
+      // Taken by the parser
+      tailroom_ = 0;
+    }
+  }
+
+  void readEOF() noexcept override {
+    handler_->readEOF(nullptr);
+  }
+
+  void readErr(const folly::AsyncSocketException& ex) noexcept override {
+    handler_->readException(
+        nullptr,
+        folly::make_exception_wrapper<folly::AsyncSocketException>(ex));
+  }
+
+ private:
+  AcceptRoutingHandler<Pipeline, R>* owner_;
+  std::shared_ptr<folly::AsyncSocket> socket_;
+  std::shared_ptr<RoutingDataHandler<R>> handler_;
+  folly::IOBufQueue queue_{folly::IOBufQueue::cacheChainLength()};
+  // Of the last buffer in queue_
+  size_t tailroom_{0};
+};
+
 template <typename Pipeline, typename R>
 void AcceptRoutingHandler<Pipeline, R>::read(Context* ctx, void* conn) {
   populateAcceptors();
 
-  uint64_t connId = nextConnId_++;
   auto socket = std::shared_ptr<folly::AsyncSocket>(
       reinterpret_cast<folly::AsyncSocket*>(conn),
       folly::DelayedDestruction::Destructor());
+  eventBase_ = socket->getEventBase();
+
+  uint64_t connId = addSlot();
+  auto handler = routingHandlerFactory_->newHandler(connId, this);
+  auto& slot = slots_[uint32_t(connId)];
+  if (lightweightRouting_) {
+    slot.reader.reset(new RoutingReader(this, socket, handler));
+    slot.reader->start();
+    return;
+  }
 
   // Create a new routing pipeline for this connection to read from
   // the socket until it parses the routing data
-  DefaultPipeline::UniquePtr routingPipeline(new DefaultPipeline);
+  slot.pipeline.reset(new DefaultPipeline);
+  auto routingPipeline = slot.pipeline.get();
   routingPipeline->addBack(folly::wangle::AsyncSocketHandler(socket));
-  routingPipeline->addBack(routingHandlerFactory_->newHandler(connId, this));
+  routingPipeline->addBack(handler);
   routingPipeline->finalize();
 
   routingPipeline->transportActive();
-  routingPipelines_[connId] = std::move(routingPipeline);
 }
 
 template <typename Pipeline, typename R>
 void AcceptRoutingHandler<Pipeline, R>::onRoutingData(
     uint64_t connId, typename RoutingDataHandler<R>::RoutingData& routingData) {
-  // Get the routing pipeline corresponding to this connection
-  auto routingPipelineIter = routingPipelines_.find(connId);
-  DCHECK(routingPipelineIter != routingPipelines_.end());
-  auto routingPipeline = std::move(routingPipelineIter->second);
-  routingPipelines_.erase(routingPipelineIter);
-
-  // Fetch the socket from the pipeline and pause reading from the
-  // socket
-  auto socket = std::dynamic_pointer_cast<folly::AsyncSocket>(
-      routingPipeline->getTransport());
-  routingPipeline->transportInactive();
+  // Take the connection out of its slot and pause reading from the socket
+  auto slot = removeSlot(connId);
+  if (!slot.pipeline && !slot.reader) {
+    VLOG(4) << "Routing data for connection " << connId << " already gone";
+    return;
+  }
+  std::shared_ptr<folly::AsyncSocket> socket;
+  if (slot.reader) {
+    socket = slot.reader->release();
+    // Still on the stack
+    retiredReaders_.push_back(std::move(slot.reader));
+  } else {
+    socket = std::dynamic_pointer_cast<folly::AsyncSocket>(
+        slot.pipeline->getTransport());
+    slot.pipeline->transportInactive();
+  }
   socket->detachEventBase();
 
   // Hash based on routing data to pick a new acceptor
   uint64_t hash = std::hash<R>()(routingData.routingData);
-  auto acceptor = acceptors_[hash % acceptors_.size()];
-
-  // Switch to the new acceptor's thread
-  auto mwRoutingData =
-      folly::makeMoveWrapper<typename RoutingDataHandler<R>::RoutingData>(
-          std::move(routingData));
-  acceptor->getEventBase()->runInEventBaseThread([=]() mutable {
-    socket->attachEventBase(acceptor->getEventBase());
-
-    auto pipeline =
-        childPipelineFactory_->newPipeline(socket, mwRoutingData->routingData);
-    auto pipelinePtr = pipeline.get();
-    folly::DelayedDestruction::DestructorGuard dg(pipelinePtr);
-
-    auto connection =
-        new typename folly::ServerAcceptor<Pipeline>::ServerConnection(
-            std::move(pipeline));
-    acceptor->addConnection(connection);
-
-    pipelinePtr->transportActive();
-
-    // Pass in the buffered bytes to the pipeline
-    pipelinePtr->read(mwRoutingData->bufQueue);
-  });
+  auto index = workerSelector_->select(hash, acceptors_.size());
+  DCHECK(index < acceptors_.size());
+  auto& batch = handoffs_[index];
+  batch.emplace_back();
+  batch.back().socket = std::move(socket);
+  batch.back().routingData = std::move(routingData);
+  scheduleFlush();
 }
 
 template <typename Pipeline, typename R>
 void AcceptRoutingHandler<Pipeline, R>::onError(uint64_t connId) {
-  // Delete the pipeline. This will close and delete the socket as well.
-  routingPipelines_.erase(connId);
+  // Delete the pipeline or close the reader. This will close and delete
+  // the socket as well.
+  auto slot = removeSlot(connId);
+  if (slot.reader) {
+    slot.reader->close();
+    retiredReaders_.push_back(std::move(slot.reader));
+    scheduleFlush();
+  }
 }
 
 template <typename Pipeline, typename R>
@@ -81,6 +174,118 @@ void AcceptRoutingHandler<Pipeline, R>::populateAcceptors() {
   CHECK(server_);
   server_->forEachWorker(
       [&](folly::Acceptor* acceptor) { acceptors_.push_back(acceptor); });
+  handoffs_.resize(acceptors_.size());
+}
+
+template <typename Pipeline, typename R>
+uint64_t AcceptRoutingHandler<Pipeline, R>::addSlot() {
+  uint32_t index;
+  if (freeSlots_.empty()) {
+    slots_.emplace_back();
+    index = slots_.size() - 1;
+  } else {
+    index = freeSlots_.back();
+    freeSlots_.pop_back();
+  }
+  return (uint64_t(slots_[index].generation) << 32) | index;
+}
+
+template <typename Pipeline, typename R>
+typename AcceptRoutingHandler<Pipeline, R>::RoutingSlot
+AcceptRoutingHandler<Pipeline, R>::removeSlot(uint64_t connId) {
+  RoutingSlot slot;
+  uint32_t index = connId;
+  if (index >= slots_.size()) {
+    return slot;
+  }
+  auto& current = slots_[index];
+  if (current.generation != uint32_t(connId >> 32) ||
+      (!current.pipeline && !current.reader)) {
+    return slot;
+  }
+  slot.pipeline = std::move(current.pipeline);
+  slot.reader = std::move(current.reader);
+  current.generation++;
+  freeSlots_.push_back(index);
+  return slot;
+}
+
+template <typename Pipeline, typename R>
+void AcceptRoutingHandler<Pipeline, R>::scheduleFlush() {
+  if (flushScheduled_) {
+    return;
+  }
+  flushScheduled_ = true;
+  eventBase_->runInLoop([this]() {
+    flush();
+  });
+}
+
+template <typename Pipeline, typename R>
+void AcceptRoutingHandler<Pipeline, R>::flush() {
+  flushScheduled_ = false;
+  retiredReaders_.clear();
+
+  for (size_t i = 0; i < handoffs_.size(); i++) {
+    if (handoffs_[i].empty()) {
+      continue;
+    }
+    auto acceptor = acceptors_[i];
+    auto childPipelineFactory = childPipelineFactory_;
+    auto mwBatch = folly::makeMoveWrapper(std::move(handoffs_[i]));
+    handoffs_[i].clear();
+
+    // Switch to the new acceptor's thread
+    acceptor->getEventBase()->runInEventBaseThread([=]() mutable {
+      for (auto& handoff : *mwBatch) {
+        startConnection(acceptor, childPipelineFactory.get(), handoff);
+      }
+    });
+  }
+}
+
+template <typename Pipeline, typename R>
+void AcceptRoutingHandler<Pipeline, R>::startConnection(
+    folly::Acceptor* acceptor,
+    RoutingDataPipelineFactory<Pipeline, R>* childPipelineFactory,
+    Handoff& handoff) {
+  auto socket = std::move(handoff.socket);
+  socket->attachEventBase(acceptor->getEventBase());
+
+  auto pipeline = childPipelineFactory->newPipeline(
+      socket, handoff.routingData.routingData);
+  auto pipelinePtr = pipeline.get();
+  folly::DelayedDestruction::DestructorGuard dg(pipelinePtr);
+
+  auto connection =
+      new typename folly::ServerAcceptor<Pipeline>::ServerConnection(
+          std::move(pipeline));
+  acceptor->addConnection(connection);
+
+  pipelinePtr->transportActive();
+
+  // Pass in the buffered bytes to the pipeline
+  pipelinePtr->read(handoff.routingData.bufQueue);
+}
+
+template <typename Pipeline, typename R>
+std::unique_ptr<folly::IOBuf>
+AcceptRoutingHandler<Pipeline, R>::takeBuffer() {
+  if (bufferPool_.empty()) {
+    return folly::IOBuf::create(kRoutingBufferSize);
+  }
+  auto buf = std::move(bufferPool_.back());
+  bufferPool_.pop_back();
+  return buf;
+}
+
+template <typename Pipeline, typename R>
+void AcceptRoutingHandler<Pipeline, R>::returnBuffer(
+    std::unique_ptr<folly::IOBuf> buf) {
+  if (bufferPool_.size() < kMaxPooledBuffers) {
+    buf->clear();
+    bufferPool_.push_back(std::move(buf));
+  }
 }
 
 }} // namespace folly::wangle
@@ -3,6 +3,7 @@
 
 #include <wangle/bootstrap/RoutingDataHandler.h>
 #include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/bootstrap/WorkerSelector.h>
 #include <wangle/channel/Pipeline.h>
 
 namespace folly { namespace wangle {
@@ -19,6 +20,17 @@ namespace folly { namespace wangle {
  * to notify the AcceptRoutingHandler. AcceptRoutingHandler then pauses
  * reads from the socket, moves the connection over to the hashed
  * worker thread, and resumes reading from the socket on the child pipeline.
+ *
+ * With lightweightRouting, a connection gets a socket read callback instead
+ * of a routing pipeline, which reads into small buffers pooled by the
+ * handler, and the routing handler is called without a pipeline, so its
+ * parser mustn't use the Context.  Either way, connections routed to the
+ * same worker in one loop of the accepting thread are handed over at once.
+ *
+ * The worker is picked from std::hash of the routing data by the
+ * workerSelector, ModuloWorkerSelector unless given.  A consistent one
+ * such as JumpConsistentWorkerSelector keeps most routing data on its
+ * worker when the number of IO threads changes.
  */
 
 typedef folly::PipelineFactory<AcceptPipeline> AcceptPipelineFactory;
@@ -34,10 +46,16 @@ class AcceptRoutingHandler : public folly::wangle::InboundHandler<void*>,
       folly::ServerBootstrap<Pipeline>* server,
       std::shared_ptr<RoutingDataHandlerFactory<R>> routingHandlerFactory,
       std::shared_ptr<RoutingDataPipelineFactory<Pipeline, R>>
-          childPipelineFactory)
+          childPipelineFactory,
+      bool lightweightRouting = false,
+      std::shared_ptr<WorkerSelector> workerSelector = nullptr)
       : server_(CHECK_NOTNULL(server)),
         routingHandlerFactory_(routingHandlerFactory),
-        childPipelineFactory_(childPipelineFactory) {}
+        childPipelineFactory_(childPipelineFactory),
+        lightweightRouting_(lightweightRouting),
+        workerSelector_(workerSelector ?
+                        workerSelector :
+                        std::make_shared<ModuloWorkerSelector>()) {}
 
   // InboundHandler implementation
   void read(Context* ctx, void* conn) override;
@@ -49,16 +67,65 @@ class AcceptRoutingHandler : public folly::wangle::InboundHandler<void*>,
   void onError(uint64_t connId) override;
 
  private:
+  class RoutingReader;
+
+  static const size_t kRoutingBufferSize = 1024;
+  static const size_t kMaxPooledBuffers = 64;
+
+  // A connection until its routing data is parsed.  The connection ID is
+  // the slot's generation, bumped as each connection leaves it, over its
+  // index, so a late callback for an earlier connection in the slot
+  // doesn't reach the current one.
+  struct RoutingSlot {
+    DefaultPipeline::UniquePtr pipeline;
+    std::unique_ptr<RoutingReader> reader;
+    uint32_t generation{0};
+  };
+
+  // A connection on its way to a worker
+  struct Handoff {
+    std::shared_ptr<folly::AsyncSocket> socket;
+    typename RoutingDataHandler<R>::RoutingData routingData;
+  };
+
   void populateAcceptors();
 
+  // An empty slot for a new connection
+  uint64_t addSlot();
+  // Empty if connId's connection already left
+  RoutingSlot removeSlot(uint64_t connId);
+
+  // Hands the connections routed in this loop to their workers, and drops
+  // the readers done with
+  void scheduleFlush();
+  void flush();
+
+  static void startConnection(
+      folly::Acceptor* acceptor,
+      RoutingDataPipelineFactory<Pipeline, R>* childPipelineFactory,
+      Handoff& handoff);
+
+  std::unique_ptr<folly::IOBuf> takeBuffer();
+  void returnBuffer(std::unique_ptr<folly::IOBuf> buf);
+
   folly::ServerBootstrap<Pipeline>* server_;
   std::shared_ptr<RoutingDataHandlerFactory<R>> routingHandlerFactory_;
   std::shared_ptr<RoutingDataPipelineFactory<Pipeline, R>>
       childPipelineFactory_;
+  const bool lightweightRouting_;
+  std::shared_ptr<WorkerSelector> workerSelector_;
 
   std::vector<folly::Acceptor*> acceptors_;
-  std::map<uint64_t, DefaultPipeline::UniquePtr> routingPipelines_;
-  uint64_t nextConnId_{0};
+  folly::EventBase* eventBase_{nullptr};
+  // Before the readers, which give their buffers back
+  std::vector<std::unique_ptr<folly::IOBuf>> bufferPool_;
+  std::vector<RoutingSlot> slots_;
+  std::vector<uint32_t> freeSlots_;
+
+  // By acceptor
+  std::vector<std::vector<Handoff>> handoffs_;
+  std::vector<std::unique_ptr<RoutingReader>> retiredReaders_;
+  bool flushScheduled_{false};
 };
 
 template <typename Pipeline, typename R>
@@ -68,16 +135,23 @@ class AcceptRoutingPipelineFactory : public AcceptPipelineFactory {
       folly::ServerBootstrap<Pipeline>* server,
       std::shared_ptr<RoutingDataHandlerFactory<R>> routingHandlerFactory,
       std::shared_ptr<RoutingDataPipelineFactory<Pipeline, R>>
-          childPipelineFactory)
+          childPipelineFactory,
+      bool lightweightRouting = false,
+      std::shared_ptr<WorkerSelector> workerSelector = nullptr)
       : server_(CHECK_NOTNULL(server)),
         routingHandlerFactory_(routingHandlerFactory),
-        childPipelineFactory_(childPipelineFactory) {}
+        childPipelineFactory_(childPipelineFactory),
+        lightweightRouting_(lightweightRouting),
+        workerSelector_(workerSelector ?
+                        workerSelector :
+                        std::make_shared<ModuloWorkerSelector>()) {}
 
   AcceptPipeline::UniquePtr newPipeline(
       std::shared_ptr<folly::AsyncSocket>) override {
     AcceptPipeline::UniquePtr pipeline(new AcceptPipeline);
     pipeline->addBack(AcceptRoutingHandler<Pipeline, R>(
-        server_, routingHandlerFactory_, childPipelineFactory_));
+        server_, routingHandlerFactory_, childPipelineFactory_,
+        lightweightRouting_, workerSelector_));
     pipeline->finalize();
 
     return pipeline;
@@ -88,6 +162,8 @@ class AcceptRoutingPipelineFactory : public AcceptPipelineFactory {
   std::shared_ptr<RoutingDataHandlerFactory<R>> routingHandlerFactory_;
   std::shared_ptr<RoutingDataPipelineFactory<Pipeline, R>>
       childPipelineFactory_;
+  const bool lightweightRouting_;
+  std::shared_ptr<WorkerSelector> workerSelector_;
 };
 
 template <typename Pipeline, typename R>
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Server startup time: each iteration binds a SO_REUSEPORT listener on
+// every acceptor thread, ready to accept on every worker, and stops them
+
+#include <folly/Benchmark.h>
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <gflags/gflags.h>
+
+using namespace folly;
+using namespace folly::wangle;
+
+DEFINE_int32(workers, 4, "Worker IO threads");
+
+typedef Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> BytesPipeline;
+
+class NullPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    return nullptr;
+  }
+};
+
+void bindAcceptors(uint iters, size_t acceptors) {
+  BenchmarkSuspender bs;
+  auto factory = std::make_shared<NullPipelineFactory>();
+
+  for (uint i = 0; i < iters; i++) {
+    // The server joins its groups when it's destroyed
+    ServerBootstrap<BytesPipeline> server;
+    server.childPipeline(factory);
+    server.group(
+      std::make_shared<IOThreadPoolExecutor>(acceptors),
+      std::make_shared<IOThreadPoolExecutor>(FLAGS_workers));
+    bs.dismiss();
+    server.bind(0);
+    bs.rehire();
+  }
+}
+
+BENCHMARK_PARAM(bindAcceptors, 1);
+BENCHMARK_PARAM(bindAcceptors, 8);
+BENCHMARK_PARAM(bindAcceptors, 32);
+BENCHMARK_PARAM(bindAcceptors, 64);
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
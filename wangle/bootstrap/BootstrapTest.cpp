@@ -9,12 +9,31 @@
  */
 
 #include "wangle/bootstrap/ServerBootstrap.h"
+#include "wangle/bootstrap/AcceptRoutingHandler.h"
 #include "wangle/bootstrap/ClientBootstrap.h"
+#include "wangle/bootstrap/ConnectionPool.h"
+#include "wangle/bootstrap/DatagramServer.h"
+#include "wangle/bootstrap/RoutingDataHandler.h"
+#include "wangle/bootstrap/WorkerSelector.h"
+#include "wangle/channel/AsyncSocketHandler.h"
 #include "wangle/channel/Handler.h"
 
+#include <folly/Format.h>
+#include <folly/ScopeGuard.h>
+#include <folly/io/async/AsyncSSLSocket.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <boost/thread.hpp>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace folly::wangle;
 using namespace folly;
@@ -49,6 +68,18 @@ class TestPipelineFactory : public PipelineFactory<BytesPipeline> {
   std::atomic<int> pipelines{0};
 };
 
+class TestSocketPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new BytesPipeline());
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
 class TestAcceptor : public Acceptor {
 EventBase base_;
  public:
@@ -135,6 +166,253 @@ TEST(Bootstrap, ClientConnectionManagerTest) {
   CHECK(factory->pipelines == 2);
 }
 
+TEST(Bootstrap, ConnectionPoolTest) {
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+  auto base = EventBaseManager::get()->getEventBase();
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  ConnectionPool::Options options;
+  options.minIdle = 2;
+  auto pool = std::make_shared<ConnectionPool>(address, options);
+  pool->warm(base);
+  while (pool->getIdleCount(base) < 2) {
+    base->loopOnce();
+  }
+
+  // Handed an idle socket right away, and another one is connected
+  TestClient client;
+  client.pipelineFactory(std::make_shared<TestSocketPipelineFactory>());
+  client.connectionPool(pool);
+  auto future = client.connect(address);
+  EXPECT_TRUE(future.isReady());
+  EXPECT_TRUE(client.getPipeline()->getTransport()->good());
+  EXPECT_EQ(1, pool->getIdleCount(base));
+  while (pool->getIdleCount(base) < 2) {
+    base->loopOnce();
+  }
+
+  pool.reset();
+  server.stop();
+}
+
+TEST(Bootstrap, ConnectionPoolOutlivesEventBase) {
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  ConnectionPool::Options options;
+  options.minIdle = 2;
+  auto pool = std::make_shared<ConnectionPool>(address, options);
+  {
+    EventBase base;
+    pool->warm(&base);
+    while (pool->getIdleCount(&base) < 2) {
+      base.loopOnce();
+    }
+  }
+
+  // Its sockets went with it, and nothing is left to touch it
+  pool.reset();
+  server.stop();
+}
+
+TEST(Bootstrap, HappyEyeballsTest) {
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+  auto base = EventBaseManager::get()->getEventBase();
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  // Nothing listens on the first one, and its failure starts the next
+  // without waiting out the delay
+  TestClient client;
+  client.pipelineFactory(std::make_shared<TestSocketPipelineFactory>());
+  client.connectionAttemptDelay(std::chrono::milliseconds(60000));
+  auto future = client.connect(
+    {SocketAddress("127.0.0.1", 1), address},
+    std::chrono::milliseconds(5000));
+  EXPECT_FALSE(future.isReady());
+  while (!future.isReady()) {
+    base->loopOnce();
+  }
+  auto pipeline = future.value();
+  EXPECT_EQ(client.getPipeline(), pipeline);
+  EXPECT_TRUE(pipeline->getTransport()->good());
+
+  server.stop();
+}
+
+TEST(Bootstrap, ThreadSelectorTest) {
+  // Verify that connections get to the pipeline factory when they are
+  // assigned by the IO group's ThreadSelector
+
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.group(std::make_shared<IOThreadPoolExecutor>(
+      2,
+      std::make_shared<NamedThreadFactory>("IO Thread"),
+      EventBaseManager::get(),
+      std::make_shared<LeastPendingTasksThreadSelector>()));
+  server.useThreadSelector(true);
+  server.bind(0);
+  auto base = EventBaseManager::get()->getEventBase();
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  TestClient client;
+  client.pipelineFactory(std::make_shared<TestClientPipelineFactory>());
+  client.connect(address);
+
+  TestClient client2;
+  client2.pipelineFactory(std::make_shared<TestClientPipelineFactory>());
+  client2.connect(address);
+
+  base->loop();
+  server.stop();
+
+  CHECK(factory->pipelines == 2);
+}
+
+TEST(Bootstrap, LeastConnectionsTest) {
+  // Connections stay open, so each new one goes to the worker with the
+  // fewest, and four connections end up two per worker
+
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.workerSelection(ServerWorkerPool::WorkerSelection::LEAST_LOADED);
+  server.bind(0);
+  auto base = EventBaseManager::get()->getEventBase();
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  std::vector<std::unique_ptr<TestClient>> clients;
+  for (int i = 0; i < 4; i++) {
+    clients.emplace_back(new TestClient);
+    clients.back()->pipelineFactory(
+        std::make_shared<TestClientPipelineFactory>());
+    clients.back()->connect(address);
+    base->loop();
+  }
+
+  std::vector<uint32_t> counts;
+  server.forEachWorker([&](Acceptor* worker) {
+    worker->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+      [&]() {
+        counts.push_back(worker->getNumConnections());
+      });
+  });
+  server.stop();
+
+  CHECK(factory->pipelines == 4);
+  EXPECT_EQ(std::vector<uint32_t>({2, 2}), counts);
+}
+
+TEST(Bootstrap, LaggingWorkerTest) {
+  // One worker's loop falls behind by 20ms an iteration, past the Codel
+  // target, so new connections go to the other one
+
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.socketConfig.loopLagProbeInterval = std::chrono::milliseconds(1);
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.workerSelection(ServerWorkerPool::WorkerSelection::LEAST_LOADED);
+  server.bind(0);
+  auto base = EventBaseManager::get()->getEventBase();
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  Acceptor* lagging = nullptr;
+  server.forEachWorker([&](Acceptor* worker) {
+    if (!lagging) {
+      lagging = worker;
+    }
+  });
+  std::atomic<bool> stop(false);
+  std::function<void()> block = [&] {
+    /* sleep override */
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    if (!stop) {
+      lagging->getEventBase()->runInLoop(block);
+    }
+  };
+  lagging->getEventBase()->runInEventBaseThread(block);
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  EXPECT_TRUE(lagging->isLoopOverloaded());
+
+  std::vector<std::unique_ptr<TestClient>> clients;
+  for (int i = 0; i < 4; i++) {
+    clients.emplace_back(new TestClient);
+    clients.back()->pipelineFactory(
+        std::make_shared<TestClientPipelineFactory>());
+    clients.back()->connect(address);
+    base->loop();
+  }
+  stop = true;
+
+  std::vector<uint32_t> counts;
+  server.forEachWorker([&](Acceptor* worker) {
+    worker->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+      [&]() {
+        counts.push_back(worker->getNumConnections());
+      });
+  });
+  server.stop();
+
+  CHECK(factory->pipelines == 4);
+  EXPECT_EQ(0, counts[0]);
+  EXPECT_EQ(4, counts[1]);
+}
+
+TEST(Bootstrap, BatchedConnectionsAcceptedTest) {
+  // A batch handed over by the dispatcher goes through an override of
+  // connectionAccepted() like connections accepted one at a time
+
+  class CountingAcceptor : public TestAcceptor {
+   public:
+    void connectionAccepted(
+        int fd, const folly::SocketAddress& clientAddr) noexcept override {
+      accepted++;
+      Acceptor::connectionAccepted(fd, clientAddr);
+    }
+    int accepted{0};
+  };
+
+  CountingAcceptor acceptor;
+  Acceptor::AcceptedConnections conns;
+  folly::SocketAddress address("127.0.0.1", 1234);
+  for (int i = 0; i < 3; i++) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    close(fds[1]);
+    conns.emplace_back(fds[0], address);
+  }
+  acceptor.connectionsAccepted(conns);
+  EXPECT_EQ(3, acceptor.accepted);
+}
+
 TEST(Bootstrap, ServerAcceptGroupTest) {
   // Verify that server is using the accept IO group
 
@@ -260,6 +538,70 @@ TEST(Bootstrap, ExistingSocket) {
   server.bind(std::move(socket));
 }
 
+TEST(Bootstrap, SocketTakeover) {
+  TestServer server1;
+  server1.childPipeline(std::make_shared<TestPipelineFactory>());
+  server1.bind(0);
+  SocketAddress address;
+  server1.getSockets()[0]->getAddress(&address);
+
+  auto path = "/tmp/wangle_takeover_test." + std::to_string(getpid());
+  std::thread old([&]() {
+    server1.offerTakeover(path);
+  });
+
+  TestServer server2;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server2.childPipeline(factory);
+  // Until the old server listens on path
+  for (int attempt = 0; ; attempt++) {
+    try {
+      server2.takeOver(path);
+      break;
+    } catch (const std::exception& ex) {
+      CHECK(attempt < 100) << ex.what();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  old.join();
+  EXPECT_TRUE(server1.getSockets().empty());
+
+  SocketAddress taken;
+  server2.getSockets()[0]->getAddress(&taken);
+  EXPECT_EQ(address, taken);
+
+  auto base = EventBaseManager::get()->getEventBase();
+  TestClient client;
+  client.pipelineFactory(std::make_shared<TestClientPipelineFactory>());
+  client.connect(address);
+  base->loop();
+  server2.stop();
+
+  EXPECT_EQ(1, factory->pipelines);
+}
+
+TEST(Bootstrap, SocketTakeoverTimeout) {
+  auto path = "/tmp/wangle_takeover_timeout_test." + std::to_string(getpid());
+  std::atomic<bool> done{false};
+  bool privateSocket = false;
+  std::thread checker([&]() {
+    // Only for this user, while it waits
+    struct stat st;
+    while (!done && !privateSocket) {
+      privateSocket = ::stat(path.c_str(), &st) == 0 &&
+        (st.st_mode & 0777) == 0600;
+    }
+  });
+  EXPECT_THROW(
+    sendTakeoverSockets(path, TakeoverSockets(),
+                        std::chrono::milliseconds(200)),
+    std::runtime_error);
+  done = true;
+  checker.join();
+  EXPECT_TRUE(privateSocket);
+  EXPECT_NE(0, ::access(path.c_str(), F_OK));
+}
+
 std::atomic<int> connections{0};
 
 class TestHandlerPipeline : public InboundHandler<void*> {
@@ -310,6 +652,316 @@ TEST(Bootstrap, LoadBalanceHandler) {
   CHECK(connections == 1);
 }
 
+TEST(Bootstrap, PerThreadListenersTest) {
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.perThreadListeners(true);
+  server.bind(0);
+
+  // One listener per IO thread, all on the same port
+  CHECK(server.getSockets().size() == 2);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  SocketAddress address2;
+  server.getSockets()[1]->getAddress(&address2);
+  CHECK(address.getPort() == address2.getPort());
+
+  boost::barrier barrier(2);
+  auto thread = std::thread([&](){
+    TestClient client;
+    client.pipelineFactory(std::make_shared<TestClientPipelineFactory>());
+    client.connect(address);
+    EventBaseManager::get()->getEventBase()->loop();
+    barrier.wait();
+  });
+  barrier.wait();
+  server.stop();
+  thread.join();
+
+  CHECK(factory->pipelines == 1);
+}
+
+class CloseOnEOFHandler : public BytesToBytesHandler {
+ public:
+  void readEOF(Context* ctx) override {
+    ctx->fireClose();
+  }
+
+  void readException(Context* ctx, exception_wrapper e) override {
+    ctx->fireClose();
+  }
+};
+
+// A connected pair of TCP sockets on the loopback
+void tcpPair(int fds[2]) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(listener, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addrLen = sizeof(addr);
+  CHECK_EQ(0, bind(listener, (sockaddr*)&addr, addrLen));
+  CHECK_EQ(0, listen(listener, 1));
+  CHECK_EQ(0, getsockname(listener, (sockaddr*)&addr, &addrLen));
+  fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_EQ(0, connect(fds[1], (sockaddr*)&addr, addrLen));
+  fds[0] = accept(listener, nullptr, nullptr);
+  CHECK_GE(fds[0], 0);
+  close(listener);
+}
+
+TEST(Bootstrap, ServerConnectionCloseReasons) {
+  typedef ManagedConnection::CloseReason CloseReason;
+  EventBase base;
+  auto manager = ConnectionManager::makeUnique(
+      &base, std::chrono::milliseconds(60000));
+  std::vector<int> peers;
+  SCOPE_EXIT {
+    for (auto fd : peers) {
+      close(fd);
+    }
+  };
+  auto addConnection = [&] {
+    int fds[2];
+    tcpPair(fds);
+    peers.push_back(fds[1]);
+    BytesPipeline::UniquePtr pipeline(new BytesPipeline);
+    pipeline->addBack(
+        AsyncSocketHandler(AsyncSocket::newSocket(&base, fds[0])));
+    pipeline->addBack(CloseOnEOFHandler());
+    pipeline->finalize();
+    auto pipelinePtr = pipeline.get();
+    auto conn = new ServerAcceptor<BytesPipeline>::ServerConnection(
+        std::move(pipeline));
+    manager->addConnection(conn);
+    pipelinePtr->transportActive();
+    return conn;
+  };
+  auto closed = [&](CloseReason reason) {
+    return manager->getStats().numClosed[size_t(reason)];
+  };
+
+  addConnection()->timeoutExpired();
+  EXPECT_EQ(1, closed(CloseReason::IDLE_TIMEOUT));
+
+  addConnection();
+  shutdown(peers.back(), SHUT_WR);
+  while (closed(CloseReason::REMOTE_EOF) == 0) {
+    base.loopOnce();
+  }
+
+  // Reset by the peer
+  addConnection();
+  linger noLinger{1, 0};
+  setsockopt(peers.back(), SOL_SOCKET, SO_LINGER,
+             &noLinger, sizeof(noLinger));
+  close(peers.back());
+  peers.pop_back();
+  while (closed(CloseReason::TRANSPORT_ERROR) == 0) {
+    base.loopOnce();
+  }
+
+  EXPECT_EQ(0, manager->getNumConnections());
+  EXPECT_EQ(0, closed(CloseReason::UNKNOWN));
+}
+
+class PooledPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    pipelines++;
+    std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new BytesPipeline());
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(CloseOnEOFHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newUnboundPipeline() override {
+    return newPipeline(nullptr);
+  }
+
+  bool resetPipeline(
+      BytesPipeline* pipeline, std::shared_ptr<AsyncSocket> sock) override {
+    pipeline->getHandler<AsyncSocketHandler>(0)->resetSocket(sock);
+    if (sock) {
+      reused++;
+    } else {
+      released++;
+    }
+    return true;
+  }
+
+  std::atomic<int> pipelines{0};
+  std::atomic<int> released{0};
+  std::atomic<int> reused{0};
+};
+
+TEST(Bootstrap, PipelinePoolTest) {
+  TestServer server;
+  auto factory = std::make_shared<PooledPipelineFactory>();
+  server.childPipeline(factory);
+  server.pipelinePool(4, 1);
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+  EXPECT_EQ(1, factory->pipelines);
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  for (int i = 1; i <= 3; i++) {
+    EventBase base;
+    auto socket = AsyncSocket::newSocket(&base, address);
+    base.loop();
+    socket->closeNow();
+    while (factory->released < i) {
+      std::this_thread::yield();
+    }
+  }
+
+  server.stop();
+
+  // Every connection ran on the pipeline built up front
+  EXPECT_EQ(1, factory->pipelines);
+  EXPECT_EQ(3, factory->reused);
+}
+
+// Keeps the pipeline guarded for a while after closing it
+class GuardedCloseHandler : public BytesToBytesHandler {
+ public:
+  void readEOF(Context* ctx) override {
+    auto guard = std::make_shared<folly::DelayedDestruction::DestructorGuard>(
+      ctx->getPipeline());
+    ctx->getTransport()->getEventBase()->runAfterDelay([guard] {}, 50);
+    ctx->fireClose();
+  }
+};
+
+class GuardedPipelineFactory : public PooledPipelineFactory {
+ public:
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    pipelines++;
+    std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new BytesPipeline());
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(GuardedCloseHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+TEST(Bootstrap, PipelinePoolSkipsGuardedTest) {
+  TestServer server;
+  auto factory = std::make_shared<GuardedPipelineFactory>();
+  server.childPipeline(factory);
+  server.pipelinePool(4);
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  for (int i = 1; i <= 2; i++) {
+    EventBase base;
+    auto socket = AsyncSocket::newSocket(&base, address);
+    base.loop();
+    while (factory->pipelines + factory->reused < i) {
+      std::this_thread::yield();
+    }
+    socket->closeNow();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  server.stop();
+
+  // The first one was still guarded when its connection closed
+  EXPECT_EQ(2, factory->pipelines);
+  EXPECT_EQ(0, factory->reused);
+}
+
+TEST(Bootstrap, PrewarmTest) {
+  TestServer server;
+  auto factory = std::make_shared<PooledPipelineFactory>();
+  server.childPipeline(factory);
+  server.pipelinePool(4, 2);
+  server.group(std::make_shared<IOThreadPoolExecutor>(3));
+
+  std::atomic<int> prewarmed{0};
+  std::atomic<int> inThread{0};
+  server.prewarm([&](Acceptor* worker) {
+    prewarmed++;
+    if (worker->getEventBase()->isInEventBaseThread()) {
+      inThread++;
+    }
+    AsyncSocketHandler::prewarmThread(16, 4096);
+  });
+  server.bind(0);
+
+  // Every worker, in its thread, before the server listened
+  EXPECT_EQ(3, prewarmed);
+  EXPECT_EQ(3, inThread);
+  EXPECT_EQ(6, factory->pipelines);
+  server.stop();
+}
+
+TEST(Bootstrap, PrewarmErrorTest) {
+  TestServer server;
+  server.childPipeline(std::make_shared<TestPipelineFactory>());
+  server.prewarm([](Acceptor*) {
+    throw std::runtime_error("prewarm failed");
+  });
+  EXPECT_THROW(server.bind(0), std::runtime_error);
+  EXPECT_TRUE(server.getSockets().empty());
+}
+
+TEST(Bootstrap, ListenerSocketOptionsTest) {
+  TestServer server;
+  server.childPipeline(std::make_shared<TestPipelineFactory>());
+  server.socketConfig.fastOpenQueueSize = 16;
+  server.socketConfig.deferAccept = std::chrono::seconds(5);
+  server.bind(0);
+
+  auto socket =
+    std::dynamic_pointer_cast<AsyncServerSocket>(server.getSockets()[0]);
+  ASSERT_TRUE(socket);
+  for (auto fd : socket->getSockets()) {
+    int value = 0;
+    socklen_t len = sizeof(value);
+    ASSERT_EQ(0, getsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &value, &len));
+    EXPECT_GT(value, 0);
+  }
+  server.stop();
+}
+
+TEST(Bootstrap, LoopbackClientServerTest) {
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.bind("loopback:BootstrapTest");
+
+  TestClient client;
+  client.pipelineFactory(std::make_shared<TestSocketPipelineFactory>());
+  auto pipeline = client.connect("loopback:BootstrapTest").get();
+  EXPECT_TRUE(pipeline);
+  // Taken by a worker in its own time
+  while (factory->pipelines == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  server.stop();
+  EXPECT_EQ(1, factory->pipelines);
+
+  TestClient late;
+  late.pipelineFactory(std::make_shared<TestSocketPipelineFactory>());
+  EXPECT_THROW(late.connect("loopback:BootstrapTest").get(),
+               AsyncSocketException);
+}
+
 class TestUDPPipeline : public InboundHandler<void*> {
  public:
   void read(Context* ctx, void* conn) override { connections++; }
@@ -353,3 +1005,520 @@ TEST(Bootstrap, UDPClientServerTest) {
 
   CHECK(connections == 1);
 }
+
+class DatagramEchoHandler : public HandlerAdapter<Datagram&, Datagram> {
+ public:
+  void read(Context* ctx, Datagram& datagram) override {
+    ctx->fireWrite(std::move(datagram));
+  }
+};
+
+class DatagramEchoPipelineFactory : public DatagramPipelineFactory {
+ public:
+  DatagramPipeline::UniquePtr newPipeline(
+      std::shared_ptr<DatagramSocketHandler> transport) override {
+    DatagramPipeline::UniquePtr pipeline(new DatagramPipeline);
+    pipeline->addBack(transport);
+    pipeline->addBack(DatagramEchoHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+TEST(Bootstrap, DatagramServerEcho) {
+  DatagramSocketHandler::Options options;
+  options.readBatchSize = 4;
+  DatagramServer server(
+    std::make_shared<DatagramEchoPipelineFactory>(), options);
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.bind(SocketAddress("127.0.0.1", 0));
+  auto address = server.getAddress();
+  ASSERT_NE(0, address.getPort());
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_GE(fd, 0);
+  SCOPE_EXIT {
+    close(fd);
+  };
+  timeval timeout{5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  sockaddr_storage addr;
+  auto addrLen = address.getAddress(&addr);
+
+  // More than a batch, so some take a second recvmmsg()
+  const size_t kDatagrams = 10;
+  for (size_t i = 0; i < kDatagrams; i++) {
+    auto message = "datagram " + std::to_string(i);
+    auto sent = sendto(fd, message.data(), message.size(), 0,
+                       (sockaddr*)&addr, addrLen);
+    ASSERT_EQ(ssize_t(message.size()), sent);
+  }
+  std::set<std::string> echoed;
+  for (size_t i = 0; i < kDatagrams; i++) {
+    char buf[64];
+    auto len = recv(fd, buf, sizeof(buf), 0);
+    ASSERT_GT(len, 0);
+    echoed.insert(std::string(buf, len));
+  }
+  EXPECT_EQ(kDatagrams, echoed.size());
+  EXPECT_EQ(1, echoed.count("datagram 7"));
+  server.stop();
+}
+
+class DatagramRetainer : public InboundHandler<Datagram&> {
+ public:
+  DatagramRetainer(EventBase* base, size_t n) : base_(base), n_(n) {}
+
+  void read(Context* ctx, Datagram& datagram) override {
+    retained.push_back(std::move(datagram.data));
+    if (retained.size() == n_) {
+      base_->terminateLoopSoon();
+    }
+  }
+
+  std::vector<std::unique_ptr<IOBuf>> retained;
+
+ private:
+  EventBase* base_;
+  size_t n_;
+};
+
+TEST(Bootstrap, DatagramRetainedKeepsOwnBuffer) {
+  // Datagrams held on to don't keep the rest of their batch's memory
+  EventBase base;
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  ASSERT_GE(fd, 0);
+  SocketAddress address("127.0.0.1", 0);
+  sockaddr_storage addr;
+  auto addrLen = address.getAddress(&addr);
+  ASSERT_EQ(0, bind(fd, (sockaddr*)&addr, addrLen));
+  address.setFromLocalAddress(fd);
+  addrLen = address.getAddress(&addr);
+
+  DatagramSocketHandler::Options options;
+  options.readBatchSize = 8;
+  auto handler = std::make_shared<DatagramSocketHandler>(&base, fd, options);
+  const size_t kDatagrams = 3;
+  DatagramRetainer retainer(&base, kDatagrams);
+  DatagramPipeline::UniquePtr pipeline(new DatagramPipeline);
+  pipeline->addBack(handler);
+  pipeline->addBack(&retainer);
+  pipeline->finalize();
+  pipeline->transportActive();
+
+  int client = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_GE(client, 0);
+  SCOPE_EXIT {
+    close(client);
+  };
+  for (size_t i = 0; i < kDatagrams; i++) {
+    ASSERT_EQ(5, sendto(client, "hello", 5, 0, (sockaddr*)&addr, addrLen));
+  }
+  base.runAfterDelay([&] { base.terminateLoopSoon(); }, 5000);
+  base.loopForever();
+
+  ASSERT_EQ(kDatagrams, retainer.retained.size());
+  for (auto& buf : retainer.retained) {
+    EXPECT_EQ(5, buf->length());
+    EXPECT_LT(buf->capacity(), 2 * options.maxDatagramSize);
+  }
+  pipeline.reset();
+}
+
+class PrefixRoutingDataHandler : public RoutingDataHandler<std::string> {
+ public:
+  PrefixRoutingDataHandler(uint64_t connId, Callback* cob)
+      : RoutingDataHandler<std::string>(connId, cob) {}
+
+  bool peekRoutingData(io::Cursor cursor, std::string& routingData) override {
+    routingData = cursor.readFixedString(4);
+    return true;
+  }
+};
+
+class RecordingRoutingCallback
+    : public RoutingDataHandler<std::string>::Callback {
+ public:
+  void onRoutingData(
+      uint64_t connId,
+      RoutingDataHandler<std::string>::RoutingData& routingData) override {
+    routed++;
+    key = routingData.routingData;
+    buffers = routingData.bufQueue.front()->countChainElements();
+    length = routingData.bufQueue.chainLength();
+  }
+
+  void onError(uint64_t connId) override {}
+
+  int routed{0};
+  std::string key;
+  size_t buffers{0};
+  size_t length{0};
+};
+
+TEST(Bootstrap, RoutingDataPeek) {
+  RecordingRoutingCallback cob;
+  PrefixRoutingDataHandler handler(1, &cob);
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  // Not enough bytes yet, and nothing taken
+  q.append(IOBuf::copyBuffer("ab"));
+  handler.read(nullptr, q);
+  EXPECT_EQ(0, cob.routed);
+  EXPECT_EQ(2, q.chainLength());
+
+  q.append(IOBuf::copyBuffer("cdef"));
+  handler.read(nullptr, q);
+  EXPECT_EQ(1, cob.routed);
+  EXPECT_EQ("abcd", cob.key);
+  EXPECT_TRUE(q.empty());
+
+  // Everything handed on in the buffers it was read into
+  EXPECT_EQ(2, cob.buffers);
+  EXPECT_EQ(6, cob.length);
+}
+
+class RecordingRoutingHandlerFactory
+    : public RoutingDataHandlerFactory<std::string> {
+ public:
+  std::shared_ptr<RoutingDataHandler<std::string>> newHandler(
+      uint64_t connId,
+      RoutingDataHandler<std::string>::Callback* cob) override {
+    std::lock_guard<std::mutex> g(mutex);
+    connIds.push_back(connId);
+    callback = cob;
+    base = EventBaseManager::get()->getEventBase();
+    return std::make_shared<PrefixRoutingDataHandler>(connId, cob);
+  }
+
+  size_t handlers() {
+    std::lock_guard<std::mutex> g(mutex);
+    return connIds.size();
+  }
+
+  std::mutex mutex;
+  std::vector<uint64_t> connIds;
+  RoutingDataHandler<std::string>::Callback* callback{nullptr};
+  EventBase* base{nullptr};
+};
+
+class EchoHandler : public BytesToBytesHandler {
+ public:
+  void read(Context* ctx, IOBufQueue& q) override {
+    write(ctx, q.move());
+  }
+
+  void readEOF(Context* ctx) override {
+    ctx->fireClose();
+  }
+};
+
+class RoutedEchoPipelineFactory
+    : public RoutingDataPipelineFactory<BytesPipeline, std::string> {
+ public:
+  BytesPipeline::UniquePtr newPipeline(
+      std::shared_ptr<AsyncSocket> sock,
+      const std::string& routingData) override {
+    routed++;
+    BytesPipeline::UniquePtr pipeline(new BytesPipeline);
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(EchoHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+
+  std::atomic<int> routed{0};
+};
+
+int connectTo(const SocketAddress& address) {
+  sockaddr_storage addr;
+  auto addrLen = address.getAddress(&addr);
+  int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+  CHECK_GE(fd, 0);
+  timeval timeout{5, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  CHECK_EQ(0, connect(fd, (sockaddr*)&addr, addrLen));
+  return fd;
+}
+
+// What's echoed back of as many bytes
+std::string receive(int fd, size_t length) {
+  std::string received;
+  char buf[256];
+  while (received.size() < length) {
+    auto len = recv(fd, buf, sizeof(buf), 0);
+    if (len <= 0) {
+      break;
+    }
+    received.append(buf, len);
+  }
+  return received;
+}
+
+void sendString(int fd, const std::string& data) {
+  CHECK_EQ(ssize_t(data.size()), send(fd, data.data(), data.size(), 0));
+}
+
+class AcceptRoutingTest : public ::testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    routingFactory = std::make_shared<RecordingRoutingHandlerFactory>();
+    childFactory = std::make_shared<RoutedEchoPipelineFactory>();
+    server.pipeline(
+        std::make_shared<AcceptRoutingPipelineFactory<BytesPipeline,
+                                                      std::string>>(
+            &server, routingFactory, childFactory, GetParam()));
+    // One IO thread, so every connection goes through one handler
+    server.group(std::make_shared<IOThreadPoolExecutor>(1));
+    server.bind(0);
+    SocketAddress bound;
+    server.getSockets()[0]->getAddress(&bound);
+    address.setFromIpPort("127.0.0.1", bound.getPort());
+  }
+
+  void TearDown() override {
+    server.stop();
+  }
+
+  void waitForHandlers(size_t count) {
+    while (routingFactory->handlers() < count) {
+      std::this_thread::yield();
+    }
+  }
+
+  TestServer server;
+  std::shared_ptr<RecordingRoutingHandlerFactory> routingFactory;
+  std::shared_ptr<RoutedEchoPipelineFactory> childFactory;
+  SocketAddress address;
+};
+
+TEST_P(AcceptRoutingTest, RoutedInPieces) {
+  int fd = connectTo(address);
+  SCOPE_EXIT {
+    close(fd);
+  };
+  // The routing data arrives over two reads, and all of it, with what
+  // follows, makes it to the child pipeline
+  sendString(fd, "ab");
+  waitForHandlers(1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_EQ(0, childFactory->routed);
+  sendString(fd, "cdhello");
+  EXPECT_EQ("abcdhello", receive(fd, 9));
+  EXPECT_EQ(1, childFactory->routed);
+}
+
+TEST_P(AcceptRoutingTest, LateCallbackForReusedSlot) {
+  int first = connectTo(address);
+  sendString(first, "aaaa1");
+  EXPECT_EQ("aaaa1", receive(first, 5));
+  close(first);
+
+  int second = connectTo(address);
+  SCOPE_EXIT {
+    close(second);
+  };
+  waitForHandlers(2);
+  auto oldId = routingFactory->connIds[0];
+  auto newId = routingFactory->connIds[1];
+  // The same slot, not the same connection
+  EXPECT_EQ(uint32_t(oldId), uint32_t(newId));
+  EXPECT_NE(oldId, newId);
+
+  // Neither reaches the connection now in the slot
+  routingFactory->base->runInEventBaseThreadAndWait([&] {
+    routingFactory->callback->onError(oldId);
+    RoutingDataHandler<std::string>::RoutingData routingData;
+    routingData.routingData = "aaaa";
+    routingFactory->callback->onRoutingData(oldId, routingData);
+  });
+  sendString(second, "bbbb2");
+  EXPECT_EQ("bbbb2", receive(second, 5));
+  EXPECT_EQ(2, childFactory->routed);
+}
+
+TEST_P(AcceptRoutingTest, ManyRoutedAtOnce) {
+  // Routed together as their data arrives in the same loop, and handed
+  // over in batches
+  const int kConnections = 16;
+  std::vector<int> fds;
+  for (int i = 0; i < kConnections; i++) {
+    fds.push_back(connectTo(address));
+  }
+  SCOPE_EXIT {
+    for (auto fd : fds) {
+      close(fd);
+    }
+  };
+  waitForHandlers(kConnections);
+  for (int i = 0; i < kConnections; i++) {
+    sendString(fds[i], folly::sformat("{:04d}", i));
+  }
+  for (int i = 0; i < kConnections; i++) {
+    EXPECT_EQ(folly::sformat("{:04d}", i), receive(fds[i], 4));
+  }
+  EXPECT_EQ(kConnections, childFactory->routed);
+}
+
+INSTANTIATE_TEST_CASE_P(Bootstrap, AcceptRoutingTest,
+                        ::testing::Values(false, true));
+
+// Hashes only move to the added worker, and about as few as have to
+void expectConsistent(WorkerSelector& selector) {
+  const size_t kHashes = 10000;
+  size_t moved = 0;
+  std::vector<size_t> perWorker(9);
+  for (uint64_t i = 0; i < kHashes; i++) {
+    auto hash = std::hash<uint64_t>()(i);
+    auto before = selector.select(hash, 8);
+    auto after = selector.select(hash, 9);
+    EXPECT_LT(before, 8);
+    if (before != after) {
+      EXPECT_EQ(8, after);
+      moved++;
+    }
+    perWorker[after]++;
+  }
+  EXPECT_GT(moved, kHashes / 9 / 2);
+  EXPECT_LT(moved, kHashes / 9 * 2);
+  for (auto count : perWorker) {
+    EXPECT_GT(count, kHashes / 9 / 2);
+  }
+}
+
+TEST(Bootstrap, JumpConsistentWorkerSelector) {
+  JumpConsistentWorkerSelector selector;
+  EXPECT_EQ(0, selector.select(12345, 1));
+  expectConsistent(selector);
+}
+
+TEST(Bootstrap, RendezvousWorkerSelector) {
+  RendezvousWorkerSelector selector;
+  EXPECT_EQ(0, selector.select(12345, 1));
+  expectConsistent(selector);
+}
+
+// A self-signed certificate for localhost, and its key
+static void writeTestCertificate(const std::string& certPath,
+                                 const std::string& keyPath) {
+  EVP_PKEY* key = EVP_PKEY_new();
+  EVP_PKEY_assign_RSA(key, RSA_generate_key(2048, RSA_F4, nullptr, nullptr));
+  X509* cert = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_get_notBefore(cert), 0);
+  X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+  X509_set_pubkey(cert, key);
+  auto name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                             (const unsigned char*)"localhost", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+  X509_sign(cert, key, EVP_sha256());
+
+  FILE* f = fopen(certPath.c_str(), "w");
+  CHECK(f);
+  PEM_write_X509(f, cert);
+  fclose(f);
+  f = fopen(keyPath.c_str(), "w");
+  CHECK(f);
+  PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+  fclose(f);
+  X509_free(cert);
+  EVP_PKEY_free(key);
+}
+
+class HandshakeClient : public AsyncSocket::ConnectCallback {
+ public:
+  HandshakeClient(EventBase* base, std::shared_ptr<SSLContext> ctx,
+                  const SocketAddress& address, SSL_SESSION* session)
+      : socket(AsyncSSLSocket::newSocket(ctx, base)) {
+    if (session) {
+      socket->setSSLSession(session);
+    }
+    socket->connect(this, address);
+  }
+
+  ~HandshakeClient() {
+    if (session) {
+      SSL_SESSION_free(session);
+    }
+  }
+
+  void connectSuccess() noexcept override {
+    succeeded = true;
+    reused = socket->getSSLSessionReused();
+    session = socket->getSSLSession();
+    socket->closeNow();
+  }
+
+  void connectErr(const AsyncSocketException& ex) noexcept override {
+    LOG(ERROR) << "Handshake failed: " << ex.what();
+  }
+
+  AsyncSSLSocket::UniquePtr socket;
+  bool succeeded{false};
+  bool reused{false};
+  SSL_SESSION* session{nullptr};
+};
+
+TEST(Bootstrap, OffloadedSSLHandshakes) {
+  char dir[] = "/tmp/bootstrap_test_XXXXXX";
+  CHECK(mkdtemp(dir));
+  std::string certPath = std::string(dir) + "/cert.pem";
+  std::string keyPath = std::string(dir) + "/key.pem";
+  writeTestCertificate(certPath, keyPath);
+  SCOPE_EXIT {
+    unlink(certPath.c_str());
+    unlink(keyPath.c_str());
+    rmdir(dir);
+  };
+
+  TestServer server;
+  SSLContextConfig ctxConfig;
+  ctxConfig.setCertificate(certPath, keyPath, "");
+  ctxConfig.isDefault = true;
+  server.socketConfig.sslContextConfigs.push_back(ctxConfig);
+  auto handshakeExecutor = std::make_shared<IOThreadPoolExecutor>(4);
+  server.socketConfig.sslHandshakeExecutor = handshakeExecutor;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.bind(0);
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  auto clientCtx = std::make_shared<SSLContext>();
+#ifdef TLS1_3_VERSION
+  // For the session to be there as the handshake is done
+  SSL_CTX_set_max_proto_version(clientCtx->getSSLCtx(), TLS1_2_VERSION);
+#endif
+
+  const int kClients = 32;
+  EventBase base;
+  std::vector<std::unique_ptr<HandshakeClient>> clients;
+  for (int i = 0; i < kClients; i++) {
+    clients.emplace_back(new HandshakeClient(&base, clientCtx, address,
+                                             nullptr));
+  }
+  base.loop();
+
+  // The same again, resuming the sessions, on whichever handshake thread
+  std::vector<std::unique_ptr<HandshakeClient>> resumed;
+  for (auto& client : clients) {
+    ASSERT_TRUE(client->succeeded);
+    ASSERT_TRUE(client->session);
+    resumed.emplace_back(new HandshakeClient(&base, clientCtx, address,
+                                             client->session));
+  }
+  base.loop();
+  for (auto& client : resumed) {
+    EXPECT_TRUE(client->succeeded);
+    EXPECT_TRUE(client->reused);
+  }
+
+  while (factory->pipelines < 2 * kClients) {
+    std::this_thread::yield();
+  }
+  server.stop();
+  server.join();
+  handshakeExecutor->join();
+}
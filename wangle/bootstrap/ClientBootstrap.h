@@ -10,11 +10,30 @@
 
 #pragma once
 
+#include <wangle/bootstrap/ConnectionPool.h>
+#include <wangle/bootstrap/LoopbackServerSocket.h>
 #include <wangle/channel/Pipeline.h>
+#include <wangle/channel/ShmSocket.h>
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
+#include <wangle/ssl/SSLClientSessionCache.h>
+#include <folly/MoveWrapper.h>
+#include <folly/io/async/AsyncSSLSocket.h>
 #include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/EventBaseManager.h>
 
+#include <netinet/tcp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+
 namespace folly {
 
 /*
@@ -26,11 +45,16 @@ class ClientBootstrap {
 
   class ConnectCallback : public AsyncSocket::ConnectCallback {
    public:
-    ConnectCallback(Promise<Pipeline*> promise, ClientBootstrap* bootstrap)
+    ConnectCallback(Promise<Pipeline*> promise, ClientBootstrap* bootstrap,
+                    std::shared_ptr<AsyncSocket> socket,
+                    const SocketAddress& address)
         : promise_(std::move(promise))
-        , bootstrap_(bootstrap) {}
+        , bootstrap_(bootstrap)
+        , socket_(std::move(socket))
+        , address_(address) {}
 
     void connectSuccess() noexcept override {
+      bootstrap_->storeSession(socket_.get(), address_);
       if (bootstrap_->getPipeline()) {
         bootstrap_->getPipeline()->transportActive();
       }
@@ -39,6 +63,7 @@ class ClientBootstrap {
     }
 
     void connectErr(const AsyncSocketException& ex) noexcept override {
+      bootstrap_->dropSession(ex, address_);
       promise_.setException(
         folly::make_exception_wrapper<AsyncSocketException>(ex));
       delete this;
@@ -46,6 +71,144 @@ class ClientBootstrap {
    private:
     Promise<Pipeline*> promise_;
     ClientBootstrap* bootstrap_;
+    std::shared_ptr<AsyncSocket> socket_;
+    SocketAddress address_;
+  };
+
+  // Connects to a list of addresses, the next one starting whenever the
+  // attempt delay passes, or an attempt fails, before any has connected
+  class ConnectRace : public AsyncTimeout {
+    class Attempt : public AsyncSocket::ConnectCallback {
+     public:
+      Attempt(ConnectRace* race, std::shared_ptr<AsyncSocket> socket,
+              const SocketAddress& address)
+        : race_(race), socket_(std::move(socket)), address_(address) {}
+
+      void connectSuccess() noexcept override {
+        race_->bootstrap_->storeSession(socket_.get(), address_);
+        race_->connected(this);
+      }
+
+      void connectErr(const AsyncSocketException& ex) noexcept override {
+        race_->bootstrap_->dropSession(ex, address_);
+        race_->failed(this, ex);
+      }
+
+      ConnectRace* race_;
+      std::shared_ptr<AsyncSocket> socket_;
+      SocketAddress address_;
+    };
+
+   public:
+    ConnectRace(ClientBootstrap* bootstrap,
+                EventBase* base,
+                std::vector<SocketAddress> addresses,
+                std::chrono::milliseconds timeout,
+                Promise<Pipeline*> promise)
+      : AsyncTimeout(base),
+        bootstrap_(bootstrap),
+        base_(base),
+        addresses_(interleave(std::move(addresses))),
+        timeout_(timeout),
+        promise_(std::move(promise)) {}
+
+    void start() {
+      if (addresses_.empty()) {
+        promise_.setException(AsyncSocketException(
+          AsyncSocketException::BAD_ARGS, "no address to connect to"));
+        delete this;
+        return;
+      }
+      tryNext();
+    }
+
+    void timeoutExpired() noexcept override {
+      tryNext();
+    }
+
+   private:
+    // Alternates the address families, starting with that of the first
+    // address, keeping the order within each family
+    static std::vector<SocketAddress> interleave(
+        std::vector<SocketAddress> addresses) {
+      if (addresses.empty()) {
+        return addresses;
+      }
+      const auto first = addresses.front().getFamily();
+      std::vector<SocketAddress> same;
+      std::vector<SocketAddress> other;
+      for (auto& address : addresses) {
+        (address.getFamily() == first ? same : other).push_back(address);
+      }
+      std::vector<SocketAddress> result;
+      for (size_t i = 0; i < std::max(same.size(), other.size()); i++) {
+        if (i < same.size()) {
+          result.push_back(same[i]);
+        }
+        if (i < other.size()) {
+          result.push_back(other[i]);
+        }
+      }
+      return result;
+    }
+
+    void tryNext() {
+      if (next_ == addresses_.size()) {
+        return;
+      }
+      const auto& address = addresses_[next_++];
+      auto socket = bootstrap_->newSocket(base_, address);
+      attempts_.emplace_back(new Attempt(this, socket, address));
+      auto attempt = attempts_.back().get();
+      if (next_ < addresses_.size()) {
+        scheduleTimeout(bootstrap_->connectionAttemptDelay_.count());
+      }
+      socket->connect(attempt, address, timeout_.count(),
+                      bootstrap_->getConnectOptions());
+    }
+
+    void connected(Attempt* winner) {
+      done_ = true;
+      cancelTimeout();
+      // The losers' connectErr() only finds the race done
+      for (auto& attempt : attempts_) {
+        if (attempt.get() != winner) {
+          attempt->socket_->closeNow();
+        }
+      }
+      auto& pipeline = bootstrap_->pipeline_;
+      pipeline = bootstrap_->pipelineFactory_->newPipeline(winner->socket_);
+      if (pipeline) {
+        pipeline->transportActive();
+      }
+      promise_.setValue(pipeline.get());
+      delete this;
+    }
+
+    void failed(Attempt* attempt, const AsyncSocketException& ex) {
+      if (done_) {
+        return;
+      }
+      failures_++;
+      if (next_ < addresses_.size()) {
+        // No point waiting for the delay
+        cancelTimeout();
+        tryNext();
+      } else if (failures_ == attempts_.size()) {
+        promise_.setException(ex);
+        delete this;
+      }
+    }
+
+    ClientBootstrap* bootstrap_;
+    EventBase* base_;
+    std::vector<SocketAddress> addresses_;
+    std::chrono::milliseconds timeout_;
+    Promise<Pipeline*> promise_;
+    size_t next_{0};
+    size_t failures_{0};
+    bool done_{false};
+    std::vector<std::unique_ptr<Attempt>> attempts_;
   };
 
  public:
@@ -69,16 +232,135 @@ class ClientBootstrap {
     }
     Future<Pipeline*> retval((Pipeline*)nullptr);
     base->runImmediatelyOrRunInEventBaseThreadAndWait([&](){
-      auto socket = AsyncSocket::newSocket(base);
+      if (pool_) {
+        DCHECK(pool_->getAddress() == address);
+        retval = pool_->getSocket(base).then(
+          [this](std::shared_ptr<AsyncSocket> socket) {
+            pipeline_ = pipelineFactory_->newPipeline(socket);
+            if (pipeline_) {
+              pipeline_->transportActive();
+            }
+            return pipeline_.get();
+          });
+        return;
+      }
+      auto socket = newSocket(base, address);
       Promise<Pipeline*> promise;
       retval = promise.getFuture();
       socket->connect(
-        new ConnectCallback(std::move(promise), this), address);
+        new ConnectCallback(std::move(promise), this, socket, address), address,
+        0, getConnectOptions());
       pipeline_ = pipelineFactory_->newPipeline(socket);
     });
     return retval;
   }
 
+  /**
+   * Connects to "host:port"; with "shm:<path>" over a ShmSocket to the
+   * ShmServerSocket at path, and with "loopback:<name>" over a
+   * LoopbackSocket to the LoopbackServerSocket of that name.  The last
+   * two complete before this returns.
+   */
+  Future<Pipeline*> connect(const std::string& address) {
+    static const std::string kShmScheme = "shm:";
+    static const std::string kLoopbackScheme = "loopback:";
+    if (address.compare(0, kShmScheme.size(), kShmScheme) == 0) {
+      auto path = address.substr(kShmScheme.size());
+      return connectTransport([path](EventBase* base) {
+        return wangle::ShmSocket::newClientSocket(base, path).release();
+      });
+    }
+    if (address.compare(0, kLoopbackScheme.size(), kLoopbackScheme) == 0) {
+      auto name = address.substr(kLoopbackScheme.size());
+      return connectTransport([name](EventBase* base) {
+        return LoopbackServerSocket::connect(base, name).release();
+      });
+    }
+    SocketAddress socketAddress;
+    socketAddress.setFromHostPort(address);
+    return connect(socketAddress);
+  }
+
+  /**
+   * Connects to the first of addresses to accept, racing them as in happy
+   * eyeballs (RFC 6555): IPv6 and IPv4 addresses are tried by turns,
+   * starting with the family of the first one, and each attempt that
+   * hasn't connected within the attempt delay, or fails, starts the next.
+   * The first connection wins and the others are closed.  timeout bounds
+   * each attempt, 0 for the system's.
+   *
+   * Unlike connect(address), the caller never waits for the EventBase:
+   * the attempts start in its thread, and the pipeline is made there once a
+   * socket is connected.
+   */
+  Future<Pipeline*> connect(
+      std::vector<SocketAddress> addresses,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+    DCHECK(pipelineFactory_);
+    auto base = EventBaseManager::get()->getEventBase();
+    if (group_) {
+      base = group_->getEventBase();
+    }
+    Promise<Pipeline*> promise;
+    auto future = promise.getFuture();
+    auto movePromise = folly::makeMoveWrapper(std::move(promise));
+    auto moveAddresses = folly::makeMoveWrapper(std::move(addresses));
+    base->runInEventBaseThread([=]() mutable {
+      auto race = new ConnectRace(this, base, std::move(*moveAddresses),
+                                  timeout, std::move(*movePromise));
+      race->start();
+    });
+    return future;
+  }
+
+  // How long an attempt of connect(addresses) has before the next starts
+  ClientBootstrap* connectionAttemptDelay(std::chrono::milliseconds delay) {
+    connectionAttemptDelay_ = delay;
+    return this;
+  }
+
+  /**
+   * Connect with TCP Fast Open (TCP_FASTOPEN_CONNECT): with a cookie from
+   * an earlier connection to the server, connect() completes right away
+   * and the pipeline's first write goes out in the SYN.  Needs Linux 4.11
+   * or later, elsewhere connecting fails on setting the option.
+   */
+  ClientBootstrap* fastOpen(bool enabled) {
+    fastOpen_ = enabled;
+    return this;
+  }
+
+  /**
+   * Connect over TLS with context, the handshake done before the pipeline
+   * is active.  With a sessionCache, which may be shared by bootstraps in
+   * several threads, each connection tries to resume the last session of
+   * its server, so reconnecting to a backend costs an abbreviated
+   * handshake.  Not for connections from a connectionPool().
+   */
+  ClientBootstrap* sslContext(
+      std::shared_ptr<SSLContext> context,
+      std::shared_ptr<SSLClientSessionCache> sessionCache = nullptr) {
+    sslContext_ = std::move(context);
+    sessionCache_ = std::move(sessionCache);
+    return this;
+  }
+
+  // Sent in SNI, and part of a session's key in the cache
+  ClientBootstrap* serverName(const std::string& name) {
+    serverName_ = name;
+    return this;
+  }
+
+  /**
+   * Start pipelines on the sockets of pool, which has to be for the address
+   * given to connect(); the pipeline is only made once its socket is
+   * connected, which is right away with an idle one.
+   */
+  ClientBootstrap* connectionPool(std::shared_ptr<ConnectionPool> pool) {
+    pool_ = pool;
+    return this;
+  }
+
   ClientBootstrap* pipelineFactory(
       std::shared_ptr<PipelineFactory<Pipeline>> factory) {
     pipelineFactory_ = factory;
@@ -99,6 +381,89 @@ class ClientBootstrap {
 
   std::shared_ptr<PipelineFactory<Pipeline>> pipelineFactory_;
   std::shared_ptr<folly::wangle::IOThreadPoolExecutor> group_;
+  std::shared_ptr<ConnectionPool> pool_;
+  std::chrono::milliseconds connectionAttemptDelay_{250};
+  bool fastOpen_{false};
+  std::shared_ptr<SSLContext> sslContext_;
+  std::shared_ptr<SSLClientSessionCache> sessionCache_;
+  std::string serverName_;
+
+ private:
+  std::shared_ptr<AsyncSocket> newSocket(EventBase* base,
+                                         const SocketAddress& address) {
+    if (!sslContext_) {
+      return AsyncSocket::newSocket(base);
+    }
+    auto socket = AsyncSSLSocket::newSocket(sslContext_, base);
+    if (!serverName_.empty()) {
+      socket->setServerName(serverName_);
+    }
+    if (sessionCache_) {
+      auto key = SSLClientSessionCache::getKey(address, serverName_);
+      if (auto session = sessionCache_->lookup(key)) {
+        socket->setSSLSession(session, true);
+      }
+    }
+    return socket;
+  }
+
+  // Keeps the session of a TLS connection that just came up
+  void storeSession(AsyncSocket* socket, const SocketAddress& address) {
+    if (!sessionCache_) {
+      return;
+    }
+    auto sslSocket = dynamic_cast<AsyncSSLSocket*>(socket);
+    if (!sslSocket) {
+      return;
+    }
+    if (auto session = sslSocket->getSSLSession()) {
+      sessionCache_->store(
+        SSLClientSessionCache::getKey(address, serverName_), session);
+    }
+  }
+
+  // A failed handshake may be down to the session it offered
+  void dropSession(const AsyncSocketException& ex,
+                   const SocketAddress& address) {
+    if (sessionCache_ && ex.getType() == AsyncSocketException::SSL_ERROR) {
+      sessionCache_->remove(
+        SSLClientSessionCache::getKey(address, serverName_));
+    }
+  }
+
+  // Over a transport whose factory connects before it returns
+  Future<Pipeline*> connectTransport(
+      std::function<AsyncSocket*(EventBase*)> factory) {
+    DCHECK(pipelineFactory_);
+    auto base = EventBaseManager::get()->getEventBase();
+    if (group_) {
+      base = group_->getEventBase();
+    }
+    Future<Pipeline*> retval((Pipeline*)nullptr);
+    base->runImmediatelyOrRunInEventBaseThreadAndWait([&](){
+      try {
+        std::shared_ptr<AsyncSocket> socket(
+          factory(base), DelayedDestruction::Destructor());
+        pipeline_ = pipelineFactory_->newPipeline(socket);
+        if (pipeline_) {
+          pipeline_->transportActive();
+        }
+        retval = makeFuture(pipeline_.get());
+      } catch (const AsyncSocketException& ex) {
+        retval = makeFuture<Pipeline*>(ex);
+      }
+    });
+    return retval;
+  }
+
+  AsyncSocket::OptionMap getConnectOptions() const {
+    AsyncSocket::OptionMap options;
+    if (fastOpen_) {
+      options.emplace(
+        AsyncSocket::OptionKey{IPPROTO_TCP, TCP_FASTOPEN_CONNECT}, 1);
+    }
+    return options;
+  }
 };
 
 } // namespace
@@ -0,0 +1,309 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/bootstrap/ConnectionPool.h>
+
+#include <folly/Optional.h>
+#include <folly/io/async/AsyncTimeout.h>
+
+#include <list>
+#include <set>
+
+namespace folly {
+
+// The sockets of one EventBase, only used in its thread, and dropped from
+// the pool when the EventBase is destroyed
+class ConnectionPool::LoopPool : private EventBase::LoopCallback {
+ public:
+  LoopPool(ConnectionPool* pool, EventBase* eventBase)
+    : pool_(pool), eventBase_(eventBase) {}
+
+  ~LoopPool() {
+    cancelLoopCallback();
+    idle_.clear();
+    // Their callbacks fail their promises, if any, and delete them
+    auto connecting = std::move(connecting_);
+    for (auto connect : connecting) {
+      connect->cancel();
+    }
+  }
+
+  // Once in the EventBase's thread, before anything is kept on it
+  void watch() {
+    DCHECK(eventBase_->isInEventBaseThread());
+    if (!watching_) {
+      watching_ = true;
+      eventBase_->runOnDestruction(this);
+    }
+  }
+
+  Future<std::shared_ptr<AsyncSocket>> get() {
+    watch();
+    used_ = true;
+    while (!idle_.empty()) {
+      auto socket = idle_.back()->release();
+      idle_.pop_back();
+      // Whatever made it readable since the loop last ran, it isn't usable
+      if (socket->good() && !socket->readable()) {
+        fill();
+        return makeFuture(std::move(socket));
+      }
+    }
+    Promise<std::shared_ptr<AsyncSocket>> promise;
+    auto future = promise.getFuture();
+    connect(std::move(promise));
+    fill();
+    return future;
+  }
+
+  void put(std::shared_ptr<AsyncSocket> socket) {
+    watch();
+    if (socket->good() && !socket->readable() &&
+        !socket->getReadCallback() &&
+        idle_.size() < pool_->options_.maxIdle) {
+      addIdle(std::move(socket));
+    }
+  }
+
+  // Connects whatever more it takes to have minIdle idle sockets.  A
+  // failed connect isn't retried until a socket is taken or dropped.
+  void fill() {
+    auto have = idle_.size() + warming_;
+    for (auto i = have; i < pool_->options_.minIdle; i++) {
+      connect(none);
+    }
+  }
+
+  void warm() {
+    watch();
+    used_ = true;
+    fill();
+  }
+
+  size_t getIdleCount() const {
+    return idle_.size();
+  }
+
+ private:
+  // The EventBase is being destroyed
+  void runLoopCallback() noexcept override {
+    pool_->dropLoopPool(eventBase_);
+  }
+
+  // An idle socket, dropped on any read event or after maxIdleTime
+  class Idle : public AsyncSocket::ReadCallback, public AsyncTimeout {
+   public:
+    Idle(LoopPool* loop, std::shared_ptr<AsyncSocket> socket)
+      : AsyncTimeout(loop->eventBase_),
+        loop_(loop),
+        socket_(std::move(socket)) {
+      socket_->setReadCB(this);
+      scheduleTimeout(loop_->pool_->options_.maxIdleTime);
+    }
+
+    ~Idle() {
+      if (socket_) {
+        socket_->setReadCB(nullptr);
+        socket_->closeNow();
+      }
+    }
+
+    std::shared_ptr<AsyncSocket> release() {
+      cancelTimeout();
+      socket_->setReadCB(nullptr);
+      return std::move(socket_);
+    }
+
+    void getReadBuffer(void** bufReturn, size_t* lenReturn) override {
+      *bufReturn = buf_;
+      *lenReturn = sizeof(buf_);
+    }
+
+    void readDataAvailable(size_t len) noexcept override {
+      VLOG(4) << "Dropping pooled connection that received " << len
+              << " bytes";
+      loop_->drop(this);
+    }
+
+    void readEOF() noexcept override {
+      loop_->drop(this);
+    }
+
+    void readErr(const AsyncSocketException& ex) noexcept override {
+      loop_->drop(this);
+    }
+
+    void timeoutExpired() noexcept override {
+      loop_->drop(this);
+    }
+
+    std::list<std::unique_ptr<Idle>>::iterator it;
+
+   private:
+    LoopPool* loop_;
+    std::shared_ptr<AsyncSocket> socket_;
+    char buf_[64];
+  };
+
+  // A connect for get(), with a promise, or for fill()
+  class Connect : public AsyncSocket::ConnectCallback {
+   public:
+    Connect(LoopPool* loop,
+            Optional<Promise<std::shared_ptr<AsyncSocket>>> promise)
+      : loop_(loop),
+        socket_(AsyncSocket::newSocket(loop->eventBase_)),
+        promise_(std::move(promise)) {}
+
+    void start() {
+      socket_->connect(this, loop_->pool_->address_,
+                       loop_->pool_->options_.connectTimeout.count());
+    }
+
+    // Also deletes this, the pool is gone
+    void cancel() {
+      loop_ = nullptr;
+      socket_->closeNow();
+    }
+
+    void connectSuccess() noexcept override {
+      if (loop_) {
+        loop_->connected(this);
+      }
+      if (promise_) {
+        promise_->setValue(std::move(socket_));
+      } else if (loop_) {
+        loop_->put(std::move(socket_));
+      }
+      delete this;
+    }
+
+    void connectErr(const AsyncSocketException& ex) noexcept override {
+      if (loop_) {
+        loop_->connected(this);
+      }
+      if (promise_) {
+        promise_->setException(
+          folly::make_exception_wrapper<AsyncSocketException>(ex));
+      } else {
+        VLOG(4) << "Warming a pooled connection failed: " << ex.what();
+      }
+      delete this;
+    }
+
+    bool warming() const {
+      return !promise_;
+    }
+
+   private:
+    LoopPool* loop_;
+    std::shared_ptr<AsyncSocket> socket_;
+    Optional<Promise<std::shared_ptr<AsyncSocket>>> promise_;
+  };
+
+  void connect(Optional<Promise<std::shared_ptr<AsyncSocket>>> promise) {
+    auto connect = new Connect(this, std::move(promise));
+    connecting_.insert(connect);
+    if (connect->warming()) {
+      warming_++;
+    }
+    connect->start();
+  }
+
+  void connected(Connect* connect) {
+    connecting_.erase(connect);
+    if (connect->warming()) {
+      warming_--;
+    }
+  }
+
+  void addIdle(std::shared_ptr<AsyncSocket> socket) {
+    idle_.emplace_back(new Idle(this, std::move(socket)));
+    idle_.back()->it = std::prev(idle_.end());
+  }
+
+  void drop(Idle* idle) {
+    idle_.erase(idle->it);
+    if (used_) {
+      fill();
+    }
+  }
+
+  ConnectionPool* pool_;
+  EventBase* eventBase_;
+  // The most recently added last
+  std::list<std::unique_ptr<Idle>> idle_;
+  std::set<Connect*> connecting_;
+  size_t warming_{0};
+  // Nothing is connected in the background for an EventBase before it
+  // asks for a socket
+  bool used_{false};
+  bool watching_{false};
+};
+
+ConnectionPool::ConnectionPool(SocketAddress address, Options options)
+  : address_(std::move(address)), options_(std::move(options)) {}
+
+ConnectionPool::~ConnectionPool() {
+  decltype(loops_) loops;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    loops.swap(loops_);
+  }
+  for (auto& loop : loops) {
+    loop.first->runImmediatelyOrRunInEventBaseThreadAndWait([&]() {
+      loop.second.reset();
+    });
+  }
+}
+
+Future<std::shared_ptr<AsyncSocket>> ConnectionPool::getSocket(
+    EventBase* eventBase) {
+  return getLoopPool(eventBase)->get();
+}
+
+void ConnectionPool::putSocket(std::shared_ptr<AsyncSocket> socket) {
+  auto eventBase = socket->getEventBase();
+  getLoopPool(eventBase)->put(std::move(socket));
+}
+
+void ConnectionPool::warm(EventBase* eventBase) {
+  auto loop = getLoopPool(eventBase);
+  eventBase->runInEventBaseThread([loop]() {
+    loop->warm();
+  });
+}
+
+size_t ConnectionPool::getIdleCount(EventBase* eventBase) {
+  return getLoopPool(eventBase)->getIdleCount();
+}
+
+void ConnectionPool::dropLoopPool(EventBase* eventBase) {
+  std::unique_ptr<LoopPool> loop;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    auto it = loops_.find(eventBase);
+    if (it == loops_.end()) {
+      return;
+    }
+    loop = std::move(it->second);
+    loops_.erase(it);
+  }
+}
+
+ConnectionPool::LoopPool* ConnectionPool::getLoopPool(EventBase* eventBase) {
+  std::lock_guard<std::mutex> g(mutex_);
+  auto& loop = loops_[eventBase];
+  if (!loop) {
+    loop.reset(new LoopPool(this, eventBase));
+  }
+  return loop.get();
+}
+
+} // namespace
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/SocketAddress.h>
+#include <folly/futures/Future.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/EventBase.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace folly {
+
+/*
+ * Connected, idle sockets to one address, kept for each EventBase, so a
+ * ClientBootstrap (see ClientBootstrap::connectionPool()) starts its
+ * pipeline on an established socket instead of waiting for a handshake.
+ * The sockets of an EventBase are only touched in its thread, and dropped
+ * when it's destroyed, so the pool may outlive the EventBases it was used
+ * on, though not be destroyed while one of them is.
+ *
+ * An idle socket is dropped as soon as it becomes readable, as the backend
+ * closed it or sent something nobody asked for, after maxIdleTime, or when
+ * maxIdle others are idle already.  Each EventBase that took a socket, or
+ * was warm()ed, connects in the background to keep minIdle sockets idle.
+ */
+class ConnectionPool {
+ public:
+  struct Options {
+    // Connected ahead of use on each EventBase
+    size_t minIdle{0};
+    // Most idle sockets kept on each EventBase
+    size_t maxIdle{16};
+    std::chrono::milliseconds maxIdleTime{60000};
+    // 0 for the system's
+    std::chrono::milliseconds connectTimeout{0};
+  };
+
+  ConnectionPool(SocketAddress address, Options options);
+  ~ConnectionPool();
+
+  const SocketAddress& getAddress() const {
+    return address_;
+  }
+
+  /**
+   * A connected socket on eventBase: an idle one, or else a new one once
+   * it's connected.  In eventBase's thread.
+   */
+  Future<std::shared_ptr<AsyncSocket>> getSocket(EventBase* eventBase);
+
+  /**
+   * Hands back a socket that's done with, for a protocol whose connections
+   * can be reused, in the thread of the socket's EventBase.  Kept if it's
+   * still good and there's room.
+   */
+  void putSocket(std::shared_ptr<AsyncSocket> socket);
+
+  // Connects minIdle sockets on eventBase ahead of use; from any thread
+  void warm(EventBase* eventBase);
+
+  // In eventBase's thread
+  size_t getIdleCount(EventBase* eventBase);
+
+ private:
+  class LoopPool;
+
+  LoopPool* getLoopPool(EventBase* eventBase);
+  // From eventBase's destructor
+  void dropLoopPool(EventBase* eventBase);
+
+  const SocketAddress address_;
+  const Options options_;
+
+  std::mutex mutex_;
+  std::unordered_map<EventBase*, std::unique_ptr<LoopPool>> loops_;
+};
+
+} // namespace
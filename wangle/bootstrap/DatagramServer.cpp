@@ -0,0 +1,163 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/bootstrap/DatagramServer.h>
+
+#include <folly/Exception.h>
+#include <folly/ScopeGuard.h>
+#include <wangle/concurrent/NamedThreadFactory.h>
+
+#include <thread>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace folly {
+
+class DatagramServer::Workers
+    : public wangle::ThreadPoolExecutor::Observer {
+ public:
+  explicit Workers(DatagramServer* server) : server_(server) {}
+
+  void threadStarted(wangle::ThreadPoolExecutor::ThreadHandle* h) override {
+    try {
+      server_->startListener(h);
+    } catch (const std::exception& ex) {
+      if (!error_) {
+        error_ = std::current_exception();
+      }
+      LOG(ERROR) << "Datagram socket bind failed: " << ex.what();
+    }
+  }
+
+  void threadStopped(wangle::ThreadPoolExecutor::ThreadHandle* h) override {
+    server_->stopListener(h);
+  }
+
+  // The first bind error, to rethrow
+  std::exception_ptr error_;
+
+ private:
+  DatagramServer* server_;
+};
+
+namespace {
+
+int bindDatagramSocket(const SocketAddress& address) {
+  int fd = ::socket(address.getFamily(),
+                    SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  checkUnixError(fd, "datagram socket() failed");
+  auto guard = makeGuard([&] {
+    ::close(fd);
+  });
+
+  int one = 1;
+  checkUnixError(
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)),
+    "setsockopt(SO_REUSEPORT) failed");
+  sockaddr_storage addr;
+  auto len = address.getAddress(&addr);
+  checkUnixError(::bind(fd, reinterpret_cast<sockaddr*>(&addr), len),
+                 "datagram bind() to ", address.describe(), " failed");
+  guard.dismiss();
+  return fd;
+}
+
+} // namespace
+
+void DatagramServer::bind(const SocketAddress& address) {
+  CHECK(!workers_);
+  if (!io_group_) {
+    auto threads = std::thread::hardware_concurrency();
+    if (threads <= 0) {
+      // Reasonable mid-point for concurrency when actual value unknown
+      threads = 8;
+    }
+    io_group_ = std::make_shared<wangle::IOThreadPoolExecutor>(
+      threads, std::make_shared<wangle::NamedThreadFactory>("IO Thread"));
+  }
+
+  address_ = address;
+  workers_ = std::make_shared<Workers>(this);
+  io_group_->addObserver(workers_);
+  if (workers_->error_) {
+    auto error = workers_->error_;
+    stop();
+    std::rethrow_exception(error);
+  }
+}
+
+void DatagramServer::stop() {
+  if (workers_) {
+    io_group_->removeObserver(workers_);
+    workers_.reset();
+  }
+}
+
+void DatagramServer::startListener(
+    wangle::ThreadPoolExecutor::ThreadHandle* h) {
+  int fd;
+  {
+    // The first socket picks the port of ephemeral binds
+    std::lock_guard<std::mutex> g(listenersLock_);
+    fd = bindDatagramSocket(address_);
+    if (address_.getPort() == 0) {
+      address_.setFromLocalAddress(fd);
+    }
+  }
+
+  auto listener = std::make_shared<Listener>();
+  listener->base = wangle::IOThreadPoolExecutor::getEventBase(h);
+  listener->handler = std::make_shared<wangle::DatagramSocketHandler>(
+    listener->base, fd, options_);
+  {
+    std::lock_guard<std::mutex> g(listenersLock_);
+    listeners_[h] = listener;
+  }
+
+  auto factory = factory_;
+  listener->base->runInEventBaseThread([listener, factory]() {
+    if (!listener->handler) {
+      // Stopped already
+      return;
+    }
+    listener->pipeline = factory->newPipeline(listener->handler);
+    listener->pipeline->transportActive();
+  });
+}
+
+void DatagramServer::stopListener(
+    wangle::ThreadPoolExecutor::ThreadHandle* h) {
+  std::shared_ptr<Listener> listener;
+  {
+    std::lock_guard<std::mutex> g(listenersLock_);
+    auto it = listeners_.find(h);
+    if (it == listeners_.end()) {
+      return;
+    }
+    listener = std::move(it->second);
+    listeners_.erase(it);
+  }
+
+  auto close = [listener]() {
+    if (listener->pipeline) {
+      listener->pipeline->transportInactive();
+      listener->pipeline.reset();
+    }
+    listener->handler.reset();
+  };
+  if (!listener->base->isInEventBaseThread()) {
+    listener->base->runImmediatelyOrRunInEventBaseThreadAndWait(close);
+  } else {
+    close();
+  }
+}
+
+} // namespace
@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/DatagramSocketHandler.h>
+#include <wangle/channel/Pipeline.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+#include <folly/SocketAddress.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace folly {
+
+class DatagramPipelineFactory {
+ public:
+  /**
+   * The pipeline of one IO thread's socket, which has to start with
+   * transport, e.g. with pipeline->addBack(transport).
+   */
+  virtual wangle::DatagramPipeline::UniquePtr newPipeline(
+      std::shared_ptr<wangle::DatagramSocketHandler> transport) = 0;
+
+  virtual ~DatagramPipelineFactory() = default;
+};
+
+/*
+ * DatagramServer serves UDP on a pool of IO threads: each thread has a
+ * SO_REUSEPORT socket of its own bound to the address, and the kernel
+ * spreads the peers across them.  A socket's datagrams go through the
+ * DatagramPipeline of its thread (see DatagramSocketHandler), which
+ * writes replies to the peer of the datagram it read.
+ *
+ * Threads added to the IO group get a socket too, and the sockets of
+ * threads that stop are closed.
+ */
+class DatagramServer {
+ public:
+  explicit DatagramServer(
+      std::shared_ptr<DatagramPipelineFactory> factory,
+      wangle::DatagramSocketHandler::Options options =
+        wangle::DatagramSocketHandler::Options())
+    : factory_(std::move(factory)), options_(std::move(options)) {}
+
+  DatagramServer(const DatagramServer&) = delete;
+
+  ~DatagramServer() {
+    stop();
+  }
+
+  /*
+   * Set the IO executor.  If not set, a default one will be created
+   * with one thread per core.  Must be set before bind().
+   */
+  DatagramServer* group(
+      std::shared_ptr<wangle::IOThreadPoolExecutor> io_group) {
+    io_group_ = std::move(io_group);
+    return this;
+  }
+
+  /*
+   * Bind every IO thread's socket to address and start reading.  With
+   * port 0, the first socket picks a port for the rest.  Throws if a
+   * socket can't be bound.
+   */
+  void bind(const folly::SocketAddress& address);
+
+  // The address bound, with its port
+  const folly::SocketAddress& getAddress() const {
+    return address_;
+  }
+
+  /*
+   * Close all sockets, in their threads.
+   */
+  void stop();
+
+ private:
+  class Workers;
+
+  struct Listener {
+    folly::EventBase* base;
+    std::shared_ptr<wangle::DatagramSocketHandler> handler;
+    wangle::DatagramPipeline::UniquePtr pipeline;
+  };
+
+  void startListener(wangle::ThreadPoolExecutor::ThreadHandle* h);
+  void stopListener(wangle::ThreadPoolExecutor::ThreadHandle* h);
+
+  std::shared_ptr<DatagramPipelineFactory> factory_;
+  const wangle::DatagramSocketHandler::Options options_;
+  std::shared_ptr<wangle::IOThreadPoolExecutor> io_group_;
+  std::shared_ptr<Workers> workers_;
+  folly::SocketAddress address_;
+
+  std::mutex listenersLock_;
+  std::map<wangle::ThreadPoolExecutor::ThreadHandle*,
+           std::shared_ptr<Listener>> listeners_;
+};
+
+} // namespace
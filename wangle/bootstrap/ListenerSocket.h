@@ -0,0 +1,35 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/acceptor/Acceptor.h>
+#include <folly/io/async/AsyncSocketBase.h>
+
+namespace folly {
+
+/*
+ * A listening socket of a transport that isn't TCP or UDP, e.g. a
+ * ShmServerSocket, which hands its connections to its acceptors with
+ * Acceptor::transportAccepted().  AsyncServerSocketFactory leaves adding
+ * and removing acceptors, and stopping, to the socket itself, so
+ * ServerBootstrap keeps these alongside its AsyncServerSockets.
+ */
+class ListenerSocket : public AsyncSocketBase {
+ public:
+  virtual ~ListenerSocket() = default;
+
+  // All three from the socket's thread
+  virtual void addAcceptor(Acceptor* acceptor, EventBase* base) = 0;
+  virtual void removeAcceptor(Acceptor* acceptor) = 0;
+  virtual void stop() = 0;
+};
+
+} // namespace
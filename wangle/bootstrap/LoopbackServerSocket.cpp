@@ -0,0 +1,144 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/bootstrap/LoopbackServerSocket.h>
+
+#include <folly/MoveWrapper.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+namespace folly {
+
+using wangle::LoopbackSocket;
+
+namespace {
+
+// The listening servers, by name
+struct Registry {
+  std::mutex lock;
+  std::map<std::string, std::weak_ptr<LoopbackServerSocket>> servers;
+  std::atomic<uint64_t> nextClient{0};
+};
+
+Registry& registry() {
+  static Registry* instance = new Registry();
+  return *instance;
+}
+
+}
+
+std::shared_ptr<LoopbackServerSocket> LoopbackServerSocket::newSocket(
+    EventBase* evb, const std::string& name) {
+  std::shared_ptr<LoopbackServerSocket> server(
+    new LoopbackServerSocket(evb, name));
+  auto& r = registry();
+  std::lock_guard<std::mutex> g(r.lock);
+  auto& entry = r.servers[name];
+  if (!entry.expired()) {
+    throw std::runtime_error("loopback name in use: " + name);
+  }
+  entry = server;
+  return server;
+}
+
+LoopbackSocket::UniquePtr LoopbackServerSocket::connect(
+    EventBase* evb, const std::string& name, size_t window) {
+  std::shared_ptr<LoopbackServerSocket> server;
+  auto& r = registry();
+  {
+    std::lock_guard<std::mutex> g(r.lock);
+    auto it = r.servers.find(name);
+    if (it != r.servers.end()) {
+      server = it->second.lock();
+    }
+  }
+  if (!server) {
+    throw AsyncSocketException(AsyncSocketException::NOT_OPEN,
+                               "nothing listening on loopback:" + name);
+  }
+
+  // Told apart in the server's logs
+  SocketAddress clientAddr;
+  clientAddr.setFromPath(name + "#" + std::to_string(
+    r.nextClient.fetch_add(1, std::memory_order_relaxed)));
+  auto sockets = LoopbackSocket::newPair(evb, nullptr, window);
+  sockets.first->setAddresses(clientAddr, server->address_);
+  sockets.second->setAddresses(server->address_, clientAddr);
+
+  auto socket = folly::makeMoveWrapper(std::move(sockets.second));
+  server->evb_->runInEventBaseThread([server, socket, clientAddr]() mutable {
+    server->dispatch(std::move(*socket), clientAddr);
+  });
+  return std::move(sockets.first);
+}
+
+LoopbackServerSocket::LoopbackServerSocket(EventBase* evb,
+                                           const std::string& name)
+  : evb_(evb),
+    name_(name) {
+  address_.setFromPath(name);
+}
+
+LoopbackServerSocket::~LoopbackServerSocket() {
+  stop();
+}
+
+void LoopbackServerSocket::addAcceptor(Acceptor* acceptor, EventBase* base) {
+  acceptors_.emplace_back(acceptor, base);
+}
+
+void LoopbackServerSocket::removeAcceptor(Acceptor* acceptor) {
+  acceptors_.erase(
+    std::remove_if(acceptors_.begin(), acceptors_.end(),
+                   [acceptor](const std::pair<Acceptor*, EventBase*>& a) {
+                     return a.first == acceptor;
+                   }),
+    acceptors_.end());
+}
+
+void LoopbackServerSocket::stop() {
+  if (stopped_) {
+    return;
+  }
+  stopped_ = true;
+  acceptors_.clear();
+  auto& r = registry();
+  std::lock_guard<std::mutex> g(r.lock);
+  auto it = r.servers.find(name_);
+  if (it != r.servers.end()) {
+    auto server = it->second.lock();
+    // Unless a new one took the name
+    if (!server || server.get() == this) {
+      r.servers.erase(it);
+    }
+  }
+}
+
+void LoopbackServerSocket::dispatch(LoopbackSocket::UniquePtr socket,
+                                    const SocketAddress& clientAddr) {
+  if (acceptors_.empty()) {
+    socket->closeNow();
+    return;
+  }
+  auto& target = acceptors_[nextAcceptor_++ % acceptors_.size()];
+  auto acceptor = target.first;
+  auto base = target.second;
+  auto sock = folly::makeMoveWrapper(std::move(socket));
+  base->runInEventBaseThread([acceptor, base, sock, clientAddr]() mutable {
+    (*sock)->attachEventBase(base);
+    acceptor->transportAccepted(std::move(*sock), clientAddr);
+  });
+}
+
+} // namespace
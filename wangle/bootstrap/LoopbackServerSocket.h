@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/bootstrap/ListenerSocket.h>
+#include <wangle/channel/LoopbackSocket.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace folly {
+
+/*
+ * Listens for LoopbackSockets under a name within the process, and hands
+ * the connections to its acceptors by turns.  ServerBootstrap::bind(
+ * "loopback:<name>") makes one in an acceptor thread, and
+ * ClientBootstrap::connect("loopback:<name>") connects to it.
+ */
+class LoopbackServerSocket : public ListenerSocket {
+ public:
+  // Listens from evb's thread; throws if the name is taken
+  static std::shared_ptr<LoopbackServerSocket> newSocket(
+      EventBase* evb, const std::string& name);
+
+  /*
+   * The client's end of a new connection to the server listening as name,
+   * attached to evb.  Throws AsyncSocketException if there's none.
+   */
+  static wangle::LoopbackSocket::UniquePtr connect(
+      EventBase* evb,
+      const std::string& name,
+      size_t window = wangle::LoopbackSocket::kDefaultWindow);
+
+  ~LoopbackServerSocket();
+
+  void addAcceptor(Acceptor* acceptor, EventBase* base) override;
+  void removeAcceptor(Acceptor* acceptor) override;
+  void stop() override;
+
+  EventBase* getEventBase() const override {
+    return evb_;
+  }
+
+  // A Unix path of the name, though there's no such socket
+  void getAddress(SocketAddress* address) const override {
+    *address = address_;
+  }
+
+ private:
+  LoopbackServerSocket(EventBase* evb, const std::string& name);
+
+  void dispatch(wangle::LoopbackSocket::UniquePtr socket,
+                const SocketAddress& clientAddr);
+
+  EventBase* evb_;
+  const std::string name_;
+  SocketAddress address_;
+  std::vector<std::pair<Acceptor*, EventBase*>> acceptors_;
+  size_t nextAcceptor_{0};
+  bool stopped_{false};
+};
+
+} // namespace
@@ -15,6 +15,25 @@ void RoutingDataHandler<R>::read(Context* ctx, IOBufQueue& q) {
   }
 }
 
+template <typename R>
+bool RoutingDataHandler<R>::parseRoutingData(IOBufQueue& bufQueue,
+                                             RoutingData& routingData) {
+  if (!bufQueue.front()) {
+    return false;
+  }
+  try {
+    if (!peekRoutingData(io::Cursor(bufQueue.front()),
+                         routingData.routingData)) {
+      return false;
+    }
+  } catch (const std::out_of_range&) {
+    return false;
+  }
+  // Hands over the chain, not the bytes
+  routingData.bufQueue.append(bufQueue);
+  return true;
+}
+
 template <typename R>
 void RoutingDataHandler<R>::readEOF(Context* ctx) {
   VLOG(4) << "Received EOF before parsing routing data";
@@ -1,6 +1,7 @@
 // Copyright 2004-present Facebook.  All rights reserved.
 #pragma once
 
+#include <folly/io/Cursor.h>
 #include <wangle/channel/AsyncSocketHandler.h>
 
 namespace folly { namespace wangle {
@@ -38,11 +39,24 @@ class RoutingDataHandler : public folly::wangle::BytesToBytesHandler {
    * as additional bytes left in bufQueue not used for parsing)
    * should be moved into RoutingData::bufQueue.
    *
+   * By default the routing data is peeked at with peekRoutingData(), and
+   * all of bufQueue is then handed to the child pipeline as it is.
+   *
    * @return bool - True on success, false if bufQueue doesn't have
    *                sufficient bytes for parsing
    */
   virtual bool parseRoutingData(folly::IOBufQueue& bufQueue,
-                                RoutingData& routingData) = 0;
+                                RoutingData& routingData);
+
+  /**
+   * Parse the routing data from a cursor over the bytes read so far,
+   * across the buffers they arrived in, without moving or coalescing them.
+   * Running out of bytes, by returning false or by the cursor throwing
+   * std::out_of_range, waits for more.  Parsers that override
+   * parseRoutingData() to do without it can simply return false.
+   */
+  virtual bool peekRoutingData(folly::io::Cursor cursor,
+                               R& routingData) = 0;
 
  protected:
   uint64_t connId_;
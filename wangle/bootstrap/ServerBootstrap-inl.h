@@ -12,12 +12,20 @@
 
 #include <wangle/acceptor/Acceptor.h>
 #include <wangle/bootstrap/ServerSocketFactory.h>
+#include <folly/ThreadLocal.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
 #include <wangle/acceptor/ManagedConnection.h>
 #include <wangle/channel/Pipeline.h>
 #include <wangle/channel/Handler.h>
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <vector>
+
 namespace folly {
 
 template <typename Pipeline>
@@ -31,17 +39,52 @@ class ServerAcceptor
   class ServerConnection : public wangle::ManagedConnection,
                            public wangle::PipelineManager {
    public:
-    explicit ServerConnection(PipelinePtr pipeline)
-        : pipeline_(std::move(pipeline)) {
+    explicit ServerConnection(
+        PipelinePtr pipeline, ServerAcceptor* acceptor = nullptr)
+        : pipeline_(std::move(pipeline)),
+          acceptor_(acceptor) {
       pipeline_->setPipelineManager(this);
     }
 
     ~ServerConnection() = default;
 
+    // Idle for the whole idle timeout, or dropped early as memory runs low
     void timeoutExpired() noexcept override {
+      setCloseReason(CloseReason::IDLE_TIMEOUT);
+      pipeline_->close();
+    }
+
+    // Whatever closes the pipeline next, it's for this
+    void transportEOF() override {
+      setCloseReason(CloseReason::REMOTE_EOF);
+    }
+
+    void transportError() override {
+      setCloseReason(CloseReason::TRANSPORT_ERROR);
     }
 
-    void describe(std::ostream& os) const override {}
+    // With no requests to be busy with, it is idle from its last activity
+    void refreshTimeout() override {
+      resetTimeout();
+      auto manager = getConnectionManager();
+      if (manager) {
+        manager->onActivated(*this);
+        manager->onDeactivated(*this);
+      }
+    }
+
+    void describe(std::ostream& os) const override {
+      auto transport = pipeline_ ? pipeline_->getTransport() : nullptr;
+      folly::SocketAddress peer;
+      try {
+        if (transport) {
+          transport->getPeerAddress(&peer);
+        }
+      } catch (const std::exception&) {
+      }
+      os << "ServerConnection " << this << " peer="
+         << (peer.isInitialized() ? peer.describe() : "unknown");
+    }
     bool isBusy() const override {
       return false;
     }
@@ -50,43 +93,73 @@ class ServerAcceptor
     void dropConnection() override {
       delete this;
     }
-    void dumpConnectionState(uint8_t loglevel) override {}
+    void dumpConnectionState(uint8_t loglevel) override {
+      VLOG(loglevel) << *this;
+    }
 
     void deletePipeline(wangle::PipelineBase* p) override {
       CHECK(p == pipeline_.get());
+      if (acceptor_) {
+        acceptor_->releasePipeline(std::move(pipeline_));
+      }
       delete this;
     }
 
    private:
     PipelinePtr pipeline_;
+    ServerAcceptor* acceptor_;
   };
 
   explicit ServerAcceptor(
         std::shared_ptr<PipelineFactory<Pipeline>> pipelineFactory,
         std::shared_ptr<folly::wangle::Pipeline<void*>> acceptorPipeline,
-        EventBase* base)
-      : Acceptor(ServerSocketConfig())
+        EventBase* base,
+        const ServerSocketConfig& accConfig = ServerSocketConfig(),
+        size_t maxPooledPipelines = 0,
+        size_t prewarmedPipelines = 0)
+      : Acceptor(accConfig)
       , base_(base)
       , childPipelineFactory_(pipelineFactory)
-      , acceptorPipeline_(acceptorPipeline) {
+      , acceptorPipeline_(acceptorPipeline)
+      , maxPooledPipelines_(maxPooledPipelines)
+      , prewarmedPipelines_(prewarmedPipelines) {
     Acceptor::init(nullptr, base_);
     CHECK(acceptorPipeline_);
 
     acceptorPipeline_->addBack(this);
     acceptorPipeline_->finalize();
+
+    pipelinePool_.reserve(maxPooledPipelines_);
+    fillPipelinePool();
   }
 
   void read(Context* ctx, void* conn) {
-    AsyncSocket::UniquePtr transport((AsyncSocket*)conn);
-      std::unique_ptr<Pipeline,
-                       folly::DelayedDestruction::Destructor>
-      pipeline(childPipelineFactory_->newPipeline(
-        std::shared_ptr<AsyncSocket>(
-          transport.release(),
-          folly::DelayedDestruction::Destructor())));
+    std::shared_ptr<AsyncSocket> transport(
+      (AsyncSocket*)conn, folly::DelayedDestruction::Destructor());
+    auto pipeline = takePooledPipeline(transport);
+    if (!pipeline) {
+      pipeline = childPipelineFactory_->newPipeline(transport);
+    }
+    auto& budget = Acceptor::getMemoryBudget();
+    if (budget) {
+      pipeline->setMemoryAccount(budget->newAccount());
+    }
     pipeline->transportActive();
-    auto connection = new ServerConnection(std::move(pipeline));
+    auto connection = new ServerConnection(
+      std::move(pipeline), maxPooledPipelines_ > 0 ? this : nullptr);
     Acceptor::addConnection(connection);
+    connection->refreshTimeout();
+  }
+
+  // Also refills the pipeline pool to the pipelines prewarmed
+  void prewarm() override {
+    Acceptor::prewarm();
+    fillPipelinePool();
+  }
+
+  // Pooled pipelines waiting for a connection
+  size_t getNumPooledPipelines() const {
+    return pipelinePool_.size();
   }
 
   /* See Acceptor::onNewConnection for details */
@@ -105,10 +178,82 @@ class ServerAcceptor
   }
 
  private:
+  PipelinePtr takePooledPipeline(const std::shared_ptr<AsyncSocket>& sock) {
+    while (!pipelinePool_.empty()) {
+      auto pipeline = std::move(pipelinePool_.back());
+      pipelinePool_.pop_back();
+      if (childPipelineFactory_->resetPipeline(pipeline.get(), sock)) {
+        return pipeline;
+      }
+    }
+    return nullptr;
+  }
+
+  // With the pipelines from the factory's newUnboundPipeline(), if any
+  void fillPipelinePool() {
+    while (pipelinePool_.size() < prewarmedPipelines_ &&
+           pipelinePool_.size() < maxPooledPipelines_) {
+      auto pipeline = childPipelineFactory_->newUnboundPipeline();
+      if (!pipeline) {
+        return;
+      }
+      pipelinePool_.push_back(std::move(pipeline));
+    }
+  }
+
+  // Pooled at the end of the loop iteration, once the calls that closed
+  // it have returned
+  void releasePipeline(PipelinePtr pipeline) {
+    // Its connection is gone
+    pipeline->setPipelineManager(nullptr);
+    released_.pipelines.push_back(std::move(pipeline));
+    if (!released_.isLoopCallbackScheduled()) {
+      base_->runInLoop(&released_);
+    }
+  }
+
+  void poolReleasedPipelines() {
+    auto released = std::move(released_.pipelines);
+    released_.pipelines.clear();
+    for (auto& pipeline : released) {
+      // Still guarded, writes or callbacks in flight would reach the next
+      // connection's socket; it's destroyed once they are done instead
+      if (pipeline->getNumDestructorGuards() > 0 ||
+          pipelinePool_.size() >= maxPooledPipelines_ ||
+          !childPipelineFactory_->resetPipeline(pipeline.get(), nullptr)) {
+        continue;
+      }
+      pipeline->setTransport(nullptr);
+      pipeline->setWritable(true);
+      pipelinePool_.push_back(std::move(pipeline));
+    }
+  }
+
+  class PipelineReleaser : public EventBase::LoopCallback {
+   public:
+    explicit PipelineReleaser(ServerAcceptor* acceptor)
+        : acceptor_(acceptor) {}
+
+    void runLoopCallback() noexcept override {
+      acceptor_->poolReleasedPipelines();
+    }
+
+    std::vector<PipelinePtr> pipelines;
+
+   private:
+    ServerAcceptor* acceptor_;
+  };
+
   EventBase* base_;
 
   std::shared_ptr<PipelineFactory<Pipeline>> childPipelineFactory_;
   std::shared_ptr<folly::wangle::Pipeline<void*>> acceptorPipeline_;
+  // Finalized pipelines of closed connections, ready for new ones
+  const size_t maxPooledPipelines_;
+  const size_t prewarmedPipelines_;
+  std::vector<PipelinePtr> pipelinePool_;
+  // Closed since the loop iteration began
+  PipelineReleaser released_{this};
 };
 
 template <typename Pipeline>
@@ -116,19 +261,30 @@ class ServerAcceptorFactory : public AcceptorFactory {
  public:
   explicit ServerAcceptorFactory(
     std::shared_ptr<PipelineFactory<Pipeline>> factory,
-    std::shared_ptr<PipelineFactory<folly::wangle::Pipeline<void*>>> pipeline)
+    std::shared_ptr<PipelineFactory<folly::wangle::Pipeline<void*>>> pipeline,
+    const ServerSocketConfig& accConfig = ServerSocketConfig(),
+    size_t maxPooledPipelines = 0,
+    size_t prewarmedPipelines = 0)
     : factory_(factory)
-    , pipeline_(pipeline) {}
+    , pipeline_(pipeline)
+    , accConfig_(accConfig)
+    , maxPooledPipelines_(maxPooledPipelines)
+    , prewarmedPipelines_(prewarmedPipelines) {}
 
   std::shared_ptr<Acceptor> newAcceptor(EventBase* base) {
     std::shared_ptr<folly::wangle::Pipeline<void*>> pipeline(
         pipeline_->newPipeline(nullptr));
-    return std::make_shared<ServerAcceptor<Pipeline>>(factory_, pipeline, base);
+    return std::make_shared<ServerAcceptor<Pipeline>>(
+      factory_, pipeline, base, accConfig_, maxPooledPipelines_,
+      prewarmedPipelines_);
   }
  private:
   std::shared_ptr<PipelineFactory<Pipeline>> factory_;
   std::shared_ptr<PipelineFactory<
     folly::wangle::Pipeline<void*>>> pipeline_;
+  ServerSocketConfig accConfig_;
+  size_t maxPooledPipelines_;
+  size_t prewarmedPipelines_;
 };
 
 class ServerWorkerPool : public folly::wangle::ThreadPoolExecutor::Observer {
@@ -143,11 +299,83 @@ class ServerWorkerPool : public folly::wangle::ThreadPoolExecutor::Observer {
       , sockets_(sockets)
       , socketFactory_(socketFactory) {
     CHECK(exec);
+    publishLocked();
   }
 
   template <typename F>
   void forEachWorker(F&& f) const;
 
+  /*
+   * How pickWorker() chooses:
+   *  - THREAD_SELECTOR: the worker on the IO thread picked by the
+   *    executor's ThreadSelector
+   *  - LEAST_LOADED: the worker with the lowest weight
+   *  - POWER_OF_TWO_CHOICES: the lower weight of two random workers,
+   *    which avoids herding onto one worker when weights are stale
+   * The weight defaults to the worker's number of connections.  Either
+   * way, connections handed to a worker that it hasn't added yet count
+   * towards its load, and workers whose loops are lagging (see
+   * Acceptor::isLoopOverloaded()) come after all the others.
+   */
+  enum class WorkerSelection {
+    THREAD_SELECTOR,
+    LEAST_LOADED,
+    POWER_OF_TWO_CHOICES,
+  };
+
+  // Called from the accepting threads, so must be thread safe
+  typedef std::function<uint64_t(const Acceptor&)> WorkerWeight;
+
+  void setWorkerSelection(
+      WorkerSelection selection,
+      WorkerWeight weight = nullptr) {
+    std::lock_guard<std::mutex> g(workersLock_);
+    selection_ = selection;
+    weight_ = std::move(weight);
+    publishLocked();
+  }
+
+  struct Worker {
+    std::shared_ptr<Acceptor> acceptor;
+    // Connections handed to the acceptor that it hasn't accepted yet
+    std::shared_ptr<std::atomic<uint32_t>> inFlight;
+  };
+
+  // A null acceptor if there are no workers.  Takes no lock unless the
+  // workers or the selection changed since the calling thread last picked.
+  Worker pickWorker();
+
+  /*
+   * When set, AsyncServerSocket connections are handed to workers by a
+   * ServerConnectionDispatcher, so workers are not added to those sockets
+   * as accept callbacks.
+   */
+  void setDispatchConnections(bool dispatch) {
+    dispatchConnections_ = dispatch;
+  }
+
+  // The workers, ordered by IOThreadPoolExecutor::getThreadIndex()
+  std::vector<std::shared_ptr<Acceptor>> getWorkersByThreadIndex();
+
+  /*
+   * Drops all the workers' connections, on their threads all at once, and
+   * waits until deadline at most; false if some weren't done by then.
+   * Their threads stopping afterwards find nothing left to drop.
+   */
+  bool dropAllConnections(std::chrono::steady_clock::time_point deadline);
+
+  /*
+   * socket is a listener of worker's own, on its event base: other
+   * workers aren't added to it, and it is stopped and dropped from the
+   * sockets when worker's thread stops.
+   */
+  void addWorkerSocket(
+      std::shared_ptr<folly::AsyncSocketBase> socket,
+      Acceptor* worker) {
+    std::lock_guard<std::mutex> g(workersLock_);
+    workerSockets_[socket.get()] = worker;
+  }
+
   void threadStarted(
     folly::wangle::ThreadPoolExecutor::ThreadHandle*);
   void threadStopped(
@@ -162,8 +390,44 @@ class ServerWorkerPool : public folly::wangle::ThreadPoolExecutor::Observer {
   }
 
  private:
-  std::map<folly::wangle::ThreadPoolExecutor::ThreadHandle*,
-           std::shared_ptr<Acceptor>> workers_;
+  bool isDispatched(const std::shared_ptr<folly::AsyncSocketBase>& socket) {
+    return dispatchConnections_ &&
+      std::dynamic_pointer_cast<AsyncServerSocket>(socket);
+  }
+
+  // What pickWorker() reads, rebuilt whenever any of it changes
+  struct Snapshot {
+    std::vector<Worker> workers;
+    WorkerSelection selection;
+    WorkerWeight weight;
+  };
+
+  // An accepting thread's copy of the snapshot, as of version
+  struct CachedSnapshot {
+    uint64_t version{std::numeric_limits<uint64_t>::max()};
+    std::shared_ptr<const Snapshot> snapshot;
+  };
+
+  // Called with workersLock_ held
+  void publishLocked();
+  const Snapshot& getSnapshot();
+  static uint64_t getLoad(const Snapshot& snapshot, const Worker& worker);
+  // nullptr if socket is shared by all workers
+  Acceptor* getSocketOwner(const std::shared_ptr<folly::AsyncSocketBase>& s) {
+    std::lock_guard<std::mutex> g(workersLock_);
+    auto it = workerSockets_.find(s.get());
+    return it == workerSockets_.end() ? nullptr : it->second;
+  }
+
+  std::map<folly::wangle::ThreadPoolExecutor::ThreadHandle*, Worker> workers_;
+  std::mutex workersLock_;
+  bool dispatchConnections_{false};
+  WorkerSelection selection_{WorkerSelection::THREAD_SELECTOR};
+  WorkerWeight weight_;
+  std::shared_ptr<const Snapshot> snapshot_;
+  std::atomic<uint64_t> version_{0};
+  folly::ThreadLocal<CachedSnapshot> cachedSnapshot_;
+  std::map<folly::AsyncSocketBase*, Acceptor*> workerSockets_;
   std::shared_ptr<AcceptorFactory> acceptorFactory_;
   folly::wangle::IOThreadPoolExecutor* exec_{nullptr};
   std::shared_ptr<std::vector<std::shared_ptr<folly::AsyncSocketBase>>> sockets_;
@@ -173,10 +437,60 @@ class ServerWorkerPool : public folly::wangle::ThreadPoolExecutor::Observer {
 template <typename F>
 void ServerWorkerPool::forEachWorker(F&& f) const {
   for (const auto& kv : workers_) {
-    f(kv.second.get());
+    f(kv.second.acceptor.get());
   }
 }
 
+/*
+ * Steers the new connections of the SO_REUSEPORT group fd belongs to by
+ * the CPU that handles their packets: CPU c gets the group's socket
+ * c % numSockets, in the order the sockets were bound.  Needs Linux 4.5;
+ * returns false if the filter couldn't be attached.
+ */
+bool attachReusePortCpuFilter(int fd, uint32_t numSockets);
+
+/*
+ * Accept callback that runs in the accepting thread and hands the
+ * accepted sockets to the workers picked by ServerWorkerPool::pickWorker().
+ *
+ * AsyncServerSocket accepts several connections per wakeup; those are
+ * collected per worker and, once the accepting loop iteration is done,
+ * handed over with one runInEventBaseThread() per worker, rather than
+ * one per connection.
+ */
+class ServerConnectionDispatcher
+    : public folly::AsyncServerSocket::AcceptCallback {
+ public:
+  explicit ServerConnectionDispatcher(std::shared_ptr<ServerWorkerPool> pool)
+      : pool_(pool) {}
+
+  void connectionAccepted(
+    int fd, const folly::SocketAddress& clientAddr) noexcept override;
+  void acceptError(const std::exception& ex) noexcept override;
+
+ private:
+  // The connections an accepting thread took in its current loop iteration
+  class Batch : public folly::EventBase::LoopCallback {
+   public:
+    ~Batch();
+
+    void add(const ServerWorkerPool::Worker& worker,
+             int fd, const folly::SocketAddress& clientAddr);
+
+    void runLoopCallback() noexcept override;
+
+   private:
+    struct Pending {
+      ServerWorkerPool::Worker worker;
+      Acceptor::AcceptedConnections conns;
+    };
+    std::vector<Pending> pending_;
+  };
+
+  std::shared_ptr<ServerWorkerPool> pool_;
+  folly::ThreadLocal<Batch> batch_;
+};
+
 class DefaultAcceptPipelineFactory
     : public PipelineFactory<wangle::Pipeline<void*>> {
 
@@ -12,15 +12,40 @@
 #include <wangle/concurrent/NamedThreadFactory.h>
 #include <wangle/channel/Handler.h>
 #include <folly/io/async/EventBaseManager.h>
+#include <folly/Likely.h>
+#include <folly/Random.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <limits>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+#endif
 
 namespace folly {
 
 void ServerWorkerPool::threadStarted(
   folly::wangle::ThreadPoolExecutor::ThreadHandle* h) {
   auto worker = acceptorFactory_->newAcceptor(exec_->getEventBase(h));
-  workers_.insert({h, worker});
+  {
+    std::lock_guard<std::mutex> g(workersLock_);
+    workers_.insert({h, Worker{
+      worker, std::make_shared<std::atomic<uint32_t>>(0)}});
+    publishLocked();
+  }
 
   for(auto socket : *sockets_) {
+    if (isDispatched(socket) || getSocketOwner(socket)) {
+      continue;
+    }
     socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
       [this, worker, socket](){
         socketFactory_->addAcceptCB(
@@ -33,25 +58,272 @@ void ServerWorkerPool::threadStopped(
   folly::wangle::ThreadPoolExecutor::ThreadHandle* h) {
   auto worker = workers_.find(h);
   CHECK(worker != workers_.end());
+  auto acceptor = worker->second.acceptor;
 
+  std::vector<std::shared_ptr<folly::AsyncSocketBase>> ownSockets;
   for (auto socket : *sockets_) {
+    auto owner = getSocketOwner(socket);
+    if (owner == acceptor.get()) {
+      ownSockets.push_back(socket);
+      continue;
+    }
+    if (isDispatched(socket) || owner) {
+      continue;
+    }
     socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
       [&]() {
         socketFactory_->removeAcceptCB(
-          socket, worker->second.get(), nullptr);
+          socket, acceptor.get(), nullptr);
     });
   }
 
-  if (!worker->second->getEventBase()->isInEventBaseThread()) {
-    worker->second->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+  // The thread's own listeners go away with it
+  for (auto& socket : ownSockets) {
+    socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+      [&]() {
+        socketFactory_->stopSocket(socket);
+    });
+    sockets_->erase(
+      std::find(sockets_->begin(), sockets_->end(), socket));
+    std::lock_guard<std::mutex> g(workersLock_);
+    workerSockets_.erase(socket.get());
+  }
+
+  if (!acceptor->getEventBase()->isInEventBaseThread()) {
+    acceptor->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
       [=]() {
-        worker->second->dropAllConnections();
+        acceptor->dropAllConnections();
       });
   } else {
-    worker->second->dropAllConnections();
+    acceptor->dropAllConnections();
   }
 
+  std::lock_guard<std::mutex> g(workersLock_);
   workers_.erase(worker);
+  publishLocked();
+}
+
+bool ServerWorkerPool::dropAllConnections(
+    std::chrono::steady_clock::time_point deadline) {
+  // Outlives the wait, if a worker's loop is too busy to get to it
+  struct Pending {
+    std::mutex lock;
+    std::condition_variable cv;
+    size_t left{0};
+  };
+  auto pending = std::make_shared<Pending>();
+  {
+    std::lock_guard<std::mutex> g(workersLock_);
+    pending->left = workers_.size();
+    for (const auto& kv : workers_) {
+      auto acceptor = kv.second.acceptor;
+      acceptor->getEventBase()->runInEventBaseThread([acceptor, pending] {
+        acceptor->dropAllConnections();
+        std::lock_guard<std::mutex> pg(pending->lock);
+        if (--pending->left == 0) {
+          pending->cv.notify_all();
+        }
+      });
+    }
+  }
+  std::unique_lock<std::mutex> pg(pending->lock);
+  return pending->cv.wait_until(
+    pg, deadline, [&] { return pending->left == 0; });
+}
+
+std::vector<std::shared_ptr<Acceptor>>
+ServerWorkerPool::getWorkersByThreadIndex() {
+  std::vector<std::pair<size_t, std::shared_ptr<Acceptor>>> indexed;
+  {
+    std::lock_guard<std::mutex> g(workersLock_);
+    for (const auto& kv : workers_) {
+      indexed.emplace_back(
+        folly::wangle::IOThreadPoolExecutor::getThreadIndex(kv.first),
+        kv.second.acceptor);
+    }
+  }
+  std::sort(indexed.begin(), indexed.end(),
+    [](const std::pair<size_t, std::shared_ptr<Acceptor>>& a,
+       const std::pair<size_t, std::shared_ptr<Acceptor>>& b) {
+      return a.first < b.first;
+    });
+  std::vector<std::shared_ptr<Acceptor>> workers;
+  for (auto& p : indexed) {
+    workers.push_back(std::move(p.second));
+  }
+  return workers;
+}
+
+bool attachReusePortCpuFilter(int fd, uint32_t numSockets) {
+#ifdef __linux__
+  // ld cpu; mod numSockets; ret a: pick the group's socket by CPU number
+  struct sock_filter code[] = {
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0, uint32_t(SKF_AD_OFF + SKF_AD_CPU) },
+    { BPF_ALU | BPF_MOD | BPF_K, 0, 0, numSockets },
+    { BPF_RET | BPF_A, 0, 0, 0 },
+  };
+  struct sock_fprog prog;
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+  if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                 &prog, sizeof(prog)) == 0) {
+    return true;
+  }
+  PLOG(WARNING) << "Unable to attach SO_REUSEPORT CPU filter";
+#endif
+  return false;
+}
+
+void ServerWorkerPool::publishLocked() {
+  auto snapshot = std::make_shared<Snapshot>();
+  snapshot->workers.reserve(workers_.size());
+  for (const auto& kv : workers_) {
+    snapshot->workers.push_back(kv.second);
+  }
+  snapshot->selection = selection_;
+  snapshot->weight = weight_;
+  snapshot_ = std::move(snapshot);
+  // Makes every accepting thread fetch the new snapshot on its next pick
+  version_.fetch_add(1, std::memory_order_release);
+}
+
+const ServerWorkerPool::Snapshot& ServerWorkerPool::getSnapshot() {
+  auto& cached = *cachedSnapshot_;
+  if (UNLIKELY(cached.version !=
+               version_.load(std::memory_order_acquire))) {
+    std::lock_guard<std::mutex> g(workersLock_);
+    cached.snapshot = snapshot_;
+    cached.version = version_.load(std::memory_order_relaxed);
+  }
+  return *cached.snapshot;
+}
+
+uint64_t ServerWorkerPool::getLoad(
+    const Snapshot& snapshot, const Worker& worker) {
+  uint64_t weight = snapshot.weight ?
+    snapshot.weight(*worker.acceptor) :
+    worker.acceptor->getNumConnectionsRelaxed();
+  weight += worker.inFlight->load(std::memory_order_relaxed);
+  // After all the others, but still by weight among themselves
+  if (worker.acceptor->isLoopOverloaded()) {
+    weight += std::numeric_limits<uint32_t>::max();
+  }
+  return weight;
+}
+
+ServerWorkerPool::Worker ServerWorkerPool::pickWorker() {
+  const auto& snapshot = getSnapshot();
+  const auto& workers = snapshot.workers;
+  if (workers.empty()) {
+    return Worker();
+  }
+  switch (snapshot.selection) {
+    case WorkerSelection::THREAD_SELECTOR: {
+      auto base = exec_->getEventBase();
+      for (const auto& worker : workers) {
+        if (worker.acceptor->getEventBase() == base) {
+          return worker;
+        }
+      }
+      return Worker();
+    }
+
+    case WorkerSelection::LEAST_LOADED: {
+      size_t best = 0;
+      auto bestLoad = getLoad(snapshot, workers[0]);
+      for (size_t i = 1; i < workers.size(); ++i) {
+        auto load = getLoad(snapshot, workers[i]);
+        if (load < bestLoad) {
+          best = i;
+          bestLoad = load;
+        }
+      }
+      return workers[best];
+    }
+
+    case WorkerSelection::POWER_OF_TWO_CHOICES: {
+      auto n = workers.size();
+      auto a = folly::Random::rand32(n);
+      if (n == 1) {
+        return workers[a];
+      }
+      // Pick a different second worker
+      auto b = folly::Random::rand32(n - 1);
+      if (b == a) {
+        b = n - 1;
+      }
+      return getLoad(snapshot, workers[a]) <= getLoad(snapshot, workers[b]) ?
+        workers[a] : workers[b];
+    }
+  }
+  return Worker();
+}
+
+void ServerConnectionDispatcher::connectionAccepted(
+    int fd, const folly::SocketAddress& clientAddr) noexcept {
+  auto worker = pool_->pickWorker();
+  if (!worker.acceptor) {
+    LOG(ERROR) << "No worker available for accepted connection";
+    close(fd);
+    return;
+  }
+  // Counted from now on, so the next pickWorker() sees it
+  worker.inFlight->fetch_add(1, std::memory_order_relaxed);
+  auto& batch = *batch_;
+  batch.add(worker, fd, clientAddr);
+  if (!batch.isLoopCallbackScheduled()) {
+    EventBaseManager::get()->getEventBase()->runInLoop(&batch);
+  }
+}
+
+ServerConnectionDispatcher::Batch::~Batch() {
+  for (auto& p : pending_) {
+    p.worker.inFlight->fetch_sub(p.conns.size(), std::memory_order_relaxed);
+    for (auto& conn : p.conns) {
+      close(conn.first);
+    }
+  }
+}
+
+void ServerConnectionDispatcher::Batch::add(
+    const ServerWorkerPool::Worker& worker,
+    int fd, const folly::SocketAddress& clientAddr) {
+  for (auto& p : pending_) {
+    if (p.worker.acceptor == worker.acceptor) {
+      p.conns.emplace_back(fd, clientAddr);
+      return;
+    }
+  }
+  pending_.push_back(Pending{worker, {}});
+  pending_.back().conns.emplace_back(fd, clientAddr);
+}
+
+void ServerConnectionDispatcher::Batch::runLoopCallback() noexcept {
+  auto pending = std::move(pending_);
+  pending_.clear();
+  for (auto& p : pending) {
+    auto worker = p.worker;
+    auto n = p.conns.size();
+    auto conns = std::make_shared<Acceptor::AcceptedConnections>(
+      std::move(p.conns));
+    if (worker.acceptor->getEventBase()->runInEventBaseThread(
+          [worker, conns, n]() {
+            worker.acceptor->connectionsAccepted(*conns);
+            worker.inFlight->fetch_sub(n, std::memory_order_relaxed);
+          })) {
+      continue;
+    }
+    worker.inFlight->fetch_sub(n, std::memory_order_relaxed);
+    LOG(ERROR) << "Worker unavailable for " << n << " accepted connections";
+    for (auto& conn : *conns) {
+      close(conn.first);
+    }
+  }
+}
+
+void ServerConnectionDispatcher::acceptError(
+    const std::exception& ex) noexcept {
+  LOG(ERROR) << "Error accepting connection: " << ex.what();
 }
 
 } // namespace
@@ -11,6 +11,9 @@
 #pragma once
 
 #include <wangle/bootstrap/ServerBootstrap-inl.h>
+#include <wangle/bootstrap/LoopbackServerSocket.h>
+#include <wangle/bootstrap/ShmServerSocket.h>
+#include <wangle/bootstrap/SocketTakeover.h>
 #include <folly/Baton.h>
 #include <wangle/channel/Pipeline.h>
 #include <iostream>
@@ -58,6 +61,53 @@ class ServerBootstrap {
     return this;
   }
 
+  /*
+   * Assign accepted TCP connections to IO threads with the IO group's
+   * ThreadSelector (see IOThreadPoolExecutor), instead of letting
+   * AsyncServerSocket rotate through the IO threads.  Accepted sockets are
+   * handed over from the accepting thread.  Must be set before bind().
+   */
+  ServerBootstrap* useThreadSelector(bool use) {
+    useThreadSelector_ = use;
+    return this;
+  }
+
+  /*
+   * Like useThreadSelector(), but assign each accepted TCP connection to
+   * the worker with the fewest connections, or the one with fewer of two
+   * random workers; see ServerWorkerPool::WorkerSelection.  A weight can
+   * be given to balance on something other than the connection count.
+   * Must be set before bind().
+   */
+  ServerBootstrap* workerSelection(
+      ServerWorkerPool::WorkerSelection selection,
+      ServerWorkerPool::WorkerWeight weight = nullptr) {
+    useThreadSelector_ = true;
+    workerSelection_ = selection;
+    workerWeight_ = std::move(weight);
+    if (workerFactory_) {
+      workerFactory_->setWorkerSelection(workerSelection_, workerWeight_);
+    }
+    return this;
+  }
+
+  /*
+   * Give every IO thread a SO_REUSEPORT listener of its own, on its
+   * EventBase, instead of accepting on the acceptor group and handing
+   * connections over; the kernel spreads connections across them.  With
+   * steerByCpu, a filter makes the kernel pick the listener by the CPU
+   * the connection arrived on: IO thread i (see
+   * IOThreadPoolExecutor::getThreadIndex()) gets the connections from
+   * CPU i modulo the number of threads, so pin the threads accordingly,
+   * e.g. with an AffinityThreadFactory.  Threads added after bind() get
+   * no listener.  Must be set before bind().
+   */
+  ServerBootstrap* perThreadListeners(bool enable, bool steerByCpu = false) {
+    perThreadListeners_ = enable;
+    steerByCpu_ = steerByCpu;
+    return this;
+  }
+
   ServerBootstrap* channelFactory(
     std::shared_ptr<ServerSocketFactory> factory) {
     socketFactory_ = factory;
@@ -86,6 +136,41 @@ class ServerBootstrap {
     return this;
   }
 
+  /*
+   * Reuse the child pipelines of closed connections for new ones, rather
+   * than building each with newPipeline(); each IO thread pools up to
+   * maxPooled.  The child pipeline factory has to implement
+   * PipelineFactory::resetPipeline(), e.g. with
+   * AsyncSocketHandler::resetSocket().  prewarmed pipelines per thread
+   * are built up front, with PipelineFactory::newUnboundPipeline(), for
+   * factories that implement it.  A pipeline is pooled at the end of the
+   * loop iteration its connection closed in, and only if nothing holds a
+   * DestructorGuard on it anymore.  Must be set before group().
+   */
+  ServerBootstrap* pipelinePool(size_t maxPooled, size_t prewarmed = 0) {
+    maxPooledPipelines_ = maxPooled;
+    prewarmedPipelines_ = prewarmed;
+    return this;
+  }
+
+  /*
+   * Prewarm the workers before the server starts listening, so its first
+   * connections don't pay for per-thread setup: bind() and takeOver()
+   * first run Acceptor::prewarm() and the callbacks in every worker's
+   * thread, all of them at once, and wait for them to finish.  Call it
+   * again to add callbacks, e.g. to fill application caches or to call
+   * AsyncSocketHandler::prewarmThread().  An exception thrown by a
+   * callback is rethrown by bind().
+   */
+  ServerBootstrap* prewarm(
+      std::function<void(Acceptor*)> callback = nullptr) {
+    prewarm_ = true;
+    if (callback) {
+      prewarmCallbacks_.push_back(std::move(callback));
+    }
+    return this;
+  }
+
   /*
    * Set the IO executor.  If not set, a default one will be created
    * with one thread per core.
@@ -134,10 +219,14 @@ class ServerBootstrap {
       workerFactory_ = std::make_shared<ServerWorkerPool>(
         std::make_shared<ServerAcceptorFactory<Pipeline>>(
           childPipelineFactory_,
-          pipeline_),
+          pipeline_,
+          socketConfig,
+          maxPooledPipelines_,
+          prewarmedPipelines_),
         io_group.get(), sockets_, socketFactory_);
     }
 
+    workerFactory_->setWorkerSelection(workerSelection_, workerWeight_);
     io_group->addObserver(workerFactory_);
 
     acceptor_group_ = accept_group;
@@ -156,6 +245,8 @@ class ServerBootstrap {
       group(nullptr);
     }
 
+    prewarmWorkers();
+
     // Since only a single socket is given,
     // we can only accept on a single thread
     CHECK(acceptor_group_->numThreads() == 1);
@@ -172,14 +263,7 @@ class ServerBootstrap {
     });
     barrier.wait();
 
-    // Startup all the threads
-    workerFactory_->forEachWorker([this, socket](Acceptor* worker){
-      socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
-        [this, worker, socket](){
-          socketFactory_->addAcceptCB(socket, worker, worker->getEventBase());
-      });
-    });
-
+    addAcceptCallbacks(socket);
     sockets_->push_back(socket);
   }
 
@@ -199,72 +283,258 @@ class ServerBootstrap {
     bindImpl(port, address);
   }
 
+  /*
+   * Bind to "host:port"; with "shm:<path>" listen for ShmSockets on the
+   * Unix socket at path, and with "loopback:<name>" for LoopbackSockets
+   * from this process.  Those listeners run in one acceptor thread and
+   * take the default socket factory.
+   *
+   * @param address Where to listen
+   */
+  void bind(const std::string& address) {
+    static const std::string kShmScheme = "shm:";
+    static const std::string kLoopbackScheme = "loopback:";
+    if (address.compare(0, kShmScheme.size(), kShmScheme) == 0) {
+      auto path = address.substr(kShmScheme.size());
+      bindListener([path](EventBase* base) {
+        return ShmServerSocket::newSocket(base, path);
+      });
+      return;
+    }
+    if (address.compare(0, kLoopbackScheme.size(), kLoopbackScheme) == 0) {
+      auto name = address.substr(kLoopbackScheme.size());
+      bindListener([name](EventBase* base) {
+        return LoopbackServerSocket::newSocket(base, name);
+      });
+      return;
+    }
+    folly::SocketAddress socketAddress;
+    socketAddress.setFromHostPort(address);
+    bind(socketAddress);
+  }
+
   void bindImpl(int port, folly::SocketAddress& address) {
     if (!workerFactory_) {
       group(nullptr);
     }
+    prewarmWorkers();
 
-    bool reusePort = false;
-    if (acceptor_group_->numThreads() > 1) {
-      reusePort = true;
+    if (perThreadListeners_) {
+      bindPerThread(port, address);
+      return;
     }
 
-    std::mutex sock_lock;
-    std::vector<std::shared_ptr<folly::AsyncSocketBase>> new_sockets;
-
-
-    std::exception_ptr exn;
-
-    auto startupFunc = [&](std::shared_ptr<folly::Baton<>> barrier){
+    // Each acceptor thread listens on a socket of its own, created, bound
+    // and attached to the workers in parallel with the others
+    auto threads = acceptor_group_->numThreads();
+    bool reusePort = threads > 1;
+    std::vector<std::shared_ptr<folly::AsyncSocketBase>> new_sockets(threads);
+    std::vector<std::exception_ptr> errors(threads);
+    // The dispatcher is shared, so it's attached below
+    bool attach = !useThreadSelector_;
 
+    std::atomic<size_t> pending{0};
+    folly::Baton<> barrier;
+    auto startupFunc = [&](size_t i) {
       try {
         auto socket = socketFactory_->newSocket(
           port, address, socketConfig.acceptBacklog, reusePort, socketConfig);
-
-        sock_lock.lock();
-        new_sockets.push_back(socket);
-        sock_lock.unlock();
-
-        if (port <= 0) {
-          socket->getAddress(&address);
-          port = address.getPort();
+        if (attach) {
+          // Runs inline, in the socket's thread
+          addAcceptCallbacks(socket);
         }
-
-        barrier->post();
+        new_sockets[i] = std::move(socket);
       } catch (...) {
-        exn = std::current_exception();
-        barrier->post();
+        errors[i] = std::current_exception();
+      }
+      if (--pending == 0) {
+        barrier.post();
+      }
+    };
 
-        return;
+    // The first socket picks an ephemeral port for the rest
+    size_t first = 0;
+    if (port == 0 || (port < 0 && address.getPort() == 0)) {
+      pending = 1;
+      acceptor_group_->add(std::bind(startupFunc, 0));
+      barrier.wait();
+      barrier.reset();
+      if (new_sockets[0]) {
+        folly::SocketAddress bound;
+        new_sockets[0]->getAddress(&bound);
+        if (port == 0) {
+          port = bound.getPort();
+        } else {
+          address.setPort(bound.getPort());
+        }
+        first = 1;
+      } else {
+        first = threads;
       }
+    }
 
+    if (first < threads) {
+      pending = threads - first;
+      for (size_t i = first; i < threads; i++) {
+        acceptor_group_->add(std::bind(startupFunc, i));
+      }
+      barrier.wait();
+    }
 
+    for (auto& exn : errors) {
+      if (exn) {
+        for (auto& socket : new_sockets) {
+          if (socket) {
+            socket->getEventBase()
+              ->runImmediatelyOrRunInEventBaseThreadAndWait([&]() {
+                socketFactory_->stopSocket(socket);
+              });
+          }
+        }
+        std::rethrow_exception(exn);
+      }
+    }
 
-    };
+    if (port < 0) {
+      new_sockets[0]->getAddress(&address);
+    }
+    for (auto& socket : new_sockets) {
+      if (!attach) {
+        addAcceptCallbacks(socket);
+      }
+      sockets_->push_back(socket);
+    }
+  }
 
-    auto wait0 = std::make_shared<folly::Baton<>>();
-    acceptor_group_->add(std::bind(startupFunc, wait0));
-    wait0->wait();
+  void bindPerThread(int port, folly::SocketAddress& address) {
+    auto workers = workerFactory_->getWorkersByThreadIndex();
+    CHECK(!workers.empty());
 
-    for (size_t i = 1; i < acceptor_group_->numThreads(); i++) {
-      auto barrier = std::make_shared<folly::Baton<>>();
-      acceptor_group_->add(std::bind(startupFunc, barrier));
-      barrier->wait();
+    std::vector<std::shared_ptr<folly::AsyncSocketBase>> new_sockets;
+    for (auto& worker : workers) {
+      std::exception_ptr exn;
+      worker->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+        [&]() {
+          try {
+            auto socket = socketFactory_->newSocket(
+              port, address, socketConfig.acceptBacklog, true, socketConfig);
+            // The rest join the first one's port if it was ephemeral
+            if (port == 0) {
+              folly::SocketAddress bound;
+              socket->getAddress(&bound);
+              port = bound.getPort();
+            } else if (port < 0) {
+              socket->getAddress(&address);
+            }
+            workerFactory_->addWorkerSocket(socket, worker.get());
+            socketFactory_->addAcceptCB(
+              socket, worker.get(), worker->getEventBase());
+            new_sockets.push_back(socket);
+          } catch (...) {
+            exn = std::current_exception();
+          }
+        });
+      if (exn) {
+        std::rethrow_exception(exn);
+      }
     }
 
-    if (exn) {
-      std::rethrow_exception(exn);
+    auto serverSocket =
+      std::dynamic_pointer_cast<AsyncServerSocket>(new_sockets[0]);
+    if (steerByCpu_ && serverSocket) {
+      new_sockets[0]->getEventBase()
+        ->runImmediatelyOrRunInEventBaseThreadAndWait([&]() {
+          for (auto fd : serverSocket->getSockets()) {
+            attachReusePortCpuFilter(fd, new_sockets.size());
+          }
+        });
     }
 
     for (auto& socket : new_sockets) {
-      // Startup all the threads
-      workerFactory_->forEachWorker([this, socket](Acceptor* worker){
-        socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
-          [this, worker, socket](){
-            socketFactory_->addAcceptCB(socket, worker, worker->getEventBase());
+      sockets_->push_back(socket);
+    }
+  }
+
+  /*
+   * Hot restart, in the running server: waits for the server replacing it
+   * to call takeOver() with the same path, hands it the listening sockets
+   * (see SocketTakeover.h), then stops listening and drains the existing
+   * connections, as the new server accepts the next ones.  Blocks until
+   * the new server takes the sockets, or throws after timeout.
+   *
+   * @param path Unix socket for the takeover, known to both servers
+   */
+  void offerTakeover(
+      const std::string& path,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(60000)) {
+    TakeoverSockets takeover;
+    for (auto& socket : *sockets_) {
+      if (std::dynamic_pointer_cast<ListenerSocket>(socket)) {
+        // The new server binds its own
+        continue;
+      }
+      auto serverSocket =
+        std::dynamic_pointer_cast<AsyncServerSocket>(socket);
+      CHECK(serverSocket) << "only TCP sockets can be taken over";
+      socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+        [&]() {
+          takeover.push_back(serverSocket->getSockets());
         });
+    }
+    sendTakeoverSockets(path, takeover, timeout);
+
+    stop();
+    forEachWorker([](Acceptor* worker) {
+      worker->getEventBase()->runInEventBaseThread([worker]() {
+        worker->drainAllConnections();
+      });
+    });
+  }
+
+  /*
+   * Hot restart, in the new server: listens on the sockets of the server
+   * calling offerTakeover() with the same path, instead of binding, so no
+   * connection is refused during the restart.  The sockets are spread
+   * over the acceptor threads like bind()'s.  One of childPipeline or
+   * childHandler must be called before.
+   *
+   * @param path Unix socket for the takeover, known to both servers
+   */
+  void takeOver(const std::string& path) {
+    if (!workerFactory_) {
+      group(nullptr);
+    }
+    CHECK(!perThreadListeners_);
+    prewarmWorkers();
+
+    auto takeover = receiveTakeoverSockets(path);
+
+    std::vector<std::shared_ptr<folly::AsyncSocketBase>> new_sockets;
+    for (auto& fds : takeover) {
+      std::exception_ptr exn;
+      folly::Baton<> barrier;
+      acceptor_group_->add([&]() {
+        try {
+          std::shared_ptr<folly::AsyncServerSocket> socket(
+            new AsyncServerSocket(EventBaseManager::get()->getEventBase()),
+            DelayedDestruction::Destructor());
+          socket->useExistingSockets(fds);
+          socket->listen(socketConfig.acceptBacklog);
+          socket->startAccepting();
+          new_sockets.push_back(socket);
+        } catch (...) {
+          exn = std::current_exception();
+        }
+        barrier.post();
       });
+      barrier.wait();
+      if (exn) {
+        std::rethrow_exception(exn);
+      }
+    }
 
+    for (auto& socket : new_sockets) {
+      addAcceptCallbacks(socket);
       sockets_->push_back(socket);
     }
   }
@@ -301,6 +571,36 @@ class ServerBootstrap {
     }
   }
 
+  /*
+   * join(), within timeout in all.  After stop(), the workers drop their
+   * connections on all the IO threads at once rather than one thread
+   * after another, and the threads of each group drain their tasks in
+   * parallel; what's still queued at the deadline is left.  Returns the
+   * ids of the threads that overran it.
+   */
+  std::vector<std::thread::id> join(std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto left = [deadline] {
+      return std::max(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now()),
+        std::chrono::milliseconds(0));
+    };
+    std::vector<std::thread::id> overran;
+    if (acceptor_group_) {
+      overran = acceptor_group_->join(left());
+    }
+    if (workerFactory_ && stopped_ &&
+        !workerFactory_->dropAllConnections(deadline)) {
+      LOG(WARNING) << "Workers still dropping connections at the deadline";
+    }
+    if (io_group_) {
+      auto ioOverran = io_group_->join(left());
+      overran.insert(overran.end(), ioOverran.begin(), ioOverran.end());
+    }
+    return overran;
+  }
+
   void waitForStop() {
     if (!stopped_) {
       CHECK(stopBaton_);
@@ -325,9 +625,107 @@ class ServerBootstrap {
     workerFactory_->forEachWorker(f);
   }
 
+  /*
+   * Settings of the listening sockets and of the child pipelines'
+   * acceptors.  The acceptors copy it when group() creates them, so set
+   * it before that.
+   */
   ServerSocketConfig socketConfig;
 
  private:
+  void prewarmWorkers() {
+    if (!prewarm_ || prewarmed_) {
+      return;
+    }
+    prewarmed_ = true;
+    std::vector<Acceptor*> workers;
+    forEachWorker([&](Acceptor* worker) {
+      workers.push_back(worker);
+    });
+    if (workers.empty()) {
+      return;
+    }
+
+    std::atomic<size_t> pending{workers.size()};
+    std::mutex exnLock;
+    std::exception_ptr exn;
+    folly::Baton<> barrier;
+    for (auto worker : workers) {
+      worker->getEventBase()->runInEventBaseThread([&, worker]() {
+        try {
+          worker->prewarm();
+          for (auto& callback : prewarmCallbacks_) {
+            callback(worker);
+          }
+        } catch (...) {
+          std::lock_guard<std::mutex> g(exnLock);
+          if (!exn) {
+            exn = std::current_exception();
+          }
+        }
+        if (--pending == 0) {
+          barrier.post();
+        }
+      });
+    }
+    barrier.wait();
+    if (exn) {
+      std::rethrow_exception(exn);
+    }
+  }
+
+  // Makes a ListenerSocket in an acceptor thread
+  void bindListener(
+      std::function<std::shared_ptr<ListenerSocket>(EventBase*)> factory) {
+    if (!workerFactory_) {
+      group(nullptr);
+    }
+    prewarmWorkers();
+
+    std::shared_ptr<folly::AsyncSocketBase> socket;
+    std::exception_ptr error;
+    folly::Baton<> barrier;
+    acceptor_group_->add([&](){
+      try {
+        socket = factory(EventBaseManager::get()->getEventBase());
+      } catch (...) {
+        error = std::current_exception();
+      }
+      barrier.post();
+    });
+    barrier.wait();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+
+    addAcceptCallbacks(socket);
+    sockets_->push_back(socket);
+  }
+
+  void addAcceptCallbacks(std::shared_ptr<folly::AsyncSocketBase> socket) {
+    auto serverSocket = std::dynamic_pointer_cast<AsyncServerSocket>(socket);
+    if (useThreadSelector_ && serverSocket) {
+      if (!dispatcher_) {
+        dispatcher_ =
+          std::make_shared<ServerConnectionDispatcher>(workerFactory_);
+      }
+      workerFactory_->setDispatchConnections(true);
+      socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+        [this, serverSocket](){
+          serverSocket->addAcceptCallback(dispatcher_.get(), nullptr);
+      });
+      return;
+    }
+
+    // Startup all the threads
+    workerFactory_->forEachWorker([this, socket](Acceptor* worker){
+      socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+        [this, worker, socket](){
+          socketFactory_->addAcceptCB(socket, worker, worker->getEventBase());
+      });
+    });
+  }
+
   std::shared_ptr<wangle::IOThreadPoolExecutor> acceptor_group_;
   std::shared_ptr<wangle::IOThreadPoolExecutor> io_group_;
 
@@ -345,6 +743,18 @@ class ServerBootstrap {
   std::unique_ptr<folly::Baton<>> stopBaton_{
     folly::make_unique<folly::Baton<>>()};
   bool stopped_{false};
+  bool useThreadSelector_{false};
+  bool perThreadListeners_{false};
+  bool prewarm_{false};
+  bool prewarmed_{false};
+  std::vector<std::function<void(Acceptor*)>> prewarmCallbacks_;
+  size_t maxPooledPipelines_{0};
+  size_t prewarmedPipelines_{0};
+  bool steerByCpu_{false};
+  ServerWorkerPool::WorkerSelection workerSelection_{
+    ServerWorkerPool::WorkerSelection::THREAD_SELECTOR};
+  ServerWorkerPool::WorkerWeight workerWeight_;
+  std::shared_ptr<ServerConnectionDispatcher> dispatcher_;
 };
 
 } // namespace
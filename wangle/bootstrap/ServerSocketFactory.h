@@ -11,6 +11,7 @@
 #pragma once
 
 #include <wangle/bootstrap/ServerBootstrap-inl.h>
+#include <wangle/bootstrap/ListenerSocket.h>
 #include <folly/io/async/AsyncServerSocket.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <folly/io/async/AsyncUDPServerSocket.h>
@@ -45,6 +46,9 @@ class AsyncServerSocketFactory : public ServerSocketFactory {
     } else {
       socket->bind(address);
     }
+    for (auto fd : socket->getSockets()) {
+      config.applyListenerSocketOptions(fd);
+    }
 
     socket->listen(config.acceptBacklog);
     socket->startAccepting();
@@ -54,6 +58,10 @@ class AsyncServerSocketFactory : public ServerSocketFactory {
 
   virtual void stopSocket(
     std::shared_ptr<AsyncSocketBase>& s) {
+    if (auto listener = std::dynamic_pointer_cast<ListenerSocket>(s)) {
+      listener->stop();
+      return;
+    }
     auto socket = std::dynamic_pointer_cast<AsyncServerSocket>(s);
     DCHECK(socket);
     socket->stopAccepting();
@@ -62,6 +70,10 @@ class AsyncServerSocketFactory : public ServerSocketFactory {
 
   virtual void removeAcceptCB(std::shared_ptr<AsyncSocketBase> s,
                               Acceptor *callback, EventBase* base) {
+    if (auto listener = std::dynamic_pointer_cast<ListenerSocket>(s)) {
+      listener->removeAcceptor(callback);
+      return;
+    }
     auto socket = std::dynamic_pointer_cast<AsyncServerSocket>(s);
     CHECK(socket);
     socket->removeAcceptCallback(callback, base);
@@ -69,6 +81,10 @@ class AsyncServerSocketFactory : public ServerSocketFactory {
 
   virtual void addAcceptCB(std::shared_ptr<AsyncSocketBase> s,
                                  Acceptor* callback, EventBase* base) {
+    if (auto listener = std::dynamic_pointer_cast<ListenerSocket>(s)) {
+      listener->addAcceptor(callback, base);
+      return;
+    }
     auto socket = std::dynamic_pointer_cast<AsyncServerSocket>(s);
     CHECK(socket);
     socket->addAcceptCallback(callback, base);
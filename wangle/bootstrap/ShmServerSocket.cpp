@@ -0,0 +1,160 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/bootstrap/ShmServerSocket.h>
+
+#include <folly/Exception.h>
+#include <folly/MoveWrapper.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace folly {
+
+using wangle::ShmSocket;
+
+const std::chrono::milliseconds ShmServerSocket::kHandshakeTimeout(5000);
+
+ShmServerSocket::Handshake::~Handshake() {
+  unregisterHandler();
+  if (fd_ != -1) {
+    ::close(fd_);
+  }
+}
+
+void ShmServerSocket::Handshake::handlerReady(uint16_t /*events*/) noexcept {
+  ShmSocket::UniquePtr socket;
+  try {
+    socket = ShmSocket::newServerSocket(fd_, server_->address_);
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Dropping shm connection from " << clientAddr_.describe()
+               << ": " << ex.what();
+    server_->handshakes_.erase(this);
+    return;
+  }
+  if (!socket) {
+    registerHandler(EventHandler::READ);
+    return;
+  }
+  timeout_.cancelTimeout();
+  // The socket has the fd now
+  fd_ = -1;
+  auto server = server_;
+  auto clientAddr = clientAddr_;
+  server->handshakes_.erase(this);
+  server->dispatch(std::move(socket), clientAddr);
+}
+
+void ShmServerSocket::Handshake::start() {
+  timeout_.scheduleTimeout(kHandshakeTimeout);
+  // Usually sent along with the connect
+  handlerReady(EventHandler::READ);
+}
+
+void ShmServerSocket::Handshake::Timeout::timeoutExpired() noexcept {
+  LOG(ERROR) << "Dropping shm connection from "
+             << handshake_->clientAddr_.describe()
+             << ": no handshake in time";
+  handshake_->server_->handshakes_.erase(handshake_);
+}
+
+std::shared_ptr<ShmServerSocket> ShmServerSocket::newSocket(
+    EventBase* evb, const std::string& path) {
+  std::shared_ptr<ShmServerSocket> server(new ShmServerSocket(evb, path));
+  // What's left of a server that's gone
+  ::unlink(path.c_str());
+  server->socket_->bind(server->address_);
+  // Before listening, so no one else can connect in between
+  checkUnixError(::chmod(path.c_str(), S_IRUSR | S_IWUSR),
+                 "chmod() of ", path, " failed");
+  server->socket_->listen(1024);
+  server->socket_->addAcceptCallback(server.get(), nullptr);
+  server->socket_->startAccepting();
+  return server;
+}
+
+ShmServerSocket::ShmServerSocket(EventBase* evb, const std::string& path)
+  : evb_(evb),
+    socket_(new AsyncServerSocket(evb)) {
+  address_.setFromPath(path);
+}
+
+ShmServerSocket::~ShmServerSocket() {
+  if (socket_) {
+    stop();
+  }
+}
+
+void ShmServerSocket::addAcceptor(Acceptor* acceptor, EventBase* base) {
+  acceptors_.emplace_back(acceptor, base);
+}
+
+void ShmServerSocket::removeAcceptor(Acceptor* acceptor) {
+  acceptors_.erase(
+    std::remove_if(acceptors_.begin(), acceptors_.end(),
+                   [acceptor](const std::pair<Acceptor*, EventBase*>& a) {
+                     return a.first == acceptor;
+                   }),
+    acceptors_.end());
+}
+
+void ShmServerSocket::stop() {
+  if (!socket_) {
+    return;
+  }
+  socket_->stopAccepting();
+  socket_->detachEventBase();
+  socket_.reset();
+  handshakes_.clear();
+  ::unlink(address_.getPath().c_str());
+}
+
+void ShmServerSocket::connectionAccepted(
+    int fd, const SocketAddress& clientAddr) noexcept {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 ||
+      cred.uid != ::geteuid()) {
+    LOG(ERROR) << "Dropping shm connection from "
+               << clientAddr.describe() << ": not from this user";
+    ::close(fd);
+    return;
+  }
+  auto handshake = new Handshake(this, fd, clientAddr);
+  handshakes_[handshake].reset(handshake);
+  handshake->start();
+}
+
+void ShmServerSocket::acceptError(const std::exception& ex) noexcept {
+  LOG(ERROR) << "Error accepting on " << address_.describe() << ": "
+             << ex.what();
+}
+
+void ShmServerSocket::dispatch(ShmSocket::UniquePtr socket,
+                               const SocketAddress& clientAddr) {
+  if (acceptors_.empty()) {
+    socket->closeNow();
+    return;
+  }
+  auto& target = acceptors_[nextAcceptor_++ % acceptors_.size()];
+  auto acceptor = target.first;
+  auto base = target.second;
+  auto sock = folly::makeMoveWrapper(std::move(socket));
+  base->runInEventBaseThread([acceptor, base, sock, clientAddr]() mutable {
+    (*sock)->attachEventBase(base);
+    acceptor->transportAccepted(std::move(*sock), clientAddr);
+  });
+}
+
+} // namespace
@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/bootstrap/ListenerSocket.h>
+#include <wangle/channel/ShmSocket.h>
+#include <folly/io/async/AsyncServerSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace folly {
+
+/*
+ * Listens for ShmSockets on a Unix socket: takes the rings each client
+ * sends once it connects, and hands the connections to its acceptors by
+ * turns.  ServerBootstrap::bind("shm:<path>") makes one in an acceptor
+ * thread.
+ *
+ * Only processes of the server's own user may connect: the socket is
+ * created accessible to it alone, and the peer credentials of each
+ * connection are checked.  Clients that don't send their rings within
+ * kHandshakeTimeout are dropped.
+ */
+class ShmServerSocket : public ListenerSocket,
+                        private AsyncServerSocket::AcceptCallback {
+ public:
+  static const std::chrono::milliseconds kHandshakeTimeout;
+
+  /*
+   * Listens on path from evb's thread, replacing a socket a server that's
+   * gone left there.  Throws on errors.
+   */
+  static std::shared_ptr<ShmServerSocket> newSocket(EventBase* evb,
+                                                    const std::string& path);
+
+  ~ShmServerSocket();
+
+  void addAcceptor(Acceptor* acceptor, EventBase* base) override;
+  void removeAcceptor(Acceptor* acceptor) override;
+  void stop() override;
+
+  EventBase* getEventBase() const override {
+    return evb_;
+  }
+
+  void getAddress(SocketAddress* address) const override {
+    *address = address_;
+  }
+
+ private:
+  // Waits for a client's rings, for up to kHandshakeTimeout
+  class Handshake : public EventHandler {
+   public:
+    Handshake(ShmServerSocket* server, int fd,
+              const SocketAddress& clientAddr)
+      : EventHandler(server->evb_, fd),
+        server_(server),
+        fd_(fd),
+        clientAddr_(clientAddr),
+        timeout_(this) {}
+
+    ~Handshake();
+
+    void handlerReady(uint16_t events) noexcept override;
+
+    void start();
+
+   private:
+    class Timeout : public AsyncTimeout {
+     public:
+      explicit Timeout(Handshake* handshake)
+        : AsyncTimeout(handshake->server_->evb_), handshake_(handshake) {}
+
+      void timeoutExpired() noexcept override;
+
+     private:
+      Handshake* handshake_;
+    };
+
+    ShmServerSocket* server_;
+    int fd_;
+    SocketAddress clientAddr_;
+    Timeout timeout_;
+  };
+
+  ShmServerSocket(EventBase* evb, const std::string& path);
+
+  void connectionAccepted(int fd, const SocketAddress& clientAddr)
+    noexcept override;
+  void acceptError(const std::exception& ex) noexcept override;
+
+  void dispatch(wangle::ShmSocket::UniquePtr socket,
+                const SocketAddress& clientAddr);
+
+  EventBase* evb_;
+  SocketAddress address_;
+  AsyncServerSocket::UniquePtr socket_;
+  std::vector<std::pair<Acceptor*, EventBase*>> acceptors_;
+  size_t nextAcceptor_{0};
+  std::map<Handshake*, std::unique_ptr<Handshake>> handshakes_;
+};
+
+} // namespace
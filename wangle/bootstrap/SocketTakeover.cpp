@@ -0,0 +1,230 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/bootstrap/SocketTakeover.h>
+
+#include <folly/Exception.h>
+#include <folly/ScopeGuard.h>
+#include <folly/SocketAddress.h>
+#include <glog/logging.h>
+
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace folly {
+
+namespace {
+
+const uint32_t kTakeoverMagic = 0x7a6b7631;
+// SCM_MAX_FD on Linux
+const size_t kMaxTakeoverFds = 253;
+
+// The message: kTakeoverMagic, the number of groups, and the number of
+// sockets in each, with all the sockets attached in order
+struct TakeoverHeader {
+  uint32_t magic;
+  uint32_t groups;
+  uint32_t counts[kMaxTakeoverFds];
+};
+
+int unixSocket(const std::string& path, sockaddr_storage* addr,
+               socklen_t* len) {
+  SocketAddress address;
+  address.setFromPath(path);
+  *len = address.getAddress(addr);
+  int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  checkUnixError(fd, "takeover socket() failed");
+  return fd;
+}
+
+// Accepts a connection from a process of this user, before the deadline
+int acceptOwnUser(int listenFd,
+                  std::chrono::steady_clock::time_point deadline) {
+  for (;;) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+      deadline - std::chrono::steady_clock::now());
+    if (remaining <= std::chrono::milliseconds(0)) {
+      throw std::runtime_error("timed out waiting for takeover");
+    }
+    pollfd pfd;
+    pfd.fd = listenFd;
+    pfd.events = POLLIN;
+    int ready = ::poll(&pfd, 1, remaining.count());
+    if (ready == -1 && errno == EINTR) {
+      continue;
+    }
+    checkUnixError(ready, "takeover poll() failed");
+    if (ready == 0) {
+      continue;
+    }
+
+    int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1 && (errno == EINTR || errno == ECONNABORTED)) {
+      continue;
+    }
+    checkUnixError(fd, "takeover accept() failed");
+    ucred cred;
+    socklen_t credLen = sizeof(cred);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == 0 &&
+        cred.uid == ::geteuid()) {
+      return fd;
+    }
+    LOG(ERROR) << "Dropping takeover connection from another user";
+    ::close(fd);
+  }
+}
+
+} // namespace
+
+void sendTakeoverSockets(const std::string& path,
+                         const TakeoverSockets& sockets,
+                         std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  TakeoverHeader header;
+  header.magic = kTakeoverMagic;
+  header.groups = sockets.size();
+  std::vector<int> fds;
+  for (size_t i = 0; i < sockets.size(); i++) {
+    if (i == kMaxTakeoverFds) {
+      throw std::invalid_argument("too many sockets to take over");
+    }
+    header.counts[i] = sockets[i].size();
+    fds.insert(fds.end(), sockets[i].begin(), sockets[i].end());
+  }
+  if (fds.size() > kMaxTakeoverFds) {
+    throw std::invalid_argument("too many sockets to take over");
+  }
+
+  sockaddr_storage addr;
+  socklen_t addrLen;
+  int listenFd = unixSocket(path, &addr, &addrLen);
+  SCOPE_EXIT {
+    ::close(listenFd);
+    ::unlink(path.c_str());
+  };
+  ::unlink(path.c_str());
+  checkUnixError(::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), addrLen),
+                 "takeover bind() to ", path, " failed");
+  // Not connectable until listen(), so no one gets in before this
+  checkUnixError(::chmod(path.c_str(), 0600),
+                 "takeover chmod() of ", path, " failed");
+  checkUnixError(::listen(listenFd, 1), "takeover listen() failed");
+
+  int fd = acceptOwnUser(listenFd, deadline);
+  SCOPE_EXIT {
+    ::close(fd);
+  };
+
+  iovec iov;
+  iov.iov_base = &header;
+  iov.iov_len = offsetof(TakeoverHeader, counts) +
+    sockets.size() * sizeof(uint32_t);
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxTakeoverFds));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (!fds.empty()) {
+    msg.msg_control = control.data();
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+
+  ssize_t sent;
+  do {
+    sent = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (sent == -1 && errno == EINTR);
+  checkUnixError(sent, "takeover sendmsg() failed");
+  if (static_cast<size_t>(sent) != iov.iov_len) {
+    throw std::runtime_error("takeover message sent partially");
+  }
+}
+
+TakeoverSockets receiveTakeoverSockets(const std::string& path) {
+  sockaddr_storage addr;
+  socklen_t addrLen;
+  int fd = unixSocket(path, &addr, &addrLen);
+  SCOPE_EXIT {
+    ::close(fd);
+  };
+  checkUnixError(
+    ::connect(fd, reinterpret_cast<sockaddr*>(&addr), addrLen),
+    "takeover connect() to ", path, " failed");
+
+  TakeoverHeader header;
+  iovec iov;
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(header);
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * kMaxTakeoverFds));
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+
+  ssize_t received;
+  do {
+    received = ::recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (received == -1 && errno == EINTR);
+  checkUnixError(received, "takeover recvmsg() failed");
+
+  std::vector<int> fds;
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      auto data = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+      fds.insert(fds.end(), data, data + count);
+    }
+  }
+  auto closeFds = folly::makeGuard([&] {
+    for (auto socket : fds) {
+      ::close(socket);
+    }
+  });
+
+  const auto headerLen = offsetof(TakeoverHeader, counts);
+  if (static_cast<size_t>(received) < headerLen ||
+      header.magic != kTakeoverMagic ||
+      header.groups > kMaxTakeoverFds ||
+      static_cast<size_t>(received) !=
+        headerLen + header.groups * sizeof(uint32_t) ||
+      (msg.msg_flags & MSG_CTRUNC)) {
+    throw std::runtime_error("bad takeover message");
+  }
+
+  TakeoverSockets sockets(header.groups);
+  size_t next = 0;
+  for (size_t i = 0; i < header.groups; i++) {
+    if (header.counts[i] > fds.size() - next) {
+      throw std::runtime_error("takeover message is missing sockets");
+    }
+    sockets[i].assign(fds.begin() + next,
+                      fds.begin() + next + header.counts[i]);
+    next += header.counts[i];
+  }
+  if (next != fds.size()) {
+    throw std::runtime_error("takeover message has extra sockets");
+  }
+  closeFds.dismiss();
+  return sockets;
+}
+
+} // namespace
@@ -0,0 +1,48 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace folly {
+
+/*
+ * Hands listening sockets from a running server to the process replacing
+ * it, over a Unix domain socket with SCM_RIGHTS, so no connection attempt
+ * is refused while the new process comes up (see
+ * ServerBootstrap::offerTakeover() and ServerBootstrap::takeOver()).
+ *
+ * The sockets are grouped by the AsyncServerSocket they belong to, as
+ * that may listen on several, e.g. for IPv4 and IPv6.
+ */
+typedef std::vector<std::vector<int>> TakeoverSockets;
+
+/*
+ * Waits up to timeout for the new process to connect on the Unix socket at
+ * path, and sends it the sockets, blocking until they're sent.  The socket
+ * is only open to the same user, and connections from processes of other
+ * users are dropped.  Throws on errors, and on the timeout.
+ */
+void sendTakeoverSockets(
+  const std::string& path,
+  const TakeoverSockets& sockets,
+  std::chrono::milliseconds timeout = std::chrono::milliseconds(60000));
+
+/*
+ * Connects to the old process on the Unix socket at path and receives its
+ * sockets, which the caller then owns.  Throws on errors, e.g. when no
+ * process offers its sockets on path.
+ */
+TakeoverSockets receiveTakeoverSockets(const std::string& path);
+
+} // namespace
@@ -0,0 +1,440 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Raw throughput of ServerBootstrap over loopback, for each number of
+// server IO threads given:
+//
+//   connect      connections per second, to a server that closes them
+//   tls_connect  the same with full TLS handshakes, given --cert and --key
+//   requests     echoed requests per second, at each pipeline depth
+//   bytes        bytes per second, into a server that discards them
+//
+// Each line has the total and the rate per server thread, the scaling
+// curve to compare between releases.  The clients run on IO threads of
+// their own, through ClientBootstrap; for a curve of the server alone,
+// pin the process so they don't share its cores.
+
+#include <folly/Baton.h>
+#include <folly/Conv.h>
+#include <folly/Memory.h>
+#include <folly/String.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/bootstrap/ClientBootstrap.h>
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+#include <wangle/concurrent/MetricsRegistry.h>
+#include <gflags/gflags.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace folly;
+using namespace folly::wangle;
+
+DEFINE_string(mode, "all", "connect, tls_connect, requests, bytes or all");
+DEFINE_string(server_threads, "1,2,4", "Server IO thread counts to run with");
+DEFINE_int32(client_threads, 4, "Client IO threads");
+DEFINE_int32(connects_in_flight, 32, "Connects in flight per client thread");
+DEFINE_int32(connections, 16,
+             "Connections per client thread, for requests and bytes");
+DEFINE_string(depths, "1,16,64", "Requests in flight per connection");
+DEFINE_int32(request_bytes, 64, "Bytes in each request, and in its echo");
+DEFINE_int32(chunk_bytes, 64 * 1024, "Bytes in each write, for bytes");
+DEFINE_int32(writes_in_flight, 4, "Writes in flight per connection, for bytes");
+DEFINE_int32(warmup_ms, 200, "How long each run goes before it's measured");
+DEFINE_int32(duration_ms, 2000, "How long each run is measured for");
+DEFINE_string(cert, "", "Server certificate, for tls_connect");
+DEFINE_string(key, "", "Its private key");
+
+typedef Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> BytesPipeline;
+
+// Clients count into it from their own threads, and the runs read it
+MetricsRegistry registry;
+
+std::vector<size_t> parseList(const std::string& list) {
+  std::vector<StringPiece> parts;
+  folly::split(',', list, parts, true);
+  std::vector<size_t> values;
+  for (auto part : parts) {
+    values.push_back(folly::to<size_t>(part));
+  }
+  return values;
+}
+
+class EchoHandler : public BytesToBytesHandler {
+ public:
+  void read(Context* ctx, IOBufQueue& q) override {
+    ctx->fireWrite(q.move());
+  }
+
+  void readEOF(Context* ctx) override {
+    ctx->fireClose();
+  }
+};
+
+// Counts what it drops into bytes, if given
+class DiscardHandler : public BytesToBytesHandler {
+ public:
+  explicit DiscardHandler(std::atomic<uint64_t>* bytes = nullptr)
+      : bytes_(bytes) {}
+
+  void read(Context* ctx, IOBufQueue& q) override {
+    if (bytes_) {
+      bytes_->fetch_add(q.chainLength(), std::memory_order_relaxed);
+    }
+    q.clear();
+  }
+
+  void readEOF(Context* ctx) override {
+    ctx->fireClose();
+  }
+
+ private:
+  std::atomic<uint64_t>* bytes_;
+};
+
+class ServerPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  // Echoes, or discards counting into bytes
+  explicit ServerPipelineFactory(std::atomic<uint64_t>* bytes = nullptr)
+      : bytes_(bytes) {}
+
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new BytesPipeline());
+    pipeline->addBack(AsyncSocketHandler(sock));
+    if (bytes_) {
+      pipeline->addBack(DiscardHandler(bytes_));
+    } else {
+      pipeline->addBack(EchoHandler());
+    }
+    pipeline->finalize();
+    return pipeline;
+  }
+
+ private:
+  std::atomic<uint64_t>* bytes_;
+};
+
+// Keeps depth requests in flight on its connection from start() on, until
+// stop is set
+class RequestHandler : public BytesToBytesHandler {
+ public:
+  explicit RequestHandler(std::atomic<bool>* stop)
+      : stop_(stop),
+        request_(IOBuf::copyBuffer(std::string(FLAGS_request_bytes, 'x'))),
+        responses_(registry.counter("responses")) {}
+
+  void start(size_t depth) {
+    for (size_t i = 0; i < depth; i++) {
+      getContext()->fireWrite(request_->clone());
+    }
+  }
+
+  void read(Context* ctx, IOBufQueue& q) override {
+    received_ += q.chainLength();
+    q.clear();
+    auto responses = received_ / FLAGS_request_bytes;
+    received_ %= FLAGS_request_bytes;
+    responses_.add(responses);
+    if (stop_->load(std::memory_order_relaxed)) {
+      return;
+    }
+    for (size_t i = 0; i < responses; i++) {
+      ctx->fireWrite(request_->clone());
+    }
+  }
+
+ private:
+  std::atomic<bool>* stop_;
+  std::unique_ptr<IOBuf> request_;
+  MetricsRegistry::Counter responses_;
+  size_t received_{0};
+};
+
+// Keeps writes_in_flight chunks being written from start() on, until stop
+// is set
+class BulkHandler : public BytesToBytesHandler {
+ public:
+  explicit BulkHandler(std::atomic<bool>* stop)
+      : stop_(stop),
+        chunk_(IOBuf::copyBuffer(std::string(FLAGS_chunk_bytes, 'x'))) {}
+
+  void start() {
+    for (int i = 0; i < FLAGS_writes_in_flight; i++) {
+      writeOne();
+    }
+  }
+
+  void read(Context* ctx, IOBufQueue& q) override {
+    q.clear();
+  }
+
+ private:
+  void writeOne() {
+    getContext()->fireWrite(chunk_->clone()).then([this] (Try<Unit>&& t) {
+      if (t.hasValue() && !stop_->load(std::memory_order_relaxed)) {
+        writeOne();
+      }
+    });
+  }
+
+  std::atomic<bool>* stop_;
+  std::unique_ptr<IOBuf> chunk_;
+};
+
+template <typename Handler>
+class ClientPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  explicit ClientPipelineFactory(std::atomic<bool>* stop) : stop_(stop) {}
+
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new BytesPipeline());
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(Handler(stop_));
+    pipeline->finalize();
+    return pipeline;
+  }
+
+ private:
+  std::atomic<bool>* stop_;
+};
+
+class SinkPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    std::unique_ptr<BytesPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new BytesPipeline());
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(DiscardHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+// Connects, closes as soon as it's connected, and connects again, on its
+// EventBase until stop is set
+class Connector {
+ public:
+  Connector(EventBase* evb, const SocketAddress& address,
+            std::shared_ptr<SSLContext> sslContext, std::atomic<bool>* stop)
+      : evb_(evb),
+        address_(address),
+        sslContext_(std::move(sslContext)),
+        stop_(stop),
+        factory_(std::make_shared<SinkPipelineFactory>()),
+        connects_(registry.counter("connects")),
+        errors_(registry.counter("connect_errors")) {}
+
+  void start() {
+    evb_->runInEventBaseThread([this] { next(); });
+  }
+
+  void wait() {
+    done_.wait();
+  }
+
+ private:
+  void next() {
+    client_.reset();
+    if (stop_->load(std::memory_order_relaxed)) {
+      done_.post();
+      return;
+    }
+    client_ = folly::make_unique<ClientBootstrap<BytesPipeline>>();
+    client_->pipelineFactory(factory_);
+    if (sslContext_) {
+      client_->sslContext(sslContext_);
+    }
+    client_->connect(address_).then([this] (Try<BytesPipeline*>&& t) {
+      if (t.hasValue()) {
+        connects_.add();
+        t.value()->close();
+      } else {
+        errors_.add();
+      }
+      // Not from the connect callback, which the bootstrap is under
+      evb_->runInLoop([this] { next(); });
+    });
+  }
+
+  EventBase* evb_;
+  const SocketAddress address_;
+  std::shared_ptr<SSLContext> sslContext_;
+  std::atomic<bool>* stop_;
+  std::shared_ptr<SinkPipelineFactory> factory_;
+  MetricsRegistry::Counter connects_;
+  MetricsRegistry::Counter errors_;
+  std::unique_ptr<ClientBootstrap<BytesPipeline>> client_;
+  Baton<> done_;
+};
+
+std::unique_ptr<ServerBootstrap<BytesPipeline>> startServer(
+    size_t threads, bool tls, std::atomic<uint64_t>* bytes,
+    SocketAddress* address) {
+  auto server = folly::make_unique<ServerBootstrap<BytesPipeline>>();
+  if (tls) {
+    SSLContextConfig config;
+    config.setCertificate(FLAGS_cert, FLAGS_key, "");
+    config.isDefault = true;
+    server->socketConfig.sslContextConfigs.push_back(config);
+  }
+  server->childPipeline(std::make_shared<ServerPipelineFactory>(bytes));
+  server->group(std::make_shared<IOThreadPoolExecutor>(threads));
+  server->bind(0);
+  server->getSockets()[0]->getAddress(address);
+  return server;
+}
+
+// What count() went up by each second, after the warmup
+template <typename F>
+double measure(F count) {
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_warmup_ms));
+  auto before = count();
+  auto start = std::chrono::steady_clock::now();
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_duration_ms));
+  auto after = count();
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return (after - before) / elapsed.count();
+}
+
+void report(const std::string& what, size_t threads, double rate,
+            const char* unit) {
+  printf("%-24s %3zu server threads %14.0f %s/s %14.0f %s/s/thread\n",
+         what.c_str(), threads, rate, unit, rate / threads, unit);
+  fflush(stdout);
+}
+
+void runConnect(size_t threads, bool tls) {
+  SocketAddress address;
+  auto server = startServer(threads, tls, nullptr, &address);
+  std::shared_ptr<SSLContext> sslContext;
+  if (tls) {
+    sslContext = std::make_shared<SSLContext>();
+  }
+  auto clients = std::make_shared<IOThreadPoolExecutor>(FLAGS_client_threads);
+  std::atomic<bool> stop(false);
+  std::vector<std::unique_ptr<Connector>> connectors;
+  for (int i = 0; i < FLAGS_client_threads * FLAGS_connects_in_flight; i++) {
+    connectors.emplace_back(new Connector(
+      clients->getEventBase(), address, sslContext, &stop));
+    connectors.back()->start();
+  }
+
+  auto connects = registry.counter("connects");
+  auto rate = measure([&] { return connects.get(); });
+  stop = true;
+  for (auto& connector : connectors) {
+    connector->wait();
+  }
+  report(tls ? "tls_connect" : "connect", threads, rate, "conns");
+  server->stop();
+}
+
+template <typename Handler>
+struct Connection {
+  std::unique_ptr<ClientBootstrap<BytesPipeline>> client;
+  BytesPipeline* pipeline{nullptr};
+  Handler* handler{nullptr};
+};
+
+template <typename Handler, typename Start>
+void runConnections(size_t threads, std::atomic<uint64_t>* bytes,
+                    Start start, const std::function<uint64_t()>& count,
+                    const std::string& what, const char* unit) {
+  SocketAddress address;
+  auto server = startServer(threads, false, bytes, &address);
+  auto clients = std::make_shared<IOThreadPoolExecutor>(FLAGS_client_threads);
+  std::atomic<bool> stop(false);
+  auto factory = std::make_shared<ClientPipelineFactory<Handler>>(&stop);
+  std::vector<Connection<Handler>> connections(
+    FLAGS_client_threads * FLAGS_connections);
+  for (auto& conn : connections) {
+    conn.client = folly::make_unique<ClientBootstrap<BytesPipeline>>();
+    conn.client->group(clients);
+    conn.client->pipelineFactory(factory);
+    conn.pipeline = conn.client->connect(address).get();
+    conn.handler = conn.pipeline->template getHandler<Handler>(1);
+  }
+  for (auto& conn : connections) {
+    auto handler = conn.handler;
+    conn.pipeline->getTransport()->getEventBase()->runInEventBaseThread(
+      [handler, start] { start(handler); });
+  }
+
+  auto rate = measure(count);
+  stop = true;
+  for (auto& conn : connections) {
+    // Closed and destroyed where its socket lives
+    auto client = conn.client.release();
+    conn.pipeline->getTransport()->getEventBase()
+      ->runInEventBaseThreadAndWait([client] {
+        client->getPipeline()->close();
+        delete client;
+      });
+  }
+  report(what, threads, rate, unit);
+  server->stop();
+}
+
+void runRequests(size_t threads, size_t depth) {
+  auto responses = registry.counter("responses");
+  runConnections<RequestHandler>(
+    threads, nullptr,
+    [depth] (RequestHandler* handler) { handler->start(depth); },
+    [responses] { return responses.get(); },
+    "requests depth " + folly::to<std::string>(depth), "reqs");
+}
+
+void runBytes(size_t threads) {
+  std::atomic<uint64_t> bytes(0);
+  runConnections<BulkHandler>(
+    threads, &bytes,
+    [] (BulkHandler* handler) { handler->start(); },
+    [&bytes] { return bytes.load(std::memory_order_relaxed); },
+    "bytes", "bytes");
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  auto all = FLAGS_mode == "all";
+  bool tls = !FLAGS_cert.empty() && !FLAGS_key.empty();
+  if (FLAGS_mode == "tls_connect" && !tls) {
+    fprintf(stderr, "tls_connect needs --cert and --key\n");
+    return 1;
+  }
+  for (auto threads : parseList(FLAGS_server_threads)) {
+    if (all || FLAGS_mode == "connect") {
+      runConnect(threads, false);
+    }
+    if ((all && tls) || FLAGS_mode == "tls_connect") {
+      runConnect(threads, true);
+    }
+    if (all || FLAGS_mode == "requests") {
+      for (auto depth : parseList(FLAGS_depths)) {
+        runRequests(threads, depth);
+      }
+    }
+    if (all || FLAGS_mode == "bytes") {
+      runBytes(threads);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/bootstrap/WorkerSelector.h>
+
+#include <folly/Hash.h>
+
+namespace folly { namespace wangle {
+
+size_t ModuloWorkerSelector::select(uint64_t hash, size_t workers) {
+  return hash % workers;
+}
+
+size_t JumpConsistentWorkerSelector::select(uint64_t hash, size_t workers) {
+  int64_t bucket = -1;
+  int64_t next = 0;
+  while (next < static_cast<int64_t>(workers)) {
+    bucket = next;
+    hash = hash * 2862933555777941757ULL + 1;
+    next = (bucket + 1) *
+      (static_cast<double>(1LL << 31) / static_cast<double>((hash >> 33) + 1));
+  }
+  return bucket;
+}
+
+size_t RendezvousWorkerSelector::select(uint64_t hash, size_t workers) {
+  size_t best = 0;
+  uint64_t bestScore = 0;
+  for (size_t i = 0; i < workers; i++) {
+    auto score = folly::hash::hash_128_to_64(hash, i);
+    if (i == 0 || score > bestScore) {
+      best = i;
+      bestScore = score;
+    }
+  }
+  return best;
+}
+
+}} // namespace folly::wangle
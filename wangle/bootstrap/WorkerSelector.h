@@ -0,0 +1,58 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace folly { namespace wangle {
+
+/**
+ * Picks the worker a hash of routing data goes to, as AcceptRoutingHandler
+ * does.  A consistent selector keeps most hashes on their worker when the
+ * number of workers changes, and with them whatever per-thread state was
+ * built around that affinity.
+ */
+class WorkerSelector {
+ public:
+  virtual ~WorkerSelector() {}
+
+  // An index below workers, which is at least 1
+  virtual size_t select(uint64_t hash, size_t workers) = 0;
+};
+
+// hash % workers; every hash may move when workers changes
+class ModuloWorkerSelector : public WorkerSelector {
+ public:
+  size_t select(uint64_t hash, size_t workers) override;
+};
+
+/**
+ * Jump consistent hashing (Lamping and Veach): O(log workers), no state,
+ * and only the hashes that have to move do so as workers are added or
+ * removed at the end.
+ */
+class JumpConsistentWorkerSelector : public WorkerSelector {
+ public:
+  size_t select(uint64_t hash, size_t workers) override;
+};
+
+/**
+ * Rendezvous (highest random weight) hashing: the worker scoring highest
+ * for the hash, O(workers).  Like jump hashing it only moves the hashes
+ * of workers that come or go at the end.
+ */
+class RendezvousWorkerSelector : public WorkerSelector {
+ public:
+  size_t select(uint64_t hash, size_t workers) override;
+};
+
+}} // namespace folly::wangle
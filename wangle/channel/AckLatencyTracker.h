@@ -0,0 +1,210 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/concurrent/TaskLatencyHistogram.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <glog/logging.h>
+
+#ifdef __linux__
+#include <linux/version.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+
+// SOF_TIMESTAMPING_TX_ACK and friends are enumerators, not macros
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 17, 0)
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#define WANGLE_HAVE_TX_ACK_TIMESTAMPS 1
+#endif
+#endif
+
+namespace folly { namespace wangle {
+
+/**
+ * Measures how long it takes the peer to ack each write, using kernel TX
+ * timestamps: with SO_TIMESTAMPING and SOF_TIMESTAMPING_TX_ACK, the
+ * kernel reports on the socket's error queue when the last byte of each
+ * send was acked.  That separates network time from server time without
+ * packet captures.
+ *
+ * Call onWrite() for every write, in order, and drain() whenever the
+ * socket is readable; the kernel signals queued timestamps as an error
+ * condition, which wakes up readers.  The kernel identifies writes by
+ * their offset in the bytes it was handed, so where those aren't the
+ * bytes written, as under TLS, call onBytesSent() after each write
+ * instead.  Needs Linux 3.17; elsewhere, enable() returns false and
+ * nothing is measured.
+ */
+class AckLatencyTracker {
+ public:
+  // Turns on ack timestamps for the sends made on fd from now on
+  bool enable(int fd) {
+#ifdef WANGLE_HAVE_TX_ACK_TIMESTAMPS
+    int flags = SOF_TIMESTAMPING_TX_ACK | SOF_TIMESTAMPING_SOFTWARE |
+      SOF_TIMESTAMPING_OPT_ID;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 0, 0)
+    // Don't loop the sent packets back along with the timestamps
+    flags |= SOF_TIMESTAMPING_OPT_TSONLY;
+#endif
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
+                   &flags, sizeof(flags)) != 0) {
+      PLOG(WARNING) << "Unable to enable TX ack timestamps";
+      return false;
+    }
+    pending_.clear();
+    bytesWritten_ = 0;
+    enabled_ = true;
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool isEnabled() const {
+    return enabled_;
+  }
+
+  // A write of len bytes is about to be sent
+  void onWrite(uint64_t len) {
+    onBytesSent(bytesWritten_ + len);
+  }
+
+  /**
+   * The kernel was handed total bytes since enable(), e.g. the ciphertext
+   * of the writes so far.  A write the socket buffers is only tracked once
+   * a later one takes the total past it.
+   */
+  void onBytesSent(uint64_t total) {
+    if (!enabled_ || total <= bytesWritten_) {
+      return;
+    }
+    bytesWritten_ = total;
+    pending_.push_back(PendingWrite{bytesWritten_ - 1, realtimeNow()});
+    // Writes the kernel won't report on, e.g. after a failed send, mustn't
+    // pile up
+    if (pending_.size() > kMaxPending) {
+      pending_.pop_front();
+    }
+  }
+
+  // Reads the ack timestamps queued on fd and matches them to writes
+  void drain(int fd) {
+#ifdef WANGLE_HAVE_TX_ACK_TIMESTAMPS
+    if (!enabled_) {
+      return;
+    }
+    while (true) {
+      char control[512];
+      struct msghdr msg = {};
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        return;
+      }
+      onErrorMessage(msg);
+    }
+#endif
+  }
+
+  /**
+   * Matches an ack timestamp read from the error queue to its write, e.g.
+   * when the queue is drained by someone else (see ZeroCopyWriter).  False
+   * if msg isn't one.
+   */
+  bool onErrorMessage(const struct msghdr& msg) {
+#ifdef WANGLE_HAVE_TX_ACK_TIMESTAMPS
+    const struct scm_timestamping* ts = nullptr;
+    const struct sock_extended_err* err = nullptr;
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(&msg), cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET &&
+          cmsg->cmsg_type == SCM_TIMESTAMPING) {
+        ts = reinterpret_cast<const struct scm_timestamping*>(
+          CMSG_DATA(cmsg));
+      } else if ((cmsg->cmsg_level == IPPROTO_IP &&
+                  cmsg->cmsg_type == IP_RECVERR) ||
+                 (cmsg->cmsg_level == IPPROTO_IPV6 &&
+                  cmsg->cmsg_type == IPV6_RECVERR)) {
+        err = reinterpret_cast<const struct sock_extended_err*>(
+          CMSG_DATA(cmsg));
+      }
+    }
+    if (!ts || !err || err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING ||
+        err->ee_info != SCM_TSTAMP_ACK) {
+      return false;
+    }
+    if (enabled_) {
+      onAck(err->ee_data, std::chrono::nanoseconds(
+        int64_t(ts->ts[0].tv_sec) * 1000000000 + ts->ts[0].tv_nsec));
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // How long the peer took to ack the last write that was acked
+  std::chrono::nanoseconds getLastAckLatency() const {
+    return lastAckLatency_;
+  }
+
+  const TaskLatencyHistogram& getAckLatencyHistogram() const {
+    return ackLatency_;
+  }
+
+ private:
+  static const size_t kMaxPending = 1024;
+
+  struct PendingWrite {
+    // Offset of the write's last byte since enable(), which is how the
+    // kernel identifies it
+    uint64_t lastByte;
+    std::chrono::nanoseconds sentAt;
+  };
+
+  static std::chrono::nanoseconds realtimeNow() {
+#ifdef __linux__
+    // Kernel timestamps are on CLOCK_REALTIME
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return std::chrono::nanoseconds(
+      int64_t(now.tv_sec) * 1000000000 + now.tv_nsec);
+#else
+    return std::chrono::nanoseconds(0);
+#endif
+  }
+
+  void onAck(uint32_t key, std::chrono::nanoseconds ackedAt) {
+    // The key is the low 32 bits of the byte offset
+    while (!pending_.empty() &&
+           int32_t(key - uint32_t(pending_.front().lastByte)) >= 0) {
+      auto latency = ackedAt - pending_.front().sentAt;
+      pending_.pop_front();
+      if (latency.count() >= 0) {
+        lastAckLatency_ = latency;
+        ackLatency_.addValue(latency);
+      }
+    }
+  }
+
+  bool enabled_{false};
+  uint64_t bytesWritten_{0};
+  std::deque<PendingWrite> pending_;
+  std::chrono::nanoseconds lastAckLatency_{0};
+  TaskLatencyHistogram ackLatency_;
+};
+
+}} // folly::wangle
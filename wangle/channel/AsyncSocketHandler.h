@@ -10,19 +10,31 @@
 
 #pragma once
 
+#include <wangle/channel/AckLatencyTracker.h>
 #include <wangle/channel/Handler.h>
+#include <wangle/channel/LoopbackSocket.h>
+#include <wangle/channel/MemoryBudget.h>
+#include <wangle/channel/ZeroCopyReader.h>
+#include <wangle/channel/ZeroCopyWriter.h>
+#include <wangle/concurrent/MetricsRegistry.h>
+#include <folly/io/async/AsyncSSLSocket.h>
 #include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <folly/io/IOBuf.h>
+#include <folly/ThreadLocal.h>
 #include <folly/io/IOBufQueue.h>
+#include <folly/Optional.h>
+#include <folly/ScopeGuard.h>
+#include <folly/tracing/StaticTracepoint.h>
 
 namespace folly { namespace wangle {
 
 // This handler may only be used in a single Pipeline
 class AsyncSocketHandler
   : public folly::wangle::BytesToBytesHandler,
-    public AsyncSocket::ReadCallback {
+    public AsyncSocket::ReadCallback,
+    public LoopbackSocket::BufferReadCallback {
  public:
   explicit AsyncSocketHandler(
       std::shared_ptr<AsyncSocket> socket)
@@ -32,16 +44,25 @@ class AsyncSocketHandler
 
   ~AsyncSocketHandler() {
     detachReadCallback();
+    if (pendingWrites_) {
+      pendingWrites_->handler = nullptr;
+    }
   }
 
   void attachReadCallback() {
-    socket_->setReadCB(socket_->good() ? this : nullptr);
+    const bool paused = memoryAccount_ && memoryAccount_->isPaused();
+    socket_->setReadCB(socket_->good() && !paused ? this : nullptr);
   }
 
   void detachReadCallback() {
     if (socket_ && socket_->getReadCallback() == this) {
       socket_->setReadCB(nullptr);
     }
+    if (memoryAccount_) {
+      memoryAccount_->setPauseCallback(nullptr);
+      memoryAccount_.reset();
+    }
+    memoryCharge_.reset();
     auto ctx = getContext();
     if (ctx && !firedInactive_) {
       firedInactive_ = true;
@@ -49,21 +70,71 @@ class AsyncSocketHandler
     }
   }
 
+  /**
+   * Moves a handler over to another socket, e.g. when its pipeline is
+   * reused by PipelineFactory::resetPipeline().  Data read from the old
+   * socket but not consumed is dropped, as is tracking of its pending
+   * writes; the handler's settings are kept.
+   */
+  void resetSocket(std::shared_ptr<AsyncSocket> socket) {
+    detachReadCallback();
+    if (pendingWrites_) {
+      pendingWrites_->handler = nullptr;
+      pendingWrites_.reset();
+    }
+    bufQueue_.move();
+    socket_ = std::move(socket);
+    firedInactive_ = false;
+    if (ackLatency_) {
+      ackLatency_.reset(new AckLatencyTracker());
+      if (socket_ && socket_->good()) {
+        enableAckLatency();
+      }
+    }
+    if (zeroCopy_) {
+      zeroCopy_.reset(new ZeroCopyWriter(zeroCopy_->getThreshold()));
+      if (socket_ && socket_->good()) {
+        zeroCopy_->enable(socket_);
+      }
+      zeroCopy_->setAckLatencyTracker(ackLatency_.get());
+    }
+    if (zeroCopyReader_) {
+      zeroCopyReader_.reset(new ZeroCopyReader(zeroCopyReader_->getMapSize()));
+      setupZeroCopyReader();
+    }
+  }
+
   void attachEventBase(folly::EventBase* eventBase) {
     if (eventBase && !socket_->getEventBase()) {
       socket_->attachEventBase(eventBase);
+      if (zeroCopy_) {
+        zeroCopy_->attachEventBase(eventBase);
+      }
     }
   }
 
   void detachEventBase() {
     detachReadCallback();
     if (socket_->getEventBase()) {
+      if (zeroCopy_) {
+        zeroCopy_->detachEventBase();
+      }
       socket_->detachEventBase();
     }
   }
 
   void transportActive(Context* ctx) override {
     ctx->getPipeline()->setTransport(socket_);
+    if (ackLatency_ && !ackLatency_->isEnabled() && socket_->good()) {
+      enableAckLatency();
+    }
+    if (zeroCopy_ && !zeroCopy_->isEnabled() && socket_->good()) {
+      zeroCopy_->enable(socket_);
+    }
+    if (zeroCopyReader_) {
+      setupZeroCopyReader();
+    }
+    setupMemoryAccount(ctx->getPipeline()->getMemoryAccount());
     attachReadCallback();
     ctx->fireTransportActive();
   }
@@ -78,6 +149,144 @@ class AsyncSocketHandler
     detachReadCallback();
   }
 
+  /**
+   * In fire-and-forget mode write() does not track completion: no promise
+   * is created and the returned future is already fulfilled.  Write errors
+   * are only logged; they will also surface on the read side as the socket
+   * is torn down.  Use this when callers drop the future returned by write().
+   */
+  void setFireAndForgetWrites(bool fireAndForget) {
+    fireAndForgetWrites_ = fireAndForget;
+  }
+
+  bool getFireAndForgetWrites() const {
+    return fireAndForgetWrites_;
+  }
+
+  /**
+   * Free the read buffer's unused tailroom after each read, so an idle
+   * connection holds no read buffer between reads: what the handlers
+   * leave, like a partial frame, is copied into a buffer of its own size.
+   * The next read allocates a fresh buffer.
+   */
+  void setReleaseIdleReadBuffer(bool release) {
+    releaseIdleReadBuffer_ = release;
+  }
+
+  /**
+   * Read into a buffer shared by all handlers in this thread, and copy only
+   * the bytes actually received into this handler's queue.  This trades a
+   * copy per read for not pinning a full read buffer per connection, and
+   * suits large numbers of mostly idle connections.
+   */
+  void setUseSharedReadBuffer(bool useShared) {
+    useSharedReadBuffer_ = useShared;
+  }
+
+  /**
+   * Measure how long the peer takes to ack each write, from kernel TX
+   * timestamps; see AckLatencyTracker.  Acks are collected whenever the
+   * socket is readable, so this relies on the read callback staying
+   * attached.  Copy getAckLatencyTracker()->getLastAckLatency() into
+   * TransportInfo::lastByteAckLatency when logging the transaction.
+   */
+  void setAckTimestamping(bool enable) {
+    if (!enable) {
+      if (zeroCopy_) {
+        zeroCopy_->setAckLatencyTracker(nullptr);
+      }
+      ackLatency_.reset();
+      return;
+    }
+    if (!ackLatency_) {
+      ackLatency_.reset(new AckLatencyTracker());
+      if (socket_ && socket_->good()) {
+        enableAckLatency();
+      }
+      if (zeroCopy_) {
+        zeroCopy_->setAckLatencyTracker(ackLatency_.get());
+      }
+    }
+  }
+
+  // Null unless ack timestamping was requested
+  const AckLatencyTracker* getAckLatencyTracker() const {
+    return ackLatency_.get();
+  }
+
+  /**
+   * Send writes of threshold bytes or more with MSG_ZEROCOPY; see
+   * ZeroCopyWriter.  Their futures complete once the kernel is done with
+   * the buffers, which are held until then, even past disabling this or
+   * the handler going away.  Sockets that can't do it, e.g. encrypted
+   * ones, keep copying.
+   */
+  void setZeroCopyWrites(bool enable,
+                         size_t threshold = ZeroCopyWriter::kDefaultThreshold) {
+    if (!enable) {
+      zeroCopy_.reset();
+      return;
+    }
+    zeroCopy_.reset(new ZeroCopyWriter(threshold));
+    if (socket_ && socket_->good()) {
+      zeroCopy_->enable(socket_);
+    }
+    zeroCopy_->setAckLatencyTracker(ackLatency_.get());
+  }
+
+  // Null unless zero-copy writes were requested, with their byte counts
+  const ZeroCopyWriter* getZeroCopyWriter() const {
+    return zeroCopy_.get();
+  }
+
+  /**
+   * Map received data into the process with TCP_ZEROCOPY_RECEIVE, up to
+   * mapSize bytes per read, instead of copying it; see ZeroCopyReader.
+   * The mapped IOBufs are read-only, so handlers upstream must not modify
+   * what they read in place.  Sockets that can't do it, e.g. encrypted
+   * ones, keep copying.
+   */
+  void setZeroCopyReads(bool enable,
+                        size_t mapSize = ZeroCopyReader::kDefaultMapSize) {
+    if (!enable) {
+      zeroCopyReader_.reset();
+      return;
+    }
+    zeroCopyReader_.reset(new ZeroCopyReader(mapSize));
+    if (socket_ && socket_->good()) {
+      zeroCopyReader_->enable(socket_.get());
+    }
+  }
+
+  // Null unless zero-copy reads were requested, with their byte counts
+  const ZeroCopyReader* getZeroCopyReader() const {
+    return zeroCopyReader_.get();
+  }
+
+  /**
+   * Allocates, in the calling IO thread, the write callbacks its handlers
+   * recycle, up to writeCallbacks, and a shared read buffer (see
+   * setUseSharedReadBuffer()) of sharedReadBufferSize, ahead of the
+   * thread's first connections; e.g. from ServerBootstrap::prewarm().
+   */
+  static void prewarmThread(size_t writeCallbacks,
+                            size_t sharedReadBufferSize = 0) {
+    auto& list = WriteCallback::freeList();
+    auto count = std::min(writeCallbacks,
+                          size_t(WriteCallback::kMaxFreeListSize));
+    while (list.size < count) {
+      (new WriteCallback())->recycle();
+    }
+    if (sharedReadBufferSize > 0) {
+      sharedReadBuffer().reserve(sharedReadBufferSize);
+    }
+  }
+
+  // Write callbacks waiting for reuse in the calling IO thread
+  static size_t getNumFreeWriteCallbacks() {
+    return WriteCallback::freeList().size;
+  }
+
   folly::Future<Unit> write(
       Context* ctx,
       std::unique_ptr<folly::IOBuf> buf) override {
@@ -92,12 +301,61 @@ class AsyncSocketHandler
           "socket is closed in write()"));
     }
 
-    auto cb = new WriteCallback();
-    auto future = cb->promise_.getFuture();
+    ctx->getPipeline()->refreshTimeout();
+    auto len = buf->computeChainDataLength();
+    FOLLY_SDT(wangle, socket_write, this, len);
+    metrics().bytesWritten.add(len);
+    if (ackLatency_ && !ackEncrypted_) {
+      ackLatency_->onWrite(len);
+    }
+    SCOPE_EXIT {
+      if (ackLatency_ && ackEncrypted_ && socket_) {
+        ackLatency_->onBytesSent(
+            socket_->getRawBytesWritten() - ackRawBytesBase_);
+      }
+    };
+
+    // Pending bytes are only tracked when the pipeline has watermarks
+    const bool trackPending =
+      ctx->getPipeline()->getWriteBufferWaterMarks().second > 0;
+
+    if (zeroCopy_ && zeroCopy_->isEnabled()) {
+      if (len >= zeroCopy_->getThreshold()) {
+        return writeZeroCopy(ctx, std::move(buf), len, trackPending);
+      }
+      zeroCopy_->onFallback(len);
+    }
+
+    if (fireAndForgetWrites_ && !trackPending) {
+      socket_->writeChain(
+          &IgnoringWriteCallback::instance(),
+          std::move(buf),
+          ctx->getWriteFlags());
+      return folly::makeFuture();
+    }
+
+    auto cb = WriteCallback::allocate(!fireAndForgetWrites_);
+    auto future = fireAndForgetWrites_ ?
+      folly::makeFuture() : cb->promise_->getFuture();
+    if (trackPending) {
+      if (!pendingWrites_) {
+        pendingWrites_ = std::make_shared<PendingWrites>(this);
+      }
+      cb->bytes_ = len;
+      cb->pendingWrites_ = pendingWrites_;
+      pendingWrites_->bytes += cb->bytes_;
+    }
     socket_->writeChain(cb, std::move(buf), ctx->getWriteFlags());
+    if (trackPending) {
+      updateWritability();
+    }
     return future;
   };
 
+  uint64_t getPendingWriteBytes() const {
+    return pendingWrites_ ? pendingWrites_->bytes : 0;
+  }
+
   folly::Future<Unit> close(Context* ctx) override {
     if (socket_) {
       detachReadCallback();
@@ -114,51 +372,419 @@ class AsyncSocketHandler
   }
 
   void getReadBuffer(void** bufReturn, size_t* lenReturn) override {
-    const auto readBufferSettings = getContext()->getReadBufferSettings();
+    // Error queue entries wake up the reader like received data does;
+    // the zero-copy writer watches the queue itself, when there is one
+    if (ackLatency_ && !(zeroCopy_ && zeroCopy_->isEnabled())) {
+      ackLatency_->drain(socket_->getFd());
+    }
+    if (zeroCopyReader_ && zeroCopyReader_->isEnabled()) {
+      // What can't be mapped, e.g. a partial page, is read into a buffer
+      // of its own, so the next receive starts page-aligned
+      auto copy = zeroCopyReader_->receive(socket_.get(), bufQueue_);
+      if (copy > 0) {
+        const auto ret = bufQueue_.preallocate(copy, copy);
+        *bufReturn = ret.first;
+        *lenReturn = std::min(ret.second, copy);
+        usingSharedReadBuffer_ = false;
+        lastReadBufferLen_ = *lenReturn;
+        return;
+      }
+    }
+    auto readBufferSettings = getContext()->getReadBufferSettings();
+    // No more than what's already here, so a length the peer claims can't
+    // make us allocate for bytes it never sends
+    auto hint = std::min(getContext()->getPipeline()->getReadSizeHint(),
+                         std::max(uint64_t(kMinReadSizeHintCap),
+                                  uint64_t(bufQueue_.chainLength())));
+    hint = std::min(hint, uint64_t(kMaxReadSizeHint));
+    if (hint > readBufferSettings.first) {
+      // All of the frame being waited for in one read, if it's there
+      readBufferSettings.first = hint;
+      readBufferSettings.second = std::max(readBufferSettings.second, hint);
+    }
+    if (useSharedReadBuffer_) {
+      auto& shared = sharedReadBuffer();
+      shared.reserve(std::max(readBufferSettings.first,
+                              readBufferSettings.second));
+      *bufReturn = shared.data.get();
+      *lenReturn = shared.capacity;
+      usingSharedReadBuffer_ = true;
+      lastReadBufferLen_ = shared.capacity;
+      return;
+    }
+    auto allocator = getContext()->getPipeline()->getReadBufferAllocator();
+    if (allocator) {
+      // preallocate() would go to IOBuf::create() for a new buffer
+      auto head = bufQueue_.front();
+      auto tail = head ? head->prev() : nullptr;
+      if (!tail || tail->isSharedOne() ||
+          tail->tailroom() < readBufferSettings.first) {
+        bufQueue_.append(allocator->allocate(std::max(
+            readBufferSettings.first, readBufferSettings.second)));
+      }
+    }
     const auto ret = bufQueue_.preallocate(
         readBufferSettings.first,
         readBufferSettings.second);
     *bufReturn = ret.first;
     *lenReturn = ret.second;
+    usingSharedReadBuffer_ = false;
+    lastReadBufferLen_ = ret.second;
   }
 
   void readDataAvailable(size_t len) noexcept override {
-    bufQueue_.postallocate(len);
-    getContext()->fireRead(bufQueue_);
+    FOLLY_SDT(wangle, socket_read, this, len);
+    metrics().bytesRead.add(len);
+    auto pipeline = getContext()->getPipeline();
+    auto policy = pipeline->getReadBufferPolicy();
+    if (policy) {
+      policy->recordRead(lastReadBufferLen_, len);
+    }
+    if (usingSharedReadBuffer_) {
+      bufQueue_.append(sharedReadBuffer().data.get(), len);
+    } else {
+      bufQueue_.postallocate(len);
+    }
+    if (zeroCopyReader_) {
+      // Delivered along with what was just read
+      zeroCopyReader_->takeMapped();
+    }
+    fireReceived();
+  }
+
+  // From a LoopbackSocket, the buffers its peer wrote
+  void readBufferAvailable(std::unique_ptr<IOBuf> buf) noexcept override {
+    metrics().bytesRead.add(buf->computeChainDataLength());
+    bufQueue_.append(std::move(buf));
+    fireReceived();
   }
 
   void readEOF() noexcept override {
+    DelayedDestruction::DestructorGuard dg(getContext()->getPipeline());
+    fireMapped();
+    getContext()->getPipeline()->transportEOF();
     getContext()->fireReadEOF();
   }
 
   void readErr(const AsyncSocketException& ex)
     noexcept override {
+    DelayedDestruction::DestructorGuard dg(getContext()->getPipeline());
+    fireMapped();
+    getContext()->getPipeline()->transportError();
     getContext()->fireReadException(
         make_exception_wrapper<AsyncSocketException>(ex));
   }
 
  private:
+  struct Metrics {
+    MetricsRegistry::Counter bytesRead;
+    MetricsRegistry::Counter bytesWritten;
+  };
+
+  static const Metrics& metrics() {
+    static const Metrics m = {
+      MetricsRegistry::getDefault().counter("socket.bytes_read"),
+      MetricsRegistry::getDefault().counter("socket.bytes_written"),
+    };
+    return m;
+  }
+
+  // Larger frames still come in reads of this size
+  static const uint64_t kMaxReadSizeHint = 1 << 20;
+  static const uint64_t kMinReadSizeHintCap = 64 * 1024;
+
+  void setupZeroCopyReader() {
+    // Only called once the handler is in its pipeline, where it stays
+    zeroCopyReader_->setOnMapped([this]() {
+      DelayedDestruction::DestructorGuard dg(getContext()->getPipeline());
+      getContext()->fireRead(bufQueue_);
+      updateMemoryCharge();
+    });
+    if (!zeroCopyReader_->isEnabled() && socket_ && socket_->good()) {
+      zeroCopyReader_->enable(socket_.get());
+    }
+  }
+
+  void setupMemoryAccount(
+      const std::shared_ptr<MemoryBudget::Account>& account) {
+    if (account == memoryAccount_) {
+      return;
+    }
+    if (memoryAccount_) {
+      memoryAccount_->setPauseCallback(nullptr);
+    }
+    memoryAccount_ = account;
+    if (memoryAccount_) {
+      memoryAccount_->setPauseCallback([this](bool paused) {
+        if (paused) {
+          socket_->setReadCB(nullptr);
+        } else {
+          attachReadCallback();
+        }
+      });
+    }
+  }
+
+  // What the handlers upstream left in the queue, e.g. partial frames
+  void updateMemoryCharge() {
+    memoryCharge_.update(memoryAccount_, bufQueue_.chainLength());
+  }
+
+  void fireReceived() {
+    getContext()->getPipeline()->refreshTimeout();
+    if (!releaseIdleReadBuffer_ && !memoryAccount_) {
+      getContext()->fireRead(bufQueue_);
+      return;
+    }
+
+    // The handlers may close the pipeline, keep ourselves alive to inspect
+    // the queue afterwards.
+    DelayedDestruction::DestructorGuard dg(getContext()->getPipeline());
+    getContext()->fireRead(bufQueue_);
+    if (releaseIdleReadBuffer_) {
+      releaseReadBuffer();
+    }
+    updateMemoryCharge();
+  }
+
+  // Consumed data was popped along with its buffers, so what's left to
+  // release is the tailroom of the buffer the last read went into
+  void releaseReadBuffer() {
+    if (!bufQueue_.front()) {
+      return;
+    }
+    if (bufQueue_.chainLength() == 0) {
+      bufQueue_.move();
+      return;
+    }
+    auto tail = bufQueue_.front()->prev();
+    if (tail->tailroom() == 0) {
+      return;
+    }
+    auto chain = bufQueue_.move();
+    auto exact = IOBuf::copyBuffer(tail->data(), tail->length());
+    if (tail == chain.get()) {
+      chain = std::move(exact);
+    } else {
+      tail->unlink();
+      chain->prependChain(std::move(exact));
+    }
+    bufQueue_.append(std::move(chain));
+  }
+
+  // Delivers data mapped by a read that didn't get any to copy
+  void fireMapped() {
+    if (zeroCopyReader_ && zeroCopyReader_->takeMapped()) {
+      getContext()->fireRead(bufQueue_);
+    }
+  }
+
+  // Under TLS the kernel's byte offsets count ciphertext, so writes are
+  // tracked by the socket's raw byte count rather than by their length
+  void enableAckLatency() {
+    if (ackLatency_->enable(socket_->getFd())) {
+      ackEncrypted_ = dynamic_cast<AsyncSSLSocket*>(socket_.get()) != nullptr;
+      ackRawBytesBase_ = socket_->getRawBytesWritten();
+    }
+  }
+
+  folly::Future<Unit> writeZeroCopy(Context* ctx,
+                                    std::unique_ptr<folly::IOBuf> buf,
+                                    uint64_t len,
+                                    bool trackPending) {
+    auto future = zeroCopy_->write(
+        socket_.get(), std::move(buf), ctx->getWriteFlags());
+    if (trackPending) {
+      if (!pendingWrites_) {
+        pendingWrites_ = std::make_shared<PendingWrites>(this);
+      }
+      pendingWrites_->bytes += len;
+      auto pendingWrites = pendingWrites_;
+      future = future.ensure([pendingWrites, len]() {
+        pendingWrites->bytes -= len;
+        if (pendingWrites->handler) {
+          pendingWrites->handler->updateWritability();
+        }
+      });
+      updateWritability();
+    }
+    return fireAndForgetWrites_ ? folly::makeFuture() : std::move(future);
+  }
+
+  // WriteCallbacks are recycled through a per-thread freelist.  A socket
+  // only completes writes in its EventBase thread, which is also the thread
+  // that issued them, so callbacks are always returned to the list they
+  // were taken from.
+  struct PendingWrites {
+    explicit PendingWrites(AsyncSocketHandler* h) : handler(h) {}
+
+    // Reset when the handler goes away before its writes complete
+    AsyncSocketHandler* handler;
+    uint64_t bytes{0};
+  };
+
   class WriteCallback : private AsyncSocket::WriteCallback {
     void writeSuccess() noexcept override {
-      promise_.setValue();
-      delete this;
+      if (promise_) {
+        promise_->setValue();
+      }
+      writeDone();
     }
 
     void writeErr(size_t bytesWritten,
                     const AsyncSocketException& ex)
       noexcept override {
-      promise_.setException(ex);
-      delete this;
+      if (promise_) {
+        promise_->setException(ex);
+      } else {
+        VLOG(5) << "fire-and-forget write failed after " << bytesWritten
+                << " bytes: " << ex.what();
+      }
+      writeDone();
     }
 
    private:
     friend class AsyncSocketHandler;
-    folly::Promise<Unit> promise_;
+
+    static const size_t kMaxFreeListSize = 1024;
+
+    struct FreeList {
+      ~FreeList() {
+        while (head) {
+          auto cb = head;
+          head = cb->next_;
+          delete cb;
+        }
+      }
+
+      WriteCallback* head{nullptr};
+      size_t size{0};
+    };
+
+    static FreeList& freeList() {
+      static folly::ThreadLocal<FreeList> freeList;
+      return *freeList;
+    }
+
+    static WriteCallback* allocate(bool withPromise) {
+      auto& list = freeList();
+      WriteCallback* cb;
+      if (list.head) {
+        cb = list.head;
+        list.head = cb->next_;
+        --list.size;
+        cb->next_ = nullptr;
+      } else {
+        cb = new WriteCallback();
+      }
+      if (withPromise) {
+        cb->promise_.emplace();
+      }
+      return cb;
+    }
+
+    void writeDone() {
+      promise_.clear();
+      auto pendingWrites = std::move(pendingWrites_);
+      auto bytes = bytes_;
+      bytes_ = 0;
+      recycle();
+      if (pendingWrites) {
+        pendingWrites->bytes -= bytes;
+        if (pendingWrites->handler) {
+          pendingWrites->handler->updateWritability();
+        }
+      }
+    }
+
+    void recycle() {
+      auto& list = freeList();
+      if (list.size >= kMaxFreeListSize) {
+        delete this;
+        return;
+      }
+      next_ = list.head;
+      list.head = this;
+      ++list.size;
+    }
+
+    folly::Optional<folly::Promise<Unit>> promise_;
+    std::shared_ptr<PendingWrites> pendingWrites_;
+    uint64_t bytes_{0};
+    WriteCallback* next_{nullptr};
+  };
+
+  void updateWritability() {
+    auto ctx = getContext();
+    if (!ctx || !pendingWrites_) {
+      return;
+    }
+    auto pipeline = ctx->getPipeline();
+    const auto waterMarks = pipeline->getWriteBufferWaterMarks();
+    const bool writable = pipeline->isWritable();
+    if (writable && waterMarks.second > 0 &&
+        pendingWrites_->bytes > waterMarks.second) {
+      pipeline->setWritable(false);
+      ctx->fireWritabilityChanged();
+    } else if (!writable && (waterMarks.second == 0 ||
+                             pendingWrites_->bytes <= waterMarks.first)) {
+      pipeline->setWritable(true);
+      ctx->fireWritabilityChanged();
+    }
+  }
+
+  // Stateless callback shared by all fire-and-forget writes
+  class IgnoringWriteCallback : public AsyncSocket::WriteCallback {
+   public:
+    static IgnoringWriteCallback& instance() {
+      static IgnoringWriteCallback cb;
+      return cb;
+    }
+
+    void writeSuccess() noexcept override {}
+
+    void writeErr(size_t bytesWritten,
+                  const AsyncSocketException& ex)
+      noexcept override {
+      VLOG(5) << "fire-and-forget write failed after " << bytesWritten
+              << " bytes: " << ex.what();
+    }
+  };
+
+  struct SharedReadBuffer {
+    void reserve(size_t size) {
+      if (size > capacity) {
+        data.reset(new uint8_t[size]);
+        capacity = size;
+      }
+    }
+
+    std::unique_ptr<uint8_t[]> data;
+    size_t capacity{0};
   };
 
+  static SharedReadBuffer& sharedReadBuffer() {
+    static folly::ThreadLocal<SharedReadBuffer> buffer;
+    return *buffer;
+  }
+
   folly::IOBufQueue bufQueue_{folly::IOBufQueue::cacheChainLength()};
   std::shared_ptr<AsyncSocket> socket_{nullptr};
   bool firedInactive_{false};
+  bool fireAndForgetWrites_{false};
+  size_t lastReadBufferLen_{0};
+  std::shared_ptr<PendingWrites> pendingWrites_;
+  bool releaseIdleReadBuffer_{false};
+  bool useSharedReadBuffer_{false};
+  bool usingSharedReadBuffer_{false};
+  std::unique_ptr<AckLatencyTracker> ackLatency_;
+  bool ackEncrypted_{false};
+  uint64_t ackRawBytesBase_{0};
+  std::unique_ptr<ZeroCopyWriter> zeroCopy_;
+  std::unique_ptr<ZeroCopyReader> zeroCopyReader_;
+  // The pipeline's, while the transport is active
+  std::shared_ptr<MemoryBudget::Account> memoryAccount_;
+  MemoryBudget::Charge memoryCharge_;
 };
 
 }}
@@ -0,0 +1,120 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+namespace folly { namespace wangle {
+
+/**
+ * Memory for the handler contexts of one pipeline.  Contexts are carved out
+ * of a single block, allocated with the first of them, one after the other
+ * in the order they are added, so a pipeline built with addBack() has its
+ * contexts side by side in pipeline order.  Once the block is full the rest
+ * come from the heap.
+ *
+ * Space in the block is only reused when the context allocated last is
+ * freed, so a pipeline that keeps adding and removing handlers ends up
+ * allocating them from the heap, as it did before.  The block is freed with
+ * the arena, which has to outlive every context allocated from it.
+ */
+class ContextArena {
+ public:
+  static const size_t kBlockSize = 1024;
+
+  ContextArena() = default;
+  ContextArena(const ContextArena&) = delete;
+  ContextArena& operator=(const ContextArena&) = delete;
+
+  void* allocate(size_t size) {
+    size = align(size);
+    if (!block_) {
+      block_.reset(new char[kBlockSize]);
+    }
+    if (size <= kBlockSize - used_) {
+      void* p = block_.get() + used_;
+      used_ += size;
+      return p;
+    }
+    return ::operator new(size);
+  }
+
+  void deallocate(void* p, size_t size) {
+    auto c = static_cast<char*>(p);
+    if (!inBlock(c)) {
+      ::operator delete(p);
+      return;
+    }
+    size = align(size);
+    if (c + size == block_.get() + used_) {
+      used_ -= size;
+    }
+  }
+
+  // Bytes of the block in use
+  size_t getUsed() const {
+    return used_;
+  }
+
+  bool inBlock(const void* p) const {
+    auto c = static_cast<const char*>(p);
+    return block_ && c >= block_.get() && c < block_.get() + kBlockSize;
+  }
+
+ private:
+  static size_t align(size_t size) {
+    const size_t a = alignof(std::max_align_t);
+    return (size + a - 1) & ~(a - 1);
+  }
+
+  std::unique_ptr<char[]> block_;
+  size_t used_{0};
+};
+
+// For std::allocate_shared, which puts the control block in the arena too
+template <class T>
+class ContextAllocator {
+ public:
+  typedef T value_type;
+
+  explicit ContextAllocator(ContextArena* arena) : arena_(arena) {}
+
+  template <class U>
+  ContextAllocator(const ContextAllocator<U>& other) : arena_(other.arena_) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    arena_->deallocate(p, n * sizeof(T));
+  }
+
+  template <class U>
+  bool operator==(const ContextAllocator<U>& other) const {
+    return arena_ == other.arena_;
+  }
+
+  template <class U>
+  bool operator!=(const ContextAllocator<U>& other) const {
+    return arena_ != other.arena_;
+  }
+
+ private:
+  template <class U>
+  friend class ContextAllocator;
+
+  ContextArena* arena_;
+};
+
+}} // namespace folly::wangle
@@ -0,0 +1,314 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/DatagramSocketHandler.h>
+
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <unistd.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+namespace folly { namespace wangle {
+
+namespace {
+
+// Of a message sent with UDP_SEGMENT
+const size_t kMaxGsoSegments = 64;
+const size_t kMaxGsoBytes = 65000;
+// A longer chain is coalesced to be sent
+const size_t kMaxDatagramIovs = 16;
+
+size_t dataLength(const Datagram& datagram) {
+  return datagram.data ? datagram.data->computeChainDataLength() : 0;
+}
+
+} // namespace
+
+DatagramSocketHandler::DatagramSocketHandler(
+    folly::EventBase* base, int fd, Options options)
+  : folly::EventHandler(base, fd),
+    base_(base),
+    fd_(fd),
+    options_(std::move(options)),
+    gso_(options_.gso),
+    readBufs_(options_.readBatchSize),
+    readMsgs_(options_.readBatchSize),
+    readIovs_(options_.readBatchSize),
+    readAddrs_(options_.readBatchSize) {
+  CHECK_GT(options_.readBatchSize, 0);
+  CHECK_GT(options_.writeBatchSize, 0);
+}
+
+DatagramSocketHandler::~DatagramSocketHandler() {
+  closeSocket();
+}
+
+void DatagramSocketHandler::transportActive(Context* ctx) {
+  active_ = true;
+  updateEvents();
+  ctx->fireTransportActive();
+}
+
+void DatagramSocketHandler::transportInactive(Context* ctx) {
+  active_ = false;
+  unregisterHandler();
+  ctx->fireTransportInactive();
+}
+
+void DatagramSocketHandler::detachPipeline(Context* ctx) {
+  active_ = false;
+  unregisterHandler();
+}
+
+Future<Unit> DatagramSocketHandler::write(Context* ctx, Datagram datagram) {
+  if (fd_ < 0) {
+    return makeFuture<Unit>(std::runtime_error("datagram socket is closed"));
+  }
+  if (pending_.size() >= options_.maxPendingWrites) {
+    droppedWrites_++;
+    return makeFuture();
+  }
+  pending_.push_back(std::move(datagram));
+  if (!waitingForWrite_ && !isLoopCallbackScheduled()) {
+    base_->runInLoop(this);
+  }
+  return makeFuture();
+}
+
+Future<Unit> DatagramSocketHandler::close(Context* ctx) {
+  closeSocket();
+  return makeFuture();
+}
+
+void DatagramSocketHandler::handlerReady(uint16_t events) noexcept {
+  auto ctx = getContext();
+  if (!ctx) {
+    return;
+  }
+  DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+  if (events & folly::EventHandler::WRITE) {
+    flushWrites();
+  }
+  if (events & folly::EventHandler::READ) {
+    for (size_t i = 0; i < options_.maxReadBatches && fd_ >= 0; i++) {
+      if (readBatch(ctx) < options_.readBatchSize) {
+        break;
+      }
+    }
+  }
+}
+
+void DatagramSocketHandler::runLoopCallback() noexcept {
+  if (!waitingForWrite_) {
+    flushWrites();
+  }
+}
+
+size_t DatagramSocketHandler::readBatch(Context* ctx) {
+  const auto slotSize = options_.maxDatagramSize;
+  const auto slots = options_.readBatchSize;
+  for (size_t i = 0; i < slots; i++) {
+    // Still held by the pipeline, or never allocated
+    if (!readBufs_[i] || readBufs_[i]->isSharedOne()) {
+      readBufs_[i] = folly::IOBuf::create(slotSize);
+    }
+    readIovs_[i].iov_base = readBufs_[i]->writableBuffer();
+    readIovs_[i].iov_len = slotSize;
+    auto& hdr = readMsgs_[i].msg_hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_name = &readAddrs_[i];
+    hdr.msg_namelen = sizeof(readAddrs_[i]);
+    hdr.msg_iov = &readIovs_[i];
+    hdr.msg_iovlen = 1;
+  }
+
+  int count;
+  do {
+    count = ::recvmmsg(fd_, readMsgs_.data(), slots, MSG_DONTWAIT, nullptr);
+  } while (count == -1 && errno == EINTR);
+  if (count <= 0) {
+    if (count == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      PLOG(ERROR) << "recvmmsg() failed";
+    }
+    return 0;
+  }
+
+  for (int i = 0; i < count && fd_ >= 0; i++) {
+    auto& hdr = readMsgs_[i].msg_hdr;
+    auto data = readBufs_[i]->cloneOne();
+    data->append(readMsgs_[i].msg_len);
+    Datagram datagram;
+    datagram.data = std::move(data);
+    datagram.peer.setFromSockaddr(
+      reinterpret_cast<sockaddr*>(&readAddrs_[i]), hdr.msg_namelen);
+    datagram.truncated = hdr.msg_flags & MSG_TRUNC;
+    ctx->fireRead(datagram);
+  }
+  return count;
+}
+
+void DatagramSocketHandler::flushWrites() {
+  std::vector<size_t> counts;
+  while (fd_ >= 0 && !pending_.empty()) {
+    auto messages = prepareWrites(counts);
+    int sent;
+    do {
+      sent = ::sendmmsg(fd_, writeMsgs_.data(), messages, MSG_DONTWAIT);
+    } while (sent == -1 && errno == EINTR);
+
+    if (sent == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        setWaitingForWrite(true);
+        return;
+      }
+      if (errno == EIO && gso_) {
+        LOG(WARNING) << "UDP GSO failed, sending datagrams one by one";
+        gso_ = false;
+        continue;
+      }
+      // The first message failed; drop it and go on with the rest
+      PLOG(ERROR) << "sendmmsg() failed";
+      sent = 1;
+      droppedWrites_ += counts[0];
+    }
+    size_t done = 0;
+    for (int i = 0; i < sent; i++) {
+      done += counts[i];
+    }
+    pending_.erase(pending_.begin(), pending_.begin() + done);
+  }
+  setWaitingForWrite(false);
+}
+
+size_t DatagramSocketHandler::prepareWrites(std::vector<size_t>& counts) {
+  counts.clear();
+  writeMsgs_.clear();
+  writeIovs_.clear();
+  writeAddrs_.clear();
+  writeControl_.clear();
+  const auto controlSize = CMSG_SPACE(sizeof(uint16_t));
+
+  // The messages' iovecs, peers and controls are pointed to once the
+  // vectors are done growing
+  struct Range {
+    size_t datagram;
+    size_t iov;
+    size_t iovs;
+    uint16_t segment;
+  };
+  std::vector<Range> ranges;
+
+  size_t i = 0;
+  while (i < pending_.size() && counts.size() < options_.writeBatchSize) {
+    auto& first = pending_[i];
+    auto segment = dataLength(first);
+    size_t count = 1;
+    size_t bytes = segment;
+    if (gso_ && segment > 0) {
+      // All but the last segment have the size of the first
+      while (i + count < pending_.size() && count < kMaxGsoSegments) {
+        auto& next = pending_[i + count];
+        auto length = dataLength(next);
+        if (next.peer != first.peer || length == 0 || length > segment ||
+            bytes + length > kMaxGsoBytes) {
+          break;
+        }
+        count++;
+        bytes += length;
+        if (length < segment) {
+          break;
+        }
+      }
+    }
+
+    Range range{i, writeIovs_.size(), 0,
+                count > 1 ? uint16_t(segment) : uint16_t(0)};
+    for (size_t j = i; j < i + count; j++) {
+      auto& data = pending_[j].data;
+      if (!data) {
+        continue;
+      }
+      if (data->countChainElements() > kMaxDatagramIovs) {
+        data->coalesce();
+      }
+      for (auto& buf : *data) {
+        if (buf.size() > 0) {
+          writeIovs_.push_back(
+            {const_cast<uint8_t*>(buf.data()), buf.size()});
+        }
+      }
+    }
+    range.iovs = writeIovs_.size() - range.iov;
+    ranges.push_back(range);
+
+    counts.push_back(count);
+    i += count;
+  }
+
+  writeMsgs_.resize(ranges.size());
+  writeAddrs_.resize(ranges.size());
+  writeControl_.resize(ranges.size() * controlSize);
+  for (size_t m = 0; m < ranges.size(); m++) {
+    auto& hdr = writeMsgs_[m].msg_hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    auto& peer = pending_[ranges[m].datagram].peer;
+    hdr.msg_namelen = peer.getAddress(&writeAddrs_[m]);
+    hdr.msg_name = &writeAddrs_[m];
+    hdr.msg_iov = writeIovs_.data() + ranges[m].iov;
+    hdr.msg_iovlen = ranges[m].iovs;
+    if (ranges[m].segment > 0) {
+      hdr.msg_control = writeControl_.data() + m * controlSize;
+      hdr.msg_controllen = controlSize;
+      auto cmsg = CMSG_FIRSTHDR(&hdr);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      memcpy(CMSG_DATA(cmsg), &ranges[m].segment, sizeof(uint16_t));
+    }
+  }
+  return writeMsgs_.size();
+}
+
+void DatagramSocketHandler::setWaitingForWrite(bool waiting) {
+  // Kept while inactive too, so that the writes resume on transportActive()
+  if (waitingForWrite_ == waiting) {
+    return;
+  }
+  waitingForWrite_ = waiting;
+  updateEvents();
+}
+
+void DatagramSocketHandler::updateEvents() {
+  if (fd_ < 0 || !active_) {
+    return;
+  }
+  uint16_t events = folly::EventHandler::READ | folly::EventHandler::PERSIST;
+  if (waitingForWrite_) {
+    events |= folly::EventHandler::WRITE;
+  }
+  registerHandler(events);
+}
+
+void DatagramSocketHandler::closeSocket() {
+  if (fd_ < 0) {
+    return;
+  }
+  cancelLoopCallback();
+  unregisterHandler();
+  waitingForWrite_ = false;
+  pending_.clear();
+  ::close(fd_);
+  fd_ = -1;
+}
+
+}} // namespace folly::wangle
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+#include <folly/SocketAddress.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventHandler.h>
+
+#include <deque>
+#include <vector>
+
+#include <sys/socket.h>
+
+namespace folly { namespace wangle {
+
+/*
+ * A UDP datagram, read from peer or written to it
+ */
+struct Datagram {
+  Datagram() = default;
+  Datagram(std::unique_ptr<folly::IOBuf> buf, const folly::SocketAddress& p)
+    : data(std::move(buf)), peer(p) {}
+
+  std::unique_ptr<folly::IOBuf> data;
+  folly::SocketAddress peer;
+  // Read from a datagram longer than maxDatagramSize
+  bool truncated{false};
+};
+
+typedef Pipeline<Datagram&, Datagram> DatagramPipeline;
+
+/*
+ * The transport of a DatagramPipeline: a bound UDP socket, read with
+ * recvmmsg() in batches of readBatchSize datagrams.  Each slot of a batch
+ * has a buffer of maxDatagramSize, which is read into again once the
+ * pipeline let go of the datagram read into it, so a datagram that is
+ * held on to keeps only its own buffer alive.  Writes are queued and sent
+ * with sendmmsg() at the end of the loop; up to maxPendingWrites wait for
+ * the socket to become writable, also while the transport is inactive,
+ * and further ones are dropped.  With gso, runs of datagrams of the
+ * same size to the same peer are sent as one UDP_SEGMENT message.
+ *
+ * Writes are fire-and-forget: the future is fulfilled once the datagram
+ * is queued.  This handler may only be used in a single pipeline, in the
+ * thread of its EventBase.
+ */
+class DatagramSocketHandler
+  : public HandlerAdapter<Datagram&, Datagram>,
+    private folly::EventHandler,
+    private folly::EventBase::LoopCallback {
+ public:
+  struct Options {
+    size_t readBatchSize{32};
+    // Batches read per readable event before other events get a turn
+    size_t maxReadBatches{16};
+    size_t maxDatagramSize{2048};
+    size_t writeBatchSize{32};
+    size_t maxPendingWrites{4096};
+    bool gso{false};
+  };
+
+  // Takes ownership of fd, a bound, non-blocking UDP socket
+  DatagramSocketHandler(folly::EventBase* base, int fd, Options options);
+  ~DatagramSocketHandler();
+
+  int getFd() const {
+    return fd_;
+  }
+
+  // Datagrams dropped, as the queue was full or on send errors
+  uint64_t getDroppedWrites() const {
+    return droppedWrites_;
+  }
+
+  void transportActive(Context* ctx) override;
+  void transportInactive(Context* ctx) override;
+  void detachPipeline(Context* ctx) override;
+
+  Future<Unit> write(Context* ctx, Datagram datagram) override;
+  Future<Unit> close(Context* ctx) override;
+
+ private:
+  void handlerReady(uint16_t events) noexcept override;
+  void runLoopCallback() noexcept override;
+
+  size_t readBatch(Context* ctx);
+  void flushWrites();
+  // The messages sent by the next sendmmsg(), of the datagrams counts
+  size_t prepareWrites(std::vector<size_t>& counts);
+  void setWaitingForWrite(bool waiting);
+  // Registers for the events wanted, once the transport is active
+  void updateEvents();
+  void closeSocket();
+
+  folly::EventBase* base_;
+  int fd_;
+  Options options_;
+  bool active_{false};
+  bool waitingForWrite_{false};
+
+  // sendmmsg() may say GSO is unsupported on the route
+  bool gso_;
+  // One per slot
+  std::vector<std::unique_ptr<folly::IOBuf>> readBufs_;
+  std::vector<mmsghdr> readMsgs_;
+  std::vector<iovec> readIovs_;
+  std::vector<sockaddr_storage> readAddrs_;
+
+  std::deque<Datagram> pending_;
+  std::vector<mmsghdr> writeMsgs_;
+  std::vector<iovec> writeIovs_;
+  std::vector<sockaddr_storage> writeAddrs_;
+  std::vector<char> writeControl_;
+  uint64_t droppedWrites_{0};
+};
+
+}} // namespace folly::wangle
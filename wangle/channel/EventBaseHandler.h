@@ -10,6 +10,13 @@
 
 #pragma once
 
+#include <wangle/channel/Handler.h>
+#include <folly/MoveWrapper.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 namespace folly { namespace wangle {
 
 class EventBaseHandler : public OutboundBytesToBytesHandler {
@@ -37,4 +44,156 @@ class EventBaseHandler : public OutboundBytesToBytesHandler {
   }
 };
 
+/*
+ * Like EventBaseHandler, but writes and closes from other threads don't
+ * wait for the transport's EventBase: they're queued, in order, and the
+ * futures are fulfilled in the EventBase's thread once the write is done.
+ * However many are queued, the loop is woken once for all those queued
+ * until it runs them.  In the EventBase's thread, writes go straight
+ * through unless writes from other threads are still queued or being run.
+ */
+class NonBlockingEventBaseHandler : public OutboundBytesToBytesHandler {
+ public:
+  NonBlockingEventBaseHandler() : queue_(std::make_shared<Queue>(this)) {}
+
+  // Before it's added to a pipeline
+  NonBlockingEventBaseHandler(NonBlockingEventBaseHandler&&)
+    : NonBlockingEventBaseHandler() {}
+
+  ~NonBlockingEventBaseHandler() {
+    queue_->detach();
+  }
+
+  folly::Future<Unit> write(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    return enqueue(ctx, std::move(buf), false);
+  }
+
+  Future<Unit> close(Context* ctx) override {
+    return enqueue(ctx, nullptr, true);
+  }
+
+ private:
+  struct Op {
+    std::unique_ptr<folly::IOBuf> buf;
+    bool close;
+    Promise<Unit> promise;
+  };
+
+  // Shared with the EventBase callbacks, which may outlive the handler
+  class Queue : public std::enable_shared_from_this<Queue> {
+   public:
+    explicit Queue(NonBlockingEventBaseHandler* handler)
+      : handler_(handler) {}
+
+    // False unless ops from other threads are still waiting or being
+    // run, in which case op is queued behind them
+    bool pushFromEventBase(Op& op) {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (ops_.empty() && !draining_) {
+        return false;
+      }
+      ops_.push_back(std::move(op));
+      return true;
+    }
+
+    void push(EventBase* base, Op op) {
+      bool wake;
+      {
+        std::lock_guard<std::mutex> g(mutex_);
+        ops_.push_back(std::move(op));
+        base_ = base;
+        wake = !scheduled_;
+        scheduled_ = true;
+      }
+      if (wake) {
+        auto self = this->shared_from_this();
+        base->runInEventBaseThread([self]() {
+          self->drain();
+        });
+      }
+    }
+
+    void detach() {
+      handler_.store(nullptr, std::memory_order_release);
+    }
+
+   private:
+    void drain() {
+      std::vector<Op> ops;
+      {
+        std::lock_guard<std::mutex> g(mutex_);
+        ops.swap(ops_);
+        draining_ = true;
+      }
+      for (auto& op : ops) {
+        auto handler = handler_.load(std::memory_order_acquire);
+        if (!handler || !handler->getContext()) {
+          op.promise.setException(std::runtime_error(
+            "handler was removed before the write ran"));
+          continue;
+        }
+        auto ctx = handler->getContext();
+        DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+        auto future = op.close ? ctx->fireClose()
+                               : ctx->fireWrite(std::move(op.buf));
+        auto promise = folly::makeMoveWrapper(std::move(op.promise));
+        future.then([promise](Try<Unit>&& t) mutable {
+          promise->setTry(std::move(t));
+        });
+      }
+
+      bool more;
+      EventBase* base;
+      {
+        std::lock_guard<std::mutex> g(mutex_);
+        draining_ = false;
+        // Queued while these ran, from any thread: still in order as long
+        // as the EventBase's writes keep queueing until they're run
+        more = !ops_.empty();
+        scheduled_ = more;
+        base = base_;
+      }
+      if (more) {
+        auto self = this->shared_from_this();
+        base->runInEventBaseThread([self]() {
+          self->drain();
+        });
+      }
+    }
+
+    // Cleared by the handler going away, in whichever thread that is
+    std::atomic<NonBlockingEventBaseHandler*> handler_;
+    // Where the drain runs; set with the first push
+    EventBase* base_{nullptr};
+
+    std::mutex mutex_;
+    std::vector<Op> ops_;
+    bool scheduled_{false};
+    // Ops taken from ops_ are being run
+    bool draining_{false};
+  };
+
+  folly::Future<Unit> enqueue(
+      Context* ctx, std::unique_ptr<folly::IOBuf> buf, bool close) {
+    DCHECK(ctx->getTransport());
+    auto base = ctx->getTransport()->getEventBase();
+    DCHECK(base);
+
+    Op op;
+    op.buf = std::move(buf);
+    op.close = close;
+    auto future = op.promise.getFuture();
+    if (!base->isInEventBaseThread()) {
+      queue_->push(base, std::move(op));
+    } else if (!queue_->pushFromEventBase(op)) {
+      return close ? ctx->fireClose() : ctx->fireWrite(std::move(op.buf));
+    }
+    return future;
+  }
+
+  std::shared_ptr<Queue> queue_;
+};
+
 }} // namespace
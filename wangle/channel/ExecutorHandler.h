@@ -0,0 +1,187 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+#include <folly/Executor.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/EventBaseManager.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * Hands the messages read to a function on an executor, e.g. a
+ * CPUThreadPoolExecutor, and writes its results back from the
+ * transport's EventBase, so blocking or CPU heavy work stays off the IO
+ * thread.  The messages read in one loop iteration, up to maxBatchSize,
+ * go to the executor as one task, and their results come back in one
+ * notification.  With ordered, results are written in the order the
+ * messages were read, holding those of a batch done early until the
+ * batches before it are written; otherwise each batch is written when
+ * it's done.  If the function throws, the connection is closed.
+ */
+template <typename Req, typename Resp = Req>
+class ExecutorHandler : public HandlerAdapter<Req, Resp>,
+                        private EventBase::LoopCallback {
+ public:
+  typedef typename HandlerAdapter<Req, Resp>::Context Context;
+  typedef std::function<Resp(Req)> Function;
+
+  struct Options {
+    size_t maxBatchSize{64};
+    bool ordered{true};
+  };
+
+  ExecutorHandler(std::shared_ptr<Executor> executor,
+                  Function function,
+                  Options options = Options())
+    : executor_(std::move(executor)),
+      function_(std::make_shared<Function>(std::move(function))),
+      options_(options),
+      state_(std::make_shared<State>()) {
+    CHECK(executor_);
+    CHECK_GT(options_.maxBatchSize, 0);
+    state_->ordered = options_.ordered;
+  }
+
+  void attachPipeline(Context* ctx) override {
+    state_->ctx = ctx;
+  }
+
+  void detachPipeline(Context* ctx) override {
+    state_->ctx = nullptr;
+    cancelLoopCallback();
+    batch_.reset();
+  }
+
+  void read(Context* ctx, Req msg) override {
+    if (!batch_) {
+      batch_ = std::make_shared<Batch>();
+      auto transport = ctx->getTransport();
+      evb_ = transport && transport->getEventBase()
+        ? transport->getEventBase()
+        : EventBaseManager::get()->getEventBase();
+    }
+    batch_->requests.push_back(std::move(msg));
+    if (batch_->requests.size() >= options_.maxBatchSize) {
+      cancelLoopCallback();
+      submit();
+    } else if (!isLoopCallbackScheduled()) {
+      evb_->runInLoop(this);
+    }
+  }
+
+  // Batches on the executor or waiting for the ones before
+  size_t getNumPendingBatches() const {
+    return state_->pending.size();
+  }
+
+ private:
+  struct Batch {
+    std::vector<Req> requests;
+    std::vector<Try<Resp>> responses;
+    bool done{false};
+  };
+
+  // Shared with the batches on the executor, which may outlive the handler
+  struct State {
+    Context* ctx{nullptr};
+    bool ordered{true};
+    // In read order; only touched in the EventBase
+    std::deque<std::shared_ptr<Batch>> pending;
+  };
+
+  void runLoopCallback() noexcept override {
+    submit();
+  }
+
+  void submit() {
+    auto batch = std::move(batch_);
+    state_->pending.push_back(batch);
+
+    auto state = state_;
+    auto function = function_;
+    auto evb = evb_;
+    try {
+      executor_->add([state, function, batch, evb] {
+        batch->responses.reserve(batch->requests.size());
+        for (auto& request : batch->requests) {
+          batch->responses.push_back(makeTryWith([&] {
+            return (*function)(std::move(request));
+          }));
+        }
+        batch->requests.clear();
+        evb->runInEventBaseThread([state, batch] {
+          batch->done = true;
+          flush(state, batch.get());
+        });
+      });
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "ExecutorHandler: executor refused batch: " << ex.what();
+      state_->pending.pop_back();
+      if (state_->ctx) {
+        state_->ctx->fireClose();
+      }
+    }
+  }
+
+  // Writes out the results of done, and of the batches it held up
+  static void flush(const std::shared_ptr<State>& state, Batch* done) {
+    auto& pending = state->pending;
+    if (!state->ordered) {
+      for (auto it = pending.begin(); it != pending.end(); ++it) {
+        if (it->get() == done) {
+          auto batch = std::move(*it);
+          pending.erase(it);
+          write(state, batch.get());
+          return;
+        }
+      }
+      return;
+    }
+    while (!pending.empty() && pending.front()->done) {
+      auto batch = std::move(pending.front());
+      pending.pop_front();
+      write(state, batch.get());
+    }
+  }
+
+  static void write(const std::shared_ptr<State>& state, Batch* batch) {
+    for (auto& response : batch->responses) {
+      auto ctx = state->ctx;
+      if (!ctx) {
+        return;
+      }
+      if (response.hasException()) {
+        LOG(ERROR) << "ExecutorHandler: function threw "
+                   << response.exception().what();
+        state->pending.clear();
+        ctx->fireClose();
+        return;
+      }
+      ctx->fireWrite(std::move(response.value()));
+    }
+  }
+
+  std::shared_ptr<Executor> executor_;
+  std::shared_ptr<Function> function_;
+  const Options options_;
+  std::shared_ptr<State> state_;
+  // Read in this loop iteration, not submitted yet
+  std::shared_ptr<Batch> batch_;
+  EventBase* evb_{nullptr};
+};
+
+}} // namespace
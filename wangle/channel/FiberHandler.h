@@ -0,0 +1,162 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/MoveWrapper.h>
+#include <folly/Optional.h>
+#include <folly/experimental/fibers/Baton.h>
+#include <folly/experimental/fibers/FiberManagerMap.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/channel/Handler.h>
+
+#include <deque>
+#include <type_traits>
+
+namespace folly { namespace wangle {
+
+/**
+ * A handler whose protocol logic is written as straight-line code: run()
+ * is started on a fiber of the connection's EventBase (the FiberManager
+ * FiberServerDispatcher uses) with the first transportActive() or read(),
+ * and loops on readMessage() and writeMessage(), which suspend the fiber
+ * and not the thread.
+ *
+ * Reads are queued for the fiber and handed over without a future, and
+ * fiber stacks are recycled by the FiberManager (see opts, which only take
+ * effect for the first user of the EventBase's FiberManager), so a
+ * connection's state lives on one stack instead of in per-message
+ * continuations.  The pipeline is kept alive until run() returns, so run()
+ * should return once readMessage() returns none.
+ *
+ * In has to be a value, so frame bytes in a codec before this handler.
+ */
+template <class In, class Out = In>
+class FiberHandler : public HandlerAdapter<In, Out> {
+  static_assert(!std::is_reference<In>::value,
+                "FiberHandler queues its reads, they can't be references");
+
+ public:
+  typedef typename HandlerAdapter<In, Out>::Context Context;
+
+  explicit FiberHandler(const fibers::FiberManager::Options& opts =
+                            fibers::FiberManager::Options())
+      : opts_(opts) {}
+
+  // For addBack() by value, before the handler is in a pipeline
+  FiberHandler(FiberHandler&& other) noexcept
+      : HandlerAdapter<In, Out>(std::move(other)), opts_(other.opts_) {}
+
+  void transportActive(Context* ctx) override {
+    start(ctx);
+    ctx->fireTransportActive();
+  }
+
+  void read(Context* ctx, In msg) override {
+    start(ctx);
+    reads_.push_back(std::move(msg));
+    wake();
+  }
+
+  void readEOF(Context* ctx) override {
+    finish();
+    ctx->fireReadEOF();
+  }
+
+  void readException(Context* ctx, exception_wrapper e) override {
+    finish();
+    ctx->fireReadException(std::move(e));
+  }
+
+  void transportInactive(Context* ctx) override {
+    finish();
+    ctx->fireTransportInactive();
+  }
+
+  Future<Unit> close(Context* ctx) override {
+    finish();
+    return ctx->fireClose();
+  }
+
+ protected:
+  // The connection's logic, on its fiber
+  virtual void run(Context* ctx) = 0;
+
+  /**
+   * The next message read, suspending the fiber until there is one, or
+   * none once the connection is done: it read EOF or an error, went
+   * inactive, or was closed.  Only on the fiber.
+   */
+  Optional<In> readMessage() {
+    while (reads_.empty() && !done_) {
+      waiting_ = true;
+      baton_.wait();
+      baton_.reset();
+    }
+    if (reads_.empty()) {
+      return none;
+    }
+    Optional<In> msg(std::move(reads_.front()));
+    reads_.pop_front();
+    return msg;
+  }
+
+  // Writes msg, suspending the fiber until it's written.  Only on the fiber.
+  Try<Unit> writeMessage(Out msg) {
+    auto f = ctx_->fireWrite(std::move(msg));
+    if (f.isReady()) {
+      return std::move(f.getTry());
+    }
+    return fibers::await([&](fibers::Promise<Try<Unit>> p) {
+      auto moveP = folly::makeMoveWrapper(std::move(p));
+      f.then([moveP](Try<Unit>&& t) mutable {
+        moveP->setValue(std::move(t));
+      });
+    });
+  }
+
+ private:
+  void start(Context* ctx) {
+    if (ctx_) {
+      return;
+    }
+    ctx_ = ctx;
+    auto transport = ctx->getTransport();
+    auto evb = transport ? transport->getEventBase()
+                         : EventBaseManager::get()->getEventBase();
+    auto& fm = fibers::getFiberManager(*evb, opts_);
+    DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+    fm.addTask([this, ctx, dg]() {
+      run(ctx);
+    });
+  }
+
+  void finish() {
+    done_ = true;
+    wake();
+  }
+
+  // Posted once for each wait
+  void wake() {
+    if (waiting_) {
+      waiting_ = false;
+      baton_.post();
+    }
+  }
+
+  fibers::FiberManager::Options opts_;
+  Context* ctx_{nullptr};
+  std::deque<In> reads_;
+  fibers::Baton baton_;
+  bool waiting_{false};
+  bool done_{false};
+};
+
+}} // namespace folly::wangle
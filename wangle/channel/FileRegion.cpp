@@ -15,9 +15,32 @@
  */
 #include <wangle/channel/FileRegion.h>
 
+#include <folly/MoveWrapper.h>
+#include <folly/ThreadLocal.h>
+#include <folly/io/async/AsyncSSLSocket.h>
+
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstring>
+
+#ifdef WANGLE_HAVE_LIBURING
+#include <liburing.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#endif
+
 using namespace folly;
 using namespace folly::wangle;
 
+#ifdef __GLIBC__
+# if (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 9))
+#   define GLIBC_AT_LEAST_2_9 1
+#  endif
+#endif
+
 namespace {
 
 struct FileRegionReadPool {};
@@ -29,18 +52,510 @@ Singleton<IOThreadPoolExecutor, FileRegionReadPool> readPool(
         std::make_shared<NamedThreadFactory>("FileRegionReadPool"));
   });
 
+std::atomic<uint64_t> pipePoolHits{0};
+std::atomic<uint64_t> pipePoolMisses{0};
+
+// The empty pipes of one FileRegionReadPool thread, which takes a pipe for
+// each transfer it splices and returns it when the transfer is done
+class PipePool {
+ public:
+  // Most pipes kept by a thread
+  static const size_t kMaxPipes = 16;
+
+  ~PipePool() {
+    for (auto& pipe : pipes_) {
+      ::close(pipe.first);
+      ::close(pipe.second);
+    }
+  }
+
+  // The read and write ends of a pipe, or false if none could be made
+  bool get(int& pipeOut, int& pipeIn) {
+    if (!pipes_.empty()) {
+      pipeOut = pipes_.back().first;
+      pipeIn = pipes_.back().second;
+      pipes_.pop_back();
+      pipePoolHits.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+    pipePoolMisses.fetch_add(1, std::memory_order_relaxed);
+#ifndef GLIBC_AT_LEAST_2_9
+    return false;
+#else
+    int pipeFds[2];
+    if (::pipe2(pipeFds, O_NONBLOCK) == -1) {
+      return false;
+    }
+
+#ifdef F_SETPIPE_SZ
+    // Max size for unprevileged processes as set in /proc/sys/fs/pipe-max-size
+    // Ignore failures and just roll with it
+    // TODO maybe read max size from /proc?
+    fcntl(pipeFds[0], F_SETPIPE_SZ, 1048576);
+    fcntl(pipeFds[1], F_SETPIPE_SZ, 1048576);
+#endif
+
+    pipeOut = pipeFds[0];
+    pipeIn = pipeFds[1];
+    return true;
+#endif
+  }
+
+  // Only for pipes that are empty
+  void put(int pipeOut, int pipeIn) {
+    if (pipes_.size() < kMaxPipes) {
+      pipes_.emplace_back(pipeOut, pipeIn);
+    } else {
+      ::close(pipeOut);
+      ::close(pipeIn);
+    }
+  }
+
+ private:
+  std::vector<std::pair<int, int>> pipes_;
+};
+
+ThreadLocal<PipePool> pipePool;
+
+// Reads size bytes of fd at offset, setting err on failure
+std::unique_ptr<IOBuf> readChunk(int fd, off_t offset, size_t size,
+                                 int& err) {
+  auto buf = IOBuf::create(size);
+  while (buf->length() < size) {
+    ssize_t n = ::pread(fd, buf->writableTail(), size - buf->length(),
+                        offset + buf->length());
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // The file is shorter than the region if 0
+      err = n == 0 ? ENODATA : errno;
+      return nullptr;
+    }
+    buf->append(n);
+  }
+  return buf;
+}
+
+/*
+ * Reads a region one chunk at a time and writes the chunks through the
+ * transport, reading ahead while up to kMaxChunksBuffered are written.
+ * Keeps itself alive until the region is written, or it has failed and
+ * the transport is done with all its writes.
+ */
+class ChunkedTransfer : public AsyncTransportWrapper::WriteCallback {
+ public:
+  ChunkedTransfer(std::shared_ptr<AsyncTransportWrapper> transport,
+                  int fd, off_t offset, size_t count, bool readInline)
+    : transport_(std::move(transport)),
+      evb_(transport_->getEventBase()),
+      fd_(fd),
+      next_(offset),
+      end_(offset + count),
+      readInline_(readInline) {}
+
+  Future<Unit> start(std::shared_ptr<ChunkedTransfer> self) {
+    self_ = std::move(self);
+    auto f = promise_.getFuture();
+    pump();
+    return f;
+  }
+
+  void writeSuccess() noexcept override {
+    buffered_--;
+    pump();
+  }
+
+  void writeErr(size_t bytesWritten,
+                const AsyncSocketException& ex) noexcept override {
+    buffered_--;
+    auto guard = self_;
+    finish(make_exception_wrapper<AsyncSocketException>(ex));
+  }
+
+ private:
+  void pump() {
+    if (pumping_) {
+      // The outer call picks up where this one would have
+      return;
+    }
+    auto guard = self_;
+    pumping_ = true;
+    while (!failed_ && !reading_ && next_ < end_ &&
+           buffered_ < FileRegion::kMaxChunksBuffered) {
+      auto offset = next_;
+      auto size = std::min<size_t>(FileRegion::kChunkSize, end_ - next_);
+      next_ += size;
+      if (readInline_) {
+        int err = 0;
+        auto buf = readChunk(fd_, offset, size, err);
+        write(std::move(buf), err);
+        continue;
+      }
+      reading_ = true;
+      readPool.get()->add([guard, offset, size] {
+        auto transfer = guard.get();
+        transfer->readErr_ = 0;
+        transfer->readBuf_ =
+          readChunk(transfer->fd_, offset, size, transfer->readErr_);
+        transfer->evb_->runInEventBaseThread([guard] {
+          guard->reading_ = false;
+          guard->write(std::move(guard->readBuf_), guard->readErr_);
+          guard->pump();
+        });
+      });
+    }
+    pumping_ = false;
+    if (!failed_ && !reading_ && next_ == end_ && buffered_ == 0) {
+      promise_.setValue();
+      failed_ = true;
+    }
+    release();
+  }
+
+  void write(std::unique_ptr<IOBuf> buf, int err) {
+    if (failed_) {
+      return;
+    }
+    if (!buf) {
+      finish(make_exception_wrapper<AsyncSocketException>(
+          AsyncSocketException::INTERNAL_ERROR, "pread failed", err));
+      return;
+    }
+    buffered_++;
+    transport_->writeChain(this, std::move(buf));
+  }
+
+  void finish(exception_wrapper ew) {
+    if (!failed_) {
+      failed_ = true;
+      promise_.setException(std::move(ew));
+    }
+    release();
+  }
+
+  void release() {
+    if (failed_ && !pumping_ && !reading_ && buffered_ == 0) {
+      self_.reset();
+    }
+  }
+
+  std::shared_ptr<AsyncTransportWrapper> transport_;
+  EventBase* evb_;
+  const int fd_;
+  off_t next_;
+  const off_t end_;
+  const bool readInline_;
+  std::shared_ptr<ChunkedTransfer> self_;
+  Promise<Unit> promise_;
+  // Done, whether written or failed
+  bool failed_{false};
+  bool pumping_{false};
+  // A chunk being read on the read pool, into readBuf_
+  bool reading_{false};
+  std::unique_ptr<IOBuf> readBuf_;
+  int readErr_{0};
+  size_t buffered_{0};
+};
+
 }
 
 namespace folly { namespace wangle {
 
+const size_t FileRegion::kMaxResidencyCheck;
+
+const size_t FileRegion::kChunkSize;
+const size_t FileRegion::kMaxChunksBuffered;
+
+bool FileRegion::isEncrypted(AsyncSocket* socket) {
+  return dynamic_cast<AsyncSSLSocket*>(socket) != nullptr;
+}
+
+Future<Unit> FileRegion::readAndWrite(
+    std::shared_ptr<AsyncTransport> transport, bool readInline) {
+  auto wrapper = std::dynamic_pointer_cast<AsyncTransportWrapper>(transport);
+  CHECK(wrapper);
+  auto transfer = std::make_shared<ChunkedTransfer>(
+    std::move(wrapper), fd_, offset_, count_, readInline);
+  return transfer->start(transfer);
+}
+
+FileRegion::PipePoolStats FileRegion::getPipePoolStats() {
+  PipePoolStats stats;
+  stats.hits = pipePoolHits.load(std::memory_order_relaxed);
+  stats.misses = pipePoolMisses.load(std::memory_order_relaxed);
+  return stats;
+}
+
+bool FileRegion::isResident(int fd, off_t offset, size_t count) {
+  if (count == 0) {
+    return true;
+  }
+  static const long pageSize = sysconf(_SC_PAGESIZE);
+  off_t start = offset & ~off_t(pageSize - 1);
+  size_t length = count + (offset - start);
+  auto addr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, start);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  std::vector<unsigned char> pages((length + pageSize - 1) / pageSize);
+  bool resident = ::mincore(addr, length, pages.data()) == 0;
+  for (size_t i = 0; resident && i < pages.size(); i++) {
+    resident = pages[i] & 1;
+  }
+  ::munmap(addr, length);
+  return resident;
+}
+
+bool FileRegion::SendfileWriteRequest::performWrite() {
+  while (totalBytesWritten_ < count_) {
+    ssize_t sent = ::sendfile(socket_->getFd(), fd_, &offset_,
+                              count_ - totalBytesWritten_);
+    if (sent == -1) {
+      return errno == EAGAIN;
+    }
+    if (sent == 0) {
+      // The file is shorter than the region
+      errno = ENODATA;
+      return false;
+    }
+    bytesWritten(sent);
+  }
+  return true;
+}
+
 FileRegion::FileWriteRequest::FileWriteRequest(AsyncSocket* socket,
     WriteCallback* callback, int fd, off_t offset, size_t count)
   : WriteRequest(socket, callback),
     readFd_(fd), offset_(offset), count_(count) {
 }
 
+#ifdef WANGLE_HAVE_LIBURING
+
+/*
+ * Splices from files into pipes through io_uring, where they wait on the
+ * disk in the kernel.  The splices queued in a loop iteration are
+ * submitted together at its end, and their completions are read when the
+ * ring's eventfd fires, in the read thread's EventBase.  Each entry's
+ * user_data is its request tagged with what the entry is for, so a
+ * request's poll can be told from its splice, and cancelled with it.
+ */
+class FileRegion::SpliceRing : public EventHandler,
+                               public EventBase::LoopCallback {
+ public:
+  static const unsigned kEntries = 256;
+
+  // In the low bits of user_data, under the FileWriteRequest pointer
+  enum Tag : uintptr_t {
+    kSplice = 0,
+    kPoll = 1,
+    kCancel = 2,
+    kTagMask = 3,
+  };
+
+  ~SpliceRing() {
+    if (ok_) {
+      unregisterHandler();
+      cancelLoopCallback();
+      io_uring_queue_exit(&ring_);
+      ::close(eventFd_);
+    }
+  }
+
+  bool init(EventBase* evb) {
+    if (tried_) {
+      return ok_;
+    }
+    tried_ = true;
+    if (io_uring_queue_init(kEntries, &ring_, 0) != 0) {
+      LOG(WARNING) << "io_uring unavailable, splicing in the read threads";
+      return false;
+    }
+    eventFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (eventFd_ == -1 || io_uring_register_eventfd(&ring_, eventFd_) != 0) {
+      if (eventFd_ != -1) {
+        ::close(eventFd_);
+      }
+      io_uring_queue_exit(&ring_);
+      return false;
+    }
+    evb_ = evb;
+    initHandler(evb, eventFd_);
+    registerHandler(EventHandler::READ | EventHandler::PERSIST);
+    ok_ = true;
+    return true;
+  }
+
+  // Once the pipe, which doesn't block, has room
+  bool splice(int fdIn, off_t offset, int fdOut, size_t length,
+              FileWriteRequest* req) {
+    // Both in the same submission, so the link isn't split
+    if (!reserve(2)) {
+      return false;
+    }
+    auto poll = getSqe();
+    io_uring_prep_poll_add(poll, fdOut, POLLOUT);
+    io_uring_sqe_set_flags(poll, IOSQE_IO_LINK);
+    io_uring_sqe_set_data(poll, tag(req, kPoll));
+    auto sqe = getSqe();
+    io_uring_prep_splice(sqe, fdIn, offset, fdOut, -1, length, 0);
+    io_uring_sqe_set_data(sqe, tag(req, kSplice));
+    return true;
+  }
+
+  // Its splice still completes, with -ECANCELED if it was cancelled while
+  // waiting on the poll
+  void cancel(FileWriteRequest* req) {
+    if (!reserve(2)) {
+      LOG(ERROR) << "io_uring submission queue full, splice not cancelled";
+      return;
+    }
+    for (auto what : {kPoll, kSplice}) {
+      auto sqe = getSqe();
+      io_uring_prep_cancel(sqe, tag(req, what), 0);
+      io_uring_sqe_set_data(sqe, tag(req, kCancel));
+    }
+  }
+
+  void runLoopCallback() noexcept override {
+    submit();
+  }
+
+  void handlerReady(uint16_t events) noexcept override {
+    eventfd_t count;
+    ::eventfd_read(eventFd_, &count);
+    io_uring_cqe* cqe;
+    while (io_uring_peek_cqe(&ring_, &cqe) == 0) {
+      auto data = reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe));
+      auto result = cqe->res;
+      io_uring_cqe_seen(&ring_, cqe);
+      // Only the splice's completion is the request's; its poll's and the
+      // cancels' say nothing the splice's won't
+      if ((data & kTagMask) == kSplice) {
+        reinterpret_cast<FileWriteRequest*>(data)->spliceDone(result);
+      }
+    }
+  }
+
+ private:
+  static void* tag(FileWriteRequest* req, Tag what) {
+    static_assert(alignof(FileWriteRequest) > kTagMask,
+                  "no room for the tag");
+    return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(req) | what);
+  }
+
+  // Whatever the kernel didn't take, because it was short of memory or
+  // completion space, stays queued and goes on the next iteration
+  void submit() {
+    io_uring_submit(&ring_);
+    if (io_uring_sq_ready(&ring_) > 0 && !isLoopCallbackScheduled()) {
+      evb_->runInLoop(this);
+    }
+  }
+
+  // Room for n more entries, submitting those already queued if need be
+  bool reserve(unsigned n) {
+    if (io_uring_sq_space_left(&ring_) < n) {
+      submit();
+      if (io_uring_sq_space_left(&ring_) < n) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  io_uring_sqe* getSqe() {
+    auto sqe = io_uring_get_sqe(&ring_);
+    if (!isLoopCallbackScheduled()) {
+      evb_->runInLoop(this);
+    }
+    return sqe;
+  }
+
+  io_uring ring_;
+  int eventFd_{-1};
+  EventBase* evb_{nullptr};
+  bool tried_{false};
+  bool ok_{false};
+};
+
+FileRegion::SpliceRing* FileRegion::getSpliceRing(EventBase* evb) {
+  static ThreadLocal<SpliceRing> rings;
+  auto ring = rings.get();
+  return ring->init(evb) ? ring : nullptr;
+}
+
+void FileRegion::FileWriteRequest::submitSplice() {
+  // No more than the pipe holds, so the splice doesn't wait on the socket
+  auto length = std::min<size_t>(bytesToSplice_, 1048576);
+  if (!ring_->splice(readFd_, offset_, pipe_in_, length, this)) {
+    fail(__func__, AsyncSocketException(
+        AsyncSocketException::INTERNAL_ERROR,
+        "io_uring submission queue full"));
+    return;
+  }
+  splicing_ = true;
+}
+
+void FileRegion::FileWriteRequest::spliceDone(int result) {
+  splicing_ = false;
+  if (destroyed_) {
+    delete this;
+    return;
+  }
+  if (result == -EAGAIN) {
+    // The pipe filled up again after the poll
+    submitSplice();
+    return;
+  }
+  if (result <= 0) {
+    fail(__func__, AsyncSocketException(
+        AsyncSocketException::INTERNAL_ERROR,
+        result == 0 ? "file shorter than region" : "splice failed",
+        -result));
+    return;
+  }
+  offset_ += result;
+  bytesToSplice_ -= result;
+  try {
+    queue_.putMessage(static_cast<size_t>(result));
+  } catch (...) {
+    fail(__func__, AsyncSocketException(
+        AsyncSocketException::INTERNAL_ERROR,
+        "putMessage failed"));
+    return;
+  }
+  if (bytesToSplice_ > 0) {
+    submitSplice();
+  }
+}
+
+#else
+
+class FileRegion::SpliceRing {
+ public:
+  void cancel(FileWriteRequest*) {}
+};
+
+FileRegion::SpliceRing* FileRegion::getSpliceRing(EventBase*) {
+  return nullptr;
+}
+
+void FileRegion::FileWriteRequest::submitSplice() {
+}
+
+void FileRegion::FileWriteRequest::spliceDone(int) {
+}
+
+#endif
+
 void FileRegion::FileWriteRequest::destroy() {
   readBase_->runInEventBaseThread([this]{
+    if (splicing_) {
+      destroyed_ = true;
+      ring_->cancel(this);
+      return;
+    }
     delete this;
   });
 }
@@ -83,12 +598,6 @@ void FileRegion::FileWriteRequest::messageAvailable(size_t&& count) {
   }
 }
 
-#ifdef __GLIBC__
-# if (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 9))
-#   define GLIBC_AT_LEAST_2_9 1
-#  endif
-#endif
-
 void FileRegion::FileWriteRequest::start() {
   started_ = true;
   readBase_ = readPool.get()->getEventBase();
@@ -114,42 +623,48 @@ void FileRegion::FileWriteRequest::start() {
         "writeFile unsupported on glibc < 2.9"));
     return;
 #else
-    int pipeFds[2];
-    if (::pipe2(pipeFds, O_NONBLOCK) == -1) {
+    if (!pipePool->get(pipe_out_, pipe_in_)) {
       fail(__func__, AsyncSocketException(
           AsyncSocketException::INTERNAL_ERROR,
           "pipe2 failed", errno));
       return;
     }
 
-#ifdef F_SETPIPE_SZ
-    // Max size for unprevileged processes as set in /proc/sys/fs/pipe-max-size
-    // Ignore failures and just roll with it
-    // TODO maybe read max size from /proc?
-    fcntl(pipeFds[0], F_SETPIPE_SZ, 1048576);
-    fcntl(pipeFds[1], F_SETPIPE_SZ, 1048576);
-#endif
-
-    pipe_out_ = pipeFds[0];
-
     socket_->getEventBase()->runInEventBaseThreadAndWait([&]{
       startConsuming(socket_->getEventBase(), &queue_);
     });
+    ring_ = getSpliceRing(readBase_);
+    if (ring_) {
+      bytesToSplice_ = count_;
+      if (count_ > 0) {
+        submitSplice();
+      }
+      return;
+    }
     readHandler_ = folly::make_unique<FileReadHandler>(
-        this, pipeFds[1], count_);
+        this, pipe_in_, count_);
 #endif
   });
 }
 
 FileRegion::FileWriteRequest::~FileWriteRequest() {
   CHECK(readBase_->isInEventBaseThread());
+  bool empty = false;
   socket_->getEventBase()->runInEventBaseThreadAndWait([&]{
     stopConsuming();
-    if (pipe_out_ > -1) {
-      ::close(pipe_out_);
-    }
+    // Whatever was spliced in was spliced out
+    empty = isComplete();
   });
 
+  readHandler_.reset();
+  if (pipe_out_ > -1) {
+    if (empty) {
+      pipePool->put(pipe_out_, pipe_in_);
+    } else {
+      ::close(pipe_out_);
+      ::close(pipe_in_);
+    }
+  }
 }
 
 void FileRegion::FileWriteRequest::fail(
@@ -174,8 +689,8 @@ FileRegion::FileWriteRequest::FileReadHandler::FileReadHandler(
 
 FileRegion::FileWriteRequest::FileReadHandler::~FileReadHandler() {
   CHECK(req_->readBase_->isInEventBaseThread());
+  // The pipe is the request's
   unregisterHandler();
-  ::close(pipe_in_);
 }
 
 void FileRegion::FileWriteRequest::FileReadHandler::handlerReady(
@@ -213,4 +728,120 @@ void FileRegion::FileWriteRequest::FileReadHandler::handlerReady(
     }
   }
 }
+
+FileRegionChain& FileRegionChain::append(std::unique_ptr<IOBuf> buf) {
+  auto length = buf->computeChainDataLength();
+  if (length > 0) {
+    segments_.emplace_back(std::move(buf));
+    length_ += length;
+  }
+  return *this;
+}
+
+FileRegionChain& FileRegionChain::append(int fd, off_t offset, size_t count) {
+  if (count > 0) {
+    segments_.emplace_back(fd, offset, count);
+    length_ += count;
+  }
+  return *this;
+}
+
+Future<Unit> FileRegionChain::transferTo(
+    std::shared_ptr<AsyncTransport> transport) {
+  auto segments = std::move(segments_);
+  segments_.clear();
+  auto length = length_;
+  length_ = 0;
+  if (length == 0) {
+    return makeFuture();
+  }
+
+  auto socket = std::dynamic_pointer_cast<AsyncSocket>(transport);
+  if (socket && !FileRegion::isEncrypted(socket.get())) {
+    auto cb = new FileRegion::WriteCallback();
+    auto f = cb->promise_.getFuture();
+    socket->writeRequest(new ChainWriteRequest(
+        socket.get(), cb, std::move(segments), length));
+    return f;
+  }
+
+  // One piece after the other, so the regions' chunks can't interleave
+  auto wrapper = std::dynamic_pointer_cast<AsyncTransportWrapper>(transport);
+  CHECK(wrapper);
+  auto f = makeFuture();
+  for (auto& segment : segments) {
+    if (segment.fd == -1) {
+      auto buf = folly::makeMoveWrapper(segment.buf.move());
+      f = f.then([wrapper, buf] () mutable {
+        auto cb = new FileRegion::WriteCallback();
+        auto written = cb->promise_.getFuture();
+        wrapper->writeChain(cb, buf.move());
+        return written;
+      });
+    } else {
+      auto fd = segment.fd;
+      auto offset = segment.offset;
+      auto count = segment.count;
+      f = f.then([transport, fd, offset, count] {
+        return FileRegion(fd, offset, count).transferTo(transport);
+      });
+    }
+  }
+  return f;
+}
+
+bool FileRegionChain::ChainWriteRequest::performWrite() {
+  static const size_t kMaxIovecs = 64;
+  while (index_ < segments_.size()) {
+    auto& segment = segments_[index_];
+    // So the kernel holds a partial packet for what follows
+    int more = index_ + 1 < segments_.size() ? MSG_MORE : 0;
+    ssize_t sent;
+    if (segment.fd == -1) {
+      iovec iov[kMaxIovecs];
+      size_t n = 0;
+      auto front = segment.buf.front();
+      auto buf = front;
+      do {
+        if (buf->length() > 0) {
+          iov[n].iov_base = const_cast<uint8_t*>(buf->data());
+          iov[n].iov_len = buf->length();
+          n++;
+        }
+        buf = buf->next();
+      } while (buf != front && n < kMaxIovecs);
+      if (buf != front) {
+        more = MSG_MORE;
+      }
+      msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = n;
+      sent = ::sendmsg(socket_->getFd(), &msg, MSG_NOSIGNAL | more);
+      if (sent > 0) {
+        segment.buf.trimStart(sent);
+      }
+    } else {
+      sent = ::sendfile(socket_->getFd(), segment.fd, &segment.offset,
+                        segment.count);
+      if (sent == 0) {
+        // The file is shorter than the region
+        errno = ENODATA;
+        return false;
+      }
+      if (sent > 0) {
+        segment.count -= sent;
+      }
+    }
+    if (sent == -1) {
+      return errno == EAGAIN;
+    }
+    bytesWritten(sent);
+    if (segment.fd == -1 ? segment.buf.empty() : segment.count == 0) {
+      index_++;
+    }
+  }
+  return true;
+}
+
 }} // folly::wangle
@@ -27,20 +27,66 @@ namespace folly { namespace wangle {
 
 class FileRegion {
  public:
-  FileRegion(int fd, off_t offset, size_t count)
-    : fd_(fd), offset_(offset), count_(count) {}
+  enum class Mode {
+    // Splice the file into a pipe on FileRegionReadPool, and the pipe into
+    // the socket in its EventBase
+    SPLICE,
+    // sendfile() straight from the socket's EventBase, which blocks it on
+    // any of the file that has to be read from disk
+    SENDFILE,
+    // SENDFILE if the region is all in the page cache, else SPLICE
+    ADAPTIVE,
+  };
+
+  // Largest region ADAPTIVE checks the page cache for; larger ones are
+  // always spliced
+  static const size_t kMaxResidencyCheck = 16 * 1024 * 1024;
+
+  // Transports that encrypt, such as AsyncSSLSocket, or that aren't
+  // sockets at all or have no fd, such as LoopbackSocket, can't be written
+  // to behind their back.  Their regions
+  // are read into buffers of kChunkSize, on FileRegionReadPool for SPLICE
+  // or in the transport's EventBase otherwise (as for sendfile()), and
+  // written with writeChain(), at most kMaxChunksBuffered at a time.
+  static const size_t kChunkSize = 64 * 1024;
+  static const size_t kMaxChunksBuffered = 4;
+
+  FileRegion(int fd, off_t offset, size_t count, Mode mode = Mode::ADAPTIVE)
+    : fd_(fd), offset_(offset), count_(count), mode_(mode) {}
 
   Future<Unit> transferTo(std::shared_ptr<AsyncTransport> transport) {
     auto socket = std::dynamic_pointer_cast<AsyncSocket>(
         transport);
-    CHECK(socket);
+    bool sendfile = mode_ == Mode::SENDFILE ||
+      (mode_ == Mode::ADAPTIVE && count_ <= kMaxResidencyCheck &&
+       isResident(fd_, offset_, count_));
+    if (!socket || socket->getFd() < 0 || isEncrypted(socket.get())) {
+      return readAndWrite(std::move(transport), sendfile);
+    }
     auto cb = new WriteCallback();
     auto f = cb->promise_.getFuture();
-    auto req = new FileWriteRequest(socket.get(), cb, fd_, offset_, count_);
+    AsyncSocket::WriteRequest* req;
+    if (sendfile) {
+      req = new SendfileWriteRequest(socket.get(), cb, fd_, offset_, count_);
+    } else {
+      req = new FileWriteRequest(socket.get(), cb, fd_, offset_, count_);
+    }
     socket->writeRequest(req);
     return f;
   }
 
+  // Whether all of the given bytes of the file are in the page cache
+  static bool isResident(int fd, off_t offset, size_t count);
+
+  // SPLICE transfers take their pipes from a pool in each
+  // FileRegionReadPool thread, creating them only when it's empty
+  struct PipePoolStats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+  };
+
+  static PipePoolStats getPipePoolStats();
+
  private:
   class WriteCallback : private AsyncSocket::WriteCallback {
     void writeSuccess() noexcept override {
@@ -56,12 +102,59 @@ class FileRegion {
     }
 
     friend class FileRegion;
+    friend class FileRegionChain;
     folly::Promise<Unit> promise_;
   };
 
+  friend class FileRegionChain;
+
+  static bool isEncrypted(AsyncSocket* socket);
+
+  // With io_uring (WANGLE_HAVE_LIBURING), each FileRegionReadPool thread
+  // keeps a ring, on which the splices of all its transfers are in flight
+  // at once rather than each waiting its turn for the thread
+  class SpliceRing;
+
+  // The ring of the read thread running evb, or nullptr without io_uring
+  static SpliceRing* getSpliceRing(EventBase* evb);
+
+  // The transfer through the transport's own writes
+  Future<Unit> readAndWrite(std::shared_ptr<AsyncTransport> transport,
+                            bool readInline);
+
   const int fd_;
   const off_t offset_;
   const size_t count_;
+  const Mode mode_;
+
+  // Sends the file with sendfile() whenever the socket is writable, all in
+  // the socket's EventBase
+  class SendfileWriteRequest : public AsyncSocket::WriteRequest {
+   public:
+    SendfileWriteRequest(AsyncSocket* socket, WriteCallback* callback,
+                         int fd, off_t offset, size_t count)
+      : WriteRequest(socket, callback),
+        fd_(fd), offset_(offset), count_(count) {}
+
+    void destroy() override {
+      delete this;
+    }
+
+    bool performWrite() override;
+
+    void consume() override {
+      // do nothing
+    }
+
+    bool isComplete() override {
+      return totalBytesWritten_ == count_;
+    }
+
+   private:
+    const int fd_;
+    off_t offset_;
+    const size_t count_;
+  };
 
   class FileWriteRequest : public AsyncSocket::WriteRequest,
                            public NotificationQueue<size_t>::Consumer {
@@ -81,6 +174,9 @@ class FileRegion {
 
     void start() override;
 
+    // A splice queued on the read thread's SpliceRing is done
+    void spliceDone(int result);
+
     class FileReadHandler : public folly::EventHandler {
      public:
       FileReadHandler(FileWriteRequest* req, int pipe_in, size_t bytesToRead);
@@ -100,17 +196,106 @@ class FileRegion {
 
     void fail(const char* fn, const AsyncSocketException& ex);
 
+    // Queues the splice of the next part of the file on the ring
+    void submitSplice();
+
     const int readFd_;
     off_t offset_;
     const size_t count_;
     bool started_{false};
     int pipe_out_{-1};
+    int pipe_in_{-1};
 
     size_t bytesInPipe_{0};
     folly::EventBase* readBase_;
     folly::NotificationQueue<size_t> queue_;
     std::unique_ptr<FileReadHandler> readHandler_;
+
+    // With a SpliceRing instead of readHandler_
+    SpliceRing* ring_{nullptr};
+    size_t bytesToSplice_{0};
+    bool splicing_{false};
+    // Deleted once the splice in flight is done
+    bool destroyed_{false};
+  };
+};
+
+/**
+ * Regions of any number of files, interleaved with IOBufs, such as the
+ * parts of a multipart or ranged response, sent in order with a single
+ * future for all of them.  To a plain AsyncSocket it's one WriteRequest,
+ * which sends the buffers with sendmsg() and the regions with sendfile()
+ * in the socket's EventBase whenever the socket is writable, without any
+ * other thread; as with FileRegion::Mode::SENDFILE, the EventBase blocks
+ * on whatever file data isn't in the page cache.  Through other
+ * transports, each piece is written once the one before it is, the
+ * regions as by FileRegion.
+ */
+class FileRegionChain {
+ public:
+  FileRegionChain& append(std::unique_ptr<IOBuf> buf);
+  FileRegionChain& append(int fd, off_t offset, size_t count);
+
+  bool empty() const {
+    return length_ == 0;
+  }
+
+  // Over all the pieces
+  size_t length() const {
+    return length_;
+  }
+
+  // Sends all of the chain, leaving it empty
+  Future<Unit> transferTo(std::shared_ptr<AsyncTransport> transport);
+
+ private:
+  // A buffer, or a file region if fd isn't -1
+  struct Segment {
+    explicit Segment(std::unique_ptr<IOBuf> b) {
+      buf.append(std::move(b));
+    }
+
+    Segment(int f, off_t o, size_t c) : fd(f), offset(o), count(c) {}
+
+    IOBufQueue buf;
+    int fd{-1};
+    off_t offset{0};
+    size_t count{0};
+  };
+
+  class ChainWriteRequest : public AsyncSocket::WriteRequest {
+   public:
+    ChainWriteRequest(AsyncSocket* socket,
+                      FileRegion::WriteCallback* callback,
+                      std::vector<Segment> segments,
+                      size_t length)
+      : WriteRequest(socket, callback),
+        segments_(std::move(segments)),
+        length_(length) {}
+
+    void destroy() override {
+      delete this;
+    }
+
+    bool performWrite() override;
+
+    void consume() override {
+      // do nothing
+    }
+
+    bool isComplete() override {
+      return totalBytesWritten_ == length_;
+    }
+
+   private:
+    std::vector<Segment> segments_;
+    // The segment being sent
+    size_t index_{0};
+    const size_t length_;
   };
+
+  std::vector<Segment> segments_;
+  size_t length_{0};
 };
 
 }} // folly::wangle
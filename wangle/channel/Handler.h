@@ -52,6 +52,13 @@ class Handler : public HandlerBase<HandlerContext<Rout, Wout>> {
   virtual ~Handler() = default;
 
   virtual void read(Context* ctx, Rin msg) = 0;
+  // Invoked with all messages decoded from a single read when the previous
+  // handler fires them as a batch.  Defaults to one read() per message.
+  virtual void readBatch(Context* ctx, ReadBatch<Rin> msgs) {
+    for (auto& msg : msgs) {
+      read(ctx, std::forward<Rin>(msg));
+    }
+  }
   virtual void readEOF(Context* ctx) {
     ctx->fireReadEOF();
   }
@@ -64,6 +71,11 @@ class Handler : public HandlerBase<HandlerContext<Rout, Wout>> {
   virtual void transportInactive(Context* ctx) {
     ctx->fireTransportInactive();
   }
+  // The pipeline's isWritable() state flipped, see
+  // PipelineBase::setWriteBufferWaterMarks()
+  virtual void writabilityChanged(Context* ctx) {
+    ctx->fireWritabilityChanged();
+  }
 
   virtual Future<Unit> write(Context* ctx, Win msg) = 0;
   virtual Future<Unit> close(Context* ctx) {
@@ -80,7 +92,6 @@ class Handler : public HandlerBase<HandlerContext<Rout, Wout>> {
   virtual void channelUnregistered(HandlerContext* ctx) {}
   virtual void channelReadComplete(HandlerContext* ctx) {}
   virtual void userEventTriggered(HandlerContext* ctx, void* evt) {}
-  virtual void channelWritabilityChanged(HandlerContext* ctx) {}
 
   // outbound
   virtual Future<Unit> bind(
@@ -109,6 +120,13 @@ class InboundHandler : public HandlerBase<InboundHandlerContext<Rout>> {
   virtual ~InboundHandler() = default;
 
   virtual void read(Context* ctx, Rin msg) = 0;
+  // Invoked with all messages decoded from a single read when the previous
+  // handler fires them as a batch.  Defaults to one read() per message.
+  virtual void readBatch(Context* ctx, ReadBatch<Rin> msgs) {
+    for (auto& msg : msgs) {
+      read(ctx, std::forward<Rin>(msg));
+    }
+  }
   virtual void readEOF(Context* ctx) {
     ctx->fireReadEOF();
   }
@@ -121,6 +139,11 @@ class InboundHandler : public HandlerBase<InboundHandlerContext<Rout>> {
   virtual void transportInactive(Context* ctx) {
     ctx->fireTransportInactive();
   }
+  // The pipeline's isWritable() state flipped, see
+  // PipelineBase::setWriteBufferWaterMarks()
+  virtual void writabilityChanged(Context* ctx) {
+    ctx->fireWritabilityChanged();
+  }
 };
 
 template <class Win, class Wout = Win>
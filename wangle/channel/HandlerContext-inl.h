@@ -12,6 +12,23 @@
 
 namespace folly { namespace wangle {
 
+template <class In>
+class InboundLink;
+
+template <class Out>
+class OutboundLink;
+
+namespace detail {
+
+// A distinct address for each type, to match links without RTTI
+template <class T>
+inline const void* linkTypeTag() {
+  static const char tag = 0;
+  return &tag;
+}
+
+} // detail
+
 class PipelineContext {
  public:
   virtual ~PipelineContext() = default;
@@ -31,7 +48,30 @@ class PipelineContext {
   virtual void setNextIn(PipelineContext* ctx) = 0;
   virtual void setNextOut(PipelineContext* ctx) = 0;
 
+  // This context as the link for messages of type T, or nullptr if it takes
+  // none of those
+  template <class T>
+  InboundLink<T>* getInboundLink() {
+    return static_cast<InboundLink<T>*>(
+        findInboundLink(detail::linkTypeTag<T>()));
+  }
+
+  template <class T>
+  OutboundLink<T>* getOutboundLink() {
+    return static_cast<OutboundLink<T>*>(
+        findOutboundLink(detail::linkTypeTag<T>()));
+  }
+
+  // Behind the templates above, for the linkTypeTag of the message type
+  virtual void* findInboundLink(const void* typeTag) = 0;
+  virtual void* findOutboundLink(const void* typeTag) = 0;
+
   virtual HandlerDir getDirection() = 0;
+
+  // Starts or stops timing the handler's reads and writes
+  virtual void setProfiling(bool profiling) = 0;
+  // nullptr unless profiling
+  virtual const HandlerProfile* getProfile() = 0;
 };
 
 template <class In>
@@ -39,10 +79,12 @@ class InboundLink {
  public:
   virtual ~InboundLink() = default;
   virtual void read(In msg) = 0;
+  virtual void readBatch(ReadBatch<In> msgs) = 0;
   virtual void readEOF() = 0;
   virtual void readException(exception_wrapper e) = 0;
   virtual void transportActive() = 0;
   virtual void transportInactive() = 0;
+  virtual void writabilityChanged() = 0;
 };
 
 template <class Out>
@@ -86,7 +128,7 @@ class ContextImplBase : public PipelineContext {
       nextIn_ = nullptr;
       return;
     }
-    auto nextIn = dynamic_cast<InboundLink<typename H::rout>*>(ctx);
+    auto nextIn = ctx->getInboundLink<typename H::rout>();
     if (nextIn) {
       nextIn_ = nextIn;
     } else {
@@ -99,7 +141,7 @@ class ContextImplBase : public PipelineContext {
       nextOut_ = nullptr;
       return;
     }
-    auto nextOut = dynamic_cast<OutboundLink<typename H::wout>*>(ctx);
+    auto nextOut = ctx->getOutboundLink<typename H::wout>();
     if (nextOut) {
       nextOut_ = nextOut;
     } else {
@@ -111,12 +153,25 @@ class ContextImplBase : public PipelineContext {
     return H::dir;
   }
 
+  void setProfiling(bool profiling) override {
+    if (!profiling) {
+      profile_.reset();
+    } else if (!profile_) {
+      profile_.reset(new HandlerProfile(demangle(typeid(H)).toStdString()));
+    }
+  }
+
+  const HandlerProfile* getProfile() override {
+    return profile_.get();
+  }
+
  protected:
   Context* impl_;
   PipelineBase* pipeline_;
   std::shared_ptr<H> handler_;
   InboundLink<typename H::rout>* nextIn_{nullptr};
   OutboundLink<typename H::wout>* nextOut_{nullptr};
+  std::unique_ptr<HandlerProfile> profile_;
 
  private:
   bool attached_{false};
@@ -160,6 +215,15 @@ class ContextImpl
     }
   }
 
+  void fireReadBatch(ReadBatch<Rout> msgs) override {
+    DestructorGuard dg(this->pipeline_);
+    if (this->nextIn_) {
+      this->nextIn_->readBatch(std::move(msgs));
+    } else {
+      LOG(WARNING) << "readBatch reached end of pipeline";
+    }
+  }
+
   void fireReadEOF() override {
     DestructorGuard dg(this->pipeline_);
     if (this->nextIn_) {
@@ -192,6 +256,13 @@ class ContextImpl
     }
   }
 
+  void fireWritabilityChanged() override {
+    DestructorGuard dg(this->pipeline_);
+    if (this->nextIn_) {
+      this->nextIn_->writabilityChanged();
+    }
+  }
+
   Future<Unit> fireWrite(Wout msg) override {
     DestructorGuard dg(this->pipeline_);
     if (this->nextOut_) {
@@ -234,12 +305,37 @@ class ContextImpl
     return this->pipeline_->getReadBufferSettings();
   }
 
+  // PipelineContext overrides
+  void* findInboundLink(const void* typeTag) override {
+    if (typeTag != detail::linkTypeTag<Rin>()) {
+      return nullptr;
+    }
+    return static_cast<InboundLink<Rin>*>(this);
+  }
+
+  void* findOutboundLink(const void* typeTag) override {
+    if (typeTag != detail::linkTypeTag<Win>()) {
+      return nullptr;
+    }
+    return static_cast<OutboundLink<Win>*>(this);
+  }
+
   // InboundLink overrides
   void read(Rin msg) override {
     DestructorGuard dg(this->pipeline_);
+    if (UNLIKELY(this->profile_ != nullptr)) {
+      ProfiledHop hop(this->profile_.get(), HandlerProfile::Op::READ);
+      this->handler_->read(this, std::forward<Rin>(msg));
+      return;
+    }
     this->handler_->read(this, std::forward<Rin>(msg));
   }
 
+  void readBatch(ReadBatch<Rin> msgs) override {
+    DestructorGuard dg(this->pipeline_);
+    this->handler_->readBatch(this, std::move(msgs));
+  }
+
   void readEOF() override {
     DestructorGuard dg(this->pipeline_);
     this->handler_->readEOF(this);
@@ -260,9 +356,18 @@ class ContextImpl
     this->handler_->transportInactive(this);
   }
 
+  void writabilityChanged() override {
+    DestructorGuard dg(this->pipeline_);
+    this->handler_->writabilityChanged(this);
+  }
+
   // OutboundLink overrides
   Future<Unit> write(Win msg) override {
     DestructorGuard dg(this->pipeline_);
+    if (UNLIKELY(this->profile_ != nullptr)) {
+      ProfiledHop hop(this->profile_.get(), HandlerProfile::Op::WRITE);
+      return this->handler_->write(this, std::forward<Win>(msg));
+    }
     return this->handler_->write(this, std::forward<Win>(msg));
   }
 
@@ -311,6 +416,15 @@ class InboundContextImpl
     }
   }
 
+  void fireReadBatch(ReadBatch<Rout> msgs) override {
+    DestructorGuard dg(this->pipeline_);
+    if (this->nextIn_) {
+      this->nextIn_->readBatch(std::move(msgs));
+    } else {
+      LOG(WARNING) << "readBatch reached end of pipeline";
+    }
+  }
+
   void fireReadEOF() override {
     DestructorGuard dg(this->pipeline_);
     if (this->nextIn_) {
@@ -343,16 +457,45 @@ class InboundContextImpl
     }
   }
 
+  void fireWritabilityChanged() override {
+    DestructorGuard dg(this->pipeline_);
+    if (this->nextIn_) {
+      this->nextIn_->writabilityChanged();
+    }
+  }
+
   PipelineBase* getPipeline() override {
     return this->pipeline_;
   }
 
+  // PipelineContext overrides
+  void* findInboundLink(const void* typeTag) override {
+    if (typeTag != detail::linkTypeTag<Rin>()) {
+      return nullptr;
+    }
+    return static_cast<InboundLink<Rin>*>(this);
+  }
+
+  void* findOutboundLink(const void* typeTag) override {
+    return nullptr;
+  }
+
   // InboundLink overrides
   void read(Rin msg) override {
     DestructorGuard dg(this->pipeline_);
+    if (UNLIKELY(this->profile_ != nullptr)) {
+      ProfiledHop hop(this->profile_.get(), HandlerProfile::Op::READ);
+      this->handler_->read(this, std::forward<Rin>(msg));
+      return;
+    }
     this->handler_->read(this, std::forward<Rin>(msg));
   }
 
+  void readBatch(ReadBatch<Rin> msgs) override {
+    DestructorGuard dg(this->pipeline_);
+    this->handler_->readBatch(this, std::move(msgs));
+  }
+
   void readEOF() override {
     DestructorGuard dg(this->pipeline_);
     this->handler_->readEOF(this);
@@ -373,6 +516,11 @@ class InboundContextImpl
     this->handler_->transportInactive(this);
   }
 
+  void writabilityChanged() override {
+    DestructorGuard dg(this->pipeline_);
+    this->handler_->writabilityChanged(this);
+  }
+
  private:
   using DestructorGuard = typename DelayedDestruction::DestructorGuard;
 };
@@ -428,9 +576,25 @@ class OutboundContextImpl
     return this->pipeline_;
   }
 
+  // PipelineContext overrides
+  void* findInboundLink(const void* typeTag) override {
+    return nullptr;
+  }
+
+  void* findOutboundLink(const void* typeTag) override {
+    if (typeTag != detail::linkTypeTag<Win>()) {
+      return nullptr;
+    }
+    return static_cast<OutboundLink<Win>*>(this);
+  }
+
   // OutboundLink overrides
   Future<Unit> write(Win msg) override {
     DestructorGuard dg(this->pipeline_);
+    if (UNLIKELY(this->profile_ != nullptr)) {
+      ProfiledHop hop(this->profile_.get(), HandlerProfile::Op::WRITE);
+      return this->handler_->write(this, std::forward<Win>(msg));
+    }
     return this->handler_->write(this, std::forward<Win>(msg));
   }
 
@@ -13,21 +13,35 @@
 #include <folly/io/async/AsyncTransport.h>
 #include <folly/futures/Future.h>
 #include <folly/ExceptionWrapper.h>
+#include <folly/Likely.h>
+#include <folly/String.h>
+#include <wangle/channel/HandlerProfile.h>
+
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
 
 namespace folly { namespace wangle {
 
 class PipelineBase;
 
+// Container in which a batch of inbound messages of type T is delivered
+template <class T>
+using ReadBatch = std::vector<typename std::decay<T>::type>;
+
 template <class In, class Out>
 class HandlerContext {
  public:
   virtual ~HandlerContext() = default;
 
   virtual void fireRead(In msg) = 0;
+  virtual void fireReadBatch(ReadBatch<In> msgs) = 0;
   virtual void fireReadEOF() = 0;
   virtual void fireReadException(exception_wrapper e) = 0;
   virtual void fireTransportActive() = 0;
   virtual void fireTransportInactive() = 0;
+  virtual void fireWritabilityChanged() = 0;
 
   virtual Future<Unit> fireWrite(Out msg) = 0;
   virtual Future<Unit> fireClose() = 0;
@@ -36,6 +50,9 @@ class HandlerContext {
   std::shared_ptr<AsyncTransport> getTransport() {
     return getPipeline()->getTransport();
   }
+  bool isWritable() {
+    return getPipeline()->isWritable();
+  }
 
   virtual void setWriteFlags(WriteFlags flags) = 0;
   virtual WriteFlags getWriteFlags() = 0;
@@ -62,15 +79,20 @@ class InboundHandlerContext {
   virtual ~InboundHandlerContext() = default;
 
   virtual void fireRead(In msg) = 0;
+  virtual void fireReadBatch(ReadBatch<In> msgs) = 0;
   virtual void fireReadEOF() = 0;
   virtual void fireReadException(exception_wrapper e) = 0;
   virtual void fireTransportActive() = 0;
   virtual void fireTransportInactive() = 0;
+  virtual void fireWritabilityChanged() = 0;
 
   virtual PipelineBase* getPipeline() = 0;
   std::shared_ptr<AsyncTransport> getTransport() {
     return getPipeline()->getTransport();
   }
+  bool isWritable() {
+    return getPipeline()->isWritable();
+  }
 
   // TODO Need get/set writeFlags, readBufferSettings? Probably not.
   // Do we even really need them stored in the pipeline at all?
@@ -89,6 +111,9 @@ class OutboundHandlerContext {
   std::shared_ptr<AsyncTransport> getTransport() {
     return getPipeline()->getTransport();
   }
+  bool isWritable() {
+    return getPipeline()->isWritable();
+  }
 };
 
 // #include <windows.h> has blessed us with #define IN & OUT, typically mapped
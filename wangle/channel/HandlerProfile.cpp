@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/HandlerProfile.h>
+
+#include <folly/ThreadLocal.h>
+
+#include <atomic>
+#include <unordered_map>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+std::atomic<uint64_t> nextThreadId{1};
+
+struct ThreadProfile {
+  // Unlike the address, never reused by a later thread
+  const uint64_t id{nextThreadId.fetch_add(1, std::memory_order_relaxed)};
+  uint64_t downstreamTicks{0};
+  // Nodes don't move, so profiles keep pointers to their stats
+  std::unordered_map<std::string, HandlerStats> stats;
+};
+
+ThreadLocal<ThreadProfile> threadProfile;
+
+} // namespace
+
+HandlerProfile::HandlerProfile(std::string name)
+    : name_(std::move(name)) {}
+
+void HandlerProfile::record(Op op, uint64_t ticks) {
+  auto& thread = *threadProfile;
+  if (threadId_ != thread.id) {
+    threadStats_ = &thread.stats[name_];
+    threadId_ = thread.id;
+  }
+  if (op == Op::READ) {
+    stats_.reads++;
+    stats_.readTicks += ticks;
+    threadStats_->reads++;
+    threadStats_->readTicks += ticks;
+  } else {
+    stats_.writes++;
+    stats_.writeTicks += ticks;
+    threadStats_->writes++;
+    threadStats_->writeTicks += ticks;
+  }
+}
+
+std::map<std::string, HandlerStats> HandlerProfile::getThreadStats() {
+  return std::map<std::string, HandlerStats>(
+      threadProfile->stats.begin(), threadProfile->stats.end());
+}
+
+void HandlerProfile::resetThreadStats() {
+  for (auto& stats : threadProfile->stats) {
+    stats.second = HandlerStats();
+  }
+}
+
+uint64_t& HandlerProfile::downstreamTicks() {
+  return threadProfile->downstreamTicks;
+}
+
+}} // namespace folly::wangle
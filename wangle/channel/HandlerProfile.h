@@ -0,0 +1,119 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace folly { namespace wangle {
+
+/**
+ * Time a handler spent in read() and write(), in ticks of the timestamp
+ * counter (TSC) where there is one.  The time of the handlers further up
+ * or down the pipeline that a call fired into isn't counted.
+ */
+struct HandlerStats {
+  uint64_t reads{0};
+  uint64_t readTicks{0};
+  uint64_t writes{0};
+  uint64_t writeTicks{0};
+
+  void add(const HandlerStats& other) {
+    reads += other.reads;
+    readTicks += other.readTicks;
+    writes += other.writes;
+    writeTicks += other.writeTicks;
+  }
+};
+
+/**
+ * The stats of one handler in a profiled pipeline (see
+ * PipelineBase::setProfiling()).  Everything recorded is also added to the
+ * stats of the handler's type for the thread the call ran on, so an IO
+ * thread can report where its pipelines spend their time, wherever they
+ * were set up and whichever threads they moved between.
+ */
+class HandlerProfile {
+ public:
+  enum class Op {
+    READ,
+    WRITE,
+  };
+
+  explicit HandlerProfile(std::string name);
+
+  const std::string& getName() const {
+    return name_;
+  }
+
+  const HandlerStats& getStats() const {
+    return stats_;
+  }
+
+  void record(Op op, uint64_t ticks);
+
+  // The calling thread's stats, by handler type
+  static std::map<std::string, HandlerStats> getThreadStats();
+  static void resetThreadStats();
+
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+  }
+
+  // Ticks the hops fired from the one running took, for the thread's hop
+  // in progress
+  static uint64_t& downstreamTicks();
+
+ private:
+  std::string name_;
+  HandlerStats stats_;
+  // The stats of the thread the last call ran on, and that thread's id,
+  // looked up again when a call runs on another thread
+  HandlerStats* threadStats_{nullptr};
+  uint64_t threadId_{0};
+};
+
+/**
+ * Times a profiled handler's read or write for as long as it's in scope,
+ * less the time spent in the hops it fires.
+ */
+class ProfiledHop {
+ public:
+  ProfiledHop(HandlerProfile* profile, HandlerProfile::Op op)
+      : profile_(profile),
+        op_(op),
+        downstream_(HandlerProfile::downstreamTicks()),
+        saved_(downstream_) {
+    downstream_ = 0;
+    start_ = HandlerProfile::now();
+  }
+
+  ~ProfiledHop() {
+    auto elapsed = HandlerProfile::now() - start_;
+    profile_->record(op_, elapsed - downstream_);
+    downstream_ = saved_ + elapsed;
+  }
+
+ private:
+  HandlerProfile* profile_;
+  HandlerProfile::Op op_;
+  uint64_t& downstream_;
+  uint64_t saved_;
+  uint64_t start_;
+};
+
+}} // namespace folly::wangle
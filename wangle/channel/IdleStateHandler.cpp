@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/IdleStateHandler.h>
+
+#include <folly/ThreadLocal.h>
+
+#include <map>
+#include <memory>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+struct SharedTimer;
+typedef std::map<EventBase*, std::unique_ptr<SharedTimer>> SharedTimers;
+
+// Removes itself, and the timer, as its EventBase is destroyed
+struct SharedTimer : public EventBase::LoopCallback {
+  SharedTimer(SharedTimers* t, EventBase* e)
+      : timers(t), evb(e), timer(new HHWheelTimer(e)) {
+    evb->runOnDestruction(this);
+  }
+
+  ~SharedTimer() {
+    cancelLoopCallback();
+  }
+
+  void runLoopCallback() noexcept override {
+    // Destroys this
+    timers->erase(evb);
+  }
+
+  SharedTimers* timers;
+  EventBase* evb;
+  HHWheelTimer::UniquePtr timer;
+};
+
+ThreadLocal<SharedTimers> sharedTimers;
+
+}
+
+HHWheelTimer* getSharedWheelTimer(EventBase* evb) {
+  DCHECK(evb->isInEventBaseThread());
+  auto timers = sharedTimers.get();
+  auto it = timers->find(evb);
+  if (it == timers->end()) {
+    it = timers->emplace(
+      evb, std::unique_ptr<SharedTimer>(new SharedTimer(timers, evb))).first;
+  }
+  return it->second->timer.get();
+}
+
+}} // namespace folly::wangle
@@ -0,0 +1,227 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+
+#include <folly/io/async/EventBaseManager.h>
+#include <folly/io/async/HHWheelTimer.h>
+
+#include <chrono>
+#include <stdexcept>
+
+namespace folly { namespace wangle {
+
+/**
+ * The HHWheelTimer all the pipelines on evb share, created the first time
+ * it's asked for and destroyed with evb.  From evb's thread only.
+ */
+HHWheelTimer* getSharedWheelTimer(EventBase* evb);
+
+enum class IdleState {
+  // Nothing read for the reader idle time
+  READER_IDLE,
+  // Nothing written for the writer idle time
+  WRITER_IDLE,
+  // Neither
+  ALL_IDLE,
+};
+
+class IdleStateError : public std::runtime_error {
+ public:
+  explicit IdleStateError(IdleState state)
+      : std::runtime_error(state == IdleState::READER_IDLE ? "Reader idle" :
+                           state == IdleState::WRITER_IDLE ? "Writer idle" :
+                                                             "Idle"),
+        state_(state) {}
+
+  IdleState getState() const {
+    return state_;
+  }
+
+ private:
+  IdleState state_;
+};
+
+class ReadTimeoutError : public std::runtime_error {
+ public:
+  ReadTimeoutError() : std::runtime_error("Read timed out") {}
+};
+
+/**
+ * Calls onIdle() when nothing has been read, written, or either, for the
+ * given times, and again each time after that it stays so; 0 turns one
+ * off.  By default onIdle() fires an IdleStateError read exception, and
+ * subclasses can do otherwise, such as send a keepalive.  Goes anywhere
+ * in the pipeline, usually right after the transport handler, where it
+ * sees reads as they come and writes as they're made.
+ *
+ * The timeouts are on the shared wheel timer of the transport's EventBase,
+ * scheduled once each when the transport goes active: reads and writes
+ * only count themselves, and a timeout that finds there was activity
+ * since it was scheduled is scheduled again for the whole time.  So
+ * nothing is rescheduled, nor the clock read, for each message, and idleness
+ * is noticed between the idle time and twice it after the last activity.
+ */
+template <typename R = IOBufQueue&, typename W = std::unique_ptr<IOBuf>>
+class IdleStateHandler : public HandlerAdapter<R, W> {
+ public:
+  typedef typename HandlerAdapter<R, W>::Context Context;
+
+  explicit IdleStateHandler(
+      std::chrono::milliseconds readerIdleTime,
+      std::chrono::milliseconds writerIdleTime = std::chrono::milliseconds(0),
+      std::chrono::milliseconds allIdleTime = std::chrono::milliseconds(0))
+      : readerIdle_(this, IdleState::READER_IDLE, readerIdleTime),
+        writerIdle_(this, IdleState::WRITER_IDLE, writerIdleTime),
+        allIdle_(this, IdleState::ALL_IDLE, allIdleTime) {}
+
+  // Copied before it's added to a pipeline, and not after
+  IdleStateHandler(const IdleStateHandler& other)
+      : IdleStateHandler(other.readerIdle_.time, other.writerIdle_.time,
+                         other.allIdle_.time) {}
+
+  void read(Context* ctx, R msg) override {
+    reads_++;
+    ctx->fireRead(std::forward<R>(msg));
+  }
+
+  Future<Unit> write(Context* ctx, W msg) override {
+    writes_++;
+    return ctx->fireWrite(std::forward<W>(msg));
+  }
+
+  void transportActive(Context* ctx) override {
+    start(ctx);
+    ctx->fireTransportActive();
+  }
+
+  void transportInactive(Context* ctx) override {
+    stop();
+    ctx->fireTransportInactive();
+  }
+
+  void readEOF(Context* ctx) override {
+    stop();
+    ctx->fireReadEOF();
+  }
+
+  Future<Unit> close(Context* ctx) override {
+    stop();
+    return ctx->fireClose();
+  }
+
+  void detachPipeline(Context* ctx) override {
+    stop();
+  }
+
+ protected:
+  virtual void onIdle(Context* ctx, IdleState state) {
+    ctx->fireReadException(make_exception_wrapper<IdleStateError>(state));
+  }
+
+  // The timeouts, until the transport goes active again
+  void stop() {
+    readerIdle_.cancelTimeout();
+    writerIdle_.cancelTimeout();
+    allIdle_.cancelTimeout();
+    timer_ = nullptr;
+  }
+
+ private:
+  class Timeout : public HHWheelTimer::Callback {
+   public:
+    Timeout(IdleStateHandler* handler, IdleState s,
+            std::chrono::milliseconds t)
+        : time(t), state(s), handler_(handler) {}
+
+    void timeoutExpired() noexcept override {
+      handler_->expired(this);
+    }
+
+    const std::chrono::milliseconds time;
+    const IdleState state;
+    // reads_ + writes_ it last saw, by state
+    uint64_t seen{0};
+
+   private:
+    IdleStateHandler* handler_;
+  };
+
+  uint64_t activity(IdleState state) const {
+    switch (state) {
+      case IdleState::READER_IDLE:
+        return reads_;
+      case IdleState::WRITER_IDLE:
+        return writes_;
+      default:
+        return reads_ + writes_;
+    }
+  }
+
+  void start(Context* ctx) {
+    if (timer_) {
+      return;
+    }
+    auto transport = ctx->getTransport();
+    auto evb = transport && transport->getEventBase()
+      ? transport->getEventBase()
+      : EventBaseManager::get()->getEventBase();
+    timer_ = getSharedWheelTimer(evb);
+    for (auto timeout : {&readerIdle_, &writerIdle_, &allIdle_}) {
+      if (timeout->time.count() > 0) {
+        timeout->seen = activity(timeout->state);
+        timer_->scheduleTimeout(timeout, timeout->time);
+      }
+    }
+  }
+
+  void expired(Timeout* timeout) {
+    auto now = activity(timeout->state);
+    bool idle = now == timeout->seen;
+    timeout->seen = now;
+    // Ahead of onIdle(), which may close the pipeline and destroy this
+    timer_->scheduleTimeout(timeout, timeout->time);
+    if (idle) {
+      onIdle(this->getContext(), timeout->state);
+    }
+  }
+
+  Timeout readerIdle_;
+  Timeout writerIdle_;
+  Timeout allIdle_;
+  HHWheelTimer* timer_{nullptr};
+  uint64_t reads_{0};
+  uint64_t writes_{0};
+};
+
+/**
+ * Fires a ReadTimeoutError read exception, once, when nothing has been
+ * read for timeout; closing the pipeline is up to the handlers after it,
+ * as for any read exception.  As IdleStateHandler, it costs nothing for
+ * each read.
+ */
+template <typename R = IOBufQueue&, typename W = std::unique_ptr<IOBuf>>
+class ReadTimeoutHandler : public IdleStateHandler<R, W> {
+ public:
+  typedef typename IdleStateHandler<R, W>::Context Context;
+
+  explicit ReadTimeoutHandler(std::chrono::milliseconds timeout)
+      : IdleStateHandler<R, W>(timeout) {}
+
+ protected:
+  void onIdle(Context* ctx, IdleState state) override {
+    this->stop();
+    ctx->fireReadException(make_exception_wrapper<ReadTimeoutError>());
+  }
+};
+
+}} // namespace folly::wangle
@@ -0,0 +1,405 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/LoopbackSocket.h>
+
+#include <folly/io/Cursor.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <mutex>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+const int kMaxReadsPerEvent = 16;
+
+}
+
+// One direction of a connection, shared by its two ends
+struct LoopbackSocket::Pipe {
+  std::mutex lock;
+  IOBufQueue bufs{IOBufQueue::cacheChainLength()};
+  // Bytes ever taken by the reader
+  uint64_t taken{0};
+  // The writer is done
+  bool closed{false};
+  bool readerGone{false};
+
+  LoopbackSocket* reader{nullptr};
+  EventBase* readerEvb{nullptr};
+  bool readerWoken{false};
+
+  LoopbackSocket* writer{nullptr};
+  EventBase* writerEvb{nullptr};
+  // Has writes waiting for the reader to take bytes
+  bool writerWaiting{false};
+  bool writerWoken{false};
+};
+
+std::pair<LoopbackSocket::UniquePtr, LoopbackSocket::UniquePtr>
+LoopbackSocket::newPair(EventBase* evb1, EventBase* evb2, size_t window) {
+  auto a = std::make_shared<Pipe>();
+  auto b = std::make_shared<Pipe>();
+  UniquePtr first(new LoopbackSocket(b, a, window));
+  UniquePtr second(new LoopbackSocket(a, b, window));
+  if (evb1) {
+    first->attachEventBase(evb1);
+  }
+  if (evb2) {
+    second->attachEventBase(evb2);
+  }
+  return std::make_pair(std::move(first), std::move(second));
+}
+
+LoopbackSocket::LoopbackSocket(std::shared_ptr<Pipe> rx,
+                               std::shared_ptr<Pipe> tx,
+                               size_t window)
+  : rx_(std::move(rx)),
+    tx_(std::move(tx)),
+    window_(window) {
+  rx_->reader = this;
+  tx_->writer = this;
+}
+
+LoopbackSocket::~LoopbackSocket() {
+  closeNow();
+}
+
+// With the pipe's lock held
+void LoopbackSocket::wakeReader(const std::shared_ptr<Pipe>& pipe) {
+  if (!pipe->readerEvb || pipe->readerWoken) {
+    return;
+  }
+  pipe->readerWoken = true;
+  auto evb = pipe->readerEvb;
+  auto p = pipe;
+  evb->runInEventBaseThread([p, evb]() {
+    LoopbackSocket* reader;
+    {
+      std::lock_guard<std::mutex> g(p->lock);
+      // Moved to another EventBase since
+      if (p->readerEvb != evb) {
+        return;
+      }
+      p->readerWoken = false;
+      reader = p->reader;
+    }
+    if (reader) {
+      reader->handleRead();
+    }
+  });
+}
+
+// With the pipe's lock held
+void LoopbackSocket::wakeWriter(const std::shared_ptr<Pipe>& pipe) {
+  if (!pipe->writerWaiting || !pipe->writerEvb || pipe->writerWoken) {
+    return;
+  }
+  pipe->writerWoken = true;
+  auto evb = pipe->writerEvb;
+  auto p = pipe;
+  evb->runInEventBaseThread([p, evb]() {
+    LoopbackSocket* writer;
+    {
+      std::lock_guard<std::mutex> g(p->lock);
+      if (p->writerEvb != evb) {
+        return;
+      }
+      p->writerWoken = false;
+      writer = p->writer;
+    }
+    if (writer) {
+      writer->completeWrites();
+    }
+  });
+}
+
+void LoopbackSocket::setReadCB(ReadCallback* callback) {
+  if (callback && (closed_ || eof_)) {
+    callback->readErr(AsyncSocketException(
+      AsyncSocketException::NOT_OPEN,
+      "setReadCB() called with LoopbackSocket closed"));
+    return;
+  }
+  readCallback_ = callback;
+  bufferCallback_ = dynamic_cast<BufferReadCallback*>(callback);
+  if (callback && evb_) {
+    // Whatever came in while nobody was reading
+    std::lock_guard<std::mutex> g(rx_->lock);
+    wakeReader(rx_);
+  }
+}
+
+void LoopbackSocket::write(WriteCallback* callback, const void* buf,
+                           size_t bytes, WriteFlags flags) {
+  writeChain(callback, IOBuf::copyBuffer(buf, bytes), flags);
+}
+
+void LoopbackSocket::writev(WriteCallback* callback, const iovec* vec,
+                            size_t count, WriteFlags flags) {
+  IOBufQueue queue;
+  for (size_t i = 0; i < count; i++) {
+    queue.append(IOBuf::copyBuffer(vec[i].iov_base, vec[i].iov_len));
+  }
+  writeChain(callback, queue.move(), flags);
+}
+
+void LoopbackSocket::writeChain(WriteCallback* callback,
+                                std::unique_ptr<folly::IOBuf>&& buf,
+                                WriteFlags /*flags*/) {
+  if (!good()) {
+    if (callback) {
+      callback->writeErr(0, AsyncSocketException(
+        AsyncSocketException::NOT_OPEN,
+        "LoopbackSocket not open for writing"));
+    }
+    return;
+  }
+  DestructorGuard dg(this);
+  auto len = buf ? buf->computeChainDataLength() : 0;
+  if (len > 0) {
+    std::lock_guard<std::mutex> g(tx_->lock);
+    tx_->bufs.append(std::move(buf));
+    wakeReader(tx_);
+  }
+  bytesWritten_ += len;
+  writeRequests_.push_back({callback, bytesWritten_});
+  completeWrites();
+}
+
+// What's written is the peer's already, so neither of these waits for
+// the writes still in the window
+void LoopbackSocket::close() {
+  DestructorGuard dg(this);
+  closeTx();
+  closeNow();
+}
+
+void LoopbackSocket::closeNow() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  DestructorGuard dg(this);
+  failWrites(AsyncSocketException(
+    AsyncSocketException::NOT_OPEN, "LoopbackSocket closed locally"));
+  closeTx();
+  {
+    std::lock_guard<std::mutex> g(rx_->lock);
+    rx_->readerGone = true;
+    rx_->bufs.move();
+    rx_->reader = nullptr;
+    rx_->readerEvb = nullptr;
+    // Its writes fail rather than wait for us
+    wakeWriter(rx_);
+  }
+  received_.move();
+  if (readCallback_) {
+    auto callback = readCallback_;
+    readCallback_ = nullptr;
+    bufferCallback_ = nullptr;
+    callback->readEOF();
+  }
+}
+
+void LoopbackSocket::shutdownWrite() {
+  closeTx();
+}
+
+void LoopbackSocket::shutdownWriteNow() {
+  DestructorGuard dg(this);
+  failWrites(AsyncSocketException(
+    AsyncSocketException::NOT_OPEN, "LoopbackSocket shut down for writing"));
+  closeTx();
+}
+
+bool LoopbackSocket::good() const {
+  if (closed_ || writeShutdown_ || eof_ || !evb_) {
+    return false;
+  }
+  std::lock_guard<std::mutex> g(tx_->lock);
+  return !tx_->readerGone;
+}
+
+bool LoopbackSocket::readable() const {
+  if (closed_) {
+    return false;
+  }
+  if (!received_.empty()) {
+    return true;
+  }
+  std::lock_guard<std::mutex> g(rx_->lock);
+  return !rx_->bufs.empty() || rx_->closed;
+}
+
+void LoopbackSocket::attachEventBase(EventBase* evb) {
+  DCHECK(!evb_);
+  evb_ = evb;
+  if (closed_) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> g(rx_->lock);
+    rx_->readerEvb = evb;
+    rx_->readerWoken = false;
+    // In case data came in while nobody was listening
+    wakeReader(rx_);
+  }
+  std::lock_guard<std::mutex> g(tx_->lock);
+  if (!writeShutdown_) {
+    tx_->writerEvb = evb;
+    tx_->writerWoken = false;
+    wakeWriter(tx_);
+  }
+}
+
+void LoopbackSocket::detachEventBase() {
+  if (!evb_) {
+    return;
+  }
+  if (!closed_) {
+    {
+      std::lock_guard<std::mutex> g(rx_->lock);
+      rx_->readerEvb = nullptr;
+    }
+    std::lock_guard<std::mutex> g(tx_->lock);
+    tx_->writerEvb = nullptr;
+  }
+  evb_ = nullptr;
+}
+
+void LoopbackSocket::handleRead() {
+  if (closed_) {
+    return;
+  }
+  DestructorGuard dg(this);
+  for (int i = 0; readCallback_ && i < kMaxReadsPerEvent; i++) {
+    if (received_.empty()) {
+      bool done;
+      {
+        std::lock_guard<std::mutex> g(rx_->lock);
+        done = rx_->closed;
+        if (!rx_->bufs.empty()) {
+          rx_->taken += rx_->bufs.chainLength();
+          received_.append(rx_->bufs.move());
+          wakeWriter(rx_);
+        }
+      }
+      if (received_.empty()) {
+        if (done) {
+          eof_ = true;
+          auto callback = readCallback_;
+          readCallback_ = nullptr;
+          bufferCallback_ = nullptr;
+          callback->readEOF();
+        }
+        return;
+      }
+    }
+    if (bufferCallback_) {
+      bufferCallback_->readBufferAvailable(received_.move());
+    } else {
+      void* buf = nullptr;
+      size_t len = 0;
+      readCallback_->getReadBuffer(&buf, &len);
+      if (!buf || len == 0) {
+        auto callback = readCallback_;
+        readCallback_ = nullptr;
+        callback->readErr(AsyncSocketException(
+          AsyncSocketException::BAD_ARGS,
+          "ReadCallback::getReadBuffer() returned empty buffer"));
+        return;
+      }
+      auto n = std::min(len, received_.chainLength());
+      io::Cursor(received_.front()).pull(buf, n);
+      received_.trimStart(n);
+      readCallback_->readDataAvailable(n);
+    }
+    if (closed_) {
+      return;
+    }
+  }
+  if (readCallback_) {
+    // Back for the rest in the next loop, after the other sockets
+    std::lock_guard<std::mutex> g(rx_->lock);
+    wakeReader(rx_);
+  }
+}
+
+void LoopbackSocket::completeWrites() {
+  uint64_t taken = 0;
+  bool readerGone;
+  {
+    std::lock_guard<std::mutex> g(tx_->lock);
+    readerGone = tx_->readerGone;
+    if (readerGone) {
+      tx_->writerWaiting = false;
+    } else {
+      taken = tx_->taken;
+      // Under the lock, so the reader sees it when it next takes bytes
+      tx_->writerWaiting = !writeRequests_.empty() &&
+        writeRequests_.back().end > taken + window_;
+    }
+  }
+  if (readerGone) {
+    failWrites(AsyncSocketException(
+      AsyncSocketException::END_OF_FILE, "LoopbackSocket peer closed"));
+    return;
+  }
+  DestructorGuard dg(this);
+  while (!writeRequests_.empty() &&
+         writeRequests_.front().end <= taken + window_) {
+    auto callback = writeRequests_.front().callback;
+    writeRequests_.pop_front();
+    if (callback) {
+      callback->writeSuccess();
+    }
+    if (closed_) {
+      return;
+    }
+  }
+}
+
+void LoopbackSocket::failWrites(const AsyncSocketException& ex) {
+  auto requests = std::move(writeRequests_);
+  writeRequests_.clear();
+  for (auto& request : requests) {
+    if (request.callback) {
+      request.callback->writeErr(0, ex);
+    }
+  }
+}
+
+void LoopbackSocket::closeTx() {
+  if (writeShutdown_) {
+    return;
+  }
+  writeShutdown_ = true;
+  // Those waiting for the window go through
+  auto requests = std::move(writeRequests_);
+  writeRequests_.clear();
+  {
+    std::lock_guard<std::mutex> g(tx_->lock);
+    tx_->closed = true;
+    tx_->writer = nullptr;
+    tx_->writerEvb = nullptr;
+    tx_->writerWaiting = false;
+    wakeReader(tx_);
+  }
+  for (auto& request : requests) {
+    if (request.callback) {
+      request.callback->writeSuccess();
+    }
+  }
+}
+
+}} // namespace folly::wangle
@@ -0,0 +1,156 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/SocketAddress.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncSocket.h>
+
+#include <deque>
+#include <memory>
+#include <utility>
+
+namespace folly { namespace wangle {
+
+/**
+ * One end of a connection within the process: what's written is handed
+ * to the other end as is, without a copy or a system call, and the other
+ * end may be in another EventBase.  For benchmarking pipelines without
+ * the kernel in the way, and for components that run in one process.
+ *
+ * A write completes once no more than the window of bytes written is
+ * still to be read by the peer, as with a socket buffer, so a slow reader
+ * holds back a fast writer.  Readers that are BufferReadCallbacks, like
+ * AsyncSocketHandler, get the written IOBufs; others get a copy through
+ * getReadBuffer().  It passes for an AsyncSocket, but has no fd.
+ */
+class LoopbackSocket : public AsyncSocket {
+  struct Pipe;
+
+ public:
+  typedef std::unique_ptr<LoopbackSocket, Destructor> UniquePtr;
+
+  static const size_t kDefaultWindow = 256 * 1024;
+
+  // A ReadCallback that takes what's read as IOBufs
+  class BufferReadCallback {
+   public:
+    virtual ~BufferReadCallback() = default;
+
+    virtual void readBufferAvailable(std::unique_ptr<IOBuf> buf)
+      noexcept = 0;
+  };
+
+  /**
+   * Both ends of a connection, attached to the given EventBases; either
+   * may be null, to attach later, e.g. in the thread that takes it.
+   */
+  static std::pair<UniquePtr, UniquePtr> newPair(
+      EventBase* evb1,
+      EventBase* evb2,
+      size_t window = kDefaultWindow);
+
+  ~LoopbackSocket();
+
+  // AsyncTransportWrapper implementation
+  void setReadCB(ReadCallback* callback) override;
+  ReadCallback* getReadCallback() const override {
+    return readCallback_;
+  }
+  void write(WriteCallback* callback, const void* buf, size_t bytes,
+             WriteFlags flags = WriteFlags::NONE) override;
+  void writev(WriteCallback* callback, const iovec* vec, size_t count,
+              WriteFlags flags = WriteFlags::NONE) override;
+  void writeChain(WriteCallback* callback,
+                  std::unique_ptr<folly::IOBuf>&& buf,
+                  WriteFlags flags = WriteFlags::NONE) override;
+
+  void close() override;
+  void closeNow() override;
+  void closeWithReset() override {
+    closeNow();
+  }
+  void shutdownWrite() override;
+  void shutdownWriteNow() override;
+
+  bool good() const override;
+  bool readable() const override;
+  bool connecting() const override {
+    return false;
+  }
+  bool error() const override {
+    return false;
+  }
+
+  EventBase* getEventBase() const override {
+    return evb_;
+  }
+  void attachEventBase(EventBase* evb) override;
+  void detachEventBase() override;
+  bool isDetachable() const override {
+    return true;
+  }
+
+  void getLocalAddress(SocketAddress* address) const override {
+    *address = localAddr_;
+  }
+  void getPeerAddress(SocketAddress* address) const override {
+    *address = peerAddr_;
+  }
+
+  // Both ends' addresses, e.g. the listener's and a client's; unset
+  // unless given
+  void setAddresses(const SocketAddress& localAddr,
+                    const SocketAddress& peerAddr) {
+    localAddr_ = localAddr;
+    peerAddr_ = peerAddr;
+  }
+
+ private:
+  struct WriteRequest {
+    WriteCallback* callback;
+    // Of the bytes ever written
+    uint64_t end;
+  };
+
+  LoopbackSocket(std::shared_ptr<Pipe> rx, std::shared_ptr<Pipe> tx,
+                 size_t window);
+
+  static void wakeReader(const std::shared_ptr<Pipe>& pipe);
+  static void wakeWriter(const std::shared_ptr<Pipe>& pipe);
+
+  void handleRead();
+  void completeWrites();
+  void failWrites(const AsyncSocketException& ex);
+  void closeTx();
+
+  EventBase* evb_{nullptr};
+  // This end reads from rx_ and writes to tx_
+  std::shared_ptr<Pipe> rx_;
+  std::shared_ptr<Pipe> tx_;
+  const size_t window_;
+  SocketAddress localAddr_;
+  SocketAddress peerAddr_;
+
+  ReadCallback* readCallback_{nullptr};
+  BufferReadCallback* bufferCallback_{nullptr};
+  // Taken from rx_ but not delivered, when the reader stopped midway
+  IOBufQueue received_{IOBufQueue::cacheChainLength()};
+  std::deque<WriteRequest> writeRequests_;
+  uint64_t bytesWritten_{0};
+
+  bool closed_{false};
+  bool writeShutdown_{false};
+  bool eof_{false};
+};
+
+}} // namespace folly::wangle
@@ -0,0 +1,269 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/MemoryBudget.h>
+
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * A thread's quota and accounts.  Kept by the thread and by its accounts,
+ * so it's gone once both are.
+ */
+class MemoryBudget::Local : public AsyncTimeout {
+ public:
+  explicit Local(MemoryBudget* budget) : budget_(budget) {}
+
+  ~Local() {
+    if (cached_ > 0) {
+      budget_->giveBack(cached_);
+    }
+  }
+
+  void add(Account* account) {
+    account->index_ = accounts_.size();
+    accounts_.push_back(account);
+  }
+
+  void remove(Account* account) {
+    if (account->paused_) {
+      account->paused_ = false;
+      paused_--;
+    }
+    auto last = accounts_.back();
+    accounts_[account->index_] = last;
+    last->index_ = account->index_;
+    accounts_.pop_back();
+    if (accounts_.empty()) {
+      cancelTimeout();
+    }
+    release(account, account->bytes_);
+  }
+
+  void charge(Account* account, uint64_t bytes) {
+    account->bytes_ += bytes;
+    bytes_ += bytes;
+    if (cached_ < int64_t(bytes)) {
+      auto want = int64_t(bytes) - cached_ + budget_->chunkSize_;
+      budget_->take(want);
+      cached_ += want;
+    }
+    cached_ -= bytes;
+    if (!shedding_ && budget_->isOverloaded()) {
+      shed();
+    }
+  }
+
+  void release(Account* account, uint64_t bytes) {
+    bytes = std::min(bytes, account->bytes_);
+    account->bytes_ -= bytes;
+    bytes_ -= bytes;
+    cached_ += bytes;
+    // Keep a chunk around for the next charges
+    if (cached_ > 2 * budget_->chunkSize_) {
+      auto excess = cached_ - budget_->chunkSize_;
+      budget_->giveBack(excess);
+      cached_ -= excess;
+    }
+    if (shedding_ && !budget_->isOverloaded()) {
+      resumeAll();
+    }
+  }
+
+  void setPaused(Account* account, bool paused) {
+    if (account->paused_ == paused) {
+      return;
+    }
+    if (paused) {
+      paused_++;
+    } else {
+      paused_--;
+    }
+  }
+
+  uint64_t getBytes() const {
+    return bytes_;
+  }
+
+  size_t getPausedAccounts() const {
+    return paused_;
+  }
+
+  void timeoutExpired() noexcept override {
+    if (budget_->isOverloaded()) {
+      // The largest accounts may have changed since
+      shed();
+    } else {
+      resumeAll();
+    }
+  }
+
+ private:
+  // Pauses the largest accounts until those paused hold half of the bytes
+  // of the accounts that can be
+  void shed() {
+    shedding_ = true;
+    std::vector<Account*> candidates;
+    uint64_t pausableBytes = 0;
+    uint64_t pausedBytes = 0;
+    for (auto account : accounts_) {
+      if (account->paused_) {
+        pausedBytes += account->bytes_;
+      } else if (account->pauseCallback_ && account->bytes_ > 0) {
+        candidates.push_back(account);
+      } else {
+        continue;
+      }
+      pausableBytes += account->bytes_;
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Account* a, const Account* b) {
+                return a->bytes_ > b->bytes_;
+              });
+    for (auto account : candidates) {
+      if (pausedBytes * 2 >= pausableBytes) {
+        break;
+      }
+      pausedBytes += account->bytes_;
+      account->setPaused(true);
+    }
+    VLOG(4) << "Memory budget overloaded, " << paused_ << " of "
+            << accounts_.size() << " accounts paused";
+    schedulePoll();
+  }
+
+  void resumeAll() {
+    shedding_ = false;
+    cancelTimeout();
+    // Callbacks may add accounts
+    auto accounts = accounts_;
+    for (auto account : accounts) {
+      if (account->paused_) {
+        account->setPaused(false);
+      }
+    }
+  }
+
+  void schedulePoll() {
+    if (!evb_) {
+      // Without one, paused accounts go on at the thread's next release
+      evb_ = EventBaseManager::get()->getExistingEventBase();
+      if (!evb_) {
+        return;
+      }
+      attachEventBase(evb_);
+    }
+    scheduleTimeout(kPollIntervalMs);
+  }
+
+  MemoryBudget* budget_;
+  EventBase* evb_{nullptr};
+  // Quota taken from the budget and not charged yet
+  int64_t cached_{0};
+  uint64_t bytes_{0};
+  std::vector<Account*> accounts_;
+  size_t paused_{0};
+  bool shedding_{false};
+};
+
+MemoryBudget::Account::Account(std::shared_ptr<MemoryBudget> budget,
+                               std::shared_ptr<Local> local)
+  : budget_(std::move(budget)),
+    local_(std::move(local)) {
+  local_->add(this);
+}
+
+MemoryBudget::Account::~Account() {
+  local_->remove(this);
+}
+
+void MemoryBudget::Account::charge(uint64_t bytes) {
+  local_->charge(this, bytes);
+}
+
+void MemoryBudget::Account::release(uint64_t bytes) {
+  local_->release(this, bytes);
+}
+
+void MemoryBudget::Account::setPauseCallback(
+    std::function<void(bool)> callback) {
+  pauseCallback_ = std::move(callback);
+  if (!pauseCallback_ && paused_) {
+    local_->setPaused(this, false);
+    paused_ = false;
+  }
+}
+
+void MemoryBudget::Account::setPaused(bool paused) {
+  local_->setPaused(this, paused);
+  paused_ = paused;
+  if (pauseCallback_) {
+    pauseCallback_(paused);
+  }
+}
+
+std::shared_ptr<MemoryBudget> MemoryBudget::create(uint64_t highWatermark,
+                                                   uint64_t lowWatermark,
+                                                   uint64_t chunkSize) {
+  return std::shared_ptr<MemoryBudget>(
+    new MemoryBudget(highWatermark, lowWatermark, chunkSize));
+}
+
+MemoryBudget::MemoryBudget(uint64_t highWatermark,
+                           uint64_t lowWatermark,
+                           uint64_t chunkSize)
+  : highWatermark_(highWatermark),
+    lowWatermark_(lowWatermark),
+    chunkSize_(chunkSize > 0 ? chunkSize : 1) {
+  CHECK(lowWatermark_ <= highWatermark_);
+}
+
+std::shared_ptr<MemoryBudget::Account> MemoryBudget::newAccount() {
+  return std::shared_ptr<Account>(
+    new Account(shared_from_this(), getLocal()));
+}
+
+uint64_t MemoryBudget::getThreadBytes() {
+  return getLocal()->getBytes();
+}
+
+size_t MemoryBudget::getThreadPausedAccounts() {
+  return getLocal()->getPausedAccounts();
+}
+
+const std::shared_ptr<MemoryBudget::Local>& MemoryBudget::getLocal() {
+  auto& local = *locals_;
+  if (!local) {
+    local = std::make_shared<Local>(this);
+  }
+  return local;
+}
+
+void MemoryBudget::take(int64_t n) {
+  auto used = used_.fetch_add(n, std::memory_order_relaxed) + n;
+  if (used > int64_t(highWatermark_) && !isOverloaded()) {
+    overloaded_.store(true, std::memory_order_relaxed);
+  }
+}
+
+void MemoryBudget::giveBack(int64_t n) {
+  auto used = used_.fetch_sub(n, std::memory_order_relaxed) - n;
+  if (used <= int64_t(lowWatermark_) && isOverloaded()) {
+    overloaded_.store(false, std::memory_order_relaxed);
+  }
+}
+
+}} // namespace folly::wangle
@@ -0,0 +1,189 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/ThreadLocal.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace folly { namespace wangle {
+
+/**
+ * Bounds the memory buffered by the pipelines of a process, e.g. data
+ * read but not decoded yet and writes waiting for a flush, whatever
+ * thread they run in.  Each pipeline charges what its handlers hold to an
+ * Account, see PipelineBase::setMemoryAccount().
+ *
+ * Accounts are charged through a quota their thread takes from the budget
+ * in chunks of chunkSize bytes, so charges mostly stay thread-local, and
+ * the usage is accurate to a couple of chunks per thread.  Once it goes
+ * above highWatermark the budget is overloaded until it drops to
+ * lowWatermark: Acceptors with the budget turn away connections that
+ * aren't whitelisted, and each thread pauses reading on its largest
+ * accounts, those holding half of the bytes of the accounts it can pause,
+ * until the overload is over.  Threads check on that every kPollIntervalMs
+ * in their EventBase.
+ */
+class MemoryBudget : public std::enable_shared_from_this<MemoryBudget> {
+  class Local;
+
+ public:
+  static const uint64_t kDefaultChunkSize = 64 * 1024;
+  static const uint32_t kPollIntervalMs = 10;
+
+  // The bytes of one pipeline; used from the thread it was made on
+  class Account {
+   public:
+    ~Account();
+
+    void charge(uint64_t bytes);
+    void release(uint64_t bytes);
+
+    uint64_t getBytes() const {
+      return bytes_;
+    }
+
+    bool isPaused() const {
+      return paused_;
+    }
+
+    /**
+     * Called with true when the pipeline should stop reading, and with
+     * false once it may go on; usually set by the transport handler.
+     * Accounts without one are never paused, and clearing it lets a
+     * paused account go on without a call.
+     */
+    void setPauseCallback(std::function<void(bool)> callback);
+
+   private:
+    friend class MemoryBudget;
+    friend class MemoryBudget::Local;
+
+    Account(std::shared_ptr<MemoryBudget> budget,
+            std::shared_ptr<Local> local);
+
+    void setPaused(bool paused);
+
+    std::shared_ptr<MemoryBudget> budget_;
+    std::shared_ptr<Local> local_;
+    std::function<void(bool)> pauseCallback_;
+    uint64_t bytes_{0};
+    bool paused_{false};
+    // In the thread's accounts
+    size_t index_{0};
+  };
+
+  /**
+   * What one handler holds against an account, set as a total rather than
+   * charged and released piecemeal.  Released when it goes away.
+   */
+  class Charge {
+   public:
+    Charge() = default;
+    Charge(Charge&& other) noexcept
+      : account_(std::move(other.account_)),
+        bytes_(other.bytes_) {
+      other.bytes_ = 0;
+    }
+    Charge(const Charge&) = delete;
+    Charge& operator=(const Charge&) = delete;
+
+    ~Charge() {
+      reset();
+    }
+
+    // Moves the charge over if account isn't the one charged so far
+    void update(const std::shared_ptr<Account>& account, uint64_t bytes) {
+      if (account != account_) {
+        reset();
+        account_ = account;
+      }
+      if (!account_) {
+        return;
+      }
+      if (bytes > bytes_) {
+        account_->charge(bytes - bytes_);
+      } else if (bytes < bytes_) {
+        account_->release(bytes_ - bytes);
+      }
+      bytes_ = bytes;
+    }
+
+    void reset() {
+      if (account_ && bytes_ > 0) {
+        account_->release(bytes_);
+      }
+      account_.reset();
+      bytes_ = 0;
+    }
+
+    uint64_t getBytes() const {
+      return bytes_;
+    }
+
+   private:
+    std::shared_ptr<Account> account_;
+    uint64_t bytes_{0};
+  };
+
+  static std::shared_ptr<MemoryBudget> create(
+      uint64_t highWatermark,
+      uint64_t lowWatermark,
+      uint64_t chunkSize = kDefaultChunkSize);
+
+  // For one pipeline, to be used from the calling thread
+  std::shared_ptr<Account> newAccount();
+
+  bool isOverloaded() const {
+    return overloaded_.load(std::memory_order_relaxed);
+  }
+
+  // Quota taken by all threads, charged or not
+  uint64_t getUsage() const {
+    auto used = used_.load(std::memory_order_relaxed);
+    return used > 0 ? used : 0;
+  }
+
+  uint64_t getHighWatermark() const {
+    return highWatermark_;
+  }
+
+  uint64_t getLowWatermark() const {
+    return lowWatermark_;
+  }
+
+  // Charged to the calling thread's accounts, and of those the paused
+  uint64_t getThreadBytes();
+  size_t getThreadPausedAccounts();
+
+ private:
+  MemoryBudget(uint64_t highWatermark,
+               uint64_t lowWatermark,
+               uint64_t chunkSize);
+
+  const std::shared_ptr<Local>& getLocal();
+
+  void take(int64_t n);
+  void giveBack(int64_t n);
+
+  const uint64_t highWatermark_;
+  const uint64_t lowWatermark_;
+  const int64_t chunkSize_;
+  // Ahead of locals_, which give back their quota as they go
+  std::atomic<int64_t> used_{0};
+  std::atomic<bool> overloaded_{false};
+  ThreadLocal<std::shared_ptr<Local>> locals_;
+};
+
+}} // namespace folly::wangle
@@ -12,6 +12,7 @@
 
 #include <folly/futures/SharedPromise.h>
 #include <wangle/channel/Handler.h>
+#include <wangle/channel/MemoryBudget.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <folly/io/IOBuf.h>
@@ -23,6 +24,15 @@ namespace folly { namespace wangle {
  * OutputBufferingHandler buffers writes in order to minimize syscalls. The
  * transport will be written to once per event loop instead of on every write.
  *
+ * The amount buffered can be capped in bytes and in IOBufs (each one becomes
+ * an iovec in the eventual writev).  Crossing either cap flushes right away
+ * instead of waiting for the end of the loop; with setCorkEarlyFlushes()
+ * those early flushes are sent with WriteFlags::CORK (MSG_MORE) so that the
+ * kernel coalesces them with the final flush of the loop.
+ *
+ * What's buffered is charged to the pipeline's memory account, if it has
+ * one, until it's flushed.
+ *
  * This handler may only be used in a single Pipeline.
  */
 class OutputBufferingHandler : public OutboundBytesToBytesHandler,
@@ -33,6 +43,15 @@ class OutputBufferingHandler : public OutboundBytesToBytesHandler,
     if (!queueSends_) {
       return ctx->fireWrite(std::move(buf));
     } else {
+      auto& account = ctx->getPipeline()->getMemoryAccount();
+      if (maxBufferedBytes_ > 0 || account) {
+        auto len = buf->computeChainDataLength();
+        bufferedBytes_ += len;
+        memoryCharge_.update(account, memoryCharge_.getBytes() + len);
+      }
+      if (maxBufferedIOBufs_ > 0) {
+        bufferedIOBufs_ += buf->countChainElements();
+      }
       // Delay sends to optimize for fewer syscalls
       if (!sends_) {
         DCHECK(!isLoopCallbackScheduled());
@@ -43,17 +62,23 @@ class OutputBufferingHandler : public OutboundBytesToBytesHandler,
         DCHECK(isLoopCallbackScheduled());
         sends_->prependChain(std::move(buf));
       }
-      return sharedPromise_.getFuture();
+
+      Future<Unit> future = makeFuture();
+      if (writeFutures_) {
+        future = sharedPromise_.getFuture();
+        pendingFutures_ = true;
+      }
+      if ((maxBufferedBytes_ > 0 && bufferedBytes_ >= maxBufferedBytes_) ||
+          (maxBufferedIOBufs_ > 0 && bufferedIOBufs_ >= maxBufferedIOBufs_)) {
+        cancelLoopCallback();
+        flush(corkEarlyFlushes_);
+      }
+      return future;
     }
   }
 
   void runLoopCallback() noexcept override {
-    MoveWrapper<SharedPromise<Unit>> sharedPromise;
-    std::swap(*sharedPromise, sharedPromise_);
-    getContext()->fireWrite(std::move(sends_))
-      .then([sharedPromise](Try<Unit> t) mutable {
-        sharedPromise->setTry(std::move(t));
-      });
+    flush(false);
   }
 
   Future<Unit> close(Context* ctx) override {
@@ -67,12 +92,80 @@ class OutputBufferingHandler : public OutboundBytesToBytesHandler,
         "close() called while sends still pending"));
     sends_.reset();
     sharedPromise_ = SharedPromise<Unit>();
+    pendingFutures_ = false;
+    bufferedBytes_ = 0;
+    bufferedIOBufs_ = 0;
+    memoryCharge_.reset();
     return ctx->fireClose();
   }
 
+  // Flush as soon as this many bytes are buffered; 0 means no limit
+  void setMaxBufferedBytes(uint64_t maxBytes) {
+    maxBufferedBytes_ = maxBytes;
+  }
+
+  // Flush as soon as this many IOBufs are buffered; 0 means no limit
+  void setMaxBufferedIOBufs(size_t maxIOBufs) {
+    maxBufferedIOBufs_ = maxIOBufs;
+  }
+
+  /*
+   * If false, write() returns an already fulfilled future and failures of
+   * the buffered writes are not reported to the individual writers.  This
+   * avoids building a future per write for callers which drop them anyway.
+   */
+  void setWriteFutures(bool writeFutures) {
+    writeFutures_ = writeFutures;
+  }
+
+  void setCorkEarlyFlushes(bool cork) {
+    corkEarlyFlushes_ = cork;
+  }
+
   SharedPromise<Unit> sharedPromise_;
   std::unique_ptr<IOBuf> sends_{nullptr};
   bool queueSends_{true};
+
+ private:
+  void flush(bool cork) {
+    auto ctx = getContext();
+    auto pipeline = ctx->getPipeline();
+    bufferedBytes_ = 0;
+    bufferedIOBufs_ = 0;
+    memoryCharge_.reset();
+
+    // Writes issued while this flush is in progress belong to the next one
+    bool hasFutures = pendingFutures_;
+    pendingFutures_ = false;
+    MoveWrapper<SharedPromise<Unit>> sharedPromise;
+    if (hasFutures) {
+      std::swap(*sharedPromise, sharedPromise_);
+    }
+
+    auto flags = pipeline->getWriteFlags();
+    if (cork) {
+      pipeline->setWriteFlags(flags | WriteFlags::CORK);
+    }
+    auto future = ctx->fireWrite(std::move(sends_));
+    if (cork) {
+      pipeline->setWriteFlags(flags);
+    }
+
+    if (hasFutures) {
+      future.then([sharedPromise](Try<Unit> t) mutable {
+          sharedPromise->setTry(std::move(t));
+        });
+    }
+  }
+
+  uint64_t maxBufferedBytes_{0};
+  size_t maxBufferedIOBufs_{0};
+  uint64_t bufferedBytes_{0};
+  size_t bufferedIOBufs_{0};
+  bool writeFutures_{true};
+  bool pendingFutures_{false};
+  bool corkEarlyFlushes_{false};
+  MemoryBudget::Charge memoryCharge_;
 };
 
 }}
@@ -13,6 +13,9 @@
 #include <folly/io/IOBufQueue.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <climits>
+
 namespace folly { namespace wangle {
 
 typedef Pipeline<void*> AcceptPipeline;
@@ -37,7 +40,10 @@ Pipeline<R, W>::~Pipeline() {
 template <class H>
 PipelineBase& PipelineBase::addBack(std::shared_ptr<H> handler) {
   typedef typename ContextType<H>::type Context;
-  return addHelper(std::make_shared<Context>(this, std::move(handler)), false);
+  return addHelper(
+      std::allocate_shared<Context>(
+          ContextAllocator<Context>(&arena_), this, std::move(handler)),
+      false);
 }
 
 template <class H>
@@ -53,7 +59,10 @@ PipelineBase& PipelineBase::addBack(H* handler) {
 template <class H>
 PipelineBase& PipelineBase::addFront(std::shared_ptr<H> handler) {
   typedef typename ContextType<H>::type Context;
-  return addHelper(std::make_shared<Context>(this, std::move(handler)), true);
+  return addHelper(
+      std::allocate_shared<Context>(
+          ContextAllocator<Context>(&arena_), this, std::move(handler)),
+      true);
 }
 
 template <class H>
@@ -129,6 +138,9 @@ PipelineBase& PipelineBase::addHelper(
     std::shared_ptr<Context>&& ctx,
     bool front) {
   ctxs_.insert(front ? ctxs_.begin() : ctxs_.end(), ctx);
+  if (profiling_) {
+    ctx->setProfiling(true);
+  }
   if (Context::dir == HandlerDir::BOTH || Context::dir == HandlerDir::IN) {
     inCtxs_.insert(front ? inCtxs_.begin() : inCtxs_.end(), ctx.get());
   }
@@ -138,6 +150,34 @@ PipelineBase& PipelineBase::addHelper(
   return *this;
 }
 
+template <class Context>
+void PipelineBase::insertAt(std::shared_ptr<Context>&& ctx, size_t pos) {
+  // Where it goes among the inbound and outbound contexts, without a scan
+  // at either end
+  size_t in = 0;
+  size_t out = 0;
+  if (pos == ctxs_.size()) {
+    in = inCtxs_.size();
+    out = outCtxs_.size();
+  } else {
+    for (size_t i = 0; i < pos; i++) {
+      auto dir = ctxs_[i]->getDirection();
+      in += dir != HandlerDir::OUT;
+      out += dir != HandlerDir::IN;
+    }
+  }
+  if (profiling_) {
+    ctx->setProfiling(true);
+  }
+  if (Context::dir == HandlerDir::BOTH || Context::dir == HandlerDir::IN) {
+    inCtxs_.insert(inCtxs_.begin() + in, ctx.get());
+  }
+  if (Context::dir == HandlerDir::BOTH || Context::dir == HandlerDir::OUT) {
+    outCtxs_.insert(outCtxs_.begin() + out, ctx.get());
+  }
+  ctxs_.insert(ctxs_.begin() + pos, std::move(ctx));
+}
+
 namespace detail {
 
 template <class T>
@@ -226,7 +266,7 @@ template <class R, class W>
 void Pipeline<R, W>::finalize() {
   front_ = nullptr;
   if (!inCtxs_.empty()) {
-    front_ = dynamic_cast<InboundLink<R>*>(inCtxs_.front());
+    front_ = inCtxs_.front()->getInboundLink<R>();
     for (size_t i = 0; i < inCtxs_.size() - 1; i++) {
       inCtxs_[i]->setNextIn(inCtxs_[i+1]);
     }
@@ -235,7 +275,7 @@ void Pipeline<R, W>::finalize() {
 
   back_ = nullptr;
   if (!outCtxs_.empty()) {
-    back_ = dynamic_cast<OutboundLink<W>*>(outCtxs_.back());
+    back_ = outCtxs_.back()->getOutboundLink<W>();
     for (size_t i = outCtxs_.size() - 1; i > 0; i--) {
       outCtxs_[i]->setNextOut(outCtxs_[i-1]);
     }
@@ -256,6 +296,166 @@ void Pipeline<R, W>::finalize() {
   for (auto it = ctxs_.rbegin(); it != ctxs_.rend(); it++) {
     (*it)->attachPipeline();
   }
+  finalized_ = true;
+}
+
+template <class R, class W>
+template <class H>
+Pipeline<R, W>& Pipeline<R, W>::addFrontLinked(std::shared_ptr<H> handler) {
+  splice(0, false, std::move(handler));
+  return *this;
+}
+
+template <class R, class W>
+template <class H>
+Pipeline<R, W>& Pipeline<R, W>::addFrontLinked(H&& handler) {
+  return addFrontLinked(std::make_shared<H>(std::forward<H>(handler)));
+}
+
+template <class R, class W>
+template <class H>
+Pipeline<R, W>& Pipeline<R, W>::addFrontLinked(H* handler) {
+  return addFrontLinked(std::shared_ptr<H>(handler, [](H*){}));
+}
+
+template <class R, class W>
+template <class H>
+Pipeline<R, W>& Pipeline<R, W>::addBackLinked(std::shared_ptr<H> handler) {
+  splice(ctxs_.size(), false, std::move(handler));
+  return *this;
+}
+
+template <class R, class W>
+template <class H>
+Pipeline<R, W>& Pipeline<R, W>::addBackLinked(H&& handler) {
+  return addBackLinked(std::make_shared<H>(std::forward<H>(handler)));
+}
+
+template <class R, class W>
+template <class H>
+Pipeline<R, W>& Pipeline<R, W>::addBackLinked(H* handler) {
+  return addBackLinked(std::shared_ptr<H>(handler, [](H*){}));
+}
+
+template <class R, class W>
+template <class H>
+Pipeline<R, W>& Pipeline<R, W>::removeLinked(H* handler) {
+  splice(positionOf(handler), true, std::shared_ptr<H>());
+  return *this;
+}
+
+template <class R, class W>
+template <class Old, class H>
+Pipeline<R, W>& Pipeline<R, W>::replaceLinked(
+    Old* old, std::shared_ptr<H> handler) {
+  splice(positionOf(old), true, std::move(handler));
+  return *this;
+}
+
+template <class R, class W>
+template <class Old, class H>
+Pipeline<R, W>& Pipeline<R, W>::replaceLinked(Old* old, H&& handler) {
+  return replaceLinked(old, std::make_shared<H>(std::forward<H>(handler)));
+}
+
+template <class R, class W>
+template <class Old, class H>
+Pipeline<R, W>& Pipeline<R, W>::replaceLinked(Old* old, H* handler) {
+  return replaceLinked(old, std::shared_ptr<H>(handler, [](H*){}));
+}
+
+template <class R, class W>
+template <class Old>
+size_t Pipeline<R, W>::positionOf(Old* old) {
+  typedef typename ContextType<Old>::type Context;
+  for (size_t i = 0; i < ctxs_.size(); i++) {
+    auto ctx = dynamic_cast<Context*>(ctxs_[i].get());
+    if (ctx && ctx->getHandler() == old) {
+      return i;
+    }
+  }
+  throw std::invalid_argument("No such handler in pipeline");
+}
+
+template <class R, class W>
+template <class H>
+void Pipeline<R, W>::splice(
+    size_t pos, bool remove, std::shared_ptr<H> handler) {
+  // The links to redo, from the lowest index to the highest
+  int inLo = INT_MAX, inHi = -1, outLo = INT_MAX, outHi = -1;
+  auto mark = [] (int k, int& lo, int& hi) {
+    lo = std::min(lo, k);
+    hi = std::max(hi, k);
+  };
+
+  std::pair<int, int> removed(-1, -1);
+  if (remove) {
+    removed = linkIndices(ctxs_[pos].get());
+    removeAt(ctxs_.begin() + pos);
+  }
+
+  PipelineContext* added = nullptr;
+  if (handler) {
+    typedef typename ContextType<H>::type Context;
+    auto ctx = std::allocate_shared<Context>(
+      ContextAllocator<Context>(&arena_), this, std::move(handler));
+    added = ctx.get();
+    insertAt(std::move(ctx), pos);
+    auto at = linkIndices(added);
+    if (at.first >= 0) {
+      mark(at.first, inLo, inHi);
+      mark(at.first + 1, inLo, inHi);
+      // Shifted up by the insertion
+      if (removed.first > at.first) {
+        removed.first++;
+      }
+    }
+    if (at.second >= 0) {
+      mark(at.second, outLo, outHi);
+      mark(at.second + 1, outLo, outHi);
+      if (removed.second > at.second) {
+        removed.second++;
+      }
+    }
+  }
+  if (removed.first >= 0) {
+    mark(removed.first, inLo, inHi);
+  }
+  if (removed.second >= 0) {
+    mark(removed.second, outLo, outHi);
+  }
+
+  if (!finalized_) {
+    return;
+  }
+  for (int k = inLo; k <= inHi && k <= int(inCtxs_.size()); k++) {
+    linkIn(k);
+  }
+  for (int k = outLo; k <= outHi && k <= int(outCtxs_.size()); k++) {
+    linkOut(k);
+  }
+  if (added) {
+    added->attachPipeline();
+  }
+}
+
+template <class R, class W>
+void Pipeline<R, W>::linkIn(size_t k) {
+  if (k == 0) {
+    front_ = inCtxs_.empty() ? nullptr : inCtxs_[0]->getInboundLink<R>();
+  } else {
+    inCtxs_[k - 1]->setNextIn(k < inCtxs_.size() ? inCtxs_[k] : nullptr);
+  }
+}
+
+template <class R, class W>
+void Pipeline<R, W>::linkOut(size_t k) {
+  auto n = outCtxs_.size();
+  if (k == n) {
+    back_ = n == 0 ? nullptr : outCtxs_[n - 1]->getOutboundLink<W>();
+  } else {
+    outCtxs_[k]->setNextOut(k > 0 ? outCtxs_[k - 1] : nullptr);
+  }
 }
 
 }} // folly::wangle
@@ -30,12 +30,75 @@ void PipelineBase::setReadBufferSettings(
     uint64_t minAvailable,
     uint64_t allocationSize) {
   readBufferSettings_ = std::make_pair(minAvailable, allocationSize);
+  readBufferSettingsSet_ = true;
 }
 
 std::pair<uint64_t, uint64_t> PipelineBase::getReadBufferSettings() {
+  if (readBufferPolicy_ && !readBufferSettingsSet_) {
+    return readBufferPolicy_->getReadBufferSettings();
+  }
   return readBufferSettings_;
 }
 
+void PipelineBase::resetReadBufferSettings() {
+  readBufferSettings_ = std::make_pair(2048, 2048);
+  readBufferSettingsSet_ = false;
+}
+
+void PipelineBase::setWriteBufferWaterMarks(uint64_t low, uint64_t high) {
+  CHECK(low <= high);
+  writeBufferWaterMarks_ = std::make_pair(low, high);
+}
+
+std::pair<uint64_t, uint64_t> PipelineBase::getWriteBufferWaterMarks() {
+  return writeBufferWaterMarks_;
+}
+
+void PipelineBase::setReadBufferPolicy(
+    std::shared_ptr<ReadBufferPolicy> policy) {
+  readBufferPolicy_ = std::move(policy);
+}
+
+ReadBufferPolicy* PipelineBase::getReadBufferPolicy() {
+  return readBufferPolicy_.get();
+}
+
+void PipelineBase::setReadBufferAllocator(
+    std::shared_ptr<ReadBufferAllocator> allocator) {
+  readBufferAllocator_ = std::move(allocator);
+}
+
+ReadBufferAllocator* PipelineBase::getReadBufferAllocator() {
+  return readBufferAllocator_.get();
+}
+
+void PipelineBase::setMemoryAccount(
+    std::shared_ptr<MemoryBudget::Account> account) {
+  memoryAccount_ = std::move(account);
+}
+
+const std::shared_ptr<MemoryBudget::Account>&
+PipelineBase::getMemoryAccount() {
+  return memoryAccount_;
+}
+
+void PipelineBase::setProfiling(bool profiling) {
+  profiling_ = profiling;
+  for (auto& ctx : ctxs_) {
+    ctx->setProfiling(profiling);
+  }
+}
+
+std::vector<const HandlerProfile*> PipelineBase::getProfiles() {
+  std::vector<const HandlerProfile*> profiles;
+  for (auto& ctx : ctxs_) {
+    if (ctx->getProfile()) {
+      profiles.push_back(ctx->getProfile());
+    }
+  }
+  return profiles;
+}
+
 typename PipelineBase::ContextIterator PipelineBase::removeAt(
     const typename PipelineBase::ContextIterator& it) {
   (*it)->detachPipeline();
@@ -56,6 +119,14 @@ typename PipelineBase::ContextIterator PipelineBase::removeAt(
   return ctxs_.erase(it);
 }
 
+std::pair<int, int> PipelineBase::linkIndices(PipelineContext* ctx) const {
+  auto in = std::find(inCtxs_.begin(), inCtxs_.end(), ctx);
+  auto out = std::find(outCtxs_.begin(), outCtxs_.end(), ctx);
+  return std::make_pair(
+    in == inCtxs_.end() ? -1 : int(in - inCtxs_.begin()),
+    out == outCtxs_.end() ? -1 : int(out - outCtxs_.begin()));
+}
+
 PipelineBase& PipelineBase::removeFront() {
   if (ctxs_.empty()) {
     throw std::invalid_argument("No handlers in pipeline");
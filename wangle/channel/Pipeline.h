@@ -14,7 +14,11 @@
 #include <folly/futures/Unit.h>
 #include <folly/io/async/AsyncTransport.h>
 #include <folly/io/async/DelayedDestruction.h>
+#include <wangle/channel/ContextArena.h>
 #include <wangle/channel/HandlerContext.h>
+#include <wangle/channel/MemoryBudget.h>
+#include <wangle/channel/ReadBufferAllocator.h>
+#include <wangle/channel/ReadBufferPolicy.h>
 #include <folly/ExceptionWrapper.h>
 #include <folly/Memory.h>
 
@@ -26,6 +30,11 @@ class PipelineManager {
  public:
   virtual ~PipelineManager() = default;
   virtual void deletePipeline(PipelineBase* pipeline) = 0;
+  // There was activity on the pipeline's transport
+  virtual void refreshTimeout() {}
+  // The transport read EOF, or failed, while reading
+  virtual void transportEOF() {}
+  virtual void transportError() {}
 };
 
 class PipelineBase : public DelayedDestruction {
@@ -42,6 +51,29 @@ class PipelineBase : public DelayedDestruction {
     }
   }
 
+  void refreshTimeout() {
+    if (manager_) {
+      manager_->refreshTimeout();
+    }
+  }
+
+  void transportEOF() {
+    if (manager_) {
+      manager_->transportEOF();
+    }
+  }
+
+  void transportError() {
+    if (manager_) {
+      manager_->transportError();
+    }
+  }
+
+  // DestructorGuards still held on it, by calls and callbacks in progress
+  uint32_t getNumDestructorGuards() const {
+    return getDestructorGuardCount();
+  }
+
   void setTransport(std::shared_ptr<AsyncTransport> transport) {
     transport_ = transport;
   }
@@ -53,8 +85,81 @@ class PipelineBase : public DelayedDestruction {
   void setWriteFlags(WriteFlags flags);
   WriteFlags getWriteFlags();
 
+  // Settings set here take precedence over a read buffer policy, until
+  // resetReadBufferSettings()
   void setReadBufferSettings(uint64_t minAvailable, uint64_t allocationSize);
   std::pair<uint64_t, uint64_t> getReadBufferSettings();
+  bool hasReadBufferSettings() const {
+    return readBufferSettingsSet_;
+  }
+  // Back to the policy's settings, or the defaults
+  void resetReadBufferSettings();
+
+  /**
+   * Bytes a decoder is known to need before it can make progress, so the
+   * transport handler can read them at once rather than in buffers of the
+   * usual size.  0 when nothing in particular is expected.
+   */
+  void setReadSizeHint(uint64_t bytes) {
+    readSizeHint_ = bytes;
+  }
+
+  uint64_t getReadSizeHint() {
+    return readSizeHint_;
+  }
+
+  /**
+   * Once more than high bytes are waiting to be written the pipeline
+   * becomes unwritable, and it becomes writable again when that drops to
+   * low or below.  Handlers are told about each change through
+   * writabilityChanged().  A high watermark of 0 (the default) disables
+   * tracking, and the pipeline stays writable.
+   */
+  void setWriteBufferWaterMarks(uint64_t low, uint64_t high);
+  std::pair<uint64_t, uint64_t> getWriteBufferWaterMarks();
+
+  bool isWritable() {
+    return writable_;
+  }
+
+  // For transport handlers, which fire writabilityChanged() afterwards
+  void setWritable(bool writable) {
+    writable_ = writable;
+  }
+
+  // While a policy is installed it decides the read buffer settings, but
+  // for those set with setReadBufferSettings().  Pass nullptr to go back
+  // to the fixed settings.
+  void setReadBufferPolicy(std::shared_ptr<ReadBufferPolicy> policy);
+  ReadBufferPolicy* getReadBufferPolicy();
+
+  // Where the transport handler gets its read buffers from once the last
+  // one is full; nullptr, the default, means IOBuf::create()
+  void setReadBufferAllocator(std::shared_ptr<ReadBufferAllocator> allocator);
+  ReadBufferAllocator* getReadBufferAllocator();
+
+  /**
+   * What the handlers buffer is charged to, see MemoryBudget; the
+   * transport handler stops reading while the account is paused.  Set it
+   * ahead of transportActive(), from the pipeline's thread.
+   */
+  void setMemoryAccount(std::shared_ptr<MemoryBudget::Account> account);
+  const std::shared_ptr<MemoryBudget::Account>& getMemoryAccount();
+
+  /**
+   * Times each handler's read() and write() calls, less the time of the
+   * handlers they fire into, for getProfiles() and
+   * HandlerProfile::getThreadStats().  Off by default, when the hops only
+   * test a pointer.  Applies to handlers added later as well.
+   */
+  void setProfiling(bool profiling);
+
+  bool isProfiling() {
+    return profiling_;
+  }
+
+  // Of the handlers in pipeline order, while profiling
+  std::vector<const HandlerProfile*> getProfiles();
 
   template <class H>
   PipelineBase& addBack(std::shared_ptr<H> handler);
@@ -102,6 +207,20 @@ class PipelineBase : public DelayedDestruction {
 
   void detachHandlers();
 
+  typedef std::vector<std::shared_ptr<PipelineContext>>::iterator
+    ContextIterator;
+
+  ContextIterator removeAt(const ContextIterator& it);
+
+  // Puts ctx at pos in ctxs_, and in order in inCtxs_ and outCtxs_
+  template <class Context>
+  void insertAt(std::shared_ptr<Context>&& ctx, size_t pos);
+
+  // Where ctx is in inCtxs_ and outCtxs_, -1 where it isn't
+  std::pair<int, int> linkIndices(PipelineContext* ctx) const;
+
+  // Where the contexts live; declared ahead of them so it outlives them
+  ContextArena arena_;
   std::vector<std::shared_ptr<PipelineContext>> ctxs_;
   std::vector<PipelineContext*> inCtxs_;
   std::vector<PipelineContext*> outCtxs_;
@@ -116,13 +235,16 @@ class PipelineBase : public DelayedDestruction {
   template <class H>
   PipelineBase& removeHelper(H* handler, bool checkEqual);
 
-  typedef std::vector<std::shared_ptr<PipelineContext>>::iterator
-    ContextIterator;
-
-  ContextIterator removeAt(const ContextIterator& it);
-
   WriteFlags writeFlags_{WriteFlags::NONE};
   std::pair<uint64_t, uint64_t> readBufferSettings_{2048, 2048};
+  bool readBufferSettingsSet_{false};
+  uint64_t readSizeHint_{0};
+  std::shared_ptr<ReadBufferPolicy> readBufferPolicy_;
+  std::shared_ptr<ReadBufferAllocator> readBufferAllocator_;
+  std::shared_ptr<MemoryBudget::Account> memoryAccount_;
+  std::pair<uint64_t, uint64_t> writeBufferWaterMarks_{0, 0};
+  bool writable_{true};
+  bool profiling_{false};
 
   std::shared_ptr<PipelineContext> owner_;
 };
@@ -173,11 +295,66 @@ class Pipeline : public PipelineBase {
 
   void finalize() override;
 
+  /*
+   * addFront(), addBack() and remove() of one handler, and the swap of one
+   * for another in place, on a pipeline that has been finalized: only the
+   * links on either side of the handler are redone, and only the new
+   * handler is attached, so there's no finalize() to call after.  For the
+   * handlers changed on live connections, for STARTTLS, protocol upgrades
+   * and the like.  Throws std::invalid_argument on a type mismatch with
+   * a neighbour, as finalize() would.  Before the first finalize() they
+   * just add and remove.
+   */
+  template <class H>
+  Pipeline& addFrontLinked(std::shared_ptr<H> handler);
+
+  template <class H>
+  Pipeline& addFrontLinked(H&& handler);
+
+  template <class H>
+  Pipeline& addFrontLinked(H* handler);
+
+  template <class H>
+  Pipeline& addBackLinked(std::shared_ptr<H> handler);
+
+  template <class H>
+  Pipeline& addBackLinked(H&& handler);
+
+  template <class H>
+  Pipeline& addBackLinked(H* handler);
+
+  template <class H>
+  Pipeline& removeLinked(H* handler);
+
+  template <class Old, class H>
+  Pipeline& replaceLinked(Old* old, std::shared_ptr<H> handler);
+
+  template <class Old, class H>
+  Pipeline& replaceLinked(Old* old, H&& handler);
+
+  template <class Old, class H>
+  Pipeline& replaceLinked(Old* old, H* handler);
+
  protected:
   explicit Pipeline(bool isStatic);
 
  private:
+  // Where old's context is in ctxs_; throws if it isn't
+  template <class Old>
+  size_t positionOf(Old* old);
+
+  // Removes ctxs_[pos] if remove, then puts handler's context there if
+  // given, and relinks around them once finalized
+  template <class H>
+  void splice(size_t pos, bool remove, std::shared_ptr<H> handler);
+
+  // The inbound link into inCtxs_[k], from front_ for 0, and the outbound
+  // one out of outCtxs_[k], from back_ for outCtxs_.size()
+  void linkIn(size_t k);
+  void linkOut(size_t k);
+
   bool isStatic_{false};
+  bool finalized_{false};
 
   InboundLink<R>* front_{nullptr};
   OutboundLink<W>* back_{nullptr};
@@ -195,6 +372,30 @@ class PipelineFactory {
   virtual typename Pipeline::UniquePtr newPipeline(
       std::shared_ptr<AsyncSocket>) = 0;
 
+  /**
+   * Lets servers reuse pipelines across connections, see
+   * ServerBootstrap::pipelinePool().  Rebinds pipeline, built by
+   * newPipeline(), to sock and resets its handlers' per-connection state,
+   * or returns false if it can't be reused, in which case it is destroyed.
+   * It is called with a null sock when the pipeline's connection is done
+   * and again with the new connection's socket when it is reused.
+   */
+  virtual bool resetPipeline(
+      Pipeline* /*pipeline*/, std::shared_ptr<AsyncSocket> /*sock*/) {
+    return false;
+  }
+
+  /**
+   * A pipeline not bound to any connection yet, for ServerBootstrap to
+   * prewarm its pipeline pool with; it gets its socket from
+   * resetPipeline().  Only for factories whose handlers don't need a
+   * socket until then, so by default there is none, and nothing is
+   * prewarmed.
+   */
+  virtual typename Pipeline::UniquePtr newUnboundPipeline() {
+    return nullptr;
+  }
+
   virtual ~PipelineFactory() = default;
 };
 
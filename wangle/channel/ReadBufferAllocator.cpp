@@ -0,0 +1,228 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/ReadBufferAllocator.h>
+
+#include <folly/Likely.h>
+#include <glog/logging.h>
+
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <new>
+#include <thread>
+
+#include <sys/mman.h>
+
+namespace folly { namespace wangle {
+
+/**
+ * The slabs of one thread.  Holds a reference for its thread and one for
+ * each buffer handed out, and goes away with the last of them.  Each slab
+ * keeps its own free list, so that a slab whose buffers have all come
+ * back can be unmapped; only the one being allocated from is kept.
+ */
+class SlabReadBufferAllocator::Arena {
+ public:
+  Arena(size_t bufferSize, size_t slabSize, bool hugePages)
+    : bufferSize_(bufferSize),
+      slabSize_(slabSize),
+      buffersPerSlab_(slabSize / bufferSize),
+      hugePages_(hugePages),
+      owner_(std::this_thread::get_id()) {}
+
+  // Owner thread only
+  void* allocate() {
+    if (!current_ || !current_->free) {
+      nextSlab();
+    }
+    auto buf = current_->free;
+    current_->free = buf->next;
+    current_->numFree--;
+    numFree_--;
+    refs_.fetch_add(1, std::memory_order_relaxed);
+    return buf;
+  }
+
+  static void free(void* buf, void* userData) {
+    auto arena = static_cast<Arena*>(userData);
+    auto b = static_cast<FreeBuffer*>(buf);
+    if (!arena->released_.load(std::memory_order_acquire) &&
+        std::this_thread::get_id() == arena->owner_) {
+      arena->putBack(b);
+    } else {
+      auto head = arena->remote_.load(std::memory_order_relaxed);
+      do {
+        b->next = head;
+      } while (!arena->remote_.compare_exchange_weak(
+          head, b, std::memory_order_release, std::memory_order_relaxed));
+    }
+    arena->unref();
+  }
+
+  // The thread, or the allocator, is done with the arena
+  void release() {
+    released_.store(true, std::memory_order_release);
+    unref();
+  }
+
+  size_t getSlabs() const {
+    return slabs_.size();
+  }
+
+  size_t getFreeBuffers() const {
+    return numFree_;
+  }
+
+ private:
+  struct FreeBuffer {
+    FreeBuffer* next;
+  };
+
+  struct Slab {
+    FreeBuffer* free{nullptr};
+    size_t numFree{0};
+  };
+
+  ~Arena() {
+    // Buffers freed on other threads don't matter anymore
+    for (auto& slab : slabs_) {
+      ::munmap(slab.first, slabSize_);
+    }
+  }
+
+  void unref() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete this;
+    }
+  }
+
+  // Makes current_ a slab with free buffers
+  void nextSlab() {
+    // Take over everything freed by other threads so far
+    auto remote = remote_.exchange(nullptr, std::memory_order_acquire);
+    while (remote) {
+      auto next = remote->next;
+      putBack(remote);
+      remote = next;
+    }
+    if (current_ && current_->free) {
+      return;
+    }
+    for (auto& slab : slabs_) {
+      if (slab.second.free) {
+        current_ = &slab.second;
+        return;
+      }
+    }
+    addSlab();
+  }
+
+  // Owner thread only
+  void putBack(FreeBuffer* b) {
+    auto it = std::prev(slabs_.upper_bound(reinterpret_cast<uint8_t*>(b)));
+    auto& slab = it->second;
+    b->next = slab.free;
+    slab.free = b;
+    slab.numFree++;
+    numFree_++;
+    if (slab.numFree == buffersPerSlab_ && &slab != current_) {
+      numFree_ -= buffersPerSlab_;
+      ::munmap(it->first, slabSize_);
+      slabs_.erase(it);
+    }
+  }
+
+  void addSlab() {
+    void* slab = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugePages_) {
+      slab = ::mmap(nullptr, slabSize_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (slab == MAP_FAILED) {
+      slab = ::mmap(nullptr, slabSize_, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (slab == MAP_FAILED) {
+        throw std::bad_alloc();
+      }
+#ifdef MADV_HUGEPAGE
+      if (hugePages_) {
+        // No huge pages reserved, try transparent ones instead
+        ::madvise(slab, slabSize_, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    auto start = static_cast<uint8_t*>(slab);
+    current_ = &slabs_[start];
+    for (size_t i = 0; i < buffersPerSlab_; i++) {
+      auto b = reinterpret_cast<FreeBuffer*>(start + i * bufferSize_);
+      b->next = current_->free;
+      current_->free = b;
+    }
+    current_->numFree = buffersPerSlab_;
+    numFree_ += buffersPerSlab_;
+  }
+
+  const size_t bufferSize_;
+  const size_t slabSize_;
+  const size_t buffersPerSlab_;
+  const bool hugePages_;
+  const std::thread::id owner_;
+  // Only touched by the owner thread; by start address, so a buffer's
+  // slab can be found
+  std::map<uint8_t*, Slab> slabs_;
+  Slab* current_{nullptr};
+  size_t numFree_{0};
+  // Pushed onto by other threads
+  std::atomic<FreeBuffer*> remote_{nullptr};
+  std::atomic<size_t> refs_{1};
+  std::atomic<bool> released_{false};
+};
+
+SlabReadBufferAllocator::SlabReadBufferAllocator(size_t bufferSize,
+                                                 size_t slabSize,
+                                                 bool hugePages)
+  : bufferSize_(bufferSize),
+    slabSize_(slabSize),
+    hugePages_(hugePages) {
+  CHECK(bufferSize_ >= sizeof(void*) && bufferSize_ <= slabSize_);
+}
+
+SlabReadBufferAllocator::~SlabReadBufferAllocator() = default;
+
+std::unique_ptr<IOBuf> SlabReadBufferAllocator::allocate(uint64_t size) {
+  if (size > bufferSize_) {
+    return IOBuf::create(size);
+  }
+  auto arena = getArena();
+  return IOBuf::takeOwnership(
+      arena->allocate(), bufferSize_, 0, &Arena::free, arena);
+}
+
+size_t SlabReadBufferAllocator::getThreadSlabs() {
+  return getArena()->getSlabs();
+}
+
+size_t SlabReadBufferAllocator::getThreadFreeBuffers() {
+  return getArena()->getFreeBuffers();
+}
+
+SlabReadBufferAllocator::Arena* SlabReadBufferAllocator::getArena() {
+  auto arena = arenas_.get();
+  if (UNLIKELY(!arena)) {
+    arena = new Arena(bufferSize_, slabSize_, hugePages_);
+    arenas_.reset(arena, [](Arena* a, TLPDestructionMode) { a->release(); });
+  }
+  return arena;
+}
+
+}} // namespace folly::wangle
@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/ThreadLocal.h>
+#include <folly/io/IOBuf.h>
+
+#include <cstdint>
+#include <memory>
+
+namespace folly { namespace wangle {
+
+/**
+ * Allocates the buffers a transport handler reads into.  Install one per
+ * pipeline with PipelineBase::setReadBufferAllocator(); without one, read
+ * buffers come from IOBuf::create().  The buffers are owned by the IOBufs
+ * returned, and may be freed on any thread.
+ */
+class ReadBufferAllocator {
+ public:
+  virtual ~ReadBufferAllocator() = default;
+
+  // An empty IOBuf with at least size bytes of tailroom
+  virtual std::unique_ptr<IOBuf> allocate(uint64_t size) = 0;
+};
+
+/**
+ * Hands out fixed-size read buffers from slabs owned by the allocating
+ * thread, e.g. an IO thread shared by many pipelines, so reads don't go
+ * through the global allocator.  Buffers freed by their owner go straight
+ * back on its free list.  Buffers freed elsewhere, e.g. by the CPU thread
+ * that handled the message, are pushed onto a lock-free remote free list
+ * that the owner takes over once its own list runs dry.  A slab all of
+ * whose buffers have come back is unmapped, unless it's the one buffers
+ * are being allocated from; the rest go once their thread, or the
+ * allocator, is gone and all of their buffers have been freed.
+ *
+ * Each buffer still needs an IOBuf, and folly keeps the SharedInfo such
+ * a buffer is shared through to itself, so IOBuf::takeOwnership() makes
+ * one small allocation per buffer holding both.
+ *
+ * Requests for more than bufferSize bytes fall back to IOBuf::create().
+ * With hugePages, slabs are backed by huge pages if the system has any to
+ * spare, or else marked for transparent huge pages; slabSize should be a
+ * multiple of the huge page size then.
+ */
+class SlabReadBufferAllocator : public ReadBufferAllocator {
+ public:
+  static const size_t kDefaultBufferSize = 16 * 1024;
+  static const size_t kDefaultSlabSize = 2 * 1024 * 1024;
+
+  explicit SlabReadBufferAllocator(size_t bufferSize = kDefaultBufferSize,
+                                   size_t slabSize = kDefaultSlabSize,
+                                   bool hugePages = false);
+  ~SlabReadBufferAllocator();
+
+  std::unique_ptr<IOBuf> allocate(uint64_t size) override;
+
+  size_t getBufferSize() const {
+    return bufferSize_;
+  }
+
+  // Of the calling thread
+  size_t getThreadSlabs();
+  size_t getThreadFreeBuffers();
+
+ private:
+  class Arena;
+
+  Arena* getArena();
+
+  const size_t bufferSize_;
+  const size_t slabSize_;
+  const bool hugePages_;
+  ThreadLocalPtr<Arena> arenas_;
+};
+
+}} // namespace folly::wangle
@@ -0,0 +1,153 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <glog/logging.h>
+
+namespace folly { namespace wangle {
+
+/**
+ * Decides how much buffer space a transport handler offers for each read.
+ *
+ * Install one per pipeline with PipelineBase::setReadBufferPolicy().  While
+ * a policy is installed it replaces the fixed settings passed to
+ * setReadBufferSettings().
+ *
+ * The base class keeps counters of the bytes offered to and actually filled
+ * by reads, which is a direct measure of read buffer waste.
+ */
+class ReadBufferPolicy {
+ public:
+  virtual ~ReadBufferPolicy() = default;
+
+  /**
+   * (minAvailable, allocationSize) to use for the next read, with the same
+   * meaning as PipelineBase::setReadBufferSettings().
+   */
+  virtual std::pair<uint64_t, uint64_t> getReadBufferSettings() = 0;
+
+  /**
+   * Called by the transport handler after each read, with the size of the
+   * buffer that was offered and the number of bytes placed in it.
+   */
+  void recordRead(uint64_t offered, uint64_t used) {
+    bytesAllocated_ += offered;
+    bytesUsed_ += used;
+    ++reads_;
+    onRead(offered, used);
+  }
+
+  uint64_t getBytesAllocated() const {
+    return bytesAllocated_;
+  }
+
+  uint64_t getBytesUsed() const {
+    return bytesUsed_;
+  }
+
+  uint64_t getReads() const {
+    return reads_;
+  }
+
+ protected:
+  virtual void onRead(uint64_t offered, uint64_t used) = 0;
+
+ private:
+  uint64_t bytesAllocated_{0};
+  uint64_t bytesUsed_{0};
+  uint64_t reads_{0};
+};
+
+/**
+ * Grows the read size quickly after reads that fill the buffer and shrinks
+ * it slowly after consecutive short reads, in the manner of Netty's
+ * AdaptiveRecvByteBufAllocator.  Bulk transfers converge on large reads and
+ * fewer syscalls, while mostly idle connections converge on small buffers.
+ */
+class AdaptiveReadBufferPolicy : public ReadBufferPolicy {
+ public:
+  explicit AdaptiveReadBufferPolicy(
+      uint64_t minimum = 64,
+      uint64_t initial = 2048,
+      uint64_t maximum = 65536) {
+    CHECK(minimum > 0);
+    CHECK(minimum <= initial && initial <= maximum);
+    // 16 byte steps up to 512, power of two steps after that
+    for (uint64_t size = 16; size < std::min<uint64_t>(512, maximum);
+         size += 16) {
+      sizeTable_.push_back(size);
+    }
+    for (uint64_t size = 512; size < maximum; size <<= 1) {
+      sizeTable_.push_back(size);
+    }
+    sizeTable_.push_back(maximum);
+
+    minIndex_ = getSizeTableIndex(minimum);
+    maxIndex_ = getSizeTableIndex(maximum);
+    index_ = getSizeTableIndex(initial);
+    nextReadSize_ = sizeTable_[index_];
+  }
+
+  std::pair<uint64_t, uint64_t> getReadBufferSettings() override {
+    return std::make_pair(nextReadSize_, nextReadSize_);
+  }
+
+  uint64_t getNextReadSize() const {
+    return nextReadSize_;
+  }
+
+ protected:
+  void onRead(uint64_t offered, uint64_t used) override {
+    if (used <= sizeTable_[index_ > kIndexDecrement ?
+                           index_ - kIndexDecrement - 1 : 0]) {
+      // Only shrink after two short reads in a row
+      if (decreaseNow_) {
+        index_ = index_ > minIndex_ + kIndexDecrement ?
+          index_ - kIndexDecrement : minIndex_;
+        nextReadSize_ = sizeTable_[index_];
+        decreaseNow_ = false;
+      } else {
+        decreaseNow_ = true;
+      }
+    } else if (used >= nextReadSize_) {
+      index_ = std::min(index_ + kIndexIncrement, maxIndex_);
+      nextReadSize_ = sizeTable_[index_];
+      decreaseNow_ = false;
+    }
+  }
+
+ private:
+  static const size_t kIndexIncrement = 4;
+  static const size_t kIndexDecrement = 1;
+
+  // Index of the smallest table entry >= size
+  size_t getSizeTableIndex(uint64_t size) const {
+    auto it = std::lower_bound(sizeTable_.begin(), sizeTable_.end(), size);
+    if (it == sizeTable_.end()) {
+      return sizeTable_.size() - 1;
+    }
+    return it - sizeTable_.begin();
+  }
+
+  std::vector<uint64_t> sizeTable_;
+  size_t minIndex_;
+  size_t maxIndex_;
+  size_t index_;
+  uint64_t nextReadSize_;
+  bool decreaseNow_{false};
+};
+
+}} // folly::wangle
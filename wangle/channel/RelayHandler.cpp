@@ -0,0 +1,393 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/RelayHandler.h>
+
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/io/async/EventHandler.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+# if (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 9))
+#   define GLIBC_AT_LEAST_2_9 1
+#  endif
+#endif
+
+namespace folly { namespace wangle {
+
+const uint64_t RelayHandler::kDefaultMaxBuffered;
+
+/**
+ * Splices the bytes read from one socket into a pipe, and from the pipe into
+ * the other socket.  It waits for the first socket to be readable as long as
+ * the pipe has room, and for the second to be writable while the pipe isn't
+ * empty.
+ */
+class RelayHandler::Splicer {
+ public:
+  Splicer(RelayHandler* owner,
+          std::shared_ptr<AsyncSocket> from,
+          std::shared_ptr<AsyncSocket> to,
+          size_t pipeSize)
+    : owner_(owner),
+      from_(std::move(from)),
+      to_(std::move(to)),
+      pipeSize_(pipeSize),
+      reader_(this, from_->getEventBase(), from_->getFd()),
+      writer_(this, to_->getEventBase(), to_->getFd()) {}
+
+  ~Splicer() {
+    reader_.unregisterHandler();
+    writer_.unregisterHandler();
+    if (pipeOut_ != -1) {
+      ::close(pipeOut_);
+      ::close(pipeIn_);
+    }
+  }
+
+  // Makes the pipe, false if it couldn't be made
+  bool init() {
+#ifndef GLIBC_AT_LEAST_2_9
+    return false;
+#else
+    int pipeFds[2];
+    if (::pipe2(pipeFds, O_NONBLOCK) == -1) {
+      return false;
+    }
+    pipeOut_ = pipeFds[0];
+    pipeIn_ = pipeFds[1];
+
+#ifdef F_SETPIPE_SZ
+    // Rounded up by the kernel, or left alone if over pipe-max-size
+    fcntl(pipeIn_, F_SETPIPE_SZ, pipeSize_);
+    auto size = fcntl(pipeIn_, F_GETPIPE_SZ);
+    pipeSize_ = size > 0 ? size : kDefaultPipeSize;
+#else
+    pipeSize_ = kDefaultPipeSize;
+#endif
+    return true;
+#endif
+  }
+
+  void start() {
+    pump();
+  }
+
+ private:
+  static const size_t kDefaultPipeSize = 65536;
+
+  class Waiter : public folly::EventHandler {
+   public:
+    Waiter(Splicer* splicer, EventBase* eventBase, int fd)
+      : EventHandler(eventBase, fd), splicer_(splicer) {}
+
+    // Waits for events while wanted
+    void want(bool wanted, uint16_t events) {
+      if (wanted && !isHandlerRegistered()) {
+        registerHandler(events | EventHandler::PERSIST);
+      } else if (!wanted && isHandlerRegistered()) {
+        unregisterHandler();
+      }
+    }
+
+    void handlerReady(uint16_t events) noexcept override {
+      splicer_->pump();
+    }
+
+   private:
+    Splicer* splicer_;
+  };
+
+  // The owner may close the relay, and delete this, in here
+  void pump() {
+    if (!eof_ && !pipeFull_) {
+      ssize_t spliced = ::splice(from_->getFd(), nullptr, pipeIn_, nullptr,
+                                 pipeSize_ - inPipe_,
+                                 SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+      if (spliced > 0) {
+        inPipe_ += spliced;
+        pipeFull_ = inPipe_ >= pipeSize_;
+      } else if (spliced == 0) {
+        eof_ = true;
+      } else if (errno == EAGAIN) {
+        // Either the socket has nothing, or the pipe ran out of buffers
+        // for the socket's fragments before it ran out of bytes
+        pipeFull_ = inPipe_ > 0;
+      } else {
+        VLOG(4) << "Relay splice from socket failed: " << strerror(errno);
+        owner_->closeRelay();
+        return;
+      }
+    }
+
+    if (inPipe_ > 0) {
+      int flags = SPLICE_F_NONBLOCK | SPLICE_F_MOVE;
+      if (!eof_) {
+        flags |= SPLICE_F_MORE;
+      }
+      ssize_t spliced = ::splice(pipeOut_, nullptr, to_->getFd(), nullptr,
+                                 inPipe_, flags);
+      if (spliced > 0) {
+        inPipe_ -= spliced;
+        pipeFull_ = false;
+        owner_->bytesRelayed_ += spliced;
+      } else if (spliced == -1 && errno != EAGAIN) {
+        VLOG(4) << "Relay splice to socket failed: " << strerror(errno);
+        owner_->closeRelay();
+        return;
+      }
+    }
+
+    if (eof_ && inPipe_ == 0) {
+      reader_.unregisterHandler();
+      writer_.unregisterHandler();
+      owner_->readDone();
+      return;
+    }
+    reader_.want(!eof_ && !pipeFull_, EventHandler::READ);
+    writer_.want(inPipe_ > 0, EventHandler::WRITE);
+  }
+
+  RelayHandler* owner_;
+  std::shared_ptr<AsyncSocket> from_;
+  std::shared_ptr<AsyncSocket> to_;
+  size_t pipeSize_;
+  int pipeOut_{-1};
+  int pipeIn_{-1};
+  size_t inPipe_{0};
+  bool pipeFull_{false};
+  bool eof_{false};
+  Waiter reader_;
+  Waiter writer_;
+};
+
+const size_t RelayHandler::Splicer::kDefaultPipeSize;
+
+RelayHandler::RelayHandler(bool splice, uint64_t maxBuffered)
+  : splice_(splice), maxBuffered_(maxBuffered) {}
+
+RelayHandler::RelayHandler(RelayHandler&&) = default;
+
+RelayHandler::~RelayHandler() {
+  unlink();
+}
+
+void RelayHandler::relay(RelayHandler* a, RelayHandler* b) {
+  CHECK(a->getContext() && b->getContext());
+  a->unlink();
+  b->unlink();
+  a->peer_ = b;
+  b->peer_ = a;
+
+  auto socketA = a->getSocket();
+  auto socketB = b->getSocket();
+  if (a->splice_ && b->splice_ && socketA && socketB &&
+      socketA->good() && socketB->good() &&
+      !dynamic_cast<AsyncSSLSocket*>(socketA.get()) &&
+      !dynamic_cast<AsyncSSLSocket*>(socketB.get())) {
+    CHECK(socketA->getEventBase() == socketB->getEventBase());
+    std::unique_ptr<Splicer> ab(
+      new Splicer(a, socketA, socketB, a->maxBuffered_));
+    std::unique_ptr<Splicer> ba(
+      new Splicer(b, socketB, socketA, b->maxBuffered_));
+    if (ab->init() && ba->init()) {
+      a->startSplicing(std::move(ab));
+      b->startSplicing(std::move(ba));
+      return;
+    }
+  }
+  a->startForwarding();
+  b->startForwarding();
+}
+
+void RelayHandler::read(Context* ctx, IOBufQueue& q) {
+  if (!peer_) {
+    pending_.append(q.move());
+    if (pending_.chainLength() >= maxBuffered_) {
+      setReading(false);
+    }
+    return;
+  }
+  bytesRelayed_ += q.chainLength();
+  peer_->getContext()->fireWrite(q.move());
+}
+
+void RelayHandler::readEOF(Context* ctx) {
+  sawEOF_ = true;
+  if (peer_ && !splicer_) {
+    finishForwarding();
+  }
+}
+
+void RelayHandler::readException(Context* ctx, exception_wrapper e) {
+  VLOG(4) << "Relay closed on error: " << exceptionStr(e);
+  closeRelay();
+}
+
+void RelayHandler::transportActive(Context* ctx) {
+  ctx->fireTransportActive();
+  if (!reading_) {
+    // The transport handler attached its read callback again
+    setReading(false);
+  }
+}
+
+void RelayHandler::transportInactive(Context* ctx) {
+  pausedReadCallback_ = nullptr;
+  ctx->fireTransportInactive();
+}
+
+void RelayHandler::writabilityChanged(Context* ctx) {
+  // The other side's bytes back up here
+  if (peer_ && !peer_->splicer_) {
+    peer_->setReading(ctx->isWritable());
+  }
+  ctx->fireWritabilityChanged();
+}
+
+void RelayHandler::attachPipeline(Context* ctx) {
+  self_ = std::make_shared<RelayHandler*>(this);
+  auto pipeline = ctx->getPipeline();
+  if (pipeline->getWriteBufferWaterMarks().second == 0) {
+    pipeline->setWriteBufferWaterMarks(maxBuffered_ / 2, maxBuffered_);
+  }
+}
+
+void RelayHandler::detachPipeline(Context* ctx) {
+  if (self_) {
+    *self_ = nullptr;
+    self_.reset();
+  }
+  auto peer = peer_;
+  unlink();
+  if (peer) {
+    peer->closeRelay();
+  }
+}
+
+std::shared_ptr<AsyncSocket> RelayHandler::getSocket() {
+  auto ctx = getContext();
+  if (!ctx) {
+    return nullptr;
+  }
+  return std::dynamic_pointer_cast<AsyncSocket>(ctx->getTransport());
+}
+
+void RelayHandler::setReading(bool reading) {
+  reading_ = reading;
+  auto socket = getSocket();
+  if (!socket) {
+    return;
+  }
+  if (!reading) {
+    auto callback = socket->getReadCallback();
+    if (callback) {
+      pausedReadCallback_ = callback;
+      socket->setReadCB(nullptr);
+    }
+  } else if (pausedReadCallback_) {
+    auto callback = pausedReadCallback_;
+    pausedReadCallback_ = nullptr;
+    if (socket->good()) {
+      socket->setReadCB(callback);
+    }
+  }
+}
+
+void RelayHandler::startSplicing(std::unique_ptr<Splicer> splicer) {
+  if (!peer_) {
+    // Closed while the other side started
+    return;
+  }
+  setReading(false);
+  splicer_ = std::move(splicer);
+
+  // Whatever was read already goes first, through the transport
+  bytesRelayed_ += pending_.chainLength();
+  auto token = self_;
+  peer_->getContext()->fireWrite(pending_.move())
+    .then([token](Try<Unit>&& t) {
+      auto self = *token;
+      if (!self || !self->splicer_) {
+        return;
+      }
+      if (t.hasException()) {
+        self->closeRelay();
+      } else {
+        self->splicer_->start();
+      }
+    });
+}
+
+void RelayHandler::startForwarding() {
+  if (!peer_) {
+    return;
+  }
+  auto peerCtx = peer_->getContext();
+  if (pending_.chainLength() > 0) {
+    bytesRelayed_ += pending_.chainLength();
+    peerCtx->fireWrite(pending_.move());
+  }
+  if (sawEOF_) {
+    finishForwarding();
+  } else {
+    setReading(peerCtx->isWritable());
+  }
+}
+
+void RelayHandler::finishForwarding() {
+  // Done after every write before it
+  auto token = self_;
+  peer_->getContext()->fireWrite(IOBuf::create(0))
+    .then([token](Try<Unit>&& t) {
+      auto self = *token;
+      if (self) {
+        self->readDone();
+      }
+    });
+}
+
+void RelayHandler::readDone() {
+  readDone_ = true;
+  if (!peer_) {
+    return;
+  }
+  auto socket = peer_->getSocket();
+  if (socket) {
+    socket->shutdownWrite();
+  }
+  if (peer_->readDone_) {
+    closeRelay();
+  }
+}
+
+void RelayHandler::unlink() {
+  splicer_.reset();
+  if (peer_) {
+    peer_->splicer_.reset();
+    peer_->peer_ = nullptr;
+    peer_ = nullptr;
+  }
+}
+
+void RelayHandler::closeRelay() {
+  auto peer = peer_;
+  unlink();
+  if (peer && peer->getContext()) {
+    peer->close(peer->getContext());
+  }
+  if (getContext()) {
+    close(getContext());
+  }
+}
+
+}} // namespace
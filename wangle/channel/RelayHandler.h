@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/IOBufQueue.h>
+
+namespace folly { namespace wangle {
+
+/**
+ * Relays the bytes of two pipelines' transports to each other, e.g. the
+ * client and backend connections of a TCP proxy.  Add one as the last
+ * handler of each pipeline, right after its AsyncSocketHandler, and link
+ * the two with relay() once both transports are active.  Both pipelines
+ * have to be on the same EventBase.  Bytes read before the link are held,
+ * up to maxBuffered, and relayed first.
+ *
+ * When both transports are plain AsyncSockets, and splicing wasn't turned
+ * off, the sockets' read callbacks are detached and each direction is
+ * spliced from one socket into a pipe and from the pipe into the other
+ * socket, so relayed bytes are never copied into user space.  A direction
+ * stops reading while its pipe (about maxBuffered) is full, and a slow
+ * receiver closes the TCP window of the sender instead of growing a
+ * buffer.
+ *
+ * Otherwise, e.g. through TLS, bytes are forwarded as IOBufs.  Pipelines
+ * without write watermarks get (maxBuffered / 2, maxBuffered), and one side
+ * stops reading while the other side's pipeline isn't writable, so about
+ * maxBuffered bytes are held per direction.
+ *
+ * EOF from one side shuts down writing to the other once all the bytes
+ * before it are relayed, and both pipelines are closed when both directions
+ * are done, or on the first error of either.
+ */
+class RelayHandler : public BytesToBytesHandler {
+ public:
+  static const uint64_t kDefaultMaxBuffered = 256 * 1024;
+
+  explicit RelayHandler(bool splice = true,
+                        uint64_t maxBuffered = kDefaultMaxBuffered);
+  RelayHandler(RelayHandler&&);
+  ~RelayHandler();
+
+  // Starts relaying between the pipelines of a and b
+  static void relay(RelayHandler* a, RelayHandler* b);
+
+  // Whether the bytes read by this side are spliced rather than forwarded
+  bool isSplicing() const {
+    return splicer_ != nullptr;
+  }
+
+  // Bytes read by this side and written to the other
+  uint64_t getBytesRelayed() const {
+    return bytesRelayed_;
+  }
+
+  void read(Context* ctx, IOBufQueue& q) override;
+  void readEOF(Context* ctx) override;
+  void readException(Context* ctx, exception_wrapper e) override;
+  void transportActive(Context* ctx) override;
+  void transportInactive(Context* ctx) override;
+  void writabilityChanged(Context* ctx) override;
+
+  void attachPipeline(Context* ctx) override;
+  void detachPipeline(Context* ctx) override;
+
+ private:
+  class Splicer;
+
+  std::shared_ptr<AsyncSocket> getSocket();
+
+  // Attaches or detaches the read callback of this side's socket
+  void setReading(bool reading);
+
+  void startSplicing(std::unique_ptr<Splicer> splicer);
+  void startForwarding();
+  // Relays the EOF once the bytes before it are written
+  void finishForwarding();
+
+  // Everything read by this side is relayed, including its EOF
+  void readDone();
+
+  void unlink();
+  void closeRelay();
+
+  bool splice_;
+  uint64_t maxBuffered_;
+
+  RelayHandler* peer_{nullptr};
+  // Read before the link
+  IOBufQueue pending_{IOBufQueue::cacheChainLength()};
+  std::unique_ptr<Splicer> splicer_;
+  bool reading_{true};
+  bool sawEOF_{false};
+  bool readDone_{false};
+  AsyncSocket::ReadCallback* pausedReadCallback_{nullptr};
+  uint64_t bytesRelayed_{0};
+
+  // Cleared when the handler leaves its pipeline, for callbacks of writes
+  std::shared_ptr<RelayHandler*> self_;
+};
+
+}} // namespace
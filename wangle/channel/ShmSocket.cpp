@@ -0,0 +1,768 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/ShmSocket.h>
+
+#include <folly/ScopeGuard.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Older headers carry memfd_create() but not file sealing
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_GET_SEALS 1034
+#endif
+#ifndef F_SEAL_SHRINK
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+namespace folly { namespace wangle {
+
+namespace {
+
+const uint32_t kShmMagic = 0x73686d31;
+// Each ring's header takes a page ahead of its data
+const size_t kPageSize = 4096;
+// So that the region's size can't wrap whatever a peer claims
+const size_t kMaxRingSize = size_t(1) << 30;
+// A peer can't shrink the region under the mapping, or grow it
+const int kSizeSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+const int kMaxReadsPerEvent = 16;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "the rings need lock-free 64-bit atomics");
+
+// Shared by the two processes; the writer only stores tail and the reader
+// only head, so each stays in a cache line of its own
+struct RingHeader {
+  alignas(64) std::atomic<uint64_t> head;
+  std::atomic<uint32_t> writerWaiting;
+  alignas(64) std::atomic<uint64_t> tail;
+  std::atomic<uint32_t> readerWaiting;
+  // The writer is done
+  std::atomic<uint32_t> closed;
+};
+
+static_assert(sizeof(RingHeader) <= kPageSize, "ring header too large");
+
+// Sent by the client, with the memory and the client and server eventfds
+struct Handshake {
+  uint32_t magic;
+  uint32_t reserved;
+  uint64_t ringSize;
+};
+
+const size_t kHandshakeFds = 3;
+
+union HandshakeControl {
+  char buf[CMSG_SPACE(sizeof(int) * kHandshakeFds)];
+  cmsghdr align;
+};
+
+bool validRingSize(uint64_t ringSize) {
+  return ringSize >= kPageSize && ringSize <= kMaxRingSize &&
+    (ringSize & (ringSize - 1)) == 0;
+}
+
+size_t regionSize(size_t ringSize) {
+  return 2 * (kPageSize + ringSize);
+}
+
+AsyncSocketException shmError(const std::string& what, int err = 0) {
+  return AsyncSocketException(
+    AsyncSocketException::INTERNAL_ERROR, "ShmSocket " + what, err);
+}
+
+// A memfd sealed at its size, as the server won't map anything else
+int createSharedMemory(size_t size) {
+  int fd = -1;
+#ifdef SYS_memfd_create
+  // MFD_CLOEXEC
+  fd = ::syscall(SYS_memfd_create, "wangle-shm", 1U | MFD_ALLOW_SEALING);
+#else
+  errno = ENOSYS;
+#endif
+  if (fd == -1) {
+    throw shmError("can't create shared memory", errno);
+  }
+  if (::ftruncate(fd, size) != 0 ||
+      ::fcntl(fd, F_ADD_SEALS, kSizeSeals) != 0) {
+    auto err = errno;
+    ::close(fd);
+    throw shmError("can't size shared memory", err);
+  }
+  return fd;
+}
+
+void ring(int fd) {
+  uint64_t one = 1;
+  // Only fails once the counter is about to overflow, when it's rung anyway
+  auto ret = ::write(fd, &one, sizeof(one));
+  (void)ret;
+}
+
+void drain(int fd) {
+  uint64_t count;
+  auto ret = ::read(fd, &count, sizeof(count));
+  (void)ret;
+}
+
+} // namespace
+
+/**
+ * One direction of the connection.  Whoever finds the other side waiting
+ * after an update rings its bell; the flags are set ahead of a last check
+ * of the ring, so one side can't go to sleep just as the other updates.
+ *
+ * The peer may be buggy or hostile, so the index this side stores is kept
+ * in its own memory too, and the peer's is only trusted once it's within
+ * a ring's size of it; otherwise the ring is corrupt, and nothing more is
+ * read or written.
+ */
+class ShmSocket::Ring {
+ public:
+  Ring(void* base, size_t size)
+    : header_(static_cast<RingHeader*>(base)),
+      data_(static_cast<uint8_t*>(base) + kPageSize),
+      size_(size) {}
+
+  static void init(void* base) {
+    new (base) RingHeader();
+  }
+
+  // Writer side; returns how much fit
+  size_t write(const uint8_t* buf, size_t len) {
+    auto tail = own_;
+    auto used = tail - header_->head.load(std::memory_order_acquire);
+    if (!check(used)) {
+      return 0;
+    }
+    len = std::min<uint64_t>(len, size_ - used);
+    auto offset = tail & (size_ - 1);
+    auto first = std::min<size_t>(len, size_ - offset);
+    memcpy(data_ + offset, buf, first);
+    memcpy(data_, buf + first, len - first);
+    own_ = tail + len;
+    header_->tail.store(own_, std::memory_order_release);
+    return len;
+  }
+
+  // Reader side
+  size_t read(uint8_t* buf, size_t len) {
+    auto head = own_;
+    auto used = header_->tail.load(std::memory_order_acquire) - head;
+    if (!check(used)) {
+      return 0;
+    }
+    len = std::min<uint64_t>(len, used);
+    auto offset = head & (size_ - 1);
+    auto first = std::min<size_t>(len, size_ - offset);
+    memcpy(buf, data_ + offset, first);
+    memcpy(buf + first, data_, len - first);
+    own_ = head + len;
+    header_->head.store(own_, std::memory_order_release);
+    return len;
+  }
+
+  // Reader side; a corrupt ring isn't, so the next read finds out
+  bool empty() const {
+    return header_->tail.load(std::memory_order_acquire) == own_;
+  }
+
+  // The peer moved its index out of bounds
+  bool isCorrupt() const {
+    return corrupt_;
+  }
+
+  // True to go to sleep, false if data came in after all
+  bool waitForData() {
+    header_->readerWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return empty();
+  }
+
+  // True to go to sleep, false if room was made after all, or the ring
+  // is corrupt
+  bool waitForRoom() {
+    header_->writerWaiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return own_ - header_->head.load(std::memory_order_acquire) == size_;
+  }
+
+  // After a write, whether the reader has to be woken up
+  bool takeReaderWaiting() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return header_->readerWaiting.load(std::memory_order_relaxed) &&
+      header_->readerWaiting.exchange(0, std::memory_order_relaxed);
+  }
+
+  // After a read, whether the writer has to be woken up
+  bool takeWriterWaiting() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return header_->writerWaiting.load(std::memory_order_relaxed) &&
+      header_->writerWaiting.exchange(0, std::memory_order_relaxed);
+  }
+
+  void close() {
+    header_->closed.store(1, std::memory_order_release);
+  }
+
+  // Once set, all that was written is in the ring
+  bool isClosed() const {
+    return header_->closed.load(std::memory_order_acquire);
+  }
+
+ private:
+  bool check(uint64_t used) {
+    if (used > size_) {
+      corrupt_ = true;
+    }
+    return !corrupt_;
+  }
+
+  RingHeader* header_;
+  uint8_t* data_;
+  const uint64_t size_;
+  // The tail of a ring written to, the head of one read from
+  uint64_t own_{0};
+  bool corrupt_{false};
+};
+
+ShmSocket::UniquePtr ShmSocket::newClientSocket(EventBase* evb,
+                                                const std::string& path,
+                                                size_t ringSize) {
+  if (!validRingSize(ringSize)) {
+    throw AsyncSocketException(AsyncSocketException::BAD_ARGS,
+                               "ShmSocket ring size has to be a power of two "
+                               "from a page to 1GB");
+  }
+  std::vector<int> fds;
+  auto closeFds = folly::makeGuard([&] {
+    for (auto fd : fds) {
+      ::close(fd);
+    }
+  });
+
+  const auto size = regionSize(ringSize);
+  int memFd = createSharedMemory(size);
+  fds.push_back(memFd);
+  auto region = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       memFd, 0);
+  if (region == MAP_FAILED) {
+    throw shmError("can't map shared memory", errno);
+  }
+  auto unmap = folly::makeGuard([&] {
+    ::munmap(region, size);
+  });
+  Ring::init(region);
+  Ring::init(static_cast<uint8_t*>(region) + kPageSize + ringSize);
+
+  for (int i = 0; i < 2; i++) {
+    int bell = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (bell == -1) {
+      throw shmError("eventfd() failed", errno);
+    }
+    fds.push_back(bell);
+  }
+
+  SocketAddress address;
+  address.setFromPath(path);
+  sockaddr_storage addr;
+  auto addrLen = address.getAddress(&addr);
+  int controlFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (controlFd == -1) {
+    throw shmError("socket() failed", errno);
+  }
+  auto closeControl = folly::makeGuard([&] {
+    ::close(controlFd);
+  });
+  if (::connect(controlFd, reinterpret_cast<sockaddr*>(&addr), addrLen) != 0) {
+    throw AsyncSocketException(AsyncSocketException::NOT_OPEN,
+                               "ShmSocket connect() to " + path + " failed",
+                               errno);
+  }
+
+  Handshake handshake;
+  handshake.magic = kShmMagic;
+  handshake.reserved = 0;
+  handshake.ringSize = ringSize;
+  iovec iov;
+  iov.iov_base = &handshake;
+  iov.iov_len = sizeof(handshake);
+  HandshakeControl control;
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * kHandshakeFds);
+  memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * kHandshakeFds);
+  ssize_t sent;
+  do {
+    sent = ::sendmsg(controlFd, &msg, MSG_NOSIGNAL);
+  } while (sent == -1 && errno == EINTR);
+  if (sent != sizeof(handshake)) {
+    throw shmError("handshake failed", sent == -1 ? errno : 0);
+  }
+  ::fcntl(controlFd, F_SETFL, ::fcntl(controlFd, F_GETFL) | O_NONBLOCK);
+
+  // The client reads from the second ring and rings the server's bell
+  UniquePtr socket(new ShmSocket(controlFd, fds[1], fds[2], region,
+                                 ringSize, true));
+  ::close(memFd);
+  fds.clear();
+  closeControl.dismiss();
+  unmap.dismiss();
+  socket->peerAddr_ = address;
+  if (evb) {
+    socket->attachEventBase(evb);
+  }
+  return socket;
+}
+
+ShmSocket::UniquePtr ShmSocket::newServerSocket(
+    int controlFd,
+    const SocketAddress& localAddr) {
+  Handshake handshake;
+  iovec iov;
+  iov.iov_base = &handshake;
+  iov.iov_len = sizeof(handshake);
+  HandshakeControl control;
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  ssize_t received;
+  do {
+    received = ::recvmsg(controlFd, &msg, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+  } while (received == -1 && errno == EINTR);
+  if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return nullptr;
+  }
+
+  std::vector<int> fds;
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      auto data = reinterpret_cast<int*>(CMSG_DATA(cmsg));
+      fds.insert(fds.end(), data, data + count);
+    }
+  }
+  auto closeFds = folly::makeGuard([&] {
+    for (auto fd : fds) {
+      ::close(fd);
+    }
+  });
+  if (received != sizeof(handshake) || handshake.magic != kShmMagic ||
+      fds.size() != kHandshakeFds || (msg.msg_flags & MSG_CTRUNC) ||
+      !validRingSize(handshake.ringSize)) {
+    throw shmError("got a bad handshake");
+  }
+
+  const auto size = regionSize(handshake.ringSize);
+  // Unless the size is sealed the client could truncate the memory later
+  // and fault the server on its next access
+  auto seals = ::fcntl(fds[0], F_GET_SEALS);
+  if (seals == -1 || (seals & kSizeSeals) != kSizeSeals) {
+    throw shmError("got shared memory that isn't sealed");
+  }
+  struct stat st;
+  if (::fstat(fds[0], &st) != 0 || size_t(st.st_size) < size) {
+    throw shmError("got too little shared memory");
+  }
+  auto region = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fds[0], 0);
+  if (region == MAP_FAILED) {
+    throw shmError("can't map shared memory", errno);
+  }
+  ::fcntl(controlFd, F_SETFL, ::fcntl(controlFd, F_GETFL) | O_NONBLOCK);
+
+  UniquePtr socket(new ShmSocket(controlFd, fds[2], fds[1], region,
+                                 handshake.ringSize, false));
+  ::close(fds[0]);
+  fds.clear();
+  socket->localAddr_ = localAddr;
+  return socket;
+}
+
+ShmSocket::ShmSocket(int controlFd, int bellFd, int peerBellFd,
+                     void* region, size_t ringSize, bool client)
+  : controlFd_(controlFd),
+    bellFd_(bellFd),
+    peerBellFd_(peerBellFd),
+    region_(region),
+    ringSize_(ringSize),
+    bellHandler_(this, bellFd, false),
+    controlHandler_(this, controlFd, true) {
+  auto second = static_cast<uint8_t*>(region) + kPageSize + ringSize;
+  // The first ring carries what the client sends
+  rx_.reset(new Ring(client ? second : region, ringSize));
+  tx_.reset(new Ring(client ? region : second, ringSize));
+}
+
+ShmSocket::~ShmSocket() {
+  closeNow();
+}
+
+void ShmSocket::Handler::handlerReady(uint16_t /*events*/) noexcept {
+  if (control_) {
+    socket_->controlReady();
+  } else {
+    socket_->bellReady();
+  }
+}
+
+void ShmSocket::setReadCB(ReadCallback* callback) {
+  if (callback && (closed_ || eof_)) {
+    callback->readErr(AsyncSocketException(
+      AsyncSocketException::NOT_OPEN,
+      "setReadCB() called with ShmSocket closed"));
+    return;
+  }
+  readCallback_ = callback;
+  if (callback && evb_) {
+    // Whatever came in while nobody was reading
+    ring(bellFd_);
+  }
+}
+
+void ShmSocket::write(WriteCallback* callback, const void* buf, size_t bytes,
+                      WriteFlags flags) {
+  writeChain(callback, IOBuf::copyBuffer(buf, bytes), flags);
+}
+
+void ShmSocket::writev(WriteCallback* callback, const iovec* vec,
+                       size_t count, WriteFlags flags) {
+  IOBufQueue queue;
+  for (size_t i = 0; i < count; i++) {
+    queue.append(IOBuf::copyBuffer(vec[i].iov_base, vec[i].iov_len));
+  }
+  writeChain(callback, queue.move(), flags);
+}
+
+void ShmSocket::writeChain(WriteCallback* callback,
+                           std::unique_ptr<folly::IOBuf>&& buf,
+                           WriteFlags /*flags*/) {
+  if (!good()) {
+    if (callback) {
+      callback->writeErr(0, AsyncSocketException(
+        AsyncSocketException::NOT_OPEN, "ShmSocket not open for writing"));
+    }
+    return;
+  }
+  DestructorGuard dg(this);
+  auto len = buf ? buf->computeChainDataLength() : 0;
+  writeRequests_.push_back({callback, bytesQueued_, bytesQueued_ + len});
+  bytesQueued_ += len;
+  if (buf) {
+    pendingWrites_.append(std::move(buf));
+  }
+  handleWrite();
+}
+
+void ShmSocket::close() {
+  if (writeRequests_.empty()) {
+    closeNow();
+    return;
+  }
+  closing_ = true;
+  if (readCallback_) {
+    auto callback = readCallback_;
+    readCallback_ = nullptr;
+    callback->readEOF();
+  }
+}
+
+void ShmSocket::closeNow() {
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  DestructorGuard dg(this);
+  if (evb_) {
+    bellHandler_.unregisterHandler();
+    controlHandler_.unregisterHandler();
+  }
+  if (!writeShutdown_) {
+    writeShutdown_ = true;
+    tx_->close();
+    ringPeer();
+  }
+  failWrites(AsyncSocketException(
+    AsyncSocketException::NOT_OPEN, "ShmSocket closed locally"));
+  if (readCallback_) {
+    auto callback = readCallback_;
+    readCallback_ = nullptr;
+    callback->readEOF();
+  }
+  // The peer sees the control socket close
+  ::close(controlFd_);
+  ::close(bellFd_);
+  ::close(peerBellFd_);
+  rx_.reset();
+  tx_.reset();
+  ::munmap(region_, regionSize(ringSize_));
+}
+
+void ShmSocket::shutdownWrite() {
+  if (writeRequests_.empty()) {
+    finishShutdownWrite();
+  } else {
+    shutdownWritePending_ = true;
+  }
+}
+
+void ShmSocket::shutdownWriteNow() {
+  DestructorGuard dg(this);
+  failWrites(AsyncSocketException(
+    AsyncSocketException::NOT_OPEN, "ShmSocket shut down for writing"));
+  finishShutdownWrite();
+}
+
+bool ShmSocket::good() const {
+  return !closed_ && !closing_ && !shutdownWritePending_ && !writeShutdown_ &&
+    !eof_ && !peerGone_ && evb_;
+}
+
+bool ShmSocket::readable() const {
+  return !closed_ && !rx_->empty();
+}
+
+void ShmSocket::attachEventBase(EventBase* evb) {
+  DCHECK(!evb_);
+  evb_ = evb;
+  bellHandler_.attachEventBase(evb);
+  controlHandler_.attachEventBase(evb);
+  if (!closed_) {
+    registerHandlers();
+    // In case the peer rang while nobody was listening
+    ring(bellFd_);
+  }
+}
+
+void ShmSocket::detachEventBase() {
+  if (!evb_) {
+    return;
+  }
+  if (!closed_) {
+    bellHandler_.unregisterHandler();
+    controlHandler_.unregisterHandler();
+  }
+  bellHandler_.detachEventBase();
+  controlHandler_.detachEventBase();
+  evb_ = nullptr;
+}
+
+void ShmSocket::registerHandlers() {
+  bellHandler_.registerHandler(EventHandler::READ | EventHandler::PERSIST);
+  if (!peerGone_) {
+    controlHandler_.registerHandler(
+      EventHandler::READ | EventHandler::PERSIST);
+  }
+}
+
+void ShmSocket::bellReady() {
+  drain(bellFd_);
+  DestructorGuard dg(this);
+  handleWrite();
+  if (!closed_) {
+    handleRead();
+  }
+}
+
+void ShmSocket::controlReady() {
+  char buf[64];
+  auto ret = ::recv(controlFd_, buf, sizeof(buf), MSG_DONTWAIT);
+  if (ret > 0 || (ret == -1 && (errno == EAGAIN || errno == EINTR))) {
+    return;
+  }
+  // The peer closed, or died
+  peerGone_ = true;
+  controlHandler_.unregisterHandler();
+  DestructorGuard dg(this);
+  failWrites(AsyncSocketException(
+    AsyncSocketException::END_OF_FILE, "ShmSocket peer went away"));
+  // What it wrote before is still delivered
+  if (!closed_) {
+    handleRead();
+  }
+}
+
+void ShmSocket::handleRead() {
+  for (int i = 0; readCallback_ && i < kMaxReadsPerEvent; i++) {
+    if (rx_->empty()) {
+      // Checked before emptiness, both only mean the end once it's empty
+      bool done = rx_->isClosed() || peerGone_;
+      if (!rx_->empty()) {
+        continue;
+      }
+      if (done) {
+        eof_ = true;
+        auto callback = readCallback_;
+        readCallback_ = nullptr;
+        callback->readEOF();
+        return;
+      }
+      if (rx_->waitForData()) {
+        return;
+      }
+      continue;
+    }
+    void* buf = nullptr;
+    size_t len = 0;
+    readCallback_->getReadBuffer(&buf, &len);
+    if (!buf || len == 0) {
+      auto callback = readCallback_;
+      readCallback_ = nullptr;
+      callback->readErr(AsyncSocketException(
+        AsyncSocketException::BAD_ARGS,
+        "ReadCallback::getReadBuffer() returned empty buffer"));
+      return;
+    }
+    auto n = rx_->read(static_cast<uint8_t*>(buf), len);
+    if (rx_->isCorrupt()) {
+      fail(shmError("peer corrupted the ring it writes"));
+      return;
+    }
+    if (rx_->takeWriterWaiting()) {
+      ringPeer();
+    }
+    readCallback_->readDataAvailable(n);
+    if (closed_) {
+      return;
+    }
+  }
+  if (readCallback_ && !rx_->empty()) {
+    // Back for the rest in the next loop, after the other sockets
+    ring(bellFd_);
+  }
+}
+
+void ShmSocket::handleWrite() {
+  if (closed_) {
+    return;
+  }
+  uint64_t written = 0;
+  while (auto head = pendingWrites_.front()) {
+    if (head->length() == 0) {
+      pendingWrites_.pop_front();
+      continue;
+    }
+    auto n = tx_->write(head->data(), head->length());
+    if (tx_->isCorrupt()) {
+      fail(shmError("peer corrupted the ring it reads"));
+      return;
+    }
+    if (n == 0) {
+      if (tx_->waitForRoom()) {
+        break;
+      }
+      continue;
+    }
+    pendingWrites_.trimStart(n);
+    written += n;
+  }
+  if (written > 0) {
+    bytesWritten_ += written;
+    if (tx_->takeReaderWaiting()) {
+      ringPeer();
+    }
+  }
+  while (!writeRequests_.empty() &&
+         writeRequests_.front().end <= bytesWritten_) {
+    auto callback = writeRequests_.front().callback;
+    writeRequests_.pop_front();
+    if (callback) {
+      callback->writeSuccess();
+    }
+    if (closed_) {
+      return;
+    }
+  }
+  if (writeRequests_.empty()) {
+    if (closing_) {
+      closeNow();
+    } else if (shutdownWritePending_) {
+      finishShutdownWrite();
+    }
+  }
+}
+
+void ShmSocket::failWrites(const AsyncSocketException& ex) {
+  auto requests = std::move(writeRequests_);
+  writeRequests_.clear();
+  pendingWrites_.move();
+  bytesQueued_ = bytesWritten_;
+  for (auto& request : requests) {
+    if (request.callback) {
+      auto written = bytesWritten_ > request.start ?
+        bytesWritten_ - request.start : 0;
+      request.callback->writeErr(written, ex);
+    }
+  }
+}
+
+void ShmSocket::fail(const AsyncSocketException& ex) {
+  LOG(ERROR) << ex.what() << ", closing the connection";
+  DestructorGuard dg(this);
+  failWrites(ex);
+  if (readCallback_) {
+    auto callback = readCallback_;
+    readCallback_ = nullptr;
+    callback->readErr(ex);
+  }
+  closeNow();
+}
+
+void ShmSocket::finishShutdownWrite() {
+  shutdownWritePending_ = false;
+  if (writeShutdown_ || closed_) {
+    return;
+  }
+  writeShutdown_ = true;
+  tx_->close();
+  ringPeer();
+  if (eof_) {
+    closeNow();
+  }
+}
+
+void ShmSocket::ringPeer() {
+  if (!peerGone_) {
+    ring(peerBellFd_);
+  }
+}
+
+}} // namespace folly::wangle
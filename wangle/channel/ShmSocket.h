@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/SocketAddress.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/EventHandler.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+
+namespace folly { namespace wangle {
+
+/**
+ * A transport between two processes on the same host over a pair of
+ * single-producer single-consumer byte rings in shared memory, one per
+ * direction, so data is copied once into the ring and once out of it
+ * with no system call on the way.  Each side sleeps on an eventfd that
+ * the other only signals when it's found waiting, for data or for room.
+ *
+ * The client sets up the rings in a memfd sealed at its size and hands
+ * them, with the eventfds, to the server over a Unix socket (see
+ * ShmServerSocket), which stays open so either side sees the other go
+ * away.  It passes for an AsyncSocket, so AsyncSocketHandler and Acceptor
+ * take it as is, but it has no fd, and TCP socket options and features
+ * like zero-copy don't apply.
+ */
+class ShmSocket : public AsyncSocket {
+ public:
+  typedef std::unique_ptr<ShmSocket, Destructor> UniquePtr;
+
+  // Bytes each way; a power of two from a page to 1GB
+  static const size_t kDefaultRingSize = 1024 * 1024;
+
+  /**
+   * Connects to the ShmServerSocket listening on the Unix socket at path.
+   * Completes before it returns, as a local connect() doesn't wait for
+   * the server; throws AsyncSocketException on errors.
+   */
+  static UniquePtr newClientSocket(EventBase* evb,
+                                   const std::string& path,
+                                   size_t ringSize = kDefaultRingSize);
+
+  /**
+   * The server's end of the connection accepted as controlFd, made from
+   * the rings the client sent once controlFd is readable.  Returns null
+   * if they aren't there yet, and throws if what's there isn't a client's
+   * handshake; either way the caller keeps controlFd.  Attach it to an
+   * EventBase before use.
+   */
+  static UniquePtr newServerSocket(int controlFd,
+                                   const SocketAddress& localAddr);
+
+  ~ShmSocket();
+
+  // AsyncTransportWrapper implementation
+  void setReadCB(ReadCallback* callback) override;
+  ReadCallback* getReadCallback() const override {
+    return readCallback_;
+  }
+  void write(WriteCallback* callback, const void* buf, size_t bytes,
+             WriteFlags flags = WriteFlags::NONE) override;
+  void writev(WriteCallback* callback, const iovec* vec, size_t count,
+              WriteFlags flags = WriteFlags::NONE) override;
+  void writeChain(WriteCallback* callback,
+                  std::unique_ptr<folly::IOBuf>&& buf,
+                  WriteFlags flags = WriteFlags::NONE) override;
+
+  void close() override;
+  void closeNow() override;
+  void closeWithReset() override {
+    closeNow();
+  }
+  void shutdownWrite() override;
+  void shutdownWriteNow() override;
+
+  bool good() const override;
+  bool readable() const override;
+  bool connecting() const override {
+    return false;
+  }
+  bool error() const override {
+    return false;
+  }
+
+  EventBase* getEventBase() const override {
+    return evb_;
+  }
+  void attachEventBase(EventBase* evb) override;
+  void detachEventBase() override;
+  bool isDetachable() const override {
+    return true;
+  }
+
+  void getLocalAddress(SocketAddress* address) const override {
+    *address = localAddr_;
+  }
+  void getPeerAddress(SocketAddress* address) const override {
+    *address = peerAddr_;
+  }
+
+  size_t getRingSize() const {
+    return ringSize_;
+  }
+
+ private:
+  class Ring;
+
+  class Handler : public EventHandler {
+   public:
+    Handler(ShmSocket* socket, int fd, bool control)
+      : EventHandler(nullptr, fd), socket_(socket), control_(control) {}
+
+    void handlerReady(uint16_t events) noexcept override;
+
+   private:
+    ShmSocket* socket_;
+    const bool control_;
+  };
+
+  struct WriteRequest {
+    WriteCallback* callback;
+    // Of the bytes ever queued
+    uint64_t start;
+    uint64_t end;
+  };
+
+  ShmSocket(int controlFd, int bellFd, int peerBellFd,
+            void* region, size_t ringSize, bool client);
+
+  void bellReady();
+  void controlReady();
+  void handleRead();
+  void handleWrite();
+  void failWrites(const AsyncSocketException& ex);
+  // Fails the reads and writes, and closes
+  void fail(const AsyncSocketException& ex);
+  void finishShutdownWrite();
+  void registerHandlers();
+  void ringPeer();
+
+  EventBase* evb_{nullptr};
+  int controlFd_;
+  int bellFd_;
+  int peerBellFd_;
+  void* region_;
+  const size_t ringSize_;
+  std::unique_ptr<Ring> rx_;
+  std::unique_ptr<Ring> tx_;
+  Handler bellHandler_;
+  Handler controlHandler_;
+  SocketAddress localAddr_;
+  SocketAddress peerAddr_;
+
+  ReadCallback* readCallback_{nullptr};
+  IOBufQueue pendingWrites_;
+  std::deque<WriteRequest> writeRequests_;
+  uint64_t bytesQueued_{0};
+  uint64_t bytesWritten_{0};
+
+  bool closed_{false};
+  // close() waits for the pending writes
+  bool closing_{false};
+  bool shutdownWritePending_{false};
+  bool writeShutdown_{false};
+  bool eof_{false};
+  bool peerGone_{false};
+};
+
+}} // namespace folly::wangle
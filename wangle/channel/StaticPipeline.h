@@ -36,14 +36,175 @@ namespace folly { namespace wangle {
  * pipeline;
  *
  * You can then use pipeline just like any Pipeline. See Pipeline.h.
+ *
+ * Because the handler types are known at compile time, a context's
+ * fireRead() calls the next handler's context directly, and its fireWrite()
+ * the previous handler's, instead of through the virtual InboundLink and
+ * OutboundLink interfaces that dynamic pipelines are wired with.  Declare
+ * handlers final to let the compiler inline their read() and write() as
+ * well.
  */
 template <class R, class W, class... Handlers>
 class StaticPipeline;
 
-template <class R, class W>
-class StaticPipeline<R, W> : public Pipeline<R, W> {
+// One level per handler, each knowing the type of the handler before it
+template <class R, class W, class Prev, class... Handlers>
+class StaticPipelineLevel;
+
+template <class R, class W, class Prev>
+class StaticPipelineLevel<R, W, Prev> : public Pipeline<R, W> {
  protected:
-  explicit StaticPipeline(bool) : Pipeline<R, W>(true) {}
+  typedef void StaticContext;
+
+  StaticPipelineLevel() : Pipeline<R, W>(true) {}
+};
+
+template <class Context>
+struct ReceivesInbound {
+  static const bool value = Context::dir != HandlerDir::OUT;
+};
+
+template <>
+struct ReceivesInbound<void> {
+  static const bool value = false;
+};
+
+template <class Handler, class NextContext, class Enable = void>
+struct HasStaticNextIn : std::false_type {};
+
+template <class Handler, class NextContext>
+struct HasStaticNextIn<
+    Handler,
+    NextContext,
+    typename std::enable_if<ReceivesInbound<NextContext>::value>::type>
+  : std::integral_constant<bool,
+      Handler::dir != HandlerDir::OUT &&
+      std::is_same<typename Handler::rout,
+                   typename NextContext::Rin>::value> {};
+
+template <class Handler>
+struct ReceivesOutbound {
+  static const bool value = Handler::dir != HandlerDir::IN;
+};
+
+template <>
+struct ReceivesOutbound<void> {
+  static const bool value = false;
+};
+
+template <class Handler, class PrevHandler, class Enable = void>
+struct HasStaticNextOut : std::false_type {};
+
+template <class Handler, class PrevHandler>
+struct HasStaticNextOut<
+    Handler,
+    PrevHandler,
+    typename std::enable_if<ReceivesOutbound<PrevHandler>::value>::type>
+  : std::integral_constant<bool,
+      Handler::dir != HandlerDir::IN &&
+      std::is_same<typename Handler::wout,
+                   typename PrevHandler::win>::value> {};
+
+/*
+ * The outbound half of a StaticPipeline context.  When the previous
+ * handler receives this handler's outbound messages, fireWrite() makes a
+ * non-virtual call into the previous context, as long as the pipeline is
+ * still wired the way it was constructed.
+ */
+template <class Handler, class PrevHandler,
+          bool = HasStaticNextOut<Handler, PrevHandler>::value>
+class StaticOutboundContextImpl : public ContextType<Handler>::type {
+ public:
+  template <class T>
+  void setStaticNextOut(T*) {}
+};
+
+template <class Handler, class PrevHandler>
+class StaticOutboundContextImpl<Handler, PrevHandler, true>
+    : public ContextType<Handler>::type {
+ public:
+  typedef typename ContextType<Handler>::type Base;
+  typedef typename ContextType<PrevHandler>::type PrevContext;
+  typedef typename Handler::wout Wout;
+
+  void setStaticNextOut(PrevContext* prev) {
+    staticCandidate_ = prev;
+  }
+
+  void setNextOut(PipelineContext* ctx) override {
+    Base::setNextOut(ctx);
+    if (ctx && ctx == static_cast<PipelineContext*>(staticCandidate_)) {
+      staticNextOut_ = staticCandidate_;
+    } else {
+      staticNextOut_ = nullptr;
+    }
+  }
+
+  Future<Unit> fireWrite(Wout msg) override {
+    if (staticNextOut_) {
+      DestructorGuard dg(this->pipeline_);
+      return staticNextOut_->PrevContext::write(std::forward<Wout>(msg));
+    } else {
+      return Base::fireWrite(std::forward<Wout>(msg));
+    }
+  }
+
+ private:
+  using DestructorGuard = typename DelayedDestruction::DestructorGuard;
+
+  PrevContext* staticCandidate_{nullptr};
+  PrevContext* staticNextOut_{nullptr};
+};
+
+/*
+ * Context used by StaticPipeline.  When the next handler receives this
+ * handler's inbound messages, fireRead() makes a non-virtual call into the
+ * next context, as long as the pipeline is still wired the way it was
+ * constructed.
+ */
+template <class Handler, class NextContext, class PrevHandler,
+          bool = HasStaticNextIn<Handler, NextContext>::value>
+class StaticContextImpl
+    : public StaticOutboundContextImpl<Handler, PrevHandler> {
+ public:
+  template <class T>
+  void setStaticNextIn(T*) {}
+};
+
+template <class Handler, class NextContext, class PrevHandler>
+class StaticContextImpl<Handler, NextContext, PrevHandler, true>
+    : public StaticOutboundContextImpl<Handler, PrevHandler> {
+ public:
+  typedef StaticOutboundContextImpl<Handler, PrevHandler> Base;
+  typedef typename Handler::rout Rout;
+
+  void setStaticNextIn(NextContext* next) {
+    staticCandidate_ = next;
+  }
+
+  void setNextIn(PipelineContext* ctx) override {
+    Base::setNextIn(ctx);
+    if (ctx && ctx == static_cast<PipelineContext*>(staticCandidate_)) {
+      staticNextIn_ = staticCandidate_;
+    } else {
+      staticNextIn_ = nullptr;
+    }
+  }
+
+  void fireRead(Rout msg) override {
+    if (staticNextIn_) {
+      DestructorGuard dg(this->pipeline_);
+      staticNextIn_->NextContext::read(std::forward<Rout>(msg));
+    } else {
+      Base::fireRead(std::forward<Rout>(msg));
+    }
+  }
+
+ private:
+  using DestructorGuard = typename DelayedDestruction::DestructorGuard;
+
+  NextContext* staticCandidate_{nullptr};
+  NextContext* staticNextIn_{nullptr};
 };
 
 template <class Handler>
@@ -56,45 +217,45 @@ template <class Handler>
 class BaseWithoutOptional {
 };
 
-template <class R, class W, class Handler, class... Handlers>
-class StaticPipeline<R, W, Handler, Handlers...>
-    : public StaticPipeline<R, W, Handlers...>
+template <class R, class W, class Prev, class Handler, class... Handlers>
+class StaticPipelineLevel<R, W, Prev, Handler, Handlers...>
+    : public StaticPipelineLevel<R, W, Handler, Handlers...>
     , public std::conditional<std::is_abstract<Handler>::value,
                               BaseWithoutOptional<Handler>,
                               BaseWithOptional<Handler>>::type {
- public:
-  template <class... HandlerArgs>
-  explicit StaticPipeline(HandlerArgs&&... handlers)
-    : StaticPipeline(true, std::forward<HandlerArgs>(handlers)...) {
-    isFirst_ = true;
-  }
+  template <class R2, class W2, class Prev2, class... Handlers2>
+  friend class StaticPipelineLevel;
 
-  ~StaticPipeline() {
-    if (isFirst_) {
-      Pipeline<R, W>::detachHandlers();
-    }
-  }
+  typedef StaticPipelineLevel<R, W, Handler, Handlers...> NextLevel;
 
  protected:
   template <class HandlerArg, class... HandlerArgs>
-  StaticPipeline(
-      bool isFirst,
+  explicit StaticPipelineLevel(
       HandlerArg&& handler,
       HandlerArgs&&... handlers)
-    : StaticPipeline<R, W, Handlers...>(
-          false,
-          std::forward<HandlerArgs>(handlers)...) {
-    isFirst_ = isFirst;
+    : NextLevel(std::forward<HandlerArgs>(handlers)...) {
     setHandler(std::forward<HandlerArg>(handler));
     CHECK(handlerPtr_);
     ctx_.initialize(this, handlerPtr_);
+    linkNext(static_cast<NextLevel*>(this));
     Pipeline<R, W>::addContextFront(&ctx_);
-    if (isFirst_) {
-      Pipeline<R, W>::finalize();
-    }
   }
 
+  typedef StaticContextImpl<
+    Handler,
+    typename NextLevel::StaticContext,
+    Prev> StaticContext;
+
  private:
+  template <class NextHandler, class... NextHandlers>
+  void linkNext(
+      StaticPipelineLevel<R, W, Handler, NextHandler, NextHandlers...>* next) {
+    ctx_.setStaticNextIn(&next->ctx_);
+    next->ctx_.setStaticNextOut(&ctx_);
+  }
+
+  void linkNext(StaticPipelineLevel<R, W, Handler>*) {}
+
   template <class HandlerArg>
   typename std::enable_if<std::is_same<
     typename std::remove_reference<HandlerArg>::type,
@@ -123,9 +284,23 @@ class StaticPipeline<R, W, Handler, Handlers...>
     handlerPtr_ = std::shared_ptr<Handler>(arg, [](Handler*){});
   }
 
-  bool isFirst_;
   std::shared_ptr<Handler> handlerPtr_;
-  typename ContextType<Handler>::type ctx_;
+  StaticContext ctx_;
+};
+
+template <class R, class W, class... Handlers>
+class StaticPipeline : public StaticPipelineLevel<R, W, void, Handlers...> {
+ public:
+  template <class... HandlerArgs>
+  explicit StaticPipeline(HandlerArgs&&... handlers)
+    : StaticPipelineLevel<R, W, void, Handlers...>(
+          std::forward<HandlerArgs>(handlers)...) {
+    Pipeline<R, W>::finalize();
+  }
+
+  ~StaticPipeline() {
+    Pipeline<R, W>::detachHandlers();
+  }
 };
 
 }} // folly::wangle
@@ -0,0 +1,202 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/ZeroCopyReader.h>
+
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <glog/logging.h>
+
+#include <atomic>
+
+#ifdef __linux__
+#include <linux/version.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0)
+#define WANGLE_HAVE_TCP_ZEROCOPY_RECEIVE 1
+// Not in older C libraries' <netinet/tcp.h>, which clashes with
+// <linux/tcp.h>
+#ifndef TCP_ZEROCOPY_RECEIVE
+#define TCP_ZEROCOPY_RECEIVE 35
+#endif
+#endif
+#endif
+
+namespace folly { namespace wangle {
+
+namespace {
+
+std::atomic<uint64_t> globalMappedBytes{0};
+std::atomic<uint64_t> globalCopiedBytes{0};
+
+#ifdef WANGLE_HAVE_TCP_ZEROCOPY_RECEIVE
+// The start of struct tcp_zerocopy_receive, all that 4.18 knows of; later
+// kernels take it as is
+struct ZeroCopyReceive {
+  uint64_t address;
+  uint32_t length;
+  uint32_t recv_skip_hint;
+};
+
+#endif
+
+} // namespace
+
+#ifdef WANGLE_HAVE_TCP_ZEROCOPY_RECEIVE
+// Referenced by the reader while it receives into it, and by each IOBuf
+// made from it
+struct ZeroCopyReader::Mapping {
+  Mapping(void* a, size_t s) : addr(static_cast<uint8_t*>(a)), size(s) {}
+
+  static void free(void* buf, void* userData) {
+    static_cast<Mapping*>(userData)->unref();
+  }
+
+  void unref() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      ::munmap(addr, size);
+      delete this;
+    }
+  }
+
+  uint8_t* const addr;
+  const size_t size;
+  std::atomic<size_t> refs{1};
+};
+#endif
+
+ZeroCopyReader::ZeroCopyReader(size_t mapSize) : mapSize_(mapSize) {
+#ifdef WANGLE_HAVE_TCP_ZEROCOPY_RECEIVE
+  static const size_t pageSize = sysconf(_SC_PAGESIZE);
+  CHECK(mapSize_ >= pageSize && mapSize_ % pageSize == 0)
+    << "map size has to be a multiple of the page size";
+#endif
+}
+
+ZeroCopyReader::~ZeroCopyReader() {
+  cancelLoopCallback();
+#ifdef WANGLE_HAVE_TCP_ZEROCOPY_RECEIVE
+  if (mapping_) {
+    mapping_->unref();
+  }
+#endif
+}
+
+bool ZeroCopyReader::map(AsyncSocket* socket) {
+#ifdef WANGLE_HAVE_TCP_ZEROCOPY_RECEIVE
+  auto addr = ::mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED,
+                     socket->getFd(), 0);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  if (mapping_) {
+    mapping_->unref();
+  }
+  mapping_ = new Mapping(addr, mapSize_);
+  offset_ = 0;
+  stats_.mappings++;
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool ZeroCopyReader::enable(AsyncSocket* socket) {
+#ifdef WANGLE_HAVE_TCP_ZEROCOPY_RECEIVE
+  if (dynamic_cast<AsyncSSLSocket*>(socket)) {
+    return false;
+  }
+  // Fails with ENODEV on kernels that can't map TCP sockets
+  if (!map(socket)) {
+    PLOG(WARNING) << "Unable to map TCP socket for zero-copy receives";
+    return false;
+  }
+  enabled_ = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+size_t ZeroCopyReader::receive(AsyncSocket* socket, IOBufQueue& q) {
+#ifdef WANGLE_HAVE_TCP_ZEROCOPY_RECEIVE
+  DCHECK(enabled_);
+  if (mapping_->refs.load(std::memory_order_acquire) == 1) {
+    // Nothing received before is still in use, so it can be mapped over;
+    // the kernel swaps the pages there for the new ones
+    offset_ = 0;
+  } else if (offset_ == mapSize_ && !map(socket)) {
+    return 0;
+  }
+  auto addr = mapping_->addr + offset_;
+  ZeroCopyReceive zc = {};
+  zc.address = reinterpret_cast<uint64_t>(addr);
+  zc.length = mapSize_ - offset_;
+  socklen_t len = sizeof(zc);
+  if (getsockopt(socket->getFd(), IPPROTO_TCP, TCP_ZEROCOPY_RECEIVE,
+                 &zc, &len) != 0) {
+    if (errno == EAGAIN) {
+      return 0;
+    }
+    // Leave it all to plain reads from now on
+    PLOG(WARNING) << "Zero-copy receive failed";
+    enabled_ = false;
+    return 0;
+  }
+  // Only whole pages are mapped, so the offset stays page-aligned
+  if (zc.length > 0) {
+    mapping_->refs.fetch_add(1, std::memory_order_relaxed);
+    offset_ += zc.length;
+    // No tailroom, and shared, so nothing ever writes to the mapping
+    auto buf = IOBuf::takeOwnership(
+        addr, zc.length, zc.length, &Mapping::free, mapping_);
+    buf->markExternallyShared();
+    q.append(std::move(buf));
+    stats_.mappedBytes += zc.length;
+    globalMappedBytes.fetch_add(zc.length, std::memory_order_relaxed);
+    if (!mapped_) {
+      mapped_ = true;
+      socket->getEventBase()->runInLoop(this);
+    }
+  }
+  stats_.copiedBytes += zc.recv_skip_hint;
+  globalCopiedBytes.fetch_add(zc.recv_skip_hint, std::memory_order_relaxed);
+  return zc.recv_skip_hint;
+#else
+  return 0;
+#endif
+}
+
+bool ZeroCopyReader::takeMapped() {
+  if (!mapped_) {
+    return false;
+  }
+  mapped_ = false;
+  cancelLoopCallback();
+  return true;
+}
+
+void ZeroCopyReader::runLoopCallback() noexcept {
+  if (takeMapped() && onMapped_) {
+    onMapped_();
+  }
+}
+
+ZeroCopyReader::Stats ZeroCopyReader::getGlobalStats() {
+  Stats stats;
+  stats.mappedBytes = globalMappedBytes.load(std::memory_order_relaxed);
+  stats.copiedBytes = globalCopiedBytes.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}} // namespace folly::wangle
@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/EventBase.h>
+
+#include <cstdint>
+#include <functional>
+
+namespace folly { namespace wangle {
+
+/**
+ * Receives the page-aligned bulk of what arrives on a TCP socket with
+ * TCP_ZEROCOPY_RECEIVE, which maps the received pages into the process
+ * instead of copying them.  Receives map into one region of mapSize
+ * bytes, each after the last, and the IOBufs they make keep the region
+ * mapped.  Once none of those is left, the next receive maps over the
+ * region from its start again; only a region that fills up while still in
+ * use is left to its IOBufs, to be unmapped with the last of them, for a
+ * fresh one.  Whatever isn't a whole page of payload, e.g. the unaligned
+ * head of a message or a short tail, has to be read the usual way first;
+ * receive() says how much.
+ *
+ * Mapped pages are read-only, so their IOBufs are marked shared, and
+ * anything modifying them has to unshare() them first.  Needs Linux 4.18;
+ * elsewhere, and for encrypted sockets, enable() returns false.
+ */
+class ZeroCopyReader : private EventBase::LoopCallback {
+ public:
+  // Most mapped by one receive
+  static const size_t kDefaultMapSize = 1024 * 1024;
+
+  struct Stats {
+    uint64_t mappedBytes{0};
+    // The bytes receive() asked to be read the usual way
+    uint64_t copiedBytes{0};
+    // Regions mapped
+    uint64_t mappings{0};
+  };
+
+  explicit ZeroCopyReader(size_t mapSize = kDefaultMapSize);
+  ~ZeroCopyReader();
+
+  /**
+   * Delivers what was mapped when no read follows in the same event, e.g.
+   * as the rest of the data is page-aligned too.  Set it once the owner is
+   * where it stays, as it usually points back at it.
+   */
+  void setOnMapped(std::function<void()> onMapped) {
+    onMapped_ = std::move(onMapped);
+  }
+
+  // False if socket can't be read from this way
+  bool enable(AsyncSocket* socket);
+
+  bool isEnabled() const {
+    return enabled_;
+  }
+
+  size_t getMapSize() const {
+    return mapSize_;
+  }
+
+  /**
+   * Maps what has been received on socket into IOBufs at the end of q.
+   * Returns the number of bytes to read with a plain read before the next
+   * receive, 0 if none.
+   */
+  size_t receive(AsyncSocket* socket, IOBufQueue& q);
+
+  // Mapped data was delivered along with a read, or has to be now
+  bool takeMapped();
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+  // Of all readers in the process
+  static Stats getGlobalStats();
+
+ private:
+  struct Mapping;
+
+  void runLoopCallback() noexcept override;
+
+  // Replaces the region received into with a fresh one
+  bool map(AsyncSocket* socket);
+
+  std::function<void()> onMapped_;
+  const size_t mapSize_;
+  Mapping* mapping_{nullptr};
+  // Where the next receive maps to in the region
+  size_t offset_{0};
+  bool enabled_{false};
+  // Mapped data not delivered yet
+  bool mapped_{false};
+  Stats stats_;
+};
+
+}} // namespace folly::wangle
@@ -0,0 +1,517 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/ZeroCopyWriter.h>
+
+#include <folly/FileUtil.h>
+#include <folly/Optional.h>
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventHandler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/version.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+#include <linux/errqueue.h>
+#define WANGLE_HAVE_MSG_ZEROCOPY 1
+// Older C libraries don't have these yet
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#endif
+#endif
+
+namespace folly { namespace wangle {
+
+namespace {
+
+std::atomic<uint64_t> globalZeroCopyBytes{0};
+std::atomic<uint64_t> globalFallbackBytes{0};
+
+// Send sequence numbers wrap
+bool seqReached(uint32_t completed, uint32_t seq) {
+  return int32_t(completed - seq) >= 0;
+}
+
+AsyncSocketException writerGone() {
+  return AsyncSocketException(
+      AsyncSocketException::AsyncSocketExceptionType::NOT_OPEN,
+      "zero-copy writer is gone");
+}
+
+// How often a socket left with held writes is checked for being closed
+const std::chrono::milliseconds kCloseCheckInterval(1000);
+
+} // namespace
+
+struct ZeroCopyWriter::State {
+  // A write the kernel may still be sending from
+  struct Held {
+    // One past the sequence number of its last zero-copy send
+    uint32_t endSeq;
+    std::unique_ptr<IOBuf> buf;
+    Optional<Promise<Unit>> promise;
+    uint64_t zeroCopyBytes;
+  };
+
+  // Woken up as the kernel adds to the error queue, through an epoll set
+  // of its own that has the socket in it for errors only
+  class Watcher : public EventHandler {
+   public:
+    explicit Watcher(State* state) : state_(state) {}
+
+    void handlerReady(uint16_t events) noexcept override {
+      state_->onErrorQueue();
+    }
+
+   private:
+    State* const state_;
+  };
+
+  // Once the writer is gone, as the socket stops reporting completions
+  // when it is closed
+  class CloseCheck : public AsyncTimeout {
+   public:
+    CloseCheck(EventBase* evb, State* state)
+        : AsyncTimeout(evb), state_(state) {}
+
+    void timeoutExpired() noexcept override {
+      state_->checkOrphaned();
+    }
+
+   private:
+    State* const state_;
+  };
+
+  ~State() {
+    if (epollFd != -1) {
+      closeNoInt(epollFd);
+    }
+  }
+
+  void addZeroCopy(uint64_t bytes) {
+    stats.zeroCopyBytes += bytes;
+    globalZeroCopyBytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  void addFallback(uint64_t bytes) {
+    stats.fallbackBytes += bytes;
+    globalFallbackBytes.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  // The kernel is done with the sends before end
+  void complete(uint32_t end, bool copied) {
+    if (seqReached(completedSeq, end)) {
+      return;
+    }
+    completedSeq = end;
+    while (!held.empty() && seqReached(completedSeq, held.front().endSeq)) {
+      auto write = std::move(held.front());
+      held.pop_front();
+      if (copied) {
+        addFallback(write.zeroCopyBytes);
+      } else {
+        addZeroCopy(write.zeroCopyBytes);
+      }
+      if (write.promise) {
+        write.promise->setValue();
+      }
+    }
+  }
+
+  bool watch(std::shared_ptr<AsyncSocket> s) {
+#ifdef WANGLE_HAVE_MSG_ZEROCOPY
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd == -1) {
+      return false;
+    }
+    // Edge-triggered, as the socket may stay hung up, with EPOLLERR and
+    // EPOLLHUP, which are always reported
+    struct epoll_event ev = {};
+    ev.events = EPOLLET;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, s->getFd(), &ev) != 0) {
+      closeNoInt(epollFd);
+      epollFd = -1;
+      return false;
+    }
+    socket = std::move(s);
+    if (socket->getEventBase()) {
+      attach(socket->getEventBase());
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void attach(EventBase* evb) {
+    if (epollFd != -1 && !closed && !watcher.isHandlerRegistered()) {
+      watcher.initHandler(evb, epollFd);
+      watcher.registerHandler(EventHandler::READ | EventHandler::PERSIST);
+    }
+  }
+
+  void detach() {
+    watcher.unregisterHandler();
+    watcher.detachEventBase();
+  }
+
+  void onErrorQueue() {
+#ifdef WANGLE_HAVE_MSG_ZEROCOPY
+    // Takes the event, which rearms the edge; there is none once the
+    // socket is closed, as that takes it out of the set
+    struct epoll_event ev;
+    if (epoll_wait(epollFd, &ev, 1, 0) <= 0 || socket->getFd() == -1) {
+      return;
+    }
+    drain();
+    if (self && idle()) {
+      stop();
+    }
+#endif
+  }
+
+  // Reads the error queue for completions; anything else on it is passed
+  // to ackLatency
+  void drain() {
+#ifdef WANGLE_HAVE_MSG_ZEROCOPY
+    while (true) {
+      char control[512];
+      struct msghdr msg = {};
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (recvmsg(socket->getFd(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        return;
+      }
+      const struct sock_extended_err* err = nullptr;
+      for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if ((cmsg->cmsg_level == IPPROTO_IP &&
+             cmsg->cmsg_type == IP_RECVERR) ||
+            (cmsg->cmsg_level == IPPROTO_IPV6 &&
+             cmsg->cmsg_type == IPV6_RECVERR)) {
+          err = reinterpret_cast<const struct sock_extended_err*>(
+            CMSG_DATA(cmsg));
+        }
+      }
+      if (err && err->ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+        // Sends ee_info through ee_data are done
+        complete(err->ee_data + 1, err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+      } else if (ackLatency) {
+        ackLatency->onErrorMessage(msg);
+      }
+    }
+#endif
+  }
+
+  // Nothing the kernel may still be sending from
+  bool idle() const {
+    return held.empty() && inFlight == 0;
+  }
+
+  // The writer is gone; keeps watching, and itself alive, for as long as
+  // the kernel may be sending from buffers
+  void orphan(std::shared_ptr<State> me) {
+    ackLatency = nullptr;
+    if (idle() || !socket || !socket->good() ||
+        !watcher.isHandlerRegistered()) {
+      stop();
+      return;
+    }
+    self = std::move(me);
+    closeCheck.reset(new CloseCheck(socket->getEventBase(), this));
+    closeCheck->scheduleTimeout(kCloseCheckInterval);
+  }
+
+  void checkOrphaned() {
+    if (idle() || !socket->good()) {
+      stop();
+    } else {
+      closeCheck->scheduleTimeout(kCloseCheckInterval);
+    }
+  }
+
+  // Frees what is held: no completion is coming for it anymore.  May
+  // destroy this.
+  void stop() {
+    closed = true;
+    if (watcher.isHandlerRegistered()) {
+      detach();
+    }
+    auto writes = std::move(held);
+    for (auto& write : writes) {
+      if (write.promise) {
+        write.promise->setException(writerGone());
+      }
+    }
+    closeCheck.reset();
+    socket.reset();
+    auto me = std::move(self);
+  }
+
+  // No more completions are read: the writer is gone, and so is the
+  // socket or what it held
+  bool closed{false};
+  // The sequence number of the next zero-copy send on the socket
+  uint32_t nextSeq{0};
+  // All sends before this one are complete
+  uint32_t completedSeq{0};
+  std::deque<Held> held;
+  // Writes the socket hasn't finished with
+  size_t inFlight{0};
+  Stats stats;
+  std::shared_ptr<AsyncSocket> socket;
+  AckLatencyTracker* ackLatency{nullptr};
+  int epollFd{-1};
+  Watcher watcher{this};
+  std::unique_ptr<CloseCheck> closeCheck;
+  // Set once orphaned
+  std::shared_ptr<State> self;
+};
+
+/**
+ * One write, which is also its own callback.  The AsyncSocket destroys a
+ * request before calling back, so it hands its buffer over to the writer
+ * once both have happened.
+ */
+class ZeroCopyWriter::Write : private AsyncSocket::WriteCallback,
+                              public AsyncSocket::WriteRequest {
+ public:
+  Write(AsyncSocket* socket,
+        std::shared_ptr<State> state,
+        std::unique_ptr<IOBuf> buf,
+        WriteFlags flags)
+      : WriteRequest(socket, this),
+        state_(std::move(state)),
+        buf_(std::move(buf)),
+        length_(buf_->computeChainDataLength()),
+        more_(isSet(flags, WriteFlags::CORK)) {
+    auto iov = buf_->getIov();
+    iov_.assign(iov.begin(), iov.end());
+    promise_.emplace();
+    state_->inFlight++;
+  }
+
+  Future<Unit> getFuture() {
+    return promise_->getFuture();
+  }
+
+  void destroy() override {
+    destroyed_ = true;
+    finish();
+  }
+
+  bool performWrite() override;
+
+  void consume() override {
+    // do nothing
+  }
+
+  bool isComplete() override {
+    return totalBytesWritten_ == length_;
+  }
+
+ private:
+  static const size_t kMaxIovecs = 64;
+
+  void writeSuccess() noexcept override {
+    calledBack_ = true;
+    finish();
+  }
+
+  void writeErr(size_t bytesWritten,
+                const AsyncSocketException& ex) noexcept override {
+    promise_->setException(ex);
+    promise_.clear();
+    calledBack_ = true;
+    finish();
+  }
+
+  void finish();
+
+  std::shared_ptr<State> state_;
+  // Untouched while being sent, as the kernel may reference any of it
+  std::unique_ptr<IOBuf> buf_;
+  std::vector<iovec> iov_;
+  // The first of iov_ not completely sent
+  size_t index_{0};
+  const size_t length_;
+  const bool more_;
+  Optional<Promise<Unit>> promise_;
+  uint64_t zeroCopyBytes_{0};
+  uint64_t copiedBytes_{0};
+  bool destroyed_{false};
+  bool calledBack_{false};
+};
+
+bool ZeroCopyWriter::Write::performWrite() {
+#ifdef WANGLE_HAVE_MSG_ZEROCOPY
+  while (index_ < iov_.size()) {
+    size_t n = std::min(iov_.size() - index_, size_t(kMaxIovecs));
+    int more = more_ || index_ + n < iov_.size() ? MSG_MORE : 0;
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov_[index_];
+    msg.msg_iovlen = n;
+    bool zeroCopy = true;
+    ssize_t sent = ::sendmsg(socket_->getFd(), &msg,
+                             MSG_NOSIGNAL | MSG_ZEROCOPY | more);
+    if (sent == -1 && errno == ENOBUFS) {
+      // Out of the memory zero-copy sends are accounted against
+      zeroCopy = false;
+      sent = ::sendmsg(socket_->getFd(), &msg, MSG_NOSIGNAL | more);
+    }
+    if (sent == -1) {
+      return errno == EAGAIN;
+    }
+    if (zeroCopy) {
+      zeroCopyBytes_ += sent;
+      state_->nextSeq++;
+    } else {
+      copiedBytes_ += sent;
+    }
+    bytesWritten(sent);
+    size_t left = sent;
+    while (left > 0) {
+      auto& iov = iov_[index_];
+      if (left < iov.iov_len) {
+        iov.iov_base = static_cast<uint8_t*>(iov.iov_base) + left;
+        iov.iov_len -= left;
+        break;
+      }
+      left -= iov.iov_len;
+      index_++;
+    }
+    while (index_ < iov_.size() && iov_[index_].iov_len == 0) {
+      index_++;
+    }
+  }
+  return true;
+#else
+  errno = ENOTSUP;
+  return false;
+#endif
+}
+
+void ZeroCopyWriter::Write::finish() {
+  if (!destroyed_ || !calledBack_) {
+    return;
+  }
+  state_->inFlight--;
+  state_->addFallback(copiedBytes_);
+  if (state_->closed) {
+    if (promise_) {
+      promise_->setException(writerGone());
+    }
+  } else if (zeroCopyBytes_ == 0 ||
+             seqReached(state_->completedSeq, state_->nextSeq)) {
+    state_->addZeroCopy(zeroCopyBytes_);
+    if (promise_) {
+      promise_->setValue();
+    }
+  } else {
+    state_->held.push_back(State::Held{
+        state_->nextSeq, std::move(buf_), std::move(promise_),
+        zeroCopyBytes_});
+  }
+  auto state = std::move(state_);
+  delete this;
+  if (state->self && !state->closed && state->idle()) {
+    state->stop();
+  }
+}
+
+ZeroCopyWriter::ZeroCopyWriter(size_t threshold)
+    : threshold_(threshold), state_(std::make_shared<State>()) {}
+
+ZeroCopyWriter::~ZeroCopyWriter() {
+  // The kernel pins the pages it is sending from, but freed memory is
+  // reused, and what it is reused for would go out instead
+  state_->orphan(state_);
+}
+
+bool ZeroCopyWriter::enable(std::shared_ptr<AsyncSocket> socket) {
+#ifdef WANGLE_HAVE_MSG_ZEROCOPY
+  if (dynamic_cast<AsyncSSLSocket*>(socket.get())) {
+    return false;
+  }
+  int on = 1;
+  if (setsockopt(socket->getFd(), SOL_SOCKET, SO_ZEROCOPY,
+                 &on, sizeof(on)) != 0) {
+    PLOG(WARNING) << "Unable to enable zero-copy sends";
+    return false;
+  }
+  if (!state_->watch(std::move(socket))) {
+    PLOG(WARNING) << "Unable to watch the error queue for zero-copy sends";
+    return false;
+  }
+  enabled_ = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void ZeroCopyWriter::attachEventBase(EventBase* evb) {
+  state_->attach(evb);
+}
+
+void ZeroCopyWriter::detachEventBase() {
+  if (state_->watcher.isHandlerRegistered()) {
+    state_->detach();
+  }
+}
+
+Future<Unit> ZeroCopyWriter::write(AsyncSocket* socket,
+                                   std::unique_ptr<IOBuf> buf,
+                                   WriteFlags flags) {
+  DCHECK(enabled_);
+  auto write = new Write(socket, state_, std::move(buf), flags);
+  auto future = write->getFuture();
+  socket->writeRequest(write);
+  return future;
+}
+
+void ZeroCopyWriter::onFallback(uint64_t bytes) {
+  state_->addFallback(bytes);
+}
+
+void ZeroCopyWriter::setAckLatencyTracker(AckLatencyTracker* ackLatency) {
+  state_->ackLatency = ackLatency;
+}
+
+size_t ZeroCopyWriter::getHeldWrites() const {
+  return state_->held.size();
+}
+
+const ZeroCopyWriter::Stats& ZeroCopyWriter::getStats() const {
+  return state_->stats;
+}
+
+ZeroCopyWriter::Stats ZeroCopyWriter::getGlobalStats() {
+  Stats stats;
+  stats.zeroCopyBytes = globalZeroCopyBytes.load(std::memory_order_relaxed);
+  stats.fallbackBytes = globalFallbackBytes.load(std::memory_order_relaxed);
+  return stats;
+}
+
+}} // namespace folly::wangle
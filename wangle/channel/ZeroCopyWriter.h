@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/futures/Future.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <wangle/channel/AckLatencyTracker.h>
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+
+namespace folly { namespace wangle {
+
+/**
+ * Sends the large writes of a socket with MSG_ZEROCOPY, so the kernel
+ * transmits straight from the IOBufs instead of copying them.  Each write
+ * is queued on the AsyncSocket like any other (see
+ * AsyncSocket::writeRequest()), so it stays in order with the socket's
+ * other writes.  Its buffer is held, and its future left pending, until
+ * the kernel reports on the socket's error queue that it's done with the
+ * pages.  The error queue is watched on the socket's EventBase, whether
+ * or not the socket is being read, so follow the socket with
+ * attachEventBase() and detachEventBase().
+ *
+ * Buffers outlive the writer: once it is destroyed, those the kernel may
+ * still be sending from are kept, along with the socket, until their
+ * completions arrive or the socket is closed.  Their futures fail then, if
+ * not completed.  Needs Linux 4.14; elsewhere, and for encrypted sockets,
+ * enable() returns false and writes should go the usual way.
+ */
+class ZeroCopyWriter {
+ public:
+  // Below this, copying is cheaper than pinning pages and the completion
+  static const size_t kDefaultThreshold = 32 * 1024;
+
+  struct Stats {
+    // Sent from the buffers
+    uint64_t zeroCopyBytes{0};
+    // Copied, as the write was small, the kernel was short of memory for
+    // zero-copy sends, or it copied them anyway (e.g. over loopback)
+    uint64_t fallbackBytes{0};
+  };
+
+  explicit ZeroCopyWriter(size_t threshold = kDefaultThreshold);
+  ~ZeroCopyWriter();
+
+  ZeroCopyWriter(const ZeroCopyWriter&) = delete;
+  ZeroCopyWriter& operator=(const ZeroCopyWriter&) = delete;
+
+  // Turns on SO_ZEROCOPY for socket, false if it can't be used
+  bool enable(std::shared_ptr<AsyncSocket> socket);
+
+  // Where the socket's EventBase goes, so does the error queue's watch
+  void attachEventBase(EventBase* evb);
+  void detachEventBase();
+
+  bool isEnabled() const {
+    return enabled_;
+  }
+
+  size_t getThreshold() const {
+    return threshold_;
+  }
+
+  // Queues buf on the socket; done once the kernel is done with it
+  Future<Unit> write(AsyncSocket* socket,
+                     std::unique_ptr<IOBuf> buf,
+                     WriteFlags flags = WriteFlags::NONE);
+
+  // Counts a write sent the usual way, e.g. as it was below the threshold
+  void onFallback(uint64_t bytes);
+
+  /**
+   * Passes what else is read from the error queue to ackLatency, as the
+   * queue is shared; null for none.  It must outlive the writer, or be
+   * unset first.
+   */
+  void setAckLatencyTracker(AckLatencyTracker* ackLatency);
+
+  // The writes that are sent but still hold their buffer
+  size_t getHeldWrites() const;
+
+  const Stats& getStats() const;
+
+  // Of all writers in the process
+  static Stats getGlobalStats();
+
+ private:
+  class Write;
+  struct State;
+
+  const size_t threshold_;
+  bool enabled_{false};
+  std::shared_ptr<State> state_;
+};
+
+}} // namespace folly::wangle
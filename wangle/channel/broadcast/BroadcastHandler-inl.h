@@ -5,12 +5,25 @@ namespace folly { namespace wangle {
 
 template <typename T>
 void BroadcastHandler<T>::read(Context* ctx, folly::IOBufQueue& q) {
+  // Every subscriber gets the same data
   T data;
-  if (processRead(q, data)) {
-    forEachSubscriber([&](Subscriber<T>* s) {
-      s->onNext(data);
-    });
+  if (!processRead(q, data)) {
+    return;
+  }
+  if (historyMaxMessages_ == 0 && historyMaxBytes_ == 0) {
+    broadcast(data);
+    return;
   }
+  auto retained = std::make_shared<T>(std::move(data));
+  broadcast(*retained);
+  addToHistory(std::move(retained));
+}
+
+template <typename T>
+void BroadcastHandler<T>::broadcast(const T& data) {
+  forEachSubscriber([&](Subscriber<T>* s) {
+    s->onNext(data);
+  });
 }
 
 template <typename T>
@@ -18,7 +31,8 @@ void BroadcastHandler<T>::readEOF(Context* ctx) {
   forEachSubscriber([&](Subscriber<T>* s) {
     s->onCompleted();
   });
-  subscribers_.clear();
+  subscribers_ = std::make_shared<Subscribers>();
+  numSubscribers_ = 0;
 
   // This will delete the broadcast from the pool
   close(ctx);
@@ -33,7 +47,8 @@ void BroadcastHandler<T>::readException(Context* ctx,
   forEachSubscriber([&](Subscriber<T>* s) {
     s->onError(ex);
   });
-  subscribers_.clear();
+  subscribers_ = std::make_shared<Subscribers>();
+  numSubscribers_ = 0;
 
   // This will delete the broadcast from the pool
   close(ctx);
@@ -42,14 +57,135 @@ void BroadcastHandler<T>::readException(Context* ctx,
 template <typename T>
 uint64_t BroadcastHandler<T>::subscribe(Subscriber<T>* subscriber) {
   auto subscriptionId = nextSubscriptionId_++;
-  subscribers_[subscriptionId] = subscriber;
+  getMutableSubscribers().emplace_back(subscriptionId, subscriber);
+  numSubscribers_++;
   return subscriptionId;
 }
 
+template <typename T>
+uint64_t BroadcastHandler<T>::subscribe(Subscriber<T>* subscriber,
+                                       BroadcastReplay replay) {
+  auto subscriptionId = subscribe(subscriber);
+  auto first = history_.end();
+  switch (replay) {
+    case BroadcastReplay::NONE:
+      break;
+    case BroadcastReplay::ALL:
+      first = history_.begin();
+      break;
+    case BroadcastReplay::LATEST_START:
+      for (auto it = history_.rbegin(); it != history_.rend(); ++it) {
+        if (isReplayStart(*it->data)) {
+          first = std::prev(it.base());
+          break;
+        }
+      }
+      break;
+  }
+  if (first == history_.end()) {
+    return subscriptionId;
+  }
+
+  // The subscriber may leave, or have more broadcast, while it catches up
+  auto ctx = getContext();
+  DelayedDestruction::DestructorGuard dg(ctx ? ctx->getPipeline() : nullptr);
+  std::vector<std::shared_ptr<T>> replayed;
+  replayed.reserve(std::distance(first, history_.end()));
+  for (auto it = first; it != history_.end(); ++it) {
+    replayed.push_back(it->data);
+  }
+  for (const auto& data : replayed) {
+    if (!isSubscribed(subscriptionId)) {
+      break;
+    }
+    subscriber->onNext(*data);
+  }
+  return subscriptionId;
+}
+
+template <typename T>
+void BroadcastHandler<T>::setHistory(size_t maxMessages, uint64_t maxBytes) {
+  historyMaxMessages_ = maxMessages;
+  historyMaxBytes_ = maxBytes;
+  if (maxMessages == 0 && maxBytes == 0) {
+    history_.clear();
+    historyBytes_ = 0;
+  }
+}
+
+template <typename T>
+void BroadcastHandler<T>::addToHistory(std::shared_ptr<T> data) {
+  auto bytes = getDataSize(*data);
+  history_.push_back(Retained{std::move(data), bytes});
+  historyBytes_ += bytes;
+  while (!history_.empty() &&
+         ((historyMaxMessages_ > 0 &&
+           history_.size() > historyMaxMessages_) ||
+          (historyMaxBytes_ > 0 && historyBytes_ > historyMaxBytes_))) {
+    historyBytes_ -= history_.front().bytes;
+    history_.pop_front();
+  }
+}
+
+namespace detail {
+
+template <typename Subscribers>
+typename Subscribers::iterator findSubscriber(
+    Subscribers& subscribers, uint64_t subscriptionId) {
+  auto it = std::lower_bound(
+    subscribers.begin(), subscribers.end(), subscriptionId,
+    [](const typename Subscribers::value_type& s, uint64_t id) {
+      return s.first < id;
+    });
+  if (it != subscribers.end() && it->first == subscriptionId &&
+      it->second) {
+    return it;
+  }
+  return subscribers.end();
+}
+
+} // namespace detail
+
+template <typename T>
+bool BroadcastHandler<T>::isSubscribed(uint64_t subscriptionId) const {
+  return detail::findSubscriber(*subscribers_, subscriptionId) !=
+    subscribers_->end();
+}
+
+template <typename T>
+typename BroadcastHandler<T>::Subscribers&
+BroadcastHandler<T>::getMutableSubscribers() {
+  if (subscribers_.use_count() > 1) {
+    subscribers_ = std::make_shared<Subscribers>(compact(*subscribers_));
+  }
+  return *subscribers_;
+}
+
+template <typename T>
+typename BroadcastHandler<T>::Subscribers
+BroadcastHandler<T>::compact(const Subscribers& subscribers) {
+  Subscribers compacted;
+  compacted.reserve(subscribers.size());
+  for (const auto& it : subscribers) {
+    if (it.second) {
+      compacted.push_back(it);
+    }
+  }
+  return compacted;
+}
+
 template <typename T>
 void BroadcastHandler<T>::unsubscribe(uint64_t subscriptionId) {
-  subscribers_.erase(subscriptionId);
-  if (subscribers_.empty()) {
+  auto& subscribers = getMutableSubscribers();
+  auto it = detail::findSubscriber(subscribers, subscriptionId);
+  if (it != subscribers.end()) {
+    it->second = nullptr;
+    numSubscribers_--;
+    if (subscribers.size() - numSubscribers_ > numSubscribers_) {
+      subscribers = compact(subscribers);
+    }
+  }
+  if (numSubscribers_ == 0) {
     // No more subscribers. Clean up.
     // This will delete the broadcast from the pool.
     close(getContext());
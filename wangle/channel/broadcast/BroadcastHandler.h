@@ -6,8 +6,21 @@
 #include <wangle/channel/Pipeline.h>
 #include <wangle/channel/broadcast/Subscriber.h>
 
+#include <algorithm>
+#include <deque>
+#include <vector>
+
 namespace folly { namespace wangle {
 
+// What a new subscriber gets of a BroadcastHandler's history
+enum class BroadcastReplay {
+  NONE,
+  // Everything retained
+  ALL,
+  // From the latest retained data that isReplayStart()
+  LATEST_START,
+};
+
 /**
  * An Observable type handler for broadcasting/streaming data to a list
  * of subscribers.
@@ -16,7 +29,7 @@ template <typename T>
 class BroadcastHandler : public BytesToBytesHandler {
  public:
   virtual ~BroadcastHandler() {
-    CHECK(subscribers_.empty());
+    CHECK_EQ(0, numSubscribers_);
   }
 
   // BytesToBytesHandler implementation
@@ -30,6 +43,13 @@ class BroadcastHandler : public BytesToBytesHandler {
    */
   virtual uint64_t subscribe(Subscriber<T>* subscriber);
 
+  /**
+   * Subscribes, and first hands the subscriber what was broadcast before
+   * according to replay, so a late joiner needn't ask the upstream for a
+   * snapshot.  See setHistory().
+   */
+  uint64_t subscribe(Subscriber<T>* subscriber, BroadcastReplay replay);
+
   /**
    * Unsubscribe from the broadcast. Closes the pipeline if the
    * number of subscribers reaches zero.
@@ -45,18 +65,85 @@ class BroadcastHandler : public BytesToBytesHandler {
    */
   virtual bool processRead(folly::IOBufQueue& q, T& data) = 0;
 
+  /**
+   * Retains the last maxMessages broadcasts, and no more than maxBytes of
+   * them by getDataSize(), for replay to new subscribers.  The data is
+   * shared with the subscribers it was broadcast to, not copied.  0 for
+   * either means no bound on it; both 0, the default, retains nothing.
+   */
+  void setHistory(size_t maxMessages, uint64_t maxBytes = 0);
+
+  size_t getHistoryLength() const {
+    return history_.size();
+  }
+
+  // Bytes of data for the maxBytes of setHistory(); IOBuf chain lengths
+  // by default, and 0 for other types
+  virtual uint64_t getDataSize(const T& data) {
+    return dataSize(data);
+  }
+
+  // Whether a subscriber can start from data, such as a keyframe or a
+  // snapshot, for BroadcastReplay::LATEST_START
+  virtual bool isReplayStart(const T& data) {
+    return true;
+  }
+
  protected:
+  // Subscribers that come and go in f are seen from the next call on
   template <typename FUNC> // FUNC: Subscriber<T>* -> void
   void forEachSubscriber(FUNC f) {
-    auto subscribers = subscribers_;
-    for (const auto& it : subscribers) {
-      f(it.second);
+    std::shared_ptr<const Subscribers> subscribers = subscribers_;
+    for (const auto& it : *subscribers) {
+      if (it.second) {
+        f(it.second);
+      }
     }
   }
 
  private:
-  std::map<uint64_t, Subscriber<T>*> subscribers_;
+  void broadcast(const T& data);
+
+  void addToHistory(std::shared_ptr<T> data);
+
+  bool isSubscribed(uint64_t subscriptionId) const;
+
+  typedef std::vector<std::pair<uint64_t, Subscriber<T>*>> Subscribers;
+
+  // Copies the list first if a broadcast is going through it
+  Subscribers& getMutableSubscribers();
+  // Drops the entries of those who left
+  static Subscribers compact(const Subscribers& subscribers);
+
+  template <typename U>
+  static uint64_t dataSize(const U&) {
+    return 0;
+  }
+
+  static uint64_t dataSize(const std::unique_ptr<folly::IOBuf>& buf) {
+    return buf ? buf->computeChainDataLength() : 0;
+  }
+
+  // In subscription ID order.  A broadcast just holds on to the current
+  // list; subscribe and unsubscribe only copy it while one does, and
+  // otherwise change it in place.  Those who unsubscribe are left as null
+  // entries until they outnumber the subscribers, so a run of
+  // unsubscribes doesn't shift the list for each one.
+  std::shared_ptr<Subscribers> subscribers_{
+    std::make_shared<Subscribers>()};
+  size_t numSubscribers_{0};
   uint64_t nextSubscriptionId_{0};
+
+  struct Retained {
+    std::shared_ptr<T> data;
+    uint64_t bytes;
+  };
+
+  size_t historyMaxMessages_{0};
+  uint64_t historyMaxBytes_{0};
+  // Oldest first
+  std::deque<Retained> history_;
+  uint64_t historyBytes_{0};
 };
 
 template <typename T>
@@ -85,6 +172,20 @@ class BroadcastPipelineFactory
     return pipeline;
   }
 
+  /**
+   * A pipeline fed by transportHandler instead of a socket, such as the
+   * MirrorHandler of a shared upstream.
+   */
+  DefaultPipeline::UniquePtr newMirrorPipeline(
+      std::shared_ptr<BytesToBytesHandler> transportHandler) {
+    DefaultPipeline::UniquePtr pipeline(new DefaultPipeline);
+    pipeline->addBack(transportHandler);
+    pipeline->addBack(handlerFactory_->newHandler());
+    pipeline->finalize();
+
+    return pipeline;
+  }
+
   static BroadcastHandler<T>* getBroadcastHandler(DefaultPipeline* pipeline) {
     DCHECK(pipeline);
     return pipeline->getHandler<BroadcastHandler<T>>(1);
@@ -3,9 +3,9 @@
 
 namespace folly { namespace wangle {
 
-template <typename T, typename R>
+template <typename T, typename R, typename Hash>
 folly::Future<BroadcastHandler<T>*>
-BroadcastPool<T, R>::BroadcastManager::getHandler() {
+BroadcastPool<T, R, Hash>::BroadcastManager::getHandler() {
   // getFuture() returns a completed future if we are already connected
   auto future = sharedPromise_.getFuture();
 
@@ -18,6 +18,11 @@ BroadcastPool<T, R>::BroadcastManager::getHandler() {
 
   // Kickoff connect request and fulfill all pending promises on completion
   connectStarted_ = true;
+  if (pool_->sharedUpstreams_) {
+    mirrorUpstream();
+    return future;
+  }
+
   const auto& addr = pool_->getServer();
   client_.connect(addr)
       .then([this](DefaultPipeline* pipeline) {
@@ -29,21 +34,47 @@ BroadcastPool<T, R>::BroadcastManager::getHandler() {
         sharedPromise_.setValue(handler);
       })
       .onError([this](const std::exception& ex) {
-        LOG(ERROR) << "Connect error: " << ex.what();
-        auto ew = folly::make_exception_wrapper<std::exception>(ex);
-
-        // Delete the broadcast before fulfilling the promises as the
-        // futures' onError callbacks can delete the pool
-        auto sharedPromise = std::move(sharedPromise_);
-        pool_->deleteBroadcast(routingData_);
-        sharedPromise.setException(ew);
+        connectError(ex);
       });
 
   return future;
 }
 
-template <typename T, typename R>
-folly::Future<BroadcastHandler<T>*> BroadcastPool<T, R>::getHandler(
+template <typename T, typename R, typename Hash>
+void BroadcastPool<T, R, Hash>::BroadcastManager::mirrorUpstream() {
+  auto mirror =
+    pool_->sharedUpstreams_->subscribe(routingData_, pool_->getServer());
+  mirrorPipeline_ =
+    pool_->broadcastPipelineFactory_->newMirrorPipeline(mirror);
+  mirrorPipeline_->setPipelineManager(this);
+
+  mirror->getConnectedFuture()
+      .then([this]() {
+        auto handler = BroadcastPipelineFactory<T>::getBroadcastHandler(
+            mirrorPipeline_.get());
+        CHECK(handler);
+        sharedPromise_.setValue(handler);
+      })
+      .onError([this](const std::exception& ex) {
+        connectError(ex);
+      });
+}
+
+template <typename T, typename R, typename Hash>
+void BroadcastPool<T, R, Hash>::BroadcastManager::connectError(
+    const std::exception& ex) {
+  LOG(ERROR) << "Connect error: " << ex.what();
+  auto ew = folly::make_exception_wrapper<std::exception>(ex);
+
+  // Delete the broadcast before fulfilling the promises as the
+  // futures' onError callbacks can delete the pool
+  auto sharedPromise = std::move(sharedPromise_);
+  pool_->deleteBroadcast(routingData_);
+  sharedPromise.setException(ew);
+}
+
+template <typename T, typename R, typename Hash>
+folly::Future<BroadcastHandler<T>*> BroadcastPool<T, R, Hash>::getHandler(
     const R& routingData) {
   const auto& iter = broadcasts_.find(routingData);
   if (iter != broadcasts_.end()) {
@@ -4,6 +4,11 @@
 #include <folly/futures/SharedPromise.h>
 #include <wangle/bootstrap/ClientBootstrap.h>
 #include <wangle/channel/broadcast/BroadcastHandler.h>
+#include <wangle/channel/broadcast/SharedUpstreams.h>
+
+#include <map>
+#include <type_traits>
+#include <unordered_map>
 
 namespace folly { namespace wangle {
 
@@ -23,15 +28,21 @@ class ServerPool {
  * for any unique routing data. Creates and maintains upstream connections
  * and broadcast pipeliens as necessary.
  *
- * Meant to be used as a thread-local instance.
+ * Meant to be used as a thread-local instance.  With SharedUpstreams, the
+ * thread-local pools of a process share one upstream connection for each
+ * routing data, and a broadcast pipeline here mirrors it.
+ *
+ * Broadcasts are looked up in a std::map by default.  With a Hash for R,
+ * such as std::hash<std::string>, they are kept in a std::unordered_map
+ * instead, which is cheaper for a lot of long routing keys.
  */
-template <typename T, typename R>
+template <typename T, typename R, typename Hash = void>
 class BroadcastPool {
  public:
   class BroadcastManager : PipelineManager {
    public:
     BroadcastManager(
-        BroadcastPool<T, R>* pool,
+        BroadcastPool<T, R, Hash>* pool,
         const R& routingData,
         std::shared_ptr<BroadcastPipelineFactory<T>> broadcastPipelineFactory)
         : pool_(pool), routingData_(routingData) {
@@ -42,30 +53,43 @@ class BroadcastPool {
       if (client_.getPipeline()) {
         client_.getPipeline()->setPipelineManager(nullptr);
       }
+      if (mirrorPipeline_) {
+        mirrorPipeline_->setPipelineManager(nullptr);
+      }
     }
 
     folly::Future<BroadcastHandler<T>*> getHandler();
 
     // PipelineManager implementation
     void deletePipeline(PipelineBase* pipeline) override {
-      CHECK(client_.getPipeline() == pipeline);
+      CHECK(client_.getPipeline() == pipeline ||
+            mirrorPipeline_.get() == pipeline);
       pool_->deleteBroadcast(routingData_);
     }
 
    private:
-    BroadcastPool<T, R>* pool_{nullptr};
+    // Subscribes a mirror pipeline to the shared upstream
+    void mirrorUpstream();
+
+    void connectError(const std::exception& ex);
+
+    BroadcastPool<T, R, Hash>* pool_{nullptr};
     R routingData_;
     folly::ClientBootstrap<DefaultPipeline> client_;
+    // Instead of client_'s, with shared upstreams
+    DefaultPipeline::UniquePtr mirrorPipeline_;
 
     bool connectStarted_{false};
     folly::SharedPromise<BroadcastHandler<T>*> sharedPromise_;
   };
 
   BroadcastPool(std::shared_ptr<ServerPool> serverPool,
-                std::shared_ptr<BroadcastHandlerFactory<T>> handlerFactory)
+                std::shared_ptr<BroadcastHandlerFactory<T>> handlerFactory,
+                std::shared_ptr<SharedUpstreams<R>> sharedUpstreams = nullptr)
       : serverPool_(serverPool),
         broadcastPipelineFactory_(
-            std::make_shared<BroadcastPipelineFactory<T>>(handlerFactory)) {}
+            std::make_shared<BroadcastPipelineFactory<T>>(handlerFactory)),
+        sharedUpstreams_(sharedUpstreams) {}
 
   virtual ~BroadcastPool() {}
 
@@ -98,7 +122,14 @@ class BroadcastPool {
 
   std::shared_ptr<ServerPool> serverPool_;
   std::shared_ptr<BroadcastPipelineFactory<T>> broadcastPipelineFactory_;
-  std::map<R, std::unique_ptr<BroadcastManager>> broadcasts_;
+  std::shared_ptr<SharedUpstreams<R>> sharedUpstreams_;
+  typedef typename std::conditional<
+      std::is_void<Hash>::value,
+      std::map<R, std::unique_ptr<BroadcastManager>>,
+      std::unordered_map<R, std::unique_ptr<BroadcastManager>, Hash>>::type
+      BroadcastMap;
+
+  BroadcastMap broadcasts_;
 };
 
 }} // namespace folly::wangle
@@ -3,8 +3,8 @@
 
 namespace folly { namespace wangle {
 
-template <typename R>
-void ObservingHandler<R>::transportActive(Context* ctx) {
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::transportActive(Context* ctx) {
   if (broadcastHandler_) {
     // Already connected
     return;
@@ -21,7 +21,7 @@ void ObservingHandler<R>::transportActive(Context* ctx) {
       .then([this, pipeline](
           BroadcastHandler<std::unique_ptr<folly::IOBuf>>* broadcastHandler) {
         broadcastHandler_ = broadcastHandler;
-        subscriptionId_ = broadcastHandler_->subscribe(this);
+        subscriptionId_ = broadcastHandler_->subscribe(this, replay_);
         VLOG(10) << "Subscribed to a broadcast";
 
         // Resume ingress
@@ -33,33 +33,64 @@ void ObservingHandler<R>::transportActive(Context* ctx) {
       });
 }
 
-template <typename R>
-void ObservingHandler<R>::readEOF(Context* ctx) {
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::readEOF(Context* ctx) {
   closeHandler();
 }
 
-template <typename R>
-void ObservingHandler<R>::readException(Context* ctx,
-                                        folly::exception_wrapper ex) {
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::readException(Context* ctx,
+                                              folly::exception_wrapper ex) {
   LOG(ERROR) << "Error on read: " << exceptionStr(ex);
   closeHandler();
 }
 
-template <typename R>
-void ObservingHandler<R>::onNext(const std::unique_ptr<folly::IOBuf>& buf) {
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::writabilityChanged(Context* ctx) {
+  DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+  while (!queue_.empty() && ctx->isWritable()) {
+    auto buf = std::move(queue_.front());
+    popQueue();
+    send(std::move(buf));
+  }
+  ctx->fireWritabilityChanged();
+}
+
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::attachPipeline(Context* ctx) {
+  setWaterMarks();
+}
+
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::onNext(
+    const std::unique_ptr<folly::IOBuf>& buf) {
   if (!buf || paused_) {
     return;
   }
 
-  write(getContext(), buf->clone())
-      .onError([this](const std::exception& ex) {
-        LOG(ERROR) << "Error on write: " << ex.what();
-        closeHandler();
-      });
+  if (skipping_) {
+    if (!slowSubscriberOptions_.isKeyframe(*buf)) {
+      return;
+    }
+    skipping_ = false;
+  }
+
+  // Shares the broadcast's bytes; the write only owns the IOBuf headers
+  if (slowSubscriberOptions_.maxQueuedBytes == 0 ||
+      (queue_.empty() && getContext()->isWritable())) {
+    send(buf->clone());
+    return;
+  }
+
+  queuedBytes_ += buf->computeChainDataLength();
+  queue_.push_back(buf->clone());
+  if (queuedBytes_ > getQueueBound()) {
+    trimQueue();
+  }
 }
 
-template <typename R>
-void ObservingHandler<R>::onError(folly::exception_wrapper ex) {
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::onError(folly::exception_wrapper ex) {
   LOG(ERROR) << "Error observing a broadcast: " << exceptionStr(ex);
 
   // broadcastHandler_ will clear its subscribers and delete itself
@@ -67,15 +98,100 @@ void ObservingHandler<R>::onError(folly::exception_wrapper ex) {
   closeHandler();
 }
 
-template <typename R>
-void ObservingHandler<R>::onCompleted() {
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::onCompleted() {
   // broadcastHandler_ will clear its subscribers and delete itself
   broadcastHandler_ = nullptr;
   closeHandler();
 }
 
-template <typename R>
-void ObservingHandler<R>::closeHandler() {
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::setSlowSubscriberOptions(
+    SlowSubscriberOptions options) {
+  CHECK(options.policy != SlowSubscriberOptions::Policy::SKIP_TO_KEYFRAME ||
+        options.isKeyframe);
+  slowSubscriberOptions_ = std::move(options);
+  setWaterMarks();
+}
+
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::send(std::unique_ptr<folly::IOBuf> buf) {
+  write(getContext(), std::move(buf))
+      .onError([this](const std::exception& ex) {
+        LOG(ERROR) << "Error on write: " << ex.what();
+        closeHandler();
+      });
+}
+
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::trimQueue() {
+  const auto maxQueuedBytes = getQueueBound();
+  switch (slowSubscriberOptions_.policy) {
+    case SlowSubscriberOptions::Policy::DROP_OLDEST:
+      // The newest data is kept even if it's over the bound by itself
+      while (queuedBytes_ > maxQueuedBytes && queue_.size() > 1) {
+        popQueue();
+      }
+      break;
+    case SlowSubscriberOptions::Policy::SKIP_TO_KEYFRAME: {
+      auto keyframe = std::find_if(
+          queue_.rbegin(), queue_.rend(),
+          [this](const std::unique_ptr<folly::IOBuf>& buf) {
+            return slowSubscriberOptions_.isKeyframe(*buf);
+          });
+      auto dropped = std::distance(keyframe, queue_.rend());
+      if (keyframe != queue_.rend()) {
+        dropped--;
+      }
+      while (dropped-- > 0) {
+        popQueue();
+      }
+      if (queuedBytes_ > maxQueuedBytes || keyframe == queue_.rend()) {
+        queue_.clear();
+        queuedBytes_ = 0;
+        skipping_ = true;
+      }
+      break;
+    }
+    case SlowSubscriberOptions::Policy::DISCONNECT:
+      LOG(WARNING) << "Disconnecting a subscriber " << queuedBytes_
+                   << " bytes behind the broadcast";
+      closeHandler();
+      break;
+  }
+}
+
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::popQueue() {
+  queuedBytes_ -= queue_.front()->computeChainDataLength();
+  queue_.pop_front();
+}
+
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::setWaterMarks() {
+  auto ctx = getContext();
+  const auto maxQueuedBytes = slowSubscriberOptions_.maxQueuedBytes;
+  if (!ctx || maxQueuedBytes == 0) {
+    return;
+  }
+  auto pipeline = ctx->getPipeline();
+  if (pipeline->getWriteBufferWaterMarks().second == 0) {
+    pipeline->setWriteBufferWaterMarks(maxQueuedBytes / 4, maxQueuedBytes / 2);
+  }
+}
+
+template <typename R, typename Hash>
+uint64_t ObservingHandler<R, Hash>::getQueueBound() {
+  auto ctx = getContext();
+  const auto maxQueuedBytes = slowSubscriberOptions_.maxQueuedBytes;
+  auto high = ctx ? ctx->getPipeline()->getWriteBufferWaterMarks().second : 0;
+  return high < maxQueuedBytes ? maxQueuedBytes - high : 0;
+}
+
+template <typename R, typename Hash>
+void ObservingHandler<R, Hash>::closeHandler() {
+  queue_.clear();
+  queuedBytes_ = 0;
   if (broadcastHandler_) {
     auto broadcastHandler = broadcastHandler_;
     broadcastHandler_ = nullptr;
@@ -84,20 +200,20 @@ void ObservingHandler<R>::closeHandler() {
   close(getContext());
 }
 
-template <typename R>
-BroadcastPool<std::unique_ptr<folly::IOBuf>, R>*
-ObservingHandler<R>::broadcastPool() {
+template <typename R, typename Hash>
+BroadcastPool<std::unique_ptr<folly::IOBuf>, R, Hash>*
+ObservingHandler<R, Hash>::broadcastPool() {
   if (!broadcastPool_) {
     broadcastPool_.reset(newBroadcastPool());
   }
   return broadcastPool_.get();
 }
 
-template <typename R>
-BroadcastPool<std::unique_ptr<folly::IOBuf>, R>*
-ObservingHandler<R>::newBroadcastPool() {
-  return (new BroadcastPool<std::unique_ptr<folly::IOBuf>, R>(
-      serverPool_, broadcastHandlerFactory_));
+template <typename R, typename Hash>
+BroadcastPool<std::unique_ptr<folly::IOBuf>, R, Hash>*
+ObservingHandler<R, Hash>::newBroadcastPool() {
+  return (new BroadcastPool<std::unique_ptr<folly::IOBuf>, R, Hash>(
+      serverPool_, broadcastHandlerFactory_, sharedUpstreams_));
 }
 
 }} // namespace folly::wangle
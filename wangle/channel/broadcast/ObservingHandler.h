@@ -7,17 +7,47 @@
 #include <wangle/channel/broadcast/BroadcastPool.h>
 #include <wangle/channel/broadcast/Subscriber.h>
 
+#include <algorithm>
+#include <deque>
+#include <functional>
+
 namespace folly { namespace wangle {
 
+/**
+ * What an ObservingHandler does with the broadcast a subscriber's socket
+ * doesn't keep up with.  Data is queued while the pipeline is unwritable,
+ * and once more than maxQueuedBytes are queued or pending in the socket
+ * the policy makes room.
+ */
+struct SlowSubscriberOptions {
+  enum class Policy {
+    // Drops the oldest queued data
+    DROP_OLDEST,
+    // Drops what's queued before the latest keyframe, or if that's not
+    // enough everything until the next keyframe arrives
+    SKIP_TO_KEYFRAME,
+    // Closes the subscriber's connection
+    DISCONNECT,
+  };
+
+  // Of the handler's queue and the socket's write buffer together, give
+  // or take the broadcast that made the pipeline unwritable.  0 for no
+  // bound, and nothing is queued.
+  uint64_t maxQueuedBytes{0};
+  Policy policy{Policy::DROP_OLDEST};
+  // For SKIP_TO_KEYFRAME: whether a subscriber can start from this data
+  std::function<bool(const folly::IOBuf&)> isKeyframe;
+};
+
 /**
  * A Handler-Observer adaptor that can be used for subscribing to broadcasts.
  * Maintains a thread-local BroadcastPool from which a BroadcastHandler is
  * obtained and subscribed to based on the given routing data.
  *
  * If custom logic needs to be added based on inbound bytes, subclass and
- * override the handler's read() method.
+ * override the handler's read() method.  Hash is the BroadcastPool's.
  */
-template <typename R>
+template <typename R, typename Hash = void>
 class ObservingHandler : public BytesToBytesHandler,
                          public Subscriber<std::unique_ptr<folly::IOBuf>> {
  public:
@@ -25,10 +55,12 @@ class ObservingHandler : public BytesToBytesHandler,
       const R& routingData,
       std::shared_ptr<ServerPool> serverPool,
       std::shared_ptr<BroadcastHandlerFactory<std::unique_ptr<folly::IOBuf>>>
-          broadcastHandlerFactory)
+          broadcastHandlerFactory,
+      std::shared_ptr<SharedUpstreams<R>> sharedUpstreams = nullptr)
       : routingData_(routingData),
         serverPool_(serverPool),
-        broadcastHandlerFactory_(broadcastHandlerFactory) {}
+        broadcastHandlerFactory_(broadcastHandlerFactory),
+        sharedUpstreams_(sharedUpstreams) {}
 
   virtual ~ObservingHandler() {
     CHECK(!broadcastHandler_);
@@ -38,6 +70,8 @@ class ObservingHandler : public BytesToBytesHandler,
   void transportActive(Context* ctx) override;
   void readEOF(Context* ctx) override;
   void readException(Context* ctx, folly::exception_wrapper ex) override;
+  void writabilityChanged(Context* ctx) override;
+  void attachPipeline(Context* ctx) override;
 
   // Subscriber implementation
   void onNext(const std::unique_ptr<folly::IOBuf>& buf) override;
@@ -55,6 +89,23 @@ class ObservingHandler : public BytesToBytesHandler,
    */
   void resume() noexcept { paused_ = false; }
 
+  /**
+   * Bounds the data queued for a slow subscriber.  Unless the pipeline has
+   * write buffer watermarks already, it becomes unwritable at half of
+   * maxQueuedBytes pending in the socket, and writable again at a quarter;
+   * the queue gets what the high watermark leaves of maxQueuedBytes.
+   */
+  void setSlowSubscriberOptions(SlowSubscriberOptions options);
+
+  uint64_t getQueuedBytes() const {
+    return queuedBytes_;
+  }
+
+  // What of the broadcast's history the handler gets once it subscribes
+  void setReplay(BroadcastReplay replay) {
+    replay_ = replay;
+  }
+
  protected:
   /**
    * Unsubscribe from the broadcast and close the handler.
@@ -65,52 +116,88 @@ class ObservingHandler : public BytesToBytesHandler,
   /**
    * Lazily initialize and return a thread-local BroadcastPool.
    */
-  BroadcastPool<std::unique_ptr<folly::IOBuf>, R>* broadcastPool();
+  BroadcastPool<std::unique_ptr<folly::IOBuf>, R, Hash>* broadcastPool();
 
   // For testing
-  virtual BroadcastPool<std::unique_ptr<folly::IOBuf>, R>* newBroadcastPool();
+  virtual BroadcastPool<std::unique_ptr<folly::IOBuf>, R, Hash>*
+  newBroadcastPool();
+
+  void send(std::unique_ptr<folly::IOBuf> buf);
+
+  // Makes room in the queue according to the policy
+  void trimQueue();
+
+  void popQueue();
+
+  void setWaterMarks();
+  // Of the queue, once the socket's write buffer had its share
+  uint64_t getQueueBound();
 
   R routingData_;
   std::shared_ptr<ServerPool> serverPool_;
   std::shared_ptr<BroadcastHandlerFactory<std::unique_ptr<folly::IOBuf>>>
       broadcastHandlerFactory_;
+  std::shared_ptr<SharedUpstreams<R>> sharedUpstreams_;
 
   BroadcastHandler<std::unique_ptr<folly::IOBuf>>* broadcastHandler_{nullptr};
   uint64_t subscriptionId_{0};
   bool paused_{false};
+  BroadcastReplay replay_{BroadcastReplay::NONE};
 
-  folly::ThreadLocalPtr<BroadcastPool<std::unique_ptr<folly::IOBuf>, R>>
+  SlowSubscriberOptions slowSubscriberOptions_;
+  std::deque<std::unique_ptr<folly::IOBuf>> queue_;
+  uint64_t queuedBytes_{0};
+  // Dropping everything until a keyframe
+  bool skipping_{false};
+
+  folly::ThreadLocalPtr<BroadcastPool<std::unique_ptr<folly::IOBuf>, R, Hash>>
       broadcastPool_;
 };
 
-template <typename R>
+template <typename R, typename Hash = void>
 class ObservingPipelineFactory
     : public RoutingDataPipelineFactory<DefaultPipeline, R> {
  public:
   ObservingPipelineFactory(
       std::shared_ptr<ServerPool> serverPool,
       std::shared_ptr<BroadcastHandlerFactory<std::unique_ptr<folly::IOBuf>>>
-          broadcastHandlerFactory)
+          broadcastHandlerFactory,
+      std::shared_ptr<SharedUpstreams<R>> sharedUpstreams = nullptr)
       : serverPool_(serverPool),
-        broadcastHandlerFactory_(broadcastHandlerFactory) {}
+        broadcastHandlerFactory_(broadcastHandlerFactory),
+        sharedUpstreams_(sharedUpstreams) {}
 
   DefaultPipeline::UniquePtr newPipeline(
       std::shared_ptr<folly::AsyncSocket> socket,
       const R& routingData) override {
     DefaultPipeline::UniquePtr pipeline(new DefaultPipeline);
     pipeline->addBack(AsyncSocketHandler(socket));
-    auto handler = std::make_shared<ObservingHandler<R>>(
-        routingData, serverPool_, broadcastHandlerFactory_);
+    auto handler = std::make_shared<ObservingHandler<R, Hash>>(
+        routingData, serverPool_, broadcastHandlerFactory_, sharedUpstreams_);
+    handler->setSlowSubscriberOptions(slowSubscriberOptions_);
+    handler->setReplay(replay_);
     pipeline->addBack(handler);
     pipeline->finalize();
 
     return pipeline;
   }
 
+  // For the ObservingHandler of every pipeline made from now on
+  void setSlowSubscriberOptions(SlowSubscriberOptions options) {
+    slowSubscriberOptions_ = std::move(options);
+  }
+
+  void setReplay(BroadcastReplay replay) {
+    replay_ = replay;
+  }
+
  protected:
   std::shared_ptr<ServerPool> serverPool_;
   std::shared_ptr<BroadcastHandlerFactory<std::unique_ptr<folly::IOBuf>>>
       broadcastHandlerFactory_;
+  std::shared_ptr<SharedUpstreams<R>> sharedUpstreams_;
+  SlowSubscriberOptions slowSubscriberOptions_;
+  BroadcastReplay replay_{BroadcastReplay::NONE};
 };
 
 }} // namespace folly::wangle
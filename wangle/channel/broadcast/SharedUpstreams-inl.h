@@ -0,0 +1,57 @@
+// Copyright 2004-present Facebook.  All rights reserved.
+#pragma once
+
+namespace folly { namespace wangle {
+
+template <typename R>
+const size_t SharedUpstreams<R>::kDefaultRingSize;
+
+template <typename R>
+std::shared_ptr<typename SharedUpstreams<R>::MirrorHandler>
+SharedUpstreams<R>::subscribe(const R& routingData,
+                              const SocketAddress& server) {
+  auto base = EventBaseManager::get()->getEventBase();
+  auto ring = std::make_shared<Ring>(base, ringSize_);
+  auto handler = std::make_shared<MirrorHandler>(ring);
+  attach(routingData, server, std::move(ring));
+  return handler;
+}
+
+template <typename R>
+void SharedUpstreams<R>::attach(const R& routingData,
+                                const SocketAddress& server,
+                                std::shared_ptr<Ring> ring,
+                                Upstream* stale) {
+  std::shared_ptr<Upstream> upstream;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    auto& entry = upstreams_[routingData];
+    if (!entry || entry.get() == stale) {
+      // Runs in this thread
+      entry = std::make_shared<Upstream>(
+        this->shared_from_this(),
+        routingData,
+        EventBaseManager::get()->getEventBase());
+    }
+    upstream = entry;
+  }
+
+  // The last reference to an upstream is only dropped in its thread
+  auto base = upstream->getEventBase();
+  auto moveUpstream = folly::makeMoveWrapper(std::move(upstream));
+  auto moveRing = folly::makeMoveWrapper(std::move(ring));
+  base->runInEventBaseThread([moveUpstream, moveRing, server]() {
+    (*moveUpstream)->addMirror(std::move(*moveRing), server);
+  });
+}
+
+template <typename R>
+void SharedUpstreams<R>::remove(const R& routingData, Upstream* upstream) {
+  std::lock_guard<std::mutex> g(mutex_);
+  auto it = upstreams_.find(routingData);
+  if (it != upstreams_.end() && it->second.get() == upstream) {
+    upstreams_.erase(it);
+  }
+}
+
+}} // namespace folly::wangle
@@ -0,0 +1,420 @@
+// Copyright 2004-present Facebook.  All rights reserved.
+#pragma once
+
+#include <folly/MoveWrapper.h>
+#include <folly/ProducerConsumerQueue.h>
+#include <folly/futures/Future.h>
+#include <wangle/bootstrap/ClientBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/Handler.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+
+namespace folly { namespace wangle {
+
+/**
+ * Upstream broadcast connections shared by the BroadcastPools of all IO
+ * threads: one connection per routing data, however many threads have
+ * subscribers to it, rather than one per thread.  Pass the same instance
+ * to the BroadcastPool of each thread.
+ *
+ * An upstream runs in the thread that asked for it first.  It hands every
+ * thread subscribed to it a clone of each buffer read, sharing the bytes,
+ * through a single-producer single-consumer ring.  Each thread has a mirror
+ * pipeline, with a MirrorHandler in place of the AsyncSocketHandler, where
+ * its own BroadcastHandler parses the bytes for the thread's subscribers.
+ * A thread that falls ringSize reads behind gets an error rather than
+ * holding up the others.
+ *
+ * The bytes aren't framed here, so a mirror only joins an upstream that
+ * hasn't read anything yet, and sees the stream from its start.  A thread
+ * subscribing later gets a new upstream, which replaces the old one for
+ * the threads after it.
+ */
+template <typename R>
+class SharedUpstreams
+    : public std::enable_shared_from_this<SharedUpstreams<R>> {
+  class Ring;
+  class Upstream;
+
+ public:
+  class MirrorHandler;
+
+  static const size_t kDefaultRingSize = 1024;
+
+  explicit SharedUpstreams(size_t ringSize = kDefaultRingSize)
+      : ringSize_(ringSize) {}
+
+  /**
+   * The transport handler for a mirror pipeline of routingData in the
+   * calling thread, whose EventBase gets the bytes.  The upstream is
+   * connected to server unless it's up already.
+   */
+  std::shared_ptr<MirrorHandler> subscribe(const R& routingData,
+                                           const SocketAddress& server);
+
+  // Whether any thread is subscribed to routingData
+  bool hasUpstream(const R& routingData) {
+    std::lock_guard<std::mutex> g(mutex_);
+    return upstreams_.find(routingData) != upstreams_.end();
+  }
+
+ private:
+  // What an upstream hands a mirror
+  struct Event {
+    enum class Type {
+      CONNECTED,
+      DATA,
+      END,
+      ERROR,
+    };
+
+    Event() = default;
+    explicit Event(Type t) : type(t) {}
+    Event(Type t, std::unique_ptr<IOBuf> buf)
+        : type(t), data(std::move(buf)) {}
+    Event(Type t, exception_wrapper ex) : type(t), error(std::move(ex)) {}
+
+    Type type{Type::DATA};
+    std::unique_ptr<IOBuf> data;
+    exception_wrapper error;
+  };
+
+  // Hands one mirror's thread the events of its upstream
+  class Ring : public std::enable_shared_from_this<Ring> {
+   public:
+    Ring(EventBase* base, size_t size) : base_(base), queue_(size + 1) {}
+
+    // In the upstream's thread; false once the mirror fell behind, which
+    // it learns after the events before
+    bool push(Event event) {
+      if (overflowed_) {
+        return false;
+      }
+      if (!queue_.write(std::move(event))) {
+        overflowed_ = true;
+        overflow_.store(true, std::memory_order_release);
+      }
+      if (!scheduled_.exchange(true, std::memory_order_acq_rel)) {
+        auto self = this->shared_from_this();
+        base_->runInEventBaseThread([self]() {
+          self->drain();
+        });
+      }
+      return !overflowed_;
+    }
+
+    // The upstream the ring was added to, unless the mirror is closed
+    bool setUpstream(std::shared_ptr<Upstream> upstream) {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (closed_) {
+        return false;
+      }
+      upstream_ = upstream;
+      return true;
+    }
+
+    // In the mirror's thread; it gets no more events
+    std::shared_ptr<Upstream> close() {
+      handler_ = nullptr;
+      std::lock_guard<std::mutex> g(mutex_);
+      closed_ = true;
+      return upstream_.lock();
+    }
+
+    // Only in the mirror's thread
+    MirrorHandler* handler_{nullptr};
+
+   private:
+    void drain() {
+      scheduled_.store(false, std::memory_order_release);
+      Event event;
+      while (handler_ && queue_.read(event)) {
+        handler_->onEvent(std::move(event));
+      }
+      if (handler_ && queue_.isEmpty() &&
+          overflow_.exchange(false, std::memory_order_acq_rel)) {
+        handler_->onEvent(Event(
+          Event::Type::ERROR,
+          make_exception_wrapper<std::runtime_error>(
+            "fell behind the shared upstream")));
+      }
+    }
+
+    EventBase* base_;
+    ProducerConsumerQueue<Event> queue_;
+    std::atomic<bool> scheduled_{false};
+    std::atomic<bool> overflow_{false};
+    // The upstream's own view of overflow_
+    bool overflowed_{false};
+
+    std::mutex mutex_;
+    bool closed_{false};
+    std::weak_ptr<Upstream> upstream_;
+  };
+
+  // One connection and the rings of its mirrors, in its EventBase's thread
+  class Upstream : public PipelineManager,
+                   public std::enable_shared_from_this<Upstream> {
+   public:
+    Upstream(std::shared_ptr<SharedUpstreams<R>> parent,
+             const R& routingData,
+             EventBase* base)
+        : parent_(std::move(parent)), routingData_(routingData), base_(base) {}
+
+    EventBase* getEventBase() {
+      return base_;
+    }
+
+    void addMirror(std::shared_ptr<Ring> ring, const SocketAddress& server) {
+      if (closed_ || readStarted_) {
+        // Went away, or is mid-stream, so for a fresh one
+        parent_->attach(routingData_, server, std::move(ring), this);
+        return;
+      }
+      if (!ring->setUpstream(this->shared_from_this())) {
+        return;
+      }
+      if (connected_) {
+        ring->push(Event(Event::Type::CONNECTED));
+      }
+      mirrors_.push_back(std::move(ring));
+      if (!connectStarted_) {
+        connect(server);
+      }
+    }
+
+    void removeMirror(const std::shared_ptr<Ring>& ring) {
+      auto it = std::find(mirrors_.begin(), mirrors_.end(), ring);
+      if (it == mirrors_.end()) {
+        return;
+      }
+      mirrors_.erase(it);
+      if (mirrors_.empty()) {
+        close(Event(Event::Type::END));
+      }
+    }
+
+    // Everything read from the upstream
+    void broadcast(std::unique_ptr<IOBuf> buf) {
+      readStarted_ = true;
+      auto it = mirrors_.begin();
+      while (it != mirrors_.end()) {
+        if ((*it)->push(Event(Event::Type::DATA, buf->clone()))) {
+          ++it;
+        } else {
+          it = mirrors_.erase(it);
+        }
+      }
+      if (mirrors_.empty()) {
+        close(Event(Event::Type::END));
+      }
+    }
+
+    // Ends the mirrors still there with last, END or ERROR
+    void close(Event last) {
+      if (closed_) {
+        return;
+      }
+      auto self = this->shared_from_this();
+      closed_ = true;
+      parent_->remove(routingData_, this);
+      auto mirrors = std::move(mirrors_);
+      for (auto& ring : mirrors) {
+        ring->push(Event(last.type, last.error));
+      }
+      if (client_.getPipeline()) {
+        client_.getPipeline()->close();
+      }
+    }
+
+    // PipelineManager implementation; client_ owns the pipeline
+    void deletePipeline(PipelineBase* pipeline) override {}
+
+   private:
+    class FanoutHandler : public BytesToBytesHandler {
+     public:
+      explicit FanoutHandler(Upstream* upstream) : upstream_(upstream) {}
+
+      void read(Context* ctx, IOBufQueue& q) override {
+        if (!q.empty()) {
+          upstream_->broadcast(q.move());
+        }
+      }
+
+      void readEOF(Context* ctx) override {
+        upstream_->close(Event(Event::Type::END));
+      }
+
+      void readException(Context* ctx, exception_wrapper ex) override {
+        upstream_->close(Event(Event::Type::ERROR, std::move(ex)));
+      }
+
+     private:
+      Upstream* upstream_;
+    };
+
+    class FanoutPipelineFactory : public PipelineFactory<DefaultPipeline> {
+     public:
+      explicit FanoutPipelineFactory(Upstream* upstream)
+          : upstream_(upstream) {}
+
+      DefaultPipeline::UniquePtr newPipeline(
+          std::shared_ptr<AsyncSocket> socket) override {
+        DefaultPipeline::UniquePtr pipeline(new DefaultPipeline);
+        pipeline->addBack(AsyncSocketHandler(socket));
+        pipeline->addBack(FanoutHandler(upstream_));
+        pipeline->finalize();
+        return pipeline;
+      }
+
+     private:
+      Upstream* upstream_;
+    };
+
+    void connect(const SocketAddress& server) {
+      connectStarted_ = true;
+      client_.pipelineFactory(std::make_shared<FanoutPipelineFactory>(this));
+      auto self = this->shared_from_this();
+      client_.connect(server)
+          .then([self](DefaultPipeline* pipeline) {
+            pipeline->setPipelineManager(self.get());
+            self->connected_ = true;
+            for (auto& ring : self->mirrors_) {
+              ring->push(Event(Event::Type::CONNECTED));
+            }
+          })
+          .onError([self](const std::exception& ex) {
+            LOG(ERROR) << "Shared upstream connect error: " << ex.what();
+            self->close(Event(
+              Event::Type::ERROR,
+              make_exception_wrapper<std::runtime_error>(ex.what())));
+          });
+    }
+
+    std::shared_ptr<SharedUpstreams<R>> parent_;
+    R routingData_;
+    EventBase* base_;
+    folly::ClientBootstrap<DefaultPipeline> client_;
+    std::vector<std::shared_ptr<Ring>> mirrors_;
+    bool connectStarted_{false};
+    bool connected_{false};
+    bool closed_{false};
+    // Whether mirrors joining now would start mid-stream
+    bool readStarted_{false};
+  };
+
+ public:
+  /**
+   * The front of a mirror pipeline: fires what the upstream read, its EOF
+   * and its errors, and leaves the upstream on close().  Nothing is written
+   * upstream.
+   */
+  class MirrorHandler : public BytesToBytesHandler {
+   public:
+    explicit MirrorHandler(std::shared_ptr<Ring> ring)
+        : ring_(std::move(ring)) {
+      ring_->handler_ = this;
+    }
+
+    ~MirrorHandler() {
+      leave();
+    }
+
+    // Done, or failed, once the upstream is connected
+    Future<Unit> getConnectedFuture() {
+      return connected_.getFuture();
+    }
+
+    Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+      return makeFuture<Unit>(std::runtime_error(
+        "writes to a shared upstream aren't supported"));
+    }
+
+    Future<Unit> close(Context* ctx) override {
+      leave();
+      ctx->getPipeline()->deletePipeline();
+      return makeFuture();
+    }
+
+    void onEvent(Event event) {
+      auto ctx = getContext();
+      if (!ctx) {
+        return;
+      }
+      DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+      switch (event.type) {
+        case Event::Type::CONNECTED:
+          connectedSet_ = true;
+          connected_.setValue();
+          break;
+        case Event::Type::DATA:
+          q_.append(std::move(event.data));
+          ctx->fireRead(q_);
+          break;
+        case Event::Type::END:
+          leave();
+          if (!connectedSet_) {
+            connectedSet_ = true;
+            connected_.setException(std::runtime_error(
+              "shared upstream closed before it connected"));
+          } else {
+            ctx->fireReadEOF();
+          }
+          break;
+        case Event::Type::ERROR:
+          leave();
+          if (!connectedSet_) {
+            connectedSet_ = true;
+            connected_.setException(event.error);
+          } else {
+            ctx->fireReadException(event.error);
+          }
+          break;
+      }
+    }
+
+   private:
+    // Removed from the upstream in its thread, where the upstream has to be
+    // released too
+    void leave() {
+      if (!ring_) {
+        return;
+      }
+      auto ring = std::move(ring_);
+      auto upstream = ring->close();
+      if (upstream) {
+        auto base = upstream->getEventBase();
+        auto moveUpstream = folly::makeMoveWrapper(std::move(upstream));
+        base->runInEventBaseThread([moveUpstream, ring]() {
+          (*moveUpstream)->removeMirror(ring);
+        });
+      }
+    }
+
+    std::shared_ptr<Ring> ring_;
+    IOBufQueue q_{IOBufQueue::cacheChainLength()};
+    Promise<Unit> connected_;
+    bool connectedSet_{false};
+  };
+
+ private:
+  // Replacing stale, if it's still the upstream for routingData
+  void attach(const R& routingData,
+              const SocketAddress& server,
+              std::shared_ptr<Ring> ring,
+              Upstream* stale = nullptr);
+
+  void remove(const R& routingData, Upstream* upstream);
+
+  const size_t ringSize_;
+  std::mutex mutex_;
+  std::map<R, std::shared_ptr<Upstream>> upstreams_;
+};
+
+}} // namespace folly::wangle
+
+#include <wangle/channel/broadcast/SharedUpstreams-inl.h>
@@ -13,6 +13,11 @@ class Subscriber {
  public:
   virtual ~Subscriber() {}
 
+  /**
+   * The data is shared by all the subscribers of a broadcast and only
+   * valid during the call: take a reference to it (IOBuf::clone() or
+   * cloneAsValue(), which share the bytes) rather than a copy to keep it.
+   */
   virtual void onNext(const T&) = 0;
   virtual void onError(folly::exception_wrapper ex) = 0;
   virtual void onCompleted() = 0;
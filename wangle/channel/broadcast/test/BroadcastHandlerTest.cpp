@@ -252,3 +252,128 @@ TEST_F(BroadcastHandlerTest, OnError) {
   // The handler should be deleted now
   handler->readException(nullptr, make_exception_wrapper<std::exception>());
 }
+
+TEST_F(BroadcastHandlerTest, Replay) {
+  // Test late subscribers catching up from the history
+  EXPECT_CALL(*handler, processRead(_, _))
+      .WillRepeatedly(Invoke([&](IOBufQueue& q, std::string& data) {
+        auto buf = q.move();
+        buf->coalesce();
+        data = buf->moveToFbString().toStdString();
+        return true;
+      }));
+  handler->setHistory(2);
+
+  InSequence dummy;
+
+  // Nothing to replay yet
+  EXPECT_EQ(handler->subscribe(&subscriber0, BroadcastReplay::ALL), 0);
+
+  EXPECT_CALL(subscriber0, onNext("data1")).Times(1);
+  EXPECT_CALL(subscriber0, onNext("data2")).Times(1);
+  EXPECT_CALL(subscriber0, onNext("data3")).Times(1);
+
+  // Push some data, of which the last two are retained
+  IOBufQueue q;
+  for (auto data : {"data1", "data2", "data3"}) {
+    q.append(IOBuf::copyBuffer(data));
+    handler->read(nullptr, q);
+    q.clear();
+  }
+  EXPECT_EQ(2, handler->getHistoryLength());
+
+  // Add a subscriber that gets everything retained
+  EXPECT_CALL(subscriber1, onNext("data2")).Times(1);
+  EXPECT_CALL(subscriber1, onNext("data3")).Times(1);
+  EXPECT_EQ(handler->subscribe(&subscriber1, BroadcastReplay::ALL), 1);
+  handler->unsubscribe(1);
+
+  // And again from the latest start, which by default is the latest data
+  EXPECT_CALL(subscriber1, onNext("data3")).Times(1);
+  EXPECT_EQ(
+    handler->subscribe(&subscriber1, BroadcastReplay::LATEST_START), 2);
+
+  EXPECT_CALL(subscriber0, onNext("data4")).Times(1);
+  EXPECT_CALL(subscriber1, onNext("data4")).Times(1);
+
+  // Push more data
+  q.append(IOBuf::copyBuffer("data4"));
+  handler->read(nullptr, q);
+  q.clear();
+
+  handler->unsubscribe(0);
+
+  EXPECT_CALL(*handler, close(_))
+      .WillOnce(InvokeWithoutArgs([this] {
+        delete handler;
+        return makeFuture();
+      }));
+
+  // The handler should be deleted now
+  handler->unsubscribe(2);
+}
+
+TEST_F(BroadcastHandlerTest, ManySubscribersLeave) {
+  // Subscribers leaving in bulk, some of them in the middle of a broadcast
+  EXPECT_CALL(*handler, processRead(_, _))
+      .WillRepeatedly(Invoke([&](IOBufQueue& q, std::string& data) {
+        auto buf = q.move();
+        buf->coalesce();
+        data = buf->moveToFbString().toStdString();
+        return true;
+      }));
+
+  const int kSubscribers = 100;
+  std::vector<std::unique_ptr<NiceMock<MockSubscriber<std::string>>>>
+    subscribers;
+  std::vector<int> received(kSubscribers, 0);
+  for (int i = 0; i < kSubscribers; i++) {
+    subscribers.emplace_back(new NiceMock<MockSubscriber<std::string>>());
+    ON_CALL(*subscribers.back(), onNext(_))
+        .WillByDefault(InvokeWithoutArgs([&received, i] {
+          received[i]++;
+        }));
+    EXPECT_EQ(i, handler->subscribe(subscribers.back().get()));
+  }
+
+  // Most of them go
+  for (int i = 0; i < kSubscribers; i++) {
+    if (i % 4 != 0) {
+      handler->unsubscribe(i);
+    }
+  }
+
+  // The first one takes the others with it, but they still get this one
+  ON_CALL(*subscribers[0], onNext(_))
+      .WillByDefault(InvokeWithoutArgs([&] {
+        received[0]++;
+        for (int i = 4; i < kSubscribers; i += 4) {
+          handler->unsubscribe(i);
+        }
+      }));
+  IOBufQueue q;
+  q.append(IOBuf::copyBuffer("data1"));
+  handler->read(nullptr, q);
+  q.clear();
+  for (int i = 0; i < kSubscribers; i++) {
+    EXPECT_EQ(i % 4 == 0 ? 1 : 0, received[i]);
+  }
+
+  // Only the first one is left
+  ON_CALL(*subscribers[0], onNext(_))
+      .WillByDefault(InvokeWithoutArgs([&] {
+        received[0]++;
+      }));
+  q.append(IOBuf::copyBuffer("data2"));
+  handler->read(nullptr, q);
+  q.clear();
+  EXPECT_EQ(2, received[0]);
+  EXPECT_EQ(1, received[4]);
+
+  EXPECT_CALL(*handler, close(_))
+      .WillOnce(InvokeWithoutArgs([this] {
+        delete handler;
+        return makeFuture();
+      }));
+  handler->unsubscribe(0);
+}
@@ -0,0 +1,133 @@
+// Copyright 2004-present Facebook.  All rights reserved.
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <wangle/channel/broadcast/BroadcastPool.h>
+#include <gflags/gflags.h>
+
+using namespace folly;
+using namespace folly::wangle;
+using folly::BenchmarkSuspender;
+
+class NullServerPool : public ServerPool {
+ public:
+  SocketAddress getServer() noexcept override {
+    return SocketAddress("127.0.0.1", 1);
+  }
+};
+
+class NullBroadcastHandler : public BroadcastHandler<int> {
+ public:
+  bool processRead(IOBufQueue& q, int& data) override {
+    q.clear();
+    return false;
+  }
+};
+
+class NullBroadcastHandlerFactory : public BroadcastHandlerFactory<int> {
+ public:
+  std::shared_ptr<BroadcastHandler<int>> newHandler() override {
+    return std::make_shared<NullBroadcastHandler>();
+  }
+};
+
+// Routing keys with a long common prefix, like stream URLs
+std::string routingKey(size_t i) {
+  return to<std::string>("/live/broadcast/channel/stream-", i, "/video-hd");
+}
+
+/**
+ * A pool of n broadcasts.  They mirror shared upstreams, which never
+ * connect as the EventBase doesn't loop, so the pool takes no sockets.
+ */
+template <typename Hash>
+struct Broadcasts {
+  explicit Broadcasts(size_t n)
+      : pool(std::make_shared<NullServerPool>(),
+             std::make_shared<NullBroadcastHandlerFactory>(),
+             std::make_shared<SharedUpstreams<std::string>>()) {
+    for (size_t i = 0; i < n; i++) {
+      keys.push_back(routingKey(i));
+      pool.getHandler(keys.back());
+    }
+  }
+
+  std::vector<std::string> keys;
+  BroadcastPool<int, std::string, Hash> pool;
+};
+
+// Looks up existing broadcasts among n
+template <typename Hash>
+void lookup(uint iters, size_t n) {
+  BenchmarkSuspender bs;
+  static std::map<size_t, std::unique_ptr<Broadcasts<Hash>>> cache;
+  auto& broadcasts = cache[n];
+  if (!broadcasts) {
+    broadcasts.reset(new Broadcasts<Hash>(n));
+  }
+  bs.dismiss();
+
+  size_t found = 0;
+  for (uint i = 0; i < iters; i++) {
+    const auto& key = broadcasts->keys[i % n];
+    found += broadcasts->pool.isBroadcasting(key);
+  }
+  doNotOptimizeAway(found);
+}
+
+// Subscribes to new broadcasts in a pool of n
+template <typename Hash>
+void subscribe(uint iters, size_t n) {
+  BenchmarkSuspender bs;
+  Broadcasts<Hash> broadcasts(n);
+  std::vector<std::string> keys;
+  for (uint i = 0; i < iters; i++) {
+    keys.push_back(routingKey(n + i));
+  }
+  bs.dismiss();
+
+  for (const auto& key : keys) {
+    broadcasts.pool.getHandler(key);
+  }
+
+  bs.rehire();
+}
+
+void orderedLookup(uint iters, size_t n) {
+  lookup<void>(iters, n);
+}
+
+void hashedLookup(uint iters, size_t n) {
+  lookup<std::hash<std::string>>(iters, n);
+}
+
+void orderedSubscribe(uint iters, size_t n) {
+  subscribe<void>(iters, n);
+}
+
+void hashedSubscribe(uint iters, size_t n) {
+  subscribe<std::hash<std::string>>(iters, n);
+}
+
+BENCHMARK_PARAM(orderedLookup, 1000);
+BENCHMARK_RELATIVE_PARAM(hashedLookup, 1000);
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(orderedLookup, 100000);
+BENCHMARK_RELATIVE_PARAM(hashedLookup, 100000);
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(orderedSubscribe, 1000);
+BENCHMARK_RELATIVE_PARAM(hashedSubscribe, 1000);
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(orderedSubscribe, 100000);
+BENCHMARK_RELATIVE_PARAM(hashedSubscribe, 100000);
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
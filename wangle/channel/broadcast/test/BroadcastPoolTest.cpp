@@ -15,8 +15,19 @@ class MockBroadcastHandlerFactory : public BroadcastHandlerFactory<int> {
   };
 
   std::shared_ptr<BroadcastHandler<int>> newHandler() override {
-    return std::make_shared<NiceMock<MockBroadcastHandler>>();
+    auto handler = std::make_shared<NiceMock<MockBroadcastHandler>>();
+    ON_CALL(*handler, processRead(_, _))
+        .WillByDefault(Invoke([this](IOBufQueue& q, int&) {
+          if (!q.empty()) {
+            reads.push_back(q.move()->moveToFbString().toStdString());
+          }
+          return false;
+        }));
+    return handler;
   }
+
+  // What the handlers were given to parse, in their threads
+  std::vector<std::string> reads;
 };
 
 class BroadcastPoolTest : public Test {
@@ -46,13 +57,25 @@ class BroadcastPoolTest : public Test {
    public:
     DefaultPipeline::UniquePtr newPipeline(
         std::shared_ptr<AsyncSocket> sock) override {
-      return DefaultPipeline::UniquePtr(new DefaultPipeline);
+      pipelines++;
+      DefaultPipeline::UniquePtr pipeline(new DefaultPipeline);
+      if (!greeting.empty()) {
+        pipeline->addBack(AsyncSocketHandler(sock));
+        pipeline->finalize();
+        pipeline->write(IOBuf::copyBuffer(greeting));
+      }
+      return pipeline;
     }
+
+    std::atomic<int> pipelines{0};
+    // Written to each connection first, if set
+    std::string greeting;
   };
 
   void startServer() {
     server = folly::make_unique<ServerBootstrap<DefaultPipeline>>();
-    server->childPipeline(std::make_shared<ServerPipelineFactory>());
+    serverPipelineFactory = std::make_shared<ServerPipelineFactory>();
+    server->childPipeline(serverPipelineFactory);
     server->bind(0);
     server->getSockets()[0]->getAddress(&addr);
   }
@@ -64,6 +87,7 @@ class BroadcastPoolTest : public Test {
   std::unique_ptr<BroadcastPool<int, std::string>> pool;
   std::shared_ptr<StrictMock<MockServerPool>> serverPool;
   std::unique_ptr<ServerBootstrap<DefaultPipeline>> server;
+  std::shared_ptr<ServerPipelineFactory> serverPipelineFactory;
   SocketAddress addr;
 };
 
@@ -286,3 +310,131 @@ TEST_F(BroadcastPoolTest, HandlerEOFPoolDeletion) {
   // This will also delete the pipeline and the handler
   pipeline->readEOF();
 }
+
+TEST_F(BroadcastPoolTest, SharedUpstream) {
+  // Test that pools sharing upstreams open one connection for
+  // the same routing data
+  std::string routingData = "url1";
+  BroadcastHandler<int>* handler1 = nullptr;
+  BroadcastHandler<int>* handler2 = nullptr;
+  auto base = EventBaseManager::get()->getEventBase();
+
+  auto sharedUpstreams = std::make_shared<SharedUpstreams<std::string>>();
+  auto handlerFactory = std::make_shared<MockBroadcastHandlerFactory>();
+  auto pool1 = folly::make_unique<BroadcastPool<int, std::string>>(
+      serverPool, handlerFactory, sharedUpstreams);
+  auto pool2 = folly::make_unique<BroadcastPool<int, std::string>>(
+      serverPool, handlerFactory, sharedUpstreams);
+
+  pool1->getHandler(routingData)
+      .then([&](BroadcastHandler<int>* h) {
+        handler1 = h;
+      });
+  pool2->getHandler(routingData)
+      .then([&](BroadcastHandler<int>* h) {
+        handler2 = h;
+      });
+  EXPECT_TRUE(sharedUpstreams->hasUpstream(routingData));
+  while (!handler1 || !handler2) {
+    base->loopOnce();
+  }
+
+  // Each pool has its own handler on the one upstream
+  EXPECT_TRUE(handler1 != handler2);
+  EXPECT_TRUE(pool1->isBroadcasting(routingData));
+  EXPECT_TRUE(pool2->isBroadcasting(routingData));
+  while (serverPipelineFactory->pipelines < 1) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(1, serverPipelineFactory->pipelines);
+
+  // The upstream goes away with its last mirror
+  handler1->close(handler1->getContext());
+  EXPECT_FALSE(pool1->isBroadcasting(routingData));
+  base->loopOnce();
+  EXPECT_TRUE(sharedUpstreams->hasUpstream(routingData));
+  handler2->close(handler2->getContext());
+  base->loopOnce();
+  EXPECT_FALSE(sharedUpstreams->hasUpstream(routingData));
+}
+
+TEST_F(BroadcastPoolTest, SharedUpstreamLateJoin) {
+  // Test that a pool subscribing after the shared upstream started reading
+  // gets a fresh one, from the start of the stream, rather than joining
+  // mid-stream
+  serverPipelineFactory->greeting = "hello";
+  std::string routingData = "url1";
+  BroadcastHandler<int>* handler1 = nullptr;
+  BroadcastHandler<int>* handler2 = nullptr;
+  auto base = EventBaseManager::get()->getEventBase();
+
+  auto sharedUpstreams = std::make_shared<SharedUpstreams<std::string>>();
+  auto handlerFactory = std::make_shared<MockBroadcastHandlerFactory>();
+  auto pool1 = folly::make_unique<BroadcastPool<int, std::string>>(
+      serverPool, handlerFactory, sharedUpstreams);
+  auto pool2 = folly::make_unique<BroadcastPool<int, std::string>>(
+      serverPool, handlerFactory, sharedUpstreams);
+
+  pool1->getHandler(routingData)
+      .then([&](BroadcastHandler<int>* h) {
+        handler1 = h;
+      });
+  while (handlerFactory->reads.empty()) {
+    base->loopOnce();
+  }
+  EXPECT_EQ("hello", handlerFactory->reads[0]);
+
+  pool2->getHandler(routingData)
+      .then([&](BroadcastHandler<int>* h) {
+        handler2 = h;
+      });
+  while (!handler2 || handlerFactory->reads.size() < 2) {
+    base->loopOnce();
+  }
+  EXPECT_EQ("hello", handlerFactory->reads[1]);
+  EXPECT_EQ(2, serverPipelineFactory->pipelines);
+
+  // The old upstream going away leaves the new one in place
+  handler1->close(handler1->getContext());
+  base->loopOnce();
+  EXPECT_TRUE(sharedUpstreams->hasUpstream(routingData));
+  handler2->close(handler2->getContext());
+  base->loopOnce();
+  EXPECT_FALSE(sharedUpstreams->hasUpstream(routingData));
+}
+
+TEST_F(BroadcastPoolTest, HashedRoutingData) {
+  // Test a pool that keeps its broadcasts in a hash table, with getHandler()
+  // calls for the same routing data sharing one connect
+  std::string routingData = "url1";
+  BroadcastHandler<int>* handler1 = nullptr;
+  BroadcastHandler<int>* handler2 = nullptr;
+  auto base = EventBaseManager::get()->getEventBase();
+
+  auto handlerFactory = std::make_shared<MockBroadcastHandlerFactory>();
+  auto hashedPool = folly::make_unique<
+      BroadcastPool<int, std::string, std::hash<std::string>>>(
+      serverPool, handlerFactory);
+
+  EXPECT_FALSE(hashedPool->isBroadcasting(routingData));
+  hashedPool->getHandler(routingData)
+      .then([&](BroadcastHandler<int>* h) {
+        handler1 = h;
+      });
+  hashedPool->getHandler(routingData)
+      .then([&](BroadcastHandler<int>* h) {
+        handler2 = h;
+      });
+  EXPECT_TRUE(hashedPool->isBroadcasting(routingData));
+  while (!handler1 || !handler2) {
+    base->loopOnce();
+  }
+  EXPECT_TRUE(handler1 == handler2);
+  while (serverPipelineFactory->pipelines < 1) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(1, serverPipelineFactory->pipelines);
+
+  handler1->close(handler1->getContext());
+  EXPECT_FALSE(hashedPool->isBroadcasting(routingData));
+}
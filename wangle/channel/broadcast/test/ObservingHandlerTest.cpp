@@ -28,6 +28,49 @@ class ObservingHandlerTest : public Test {
     pool = new MockBroadcastPool<std::unique_ptr<IOBuf>>();
   }
 
+  // Subscribes observingHandler to broadcastHandler
+  void subscribe() {
+    EXPECT_CALL(*socketHandler, transportActive(_))
+        .WillOnce(Invoke([&](MockAsyncSocketHandler::Context* ctx) {
+          ctx->fireTransportActive();
+        }));
+    EXPECT_CALL(*socketHandler, transportInactive(_)).WillOnce(Return());
+    EXPECT_CALL(*observingHandler, newBroadcastPool()).WillOnce(Return(pool));
+    EXPECT_CALL(*pool, getHandler(_))
+        .WillOnce(InvokeWithoutArgs([this] {
+          auto handler = broadcastHandler.get();
+          return makeFuture<BroadcastHandler<std::unique_ptr<IOBuf>>*>(
+              std::move(handler));
+        }));
+    EXPECT_CALL(*broadcastHandler, subscribe(_)).Times(1);
+    EXPECT_CALL(*socketHandler, transportActive(_))
+        .WillOnce(Invoke([&](MockAsyncSocketHandler::Context* ctx) {
+          ctx->fireTransportActive();
+        }));
+
+    pipeline->transportActive();
+  }
+
+  void broadcast(const std::string& data) {
+    auto buf = IOBuf::copyBuffer(data);
+    observingHandler->onNext(buf);
+  }
+
+  // Expects data to be written next
+  void expectWrite(const std::string& data) {
+    EXPECT_CALL(*observingHandler, write(_, _))
+        .WillOnce(Invoke([data](MockObservingHandler::Context*,
+                                std::shared_ptr<IOBuf> buf) {
+          EXPECT_EQ(data, buf->moveToFbString().toStdString());
+          return makeFuture();
+        }));
+  }
+
+  void setWritable(bool writable) {
+    pipeline->setWritable(writable);
+    observingHandler->writabilityChanged(observingHandler->getContext());
+  }
+
   void TearDown() override {
     Mock::VerifyAndClear(socketHandler.get());
     Mock::VerifyAndClear(observingHandler.get());
@@ -259,3 +302,85 @@ TEST_F(ObservingHandlerTest, WriteError) {
   auto buf = IOBuf::copyBuffer("data");
   observingHandler->onNext( buf);
 }
+
+TEST_F(ObservingHandlerTest, SlowSubscriberDropOldest) {
+  InSequence dummy;
+  subscribe();
+
+  SlowSubscriberOptions options;
+  options.maxQueuedBytes = 16;
+  observingHandler->setSlowSubscriberOptions(options);
+  // Half for the socket, half for the queue
+  EXPECT_EQ(8, pipeline->getWriteBufferWaterMarks().second);
+
+  expectWrite("data1");
+  broadcast("data1");
+
+  // Queued while the socket doesn't keep up, oldest first out
+  setWritable(false);
+  broadcast("data2");
+  broadcast("data3");
+  EXPECT_EQ(5, observingHandler->getQueuedBytes());
+  broadcast("data4");
+
+  expectWrite("data4");
+  setWritable(true);
+  EXPECT_EQ(0, observingHandler->getQueuedBytes());
+
+  EXPECT_CALL(*observingHandler, close(_)).Times(1);
+  observingHandler->onCompleted();
+}
+
+TEST_F(ObservingHandlerTest, SlowSubscriberSkipToKeyframe) {
+  InSequence dummy;
+  subscribe();
+
+  SlowSubscriberOptions options;
+  options.maxQueuedBytes = 20;
+  options.policy = SlowSubscriberOptions::Policy::SKIP_TO_KEYFRAME;
+  options.isKeyframe = [](const IOBuf& buf) {
+    return buf.length() > 0 && buf.data()[0] == 'K';
+  };
+  observingHandler->setSlowSubscriberOptions(options);
+
+  setWritable(false);
+  broadcast("Kaa");
+  broadcast("bbb");
+  broadcast("Kcc");
+  // Over the bound: back to the latest keyframe
+  broadcast("ddd");
+  EXPECT_EQ(6, observingHandler->getQueuedBytes());
+
+  // Still over once back at the keyframe: skips to the next one
+  broadcast("eeeee");
+  EXPECT_EQ(0, observingHandler->getQueuedBytes());
+  broadcast("fff");
+  EXPECT_EQ(0, observingHandler->getQueuedBytes());
+  broadcast("Kgg");
+  broadcast("hhh");
+
+  expectWrite("Kgg");
+  expectWrite("hhh");
+  setWritable(true);
+
+  EXPECT_CALL(*observingHandler, close(_)).Times(1);
+  observingHandler->onCompleted();
+}
+
+TEST_F(ObservingHandlerTest, SlowSubscriberDisconnect) {
+  InSequence dummy;
+  subscribe();
+
+  SlowSubscriberOptions options;
+  options.maxQueuedBytes = 16;
+  options.policy = SlowSubscriberOptions::Policy::DISCONNECT;
+  observingHandler->setSlowSubscriberOptions(options);
+
+  setWritable(false);
+  broadcast("data1");
+
+  EXPECT_CALL(*broadcastHandler, unsubscribe(_)).Times(1);
+  EXPECT_CALL(*observingHandler, close(_)).Times(1);
+  broadcast("data2");
+  EXPECT_EQ(0, observingHandler->getQueuedBytes());
+}
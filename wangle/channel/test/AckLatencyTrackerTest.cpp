@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/channel/AckLatencyTracker.h>
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <unistd.h>
+
+using namespace folly::wangle;
+
+#ifdef WANGLE_HAVE_TX_ACK_TIMESTAMPS
+
+namespace {
+
+// An error queue entry like the kernel's for the ack of the byte at
+// offset key, at delay after now
+class AckMessage {
+ public:
+  AckMessage(uint32_t key, std::chrono::milliseconds delay) {
+    memset(control_, 0, sizeof(control_));
+    memset(&msg_, 0, sizeof(msg_));
+    msg_.msg_control = control_;
+    msg_.msg_controllen = sizeof(control_);
+
+    auto cmsg = CMSG_FIRSTHDR(&msg_);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_TIMESTAMPING;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(scm_timestamping));
+    auto ts = reinterpret_cast<scm_timestamping*>(CMSG_DATA(cmsg));
+    clock_gettime(CLOCK_REALTIME, &ts->ts[0]);
+    auto ns = ts->ts[0].tv_nsec +
+      std::chrono::nanoseconds(delay).count();
+    ts->ts[0].tv_sec += ns / 1000000000;
+    ts->ts[0].tv_nsec = ns % 1000000000;
+
+    cmsg = CMSG_NXTHDR(&msg_, cmsg);
+    cmsg->cmsg_level = IPPROTO_IP;
+    cmsg->cmsg_type = IP_RECVERR;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(sock_extended_err));
+    auto err = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cmsg));
+    err->ee_origin = SO_EE_ORIGIN_TIMESTAMPING;
+    err->ee_info = SCM_TSTAMP_ACK;
+    err->ee_data = key;
+  }
+
+  const msghdr& get() const {
+    return msg_;
+  }
+
+ private:
+  alignas(cmsghdr) char control_[CMSG_SPACE(sizeof(scm_timestamping)) +
+                                 CMSG_SPACE(sizeof(sock_extended_err))];
+  msghdr msg_;
+};
+
+class AckLatencyTrackerTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd_, 0);
+    ASSERT_TRUE(tracker_.enable(fd_));
+  }
+
+  void TearDown() override {
+    close(fd_);
+  }
+
+  int fd_{-1};
+  AckLatencyTracker tracker_;
+};
+
+}
+
+TEST_F(AckLatencyTrackerTest, AcksMatchWritesByLastByte) {
+  tracker_.onWrite(100);
+  tracker_.onWrite(50);
+
+  // Not yet past the first write's last byte
+  EXPECT_TRUE(tracker_.onErrorMessage(
+    AckMessage(98, std::chrono::milliseconds(5)).get()));
+  EXPECT_EQ(0, tracker_.getAckLatencyHistogram().count());
+
+  EXPECT_TRUE(tracker_.onErrorMessage(
+    AckMessage(99, std::chrono::milliseconds(5)).get()));
+  EXPECT_EQ(1, tracker_.getAckLatencyHistogram().count());
+  EXPECT_GE(tracker_.getLastAckLatency(), std::chrono::milliseconds(4));
+
+  EXPECT_TRUE(tracker_.onErrorMessage(
+    AckMessage(149, std::chrono::milliseconds(5)).get()));
+  EXPECT_EQ(2, tracker_.getAckLatencyHistogram().count());
+}
+
+TEST_F(AckLatencyTrackerTest, BytesSentDifferFromWritten) {
+  // As a TLS socket reports, ciphertext with record overhead
+  tracker_.onBytesSent(129);
+  // A write fully buffered by the socket adds nothing
+  tracker_.onBytesSent(129);
+  tracker_.onBytesSent(258);
+
+  // The plaintext offset of the first write's end isn't its end
+  EXPECT_TRUE(tracker_.onErrorMessage(
+    AckMessage(99, std::chrono::milliseconds(5)).get()));
+  EXPECT_EQ(0, tracker_.getAckLatencyHistogram().count());
+
+  EXPECT_TRUE(tracker_.onErrorMessage(
+    AckMessage(128, std::chrono::milliseconds(5)).get()));
+  EXPECT_EQ(1, tracker_.getAckLatencyHistogram().count());
+  EXPECT_TRUE(tracker_.onErrorMessage(
+    AckMessage(257, std::chrono::milliseconds(5)).get()));
+  EXPECT_EQ(2, tracker_.getAckLatencyHistogram().count());
+}
+
+TEST_F(AckLatencyTrackerTest, OtherMessagesIgnored) {
+  tracker_.onWrite(10);
+  msghdr empty;
+  memset(&empty, 0, sizeof(empty));
+  EXPECT_FALSE(tracker_.onErrorMessage(empty));
+  EXPECT_EQ(0, tracker_.getAckLatencyHistogram().count());
+}
+
+#endif
@@ -0,0 +1,471 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/Pipeline.h>
+#include <folly/FileUtil.h>
+#include <folly/SocketAddress.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace folly;
+using namespace folly::wangle;
+
+typedef Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> BytesPipeline;
+
+// A connected pair of loopback TCP sockets, as zero-copy needs TCP
+static std::pair<int, int> tcpPair() {
+  SocketAddress any("127.0.0.1", 0);
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_storage addr;
+  auto len = any.getAddress(&addr);
+  CHECK_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&addr), len));
+  CHECK_EQ(0, listen(listener, 1));
+  SocketAddress bound;
+  bound.setFromLocalAddress(listener);
+  int client = socket(AF_INET, SOCK_STREAM, 0);
+  len = bound.getAddress(&addr);
+  CHECK_EQ(0, connect(client, reinterpret_cast<sockaddr*>(&addr), len));
+  int server = accept(listener, nullptr, nullptr);
+  CHECK_GE(server, 0);
+  closeNoInt(listener);
+  return std::make_pair(server, client);
+}
+
+static std::string receiveAll(int fd, size_t n) {
+  std::string received;
+  char buf[1024];
+  while (received.size() < n) {
+    auto r = recv(fd, buf, sizeof(buf), 0);
+    CHECK_GT(r, 0);
+    received.append(buf, r);
+  }
+  return received;
+}
+
+TEST(AsyncSocketHandler, RecyclesWriteCallbacks) {
+  EventBase evb;
+  auto fds = tcpPair();
+  auto socket = AsyncSocket::newSocket(&evb, fds.first);
+  AsyncSocketHandler handler(socket);
+  BytesPipeline pipeline;
+  pipeline.addBack(&handler).finalize();
+
+  AsyncSocketHandler::prewarmThread(4);
+  auto pooled = AsyncSocketHandler::getNumFreeWriteCallbacks();
+  EXPECT_LE(4, pooled);
+
+  // Small writes complete right away, handing their callbacks back
+  auto f1 = pipeline.write(IOBuf::copyBuffer("hello "));
+  auto f2 = pipeline.write(IOBuf::copyBuffer("world"));
+  ASSERT_TRUE(f1.isReady());
+  ASSERT_TRUE(f2.isReady());
+  EXPECT_FALSE(f1.getTry().hasException());
+  EXPECT_FALSE(f2.getTry().hasException());
+  EXPECT_EQ(pooled, AsyncSocketHandler::getNumFreeWriteCallbacks());
+  EXPECT_EQ("hello world", receiveAll(fds.second, 11));
+
+  // A failed write gets its error, and leaves no promise behind for the
+  // write that reuses its callback
+  shutdown(fds.first, SHUT_WR);
+  auto failed = pipeline.write(IOBuf::copyBuffer("lost"));
+  ASSERT_TRUE(failed.isReady());
+  EXPECT_TRUE(failed.getTry().hasException());
+  EXPECT_EQ(pooled, AsyncSocketHandler::getNumFreeWriteCallbacks());
+
+  auto other = tcpPair();
+  auto otherSocket = AsyncSocket::newSocket(&evb, other.first);
+  AsyncSocketHandler otherHandler(otherSocket);
+  BytesPipeline otherPipeline;
+  otherPipeline.addBack(&otherHandler).finalize();
+  auto f3 = otherPipeline.write(IOBuf::copyBuffer("again"));
+  ASSERT_TRUE(f3.isReady());
+  EXPECT_FALSE(f3.getTry().hasException());
+  EXPECT_EQ("again", receiveAll(other.second, 5));
+  closeNoInt(fds.second);
+  closeNoInt(other.second);
+}
+
+TEST(AsyncSocketHandler, FireAndForgetWrites) {
+  EventBase evb;
+  auto fds = tcpPair();
+  auto socket = AsyncSocket::newSocket(&evb, fds.first);
+  AsyncSocketHandler handler(socket);
+  handler.setFireAndForgetWrites(true);
+  BytesPipeline pipeline;
+  pipeline.addBack(&handler).finalize();
+
+  auto pooled = AsyncSocketHandler::getNumFreeWriteCallbacks();
+  auto f = pipeline.write(IOBuf::copyBuffer("hello"));
+  EXPECT_TRUE(f.isReady());
+  EXPECT_EQ("hello", receiveAll(fds.second, 5));
+
+  // Errors are only logged
+  shutdown(fds.first, SHUT_WR);
+  f = pipeline.write(IOBuf::copyBuffer("lost"));
+  ASSERT_TRUE(f.isReady());
+  EXPECT_FALSE(f.getTry().hasException());
+  // No pooled callback was taken for either
+  EXPECT_EQ(pooled, AsyncSocketHandler::getNumFreeWriteCallbacks());
+  closeNoInt(fds.second);
+}
+
+TEST(AsyncSocketHandler, ZeroCopyWrites) {
+  EventBase evb;
+  auto fds = tcpPair();
+  auto socket = AsyncSocket::newSocket(&evb, fds.first);
+  AsyncSocketHandler handler(socket);
+  handler.setZeroCopyWrites(true, 4096);
+  if (!handler.getZeroCopyWriter()->isEnabled()) {
+    LOG(INFO) << "No MSG_ZEROCOPY here, skipping";
+    closeNoInt(fds.second);
+    return;
+  }
+
+  BytesPipeline pipeline;
+  pipeline.addBack(&handler).finalize();
+  pipeline.transportActive();
+
+  const size_t kLarge = 1024 * 1024;
+  std::string large(kLarge, 'z');
+  auto f = pipeline.write(IOBuf::copyBuffer(large));
+  auto small = pipeline.write(IOBuf::copyBuffer("small"));
+
+  // Read it all while the writes complete
+  std::string received;
+  char buf[64 * 1024];
+  while (received.size() < kLarge + 5 || !f.isReady()) {
+    evb.loopOnce(EVLOOP_NONBLOCK);
+    auto n = recv(fds.second, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      received.append(buf, n);
+    }
+  }
+  EXPECT_FALSE(f.getTry().hasException());
+  EXPECT_TRUE(small.isReady());
+  EXPECT_EQ(large + "small", received);
+
+  auto& stats = handler.getZeroCopyWriter()->getStats();
+  // Loopback makes the kernel copy, but the bytes are accounted for
+  EXPECT_EQ(kLarge + 5, stats.zeroCopyBytes + stats.fallbackBytes);
+  EXPECT_EQ(0, handler.getZeroCopyWriter()->getHeldWrites());
+  closeNoInt(fds.second);
+}
+
+TEST(AsyncSocketHandler, ZeroCopyWritesCompleteWithoutReading) {
+  EventBase evb;
+  auto fds = tcpPair();
+  auto socket = AsyncSocket::newSocket(&evb, fds.first);
+  AsyncSocketHandler handler(socket);
+  handler.setZeroCopyWrites(true, 4096);
+  if (!handler.getZeroCopyWriter()->isEnabled()) {
+    LOG(INFO) << "No MSG_ZEROCOPY here, skipping";
+    closeNoInt(fds.second);
+    return;
+  }
+
+  BytesPipeline pipeline;
+  pipeline.addBack(&handler).finalize();
+  pipeline.transportActive();
+  // Completions come in whether or not anything reads the socket
+  handler.detachReadCallback();
+
+  const size_t kLarge = 1024 * 1024;
+  auto first = pipeline.write(IOBuf::copyBuffer(std::string(kLarge, 'a')));
+  auto second = pipeline.write(IOBuf::copyBuffer(std::string(kLarge, 'b')));
+  // The second write's buffer outlives the writer, until the kernel is
+  // done with it
+  handler.setZeroCopyWrites(false);
+
+  size_t received = 0;
+  char buf[64 * 1024];
+  while (received < 2 * kLarge || !first.isReady() || !second.isReady()) {
+    evb.loopOnce(EVLOOP_NONBLOCK);
+    auto n = recv(fds.second, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      received += n;
+    }
+  }
+  EXPECT_FALSE(first.getTry().hasException());
+  EXPECT_FALSE(second.getTry().hasException());
+  EXPECT_EQ(2 * kLarge, received);
+  closeNoInt(fds.second);
+}
+
+class Collector : public InboundHandler<IOBufQueue&> {
+ public:
+  void read(Context* ctx, IOBufQueue& q) override {
+    while (!q.empty()) {
+      auto buf = q.pop_front();
+      for (auto& range : *buf) {
+        received.append(reinterpret_cast<const char*>(range.data()),
+                        range.size());
+      }
+    }
+  }
+
+  void readEOF(Context* ctx) override {
+    eof = true;
+  }
+
+  std::string received;
+  bool eof{false};
+};
+
+TEST(AsyncSocketHandler, ZeroCopyReads) {
+  EventBase evb;
+  auto fds = tcpPair();
+  auto socket = AsyncSocket::newSocket(&evb, fds.first);
+  AsyncSocketHandler handler(socket);
+  handler.setZeroCopyReads(true, 64 * 1024);
+  if (!handler.getZeroCopyReader()->isEnabled()) {
+    LOG(INFO) << "No TCP_ZEROCOPY_RECEIVE here, skipping";
+    closeNoInt(fds.second);
+    return;
+  }
+
+  Collector collector;
+  BytesPipeline pipeline;
+  pipeline.addBack(&handler).addBack(&collector).finalize();
+  pipeline.transportActive();
+
+  const size_t kLarge = 1024 * 1024;
+  std::string sent;
+  for (size_t i = 0; i < kLarge; i++) {
+    sent.push_back('a' + i % 26);
+  }
+  size_t written = 0;
+  while (written < kLarge) {
+    auto n = send(fds.second, sent.data() + written, kLarge - written,
+                  MSG_DONTWAIT);
+    if (n > 0) {
+      written += n;
+    }
+    evb.loopOnce(EVLOOP_NONBLOCK);
+  }
+  shutdown(fds.second, SHUT_WR);
+  while (!collector.eof) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ(sent, collector.received);
+
+  // Loopback rarely lines payloads up with pages, so how much was mapped
+  // varies, but it's whole pages, all received into the one region, as
+  // the collector lets go of everything before the next receive
+  auto& stats = handler.getZeroCopyReader()->getStats();
+  EXPECT_EQ(0, stats.mappedBytes % sysconf(_SC_PAGESIZE));
+  EXPECT_EQ(1, stats.mappings);
+  closeNoInt(fds.second);
+}
+
+TEST(AsyncSocketHandler, ReadBufferAllocator) {
+  EventBase evb;
+  auto fds = tcpPair();
+  auto socket = AsyncSocket::newSocket(&evb, fds.first);
+  AsyncSocketHandler handler(socket);
+  auto allocator = std::make_shared<SlabReadBufferAllocator>(4096, 16384);
+
+  Collector collector;
+  BytesPipeline pipeline;
+  pipeline.setReadBufferAllocator(allocator);
+  pipeline.addBack(&handler).addBack(&collector).finalize();
+  pipeline.transportActive();
+
+  CHECK_EQ(5, send(fds.second, "hello", 5, 0));
+  while (collector.received.size() < 5) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ("hello", collector.received);
+  EXPECT_EQ(1, allocator->getThreadSlabs());
+  closeNoInt(fds.second);
+}
+
+// Takes 4 byte frames, leaving a partial one in the queue
+class FrameCollector : public InboundHandler<IOBufQueue&> {
+ public:
+  void read(Context* ctx, IOBufQueue& q) override {
+    while (q.chainLength() >= 4) {
+      auto frame = q.split(4);
+      frame->coalesce();
+      frames.emplace_back(reinterpret_cast<const char*>(frame->data()),
+                          frame->length());
+    }
+    left = q.chainLength();
+  }
+
+  std::vector<std::string> frames;
+  size_t left{0};
+};
+
+// Counts the read buffers it hands out and how many have been freed
+class CountingAllocator : public ReadBufferAllocator {
+ public:
+  std::unique_ptr<IOBuf> allocate(uint64_t size) override {
+    allocations++;
+    return IOBuf::takeOwnership(
+        new uint8_t[size], size, 0,
+        [](void* buf, void* frees) {
+          delete[] static_cast<uint8_t*>(buf);
+          ++*static_cast<int*>(frees);
+        },
+        &frees);
+  }
+
+  int allocations{0};
+  int frees{0};
+};
+
+TEST(AsyncSocketHandler, ReleaseIdleReadBuffer) {
+  EventBase evb;
+  auto fds = tcpPair();
+  auto socket = AsyncSocket::newSocket(&evb, fds.first);
+  AsyncSocketHandler handler(socket);
+  handler.setReleaseIdleReadBuffer(true);
+  auto allocator = std::make_shared<CountingAllocator>();
+
+  FrameCollector collector;
+  BytesPipeline pipeline;
+  pipeline.setReadBufferAllocator(allocator);
+  pipeline.addBack(&handler).addBack(&collector).finalize();
+  pipeline.transportActive();
+
+  CHECK_EQ(6, send(fds.second, "abcdef", 6, 0));
+  while (collector.frames.size() < 1) {
+    evb.loopOnce();
+  }
+  // The partial frame was copied out of the read buffer, freeing it
+  EXPECT_EQ(2u, collector.left);
+  EXPECT_EQ(1, allocator->allocations);
+  EXPECT_EQ(1, allocator->frees);
+
+  CHECK_EQ(2, send(fds.second, "gh", 2, 0));
+  while (collector.frames.size() < 2) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ("efgh", collector.frames[1]);
+  EXPECT_EQ(0u, collector.left);
+  EXPECT_EQ(2, allocator->allocations);
+  EXPECT_EQ(2, allocator->frees);
+  closeNoInt(fds.second);
+}
+
+TEST(AsyncSocketHandler, SharedReadBuffer) {
+  EventBase evb;
+  auto fds1 = tcpPair();
+  auto fds2 = tcpPair();
+  AsyncSocketHandler handler1(AsyncSocket::newSocket(&evb, fds1.first));
+  AsyncSocketHandler handler2(AsyncSocket::newSocket(&evb, fds2.first));
+  handler1.setUseSharedReadBuffer(true);
+  handler2.setUseSharedReadBuffer(true);
+  FrameCollector collector1;
+  FrameCollector collector2;
+  BytesPipeline pipeline1;
+  BytesPipeline pipeline2;
+  pipeline1.addBack(&handler1).addBack(&collector1).finalize();
+  pipeline2.addBack(&handler2).addBack(&collector2).finalize();
+  pipeline1.transportActive();
+  pipeline2.transportActive();
+
+  // Both read into the same buffer, and each keeps only its own bytes
+  CHECK_EQ(6, send(fds1.second, "abcdef", 6, 0));
+  while (collector1.frames.size() < 1) {
+    evb.loopOnce();
+  }
+  CHECK_EQ(6, send(fds2.second, "wxyz12", 6, 0));
+  while (collector2.frames.size() < 1) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ("abcd", collector1.frames[0]);
+  EXPECT_EQ("wxyz", collector2.frames[0]);
+  EXPECT_EQ(2u, collector1.left);
+  EXPECT_EQ(2u, collector2.left);
+
+  // The partial frames survive the other's reads
+  CHECK_EQ(2, send(fds1.second, "gh", 2, 0));
+  while (collector1.frames.size() < 2) {
+    evb.loopOnce();
+  }
+  CHECK_EQ(2, send(fds2.second, "34", 2, 0));
+  while (collector2.frames.size() < 2) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ("efgh", collector1.frames[1]);
+  EXPECT_EQ("1234", collector2.frames[1]);
+  EXPECT_EQ(0u, collector1.left);
+  EXPECT_EQ(0u, collector2.left);
+  closeNoInt(fds1.second);
+  closeNoInt(fds2.second);
+}
+
+TEST(AsyncSocketHandler, WriteBufferWaterMarks) {
+  class WritabilityTester : public InboundHandler<IOBufQueue&> {
+   public:
+    void read(Context* /*ctx*/, IOBufQueue& /*q*/) override {}
+
+    void writabilityChanged(Context* ctx) override {
+      changes.push_back(ctx->isWritable());
+    }
+
+    std::vector<bool> changes;
+  };
+
+  EventBase evb;
+  int fds[2];
+  CHECK_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  int bufSize = 16 * 1024;
+  setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof(bufSize));
+  setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+  AsyncSocketHandler handler(AsyncSocket::newSocket(&evb, fds[0]));
+  WritabilityTester tester;
+  BytesPipeline pipeline;
+  pipeline.addBack(&handler).addBack(&tester).finalize();
+  const uint64_t kLow = 16 * 1024;
+  const uint64_t kHigh = 64 * 1024;
+  pipeline.setWriteBufferWaterMarks(kLow, kHigh);
+
+  // Writes complete right away until the peer stops reading and the
+  // socket's send buffer fills up; then they stay pending
+  const std::string chunk(8 * 1024, 'x');
+  std::string sent;
+  while (pipeline.isWritable()) {
+    ASSERT_LT(sent.size(), 64 * 1024 * 1024);
+    pipeline.write(IOBuf::copyBuffer(chunk));
+    sent += chunk;
+  }
+  EXPECT_LT(kHigh, handler.getPendingWriteBytes());
+  ASSERT_EQ(1, tester.changes.size());
+  EXPECT_FALSE(tester.changes[0]);
+
+  // Reading lets the writes complete, which drain the pending bytes
+  std::string received;
+  char buf[4096];
+  while (received.size() < sent.size()) {
+    auto r = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+    if (r > 0) {
+      received.append(buf, r);
+    }
+    evb.loopOnce(EVLOOP_NONBLOCK);
+    if (tester.changes.size() == 1) {
+      EXPECT_LT(kLow, handler.getPendingWriteBytes());
+    }
+  }
+  EXPECT_EQ(sent, received);
+  EXPECT_TRUE(pipeline.isWritable());
+  EXPECT_EQ(0, handler.getPendingWriteBytes());
+  ASSERT_EQ(2, tester.changes.size());
+  EXPECT_TRUE(tester.changes[1]);
+  closeNoInt(fds[1]);
+}
@@ -0,0 +1,165 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/StaticPipeline.h>
+#include <wangle/channel/EventBaseHandler.h>
+#include <wangle/channel/test/MockHandler.h>
+#include <folly/Baton.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace folly;
+using namespace folly::wangle;
+using namespace testing;
+
+typedef StrictMock<MockHandlerAdapter<
+  IOBufQueue&,
+  std::unique_ptr<IOBuf>>>
+MockBytesHandler;
+
+MATCHER_P(IOBufContains, str, "") { return arg->moveToFbString() == str; }
+
+TEST(NonBlockingEventBaseHandlerTest, WritesFromOtherThreads) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    NonBlockingEventBaseHandler>
+  pipeline(&mockHandler, NonBlockingEventBaseHandler{});
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline.setTransport(socket);
+  std::thread loop([&]() {
+    eb.loopForever();
+  });
+
+  {
+    InSequence s;
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("hello")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("world")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("!")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("now")));
+  }
+
+  // Keep the loop busy
+  Baton<> busy, unblock;
+  Future<Unit> f3;
+  eb.runInEventBaseThread([&]() {
+    busy.post();
+    unblock.wait();
+    // In the loop's thread, behind the writes still queued
+    f3 = pipeline.write(IOBuf::copyBuffer("!"));
+  });
+  busy.wait();
+
+  // Queued without waiting for the loop
+  auto f1 = pipeline.write(IOBuf::copyBuffer("hello"));
+  auto f2 = pipeline.write(IOBuf::copyBuffer("world"));
+  EXPECT_FALSE(f1.isReady());
+  EXPECT_FALSE(f2.isReady());
+  unblock.post();
+  f1.wait();
+  f2.wait();
+
+  eb.runInEventBaseThreadAndWait([&]() {
+    EXPECT_TRUE(f3.isReady());
+    // Nothing queued, straight through
+    auto f4 = pipeline.write(IOBuf::copyBuffer("now"));
+    EXPECT_TRUE(f4.isReady());
+  });
+
+  eb.terminateLoopSoon();
+  loop.join();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(NonBlockingEventBaseHandlerTest, WriteDuringDrainIsQueued) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    NonBlockingEventBaseHandler>
+  pipeline(&mockHandler, NonBlockingEventBaseHandler{});
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline.setTransport(socket);
+  std::thread loop([&]() {
+    eb.loopForever();
+  });
+
+  // Written from the loop's thread by the first queued write, while the
+  // second is still waiting to run
+  Future<Unit> nested;
+  Baton<> done;
+  {
+    InSequence s;
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("first")))
+      .WillOnce(InvokeWithoutArgs([&] {
+        nested = pipeline.write(IOBuf::copyBuffer("nested"));
+      }));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("second")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("nested")))
+      .WillOnce(InvokeWithoutArgs([&] { done.post(); }));
+  }
+
+  Baton<> busy, unblock;
+  eb.runInEventBaseThread([&]() {
+    busy.post();
+    unblock.wait();
+  });
+  busy.wait();
+  auto f1 = pipeline.write(IOBuf::copyBuffer("first"));
+  auto f2 = pipeline.write(IOBuf::copyBuffer("second"));
+  unblock.post();
+  f1.wait();
+  f2.wait();
+  done.wait();
+
+  eb.terminateLoopSoon();
+  loop.join();
+  EXPECT_TRUE(nested.isReady());
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(NonBlockingEventBaseHandlerTest, CloseFromOtherThread) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    NonBlockingEventBaseHandler>
+  pipeline(&mockHandler, NonBlockingEventBaseHandler{});
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline.setTransport(socket);
+  std::thread loop([&]() {
+    eb.loopForever();
+  });
+
+  {
+    InSequence s;
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("bye")));
+    EXPECT_CALL(mockHandler, close_(_));
+  }
+  auto f1 = pipeline.write(IOBuf::copyBuffer("bye"));
+  auto f2 = pipeline.close();
+  f1.wait();
+  f2.wait();
+  EXPECT_FALSE(f2.hasException());
+
+  eb.terminateLoopSoon();
+  loop.join();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
@@ -0,0 +1,133 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/ExecutorHandler.h>
+#include <wangle/channel/Pipeline.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace folly;
+using namespace folly::wangle;
+
+typedef Pipeline<int, int> IntPipeline;
+
+// Counts the tasks it passes on
+class CountingExecutor : public Executor {
+ public:
+  explicit CountingExecutor(size_t threads) : executor_(threads) {}
+
+  void add(Func f) override {
+    tasks++;
+    executor_.add(std::move(f));
+  }
+
+  std::atomic<int> tasks{0};
+
+ private:
+  CPUThreadPoolExecutor executor_;
+};
+
+class WriteRecorder : public HandlerAdapter<int, int> {
+ public:
+  explicit WriteRecorder(std::vector<int>* writes) : writes_(writes) {}
+
+  Future<Unit> write(Context* ctx, int msg) override {
+    writes_->push_back(msg);
+    return makeFuture();
+  }
+
+ private:
+  std::vector<int>* writes_;
+};
+
+class ExecutorHandlerTest : public testing::Test {
+ protected:
+  void build(ExecutorHandler<int>::Options options,
+             ExecutorHandler<int>::Function function) {
+    pipeline_.reset(new IntPipeline);
+    pipeline_->addBack(WriteRecorder(&writes_));
+    pipeline_->addBack(
+      ExecutorHandler<int>(executor_, std::move(function), options));
+    pipeline_->finalize();
+  }
+
+  void waitForWrites(size_t count) {
+    auto base = EventBaseManager::get()->getEventBase();
+    while (writes_.size() < count) {
+      base->loopOnce();
+    }
+  }
+
+  std::shared_ptr<CountingExecutor> executor_{
+    std::make_shared<CountingExecutor>(4)};
+  IntPipeline::UniquePtr pipeline_;
+  std::vector<int> writes_;
+};
+
+TEST_F(ExecutorHandlerTest, BatchesPerLoop) {
+  std::atomic<int> offloaded{0};
+  auto io = std::this_thread::get_id();
+  build(ExecutorHandler<int>::Options(), [&](int msg) {
+    if (std::this_thread::get_id() != io) {
+      offloaded++;
+    }
+    return msg * 10;
+  });
+
+  for (int i = 0; i < 5; i++) {
+    pipeline_->read(i);
+  }
+  waitForWrites(5);
+  EXPECT_EQ(std::vector<int>({0, 10, 20, 30, 40}), writes_);
+  EXPECT_EQ(5, offloaded);
+  // One task for the loop iteration's reads
+  EXPECT_EQ(1, executor_->tasks);
+}
+
+TEST_F(ExecutorHandlerTest, OrderedAcrossBatches) {
+  ExecutorHandler<int>::Options options;
+  options.maxBatchSize = 2;
+  build(options, [](int msg) {
+    // The first batch finishes last
+    if (msg < 2) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return msg;
+  });
+
+  for (int i = 0; i < 6; i++) {
+    pipeline_->read(i);
+  }
+  waitForWrites(6);
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 4, 5}), writes_);
+  EXPECT_EQ(3, executor_->tasks);
+}
+
+TEST_F(ExecutorHandlerTest, Unordered) {
+  ExecutorHandler<int>::Options options;
+  options.maxBatchSize = 2;
+  options.ordered = false;
+  build(options, [](int msg) {
+    if (msg < 2) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    return msg;
+  });
+
+  for (int i = 0; i < 4; i++) {
+    pipeline_->read(i);
+  }
+  waitForWrites(4);
+  // The slow first batch is written last
+  EXPECT_EQ(std::vector<int>({2, 3, 0, 1}), writes_);
+}
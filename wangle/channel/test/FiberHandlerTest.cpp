@@ -0,0 +1,81 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/FiberHandler.h>
+#include <wangle/channel/Pipeline.h>
+#include <gtest/gtest.h>
+
+using namespace folly;
+using namespace folly::wangle;
+
+typedef Pipeline<std::string, std::string> StringPipeline;
+
+class WriteRecorder : public HandlerAdapter<std::string, std::string> {
+ public:
+  Future<Unit> write(Context* ctx, std::string msg) override {
+    writes.push_back(std::move(msg));
+    return makeFuture();
+  }
+
+  std::vector<std::string> writes;
+};
+
+// Answers "hello" with "hi <name>" once the next message gives the name
+class GreetingHandler : public FiberHandler<std::string> {
+ public:
+  explicit GreetingHandler(bool* finished) : finished_(finished) {}
+
+ protected:
+  void run(Context* ctx) override {
+    while (auto msg = readMessage()) {
+      if (*msg != "hello") {
+        writeMessage("what?");
+        continue;
+      }
+      auto name = readMessage();
+      if (!name) {
+        break;
+      }
+      writeMessage("hi " + *name);
+    }
+    *finished_ = true;
+  }
+
+ private:
+  bool* finished_;
+};
+
+TEST(FiberHandler, StraightLineProtocol) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  WriteRecorder recorder;
+  bool finished = false;
+  StringPipeline pipeline;
+  pipeline
+    .addBack(&recorder)
+    .addBack(GreetingHandler(&finished))
+    .finalize();
+
+  pipeline.read("hello");
+  evb->loopOnce();
+  // Waiting for the name
+  EXPECT_TRUE(recorder.writes.empty());
+
+  pipeline.read("bob");
+  pipeline.read("bye");
+  evb->loopOnce();
+  ASSERT_EQ(2, recorder.writes.size());
+  EXPECT_EQ("hi bob", recorder.writes[0]);
+  EXPECT_EQ("what?", recorder.writes[1]);
+  EXPECT_FALSE(finished);
+
+  pipeline.readEOF();
+  evb->loopOnce();
+  EXPECT_TRUE(finished);
+}
@@ -14,13 +14,33 @@
  * limitations under the License.
  */
 #include <wangle/channel/FileRegion.h>
+#include <wangle/channel/LoopbackSocket.h>
 #include <folly/io/async/test/AsyncSocketTest.h>
 #include <gtest/gtest.h>
 
+#include <dirent.h>
+
+#include <chrono>
+#include <thread>
+
 using namespace folly;
 using namespace folly::wangle;
 using namespace testing;
 
+namespace {
+
+size_t openFds() {
+  size_t count = 0;
+  auto dir = opendir("/proc/self/fd");
+  while (readdir(dir)) {
+    count++;
+  }
+  closedir(dir);
+  return count;
+}
+
+}
+
 struct FileRegionTest : public Test {
   FileRegionTest() {
     // Connect
@@ -108,3 +128,151 @@ TEST_F(FileRegionTest, Repeated) {
   }
   ASSERT_EQ(receivedBytes, sendCount*count);
 }
+
+TEST_F(FileRegionTest, Modes) {
+  size_t count = 1000000;
+  std::string data(count, 'x');
+  write(fd, data.data(), count);
+  // Just written, so in the page cache
+  EXPECT_TRUE(FileRegion::isResident(fd, 0, count));
+  EXPECT_TRUE(FileRegion::isResident(fd, 1000, 1000));
+
+  std::vector<Future<Unit>> fs;
+  for (auto mode : {FileRegion::Mode::SPLICE,
+                    FileRegion::Mode::SENDFILE,
+                    FileRegion::Mode::ADAPTIVE}) {
+    FileRegion fileRegion(fd, 0, count, mode);
+    fs.push_back(fileRegion.transferTo(socket));
+  }
+  ASSERT_NO_THROW(collect(fs).getVia(&evb));
+
+  socket->shutdownWrite();
+  evb.loop();
+
+  ASSERT_EQ(rcb.state, STATE_SUCCEEDED);
+  size_t receivedBytes = 0;
+  for (auto& buf : rcb.buffers) {
+    receivedBytes += buf.length;
+    ASSERT_EQ(memcmp(buf.buffer, data.data(), buf.length), 0);
+  }
+  ASSERT_EQ(receivedBytes, 3 * count);
+}
+
+TEST_F(FileRegionTest, PipePool) {
+  size_t count = 100000;
+  std::string data(count, 'x');
+  write(fd, data.data(), count);
+
+  auto before = FileRegion::getPipePoolStats();
+  int sendCount = 100;
+  for (int i = 0; i < sendCount; i++) {
+    FileRegion fileRegion(fd, 0, count, FileRegion::Mode::SPLICE);
+    ASSERT_NO_THROW(fileRegion.transferTo(socket).getVia(&evb));
+  }
+  auto after = FileRegion::getPipePoolStats();
+  EXPECT_EQ(sendCount,
+            after.hits + after.misses - before.hits - before.misses);
+
+  socket->shutdownWrite();
+  evb.loop();
+  ASSERT_EQ(rcb.state, STATE_SUCCEEDED);
+}
+
+TEST_F(FileRegionTest, CancelledWhileWaitingOnPeer) {
+  // More than the socket buffers and the pipe take, so with the peer not
+  // reading, the splice into the pipe is left waiting for room
+  size_t count = 32 * 1048576;
+  std::string data(count, 'x');
+  write(fd, data.data(), count);
+  acceptedSocket->setReadCB(nullptr);
+
+  auto before = FileRegion::getPipePoolStats();
+  auto fdsBefore = openFds();
+  FileRegion fileRegion(fd, 0, count, FileRegion::Mode::SPLICE);
+  auto f = fileRegion.transferTo(socket);
+  evb.runAfterDelay([&]{ socket->closeNow(); }, 200);
+  EXPECT_THROW(f.getVia(&evb), AsyncSocketException);
+
+  // The request and its pipe go once the read thread cancels its splice;
+  // a pooled pipe was already open before, a new one wasn't
+  auto stats = FileRegion::getPipePoolStats();
+  ASSERT_EQ(1, stats.hits + stats.misses - before.hits - before.misses);
+  auto expected = fdsBefore - 2 * (stats.hits - before.hits);
+  for (int i = 0; i < 100 && openFds() != expected; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(expected, openFds());
+}
+
+TEST_F(FileRegionTest, Chain) {
+  std::string data;
+  for (int i = 0; i < 100000; i++) {
+    data.push_back('a' + i % 26);
+  }
+  write(fd, data.data(), data.size());
+
+  FileRegionChain chain;
+  chain
+    .append(IOBuf::copyBuffer("--part\r\n"))
+    .append(fd, 10, 50000)
+    .append(IOBuf::copyBuffer("\r\n--part\r\n"))
+    .append(fd, 0, 100);
+  EXPECT_EQ(8 + 50000 + 10 + 100, chain.length());
+  ASSERT_NO_THROW(chain.transferTo(socket).getVia(&evb));
+  EXPECT_TRUE(chain.empty());
+
+  socket->shutdownWrite();
+  evb.loop();
+
+  ASSERT_EQ(rcb.state, STATE_SUCCEEDED);
+  std::string received;
+  for (auto& buf : rcb.buffers) {
+    received.append(buf.buffer, buf.length);
+  }
+  EXPECT_EQ("--part\r\n" + data.substr(10, 50000) + "\r\n--part\r\n" +
+            data.substr(0, 100),
+            received);
+}
+
+TEST_F(FileRegionTest, Chunked) {
+  // A LoopbackSocket has no fd to splice or sendfile() into, so the region
+  // goes through it in chunks, more of them than are buffered at once
+  std::string data;
+  for (size_t i = 0; i < 5 * FileRegion::kChunkSize + 123; i++) {
+    data.push_back('a' + i % 26);
+  }
+  write(fd, data.data(), data.size());
+
+  ReadCallback peerRcb;
+  auto sockets = LoopbackSocket::newPair(&evb, &evb);
+  std::shared_ptr<AsyncSocket> writer(std::move(sockets.first));
+  sockets.second->setReadCB(&peerRcb);
+
+  // Read on the read pool, then in the EventBase
+  for (auto mode : {FileRegion::Mode::SPLICE, FileRegion::Mode::SENDFILE}) {
+    FileRegion fileRegion(fd, 0, data.size(), mode);
+    ASSERT_NO_THROW(fileRegion.transferTo(writer).getVia(&evb));
+  }
+
+  writer->shutdownWrite();
+  evb.loop();
+
+  ASSERT_EQ(peerRcb.state, STATE_SUCCEEDED);
+  std::string received;
+  for (auto& buf : peerRcb.buffers) {
+    received.append(buf.buffer, buf.length);
+  }
+  EXPECT_EQ(data + data, received);
+}
+
+TEST_F(FileRegionTest, ChunkedShortFile) {
+  // The region runs past the end of the file
+  std::string data(1000, 'x');
+  write(fd, data.data(), data.size());
+
+  auto sockets = LoopbackSocket::newPair(&evb, &evb);
+  std::shared_ptr<AsyncSocket> writer(std::move(sockets.first));
+  FileRegion fileRegion(fd, 0, 2 * data.size(), FileRegion::Mode::SENDFILE);
+  EXPECT_THROW(fileRegion.transferTo(writer).getVia(&evb),
+               AsyncSocketException);
+}
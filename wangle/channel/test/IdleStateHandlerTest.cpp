@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/IdleStateHandler.h>
+#include <wangle/channel/Pipeline.h>
+#include <gtest/gtest.h>
+
+using namespace folly;
+using namespace folly::wangle;
+using namespace std::chrono;
+
+class IdleCollector : public InboundHandler<IOBufQueue&> {
+ public:
+  void read(Context* ctx, IOBufQueue& q) override {
+    q.move();
+  }
+
+  void readException(Context* ctx, exception_wrapper e) override {
+    e.with_exception<IdleStateError>([&](IdleStateError& err) {
+      idle.push_back(err.getState());
+    });
+    if (e.is_compatible_with<ReadTimeoutError>()) {
+      timeouts++;
+    }
+  }
+
+  std::vector<IdleState> idle;
+  int timeouts{0};
+};
+
+class IdleStateHandlerTest : public testing::Test {
+ protected:
+  void readEvery(milliseconds interval, int times,
+                 Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>& pipeline) {
+    for (int i = 1; i <= times; i++) {
+      evb_->runAfterDelay([&] {
+        IOBufQueue q(IOBufQueue::cacheChainLength());
+        q.append(IOBuf::copyBuffer("x"));
+        pipeline.read(q);
+      }, (interval * i).count());
+    }
+  }
+
+  EventBase* evb_{EventBaseManager::get()->getEventBase()};
+};
+
+TEST_F(IdleStateHandlerTest, ReaderIdle) {
+  IdleCollector collector;
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  pipeline
+    .addBack(IdleStateHandler<>(milliseconds(50)))
+    .addBack(&collector)
+    .finalize();
+  pipeline.transportActive();
+
+  // Busy for 200ms, then idle for as long
+  readEvery(milliseconds(20), 10, pipeline);
+  std::vector<IdleState> atBusyEnd;
+  evb_->runAfterDelay([&] { atBusyEnd = collector.idle; }, 200);
+  evb_->runAfterDelay([&] { pipeline.readEOF(); }, 400);
+  evb_->loop();
+  EXPECT_TRUE(atBusyEnd.empty());
+  // Once each idle time, from between 50ms and 100ms after the last read
+  ASSERT_GE(collector.idle.size(), 2);
+  EXPECT_LE(collector.idle.size(), 4);
+  EXPECT_EQ(IdleState::READER_IDLE, collector.idle[0]);
+}
+
+TEST_F(IdleStateHandlerTest, WritesDontCountForReads) {
+  IdleCollector collector;
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  pipeline
+    .addBack(IdleStateHandler<>(milliseconds(50), milliseconds(0),
+                                milliseconds(200)))
+    .addBack(&collector)
+    .finalize();
+  pipeline.transportActive();
+
+  for (int i = 1; i <= 10; i++) {
+    evb_->runAfterDelay([&] {
+      pipeline.write(IOBuf::copyBuffer("x"));
+    }, 20 * i);
+  }
+  evb_->runAfterDelay([&] { pipeline.close(); }, 250);
+  evb_->loop();
+  ASSERT_FALSE(collector.idle.empty());
+  for (auto state : collector.idle) {
+    EXPECT_EQ(IdleState::READER_IDLE, state);
+  }
+}
+
+TEST_F(IdleStateHandlerTest, ReadTimeout) {
+  IdleCollector collector;
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  pipeline
+    .addBack(ReadTimeoutHandler<>(milliseconds(30)))
+    .addBack(&collector)
+    .finalize();
+  pipeline.transportActive();
+
+  // Once only
+  evb_->runAfterDelay([] {}, 200);
+  evb_->loop();
+  EXPECT_EQ(1, collector.timeouts);
+}
@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/LoopbackSocket.h>
+#include <folly/Baton.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace folly;
+using namespace folly::wangle;
+
+namespace {
+
+class ReadCallback : public AsyncTransportWrapper::ReadCallback {
+ public:
+  void getReadBuffer(void** bufReturn, size_t* lenReturn) override {
+    *bufReturn = buf_;
+    *lenReturn = sizeof(buf_);
+  }
+
+  void readDataAvailable(size_t len) noexcept override {
+    data.append(buf_, len);
+    if (expected > 0 && data.size() == expected) {
+      done.post();
+    }
+  }
+
+  void readEOF() noexcept override {
+    eof = true;
+  }
+
+  void readErr(const AsyncSocketException&) noexcept override {
+    error = true;
+  }
+
+  std::string data;
+  size_t expected{0};
+  Baton<> done;
+  bool eof{false};
+  bool error{false};
+
+ private:
+  char buf_[4096];
+};
+
+class BufferCallback : public ReadCallback,
+                       public LoopbackSocket::BufferReadCallback {
+ public:
+  void readBufferAvailable(std::unique_ptr<IOBuf> buf) noexcept override {
+    buffers.push_back(std::move(buf));
+  }
+
+  std::vector<std::unique_ptr<IOBuf>> buffers;
+};
+
+class WriteCallback : public AsyncTransportWrapper::WriteCallback {
+ public:
+  void writeSuccess() noexcept override {
+    successes++;
+  }
+
+  void writeErr(size_t, const AsyncSocketException&) noexcept override {
+    errors++;
+  }
+
+  int successes{0};
+  int errors{0};
+};
+
+}
+
+TEST(LoopbackSocket, Roundtrip) {
+  EventBase evb;
+  auto sockets = LoopbackSocket::newPair(&evb, &evb);
+  ReadCallback read1;
+  ReadCallback read2;
+  WriteCallback writes;
+  sockets.first->setReadCB(&read1);
+  sockets.second->setReadCB(&read2);
+  sockets.first->write(&writes, "hello", 5);
+  sockets.second->write(&writes, "world", 5);
+  EXPECT_EQ(2, writes.successes);
+  evb.loopOnce();
+  EXPECT_EQ("world", read1.data);
+  EXPECT_EQ("hello", read2.data);
+  EXPECT_TRUE(sockets.first->good());
+}
+
+TEST(LoopbackSocket, HandsOverBuffers) {
+  EventBase evb;
+  auto sockets = LoopbackSocket::newPair(&evb, &evb);
+  BufferCallback reader;
+  WriteCallback writes;
+  sockets.second->setReadCB(&reader);
+  auto buf = IOBuf::copyBuffer("no copy");
+  auto data = buf->data();
+  sockets.first->writeChain(&writes, std::move(buf));
+  evb.loopOnce();
+  ASSERT_EQ(1, reader.buffers.size());
+  EXPECT_EQ(data, reader.buffers[0]->data());
+  EXPECT_TRUE(reader.data.empty());
+}
+
+TEST(LoopbackSocket, WritesWaitForWindow) {
+  EventBase evb;
+  auto sockets = LoopbackSocket::newPair(&evb, &evb, 4096);
+  ReadCallback reader;
+  WriteCallback writes;
+  std::string data(3 * 4096, 'x');
+  sockets.first->write(&writes, data.data(), data.size());
+  evb.loopOnce(EVLOOP_NONBLOCK);
+  // Nobody's reading
+  EXPECT_EQ(0, writes.successes);
+  sockets.second->setReadCB(&reader);
+  while (writes.successes == 0) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ(data, reader.data);
+}
+
+TEST(LoopbackSocket, EOFOnClose) {
+  EventBase evb;
+  auto sockets = LoopbackSocket::newPair(&evb, &evb);
+  ReadCallback reader;
+  WriteCallback writes;
+  sockets.second->setReadCB(&reader);
+  sockets.first->write(&writes, "bye", 3);
+  sockets.first.reset();
+  while (!reader.eof) {
+    evb.loopOnce();
+  }
+  // What was written before comes first
+  EXPECT_EQ("bye", reader.data);
+  EXPECT_FALSE(reader.error);
+
+  sockets.second->write(&writes, "late", 4);
+  EXPECT_EQ(1, writes.errors);
+}
+
+TEST(LoopbackSocket, AcrossEventBases) {
+  EventBase evb1;
+  EventBase evb2;
+  std::thread t([&] {
+    evb2.loopForever();
+  });
+  auto sockets = LoopbackSocket::newPair(&evb1, nullptr, 16 * 1024);
+  ReadCallback reader;
+  const size_t kWrites = 64;
+  const size_t kSize = 16 * 1024;
+  reader.expected = kWrites * kSize;
+  evb2.runInEventBaseThreadAndWait([&] {
+    sockets.second->attachEventBase(&evb2);
+    sockets.second->setReadCB(&reader);
+  });
+
+  WriteCallback writes;
+  std::string data(kSize, 'x');
+  for (size_t i = 0; i < kWrites; i++) {
+    sockets.first->write(&writes, data.data(), data.size());
+  }
+  while (writes.successes < int(kWrites)) {
+    evb1.loopOnce();
+  }
+  reader.done.wait();
+  evb2.runInEventBaseThreadAndWait([&] {
+    sockets.second.reset();
+  });
+  evb2.terminateLoopSoon();
+  t.join();
+  EXPECT_EQ(0, writes.errors);
+}
@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/MemoryBudget.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace folly;
+using namespace folly::wangle;
+
+TEST(MemoryBudget, ChargesInChunks) {
+  auto budget = MemoryBudget::create(100 * 1024, 50 * 1024, 4096);
+  auto account = budget->newAccount();
+  account->charge(1000);
+  EXPECT_EQ(1000, account->getBytes());
+  EXPECT_EQ(1000 + 4096, budget->getUsage());
+  account->charge(3000);
+  EXPECT_EQ(1000 + 4096, budget->getUsage());
+  EXPECT_EQ(4000, budget->getThreadBytes());
+  account.reset();
+  EXPECT_EQ(0, budget->getThreadBytes());
+  // A chunk or two stays with the thread
+  EXPECT_GE(2 * 4096, budget->getUsage());
+  EXPECT_FALSE(budget->isOverloaded());
+}
+
+TEST(MemoryBudget, Charge) {
+  auto budget = MemoryBudget::create(100 * 1024, 50 * 1024, 4096);
+  auto account = budget->newAccount();
+  {
+    MemoryBudget::Charge charge;
+    charge.update(account, 3000);
+    EXPECT_EQ(3000, account->getBytes());
+    charge.update(account, 1000);
+    EXPECT_EQ(1000, account->getBytes());
+    charge.update(nullptr, 5000);
+    EXPECT_EQ(0, account->getBytes());
+    charge.update(account, 2000);
+  }
+  EXPECT_EQ(0, account->getBytes());
+}
+
+TEST(MemoryBudget, PausesLargestAccounts) {
+  auto budget = MemoryBudget::create(100 * 1024, 50 * 1024, 4096);
+  std::vector<std::shared_ptr<MemoryBudget::Account>> accounts;
+  std::vector<int> pauses(3, 0);
+  for (int i = 0; i < 3; i++) {
+    accounts.push_back(budget->newAccount());
+    accounts.back()->setPauseCallback([&pauses, i](bool paused) {
+      pauses[i] += paused ? 1 : -1;
+    });
+  }
+  // Never paused
+  auto unpausable = budget->newAccount();
+  unpausable->charge(90 * 1024);
+  accounts[0]->charge(5 * 1024);
+  EXPECT_FALSE(budget->isOverloaded());
+  accounts[1]->charge(10 * 1024);
+  EXPECT_TRUE(budget->isOverloaded());
+  accounts[2]->charge(20 * 1024);
+
+  // The paused ones hold half of what's charged, less the unpausable
+  EXPECT_FALSE(unpausable->isPaused());
+  EXPECT_TRUE(accounts[1]->isPaused());
+  EXPECT_FALSE(accounts[0]->isPaused());
+  EXPECT_EQ(1, budget->getThreadPausedAccounts());
+  EXPECT_EQ(std::vector<int>({0, 1, 0}), pauses);
+
+  unpausable->release(80 * 1024);
+  EXPECT_FALSE(budget->isOverloaded());
+  EXPECT_FALSE(accounts[1]->isPaused());
+  EXPECT_EQ(0, budget->getThreadPausedAccounts());
+  EXPECT_EQ(std::vector<int>({0, 0, 0}), pauses);
+}
+
+TEST(MemoryBudget, ResumesOnceUnderLowWatermark) {
+  auto budget = MemoryBudget::create(100 * 1024, 50 * 1024, 4096);
+  auto evb = EventBaseManager::get()->getEventBase();
+  auto account = budget->newAccount();
+  int pauses = 0;
+  account->setPauseCallback([&](bool paused) {
+    pauses += paused ? 1 : -1;
+  });
+
+  std::shared_ptr<MemoryBudget::Account> other;
+  std::thread([&] {
+    other = budget->newAccount();
+    other->charge(200 * 1024);
+  }).join();
+  EXPECT_TRUE(budget->isOverloaded());
+  account->charge(1000);
+  EXPECT_TRUE(account->isPaused());
+  EXPECT_EQ(1, pauses);
+
+  // Released by the other thread's account, so only the poll notices
+  std::thread([&] {
+    other.reset();
+  }).join();
+  EXPECT_FALSE(budget->isOverloaded());
+  EXPECT_TRUE(account->isPaused());
+  evb->loop();
+  EXPECT_FALSE(account->isPaused());
+  EXPECT_EQ(0, pauses);
+}
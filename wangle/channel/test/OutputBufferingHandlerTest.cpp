@@ -57,3 +57,33 @@ TEST(OutputBufferingHandlerTest, Basic) {
   eb.loopOnce();
   EXPECT_TRUE(f.isReady());
 }
+
+TEST(OutputBufferingHandlerTest, EarlyFlush) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  OutputBufferingHandler buffering;
+  buffering.setMaxBufferedBytes(8);
+  buffering.setWriteFutures(false);
+  StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    OutputBufferingHandler>
+  pipeline(&mockHandler, &buffering);
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline.setTransport(socket);
+
+  // Without per-write futures, write() returns a completed future
+  auto f1 = pipeline.write(IOBuf::copyBuffer("hello"));
+  EXPECT_TRUE(f1.isReady());
+
+  // Crossing the byte limit flushes without waiting for the loop
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("helloworld")));
+  pipeline.write(IOBuf::copyBuffer("world"));
+  Mock::VerifyAndClearExpectations(&mockHandler);
+
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("foo")));
+  pipeline.write(IOBuf::copyBuffer("foo"));
+  eb.loopOnce();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
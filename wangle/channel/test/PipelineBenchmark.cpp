@@ -0,0 +1,325 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <wangle/channel/Handler.h>
+#include <wangle/channel/OutputBufferingHandler.h>
+#include <wangle/channel/Pipeline.h>
+#include <wangle/channel/StaticPipeline.h>
+#include <gflags/gflags.h>
+
+using namespace folly;
+using namespace folly::wangle;
+using folly::BenchmarkSuspender;
+
+// Each hop gets its own type, since StaticPipeline can't hold the same
+// handler type twice by value
+template <int I>
+class PassThroughHandler final : public HandlerAdapter<int, int> {
+ public:
+  void read(Context* ctx, int msg) override {
+    ctx->fireRead(msg + 1);
+  }
+
+  Future<Unit> write(Context* ctx, int msg) override {
+    return ctx->fireWrite(msg + 1);
+  }
+};
+
+class ReadSink final : public InboundHandler<int> {
+ public:
+  void read(Context* ctx, int msg) override {
+    sum += msg;
+  }
+
+  int64_t sum{0};
+};
+
+class WriteSink final : public OutboundHandler<int> {
+ public:
+  Future<Unit> write(Context* ctx, int msg) override {
+    sum += msg;
+    return makeFuture();
+  }
+
+  int64_t sum{0};
+};
+
+// StaticPipeline of WriteSink, N PassThroughHandlers and ReadSink
+template <int N, class... Handlers>
+struct StaticChain {
+  typedef StaticChain<N - 1, PassThroughHandler<N>, Handlers...> Next;
+  typedef typename Next::type type;
+
+  static std::unique_ptr<type> make(WriteSink* writeSink,
+                                    ReadSink* readSink) {
+    return Next::make(writeSink, readSink);
+  }
+};
+
+template <class... Handlers>
+struct StaticChain<0, Handlers...> {
+  typedef StaticPipeline<int, int, WriteSink, Handlers..., ReadSink> type;
+
+  static std::unique_ptr<type> make(WriteSink* writeSink,
+                                    ReadSink* readSink) {
+    return std::unique_ptr<type>(
+        new type(writeSink, Handlers()..., readSink));
+  }
+};
+
+template <int N>
+void dynamicRead(uint iters) {
+  BenchmarkSuspender bs;
+  Pipeline<int, int> pipeline;
+  WriteSink writeSink;
+  ReadSink readSink;
+  pipeline.addBack(&writeSink);
+  for (int i = 0; i < N; i++) {
+    pipeline.addBack(PassThroughHandler<0>());
+  }
+  pipeline.addBack(&readSink);
+  pipeline.finalize();
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline.read(i);
+  }
+  doNotOptimizeAway(readSink.sum);
+}
+
+template <int N>
+void staticRead(uint iters) {
+  BenchmarkSuspender bs;
+  WriteSink writeSink;
+  ReadSink readSink;
+  auto pipeline = StaticChain<N>::make(&writeSink, &readSink);
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline->read(i);
+  }
+  doNotOptimizeAway(readSink.sum);
+}
+
+template <int N>
+void dynamicWrite(uint iters) {
+  BenchmarkSuspender bs;
+  Pipeline<int, int> pipeline;
+  WriteSink writeSink;
+  ReadSink readSink;
+  pipeline.addBack(&writeSink);
+  for (int i = 0; i < N; i++) {
+    pipeline.addBack(PassThroughHandler<0>());
+  }
+  pipeline.addBack(&readSink);
+  pipeline.finalize();
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline.write(i);
+  }
+  doNotOptimizeAway(writeSink.sum);
+}
+
+template <int N>
+void staticWrite(uint iters) {
+  BenchmarkSuspender bs;
+  WriteSink writeSink;
+  ReadSink readSink;
+  auto pipeline = StaticChain<N>::make(&writeSink, &readSink);
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline->write(i);
+  }
+  doNotOptimizeAway(writeSink.sum);
+}
+
+BENCHMARK(dynamicRead1, iters) { dynamicRead<1>(iters); }
+BENCHMARK_RELATIVE(staticRead1, iters) { staticRead<1>(iters); }
+BENCHMARK(dynamicRead4, iters) { dynamicRead<4>(iters); }
+BENCHMARK_RELATIVE(staticRead4, iters) { staticRead<4>(iters); }
+BENCHMARK(dynamicRead16, iters) { dynamicRead<16>(iters); }
+BENCHMARK_RELATIVE(staticRead16, iters) { staticRead<16>(iters); }
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(dynamicWrite1, iters) { dynamicWrite<1>(iters); }
+BENCHMARK_RELATIVE(staticWrite1, iters) { staticWrite<1>(iters); }
+BENCHMARK(dynamicWrite4, iters) { dynamicWrite<4>(iters); }
+BENCHMARK_RELATIVE(staticWrite4, iters) { staticWrite<4>(iters); }
+BENCHMARK(dynamicWrite16, iters) { dynamicWrite<16>(iters); }
+BENCHMARK_RELATIVE(staticWrite16, iters) { staticWrite<16>(iters); }
+
+BENCHMARK_DRAW_LINE();
+
+class BytesSink final : public OutboundBytesToBytesHandler {
+ public:
+  Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    bytes += buf->computeChainDataLength();
+    return makeFuture();
+  }
+
+  uint64_t bytes{0};
+};
+
+// Buffers writesPerLoop writes in OutputBufferingHandler, then flushes them
+void bufferedWrites(uint iters, size_t writesPerLoop, bool writeFutures) {
+  BenchmarkSuspender bs;
+  EventBase eb;
+  BytesSink sink;
+  OutputBufferingHandler buffering;
+  buffering.setWriteFutures(writeFutures);
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  pipeline.setTransport(AsyncSocket::newSocket(&eb));
+  pipeline.addBack(&sink).addBack(&buffering).finalize();
+  auto payload = IOBuf::copyBuffer("hello world");
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    for (size_t j = 0; j < writesPerLoop; j++) {
+      pipeline.write(payload->clone());
+    }
+    eb.loopOnce();
+  }
+  doNotOptimizeAway(sink.bytes);
+}
+
+void unbufferedWrites(uint iters, size_t writesPerLoop) {
+  BenchmarkSuspender bs;
+  BytesSink sink;
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  pipeline.addBack(&sink).finalize();
+  auto payload = IOBuf::copyBuffer("hello world");
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    for (size_t j = 0; j < writesPerLoop; j++) {
+      pipeline.write(payload->clone());
+    }
+  }
+  doNotOptimizeAway(sink.bytes);
+}
+
+void bufferedFutureWrites(uint iters, size_t writesPerLoop) {
+  bufferedWrites(iters, writesPerLoop, true);
+}
+
+void bufferedNoFutureWrites(uint iters, size_t writesPerLoop) {
+  bufferedWrites(iters, writesPerLoop, false);
+}
+
+BENCHMARK_PARAM(unbufferedWrites, 1);
+BENCHMARK_RELATIVE_PARAM(bufferedFutureWrites, 1);
+BENCHMARK_RELATIVE_PARAM(bufferedNoFutureWrites, 1);
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(unbufferedWrites, 64);
+BENCHMARK_RELATIVE_PARAM(bufferedFutureWrites, 64);
+BENCHMARK_RELATIVE_PARAM(bufferedNoFutureWrites, 64);
+
+BENCHMARK_DRAW_LINE();
+
+// Builds and finalizes a pipeline of N handlers, as for each connection
+void buildPipeline(uint iters, size_t n) {
+  WriteSink writeSink;
+  ReadSink readSink;
+  for (uint i = 0; i < iters; i++) {
+    Pipeline<int, int> pipeline;
+    pipeline.addBack(&writeSink);
+    for (size_t j = 0; j < n; j++) {
+      pipeline.addBack(PassThroughHandler<0>());
+    }
+    pipeline.addBack(&readSink);
+    pipeline.finalize();
+  }
+}
+
+// Finalizes a pipeline of N handlers again, as after adding or removing one
+void refinalizePipeline(uint iters, size_t n) {
+  BenchmarkSuspender bs;
+  WriteSink writeSink;
+  ReadSink readSink;
+  Pipeline<int, int> pipeline;
+  pipeline.addBack(&writeSink);
+  for (size_t j = 0; j < n; j++) {
+    pipeline.addBack(PassThroughHandler<0>());
+  }
+  pipeline.addBack(&readSink);
+  pipeline.finalize();
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline.finalize();
+  }
+}
+
+// Swaps the handler at the front of a pipeline of N handlers for another,
+// as for a protocol upgrade, and finalizes it again
+void swapAndFinalize(uint iters, size_t n) {
+  BenchmarkSuspender bs;
+  WriteSink writeSink, otherSink;
+  ReadSink readSink;
+  Pipeline<int, int> pipeline;
+  pipeline.addBack(&writeSink);
+  for (size_t j = 0; j < n; j++) {
+    pipeline.addBack(PassThroughHandler<0>());
+  }
+  pipeline.addBack(&readSink);
+  pipeline.finalize();
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline.removeFront();
+    pipeline.addFront(i % 2 ? &writeSink : &otherSink);
+    pipeline.finalize();
+  }
+}
+
+// The same swap, relinking only its neighbours
+void swapLinked(uint iters, size_t n) {
+  BenchmarkSuspender bs;
+  WriteSink writeSink, otherSink;
+  ReadSink readSink;
+  Pipeline<int, int> pipeline;
+  pipeline.addBack(&writeSink);
+  for (size_t j = 0; j < n; j++) {
+    pipeline.addBack(PassThroughHandler<0>());
+  }
+  pipeline.addBack(&readSink);
+  pipeline.finalize();
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline.replaceLinked(i % 2 ? &otherSink : &writeSink,
+                           i % 2 ? &writeSink : &otherSink);
+  }
+}
+
+BENCHMARK_PARAM(buildPipeline, 4);
+BENCHMARK_PARAM(buildPipeline, 16);
+BENCHMARK_PARAM(refinalizePipeline, 4);
+BENCHMARK_PARAM(refinalizePipeline, 16);
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(swapAndFinalize, 4);
+BENCHMARK_RELATIVE_PARAM(swapLinked, 4);
+BENCHMARK_PARAM(swapAndFinalize, 16);
+BENCHMARK_RELATIVE_PARAM(swapLinked, 16);
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -17,6 +17,9 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <cstddef>
+#include <thread>
+
 using namespace folly;
 using namespace folly::wangle;
 using namespace testing;
@@ -299,6 +302,14 @@ TEST(Pipeline, DynamicConstruction) {
   }
 }
 
+TEST(Pipeline, TypeMismatch) {
+  Pipeline<int, int> pipeline;
+  pipeline
+    .addBack(HandlerAdapter<int, int>{})
+    .addBack(StringHandler{});
+  EXPECT_THROW(pipeline.finalize(), std::invalid_argument);
+}
+
 TEST(Pipeline, RemovePointer) {
   IntHandler handler1, handler2;
   EXPECT_CALL(handler1, attachPipeline(_));
@@ -383,3 +394,302 @@ TEST(Pipeline, RemoveType) {
 
   EXPECT_CALL(handler2, detachPipeline(_));
 }
+
+TEST(Pipeline, LinkedAddAndRemove) {
+  IntHandler handler1, handler2, handler3;
+  EXPECT_CALL(handler1, attachPipeline(_));
+  EXPECT_CALL(handler2, attachPipeline(_));
+  Pipeline<int, int> pipeline;
+  pipeline
+    .addBack(&handler1)
+    .addBack(&handler2)
+    .finalize();
+
+  // Attached on its own, with no finalize()
+  EXPECT_CALL(handler3, attachPipeline(_));
+  pipeline.addFrontLinked(&handler3);
+
+  EXPECT_CALL(handler3, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler1, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler2, read_(_, _)).Times(1);
+  pipeline.read(1);
+
+  EXPECT_CALL(handler2, write_(_, _)).WillOnce(FireWrite());
+  EXPECT_CALL(handler1, write_(_, _)).WillOnce(FireWrite());
+  EXPECT_CALL(handler3, write_(_, _)).Times(1);
+  pipeline.write(1);
+
+  EXPECT_CALL(handler1, detachPipeline(_));
+  pipeline.removeLinked(&handler1);
+
+  EXPECT_CALL(handler3, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler2, read_(_, _)).Times(1);
+  pipeline.read(1);
+
+  EXPECT_CALL(handler2, detachPipeline(_));
+  pipeline.removeLinked(&handler2);
+
+  EXPECT_CALL(handler3, write_(_, _)).Times(1);
+  pipeline.write(1);
+
+  EXPECT_CALL(handler3, detachPipeline(_));
+}
+
+TEST(Pipeline, LinkedReplace) {
+  IntHandler handler1, handler2, handler3;
+  EXPECT_CALL(handler1, attachPipeline(_));
+  EXPECT_CALL(handler2, attachPipeline(_));
+  Pipeline<int, int> pipeline;
+  pipeline
+    .addBack(&handler1)
+    .addBack(&handler2)
+    .finalize();
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(handler1, detachPipeline(_));
+    EXPECT_CALL(handler3, attachPipeline(_));
+  }
+  pipeline.replaceLinked(&handler1, &handler3);
+
+  EXPECT_CALL(handler3, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler2, read_(_, _)).Times(1);
+  pipeline.read(1);
+
+  EXPECT_CALL(handler2, write_(_, _)).WillOnce(FireWrite());
+  EXPECT_CALL(handler3, write_(_, _)).Times(1);
+  pipeline.write(1);
+
+  EXPECT_THROW(pipeline.replaceLinked(&handler1, &handler3),
+               std::invalid_argument);
+
+  EXPECT_CALL(handler3, detachPipeline(_));
+  EXPECT_CALL(handler2, detachPipeline(_));
+}
+
+TEST(Pipeline, LinkedTypeMismatch) {
+  Pipeline<int, int> pipeline;
+  pipeline
+    .addBack(HandlerAdapter<int, int>{})
+    .finalize();
+  EXPECT_THROW(pipeline.addBackLinked(StringHandler{}), std::invalid_argument);
+}
+
+TEST(Pipeline, ContextArena) {
+  // 40 bytes, rounded up to the platform's maximum alignment
+  const size_t align = alignof(std::max_align_t);
+  const size_t size = (40 + align - 1) / align * align;
+
+  ContextArena arena;
+  auto a = static_cast<char*>(arena.allocate(40));
+  auto b = static_cast<char*>(arena.allocate(40));
+  EXPECT_TRUE(arena.inBlock(a));
+  EXPECT_TRUE(arena.inBlock(b));
+  EXPECT_EQ(a + size, b);
+
+  // Only the last allocation gives its space back
+  arena.deallocate(a, 40);
+  EXPECT_EQ(2 * size, arena.getUsed());
+  arena.deallocate(b, 40);
+  EXPECT_EQ(size, arena.getUsed());
+
+  auto big = arena.allocate(ContextArena::kBlockSize);
+  EXPECT_FALSE(arena.inBlock(big));
+  arena.deallocate(big, ContextArena::kBlockSize);
+}
+
+TEST(Pipeline, MoreContextsThanFitTheArena) {
+  IntHandler handler;
+  EXPECT_CALL(handler, attachPipeline(_));
+  Pipeline<int, int> pipeline;
+  for (int i = 0; i < 32; i++) {
+    pipeline.addBack(HandlerAdapter<int, int>());
+  }
+  pipeline.addBack(&handler).finalize();
+
+  EXPECT_CALL(handler, read_(_, 1));
+  pipeline.read(1);
+  EXPECT_CALL(handler, detachPipeline(_));
+  pipeline.removeFront().removeBack().finalize();
+}
+
+TEST(Pipeline, Profiling) {
+  class SlowReader : public InboundHandler<int> {
+   public:
+    void read(Context* ctx, int msg) override {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  };
+
+  HandlerProfile::resetThreadStats();
+  Pipeline<int, int> pipeline;
+  pipeline
+    .addBack(HandlerAdapter<int, int>{})
+    .addBack(SlowReader{})
+    .finalize();
+  EXPECT_TRUE(pipeline.getProfiles().empty());
+  pipeline.read(1);
+
+  pipeline.setProfiling(true);
+  pipeline.read(1);
+  pipeline.read(2);
+  pipeline.write(3);
+
+  auto profiles = pipeline.getProfiles();
+  ASSERT_EQ(2, profiles.size());
+  auto& passThrough = profiles[0]->getStats();
+  auto& slow = profiles[1]->getStats();
+  EXPECT_EQ(2, passThrough.reads);
+  EXPECT_EQ(1, passThrough.writes);
+  EXPECT_EQ(2, slow.reads);
+  EXPECT_EQ(0, slow.writes);
+  // The pass through handler isn't charged for the slow one
+  EXPECT_LT(passThrough.readTicks, slow.readTicks);
+
+  auto threadStats = HandlerProfile::getThreadStats();
+  ASSERT_EQ(1, threadStats.count(profiles[1]->getName()));
+  EXPECT_EQ(2, threadStats[profiles[1]->getName()].reads);
+
+  pipeline.setProfiling(false);
+  EXPECT_TRUE(pipeline.getProfiles().empty());
+}
+
+TEST(Pipeline, ProfilingMovedToAnotherThread) {
+  HandlerProfile::resetThreadStats();
+  Pipeline<int, int> pipeline;
+  pipeline
+    .addBack(HandlerAdapter<int, int>{})
+    .finalize();
+  pipeline.setProfiling(true);
+  auto name = pipeline.getProfiles()[0]->getName();
+
+  // The calls count for the thread they ran on, not the one that set up
+  // profiling
+  std::map<std::string, HandlerStats> otherStats;
+  std::thread([&] {
+    pipeline.read(1);
+    pipeline.read(2);
+    otherStats = HandlerProfile::getThreadStats();
+  }).join();
+  EXPECT_EQ(2, otherStats[name].reads);
+  EXPECT_EQ(0, HandlerProfile::getThreadStats()[name].reads);
+
+  pipeline.read(3);
+  EXPECT_EQ(1, HandlerProfile::getThreadStats()[name].reads);
+  EXPECT_EQ(3, pipeline.getProfiles()[0]->getStats().reads);
+}
+
+TEST(Pipeline, AdaptiveReadBufferPolicy) {
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  EXPECT_EQ(std::make_pair(uint64_t(2048), uint64_t(2048)),
+            pipeline.getReadBufferSettings());
+
+  auto policy = std::make_shared<AdaptiveReadBufferPolicy>(64, 2048, 65536);
+  pipeline.setReadBufferPolicy(policy);
+  EXPECT_EQ(policy.get(), pipeline.getReadBufferPolicy());
+
+  // Full reads grow the buffer quickly, up to the maximum
+  policy->recordRead(2048, 2048);
+  auto grown = pipeline.getReadBufferSettings().second;
+  EXPECT_GT(grown, 2048);
+  for (int i = 0; i < 10; i++) {
+    auto size = policy->getNextReadSize();
+    policy->recordRead(size, size);
+  }
+  EXPECT_EQ(65536, policy->getNextReadSize());
+
+  // A single short read doesn't shrink, consecutive ones do
+  policy->recordRead(65536, 10);
+  EXPECT_EQ(65536, policy->getNextReadSize());
+  policy->recordRead(65536, 10);
+  EXPECT_LT(policy->getNextReadSize(), 65536);
+  for (int i = 0; i < 100; i++) {
+    policy->recordRead(policy->getNextReadSize(), 10);
+  }
+  EXPECT_EQ(64, policy->getNextReadSize());
+
+  EXPECT_EQ(113, policy->getReads());
+  EXPECT_GT(policy->getBytesAllocated(), policy->getBytesUsed());
+
+  pipeline.setReadBufferPolicy(nullptr);
+  EXPECT_EQ(std::make_pair(uint64_t(2048), uint64_t(2048)),
+            pipeline.getReadBufferSettings());
+}
+
+TEST(Pipeline, ExplicitReadBufferSettingsWin) {
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  auto policy = std::make_shared<AdaptiveReadBufferPolicy>(64, 4096, 65536);
+  pipeline.setReadBufferPolicy(policy);
+  auto fromPolicy = pipeline.getReadBufferSettings();
+  EXPECT_FALSE(pipeline.hasReadBufferSettings());
+
+  pipeline.setReadBufferSettings(100, 1000);
+  EXPECT_TRUE(pipeline.hasReadBufferSettings());
+  EXPECT_EQ(std::make_pair(uint64_t(100), uint64_t(1000)),
+            pipeline.getReadBufferSettings());
+
+  pipeline.resetReadBufferSettings();
+  EXPECT_FALSE(pipeline.hasReadBufferSettings());
+  EXPECT_EQ(fromPolicy, pipeline.getReadBufferSettings());
+
+  pipeline.setReadBufferPolicy(nullptr);
+  EXPECT_EQ(std::make_pair(uint64_t(2048), uint64_t(2048)),
+            pipeline.getReadBufferSettings());
+}
+
+TEST(Pipeline, WritabilityChanged) {
+  // Stands in for a transport handler with a slow peer: every write is
+  // left pending, and the pipeline turns unwritable past the high watermark
+  class SlowTransport : public HandlerAdapter<int, int> {
+   public:
+    Future<Unit> write(Context* ctx, int msg) override {
+      pending += msg;
+      auto waterMarks = ctx->getPipeline()->getWriteBufferWaterMarks();
+      if (ctx->isWritable() && pending > waterMarks.second) {
+        ctx->getPipeline()->setWritable(false);
+        ctx->fireWritabilityChanged();
+      }
+      return makeFuture();
+    }
+
+    void drain(Context* ctx) {
+      pending = 0;
+      ctx->getPipeline()->setWritable(true);
+      ctx->fireWritabilityChanged();
+    }
+
+    int pending{0};
+  };
+
+  class WritabilityTester : public HandlerAdapter<int, int> {
+   public:
+    void writabilityChanged(Context* ctx) override {
+      changes.push_back(ctx->isWritable());
+    }
+
+    std::vector<bool> changes;
+  };
+
+  SlowTransport transport;
+  WritabilityTester tester;
+  Pipeline<int, int> pipeline;
+  pipeline
+    .addBack(&transport)
+    .addBack(HandlerAdapter<int, int>())
+    .addBack(&tester)
+    .finalize();
+  pipeline.setWriteBufferWaterMarks(10, 100);
+  EXPECT_TRUE(pipeline.isWritable());
+
+  pipeline.write(60);
+  EXPECT_TRUE(tester.changes.empty());
+  pipeline.write(60);
+  EXPECT_FALSE(pipeline.isWritable());
+  ASSERT_EQ(1, tester.changes.size());
+  EXPECT_FALSE(tester.changes[0]);
+
+  transport.drain(transport.getContext());
+  EXPECT_TRUE(pipeline.isWritable());
+  ASSERT_EQ(2, tester.changes.size());
+  EXPECT_TRUE(tester.changes[1]);
+}
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/ReadBufferAllocator.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace folly;
+using namespace folly::wangle;
+
+TEST(SlabReadBufferAllocator, ReusesBuffers) {
+  SlabReadBufferAllocator allocator(4096, 16384);
+  auto buf = allocator.allocate(2048);
+  EXPECT_EQ(0, buf->length());
+  EXPECT_EQ(4096, buf->tailroom());
+  EXPECT_EQ(1, allocator.getThreadSlabs());
+  EXPECT_EQ(3, allocator.getThreadFreeBuffers());
+  auto data = buf->data();
+  buf.reset();
+  EXPECT_EQ(4, allocator.getThreadFreeBuffers());
+  buf = allocator.allocate(4096);
+  EXPECT_EQ(data, buf->data());
+}
+
+TEST(SlabReadBufferAllocator, GrowsBySlabs) {
+  SlabReadBufferAllocator allocator(4096, 16384);
+  std::vector<std::unique_ptr<IOBuf>> bufs;
+  for (int i = 0; i < 5; i++) {
+    bufs.push_back(allocator.allocate(4096));
+  }
+  EXPECT_EQ(2, allocator.getThreadSlabs());
+  EXPECT_EQ(3, allocator.getThreadFreeBuffers());
+}
+
+TEST(SlabReadBufferAllocator, ReleasesFreeSlabs) {
+  SlabReadBufferAllocator allocator(4096, 16384);
+  std::vector<std::unique_ptr<IOBuf>> first, second;
+  for (int i = 0; i < 4; i++) {
+    first.push_back(allocator.allocate(4096));
+  }
+  for (int i = 0; i < 4; i++) {
+    second.push_back(allocator.allocate(4096));
+  }
+  EXPECT_EQ(2, allocator.getThreadSlabs());
+  // All of the first slab's buffers are back, and it's not being
+  // allocated from
+  first.clear();
+  EXPECT_EQ(1, allocator.getThreadSlabs());
+  EXPECT_EQ(0, allocator.getThreadFreeBuffers());
+  // While the one allocated from stays for the next reads
+  second.clear();
+  EXPECT_EQ(1, allocator.getThreadSlabs());
+  EXPECT_EQ(4, allocator.getThreadFreeBuffers());
+
+  // Likewise for slabs freed on other threads, once they're taken back
+  for (int i = 0; i < 8; i++) {
+    first.push_back(allocator.allocate(4096));
+  }
+  EXPECT_EQ(2, allocator.getThreadSlabs());
+  std::thread([&]() { first.clear(); }).join();
+  first.push_back(allocator.allocate(4096));
+  EXPECT_EQ(1, allocator.getThreadSlabs());
+  EXPECT_EQ(3, allocator.getThreadFreeBuffers());
+}
+
+TEST(SlabReadBufferAllocator, LargeBuffersFromHeap) {
+  SlabReadBufferAllocator allocator(4096, 16384);
+  auto buf = allocator.allocate(8192);
+  EXPECT_LE(8192, buf->tailroom());
+  EXPECT_EQ(0, allocator.getThreadSlabs());
+}
+
+TEST(SlabReadBufferAllocator, RemoteFree) {
+  SlabReadBufferAllocator allocator(4096, 16384);
+  std::vector<std::unique_ptr<IOBuf>> bufs;
+  for (int i = 0; i < 4; i++) {
+    bufs.push_back(allocator.allocate(4096));
+  }
+  EXPECT_EQ(0, allocator.getThreadFreeBuffers());
+  std::thread([&]() { bufs.clear(); }).join();
+  // Taken back from the remote list rather than getting a new slab
+  auto buf = allocator.allocate(4096);
+  EXPECT_EQ(1, allocator.getThreadSlabs());
+  EXPECT_EQ(3, allocator.getThreadFreeBuffers());
+}
+
+TEST(SlabReadBufferAllocator, BuffersOutliveAllocator) {
+  std::unique_ptr<IOBuf> buf, other;
+  {
+    SlabReadBufferAllocator allocator(4096, 16384, true);
+    buf = allocator.allocate(4096);
+    std::thread([&]() { other = allocator.allocate(4096); }).join();
+  }
+  memset(buf->writableTail(), 'a', buf->tailroom());
+  buf->append(buf->tailroom());
+  memset(other->writableTail(), 'b', other->tailroom());
+  other.reset();
+  buf.reset();
+}
@@ -0,0 +1,95 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/RelayHandler.h>
+#include <folly/io/async/test/AsyncSocketTest.h>
+#include <gtest/gtest.h>
+
+using namespace folly;
+using namespace folly::wangle;
+using namespace testing;
+
+struct RelayHandlerTest : public Test {
+  // A pipeline with a RelayHandler on the accepted end of a new connection
+  DefaultPipeline::UniquePtr accept(std::shared_ptr<AsyncSocket>& client,
+                                    ConnCallback& ccb,
+                                    bool splice) {
+    client = AsyncSocket::newSocket(&evb);
+    client->connect(&ccb, server.getAddress(), 30);
+    DefaultPipeline::UniquePtr pipeline(new DefaultPipeline);
+    pipeline->addBack(AsyncSocketHandler(server.acceptAsync(&evb)));
+    pipeline->addBack(RelayHandler(splice));
+    pipeline->finalize();
+    pipeline->transportActive();
+    return pipeline;
+  }
+
+  void relayBothWays(bool splice) {
+    auto front = accept(client, clientConnect, splice);
+    auto back = accept(backend, backendConnect, splice);
+    client->setReadCB(&clientRead);
+    backend->setReadCB(&backendRead);
+
+    // Held until the link
+    client->write(&clientWrite, "hello ", 6);
+    evb.loopOnce();
+
+    auto frontRelay = front->getHandler<RelayHandler>(1);
+    auto backRelay = back->getHandler<RelayHandler>(1);
+    RelayHandler::relay(frontRelay, backRelay);
+    EXPECT_EQ(splice, frontRelay->isSplicing());
+    EXPECT_EQ(splice, backRelay->isSplicing());
+
+    client->write(&clientWrite, "world", 5);
+    backend->write(&backendWrite, "reply", 5);
+    client->shutdownWrite();
+    backend->shutdownWrite();
+    evb.loop();
+
+    EXPECT_EQ(STATE_SUCCEEDED, clientRead.state);
+    EXPECT_EQ(STATE_SUCCEEDED, backendRead.state);
+    EXPECT_EQ("hello world", received(backendRead));
+    EXPECT_EQ("reply", received(clientRead));
+    EXPECT_EQ(11, frontRelay->getBytesRelayed());
+    EXPECT_EQ(5, backRelay->getBytesRelayed());
+
+    // Both closed once both directions were done
+    EXPECT_FALSE(front->getTransport());
+    EXPECT_FALSE(back->getTransport());
+  }
+
+  static std::string received(const ReadCallback& rcb) {
+    std::string data;
+    for (auto& buf : rcb.buffers) {
+      data.append(buf.buffer, buf.length);
+    }
+    return data;
+  }
+
+  TestServer server;
+  EventBase evb;
+  std::shared_ptr<AsyncSocket> client;
+  std::shared_ptr<AsyncSocket> backend;
+  ConnCallback clientConnect;
+  ConnCallback backendConnect;
+  ReadCallback clientRead;
+  ReadCallback backendRead;
+  WriteCallback clientWrite;
+  WriteCallback backendWrite;
+};
+
+TEST_F(RelayHandlerTest, Splice) {
+  relayBothWays(true);
+}
+
+TEST_F(RelayHandlerTest, Forward) {
+  relayBothWays(false);
+}
@@ -0,0 +1,282 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/ShmSocket.h>
+#include <folly/FileUtil.h>
+#include <folly/SocketAddress.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#endif
+#ifndef F_SEAL_SHRINK
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+using namespace folly;
+using namespace folly::wangle;
+
+namespace {
+
+class ReadCallback : public AsyncTransportWrapper::ReadCallback {
+ public:
+  void getReadBuffer(void** bufReturn, size_t* lenReturn) override {
+    *bufReturn = buf_;
+    *lenReturn = sizeof(buf_);
+  }
+
+  void readDataAvailable(size_t len) noexcept override {
+    data.append(buf_, len);
+  }
+
+  void readEOF() noexcept override {
+    eof = true;
+  }
+
+  void readErr(const AsyncSocketException&) noexcept override {
+    error = true;
+  }
+
+  std::string data;
+  bool eof{false};
+  bool error{false};
+
+ private:
+  char buf_[4096];
+};
+
+class WriteCallback : public AsyncTransportWrapper::WriteCallback {
+ public:
+  void writeSuccess() noexcept override {
+    successes++;
+  }
+
+  void writeErr(size_t, const AsyncSocketException&) noexcept override {
+    errors++;
+  }
+
+  int successes{0};
+  int errors{0};
+};
+
+// A connected client and server, as an ShmServerSocket would make them
+class ShmSocketTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = "/tmp/ShmSocketTest." + std::to_string(getpid());
+    unlink(path_.c_str());
+    SocketAddress address;
+    address.setFromPath(path_);
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    CHECK_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&addr), len));
+    CHECK_EQ(0, listen(listener, 1));
+
+    client_ = ShmSocket::newClientSocket(&evb_, path_, kRingSize);
+    int fd = accept(listener, nullptr, nullptr);
+    CHECK_GE(fd, 0);
+    closeNoInt(listener);
+    server_ = ShmSocket::newServerSocket(fd, address);
+    CHECK(server_);
+    server_->attachEventBase(&evb_);
+  }
+
+  void TearDown() override {
+    unlink(path_.c_str());
+  }
+
+  static const size_t kRingSize = 4096;
+
+  EventBase evb_;
+  std::string path_;
+  ShmSocket::UniquePtr client_;
+  ShmSocket::UniquePtr server_;
+};
+
+// Shared memory of the given size, sealed at that size if asked
+int makeSharedMemory(size_t size, bool seal) {
+  int fd = syscall(SYS_memfd_create, "ShmSocketTest", MFD_ALLOW_SEALING);
+  CHECK_GE(fd, 0);
+  CHECK_EQ(0, ftruncate(fd, size));
+  if (seal) {
+    CHECK_EQ(0, fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW));
+  }
+  return fd;
+}
+
+// Sends the handshake, as ShmSocket::newClientSocket() does
+void sendHandshake(int controlFd, uint64_t ringSize, const int (&fds)[3]) {
+  struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t ringSize;
+  } handshake = {0x73686d31, 0, ringSize};
+  iovec iov = {&handshake, sizeof(handshake)};
+  union {
+    char buf[CMSG_SPACE(sizeof(fds))];
+    cmsghdr align;
+  } control;
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  CHECK_EQ(sizeof(handshake), sendmsg(controlFd, &msg, 0));
+}
+
+// The server's answer to a handshake with the given memory and ring size
+void expectBadHandshake(int memFd, uint64_t ringSize) {
+  int fds[3] = {memFd, eventfd(0, EFD_NONBLOCK), eventfd(0, EFD_NONBLOCK)};
+  int pair[2];
+  CHECK_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+  sendHandshake(pair[0], ringSize, fds);
+  EXPECT_THROW(ShmSocket::newServerSocket(pair[1], SocketAddress()),
+               AsyncSocketException);
+  for (auto fd : fds) {
+    closeNoInt(fd);
+  }
+  closeNoInt(pair[0]);
+  closeNoInt(pair[1]);
+}
+
+}
+
+TEST_F(ShmSocketTest, Roundtrip) {
+  ReadCallback serverRead;
+  ReadCallback clientRead;
+  WriteCallback writes;
+  server_->setReadCB(&serverRead);
+  client_->setReadCB(&clientRead);
+  client_->write(&writes, "hello", 5);
+  evb_.loopOnce();
+  EXPECT_EQ("hello", serverRead.data);
+  server_->write(&writes, "world", 5);
+  evb_.loopOnce();
+  EXPECT_EQ("world", clientRead.data);
+  EXPECT_EQ(2, writes.successes);
+  EXPECT_TRUE(client_->good());
+  EXPECT_TRUE(server_->good());
+}
+
+TEST_F(ShmSocketTest, LargerThanRing) {
+  ReadCallback serverRead;
+  WriteCallback writes;
+  server_->setReadCB(&serverRead);
+  std::string data;
+  for (size_t i = 0; i < 10 * kRingSize; i++) {
+    data.push_back('a' + i % 26);
+  }
+  client_->write(&writes, data.data(), data.size());
+  // Only part of it fits until the server reads
+  EXPECT_EQ(0, writes.successes);
+  while (serverRead.data.size() < data.size()) {
+    evb_.loopOnce();
+  }
+  EXPECT_EQ(data, serverRead.data);
+  EXPECT_EQ(1, writes.successes);
+}
+
+TEST_F(ShmSocketTest, EOFOnClose) {
+  ReadCallback serverRead;
+  WriteCallback writes;
+  server_->setReadCB(&serverRead);
+  client_->write(&writes, "bye", 3);
+  client_->close();
+  while (!serverRead.eof) {
+    evb_.loopOnce();
+  }
+  // What was written before the close comes first
+  EXPECT_EQ("bye", serverRead.data);
+  EXPECT_EQ(1, writes.successes);
+  EXPECT_FALSE(serverRead.error);
+}
+
+TEST_F(ShmSocketTest, EOFOnDestroy) {
+  ReadCallback serverRead;
+  server_->setReadCB(&serverRead);
+  client_.reset();
+  while (!serverRead.eof) {
+    evb_.loopOnce();
+  }
+  EXPECT_FALSE(serverRead.error);
+}
+
+// A client that moves the tail of the ring it writes out of bounds
+TEST(ShmSocket, CorruptRingFailsConnection) {
+  const size_t kRingSize = 4096;
+  const size_t kRegionSize = 2 * (4096 + kRingSize);
+  int memFd = makeSharedMemory(kRegionSize, true);
+  auto region = static_cast<uint8_t*>(mmap(nullptr, kRegionSize,
+                                           PROT_READ | PROT_WRITE,
+                                           MAP_SHARED, memFd, 0));
+  CHECK(region != MAP_FAILED);
+  int fds[3] = {memFd, eventfd(0, EFD_NONBLOCK), eventfd(0, EFD_NONBLOCK)};
+
+  int pair[2];
+  CHECK_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, pair));
+  sendHandshake(pair[0], kRingSize, fds);
+
+  EventBase evb;
+  auto server = ShmSocket::newServerSocket(pair[1], SocketAddress());
+  ASSERT_TRUE(server);
+  server->attachEventBase(&evb);
+  ReadCallback serverRead;
+  server->setReadCB(&serverRead);
+
+  // The tail of the first ring, which the client writes, is on the second
+  // cache line of its header
+  auto tail = reinterpret_cast<std::atomic<uint64_t>*>(region + 64);
+  tail->store(100 * kRingSize);
+  uint64_t one = 1;
+  CHECK_EQ(sizeof(one), write(fds[2], &one, sizeof(one)));
+  evb.loopOnce();
+  EXPECT_TRUE(serverRead.error);
+  EXPECT_TRUE(serverRead.data.empty());
+  EXPECT_FALSE(server->good());
+
+  munmap(region, kRegionSize);
+  for (auto fd : fds) {
+    closeNoInt(fd);
+  }
+  closeNoInt(pair[0]);
+}
+
+// 2 * (4096 + 2^63) wraps to 8KB, which the memory would pass for
+TEST(ShmSocket, OversizedRingRejected) {
+  int memFd = makeSharedMemory(8192, true);
+  expectBadHandshake(memFd, uint64_t(1) << 63);
+}
+
+TEST(ShmSocket, UnsealedMemoryRejected) {
+  int memFd = makeSharedMemory(2 * (4096 + 4096), false);
+  expectBadHandshake(memFd, 4096);
+}
@@ -10,18 +10,115 @@
 
 #include <wangle/codec/ByteToMessageCodec.h>
 
+#include <wangle/concurrent/MetricsRegistry.h>
+
+#include <folly/io/async/EventBaseManager.h>
+#include <folly/tracing/StaticTracepoint.h>
+
 namespace folly { namespace wangle {
 
+namespace {
+
+const MetricsRegistry::Counter& framesDecoded() {
+  static const auto counter =
+    MetricsRegistry::getDefault().counter("codec.frames_decoded");
+  return counter;
+}
+
+}
+
 void ByteToMessageCodec::read(Context* ctx, IOBufQueue& q) {
+  FOLLY_SDT(wangle, codec_read_begin, this, q.chainLength());
+  if (q.chainLength() < neededLength_) {
+    ctx->getPipeline()->setReadSizeHint(neededLength_ - q.chainLength());
+    return;
+  }
+  std::chrono::steady_clock::time_point start;
+  if (maxReadTime_.count() > 0) {
+    start = std::chrono::steady_clock::now();
+  }
   size_t needed = 0;
+  size_t decoded = 0;
   std::unique_ptr<IOBuf> result;
-  while (true) {
-    result = decode(ctx, q, needed);
-    if (result) {
-      ctx->fireRead(std::move(result));
-    } else {
-      break;
+  if (batchReads_) {
+    ReadBatch<std::unique_ptr<IOBuf>> frames;
+    while (!outOfBudget(frames.size(), start) &&
+           (result = decode(ctx, q, needed))) {
+      frames.push_back(std::move(result));
+      needed = 0;
+    }
+    decoded = frames.size();
+    setNeeded(ctx, q, needed);
+    if (frames.size() == 1) {
+      ctx->fireRead(std::move(frames.front()));
+    } else if (!frames.empty()) {
+      ctx->fireReadBatch(std::move(frames));
+    }
+  } else {
+    while (!outOfBudget(decoded, start)) {
+      result = decode(ctx, q, needed);
+      if (result) {
+        ctx->fireRead(std::move(result));
+        needed = 0;
+        decoded++;
+      } else {
+        break;
+      }
     }
+    setNeeded(ctx, q, needed);
+  }
+  if (decoded > 0) {
+    framesDecoded().add(decoded);
+  }
+  FOLLY_SDT(wangle, codec_read_end, this, decoded);
+  if (!q.empty() && outOfBudget(decoded, start)) {
+    resumeLater(ctx, q);
+  }
+}
+
+void ByteToMessageCodec::detachPipeline(Context* ctx) {
+  cancelLoopCallback();
+  resumeQueue_ = nullptr;
+}
+
+bool ByteToMessageCodec::outOfBudget(
+    size_t frames, std::chrono::steady_clock::time_point start) const {
+  if (maxReadFrames_ > 0 && frames >= maxReadFrames_) {
+    return true;
+  }
+  return maxReadTime_.count() > 0 && frames > 0 &&
+    std::chrono::steady_clock::now() - start >= maxReadTime_;
+}
+
+void ByteToMessageCodec::resumeLater(Context* ctx, IOBufQueue& q) {
+  resumeQueue_ = &q;
+  if (isLoopCallbackScheduled()) {
+    return;
+  }
+  auto transport = ctx->getTransport();
+  auto evb = transport && transport->getEventBase()
+    ? transport->getEventBase()
+    : EventBaseManager::get()->getEventBase();
+  evb->runInLoop(this);
+}
+
+void ByteToMessageCodec::runLoopCallback() noexcept {
+  auto ctx = getContext();
+  auto q = resumeQueue_;
+  resumeQueue_ = nullptr;
+  if (!ctx || !q) {
+    return;
+  }
+  DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+  read(ctx, *q);
+}
+
+void ByteToMessageCodec::setNeeded(Context* ctx, IOBufQueue& q,
+                                   size_t needed) {
+  neededLength_ = needed ? q.chainLength() + needed : 0;
+  auto pipeline = ctx->getPipeline();
+  if (pipeline->getReadSizeHint() != needed) {
+    pipeline->setReadSizeHint(needed);
   }
 }
 
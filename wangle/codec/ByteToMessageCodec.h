@@ -11,6 +11,9 @@
 #pragma once
 
 #include <wangle/channel/Handler.h>
+#include <folly/io/async/EventBase.h>
+
+#include <chrono>
 
 namespace folly { namespace wangle {
 
@@ -35,13 +38,65 @@ namespace folly { namespace wangle {
  * IOBufQueue.front(), without split() or pop_front().
  */
 class ByteToMessageCodec
-    : public InboundBytesToBytesHandler {
+    : public InboundBytesToBytesHandler,
+      private EventBase::LoopCallback {
  public:
 
+  /**
+   * Returns a frame, or nullptr if there isn't a whole one yet.  A decoder
+   * may then set needed to how many more bytes it needs at least, and
+   * won't be called again until they've arrived; the pipeline's transport
+   * is also asked to read that much at once (see
+   * PipelineBase::setReadSizeHint()).
+   */
   virtual std::unique_ptr<IOBuf> decode(
-    Context* ctx, IOBufQueue& buf, size_t&) = 0;
+    Context* ctx, IOBufQueue& buf, size_t& needed) = 0;
 
   void read(Context* ctx, IOBufQueue& q);
+
+  void detachPipeline(Context* ctx) override;
+
+  /**
+   * In batch mode all frames decoded from a single read are delivered to
+   * the next handler with one fireReadBatch() call instead of one
+   * fireRead() per frame.  Handlers that don't override readBatch() still
+   * see one read() per frame.
+   */
+  void setBatchReads(bool batchReads) {
+    batchReads_ = batchReads;
+  }
+
+  /**
+   * Bounds how long one read holds up the other connections of the
+   * thread: after maxFrames frames, or maxTime, whichever comes first, the
+   * frames still in the queue are decoded at the end of the loop
+   * iteration, once the EventBase handled its other ready events, and so
+   * on.  Zero means no limit; the default is no limit on either.
+   */
+  void setReadBudget(size_t maxFrames,
+                     std::chrono::microseconds maxTime =
+                       std::chrono::microseconds(0)) {
+    maxReadFrames_ = maxFrames;
+    maxReadTime_ = maxTime;
+  }
+
+ private:
+  // Decoding the rest of a read that ran out of budget
+  void runLoopCallback() noexcept override;
+  bool outOfBudget(size_t frames,
+                   std::chrono::steady_clock::time_point start) const;
+  void resumeLater(Context* ctx, IOBufQueue& q);
+
+  // Remembers what the last decode() needed, and passes it on as the hint
+  void setNeeded(Context* ctx, IOBufQueue& q, size_t needed);
+
+  bool batchReads_{false};
+  // What the queue has to hold before decode() is worth calling again
+  size_t neededLength_{0};
+  size_t maxReadFrames_{0};
+  std::chrono::microseconds maxReadTime_{0};
+  // The queue left to decode, owned by the transport handler
+  IOBufQueue* resumeQueue_{nullptr};
 };
 
 }}
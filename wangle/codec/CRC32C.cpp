@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/CRC32C.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+namespace folly { namespace wangle {
+
+namespace {
+
+// Reflected
+const uint32_t kPolynomial = 0x82f63b78;
+
+struct Table {
+  Table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; j++) {
+        crc = (crc >> 1) ^ (crc & 1 ? kPolynomial : 0);
+      }
+      entries[i] = crc;
+    }
+  }
+
+  uint32_t entries[256];
+};
+
+uint32_t crc32cTable(const uint8_t* data, size_t length, uint32_t crc) {
+  static const Table table;
+  for (size_t i = 0; i < length; i++) {
+    crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((__target__("sse4.2")))
+uint32_t crc32cHardware(const uint8_t* data, size_t length, uint32_t crc) {
+  uint64_t crc64 = crc;
+  for (; length >= 8; data += 8, length -= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = crc64;
+  for (; length > 0; data++, length--) {
+    crc = _mm_crc32_u8(crc, *data);
+  }
+  return crc;
+}
+
+bool hasHardware() {
+  static const bool has = __builtin_cpu_supports("sse4.2");
+  return has;
+}
+
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+
+uint32_t crc32cHardware(const uint8_t* data, size_t length, uint32_t crc) {
+  for (; length >= 8; data += 8, length -= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc = __crc32cd(crc, word);
+  }
+  for (; length > 0; data++, length--) {
+    crc = __crc32cb(crc, *data);
+  }
+  return crc;
+}
+
+bool hasHardware() {
+  return true;
+}
+
+#else
+
+uint32_t crc32cHardware(const uint8_t* data, size_t length, uint32_t crc) {
+  return crc32cTable(data, length, crc);
+}
+
+bool hasHardware() {
+  return false;
+}
+
+#endif
+
+}
+
+uint32_t crc32c(const uint8_t* data, size_t length, uint32_t crc) {
+  // Both work on the register's complement
+  crc = ~crc;
+  crc = hasHardware() ? crc32cHardware(data, length, crc)
+                      : crc32cTable(data, length, crc);
+  return ~crc;
+}
+
+uint32_t crc32c(const IOBuf* buf, size_t length, uint32_t crc) {
+  auto p = buf;
+  while (length > 0) {
+    auto n = std::min<size_t>(length, p->length());
+    crc = crc32c(p->data(), n, crc);
+    length -= n;
+    p = p->next();
+    if (p == buf) {
+      break;
+    }
+  }
+  return crc;
+}
+
+}} // namespace
@@ -0,0 +1,47 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/io/IOBuf.h>
+
+#include <stdexcept>
+
+namespace folly { namespace wangle {
+
+/**
+ * CRC32C (Castagnoli, as in iSCSI and SCTP) of length bytes at data,
+ * carrying on from crc, the checksum of the bytes before them.  Uses the
+ * SSE4.2 crc32 instruction where the CPU has it, whatever the build
+ * targets, and ARMv8's when the build targets it (-march=armv8-a+crc);
+ * a table otherwise.
+ */
+uint32_t crc32c(const uint8_t* data, size_t length, uint32_t crc = 0);
+
+// Of the first length bytes of the chain at buf, a buffer at a time
+uint32_t crc32c(const IOBuf* buf, size_t length, uint32_t crc = 0);
+
+// Where a frame's checksum goes, for LengthFieldBasedFrameDecoder and
+// LengthFieldPrepender
+enum class FrameChecksum {
+  NONE,
+  // Ahead of the message, after the header the decoder strips
+  HEADER,
+  // After the message
+  TRAILER,
+};
+
+class ChecksumError : public std::runtime_error {
+ public:
+  explicit ChecksumError(const std::string& what)
+      : std::runtime_error(what) {}
+};
+
+}} // namespace
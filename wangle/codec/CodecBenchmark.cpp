@@ -0,0 +1,206 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/io/Cursor.h>
+#include <wangle/codec/FixedLengthFrameDecoder.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+#include <wangle/codec/LineBasedFrameDecoder.h>
+#include <wangle/codec/StaticLengthFieldFrameDecoder.h>
+#include <wangle/codec/StringCodec.h>
+#include <gflags/gflags.h>
+
+using namespace folly;
+using namespace folly::wangle;
+using namespace folly::io;
+using folly::BenchmarkSuspender;
+
+static const size_t kFramesPerRead = 1024;
+static const size_t kPayloadLength = 64;
+
+class FrameSink final : public InboundHandler<std::unique_ptr<IOBuf>> {
+ public:
+  void read(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    bytes += buf->computeChainDataLength();
+  }
+
+  uint64_t bytes{0};
+};
+
+class StringSink final : public InboundHandler<std::string> {
+ public:
+  void read(Context* ctx, std::string msg) override {
+    bytes += msg.size();
+  }
+
+  uint64_t bytes{0};
+};
+
+class BytesSink final : public OutboundBytesToBytesHandler {
+ public:
+  Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    bytes += buf->computeChainDataLength();
+    return makeFuture();
+  }
+
+  uint64_t bytes{0};
+};
+
+// kFramesPerRead frames in a single buffer
+static std::unique_ptr<IOBuf> makeFixedFrames() {
+  auto buf = IOBuf::create(kFramesPerRead * kPayloadLength);
+  memset(buf->writableData(), 'a', kFramesPerRead * kPayloadLength);
+  buf->append(kFramesPerRead * kPayloadLength);
+  return buf;
+}
+
+static std::unique_ptr<IOBuf> makeLengthFieldFrames() {
+  auto buf = IOBuf::create(kFramesPerRead * (4 + kPayloadLength));
+  Appender appender(buf.get(), 0);
+  for (size_t i = 0; i < kFramesPerRead; i++) {
+    appender.writeBE<uint32_t>(kPayloadLength);
+    for (size_t j = 0; j < kPayloadLength; j++) {
+      appender.write<uint8_t>('a');
+    }
+  }
+  return buf;
+}
+
+static std::unique_ptr<IOBuf> makeLines() {
+  auto buf = IOBuf::create(kFramesPerRead * (kPayloadLength + 2));
+  Appender appender(buf.get(), 0);
+  for (size_t i = 0; i < kFramesPerRead; i++) {
+    for (size_t j = 0; j < kPayloadLength; j++) {
+      appender.write<uint8_t>('a');
+    }
+    appender.write<uint8_t>('\r');
+    appender.write<uint8_t>('\n');
+  }
+  return buf;
+}
+
+// Feeds iters frames through decoder, kFramesPerRead per read
+template <class Decoder>
+void decode(uint iters, Decoder decoder, std::unique_ptr<IOBuf> frames) {
+  BenchmarkSuspender bs;
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  FrameSink sink;
+  pipeline.addBack(std::move(decoder)).addBack(&sink).finalize();
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i += kFramesPerRead) {
+    q.append(frames->clone());
+    pipeline.read(q);
+  }
+  doNotOptimizeAway(sink.bytes);
+}
+
+BENCHMARK(fixedLengthFrameDecoder, iters) {
+  decode(iters, FixedLengthFrameDecoder(kPayloadLength), makeFixedFrames());
+}
+
+BENCHMARK(lengthFieldBasedFrameDecoder, iters) {
+  decode(iters, LengthFieldBasedFrameDecoder(), makeLengthFieldFrames());
+}
+
+BENCHMARK_RELATIVE(staticLengthFieldFrameDecoder, iters) {
+  decode(iters, StaticLengthFieldFrameDecoder<uint32_t>(),
+         makeLengthFieldFrames());
+}
+
+BENCHMARK(lineBasedFrameDecoder, iters) {
+  decode(iters, LineBasedFrameDecoder(), makeLines());
+}
+
+// A line split over many small reads, as from a slow client
+BENCHMARK(lineBasedFrameDecoderFragmented, iters) {
+  BenchmarkSuspender bs;
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  FrameSink sink;
+  pipeline.addBack(LineBasedFrameDecoder()).addBack(&sink).finalize();
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  auto chunk = IOBuf::copyBuffer("aaaaaaaa");
+  auto end = IOBuf::copyBuffer("\r\n");
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    for (size_t j = 0; j < kPayloadLength / 8; j++) {
+      q.append(chunk->clone());
+      pipeline.read(q);
+    }
+    q.append(end->clone());
+    pipeline.read(q);
+  }
+  doNotOptimizeAway(sink.bytes);
+}
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK(lengthFieldPrepender, iters) {
+  BenchmarkSuspender bs;
+  Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+  BytesSink sink;
+  pipeline.addBack(&sink).addBack(LengthFieldPrepender()).finalize();
+  auto payload = IOBuf::create(kPayloadLength);
+  payload->append(kPayloadLength);
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline.write(payload->clone());
+  }
+  doNotOptimizeAway(sink.bytes);
+}
+
+BENCHMARK(stringCodecRead, iters) {
+  BenchmarkSuspender bs;
+  Pipeline<std::unique_ptr<IOBuf>, std::string> pipeline;
+  BytesSink bytesSink;
+  StringSink stringSink;
+  pipeline
+    .addBack(&bytesSink)
+    .addBack(StringCodec())
+    .addBack(&stringSink)
+    .finalize();
+  auto payload = IOBuf::create(kPayloadLength);
+  payload->append(kPayloadLength);
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline.read(payload->clone());
+  }
+  doNotOptimizeAway(stringSink.bytes);
+}
+
+BENCHMARK(stringCodecWrite, iters) {
+  BenchmarkSuspender bs;
+  Pipeline<std::unique_ptr<IOBuf>, std::string> pipeline;
+  BytesSink bytesSink;
+  StringSink stringSink;
+  pipeline
+    .addBack(&bytesSink)
+    .addBack(StringCodec())
+    .addBack(&stringSink)
+    .finalize();
+  std::string payload(kPayloadLength, 'a');
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    pipeline.write(payload);
+  }
+  doNotOptimizeAway(bytesSink.bytes);
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
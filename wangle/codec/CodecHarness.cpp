@@ -0,0 +1,282 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Feeds each decoder a stream of random frames, cut into reads at random
+// places, checks that the frames come out as they went in, and reports
+// throughput, the bytes copied per byte read, and the most bytes the
+// decoder held on to between reads.
+//
+// The reads are all pieces of one buffer holding the whole stream, so a
+// frame's bytes were copied exactly when they aren't in that buffer.
+
+#include <folly/Bits.h>
+#include <folly/Conv.h>
+#include <wangle/codec/FixedLengthFrameDecoder.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+#include <wangle/codec/LineBasedFrameDecoder.h>
+#include <wangle/codec/RespCodec.h>
+#include <wangle/codec/VarintLengthFrameDecoder.h>
+#include <wangle/codec/VarintLengthPrepender.h>
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <random>
+
+using namespace folly;
+using namespace folly::wangle;
+
+DEFINE_string(decoder, "all",
+              "line, fixed, length, length-contiguous, varint, resp or all");
+DEFINE_int32(frames, 100000, "Frames in the stream");
+DEFINE_int32(min_frame, 1, "Shortest frame payload");
+DEFINE_int32(max_frame, 1024,
+             "Longest frame payload, and the length of all fixed frames");
+DEFINE_string(fragmentation, "random",
+              "random, for reads of 1 to max_read bytes, or fixed, for "
+              "reads of max_read bytes");
+DEFINE_int32(max_read, 4096, "Longest read");
+DEFINE_int32(seed, 1, "Random seed");
+DEFINE_bool(verify, true, "Compare the frames read with those written");
+
+struct Stats {
+  uint64_t frames{0};
+  uint64_t bytes{0};
+  uint64_t copied{0};
+  uint64_t mismatches{0};
+};
+
+// Checks the frames decoded from source against expected
+class Checker {
+ public:
+  Checker(const IOBuf* source, const std::vector<std::string>* expected)
+      : begin_(source->data()),
+        end_(source->tail()),
+        expected_(expected) {}
+
+  void check(StringPiece frame) {
+    bool inSource = frame.empty() ||
+      (reinterpret_cast<const uint8_t*>(frame.begin()) >= begin_ &&
+       reinterpret_cast<const uint8_t*>(frame.end()) <= end_);
+    if (!inSource) {
+      stats.copied += frame.size();
+    }
+    if (FLAGS_verify) {
+      if (stats.frames >= expected_->size()) {
+        stats.mismatches++;
+      } else {
+        auto& want = (*expected_)[stats.frames];
+        if (offset_ + frame.size() > want.size() ||
+            memcmp(want.data() + offset_, frame.data(), frame.size()) != 0) {
+          stats.mismatches++;
+        }
+      }
+    }
+    offset_ += frame.size();
+  }
+
+  void endFrame() {
+    if (FLAGS_verify && stats.frames < expected_->size() &&
+        offset_ != (*expected_)[stats.frames].size()) {
+      stats.mismatches++;
+    }
+    stats.bytes += offset_;
+    stats.frames++;
+    offset_ = 0;
+  }
+
+  Stats stats;
+
+ private:
+  const uint8_t* begin_;
+  const uint8_t* end_;
+  const std::vector<std::string>* expected_;
+  // Into the frame being checked
+  size_t offset_{0};
+};
+
+class FrameSink final : public InboundHandler<std::unique_ptr<IOBuf>> {
+ public:
+  explicit FrameSink(Checker* checker) : checker_(checker) {}
+
+  void read(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    for (auto range : *buf) {
+      checker_->check(StringPiece(range));
+    }
+    checker_->endFrame();
+  }
+
+  void readException(Context* ctx, exception_wrapper e) override {
+    checker_->stats.mismatches++;
+  }
+
+ private:
+  Checker* checker_;
+};
+
+class RespSink final : public InboundHandler<RespRequest> {
+ public:
+  explicit RespSink(Checker* checker) : checker_(checker) {}
+
+  void read(Context* ctx, RespRequest req) override {
+    if (req.args.size() != 1) {
+      checker_->stats.mismatches++;
+    } else {
+      checker_->check(req.args[0]);
+    }
+    checker_->endFrame();
+  }
+
+  void readException(Context* ctx, exception_wrapper e) override {
+    checker_->stats.mismatches++;
+  }
+
+ private:
+  Checker* checker_;
+};
+
+// The payloads, and the stream of them framed for the decoder
+void generate(const std::string& decoder, std::mt19937& rng,
+              std::vector<std::string>& payloads, std::string& stream) {
+  std::uniform_int_distribution<int> lengths(FLAGS_min_frame,
+                                             FLAGS_max_frame);
+  // Printable, so there are no line breaks in lines
+  std::uniform_int_distribution<int> chars('!', '~');
+  uint8_t header[VarintLengthFrameDecoder::kMaxVarintLength];
+  for (int i = 0; i < FLAGS_frames; i++) {
+    size_t length = decoder == "fixed" ? FLAGS_max_frame : lengths(rng);
+    std::string payload(length, 0);
+    for (auto& c : payload) {
+      c = chars(rng);
+    }
+    if (decoder == "line") {
+      stream += payload;
+      stream += "\r\n";
+    } else if (decoder == "fixed") {
+      stream += payload;
+    } else if (decoder == "length" || decoder == "length-contiguous") {
+      uint32_t be = Endian::big(uint32_t(length));
+      stream.append(reinterpret_cast<const char*>(&be), sizeof(be));
+      stream += payload;
+    } else if (decoder == "varint") {
+      auto n = VarintLengthPrepender::writeVarint(header, length);
+      stream.append(reinterpret_cast<const char*>(header), n);
+      stream += payload;
+    } else {
+      stream += "*1\r\n$" + folly::to<std::string>(length) + "\r\n";
+      stream += payload;
+      stream += "\r\n";
+    }
+    payloads.push_back(std::move(payload));
+  }
+}
+
+// Reads, as pieces of source
+std::vector<std::unique_ptr<IOBuf>> fragment(const IOBuf& source,
+                                             std::mt19937& rng) {
+  std::uniform_int_distribution<int> sizes(1, FLAGS_max_read);
+  std::vector<std::unique_ptr<IOBuf>> reads;
+  size_t offset = 0;
+  while (offset < source.length()) {
+    size_t size = FLAGS_fragmentation == "fixed" ? FLAGS_max_read : sizes(rng);
+    size = std::min(size, source.length() - offset);
+    auto read = source.cloneOne();
+    read->trimStart(offset);
+    read->trimEnd(source.length() - offset - size);
+    reads.push_back(std::move(read));
+    offset += size;
+  }
+  return reads;
+}
+
+template <class Pipeline>
+void feed(Pipeline& pipeline, std::vector<std::unique_ptr<IOBuf>>& reads,
+          size_t& peakBuffered) {
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  for (auto& read : reads) {
+    q.append(std::move(read));
+    pipeline.read(q);
+    peakBuffered = std::max(peakBuffered, q.chainLength());
+  }
+}
+
+bool runOne(const std::string& decoder) {
+  std::mt19937 rng(FLAGS_seed);
+  std::vector<std::string> payloads;
+  std::string stream;
+  generate(decoder, rng, payloads, stream);
+  auto source = IOBuf::copyBuffer(stream);
+  auto reads = fragment(*source, rng);
+  auto numReads = reads.size();
+
+  Checker checker(source.get(), &payloads);
+  size_t peakBuffered = 0;
+  auto start = std::chrono::steady_clock::now();
+  if (decoder == "resp") {
+    Pipeline<IOBufQueue&, RespReply> pipeline;
+    pipeline
+      .addBack(RespCodec())
+      .addBack(RespSink(&checker))
+      .finalize();
+    feed(pipeline, reads, peakBuffered);
+  } else {
+    Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>> pipeline;
+    if (decoder == "line") {
+      pipeline.addBack(LineBasedFrameDecoder(FLAGS_max_frame + 2));
+    } else if (decoder == "fixed") {
+      pipeline.addBack(FixedLengthFrameDecoder(FLAGS_max_frame));
+    } else if (decoder == "length" || decoder == "length-contiguous") {
+      LengthFieldBasedFrameDecoder lengthDecoder;
+      lengthDecoder.setContiguousFrames(decoder == "length-contiguous");
+      pipeline.addBack(std::move(lengthDecoder));
+    } else {
+      pipeline.addBack(VarintLengthFrameDecoder());
+    }
+    pipeline
+      .addBack(FrameSink(&checker))
+      .finalize();
+    feed(pipeline, reads, peakBuffered);
+  }
+  auto elapsed = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+
+  auto& stats = checker.stats;
+  bool ok = stats.mismatches == 0 && stats.frames == payloads.size();
+  printf("%-18s %8.3f GB/s %10.0f frames/s  copied %6.3f B/B  "
+         "peak buffered %8lu B  reads %8lu  %s\n",
+         decoder.c_str(),
+         stream.size() / elapsed / 1e9,
+         stats.frames / elapsed,
+         double(stats.copied) / stream.size(),
+         peakBuffered,
+         numReads,
+         ok ? "ok" : ("FAILED: " + folly::to<std::string>(
+                        stats.frames, " frames, ",
+                        stats.mismatches, " mismatches")).c_str());
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  std::vector<std::string> decoders;
+  if (FLAGS_decoder == "all") {
+    decoders = {"line", "fixed", "length", "length-contiguous", "varint",
+                "resp"};
+  } else {
+    decoders = {FLAGS_decoder};
+  }
+  bool ok = true;
+  for (auto& decoder : decoders) {
+    ok = runOne(decoder) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/codec/CompressionCodec.h>
+
+#include <folly/Bits.h>
+#include <folly/Conv.h>
+#include <folly/io/Cursor.h>
+
+#include <cstring>
+
+namespace folly { namespace wangle {
+
+const uint8_t CompressionCodec::kUncompressed;
+const uint8_t CompressionCodec::kCompressed;
+const size_t CompressionCodec::kHeaderLength;
+
+CompressionCodec::CompressionCodec(Options options)
+    : options_(std::move(options)),
+      codec_(io::getCodec(options_.type, options_.level)),
+      state_(std::make_shared<State>()) {
+  state_->type = options_.type;
+  state_->level = options_.level;
+}
+
+void CompressionCodec::attachPipeline(Context* ctx) {
+  state_->ctx = ctx;
+}
+
+void CompressionCodec::detachPipeline(Context* ctx) {
+  state_->ctx = nullptr;
+}
+
+void CompressionCodec::read(Context* ctx, std::unique_ptr<IOBuf> buf) {
+  auto length = buf->computeChainDataLength();
+  if (length == 0) {
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Frame missing compression header"));
+    return;
+  }
+  io::Cursor c(buf.get());
+  auto flag = c.read<uint8_t>();
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(std::move(buf));
+
+  if (flag == kUncompressed) {
+    q.trimStart(1);
+    ctx->fireRead(q.empty() ? IOBuf::create(0) : q.move());
+    return;
+  }
+  if (flag != kCompressed || length < kHeaderLength) {
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Bad compression header"));
+    return;
+  }
+  auto uncompressedLength = c.readBE<uint64_t>();
+  if (uncompressedLength > options_.maxUncompressedLength) {
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Frame uncompresses to more than " +
+                             folly::to<std::string>(
+                               options_.maxUncompressedLength)));
+    return;
+  }
+  q.trimStart(kHeaderLength);
+  auto data = q.empty() ? IOBuf::create(0) : q.move();
+
+  std::unique_ptr<IOBuf> out;
+  try {
+    out = codec_->uncompress(data.get(), uncompressedLength);
+  } catch (const std::exception& ex) {
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             std::string("Unable to uncompress frame: ") +
+                             ex.what()));
+    return;
+  }
+  ctx->fireRead(std::move(out));
+}
+
+Future<Unit> CompressionCodec::write(
+    Context* ctx, std::unique_ptr<IOBuf> buf) {
+  if (!options_.executor) {
+    return ctx->fireWrite(
+      encode(codec_.get(), options_.minCompressLength, std::move(buf)));
+  }
+  // Without a transport there's no EventBase to come back to
+  auto transport = ctx->getTransport();
+  if (transport &&
+      buf->computeChainDataLength() >= options_.minCompressLength) {
+    return offload(ctx, transport->getEventBase(), std::move(buf));
+  }
+
+  // Not worth a trip to the executor, or can't take it, but it can't pass
+  // the writes there
+  auto encoded = encode(codec_.get(), options_.minCompressLength,
+                        std::move(buf));
+  if (state_->pending.empty()) {
+    return ctx->fireWrite(std::move(encoded));
+  }
+  auto write = std::make_shared<PendingWrite>();
+  write->output = Try<std::unique_ptr<IOBuf>>(std::move(encoded));
+  write->done = true;
+  state_->pending.push_back(write);
+  return write->promise.getFuture();
+}
+
+Future<Unit> CompressionCodec::offload(
+    Context* ctx, EventBase* evb, std::unique_ptr<IOBuf> buf) {
+  auto write = std::make_shared<PendingWrite>();
+  write->input = std::move(buf);
+  state_->pending.push_back(write);
+  auto future = write->promise.getFuture();
+
+  auto state = state_;
+  auto minCompressLength = options_.minCompressLength;
+  try {
+    options_.executor->add([state, write, evb, minCompressLength] {
+      std::unique_ptr<io::Codec> codec;
+      {
+        std::lock_guard<std::mutex> g(state->codecsMutex);
+        if (!state->codecs.empty()) {
+          codec = std::move(state->codecs.back());
+          state->codecs.pop_back();
+        }
+      }
+      write->output = makeTryWith([&] {
+        if (!codec) {
+          codec = io::getCodec(state->type, state->level);
+        }
+        return encode(codec.get(), minCompressLength,
+                      std::move(write->input));
+      });
+      if (codec) {
+        std::lock_guard<std::mutex> g(state->codecsMutex);
+        state->codecs.push_back(std::move(codec));
+      }
+      evb->runInEventBaseThread([state, write] {
+        write->done = true;
+        flush(state);
+      });
+    });
+  } catch (const std::exception& ex) {
+    state_->pending.pop_back();
+    return makeFuture<Unit>(exception_wrapper(std::current_exception(), ex));
+  }
+  return future;
+}
+
+void CompressionCodec::flush(const std::shared_ptr<State>& state) {
+  auto& pending = state->pending;
+  while (!pending.empty() && pending.front()->done) {
+    auto write = std::move(pending.front());
+    pending.pop_front();
+    if (!state->ctx) {
+      write->promise.setException(
+        std::runtime_error("Pipeline detached before write"));
+      continue;
+    }
+    if (write->output.hasException()) {
+      write->promise.setException(write->output.exception());
+      continue;
+    }
+    state->ctx->fireWrite(std::move(write->output.value()))
+      .then([write](Try<Unit>&& t) {
+        write->promise.setTry(std::move(t));
+      });
+  }
+}
+
+std::unique_ptr<IOBuf> CompressionCodec::encode(
+    io::Codec* codec, size_t minCompressLength, std::unique_ptr<IOBuf> buf) {
+  auto length = buf->computeChainDataLength();
+  if (length >= minCompressLength) {
+    auto compressed = codec->compress(buf.get());
+    if (compressed->computeChainDataLength() < length) {
+      auto header = IOBuf::create(kHeaderLength);
+      header->writableData()[0] = kCompressed;
+      auto be = Endian::big(uint64_t(length));
+      memcpy(header->writableData() + 1, &be, sizeof(be));
+      header->append(kHeaderLength);
+      header->prependChain(std::move(compressed));
+      return header;
+    }
+  }
+
+  if (buf->headroom() >= 1 && !buf->isSharedOne()) {
+    buf->prepend(1);
+    buf->writableData()[0] = kUncompressed;
+    return buf;
+  }
+  auto header = IOBuf::create(1);
+  header->writableData()[0] = kUncompressed;
+  header->append(1);
+  header->prependChain(std::move(buf));
+  return header;
+}
+
+}} // namespace
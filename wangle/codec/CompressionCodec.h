@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/channel/Handler.h>
+
+#include <folly/Executor.h>
+#include <folly/io/Compression.h>
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * CompressionCodec compresses the frames written through it and
+ * uncompresses the frames read, with any of folly::io's codecs (zlib, lz4,
+ * zstd, ...).  It goes after a frame decoder and prepender, e.g.
+ *
+ *   pipeline
+ *     .addBack(AsyncSocketHandler(sock))
+ *     .addBack(LengthFieldBasedFrameDecoder())
+ *     .addBack(LengthFieldPrepender())
+ *     .addBack(CompressionCodec())
+ *
+ * Each frame gets a one byte header saying whether it was compressed, and
+ * if so its uncompressed length as 8 bytes big endian, which the reader
+ * checks against maxUncompressedLength before uncompressing anything.
+ * Frames shorter than minCompressLength, or that compress no smaller, go
+ * out as they are.
+ *
+ * The handler keeps one io::Codec for all its frames rather than making
+ * one per frame.  With an executor, frames are compressed there instead of
+ * holding up the IO thread, and written in their original order once back
+ * in the transport's EventBase; the executor's codecs are pooled per
+ * handler.  A pipeline without a transport compresses inline regardless.
+ * Reads are uncompressed inline.
+ */
+class CompressionCodec
+    : public Handler<std::unique_ptr<IOBuf>, std::unique_ptr<IOBuf>,
+                     std::unique_ptr<IOBuf>, std::unique_ptr<IOBuf>> {
+ public:
+  typedef typename Handler<
+   std::unique_ptr<IOBuf>, std::unique_ptr<IOBuf>,
+   std::unique_ptr<IOBuf>, std::unique_ptr<IOBuf>>::Context Context;
+
+  struct Options {
+    io::CodecType type{io::CodecType::ZLIB};
+    int level{io::COMPRESSION_LEVEL_DEFAULT};
+    // Shorter frames aren't worth compressing
+    size_t minCompressLength{512};
+    // Longer frames are refused by the reader
+    uint64_t maxUncompressedLength{64 << 20};
+    // Compress here rather than in the IO thread, if set
+    std::shared_ptr<Executor> executor;
+  };
+
+  static const uint8_t kUncompressed = 0;
+  static const uint8_t kCompressed = 1;
+  static const size_t kHeaderLength = 9;
+
+  explicit CompressionCodec(Options options = Options());
+
+  void attachPipeline(Context* ctx) override;
+  void detachPipeline(Context* ctx) override;
+
+  void read(Context* ctx, std::unique_ptr<IOBuf> buf) override;
+  Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf) override;
+
+  // Compresses buf with codec if it's worth it, and adds the header
+  static std::unique_ptr<IOBuf> encode(io::Codec* codec,
+                                       size_t minCompressLength,
+                                       std::unique_ptr<IOBuf> buf);
+
+ private:
+  struct PendingWrite {
+    std::unique_ptr<IOBuf> input;
+    Try<std::unique_ptr<IOBuf>> output;
+    bool done{false};
+    Promise<Unit> promise;
+  };
+
+  // Shared with the writes on the executor, which may outlive the handler
+  struct State {
+    Context* ctx{nullptr};
+    io::CodecType type;
+    int level;
+    // In write order; only touched in the EventBase
+    std::deque<std::shared_ptr<PendingWrite>> pending;
+    std::mutex codecsMutex;
+    std::vector<std::unique_ptr<io::Codec>> codecs;
+  };
+
+  // evb is the transport's, where the compressed frames are written
+  Future<Unit> offload(Context* ctx, EventBase* evb,
+                       std::unique_ptr<IOBuf> buf);
+  // Writes out the finished writes at the front of the queue
+  static void flush(const std::shared_ptr<State>& state);
+
+  Options options_;
+  std::unique_ptr<io::Codec> codec_;
+  std::shared_ptr<State> state_;
+};
+
+}} // namespace
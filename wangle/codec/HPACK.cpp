@@ -0,0 +1,612 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/HPACK.h>
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+// RFC 7541 appendix A
+const char* const kStaticEntries[HPACKTable::kStaticSize][2] = {
+  {":authority", ""},
+  {":method", "GET"},
+  {":method", "POST"},
+  {":path", "/"},
+  {":path", "/index.html"},
+  {":scheme", "http"},
+  {":scheme", "https"},
+  {":status", "200"},
+  {":status", "204"},
+  {":status", "206"},
+  {":status", "304"},
+  {":status", "400"},
+  {":status", "404"},
+  {":status", "500"},
+  {"accept-charset", ""},
+  {"accept-encoding", "gzip, deflate"},
+  {"accept-language", ""},
+  {"accept-ranges", ""},
+  {"accept", ""},
+  {"access-control-allow-origin", ""},
+  {"age", ""},
+  {"allow", ""},
+  {"authorization", ""},
+  {"cache-control", ""},
+  {"content-disposition", ""},
+  {"content-encoding", ""},
+  {"content-language", ""},
+  {"content-length", ""},
+  {"content-location", ""},
+  {"content-range", ""},
+  {"content-type", ""},
+  {"cookie", ""},
+  {"date", ""},
+  {"etag", ""},
+  {"expect", ""},
+  {"expires", ""},
+  {"from", ""},
+  {"host", ""},
+  {"if-match", ""},
+  {"if-modified-since", ""},
+  {"if-none-match", ""},
+  {"if-range", ""},
+  {"if-unmodified-since", ""},
+  {"last-modified", ""},
+  {"link", ""},
+  {"location", ""},
+  {"max-forwards", ""},
+  {"proxy-authenticate", ""},
+  {"proxy-authorization", ""},
+  {"range", ""},
+  {"referer", ""},
+  {"refresh", ""},
+  {"retry-after", ""},
+  {"server", ""},
+  {"set-cookie", ""},
+  {"strict-transport-security", ""},
+  {"transfer-encoding", ""},
+  {"user-agent", ""},
+  {"vary", ""},
+  {"via", ""},
+  {"www-authenticate", ""},
+};
+
+// RFC 7541 appendix B, by symbol, EOS last
+const uint32_t kHuffmanCodes[257] = {
+  0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6,
+  0xfffffe7, 0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea,
+  0x3ffffffd, 0xfffffeb, 0xfffffec, 0xfffffed, 0xfffffee, 0xfffffef,
+  0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3, 0xffffff4,
+  0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa,
+  0xffffffb, 0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa, 0x3fa,
+  0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18, 0x0, 0x1, 0x2, 0x19, 0x1a,
+  0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+  0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66,
+  0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+  0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22, 0x7ffd, 0x3, 0x23,
+  0x4, 0x24, 0x5, 0x25, 0x26, 0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+  0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7ffe,
+  0x7fc, 0x3ffd, 0x1ffd, 0xffffffc, 0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8,
+  0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9, 0x3fffd6, 0x7fffda, 0x7fffdb,
+  0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf, 0xffffec, 0xffffed,
+  0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3, 0x7fffe4,
+  0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+  0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9,
+  0x1fffde, 0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf,
+  0x7fffeb, 0x7fffec, 0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed,
+  0x3fffe1, 0x7fffee, 0x7fffef, 0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4,
+  0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1, 0x3ffffe0, 0x3ffffe1, 0xfffeb,
+  0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec, 0x3ffffe2, 0x3ffffe3,
+  0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed, 0x7fff2,
+  0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+  0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4,
+  0x7ffffe5, 0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7,
+  0x1fffe8, 0x7ffff3, 0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4,
+  0xfffff5, 0x3ffffea, 0x7ffff4, 0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed,
+  0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea, 0x7ffffeb, 0xffffffe,
+  0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+  0x3fffffff,
+};
+
+const uint8_t kHuffmanLengths[257] = {
+  13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28, 28, 28, 28,
+  28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28, 6, 10, 10, 12, 13, 6,
+  8, 11, 10, 10, 8, 11, 8, 6, 6, 6, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15,
+  6, 12, 10, 13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+  7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6, 15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7,
+  6, 6, 6, 5, 6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28, 20, 22,
+  20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23, 24, 24, 22, 23, 24,
+  23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24, 22, 21, 20, 22, 22, 23, 23, 21,
+  23, 22, 22, 24, 21, 22, 23, 23, 21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22,
+  22, 23, 22, 22, 23, 26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26,
+  24, 25, 19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27, 20,
+  24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23, 26, 27, 26, 26,
+  27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26, 30,
+};
+
+const uint16_t kEOS = 256;
+
+struct StaticTable {
+  StaticTable() {
+    for (uint32_t i = 0; i < HPACKTable::kStaticSize; i++) {
+      entries[i] = std::make_pair(StringPiece(kStaticEntries[i][0]),
+                                  StringPiece(kStaticEntries[i][1]));
+      auto length = entries[i].first.size();
+      if (length >= byLength.size()) {
+        byLength.resize(length + 1);
+      }
+      byLength[length].push_back(i + 1);
+    }
+  }
+
+  std::pair<StringPiece, StringPiece> entries[HPACKTable::kStaticSize];
+  // Indexes of the entries by name length
+  std::vector<std::vector<uint8_t>> byLength;
+};
+
+const StaticTable& staticTable() {
+  static const StaticTable table;
+  return table;
+}
+
+/**
+ * The code is canonical: codes of a length are consecutive, in the order
+ * of their symbols.  So the L bits at the front of the input are a code
+ * if they're within the range of codes of length L, and which symbol is
+ * the offset into the symbols of that length.
+ */
+struct HuffmanDecodeTable {
+  HuffmanDecodeTable() {
+    uint16_t n = 0;
+    for (uint8_t length = 1; length <= kMaxLength; length++) {
+      firstIndex[length] = n;
+      firstCode[length] = 0;
+      for (uint16_t symbol = 0; symbol <= kEOS; symbol++) {
+        if (kHuffmanLengths[symbol] == length) {
+          if (n == firstIndex[length]) {
+            firstCode[length] = kHuffmanCodes[symbol];
+          }
+          symbols[n++] = symbol;
+        }
+      }
+      count[length] = n - firstIndex[length];
+    }
+  }
+
+  static const uint8_t kMinLength = 5;
+  static const uint8_t kMaxLength = 30;
+
+  uint32_t firstCode[kMaxLength + 1];
+  uint16_t firstIndex[kMaxLength + 1];
+  uint16_t count[kMaxLength + 1];
+  uint16_t symbols[kEOS + 1];
+};
+
+const HuffmanDecodeTable& huffmanDecodeTable() {
+  static const HuffmanDecodeTable table;
+  return table;
+}
+
+size_t huffmanLength(StringPiece s) {
+  uint64_t bits = 0;
+  for (auto c : s) {
+    bits += kHuffmanLengths[uint8_t(c)];
+  }
+  return (bits + 7) / 8;
+}
+
+uint8_t* huffmanEncode(uint8_t* out, StringPiece s) {
+  uint64_t bits = 0;
+  unsigned nbits = 0;
+  for (auto c : s) {
+    auto length = kHuffmanLengths[uint8_t(c)];
+    bits = (bits << length) | kHuffmanCodes[uint8_t(c)];
+    nbits += length;
+    while (nbits >= 8) {
+      nbits -= 8;
+      *out++ = uint8_t(bits >> nbits);
+    }
+    bits &= (uint64_t(1) << nbits) - 1;
+  }
+  if (nbits > 0) {
+    // Padded with the front of EOS, all ones
+    *out++ = uint8_t((bits << (8 - nbits)) | (0xff >> nbits));
+  }
+  return out;
+}
+
+bool isSensitive(StringPiece name) {
+  return name == "authorization" || name == "proxy-authorization";
+}
+
+// What an integer takes at most, for the 32 bit values we deal in
+const size_t kMaxIntegerLength = 6;
+
+// Default HPACK table size, before SETTINGS say otherwise
+const uint32_t kProtocolTableSize = 4096;
+
+}
+
+void HTTP2Headers::add(StringPiece name, StringPiece value) {
+  fields_.push_back(Field{uint32_t(storage_.size()),
+                          uint32_t(name.size()),
+                          uint32_t(value.size())});
+  storage_.append(name.data(), name.size());
+  storage_.append(value.data(), value.size());
+}
+
+bool HTTP2Headers::get(StringPiece name, StringPiece* value) const {
+  for (size_t i = 0; i < fields_.size(); i++) {
+    if (getName(i) == name) {
+      *value = getValue(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+void HPACKTable::add(StringPiece name, StringPiece value) {
+  auto entrySize = name.size() + value.size() + 32;
+  if (entrySize > maxSize_) {
+    // Which empties the table (RFC 7541 4.4)
+    evict(0);
+    return;
+  }
+  Entry entry{name.str(), value.str()};
+  evict(maxSize_ - entrySize);
+  entries_.push_front(std::move(entry));
+  size_ += entrySize;
+}
+
+bool HPACKTable::get(uint32_t index, StringPiece* name,
+                     StringPiece* value) const {
+  if (index == 0) {
+    return false;
+  }
+  if (index <= kStaticSize) {
+    auto& entry = staticTable().entries[index - 1];
+    *name = entry.first;
+    *value = entry.second;
+    return true;
+  }
+  index -= kStaticSize + 1;
+  if (index >= entries_.size()) {
+    return false;
+  }
+  *name = entries_[index].name;
+  *value = entries_[index].value;
+  return true;
+}
+
+uint32_t HPACKTable::find(StringPiece name, StringPiece value,
+                          uint32_t* nameIndex) const {
+  auto index = findStatic(name, value, nameIndex);
+  if (index) {
+    return index;
+  }
+  for (size_t i = 0; i < entries_.size(); i++) {
+    auto& entry = entries_[i];
+    if (StringPiece(entry.name) == name) {
+      if (StringPiece(entry.value) == value) {
+        return kStaticSize + 1 + i;
+      }
+      if (!*nameIndex) {
+        *nameIndex = kStaticSize + 1 + i;
+      }
+    }
+  }
+  return 0;
+}
+
+uint32_t HPACKTable::findStatic(StringPiece name, StringPiece value,
+                                uint32_t* nameIndex) {
+  *nameIndex = 0;
+  auto& table = staticTable();
+  if (name.size() >= table.byLength.size()) {
+    return 0;
+  }
+  for (auto index : table.byLength[name.size()]) {
+    auto& entry = table.entries[index - 1];
+    if (entry.first == name) {
+      if (entry.second == value) {
+        return index;
+      }
+      if (!*nameIndex) {
+        *nameIndex = index;
+      }
+    }
+  }
+  return 0;
+}
+
+void HPACKTable::setMaxSize(uint32_t maxSize) {
+  maxSize_ = maxSize;
+  evict(maxSize);
+}
+
+void HPACKTable::evict(uint32_t maxSize) {
+  while (size_ > maxSize) {
+    auto& entry = entries_.back();
+    size_ -= entry.name.size() + entry.value.size() + 32;
+    entries_.pop_back();
+  }
+}
+
+void HPACKDecoder::decode(io::Cursor& cursor, size_t length,
+                          HTTP2Headers& headers) {
+  auto remaining = length;
+  bool fieldSeen = false;
+  // Huffman coding takes strings down to about 3/4
+  headers.storage_.reserve(headers.storage_.size() + length * 3 / 2);
+  while (remaining > 0) {
+    auto first = cursor.read<uint8_t>();
+    remaining--;
+    if (first & 0x80) {
+      // Indexed field
+      auto index = decodeInteger(cursor, remaining, first, 7);
+      StringPiece name, value;
+      if (!table_.get(index, &name, &value)) {
+        throw HPACKError("Bad header table index");
+      }
+      headers.add(name, value);
+    } else if ((first & 0xe0) == 0x20) {
+      // Table size update, which has to come ahead of the fields
+      if (fieldSeen) {
+        throw HPACKError("Header table size update after a field");
+      }
+      auto size = decodeInteger(cursor, remaining, first, 5);
+      if (size > maxTableSize_) {
+        throw HPACKError("Header table size update past our limit");
+      }
+      table_.setMaxSize(size);
+      continue;
+    } else {
+      // Literal, with incremental indexing, without or never indexed
+      bool indexing = (first & 0xc0) == 0x40;
+      auto index = decodeInteger(cursor, remaining, first, indexing ? 6 : 4);
+      // Straight into the block's storage, name then value
+      auto offset = headers.storage_.size();
+      size_t nameLength;
+      if (index == 0) {
+        nameLength = decodeString(cursor, remaining, headers);
+      } else {
+        StringPiece name, value;
+        if (!table_.get(index, &name, &value)) {
+          throw HPACKError("Bad header table index");
+        }
+        headers.storage_.append(name.data(), name.size());
+        nameLength = name.size();
+      }
+      auto valueLength = decodeString(cursor, remaining, headers);
+      headers.fields_.push_back(HTTP2Headers::Field{uint32_t(offset),
+                                                    uint32_t(nameLength),
+                                                    uint32_t(valueLength)});
+      if (indexing) {
+        auto i = headers.size() - 1;
+        table_.add(headers.getName(i), headers.getValue(i));
+      }
+    }
+    fieldSeen = true;
+    if (headers.getListSize() > maxHeaderListSize_) {
+      throw HPACKError("Header list too long");
+    }
+  }
+}
+
+uint32_t HPACKDecoder::decodeInteger(io::Cursor& cursor, size_t& remaining,
+                                     uint8_t first, uint8_t prefixBits) {
+  uint32_t max = (1u << prefixBits) - 1;
+  uint64_t value = first & max;
+  if (value < max) {
+    return value;
+  }
+  for (unsigned shift = 0; ; shift += 7) {
+    if (remaining == 0) {
+      throw HPACKError("Header block ends within an integer");
+    }
+    if (shift > 28) {
+      throw HPACKError("Integer too large");
+    }
+    auto b = cursor.read<uint8_t>();
+    remaining--;
+    value += uint64_t(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      break;
+    }
+  }
+  if (value > std::numeric_limits<uint32_t>::max()) {
+    throw HPACKError("Integer too large");
+  }
+  return value;
+}
+
+size_t HPACKDecoder::decodeString(io::Cursor& cursor, size_t& remaining,
+                                  HTTP2Headers& headers) {
+  if (remaining == 0) {
+    throw HPACKError("Header block ends before a string");
+  }
+  auto first = cursor.read<uint8_t>();
+  remaining--;
+  auto length = decodeInteger(cursor, remaining, first, 7);
+  if (length > remaining) {
+    throw HPACKError("String past the end of the header block");
+  }
+  remaining -= length;
+  auto& storage = headers.storage_;
+  auto start = storage.size();
+  if (first & 0x80) {
+    decodeHuffman(cursor, length, storage);
+  } else {
+    storage.resize(start + length);
+    cursor.pull(&storage[start], length);
+  }
+  return storage.size() - start;
+}
+
+void HPACKDecoder::decodeHuffman(io::Cursor& cursor, size_t length,
+                                 std::string& out) {
+  auto& table = huffmanDecodeTable();
+  uint64_t bits = 0;
+  unsigned nbits = 0;
+  while (length > 0) {
+    // However the string is split across buffers
+    auto data = cursor.peek();
+    auto n = std::min<size_t>(data.second, length);
+    for (size_t i = 0; i < n; i++) {
+      bits = (bits << 8) | data.first[i];
+      nbits += 8;
+      while (nbits >= HuffmanDecodeTable::kMinLength) {
+        uint16_t symbol = kEOS + 1;
+        auto maxLength = std::min<unsigned>(nbits,
+                                            HuffmanDecodeTable::kMaxLength);
+        unsigned codeLength = HuffmanDecodeTable::kMinLength;
+        for (; codeLength <= maxLength; codeLength++) {
+          uint32_t code = (bits >> (nbits - codeLength)) &
+            ((uint64_t(1) << codeLength) - 1);
+          uint32_t offset = code - table.firstCode[codeLength];
+          if (code >= table.firstCode[codeLength] &&
+              offset < table.count[codeLength]) {
+            symbol = table.symbols[table.firstIndex[codeLength] + offset];
+            break;
+          }
+        }
+        if (symbol > kEOS) {
+          // Needs more bits
+          break;
+        }
+        if (symbol == kEOS) {
+          throw HPACKError("EOS in a Huffman coded string");
+        }
+        out.push_back(char(symbol));
+        nbits -= codeLength;
+        bits &= (uint64_t(1) << nbits) - 1;
+      }
+    }
+    cursor.skip(n);
+    length -= n;
+  }
+  // What's left has to be padding: fewer than 8 bits, all ones
+  if (nbits >= 8 || bits != (uint64_t(1) << nbits) - 1) {
+    throw HPACKError("Bad Huffman padding");
+  }
+}
+
+HPACKEncoder::HPACKEncoder(uint32_t maxTableSize)
+    : table_(std::min(maxTableSize, kProtocolTableSize)),
+      maxTableSize_(maxTableSize) {
+  if (maxTableSize < kProtocolTableSize) {
+    tableSizeChanged_ = true;
+    minTableSize_ = nextTableSize_ = maxTableSize;
+  }
+}
+
+void HPACKEncoder::setPeerMaxTableSize(uint32_t size) {
+  size = std::min(size, maxTableSize_);
+  if (!tableSizeChanged_) {
+    if (size == table_.getMaxSize()) {
+      return;
+    }
+    tableSizeChanged_ = true;
+    minTableSize_ = size;
+  } else {
+    minTableSize_ = std::min(minTableSize_, size);
+  }
+  nextTableSize_ = size;
+}
+
+std::unique_ptr<IOBuf> HPACKEncoder::encode(const HTTP2Headers& headers) {
+  // Sized for the worst case first, so it all goes in one buffer
+  size_t size = 2 * kMaxIntegerLength;
+  for (size_t i = 0; i < headers.size(); i++) {
+    size += 3 * kMaxIntegerLength + headers.getName(i).size() +
+      headers.getValue(i).size();
+  }
+  auto buf = IOBuf::create(size);
+  auto start = buf->writableData();
+  auto out = start;
+
+  if (tableSizeChanged_) {
+    tableSizeChanged_ = false;
+    if (minTableSize_ < nextTableSize_) {
+      table_.setMaxSize(minTableSize_);
+      out = encodeInteger(out, 0x20, 5, minTableSize_);
+    }
+    table_.setMaxSize(nextTableSize_);
+    out = encodeInteger(out, 0x20, 5, nextTableSize_);
+  }
+
+  for (size_t i = 0; i < headers.size(); i++) {
+    auto name = headers.getName(i);
+    auto value = headers.getValue(i);
+    uint32_t nameIndex = 0;
+    auto index = table_.find(name, value, &nameIndex);
+    if (index) {
+      out = encodeInteger(out, 0x80, 7, index);
+      continue;
+    }
+    bool indexing = false;
+    if (isSensitive(name)) {
+      out = encodeInteger(out, 0x10, 4, nameIndex);
+    } else if (name.size() + value.size() + 32 > table_.getMaxSize() / 2) {
+      // Would push out half the table
+      out = encodeInteger(out, 0x00, 4, nameIndex);
+    } else {
+      indexing = true;
+      out = encodeInteger(out, 0x40, 6, nameIndex);
+    }
+    if (!nameIndex) {
+      out = encodeString(out, name);
+    }
+    out = encodeString(out, value);
+    if (indexing) {
+      table_.add(name, value);
+    }
+  }
+  buf->append(out - start);
+  DCHECK_LE(buf->length(), size);
+  return buf;
+}
+
+uint8_t* HPACKEncoder::encodeInteger(uint8_t* out, uint8_t first,
+                                     uint8_t prefixBits, uint32_t value) {
+  uint32_t max = (1u << prefixBits) - 1;
+  if (value < max) {
+    *out++ = first | value;
+    return out;
+  }
+  *out++ = first | max;
+  value -= max;
+  while (value >= 0x80) {
+    *out++ = 0x80 | (value & 0x7f);
+    value >>= 7;
+  }
+  *out++ = value;
+  return out;
+}
+
+uint8_t* HPACKEncoder::encodeString(uint8_t* out, StringPiece s) {
+  auto length = huffmanLength(s);
+  if (length < s.size()) {
+    out = encodeInteger(out, 0x80, 7, length);
+    return huffmanEncode(out, s);
+  }
+  out = encodeInteger(out, 0x00, 7, s.size());
+  memcpy(out, s.data(), s.size());
+  return out + s.size();
+}
+
+}} // namespace
@@ -0,0 +1,211 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Range.h>
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBuf.h>
+
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * The header fields of an HTTP/2 message, in order.  Names and values are
+ * kept back to back in one buffer for the whole block, rather than in a
+ * pair of strings each, so decoding a header block allocates about twice,
+ * whatever the number of fields.  Names are lowercase, as HTTP/2 has them.
+ */
+class HTTP2Headers {
+ public:
+  // Copies name and value
+  void add(StringPiece name, StringPiece value);
+
+  size_t size() const {
+    return fields_.size();
+  }
+  bool empty() const {
+    return fields_.empty();
+  }
+
+  StringPiece getName(size_t i) const {
+    auto& field = fields_[i];
+    return StringPiece(storage_.data() + field.offset, field.nameLength);
+  }
+  StringPiece getValue(size_t i) const {
+    auto& field = fields_[i];
+    return StringPiece(storage_.data() + field.offset + field.nameLength,
+                       field.valueLength);
+  }
+
+  // The value of the first field named name, if any
+  bool get(StringPiece name, StringPiece* value) const;
+
+  // For the fields and bytes of names and values about to be added
+  void reserve(size_t fields, size_t bytes) {
+    fields_.reserve(fields);
+    storage_.reserve(bytes);
+  }
+
+  void clear() {
+    fields_.clear();
+    storage_.clear();
+  }
+
+  // The size HPACK accounts for: the name, the value and 32 bytes a field
+  size_t getListSize() const {
+    return storage_.size() + 32 * fields_.size();
+  }
+
+ private:
+  friend class HPACKDecoder;
+
+  // Offsets rather than pointers, which storage_ growing would move
+  struct Field {
+    uint32_t offset;
+    uint32_t nameLength;
+    uint32_t valueLength;
+  };
+
+  std::string storage_;
+  std::vector<Field> fields_;
+};
+
+class HPACKError : public std::runtime_error {
+ public:
+  explicit HPACKError(const std::string& what)
+      : std::runtime_error(what) {}
+};
+
+/**
+ * HPACK's static and dynamic tables, as one index space (RFC 7541 2.3.3):
+ * 1 to 61 for the static table, then the dynamic one, newest first.
+ */
+class HPACKTable {
+ public:
+  static const uint32_t kStaticSize = 61;
+
+  explicit HPACKTable(uint32_t maxSize) : maxSize_(maxSize) {}
+
+  // Into the table, evicting the oldest entries to make room
+  void add(StringPiece name, StringPiece value);
+
+  // False if there's nothing at index
+  bool get(uint32_t index, StringPiece* name, StringPiece* value) const;
+
+  /**
+   * The index of the entry with name and value, or 0.  If there's none,
+   * nameIndex is set to one with name alone, or 0.  The static table is
+   * looked up by name length first, which most names miss on.
+   */
+  uint32_t find(StringPiece name, StringPiece value,
+                uint32_t* nameIndex) const;
+
+  void setMaxSize(uint32_t maxSize);
+
+  uint32_t getMaxSize() const {
+    return maxSize_;
+  }
+  uint32_t getSize() const {
+    return size_;
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    std::string value;
+  };
+
+  static uint32_t findStatic(StringPiece name, StringPiece value,
+                             uint32_t* nameIndex);
+  void evict(uint32_t maxSize);
+
+  // Newest first
+  std::deque<Entry> entries_;
+  uint32_t size_{0};
+  uint32_t maxSize_;
+};
+
+/**
+ * Decodes the header blocks of one direction of an HTTP/2 connection.
+ * Blocks are read through a Cursor, so one that spans several buffers,
+ * as read or as split into frames, isn't coalesced first.  Fails with an
+ * HPACKError, after which the table is out of step with the peer's and
+ * the connection has to go.
+ */
+class HPACKDecoder {
+ public:
+  static const uint32_t kDefaultTableSize = 4096;
+
+  // maxTableSize is the SETTINGS_HEADER_TABLE_SIZE we advertise
+  explicit HPACKDecoder(uint32_t maxTableSize = kDefaultTableSize,
+                        size_t maxHeaderListSize = 64 * 1024)
+      : table_(maxTableSize),
+        maxTableSize_(maxTableSize),
+        maxHeaderListSize_(maxHeaderListSize) {}
+
+  // The length bytes of a header block at cursor, into headers
+  void decode(io::Cursor& cursor, size_t length, HTTP2Headers& headers);
+
+ private:
+  uint32_t decodeInteger(io::Cursor& cursor, size_t& remaining,
+                         uint8_t first, uint8_t prefixBits);
+  // Appends the string at cursor to headers' storage; returns its length
+  size_t decodeString(io::Cursor& cursor, size_t& remaining,
+                      HTTP2Headers& headers);
+  void decodeHuffman(io::Cursor& cursor, size_t length, std::string& out);
+
+  HPACKTable table_;
+  const uint32_t maxTableSize_;
+  const size_t maxHeaderListSize_;
+};
+
+/**
+ * Encodes the header blocks of one direction of an HTTP/2 connection.
+ * Fields in the static or dynamic table go out as indexes; others are
+ * added to the dynamic table, with their name indexed where it can be,
+ * save for those too big for it and credentials, which aren't kept.
+ * Strings are Huffman coded where that's shorter.
+ */
+class HPACKEncoder {
+ public:
+  /**
+   * A table of up to maxTableSize, or the peer's SETTINGS_HEADER_TABLE_SIZE
+   * if that's smaller; until the peer's settings come, it's the default.
+   */
+  explicit HPACKEncoder(
+      uint32_t maxTableSize = HPACKDecoder::kDefaultTableSize);
+
+  // A header block for headers, in one buffer
+  std::unique_ptr<IOBuf> encode(const HTTP2Headers& headers);
+
+  // The peer's SETTINGS_HEADER_TABLE_SIZE; takes effect, and is signalled
+  // to the peer, at the start of the next block
+  void setPeerMaxTableSize(uint32_t size);
+
+ private:
+  static uint8_t* encodeInteger(uint8_t* out, uint8_t first,
+                                uint8_t prefixBits, uint32_t value);
+  static uint8_t* encodeString(uint8_t* out, StringPiece s);
+
+  HPACKTable table_;
+  const uint32_t maxTableSize_;
+  // Size updates to make, and signal, at the start of the next block: the
+  // smallest the size went down to since the last one, then the latest
+  bool tableSizeChanged_{false};
+  uint32_t minTableSize_{0};
+  uint32_t nextTableSize_{0};
+};
+
+}} // namespace
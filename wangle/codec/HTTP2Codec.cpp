@@ -0,0 +1,477 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/HTTP2Codec.h>
+
+#include <folly/io/Cursor.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+// The largest frame size SETTINGS_MAX_FRAME_SIZE may allow
+const uint32_t kMaxFrameSizeLimit = (1u << 24) - 1;
+
+void putBE16(uint8_t* p, uint16_t value) {
+  p[0] = value >> 8;
+  p[1] = value;
+}
+
+void putBE32(uint8_t* p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+}
+
+const StringPiece HTTP2Codec::kConnectionPreface(
+  "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+
+HTTP2Frame HTTP2Frame::data(uint32_t streamId, std::unique_ptr<IOBuf> buf,
+                            bool endStream) {
+  HTTP2Frame frame(Type::DATA, endStream ? END_STREAM : 0, streamId);
+  frame.payload = std::move(buf);
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::headers(uint32_t streamId, HTTP2Headers headers,
+                               bool endStream) {
+  HTTP2Frame frame(Type::HEADERS, endStream ? END_STREAM : 0, streamId);
+  frame.headerBlock = std::move(headers);
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::rstStream(uint32_t streamId, HTTP2ErrorCode code) {
+  HTTP2Frame frame(Type::RST_STREAM, 0, streamId);
+  frame.errorCode = code;
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::settings(Settings settings) {
+  HTTP2Frame frame(Type::SETTINGS, 0, 0);
+  frame.settingsList = std::move(settings);
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::settingsAck() {
+  return HTTP2Frame(Type::SETTINGS, ACK, 0);
+}
+
+HTTP2Frame HTTP2Frame::ping(std::unique_ptr<IOBuf> payload, bool ack) {
+  HTTP2Frame frame(Type::PING, ack ? ACK : 0, 0);
+  frame.payload = std::move(payload);
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::goaway(uint32_t lastStreamId, HTTP2ErrorCode code) {
+  HTTP2Frame frame(Type::GOAWAY, 0, 0);
+  frame.lastStreamId = lastStreamId;
+  frame.errorCode = code;
+  return frame;
+}
+
+HTTP2Frame HTTP2Frame::windowUpdate(uint32_t streamId, uint32_t increment) {
+  HTTP2Frame frame(Type::WINDOW_UPDATE, 0, streamId);
+  frame.windowIncrement = increment;
+  return frame;
+}
+
+void HTTP2Codec::read(Context* ctx, IOBufQueue& q) {
+  if (!failed_ && !prefaceDone_ && direction_ == Direction::SERVER &&
+      !q.empty()) {
+    // Checked as it arrives, so that an HTTP/1 client is turned away on
+    // its first read
+    char preface[24];
+    auto n = std::min(q.chainLength(), kConnectionPreface.size());
+    io::Cursor(q.front()).pull(preface, n);
+    if (StringPiece(preface, n) != kConnectionPreface.subpiece(0, n)) {
+      fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Bad connection preface");
+    } else if (n < kConnectionPreface.size()) {
+      return;
+    } else {
+      q.trimStart(n);
+      prefaceDone_ = true;
+    }
+  }
+  while (!failed_ && q.chainLength() >= kFrameHeaderSize) {
+    io::Cursor c(q.front());
+    uint32_t length = uint32_t(c.readBE<uint16_t>()) << 8;
+    length |= c.read<uint8_t>();
+    auto type = HTTP2Frame::Type(c.read<uint8_t>());
+    auto flags = c.read<uint8_t>();
+    auto streamId = c.readBE<uint32_t>() & 0x7fffffff;
+    if (length > maxFrameSize_) {
+      fail(ctx, HTTP2ErrorCode::FRAME_SIZE_ERROR, "Frame too long");
+      break;
+    }
+    if (q.chainLength() < kFrameHeaderSize + length) {
+      break;
+    }
+    q.trimStart(kFrameHeaderSize);
+    auto payload = length > 0 ? q.split(length) : IOBuf::create(0);
+    readFrame(ctx, type, flags, streamId, length, std::move(payload));
+  }
+  if (failed_) {
+    q.move();
+  }
+}
+
+bool HTTP2Codec::readFrame(Context* ctx, HTTP2Frame::Type type,
+                           uint8_t flags, uint32_t streamId,
+                           uint32_t length, std::unique_ptr<IOBuf> payload) {
+  typedef HTTP2Frame::Type Type;
+  if (headerStreamId_ &&
+      (type != Type::CONTINUATION || streamId != headerStreamId_)) {
+    fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR,
+         "Frame within a header block");
+    return false;
+  }
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(std::move(payload));
+  HTTP2Frame frame(type, flags, streamId);
+
+  switch (type) {
+    case Type::DATA:
+      if (streamId == 0) {
+        fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "DATA on stream 0");
+        return false;
+      }
+      if (!stripPadding(ctx, type, flags, q)) {
+        return false;
+      }
+      frame.flowControlLength = length;
+      frame.payload = q.empty() ? IOBuf::create(0) : q.move();
+      break;
+    case Type::HEADERS:
+      if (streamId == 0) {
+        fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "HEADERS on stream 0");
+        return false;
+      }
+      if (!stripPadding(ctx, type, flags, q)) {
+        return false;
+      }
+      if (direction_ == Direction::SERVER) {
+        lastStreamId_ = std::max(lastStreamId_, streamId);
+      }
+      headerBlock_.append(q.move());
+      headerStreamId_ = streamId;
+      headerFlags_ = flags;
+      continuations_ = 0;
+      return readHeaderBlock(ctx);
+    case Type::CONTINUATION:
+      if (!headerStreamId_) {
+        fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR,
+             "CONTINUATION without HEADERS");
+        return false;
+      }
+      // Empty ones don't grow the block, so its length doesn't bound them
+      if (length == 0 && !(flags & HTTP2Frame::END_HEADERS)) {
+        fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Empty CONTINUATION");
+        return false;
+      }
+      if (++continuations_ > kMaxContinuations) {
+        fail(ctx, HTTP2ErrorCode::ENHANCE_YOUR_CALM,
+             "Too many CONTINUATION frames");
+        return false;
+      }
+      headerBlock_.append(q.move());
+      headerFlags_ |= flags & HTTP2Frame::END_HEADERS;
+      return readHeaderBlock(ctx);
+    case Type::PRIORITY:
+      if (length != 5) {
+        fail(ctx, HTTP2ErrorCode::FRAME_SIZE_ERROR, "Bad PRIORITY frame");
+        return false;
+      }
+      return true;
+    case Type::RST_STREAM:
+      if (streamId == 0 || length != 4) {
+        fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Bad RST_STREAM frame");
+        return false;
+      }
+      frame.errorCode =
+        HTTP2ErrorCode(io::Cursor(q.front()).readBE<uint32_t>());
+      break;
+    case Type::SETTINGS:
+      if (!readSettings(ctx, frame, q)) {
+        return false;
+      }
+      break;
+    case Type::PUSH_PROMISE:
+      fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Push isn't enabled");
+      return false;
+    case Type::PING:
+      if (streamId != 0 || length != 8) {
+        fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Bad PING frame");
+        return false;
+      }
+      frame.payload = q.move();
+      break;
+    case Type::GOAWAY: {
+      if (streamId != 0 || length < 8) {
+        fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Bad GOAWAY frame");
+        return false;
+      }
+      io::Cursor c(q.front());
+      frame.lastStreamId = c.readBE<uint32_t>() & 0x7fffffff;
+      frame.errorCode = HTTP2ErrorCode(c.readBE<uint32_t>());
+      q.trimStart(8);
+      frame.payload = q.empty() ? IOBuf::create(0) : q.move();
+      break;
+    }
+    case Type::WINDOW_UPDATE: {
+      if (length != 4) {
+        fail(ctx, HTTP2ErrorCode::FRAME_SIZE_ERROR,
+             "Bad WINDOW_UPDATE frame");
+        return false;
+      }
+      frame.windowIncrement =
+        io::Cursor(q.front()).readBE<uint32_t>() & 0x7fffffff;
+      if (frame.windowIncrement == 0) {
+        fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR,
+             "WINDOW_UPDATE of nothing");
+        return false;
+      }
+      break;
+    }
+    default:
+      // Extensions we don't know of are to be ignored
+      return true;
+  }
+  ctx->fireRead(std::move(frame));
+  return true;
+}
+
+bool HTTP2Codec::stripPadding(Context* ctx, HTTP2Frame::Type type,
+                              uint8_t flags, IOBufQueue& payload) {
+  size_t padding = 0;
+  if (flags & HTTP2Frame::PADDED) {
+    if (payload.chainLength() < 1) {
+      fail(ctx, HTTP2ErrorCode::FRAME_SIZE_ERROR, "Padded frame too short");
+      return false;
+    }
+    padding = io::Cursor(payload.front()).read<uint8_t>();
+    payload.trimStart(1);
+  }
+  if (type == HTTP2Frame::Type::HEADERS &&
+      (flags & HTTP2Frame::PRIORITY_FLAG)) {
+    if (payload.chainLength() < 5) {
+      fail(ctx, HTTP2ErrorCode::FRAME_SIZE_ERROR,
+           "HEADERS too short for its priority");
+      return false;
+    }
+    payload.trimStart(5);
+  }
+  if (padding > payload.chainLength()) {
+    fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Padding past the frame");
+    return false;
+  }
+  if (padding > 0) {
+    payload.trimEnd(padding);
+  }
+  return true;
+}
+
+bool HTTP2Codec::readSettings(Context* ctx, HTTP2Frame& frame,
+                              IOBufQueue& payload) {
+  auto length = payload.chainLength();
+  if (frame.streamId != 0) {
+    fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "SETTINGS on a stream");
+    return false;
+  }
+  if (length % 6 != 0 || ((frame.flags & HTTP2Frame::ACK) && length > 0)) {
+    fail(ctx, HTTP2ErrorCode::FRAME_SIZE_ERROR, "Bad SETTINGS frame");
+    return false;
+  }
+  if (length == 0) {
+    return true;
+  }
+  io::Cursor c(payload.front());
+  frame.settingsList.reserve(length / 6);
+  for (size_t i = 0; i < length / 6; i++) {
+    auto id = HTTP2Setting(c.readBE<uint16_t>());
+    auto value = c.readBE<uint32_t>();
+    switch (id) {
+      case HTTP2Setting::HEADER_TABLE_SIZE:
+        encoder_.setPeerMaxTableSize(value);
+        break;
+      case HTTP2Setting::ENABLE_PUSH:
+        if (value > 1) {
+          fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Bad ENABLE_PUSH");
+          return false;
+        }
+        break;
+      case HTTP2Setting::INITIAL_WINDOW_SIZE:
+        if (value > 0x7fffffff) {
+          fail(ctx, HTTP2ErrorCode::FLOW_CONTROL_ERROR,
+               "Bad INITIAL_WINDOW_SIZE");
+          return false;
+        }
+        break;
+      case HTTP2Setting::MAX_FRAME_SIZE:
+        if (value < kDefaultMaxFrameSize || value > kMaxFrameSizeLimit) {
+          fail(ctx, HTTP2ErrorCode::PROTOCOL_ERROR, "Bad MAX_FRAME_SIZE");
+          return false;
+        }
+        peerMaxFrameSize_ = value;
+        break;
+      default:
+        break;
+    }
+    frame.settingsList.emplace_back(id, value);
+  }
+  return true;
+}
+
+bool HTTP2Codec::readHeaderBlock(Context* ctx) {
+  if (headerBlock_.chainLength() > maxHeaderListSize_) {
+    fail(ctx, HTTP2ErrorCode::ENHANCE_YOUR_CALM, "Header block too long");
+    return false;
+  }
+  if (!(headerFlags_ & HTTP2Frame::END_HEADERS)) {
+    // CONTINUATION to come
+    return true;
+  }
+  HTTP2Frame frame(HTTP2Frame::Type::HEADERS,
+                   headerFlags_ & (HTTP2Frame::END_STREAM |
+                                   HTTP2Frame::END_HEADERS),
+                   headerStreamId_);
+  headerStreamId_ = 0;
+  auto block = headerBlock_.move();
+  if (block) {
+    io::Cursor c(block.get());
+    try {
+      decoder_.decode(c, block->computeChainDataLength(), frame.headerBlock);
+    } catch (const HPACKError& e) {
+      fail(ctx, HTTP2ErrorCode::COMPRESSION_ERROR, e.what());
+      return false;
+    }
+  }
+  ctx->fireRead(std::move(frame));
+  return true;
+}
+
+void HTTP2Codec::fail(Context* ctx, HTTP2ErrorCode code,
+                      const std::string& what) {
+  failed_ = true;
+  headerBlock_.move();
+  headerStreamId_ = 0;
+  write(ctx, HTTP2Frame::goaway(lastStreamId_, code));
+  ctx->fireReadException(make_exception_wrapper<HTTP2Error>(code, what));
+}
+
+Future<Unit> HTTP2Codec::write(Context* ctx, HTTP2Frame frame) {
+  typedef HTTP2Frame::Type Type;
+  IOBufQueue out(IOBufQueue::cacheChainLength());
+  if (direction_ == Direction::CLIENT && !prefaceDone_) {
+    prefaceDone_ = true;
+    out.append(kConnectionPreface.data(), kConnectionPreface.size());
+  }
+  uint8_t buf[8];
+  switch (frame.type) {
+    case Type::DATA:
+      appendFrames(out, Type::DATA, frame.flags & HTTP2Frame::END_STREAM,
+                   frame.streamId, std::move(frame.payload));
+      break;
+    case Type::HEADERS:
+      appendFrames(out, Type::HEADERS, frame.flags & HTTP2Frame::END_STREAM,
+                   frame.streamId, encoder_.encode(frame.headerBlock));
+      break;
+    case Type::RST_STREAM:
+      appendFrameHeader(out, 4, frame.type, 0, frame.streamId);
+      putBE32(buf, uint32_t(frame.errorCode));
+      out.append(buf, 4);
+      break;
+    case Type::SETTINGS:
+      appendFrameHeader(out, 6 * frame.settingsList.size(), frame.type,
+                        frame.flags & HTTP2Frame::ACK, 0);
+      for (auto& setting : frame.settingsList) {
+        putBE16(buf, uint16_t(setting.first));
+        putBE32(buf + 2, setting.second);
+        out.append(buf, 6);
+      }
+      break;
+    case Type::PING: {
+      memset(buf, 0, 8);
+      if (frame.payload) {
+        io::Cursor(frame.payload.get()).pull(
+          buf, std::min<size_t>(8, frame.payload->computeChainDataLength()));
+      }
+      appendFrameHeader(out, 8, frame.type, frame.flags & HTTP2Frame::ACK, 0);
+      out.append(buf, 8);
+      break;
+    }
+    case Type::GOAWAY: {
+      auto debug = frame.payload ? frame.payload->computeChainDataLength() : 0;
+      appendFrameHeader(out, 8 + debug, frame.type, 0, 0);
+      putBE32(buf, frame.lastStreamId & 0x7fffffff);
+      putBE32(buf + 4, uint32_t(frame.errorCode));
+      out.append(buf, 8);
+      if (debug > 0) {
+        out.append(std::move(frame.payload));
+      }
+      break;
+    }
+    case Type::WINDOW_UPDATE:
+      appendFrameHeader(out, 4, frame.type, 0, frame.streamId);
+      putBE32(buf, frame.windowIncrement & 0x7fffffff);
+      out.append(buf, 4);
+      break;
+    default:
+      return makeFuture<Unit>(std::invalid_argument(
+        "HTTP2Codec doesn't write frames of this type"));
+  }
+  return ctx->fireWrite(out.move());
+}
+
+void HTTP2Codec::appendFrameHeader(IOBufQueue& out, uint32_t length,
+                                   HTTP2Frame::Type type, uint8_t flags,
+                                   uint32_t streamId) {
+  uint8_t header[kFrameHeaderSize];
+  header[0] = length >> 16;
+  putBE16(header + 1, length);
+  header[3] = uint8_t(type);
+  header[4] = flags;
+  putBE32(header + 5, streamId & 0x7fffffff);
+  out.append(header, kFrameHeaderSize);
+}
+
+void HTTP2Codec::appendFrames(IOBufQueue& out, HTTP2Frame::Type type,
+                              uint8_t flags, uint32_t streamId,
+                              std::unique_ptr<IOBuf> buf) {
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(std::move(buf));
+  bool first = true;
+  do {
+    auto n = std::min<size_t>(q.chainLength(), peerMaxFrameSize_);
+    bool last = n == q.chainLength();
+    auto frameType = type;
+    uint8_t frameFlags;
+    if (type == HTTP2Frame::Type::HEADERS) {
+      // END_STREAM on the HEADERS, END_HEADERS on the last CONTINUATION
+      frameType = first ? type : HTTP2Frame::Type::CONTINUATION;
+      frameFlags = (first ? flags : 0) |
+        (last ? HTTP2Frame::END_HEADERS : 0);
+    } else {
+      frameFlags = last ? flags : 0;
+    }
+    appendFrameHeader(out, n, frameType, frameFlags, streamId);
+    if (n > 0) {
+      out.append(q.split(n));
+    }
+    first = false;
+  } while (!q.empty());
+}
+
+}} // namespace
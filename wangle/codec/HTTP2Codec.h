@@ -0,0 +1,226 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+#include <wangle/codec/HPACK.h>
+
+#include <utility>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+enum class HTTP2ErrorCode : uint32_t {
+  NO_ERROR = 0x0,
+  PROTOCOL_ERROR = 0x1,
+  INTERNAL_ERROR = 0x2,
+  FLOW_CONTROL_ERROR = 0x3,
+  SETTINGS_TIMEOUT = 0x4,
+  STREAM_CLOSED = 0x5,
+  FRAME_SIZE_ERROR = 0x6,
+  REFUSED_STREAM = 0x7,
+  CANCEL = 0x8,
+  COMPRESSION_ERROR = 0x9,
+  CONNECT_ERROR = 0xa,
+  ENHANCE_YOUR_CALM = 0xb,
+  INADEQUATE_SECURITY = 0xc,
+  HTTP_1_1_REQUIRED = 0xd,
+};
+
+enum class HTTP2Setting : uint16_t {
+  HEADER_TABLE_SIZE = 0x1,
+  ENABLE_PUSH = 0x2,
+  MAX_CONCURRENT_STREAMS = 0x3,
+  INITIAL_WINDOW_SIZE = 0x4,
+  MAX_FRAME_SIZE = 0x5,
+  MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+/**
+ * An HTTP/2 connection error: the connection is done for, with a GOAWAY
+ * carrying code sent on it already when it's the peer's doing.
+ */
+class HTTP2Error : public std::runtime_error {
+ public:
+  HTTP2Error(HTTP2ErrorCode code, const std::string& what)
+      : std::runtime_error(what), code_(code) {}
+
+  HTTP2ErrorCode getCode() const {
+    return code_;
+  }
+
+ private:
+  HTTP2ErrorCode code_;
+};
+
+/**
+ * An HTTP/2 frame, as read and written by HTTP2Codec.  Header blocks come
+ * decoded, with any CONTINUATION frames folded into their HEADERS frame,
+ * and padding and priority are gone.
+ */
+struct HTTP2Frame {
+  enum class Type : uint8_t {
+    DATA = 0x0,
+    HEADERS = 0x1,
+    PRIORITY = 0x2,
+    RST_STREAM = 0x3,
+    SETTINGS = 0x4,
+    PUSH_PROMISE = 0x5,
+    PING = 0x6,
+    GOAWAY = 0x7,
+    WINDOW_UPDATE = 0x8,
+    CONTINUATION = 0x9,
+  };
+
+  // Flags
+  static const uint8_t END_STREAM = 0x1;
+  static const uint8_t ACK = 0x1;
+  static const uint8_t END_HEADERS = 0x4;
+  static const uint8_t PADDED = 0x8;
+  static const uint8_t PRIORITY_FLAG = 0x20;
+
+  typedef std::vector<std::pair<HTTP2Setting, uint32_t>> Settings;
+
+  static HTTP2Frame data(uint32_t streamId, std::unique_ptr<IOBuf> buf,
+                         bool endStream);
+  static HTTP2Frame headers(uint32_t streamId, HTTP2Headers headers,
+                            bool endStream);
+  static HTTP2Frame rstStream(uint32_t streamId, HTTP2ErrorCode code);
+  static HTTP2Frame settings(Settings settings);
+  static HTTP2Frame settingsAck();
+  // payload's first 8 bytes
+  static HTTP2Frame ping(std::unique_ptr<IOBuf> payload, bool ack);
+  static HTTP2Frame goaway(uint32_t lastStreamId, HTTP2ErrorCode code);
+  static HTTP2Frame windowUpdate(uint32_t streamId, uint32_t increment);
+
+  HTTP2Frame() = default;
+  HTTP2Frame(Type t, uint8_t f, uint32_t id)
+      : type(t), flags(f), streamId(id) {}
+
+  bool endStream() const {
+    return (type == Type::DATA || type == Type::HEADERS) &&
+      (flags & END_STREAM);
+  }
+
+  Type type{Type::DATA};
+  uint8_t flags{0};
+  uint32_t streamId{0};
+  // DATA, with what counts against flow control, padding included;
+  // PING's 8 bytes; GOAWAY's debug data
+  std::unique_ptr<IOBuf> payload;
+  uint32_t flowControlLength{0};
+  // HEADERS
+  HTTP2Headers headerBlock;
+  // SETTINGS
+  Settings settingsList;
+  // RST_STREAM and GOAWAY
+  HTTP2ErrorCode errorCode{HTTP2ErrorCode::NO_ERROR};
+  // GOAWAY
+  uint32_t lastStreamId{0};
+  // WINDOW_UPDATE
+  uint32_t windowIncrement{0};
+};
+
+/**
+ * Decodes the bytes of an HTTP/2 connection into HTTP2Frames, and encodes
+ * those written, HPACK included.
+ *
+ * Frames are split off the buffers they were read into, without copying
+ * or coalescing them, and header blocks, however they're split across
+ * frames and buffers, are decoded as they are.  On the way out, DATA and
+ * header blocks are split into frames of the peer's SETTINGS_MAX_FRAME_SIZE,
+ * which the codec picks up as the peer's SETTINGS go by, along with its
+ * SETTINGS_HEADER_TABLE_SIZE; acking them is up to the handler above it,
+ * like HTTP2StreamHandler.  The server takes the client's connection
+ * preface off the front, and the client puts it ahead of its first frame.
+ *
+ * A connection error writes a GOAWAY and fails with an HTTP2Error read
+ * exception, after which everything read is dropped.  Frames of unknown
+ * types, and PRIORITY frames, are dropped; PUSH_PROMISE is refused, as
+ * the client end never enables push.
+ */
+class HTTP2Codec : public Handler<IOBufQueue&, HTTP2Frame,
+                                  HTTP2Frame, std::unique_ptr<IOBuf>> {
+ public:
+  typedef typename Handler<
+   IOBufQueue&, HTTP2Frame,
+   HTTP2Frame, std::unique_ptr<IOBuf>>::Context Context;
+
+  enum class Direction {
+    SERVER,
+    CLIENT,
+  };
+
+  static const uint32_t kDefaultMaxFrameSize = 16384;
+  static const StringPiece kConnectionPreface;
+
+  /**
+   * maxFrameSize, headerTableSize and maxHeaderListSize are what we take,
+   * so ought to be what the SETTINGS we send advertise; the defaults are
+   * the protocol's, save for the header list, which it leaves unbounded.
+   */
+  explicit HTTP2Codec(
+      Direction direction,
+      uint32_t maxFrameSize = kDefaultMaxFrameSize,
+      uint32_t headerTableSize = HPACKDecoder::kDefaultTableSize,
+      size_t maxHeaderListSize = 64 * 1024)
+      : direction_(direction),
+        maxFrameSize_(maxFrameSize),
+        maxHeaderListSize_(maxHeaderListSize),
+        decoder_(headerTableSize, maxHeaderListSize) {}
+
+  void read(Context* ctx, IOBufQueue& q) override;
+
+  Future<Unit> write(Context* ctx, HTTP2Frame frame) override;
+
+ private:
+  static const size_t kFrameHeaderSize = 9;
+  // Per header block, however small they are
+  static const uint32_t kMaxContinuations = 128;
+
+  // Returns false on a connection error
+  bool readFrame(Context* ctx, HTTP2Frame::Type type, uint8_t flags,
+                 uint32_t streamId, uint32_t length,
+                 std::unique_ptr<IOBuf> payload);
+  // Takes the padding, and for HEADERS the priority, out of payload
+  bool stripPadding(Context* ctx, HTTP2Frame::Type type, uint8_t flags,
+                    IOBufQueue& payload);
+  bool readSettings(Context* ctx, HTTP2Frame& frame, IOBufQueue& payload);
+  bool readHeaderBlock(Context* ctx);
+
+  void appendFrameHeader(IOBufQueue& out, uint32_t length,
+                         HTTP2Frame::Type type, uint8_t flags,
+                         uint32_t streamId);
+  // Splits buf into frames of type, then CONTINUATION for header blocks
+  void appendFrames(IOBufQueue& out, HTTP2Frame::Type type, uint8_t flags,
+                    uint32_t streamId, std::unique_ptr<IOBuf> buf);
+  void fail(Context* ctx, HTTP2ErrorCode code, const std::string& what);
+
+  const Direction direction_;
+  const uint32_t maxFrameSize_;
+  const size_t maxHeaderListSize_;
+  uint32_t peerMaxFrameSize_{kDefaultMaxFrameSize};
+  bool prefaceDone_{false};
+  bool failed_{false};
+  // Highest stream a frame was read on, for GOAWAY
+  uint32_t lastStreamId_{0};
+
+  HPACKDecoder decoder_;
+  HPACKEncoder encoder_;
+
+  // A header block waiting for its CONTINUATION frames
+  IOBufQueue headerBlock_{IOBufQueue::cacheChainLength()};
+  uint32_t headerStreamId_{0};
+  uint8_t headerFlags_{0};
+  uint32_t continuations_{0};
+};
+
+}} // namespace
@@ -0,0 +1,358 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/HTTP2StreamHandler.h>
+
+#include <algorithm>
+#include <tuple>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+const int64_t kMaxWindow = 0x7fffffff;
+
+}
+
+void HTTP2StreamHandler::transportActive(Context* ctx) {
+  // Our SETTINGS go first, the client's after its connection preface
+  HTTP2Frame::Settings settings;
+  if (direction_ == Direction::SERVER) {
+    settings.emplace_back(HTTP2Setting::MAX_CONCURRENT_STREAMS,
+                          maxConcurrentStreams_);
+  } else {
+    settings.emplace_back(HTTP2Setting::ENABLE_PUSH, 0);
+  }
+  settings.emplace_back(HTTP2Setting::INITIAL_WINDOW_SIZE, receiveWindow_);
+  ctx->fireWrite(HTTP2Frame::settings(std::move(settings)));
+  if (receiveWindow_ > kDefaultWindow) {
+    // The connection's window isn't a setting
+    ctx->fireWrite(
+      HTTP2Frame::windowUpdate(0, receiveWindow_ - kDefaultWindow));
+  }
+  ctx->fireTransportActive();
+}
+
+void HTTP2StreamHandler::read(Context* ctx, HTTP2Frame frame) {
+  typedef HTTP2Frame::Type Type;
+  switch (frame.type) {
+    case Type::HEADERS:
+      readHeaders(ctx, frame);
+      break;
+    case Type::DATA:
+      readData(ctx, frame);
+      break;
+    case Type::SETTINGS:
+      if (!(frame.flags & HTTP2Frame::ACK)) {
+        readSettings(ctx, frame);
+      }
+      break;
+    case Type::PING:
+      if (!(frame.flags & HTTP2Frame::ACK)) {
+        ctx->fireWrite(HTTP2Frame::ping(std::move(frame.payload), true));
+      }
+      break;
+    case Type::WINDOW_UPDATE: {
+      if (frame.streamId == 0) {
+        connectionWindow_ += frame.windowIncrement;
+        if (connectionWindow_ > kMaxWindow) {
+          connectionError(ctx, HTTP2ErrorCode::FLOW_CONTROL_ERROR,
+                          "Connection window past 2^31-1");
+          return;
+        }
+        flushAll(ctx);
+        break;
+      }
+      auto it = streams_.find(frame.streamId);
+      if (it == streams_.end()) {
+        break;
+      }
+      it->second.window += frame.windowIncrement;
+      if (it->second.window > kMaxWindow) {
+        resetStream(ctx, frame.streamId, HTTP2ErrorCode::FLOW_CONTROL_ERROR);
+        break;
+      }
+      flush(ctx, it);
+      break;
+    }
+    case Type::RST_STREAM: {
+      auto it = streams_.find(frame.streamId);
+      if (it != streams_.end()) {
+        if (it->second.promise) {
+          it->second.promise->setException(
+            HTTP2Error(frame.errorCode, "Stream reset by the peer"));
+        }
+        streams_.erase(it);
+      }
+      break;
+    }
+    case Type::GOAWAY:
+      readEOF(ctx);
+      break;
+    default:
+      break;
+  }
+}
+
+void HTTP2StreamHandler::readHeaders(Context* ctx, HTTP2Frame& frame) {
+  auto id = frame.streamId;
+  auto it = streams_.find(id);
+  if (it == streams_.end()) {
+    if (direction_ == Direction::CLIENT) {
+      // Timed out and forgotten, most likely
+      resetStream(ctx, id, HTTP2ErrorCode::STREAM_CLOSED);
+      return;
+    }
+    if (id % 2 == 0) {
+      connectionError(ctx, HTTP2ErrorCode::PROTOCOL_ERROR,
+                      "Client opened an even stream");
+      return;
+    }
+    if (id <= lastPeerStreamId_) {
+      resetStream(ctx, id, HTTP2ErrorCode::STREAM_CLOSED);
+      return;
+    }
+    lastPeerStreamId_ = id;
+    if (streams_.size() >= maxConcurrentStreams_) {
+      resetStream(ctx, id, HTTP2ErrorCode::REFUSED_STREAM);
+      return;
+    }
+    it = streams_.emplace(std::piecewise_construct,
+                          std::forward_as_tuple(id),
+                          std::forward_as_tuple()).first;
+    it->second.message.streamId = id;
+    it->second.window = peerInitialWindow_;
+  }
+
+  auto& stream = it->second;
+  if (stream.readDone) {
+    resetStream(ctx, id, HTTP2ErrorCode::STREAM_CLOSED);
+    return;
+  }
+  if (!stream.headersRead) {
+    StringPiece status;
+    if (direction_ == Direction::CLIENT && !frame.endStream() &&
+        frame.headerBlock.get(":status", &status) &&
+        status.size() == 3 && status[0] == '1') {
+      // Informational, ahead of the response proper
+      return;
+    }
+    stream.message.headers = std::move(frame.headerBlock);
+    stream.headersRead = true;
+  } else {
+    // Trailers, which end the stream
+    if (!frame.endStream()) {
+      resetStream(ctx, id, HTTP2ErrorCode::PROTOCOL_ERROR);
+      return;
+    }
+    auto& trailers = frame.headerBlock;
+    for (size_t i = 0; i < trailers.size(); i++) {
+      stream.message.headers.add(trailers.getName(i), trailers.getValue(i));
+    }
+  }
+  if (frame.endStream()) {
+    finishRead(ctx, it);
+  }
+}
+
+void HTTP2StreamHandler::readData(Context* ctx, HTTP2Frame& frame) {
+  auto id = frame.streamId;
+  auto length = frame.flowControlLength;
+  // The connection's window, whatever becomes of the stream
+  connectionUnacked_ += length;
+  if (connectionUnacked_ >= receiveWindow_ / 2) {
+    ctx->fireWrite(HTTP2Frame::windowUpdate(0, connectionUnacked_));
+    connectionUnacked_ = 0;
+  }
+
+  auto it = streams_.find(id);
+  if (it == streams_.end() || !it->second.headersRead ||
+      it->second.readDone) {
+    resetStream(ctx, id, HTTP2ErrorCode::STREAM_CLOSED);
+    return;
+  }
+  auto& stream = it->second;
+  if (stream.body.chainLength() + frame.payload->computeChainDataLength() >
+      maxBodySize_) {
+    resetStream(ctx, id, HTTP2ErrorCode::CANCEL);
+    return;
+  }
+  stream.body.append(std::move(frame.payload));
+  if (frame.endStream()) {
+    finishRead(ctx, it);
+    return;
+  }
+  stream.unacked += length;
+  if (stream.unacked >= receiveWindow_ / 2) {
+    ctx->fireWrite(HTTP2Frame::windowUpdate(id, stream.unacked));
+    stream.unacked = 0;
+  }
+}
+
+void HTTP2StreamHandler::readSettings(Context* ctx, HTTP2Frame& frame) {
+  for (auto& setting : frame.settingsList) {
+    if (setting.first == HTTP2Setting::INITIAL_WINDOW_SIZE) {
+      // Which moves the windows of the streams open already
+      int64_t delta = int64_t(setting.second) - peerInitialWindow_;
+      peerInitialWindow_ = setting.second;
+      for (auto& entry : streams_) {
+        entry.second.window += delta;
+      }
+    }
+  }
+  ctx->fireWrite(HTTP2Frame::settingsAck());
+  flushAll(ctx);
+}
+
+void HTTP2StreamHandler::finishRead(Context* ctx, StreamMap::iterator it) {
+  auto& stream = it->second;
+  stream.readDone = true;
+  stream.message.body = stream.body.move();
+  auto msg = std::move(stream.message);
+  // A server's stream lives on for the response
+  eraseIfDone(it);
+  ctx->fireRead(std::move(msg));
+}
+
+Future<Unit> HTTP2StreamHandler::write(Context* ctx, HTTP2Message msg) {
+  auto id = msg.streamId;
+  StreamMap::iterator it;
+  if (direction_ == Direction::CLIENT) {
+    if (id == 0) {
+      id = lastStreamId_ + (lastStreamId_ ? 2 : 1);
+    }
+    if (id % 2 == 0 || id <= lastStreamId_) {
+      return makeFuture<Unit>(std::invalid_argument(
+        "Client stream IDs have to be odd, and go up"));
+    }
+    lastStreamId_ = id;
+    it = streams_.emplace(std::piecewise_construct,
+                          std::forward_as_tuple(id),
+                          std::forward_as_tuple()).first;
+    it->second.message.streamId = id;
+    it->second.window = peerInitialWindow_;
+  } else {
+    it = streams_.find(id);
+    if (it == streams_.end() || it->second.writeDone) {
+      return makeFuture<Unit>(std::invalid_argument(
+        "No request on the stream to respond to"));
+    }
+  }
+
+  auto& stream = it->second;
+  bool hasBody = msg.body && !msg.body->empty();
+  auto f = ctx->fireWrite(
+    HTTP2Frame::headers(id, std::move(msg.headers), !hasBody));
+  if (!hasBody) {
+    stream.writeDone = true;
+    eraseIfDone(it);
+    return f;
+  }
+  stream.pending.append(std::move(msg.body));
+  stream.promise = std::make_shared<Promise<Unit>>();
+  auto done = stream.promise->getFuture();
+  flush(ctx, it);
+  return done;
+}
+
+void HTTP2StreamHandler::flush(Context* ctx, StreamMap::iterator it) {
+  auto& stream = it->second;
+  while (!stream.pending.empty() && stream.window > 0 &&
+         connectionWindow_ > 0) {
+    auto n = std::min<int64_t>(stream.pending.chainLength(),
+                               std::min(stream.window, connectionWindow_));
+    bool last = uint64_t(n) == stream.pending.chainLength();
+    stream.window -= n;
+    connectionWindow_ -= n;
+    auto f = ctx->fireWrite(
+      HTTP2Frame::data(it->first, stream.pending.split(n), last));
+    if (last) {
+      auto promise = std::move(stream.promise);
+      f.then([promise] (Try<Unit>&& t) {
+        promise->setTry(std::move(t));
+      });
+      stream.writeDone = true;
+      eraseIfDone(it);
+      return;
+    }
+  }
+}
+
+void HTTP2StreamHandler::flushAll(Context* ctx) {
+  for (auto it = streams_.begin();
+       it != streams_.end() && connectionWindow_ > 0; ) {
+    // flush() may erase it
+    auto next = std::next(it);
+    if (!it->second.pending.empty()) {
+      flush(ctx, it);
+    }
+    it = next;
+  }
+}
+
+void HTTP2StreamHandler::resetStream(Context* ctx, uint32_t streamId,
+                                     HTTP2ErrorCode code) {
+  ctx->fireWrite(HTTP2Frame::rstStream(streamId, code));
+  auto it = streams_.find(streamId);
+  if (it != streams_.end()) {
+    if (it->second.promise) {
+      it->second.promise->setException(HTTP2Error(code, "Stream reset"));
+    }
+    streams_.erase(it);
+  }
+}
+
+void HTTP2StreamHandler::eraseIfDone(StreamMap::iterator it) {
+  if (it->second.readDone && it->second.writeDone) {
+    streams_.erase(it);
+  }
+}
+
+void HTTP2StreamHandler::connectionError(Context* ctx, HTTP2ErrorCode code,
+                                         const std::string& what) {
+  ctx->fireWrite(HTTP2Frame::goaway(lastPeerStreamId_, code));
+  auto e = make_exception_wrapper<HTTP2Error>(code, what);
+  failAll(e);
+  ctx->fireReadException(std::move(e));
+}
+
+void HTTP2StreamHandler::failAll(const exception_wrapper& e) {
+  auto streams = std::move(streams_);
+  streams_.clear();
+  for (auto& entry : streams) {
+    if (entry.second.promise) {
+      entry.second.promise->setException(e);
+    }
+  }
+}
+
+void HTTP2StreamHandler::readEOF(Context* ctx) {
+  failAll(make_exception_wrapper<std::runtime_error>("Connection closed"));
+  ctx->fireReadEOF();
+}
+
+void HTTP2StreamHandler::readException(Context* ctx, exception_wrapper e) {
+  failAll(e);
+  ctx->fireReadException(std::move(e));
+}
+
+void HTTP2StreamHandler::transportInactive(Context* ctx) {
+  failAll(make_exception_wrapper<std::runtime_error>("Connection closed"));
+  ctx->fireTransportInactive();
+}
+
+Future<Unit> HTTP2StreamHandler::close(Context* ctx) {
+  ctx->fireWrite(HTTP2Frame::goaway(lastPeerStreamId_,
+                                    HTTP2ErrorCode::NO_ERROR));
+  failAll(make_exception_wrapper<std::runtime_error>("Connection closed"));
+  return ctx->fireClose();
+}
+
+}} // namespace
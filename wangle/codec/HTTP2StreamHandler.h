@@ -0,0 +1,143 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/codec/HTTP2Codec.h>
+
+#include <folly/futures/Promise.h>
+
+#include <map>
+#include <memory>
+
+namespace folly { namespace wangle {
+
+/**
+ * A whole HTTP/2 request or response: the stream it's on, its headers,
+ * pseudo-headers like :method and :status first, and its body, if any.
+ */
+struct HTTP2Message {
+  uint32_t streamId{0};
+  HTTP2Headers headers;
+  std::unique_ptr<IOBuf> body;
+};
+
+/**
+ * The streams of an HTTP/2 connection, over HTTP2Codec: reads the frames
+ * of each stream into an HTTP2Message, and writes those written as frames,
+ * so the messages can go to a MultiplexServerDispatcher, or come from a
+ * MultiplexClientDispatcher, keyed by stream ID:
+ *
+ *   pipeline->addBack(AsyncSocketHandler(sock));
+ *   pipeline->addBack(HTTP2Codec(HTTP2Codec::Direction::SERVER));
+ *   pipeline->addBack(HTTP2StreamHandler(HTTP2Codec::Direction::SERVER));
+ *   pipeline->addBack(MultiplexServerDispatcher<HTTP2Message>(&service));
+ *
+ * The service puts the request's streamId in its response.  Clients pick
+ * a new odd stream ID, above the last, for each request; one written with
+ * a streamId of 0 gets the next one.
+ *
+ * The handler does the connection-level work: SETTINGS, and acking the
+ * peer's, PING replies, and flow control both ways.  Bodies are written
+ * as the peer's windows allow, the write completing when the last of it
+ * goes out; what's read is acked as it comes, since it's held here until
+ * the message is whole, up to maxBodySize.  A server refuses streams past
+ * maxConcurrentStreams.  Streams reset by the peer, and responses only
+ * partly read, are dropped; GOAWAY ends the connection as its EOF does.
+ */
+class HTTP2StreamHandler : public Handler<HTTP2Frame, HTTP2Message,
+                                          HTTP2Message, HTTP2Frame> {
+ public:
+  typedef typename Handler<
+   HTTP2Frame, HTTP2Message,
+   HTTP2Message, HTTP2Frame>::Context Context;
+
+  typedef HTTP2Codec::Direction Direction;
+
+  static const uint32_t kDefaultWindow = 65535;
+
+  /**
+   * receiveWindow is what each stream, and the connection as a whole,
+   * may have in flight to us; more than the protocol's default helps
+   * uploads over long round trips.
+   */
+  explicit HTTP2StreamHandler(
+      Direction direction,
+      uint32_t maxConcurrentStreams = 100,
+      size_t maxBodySize = 16 * 1024 * 1024,
+      uint32_t receiveWindow = 1024 * 1024)
+      : direction_(direction),
+        maxConcurrentStreams_(maxConcurrentStreams),
+        maxBodySize_(maxBodySize),
+        receiveWindow_(receiveWindow) {}
+
+  void transportActive(Context* ctx) override;
+  void read(Context* ctx, HTTP2Frame frame) override;
+  void readEOF(Context* ctx) override;
+  void readException(Context* ctx, exception_wrapper e) override;
+  void transportInactive(Context* ctx) override;
+
+  Future<Unit> write(Context* ctx, HTTP2Message msg) override;
+  Future<Unit> close(Context* ctx) override;
+
+  size_t getNumStreams() const {
+    return streams_.size();
+  }
+
+ private:
+  struct Stream {
+    // Being read
+    HTTP2Message message;
+    IOBufQueue body{IOBufQueue::cacheChainLength()};
+    bool headersRead{false};
+    bool readDone{false};
+    uint32_t unacked{0};
+
+    // Being written
+    IOBufQueue pending{IOBufQueue::cacheChainLength()};
+    int64_t window{0};
+    std::shared_ptr<Promise<Unit>> promise;
+    bool writeDone{false};
+  };
+  typedef std::map<uint32_t, Stream> StreamMap;
+
+  void readHeaders(Context* ctx, HTTP2Frame& frame);
+  void readData(Context* ctx, HTTP2Frame& frame);
+  void readSettings(Context* ctx, HTTP2Frame& frame);
+  // Whole messages, up the pipeline
+  void finishRead(Context* ctx, StreamMap::iterator it);
+
+  // Writes what the windows let through, of one stream or all of them
+  void flush(Context* ctx, StreamMap::iterator it);
+  void flushAll(Context* ctx);
+  void resetStream(Context* ctx, uint32_t streamId, HTTP2ErrorCode code);
+  void eraseIfDone(StreamMap::iterator it);
+  void connectionError(Context* ctx, HTTP2ErrorCode code,
+                       const std::string& what);
+  void failAll(const exception_wrapper& e);
+
+  const Direction direction_;
+  const uint32_t maxConcurrentStreams_;
+  const size_t maxBodySize_;
+  const uint32_t receiveWindow_;
+
+  StreamMap streams_;
+  // Highest stream the peer opened, or we did
+  uint32_t lastPeerStreamId_{0};
+  uint32_t lastStreamId_{0};
+
+  // Flow control of what we send, per the peer's settings and updates
+  int64_t connectionWindow_{kDefaultWindow};
+  uint32_t peerInitialWindow_{kDefaultWindow};
+  // Of what we've read, not yet acked
+  uint32_t connectionUnacked_{0};
+};
+
+}} // namespace
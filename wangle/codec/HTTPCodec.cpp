@@ -0,0 +1,551 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/HTTPCodec.h>
+
+#include <folly/Conv.h>
+#include <folly/String.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+// Longest chunk size line we put up with, extensions included
+const size_t kMaxChunkLineLength = 1024;
+
+bool equalsIgnoreCase(StringPiece a, StringPiece b) {
+  return a.size() == b.size() &&
+    strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+StringPiece trimWhitespace(StringPiece s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+    s.pop_front();
+  }
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+    s.pop_back();
+  }
+  return s;
+}
+
+// The next line of s, without its "\r\n" or "\n"
+StringPiece nextLine(StringPiece& s) {
+  auto end = s.find('\n');
+  StringPiece line;
+  if (end == StringPiece::npos) {
+    line = s;
+    s.clear();
+  } else {
+    line = s.subpiece(0, end);
+    s.advance(end + 1);
+  }
+  if (!line.empty() && line.back() == '\r') {
+    line.pop_back();
+  }
+  return line;
+}
+
+void parseVersion(StringPiece version, HTTPMessage& msg) {
+  if (!version.removePrefix("HTTP/") || version.size() != 3 ||
+      version[1] != '.' || !isdigit(version[0]) || !isdigit(version[2])) {
+    throw HTTPParseError("Bad HTTP version");
+  }
+  msg.versionMajor = version[0] - '0';
+  msg.versionMinor = version[2] - '0';
+}
+
+// Gathers a line, or a header block, that may span several buffers
+std::unique_ptr<IOBuf> splitCoalesced(IOBufQueue& q, size_t length) {
+  auto buf = q.split(length);
+  if (buf->isChained()) {
+    buf->coalesce();
+  }
+  return buf;
+}
+
+StringPiece toStringPiece(const IOBuf& buf) {
+  return StringPiece(reinterpret_cast<const char*>(buf.data()),
+                     buf.length());
+}
+
+}
+
+const std::string* HTTPMessage::getHeader(StringPiece name) const {
+  for (auto& header : headers) {
+    if (equalsIgnoreCase(header.first, name)) {
+      return &header.second;
+    }
+  }
+  return nullptr;
+}
+
+void HTTPCodec::read(Context* ctx, IOBufQueue& q) {
+  bool more = true;
+  while (more && state_ != State::ERROR && q.chainLength() > 0) {
+    switch (state_) {
+      case State::HEADERS:
+        more = parseHeaders(ctx, q);
+        break;
+      case State::BODY:
+      case State::BODY_TO_EOF:
+      case State::CHUNK_DATA:
+        more = parseBody(ctx, q);
+        break;
+      case State::CHUNK_SIZE:
+        more = parseChunkSize(ctx, q);
+        break;
+      case State::CHUNK_DATA_END:
+      case State::TRAILERS: {
+        auto end = findLineEnd(q);
+        if (end == 0) {
+          if (q.chainLength() > kMaxChunkLineLength) {
+            fail(ctx, "Chunk trailer too long");
+          }
+          more = false;
+          break;
+        }
+        auto line = splitCoalesced(q, end);
+        auto blank = toStringPiece(*line) == "\r\n" ||
+          toStringPiece(*line) == "\n";
+        if (state_ == State::CHUNK_DATA_END) {
+          if (!blank) {
+            fail(ctx, "Missing CRLF after chunk");
+          } else {
+            state_ = State::CHUNK_SIZE;
+          }
+        } else if (blank) {
+          // Trailer headers are dropped
+          endMessage(ctx);
+        }
+        break;
+      }
+      case State::ERROR:
+        break;
+    }
+  }
+  if (state_ == State::ERROR) {
+    q.move();
+  }
+}
+
+void HTTPCodec::readEOF(Context* ctx) {
+  if (state_ == State::BODY_TO_EOF) {
+    endMessage(ctx);
+  } else if (state_ != State::ERROR &&
+             (state_ != State::HEADERS || scanned_ > 0)) {
+    fail(ctx, "Connection closed in the middle of a message");
+  }
+  ctx->fireReadEOF();
+}
+
+size_t HTTPCodec::findHeaderEnd(IOBufQueue& q) {
+  size_t offset = 0;
+  auto front = q.front();
+  auto buf = front;
+  do {
+    auto data = reinterpret_cast<const char*>(buf->data());
+    size_t len = buf->length();
+    if (offset + len > scanned_) {
+      size_t start = scanned_ - offset;
+      while (start < len) {
+        auto nl = static_cast<const char*>(
+          memchr(data + start, '\n', len - start));
+        if (!nl) {
+          lineLength_ += len - start;
+          break;
+        }
+        size_t pos = nl - data;
+        lineLength_ += pos - start;
+        char before = pos > 0 ? data[pos - 1] : lastByte_;
+        bool blank = lineLength_ == 0 ||
+          (lineLength_ == 1 && before == '\r');
+        lineLength_ = 0;
+        start = pos + 1;
+        if (blank && !firstLine_) {
+          scanned_ = 0;
+          lastByte_ = 0;
+          firstLine_ = true;
+          return offset + start;
+        }
+        // Blank lines before the start line are skipped in parsing
+        if (!blank) {
+          firstLine_ = false;
+        }
+      }
+      if (len > 0) {
+        lastByte_ = data[len - 1];
+      }
+      scanned_ = offset + len;
+    }
+    offset += len;
+    buf = buf->next();
+  } while (buf != front);
+  return 0;
+}
+
+size_t HTTPCodec::findLineEnd(IOBufQueue& q) {
+  size_t offset = 0;
+  auto front = q.front();
+  auto buf = front;
+  do {
+    auto data = buf->data();
+    auto nl = static_cast<const uint8_t*>(memchr(data, '\n', buf->length()));
+    if (nl) {
+      return offset + (nl - data) + 1;
+    }
+    offset += buf->length();
+    buf = buf->next();
+  } while (buf != front && offset <= kMaxChunkLineLength);
+  return 0;
+}
+
+bool HTTPCodec::parseHeaders(Context* ctx, IOBufQueue& q) {
+  auto end = findHeaderEnd(q);
+  if (end == 0 || end > maxHeaderSize_) {
+    if (end > 0 || scanned_ > maxHeaderSize_) {
+      fail(ctx, "Header block too large");
+    }
+    return false;
+  }
+
+  auto block = splitCoalesced(q, end);
+  HTTPMessage msg;
+  try {
+    parseMessage(toStringPiece(*block), msg);
+  } catch (const std::exception& e) {
+    fail(ctx, e.what());
+    return false;
+  }
+
+  // Responses to HEAD requests, which have no body whatever their
+  // headers say, aren't told apart
+  bool noBody = !msg.isRequest && (msg.statusCode / 100 == 1 ||
+                                   msg.statusCode == 204 ||
+                                   msg.statusCode == 304);
+  if (!noBody) {
+    if (msg.chunked) {
+      state_ = State::CHUNK_SIZE;
+    } else if (msg.contentLength > 0) {
+      state_ = State::BODY;
+      remaining_ = msg.contentLength;
+    } else if (msg.contentLength == 0 || msg.isRequest) {
+      noBody = true;
+    } else {
+      state_ = State::BODY_TO_EOF;
+    }
+  }
+
+  ctx->fireRead(HTTPPart::headers(std::move(msg)));
+  if (noBody) {
+    endMessage(ctx);
+  }
+  return true;
+}
+
+void HTTPCodec::parseMessage(StringPiece block, HTTPMessage& msg) {
+  StringPiece line;
+  do {
+    if (block.empty()) {
+      throw HTTPParseError("No start line");
+    }
+    line = nextLine(block);
+  } while (line.empty());
+
+  // Split on the first two spaces only, as the reason phrase may have
+  // spaces of its own
+  auto sp1 = line.find(' ');
+  if (sp1 == StringPiece::npos) {
+    throw HTTPParseError("Bad start line");
+  }
+  auto first = line.subpiece(0, sp1);
+  auto rest = line.subpiece(sp1 + 1);
+  auto sp2 = rest.find(' ');
+  StringPiece second = rest;
+  StringPiece third;
+  if (sp2 != StringPiece::npos) {
+    second = rest.subpiece(0, sp2);
+    third = rest.subpiece(sp2 + 1);
+  }
+
+  if (first.startsWith("HTTP/")) {
+    if (direction_ == Direction::SERVER) {
+      throw HTTPParseError("Expected a request");
+    }
+    msg.isRequest = false;
+    parseVersion(first, msg);
+    if (second.size() != 3) {
+      throw HTTPParseError("Bad status code");
+    }
+    msg.statusCode = folly::to<uint16_t>(second);
+    msg.reason = third.str();
+  } else {
+    if (direction_ == Direction::CLIENT) {
+      throw HTTPParseError("Expected a response");
+    }
+    if (first.empty() || second.empty() || third.empty()) {
+      throw HTTPParseError("Bad request line");
+    }
+    msg.isRequest = true;
+    msg.method = first.str();
+    msg.url = second.str();
+    parseVersion(third, msg);
+  }
+
+  bool sawContentLength = false;
+  bool sawTransferEncoding = false;
+  while (!block.empty()) {
+    line = nextLine(block);
+    if (line.empty()) {
+      break;
+    }
+    if (line.front() == ' ' || line.front() == '\t') {
+      // Folded onto the previous header's value
+      if (msg.headers.empty()) {
+        throw HTTPParseError("Continuation line without a header");
+      }
+      auto folded = trimWhitespace(line);
+      msg.headers.back().second.push_back(' ');
+      msg.headers.back().second.append(folded.data(), folded.size());
+      continue;
+    }
+    auto colon = line.find(':');
+    if (colon == StringPiece::npos || colon == 0) {
+      throw HTTPParseError("Bad header line");
+    }
+    auto name = line.subpiece(0, colon);
+    auto value = trimWhitespace(line.subpiece(colon + 1));
+    if (equalsIgnoreCase(name, "Content-Length")) {
+      // Peers that take the first and the last would disagree on where
+      // the message ends
+      if (sawContentLength) {
+        throw HTTPParseError("Duplicate Content-Length");
+      }
+      sawContentLength = true;
+      try {
+        msg.contentLength = folly::to<int64_t>(value);
+      } catch (const std::exception&) {
+        throw HTTPParseError("Bad Content-Length");
+      }
+      if (msg.contentLength < 0) {
+        throw HTTPParseError("Bad Content-Length");
+      }
+    } else if (equalsIgnoreCase(name, "Transfer-Encoding")) {
+      // Chunked only as the last coding
+      auto last = value.rfind(',');
+      auto coding = trimWhitespace(
+        last == StringPiece::npos ? value : value.subpiece(last + 1));
+      msg.chunked = equalsIgnoreCase(coding, "chunked");
+      sawTransferEncoding = true;
+    }
+    msg.headers.emplace_back(name.str(), value.str());
+  }
+  // Which a proxy in front might have framed differently, smuggling a
+  // request past it
+  if (sawTransferEncoding && sawContentLength) {
+    throw HTTPParseError("Both Transfer-Encoding and Content-Length");
+  }
+  if (sawTransferEncoding && !msg.chunked && msg.isRequest) {
+    throw HTTPParseError("Transfer-Encoding not ending in chunked");
+  }
+  if (msg.chunked) {
+    msg.contentLength = -1;
+  }
+}
+
+bool HTTPCodec::parseBody(Context* ctx, IOBufQueue& q) {
+  if (state_ == State::BODY_TO_EOF) {
+    ctx->fireRead(HTTPPart::body(q.move()));
+    return false;
+  }
+  auto n = std::min<uint64_t>(remaining_, q.chainLength());
+  remaining_ -= n;
+  // A split, not a copy, of the buffers read into
+  ctx->fireRead(HTTPPart::body(q.split(n)));
+  if (remaining_ == 0) {
+    if (state_ == State::CHUNK_DATA) {
+      state_ = State::CHUNK_DATA_END;
+    } else {
+      endMessage(ctx);
+    }
+  }
+  return true;
+}
+
+bool HTTPCodec::parseChunkSize(Context* ctx, IOBufQueue& q) {
+  auto end = findLineEnd(q);
+  if (end == 0) {
+    if (q.chainLength() > kMaxChunkLineLength) {
+      fail(ctx, "Chunk size line too long");
+    }
+    return false;
+  }
+  auto lineBuf = splitCoalesced(q, end);
+  auto line = toStringPiece(*lineBuf);
+  line = nextLine(line);
+  // Extensions are ignored
+  auto semicolon = line.find(';');
+  auto hex = trimWhitespace(
+    semicolon == StringPiece::npos ? line : line.subpiece(0, semicolon));
+  if (hex.empty() || hex.size() > 15) {
+    fail(ctx, "Bad chunk size");
+    return false;
+  }
+  uint64_t size = 0;
+  for (auto c : hex) {
+    int digit;
+    if (c >= '0' && c <= '9') {
+      digit = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      digit = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      digit = c - 'A' + 10;
+    } else {
+      fail(ctx, "Bad chunk size");
+      return false;
+    }
+    size = size * 16 + digit;
+  }
+  if (size == 0) {
+    state_ = State::TRAILERS;
+  } else {
+    state_ = State::CHUNK_DATA;
+    remaining_ = size;
+  }
+  return true;
+}
+
+void HTTPCodec::endMessage(Context* ctx) {
+  state_ = State::HEADERS;
+  remaining_ = 0;
+  ctx->fireRead(HTTPPart::end());
+}
+
+void HTTPCodec::fail(Context* ctx, const std::string& what) {
+  state_ = State::ERROR;
+  if (direction_ == Direction::SERVER) {
+    static const char kBadRequest[] =
+      "HTTP/1.1 400 Bad Request\r\n"
+      "Connection: close\r\n"
+      "Content-Length: 0\r\n\r\n";
+    ctx->fireWrite(IOBuf::wrapBuffer(kBadRequest, sizeof(kBadRequest) - 1));
+  }
+  ctx->fireReadException(make_exception_wrapper<HTTPParseError>(what));
+}
+
+Future<Unit> HTTPCodec::write(Context* ctx, HTTPPart part) {
+  switch (part.type) {
+    case HTTPPart::Type::HEADERS:
+      writingChunked_ = part.message->chunked;
+      return ctx->fireWrite(encodeHeaders(*part.message));
+    case HTTPPart::Type::BODY: {
+      if (!writingChunked_) {
+        return ctx->fireWrite(std::move(part.body));
+      }
+      auto length = part.body->computeChainDataLength();
+      if (length == 0) {
+        // Which would be taken for the last chunk
+        return makeFuture();
+      }
+      char sizeLine[20];
+      auto n = snprintf(sizeLine, sizeof(sizeLine), "%llx\r\n",
+                        (unsigned long long)length);
+      auto buf = IOBuf::copyBuffer(sizeLine, n);
+      buf->prependChain(std::move(part.body));
+      buf->prependChain(IOBuf::copyBuffer("\r\n", 2));
+      return ctx->fireWrite(std::move(buf));
+    }
+    case HTTPPart::Type::END:
+      if (writingChunked_) {
+        writingChunked_ = false;
+        return ctx->fireWrite(IOBuf::copyBuffer("0\r\n\r\n", 5));
+      }
+      return makeFuture();
+  }
+  return makeFuture();
+}
+
+std::unique_ptr<IOBuf> HTTPCodec::encodeHeaders(const HTTPMessage& msg) {
+  std::string length;
+  bool addTransferEncoding = msg.chunked &&
+    !msg.getHeader("Transfer-Encoding");
+  if (!msg.chunked && msg.contentLength >= 0 &&
+      !msg.getHeader("Content-Length")) {
+    length = folly::to<std::string>(msg.contentLength);
+  }
+  char status[4];
+  snprintf(status, sizeof(status), "%03u", unsigned(msg.statusCode % 1000));
+  char version[9] = {'H', 'T', 'T', 'P', '/',
+                     char('0' + msg.versionMajor), '.',
+                     char('0' + msg.versionMinor), 0};
+
+  // Sized first, so it all goes in one buffer
+  size_t size = msg.isRequest
+    ? msg.method.size() + 1 + msg.url.size() + 1 + 8 + 2
+    : 8 + 1 + 3 + 1 + msg.reason.size() + 2;
+  for (auto& header : msg.headers) {
+    size += header.first.size() + 2 + header.second.size() + 2;
+  }
+  StringPiece transferEncoding("Transfer-Encoding: chunked\r\n");
+  StringPiece contentLength("Content-Length: ");
+  if (addTransferEncoding) {
+    size += transferEncoding.size();
+  }
+  if (!length.empty()) {
+    size += contentLength.size() + length.size() + 2;
+  }
+  size += 2;
+
+  auto buf = IOBuf::create(size);
+  auto out = reinterpret_cast<char*>(buf->writableData());
+  auto append = [&out] (StringPiece s) {
+    memcpy(out, s.data(), s.size());
+    out += s.size();
+  };
+  if (msg.isRequest) {
+    append(msg.method);
+    append(" ");
+    append(msg.url);
+    append(" ");
+    append(StringPiece(version, 8));
+  } else {
+    append(StringPiece(version, 8));
+    append(" ");
+    append(StringPiece(status, 3));
+    append(" ");
+    append(msg.reason);
+  }
+  append("\r\n");
+  for (auto& header : msg.headers) {
+    append(header.first);
+    append(": ");
+    append(header.second);
+    append("\r\n");
+  }
+  if (addTransferEncoding) {
+    append(transferEncoding);
+  }
+  if (!length.empty()) {
+    append(contentLength);
+    append(length);
+    append("\r\n");
+  }
+  append("\r\n");
+  buf->append(size);
+  DCHECK_EQ(out, reinterpret_cast<char*>(buf->writableTail()));
+  return buf;
+}
+
+}} // namespace
@@ -0,0 +1,182 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+
+#include <folly/Range.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * The start line and headers of an HTTP/1.x request or response.
+ */
+struct HTTPMessage {
+  // Case-insensitive; nullptr if there is no such header
+  const std::string* getHeader(StringPiece name) const;
+
+  bool isRequest{true};
+  // Requests
+  std::string method;
+  std::string url;
+  // Responses
+  uint16_t statusCode{0};
+  std::string reason;
+
+  uint8_t versionMajor{1};
+  uint8_t versionMinor{1};
+  std::vector<std::pair<std::string, std::string>> headers;
+
+  // From the headers when decoded.  When encoding, the body is framed as
+  // chunks if chunked, and the Transfer-Encoding or Content-Length header
+  // is added for these unless it's in headers already.
+  bool chunked{false};
+  // -1 if not known
+  int64_t contentLength{-1};
+};
+
+/**
+ * A piece of an HTTP message: its headers, then any number of pieces of
+ * its body, as they arrive, then its end.
+ */
+struct HTTPPart {
+  enum class Type {
+    HEADERS,
+    BODY,
+    END,
+  };
+
+  static HTTPPart headers(HTTPMessage msg) {
+    HTTPPart part(Type::HEADERS);
+    part.message.reset(new HTTPMessage(std::move(msg)));
+    return part;
+  }
+
+  static HTTPPart body(std::unique_ptr<IOBuf> buf) {
+    HTTPPart part(Type::BODY);
+    part.body = std::move(buf);
+    return part;
+  }
+
+  static HTTPPart end() {
+    return HTTPPart(Type::END);
+  }
+
+  explicit HTTPPart(Type t) : type(t) {}
+
+  Type type;
+  std::unique_ptr<HTTPMessage> message;
+  std::unique_ptr<IOBuf> body;
+};
+
+class HTTPParseError : public std::runtime_error {
+ public:
+  explicit HTTPParseError(const std::string& what)
+      : std::runtime_error(what) {}
+};
+
+/**
+ * An incremental HTTP/1.x codec, decoding requests (or responses) from
+ * the bytes read into HTTPParts, and encoding the HTTPParts written.
+ *
+ * The header block is found with memchr() over each buffer read, picking
+ * up where the last read left off, so no byte is scanned twice.  Bodies,
+ * whether of a known length, chunked, or for responses delimited by the
+ * end of the connection, are handed on as they arrive, split off the
+ * buffers they were read into rather than copied.
+ *
+ * On the way out, the start line and headers go into one buffer sized
+ * for them, and bodies are framed as chunks if the message is chunked.
+ *
+ * Malformed input fails with an HTTPParseError read exception, after
+ * which everything read is dropped; the connection should be closed.  So
+ * do messages framed ambiguously, with more than one Content-Length or
+ * with both Content-Length and Transfer-Encoding, and requests with a
+ * Transfer-Encoding whose last coding isn't chunked.  A server codec
+ * writes a 400 response before the read exception.
+ */
+class HTTPCodec : public Handler<IOBufQueue&, HTTPPart,
+                                 HTTPPart, std::unique_ptr<IOBuf>> {
+ public:
+  typedef typename Handler<
+   IOBufQueue&, HTTPPart,
+   HTTPPart, std::unique_ptr<IOBuf>>::Context Context;
+
+  enum class Direction {
+    // Reads requests and writes responses
+    SERVER,
+    // Reads responses and writes requests
+    CLIENT,
+  };
+
+  explicit HTTPCodec(Direction direction,
+                     size_t maxHeaderSize = 64 * 1024)
+      : direction_(direction),
+        maxHeaderSize_(maxHeaderSize) {}
+
+  void read(Context* ctx, IOBufQueue& q) override;
+  void readEOF(Context* ctx) override;
+
+  Future<Unit> write(Context* ctx, HTTPPart part) override;
+
+  // Serializes the start line and headers into one buffer
+  static std::unique_ptr<IOBuf> encodeHeaders(const HTTPMessage& msg);
+
+ private:
+  enum class State {
+    HEADERS,
+    BODY,
+    // Until the connection ends
+    BODY_TO_EOF,
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_DATA_END,
+    TRAILERS,
+    ERROR,
+  };
+
+  // Returns whether more might be parsed from q
+  bool parseHeaders(Context* ctx, IOBufQueue& q);
+  bool parseBody(Context* ctx, IOBufQueue& q);
+  bool parseChunkSize(Context* ctx, IOBufQueue& q);
+
+  // Length of the header block at the front of q, through the blank line
+  // ending it, or 0 if it isn't all here yet
+  size_t findHeaderEnd(IOBufQueue& q);
+  // Offset of the end of the first line in q, past its '\n', or 0
+  size_t findLineEnd(IOBufQueue& q);
+
+  void parseMessage(StringPiece block, HTTPMessage& msg);
+  void endMessage(Context* ctx);
+  void fail(Context* ctx, const std::string& what);
+
+  const Direction direction_;
+  const size_t maxHeaderSize_;
+  State state_{State::HEADERS};
+
+  // Header block scan state: bytes scanned, bytes of the current line,
+  // the last byte scanned, and whether the current line is the first
+  size_t scanned_{0};
+  size_t lineLength_{0};
+  char lastByte_{0};
+  bool firstLine_{true};
+
+  // Body bytes, or bytes of the current chunk, still to come
+  uint64_t remaining_{0};
+  // Whether the message being written is chunked
+  bool writingChunked_{false};
+};
+
+}} // namespace
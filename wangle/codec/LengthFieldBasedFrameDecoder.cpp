@@ -10,8 +10,12 @@
 
 #include <wangle/codec/LengthFieldBasedFrameDecoder.h>
 
+#include <algorithm>
+
 namespace folly { namespace wangle {
 
+const uint64_t LengthFieldBasedFrameDecoder::kMinFrameReservation;
+
 LengthFieldBasedFrameDecoder::LengthFieldBasedFrameDecoder(
   uint32_t lengthFieldLength,
   uint32_t maxFrameLength,
@@ -31,9 +35,18 @@ LengthFieldBasedFrameDecoder::LengthFieldBasedFrameDecoder(
 }
 
 std::unique_ptr<IOBuf> LengthFieldBasedFrameDecoder::decode(
-  Context* ctx, IOBufQueue& buf, size_t&) {
+  Context* ctx, IOBufQueue& buf, size_t& needed) {
   // discarding too long frame
+  if (discardingBytes_ > 0) {
+    discard(buf);
+    if (discardingBytes_ > 0) {
+      // No needed, which would keep the bytes until they're all here
+      return nullptr;
+    }
+  }
+
   if (buf.chainLength() < lengthFieldEndOffset_) {
+    needed = lengthFieldEndOffset_ - buf.chainLength();
     return nullptr;
   }
 
@@ -50,7 +63,9 @@ std::unique_ptr<IOBuf> LengthFieldBasedFrameDecoder::decode(
   }
 
   if (frameLength > maxFrameLength_) {
-    buf.trimStart(frameLength);
+    // Dropped as it arrives, so a bogus length can't make us buffer it
+    discardingBytes_ = frameLength;
+    discard(buf);
     ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
                              "Frame larger than " +
                              folly::to<std::string>(maxFrameLength_)));
@@ -58,9 +73,21 @@ std::unique_ptr<IOBuf> LengthFieldBasedFrameDecoder::decode(
   }
 
   if (buf.chainLength() < frameLength) {
+    if (contiguousFrames_) {
+      // Called for every read, to keep the read buffer settings on the
+      // bytes still missing
+      reserveFrame(ctx, buf, frameLength);
+    } else {
+      // Saves parsing the header again until the frame is all in
+      needed = frameLength - buf.chainLength();
+    }
     return nullptr;
   }
 
+  if (readBufferSettingsChanged_) {
+    restoreReadBufferSettings(ctx);
+  }
+
   if (initialBytesToStrip_ > frameLength) {
     buf.trimStart(frameLength);
     ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
@@ -70,7 +97,109 @@ std::unique_ptr<IOBuf> LengthFieldBasedFrameDecoder::decode(
 
   buf.trimStart(initialBytesToStrip_);
   int actualFrameLength = frameLength - initialBytesToStrip_;
-  return buf.split(actualFrameLength);
+  auto frame = buf.split(actualFrameLength);
+  if (contiguousFrames_ && frame->isChained()) {
+    frame->coalesce();
+  }
+  if (checksum_ != FrameChecksum::NONE && !verifyChecksum(frame)) {
+    ctx->fireReadException(folly::make_exception_wrapper<ChecksumError>(
+                             "Frame checksum mismatch"));
+    return nullptr;
+  }
+  return frame;
+}
+
+bool LengthFieldBasedFrameDecoder::verifyChecksum(
+  std::unique_ptr<IOBuf>& frame) {
+  const size_t kLength = 4;
+  auto length = frame->computeChainDataLength();
+  if (length < kLength) {
+    return false;
+  }
+  uint32_t expected;
+  if (checksum_ == FrameChecksum::HEADER) {
+    folly::io::Cursor c(frame.get());
+    expected = networkByteOrder_ ? c.readBE<uint32_t>()
+                                 : c.readLE<uint32_t>();
+    for (size_t n = kLength; n > 0; ) {
+      auto k = std::min(n, frame->length());
+      frame->trimStart(k);
+      n -= k;
+      if (frame->empty() && frame->isChained()) {
+        frame = frame->pop();
+      }
+    }
+    return crc32c(frame.get(), length - kLength) == expected;
+  }
+
+  auto actual = crc32c(frame.get(), length - kLength);
+  folly::io::Cursor c(frame.get());
+  c.skip(length - kLength);
+  expected = networkByteOrder_ ? c.readBE<uint32_t>()
+                               : c.readLE<uint32_t>();
+  for (size_t n = kLength; n > 0; ) {
+    auto last = frame->prev();
+    auto k = std::min(n, last->length());
+    last->trimEnd(k);
+    n -= k;
+    if (last->empty() && last != frame.get()) {
+      last->unlink();
+    }
+  }
+  return actual == expected;
+}
+
+void LengthFieldBasedFrameDecoder::discard(IOBufQueue& buf) {
+  auto n = std::min<uint64_t>(discardingBytes_, buf.chainLength());
+  buf.trimStart(n);
+  discardingBytes_ -= n;
+}
+
+void LengthFieldBasedFrameDecoder::reserveFrame(
+  Context* ctx, IOBufQueue& buf, uint64_t frameLength) {
+  // Everything queued belongs to this frame, since completed frames have
+  // already been split off the front.
+  auto received = buf.chainLength();
+  auto remaining = frameLength - received;
+  auto front = buf.front();
+  if (front->isChained() ||
+      front->tailroom() < std::min<uint64_t>(remaining, kMinFrameReservation)) {
+    // The buffer grows with the bytes received, at least doubling, rather
+    // than taking the length the peer claims on trust
+    auto capacity = std::min<uint64_t>(
+      frameLength,
+      received + std::max<uint64_t>(received, kMinFrameReservation));
+    auto frameBuf = IOBuf::create(capacity);
+    folly::io::Cursor c(front);
+    c.pull(frameBuf->writableTail(), received);
+    frameBuf->append(received);
+    buf.move();
+    buf.append(std::move(frameBuf));
+  }
+
+  auto pipeline = ctx->getPipeline();
+  if (!readBufferSettingsChanged_) {
+    savedReadBufferSettings_ = pipeline->getReadBufferSettings();
+    savedReadBufferSettingsSet_ = pipeline->hasReadBufferSettings();
+    readBufferSettingsChanged_ = true;
+  }
+  // Only the tailroom reserved above satisfies a request for all of it,
+  // so the next read lands in the frame buffer.
+  pipeline->setReadBufferSettings(
+    std::min<uint64_t>(remaining, buf.front()->tailroom()),
+    savedReadBufferSettings_.second);
+}
+
+void LengthFieldBasedFrameDecoder::restoreReadBufferSettings(Context* ctx) {
+  auto pipeline = ctx->getPipeline();
+  if (savedReadBufferSettingsSet_) {
+    pipeline->setReadBufferSettings(savedReadBufferSettings_.first,
+                                    savedReadBufferSettings_.second);
+  } else {
+    // Leaving a read buffer policy to it again
+    pipeline->resetReadBufferSettings();
+  }
+  readBufferSettingsChanged_ = false;
 }
 
 uint64_t LengthFieldBasedFrameDecoder::getUnadjustedFrameLength(
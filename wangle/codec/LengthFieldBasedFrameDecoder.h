@@ -11,6 +11,7 @@
 #pragma once
 
 #include <wangle/codec/ByteToMessageCodec.h>
+#include <wangle/codec/CRC32C.h>
 #include <folly/io/Cursor.h>
 
 namespace folly { namespace wangle {
@@ -186,11 +187,50 @@ class LengthFieldBasedFrameDecoder : public ByteToMessageCodec {
 
   std::unique_ptr<IOBuf> decode(Context* ctx, IOBufQueue& buf, size_t&);
 
+  /**
+   * Deliver every frame as a single, unchained IOBuf.
+   *
+   * Once the length field of an incomplete frame has been read, the bytes
+   * received so far are moved into a buffer with room for more of the
+   * frame, and the pipeline's read buffer settings are adjusted so the
+   * rest of it is read directly into that buffer's tailroom.  The buffer
+   * is kept to about twice the bytes received, growing as they come, so
+   * a large length from the peer doesn't get allocated up front.  Frames
+   * that still end up chained are coalesced before being fired.
+   */
+  void setContiguousFrames(bool contiguousFrames) {
+    contiguousFrames_ = contiguousFrames;
+  }
+
+  /**
+   * Verify a CRC32C of each frame, as LengthFieldPrepender::setChecksum()
+   * writes it, and strip it.  It's 4 bytes, in the decoder's byte order,
+   * at the front or the end of the frame as it would be handed on, past
+   * initialBytesToStrip, and covers the rest of it.  It's computed in a
+   * pass of its own once the frame is split off, a buffer at a time
+   * without coalescing them, while the frame's bytes are likely still in
+   * cache; a frame that doesn't match is dropped with a ChecksumError read
+   * exception.
+   */
+  void setChecksum(FrameChecksum checksum) {
+    checksum_ = checksum;
+  }
+
  private:
 
   uint64_t getUnadjustedFrameLength(
     IOBufQueue& buf, int offset, int length, bool networkByteOrder);
 
+  // Least tailroom reserveFrame() leaves for a frame's next bytes
+  static const uint64_t kMinFrameReservation = 64 * 1024;
+
+  // Drops what's queued of a frame that is too long
+  void discard(IOBufQueue& buf);
+  void reserveFrame(Context* ctx, IOBufQueue& buf, uint64_t frameLength);
+  void restoreReadBufferSettings(Context* ctx);
+  // Strips frame's checksum; false if it doesn't match
+  bool verifyChecksum(std::unique_ptr<IOBuf>& frame);
+
   uint32_t lengthFieldLength_;
   uint32_t maxFrameLength_;
   uint32_t lengthFieldOffset_;
@@ -199,6 +239,15 @@ class LengthFieldBasedFrameDecoder : public ByteToMessageCodec {
   bool networkByteOrder_;
 
   uint32_t lengthFieldEndOffset_;
+
+  // Bytes still to come of a frame that is too long
+  uint64_t discardingBytes_{0};
+
+  bool contiguousFrames_{false};
+  FrameChecksum checksum_{FrameChecksum::NONE};
+  bool readBufferSettingsChanged_{false};
+  std::pair<uint64_t, uint64_t> savedReadBufferSettings_;
+  bool savedReadBufferSettingsSet_{false};
 };
 
 }} // namespace
@@ -10,8 +10,27 @@
 
 #include <wangle/codec/LengthFieldPrepender.h>
 
+#include <folly/Bits.h>
+
+#include <cstring>
+#include <limits>
+
 namespace folly { namespace wangle {
 
+const size_t LengthFieldPrepender::kMaxHeaderLength;
+const size_t LengthFieldPrepender::kChecksumLength;
+
+template <typename T>
+void LengthFieldPrepender::writeLength(uint8_t* dst, uint64_t length,
+                                       bool networkByteOrder) {
+  if (length > std::numeric_limits<T>::max()) {
+    throw std::runtime_error("length does not fit byte");
+  }
+  T field = networkByteOrder ? Endian::big(T(length))
+                             : Endian::little(T(length));
+  memcpy(dst, &field, sizeof(T));
+}
+
 LengthFieldPrepender::LengthFieldPrepender(
     int lengthFieldLength,
     int lengthAdjustment,
@@ -21,74 +40,72 @@ LengthFieldPrepender::LengthFieldPrepender(
     , lengthAdjustment_(lengthAdjustment)
     , lengthIncludesLengthField_(lengthIncludesLengthField)
     , networkByteOrder_(networkByteOrder) {
-    CHECK(lengthFieldLength == 1 ||
-          lengthFieldLength == 2 ||
-          lengthFieldLength == 4 ||
-          lengthFieldLength == 8 );
+  switch (lengthFieldLength_) {
+    case 1:
+      writeLength_ = &writeLength<uint8_t>;
+      break;
+    case 2:
+      writeLength_ = &writeLength<uint16_t>;
+      break;
+    case 4:
+      writeLength_ = &writeLength<uint32_t>;
+      break;
+    case 8:
+      writeLength_ = &writeLength<uint64_t>;
+      break;
+    default:
+      LOG(FATAL) << "Invalid lengthFieldLength " << lengthFieldLength_;
   }
+}
 
 Future<Unit> LengthFieldPrepender::write(
     Context* ctx, std::unique_ptr<IOBuf> buf) {
-  int length = lengthAdjustment_ + buf->computeChainDataLength();
+  auto messageLength = buf->computeChainDataLength();
+  int length = lengthAdjustment_ + messageLength;
   if (lengthIncludesLengthField_) {
     length += lengthFieldLength_;
   }
 
+  // The checksum's bytes, and how many of them go in the header
+  uint8_t checksum[kChecksumLength];
+  size_t headerChecksum = 0;
+  if (checksum_ != FrameChecksum::NONE) {
+    auto crc = crc32c(buf.get(), messageLength);
+    crc = networkByteOrder_ ? Endian::big(crc) : Endian::little(crc);
+    memcpy(checksum, &crc, kChecksumLength);
+    length += kChecksumLength;
+    if (checksum_ == FrameChecksum::HEADER) {
+      headerChecksum = kChecksumLength;
+    } else {
+      auto last = buf->prev();
+      if (last->tailroom() >= kChecksumLength && !last->isSharedOne()) {
+        memcpy(last->writableTail(), checksum, kChecksumLength);
+        last->append(kChecksumLength);
+      } else {
+        buf->prependChain(IOBuf::copyBuffer(checksum, kChecksumLength));
+      }
+    }
+  }
+
   if (length < 0) {
     throw std::runtime_error("Length field < 0");
   }
 
-  auto len = IOBuf::create(lengthFieldLength_);
-  len->append(lengthFieldLength_);
-  folly::io::RWPrivateCursor c(len.get());
-
-  switch (lengthFieldLength_) {
-    case 1: {
-      if (length >= 256) {
-        throw std::runtime_error("length does not fit byte");
-      }
-      if (networkByteOrder_) {
-        c.writeBE((uint8_t)length);
-      } else {
-        c.writeLE((uint8_t)length);
-      }
-      break;
-    }
-    case 2: {
-      if (length >= 65536) {
-        throw std::runtime_error("length does not fit byte");
-      }
-      if (networkByteOrder_) {
-        c.writeBE((uint16_t)length);
-      } else {
-        c.writeLE((uint16_t)length);
-      }
-      break;
-    }
-    case 4: {
-      if (networkByteOrder_) {
-        c.writeBE((uint32_t)length);
-      } else {
-        c.writeLE((uint32_t)length);
-      }
-      break;
-    }
-    case 8: {
-      if (networkByteOrder_) {
-        c.writeBE((uint64_t)length);
-      } else {
-        c.writeLE((uint64_t)length);
-      }
-      break;
-    }
-    default: {
-      throw std::runtime_error("Invalid lengthFieldLength");
-    }
+  size_t headerLength = lengthFieldLength_ + headerChecksum;
+  if (buf->headroom() >= headerLength && !buf->isSharedOne()) {
+    buf->prepend(headerLength);
+    writeLength_(buf->writableData(), length, networkByteOrder_);
+    memcpy(buf->writableData() + lengthFieldLength_, checksum,
+           headerChecksum);
+    return ctx->fireWrite(std::move(buf));
   }
 
+  auto len = IOBuf::create(headerLength);
+  writeLength_(len->writableData(), length, networkByteOrder_);
+  memcpy(len->writableData() + lengthFieldLength_, checksum, headerChecksum);
+  len->append(headerLength);
   len->prependChain(std::move(buf));
   return ctx->fireWrite(std::move(len));
 }
 
-
 }} // Namespace
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <wangle/codec/ByteToMessageCodec.h>
+#include <wangle/codec/CRC32C.h>
 #include <folly/io/Cursor.h>
 
 namespace folly { namespace wangle {
@@ -40,6 +41,10 @@ namespace folly { namespace wangle {
  * + 0x000E | "HELLO, WORLD" |
  * +--------+----------------+
  *
+ * The length field is written into the message's headroom when it has
+ * enough, and isn't shared, so the message goes out as one buffer.
+ * Handlers serializing messages for a prepender can leave room for it
+ * with createWithHeadroom(); otherwise it takes a buffer of its own.
  */
 class LengthFieldPrepender
 : public OutboundBytesToBytesHandler {
@@ -52,11 +57,39 @@ class LengthFieldPrepender
 
   Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf);
 
+  /**
+   * Add a CRC32C of the message, in the prepender's byte order, between
+   * the length field and the message or after it, for a decoder with the
+   * same setChecksum().  The length field counts it.
+   */
+  void setChecksum(FrameChecksum checksum) {
+    checksum_ = checksum;
+  }
+
+  // Headroom that fits any length field, and a checksum
+  static const size_t kMaxHeaderLength = 12;
+
+  // A buffer for capacity bytes of message, with room for the length field
+  static std::unique_ptr<IOBuf> createWithHeadroom(size_t capacity) {
+    auto buf = IOBuf::create(capacity + kMaxHeaderLength);
+    buf->advance(kMaxHeaderLength);
+    return buf;
+  }
+
  private:
+  static const size_t kChecksumLength = 4;
+
+  // Writes a length field of type T at dst; throws if length doesn't fit
+  template <typename T>
+  static void writeLength(uint8_t* dst, uint64_t length,
+                          bool networkByteOrder);
+
+  void (*writeLength_)(uint8_t*, uint64_t, bool);
   int lengthFieldLength_;
   int lengthAdjustment_;
   bool lengthIncludesLengthField_;
   bool networkByteOrder_;
+  FrameChecksum checksum_{FrameChecksum::NONE};
 };
 
 }} // namespace
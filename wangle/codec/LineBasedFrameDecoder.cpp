@@ -10,6 +10,9 @@
 
 #include <wangle/codec/LineBasedFrameDecoder.h>
 
+#include <algorithm>
+#include <cstring>
+
 namespace folly { namespace wangle {
 
 using folly::io::Cursor;
@@ -24,6 +27,10 @@ LineBasedFrameDecoder::LineBasedFrameDecoder(uint32_t maxLength,
 std::unique_ptr<IOBuf> LineBasedFrameDecoder::decode(
   Context* ctx, IOBufQueue& buf, size_t&) {
   int64_t eol = findEndOfLine(buf);
+  if (eol >= 0) {
+    // Every branch below consumes the queue through this terminator
+    scanOffset_ = 0;
+  }
 
   if (!discarding_) {
     if (eol >= 0) {
@@ -51,6 +58,7 @@ std::unique_ptr<IOBuf> LineBasedFrameDecoder::decode(
       if (len > maxLength_) {
         discardedBytes_ = len;
         buf.trimStart(len);
+        scanOffset_ = 0;
         discarding_ = true;
         fail(ctx, "over " + folly::to<std::string>(len));
       }
@@ -67,6 +75,7 @@ std::unique_ptr<IOBuf> LineBasedFrameDecoder::decode(
     } else {
       discardedBytes_ = buf.chainLength();
       buf.move();
+      scanOffset_ = 0;
     }
 
     return nullptr;
@@ -81,17 +90,59 @@ void LineBasedFrameDecoder::fail(Context* ctx, std::string len) {
 }
 
 int64_t LineBasedFrameDecoder::findEndOfLine(IOBufQueue& buf) {
-  Cursor c(buf.front());
-  for (uint32_t i = 0; i < maxLength_ && i < buf.chainLength(); i++) {
-    auto b = c.read<char>();
-    if (b == '\n' && terminatorType_ != TerminatorType::CARRIAGENEWLINE) {
-      return i;
-    } else if (terminatorType_ != TerminatorType::NEWLINE &&
-               b == '\r' && !c.isAtEnd() && c.read<char>() == '\n') {
-      return i;
-    }
+  const IOBuf* head = buf.front();
+  if (!head) {
+    scanOffset_ = 0;
+    return -1;
   }
 
+  // A "\r\n" terminator may start at maxLength_ - 1, so look one byte past
+  // maxLength_ for its '\n'.
+  const uint64_t limit = std::min<uint64_t>(buf.chainLength(),
+                                            uint64_t(maxLength_) + 1);
+  if (scanOffset_ > limit) {
+    scanOffset_ = 0;
+  }
+
+  // Search segment by segment for '\n' with memchr, which is vectorized,
+  // and classify each hit by the byte in front of it.
+  uint64_t segStart = 0;
+  bool prevCR = false;
+  const IOBuf* cur = head;
+  do {
+    const size_t segLen = cur->length();
+    if (segStart >= limit) {
+      break;
+    }
+    const char* data = reinterpret_cast<const char*>(cur->data());
+    const size_t end = std::min<uint64_t>(segLen, limit - segStart);
+    size_t i = scanOffset_ > segStart ? scanOffset_ - segStart : 0;
+    while (i < end) {
+      auto p = static_cast<const char*>(memchr(data + i, '\n', end - i));
+      if (!p) {
+        break;
+      }
+      const size_t pos = p - data;
+      const bool cr = pos > 0 ? data[pos - 1] == '\r' : prevCR;
+      int64_t eol = -1;
+      if (cr && terminatorType_ != TerminatorType::NEWLINE) {
+        eol = segStart + pos - 1;
+      } else if (terminatorType_ != TerminatorType::CARRIAGENEWLINE) {
+        eol = segStart + pos;
+      }
+      if (eol >= 0 && eol < maxLength_) {
+        return eol;
+      }
+      i = pos + 1;
+    }
+    if (segLen > 0) {
+      prevCR = data[segLen - 1] == '\r';
+    }
+    segStart += segLen;
+    cur = cur->next();
+  } while (cur != head);
+
+  scanOffset_ = limit;
   return -1;
 }
 
@@ -38,6 +38,11 @@ class LineBasedFrameDecoder : public ByteToMessageCodec {
 
  private:
 
+  /**
+   * Returns the offset of the first line terminator in buf, or -1 if
+   * there is none within maxLength_ bytes.  Bytes that were already
+   * searched by a previous unsuccessful call are not searched again.
+   */
   int64_t findEndOfLine(IOBufQueue& buf);
 
   void fail(Context* ctx, std::string len);
@@ -48,6 +53,10 @@ class LineBasedFrameDecoder : public ByteToMessageCodec {
   bool discarding_{false};
   uint32_t discardedBytes_{0};
 
+  // Number of bytes at the front of the queue known not to hold a
+  // terminator.  Reset whenever bytes are consumed from the queue.
+  uint64_t scanOffset_{0};
+
   TerminatorType terminatorType_;
 };
 
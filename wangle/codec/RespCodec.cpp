@@ -0,0 +1,305 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/RespCodec.h>
+
+#include <folly/Conv.h>
+#include <folly/io/Cursor.h>
+
+#include <cstdio>
+#include <cstring>
+
+namespace folly { namespace wangle {
+
+const size_t RespCodec::kCopyThreshold;
+
+namespace {
+
+// Longest integer we parse, which keeps it from overflowing
+const size_t kMaxDigits = 18;
+
+/*
+ * Reads a "<prefix><integer>\r\n" line at c, of at most available bytes.
+ * Returns its length, or 0 if it isn't all there yet.
+ */
+size_t readNumberLine(io::Cursor& c, size_t available, char prefix,
+                      int64_t& value) {
+  size_t n = 0;
+  size_t digits = 0;
+  bool negative = false;
+  value = 0;
+  while (n < available) {
+    auto ch = c.read<char>();
+    n++;
+    if (n == 1) {
+      if (ch != prefix) {
+        throw RespParseError(std::string("Expected '") + prefix + "'");
+      }
+    } else if (ch == '\r') {
+      if (n == available) {
+        return 0;
+      }
+      n++;
+      if (c.read<char>() != '\n' || digits == 0) {
+        throw RespParseError("Bad length");
+      }
+      value = negative ? -value : value;
+      return n;
+    } else if (ch == '-' && n == 2) {
+      negative = true;
+    } else if (ch < '0' || ch > '9' || ++digits > kMaxDigits) {
+      throw RespParseError("Bad length");
+    } else {
+      value = value * 10 + (ch - '0');
+    }
+  }
+  return 0;
+}
+
+void encodeTo(RespReply& reply, IOBufQueue& out) {
+  char header[32];
+  int n;
+  switch (reply.type) {
+    case RespReply::Type::SIMPLE_STRING:
+    case RespReply::Type::ERROR:
+      DCHECK(reply.text.find_first_of("\r\n") == std::string::npos);
+      out.append(reply.type == RespReply::Type::ERROR ? "-" : "+", 1);
+      out.append(reply.text.data(), reply.text.size());
+      out.append("\r\n", 2);
+      break;
+    case RespReply::Type::INTEGER:
+      n = snprintf(header, sizeof(header), ":%lld\r\n",
+                   (long long)reply.value);
+      out.append(header, n);
+      break;
+    case RespReply::Type::BULK_STRING: {
+      size_t length = reply.bulk ? reply.bulk->computeChainDataLength() : 0;
+      n = snprintf(header, sizeof(header), "$%llu\r\n",
+                   (unsigned long long)length);
+      out.append(header, n);
+      if (length >= RespCodec::kCopyThreshold) {
+        out.append(std::move(reply.bulk));
+      } else if (reply.bulk) {
+        for (auto range : *reply.bulk) {
+          out.append(range.data(), range.size());
+        }
+      }
+      out.append("\r\n", 2);
+      break;
+    }
+    case RespReply::Type::NIL:
+      out.append("$-1\r\n", 5);
+      break;
+    case RespReply::Type::ARRAY:
+      n = snprintf(header, sizeof(header), "*%llu\r\n",
+                   (unsigned long long)reply.elements.size());
+      out.append(header, n);
+      for (auto& element : reply.elements) {
+        encodeTo(element, out);
+      }
+      break;
+  }
+}
+
+}
+
+void RespCodec::read(Context* ctx, IOBufQueue& q) {
+  if (error_) {
+    q.move();
+    return;
+  }
+  if (q.chainLength() < neededLength_) {
+    ctx->getPipeline()->setReadSizeHint(neededLength_ - q.chainLength());
+    return;
+  }
+
+  ReadBatch<RespRequest> batch;
+  size_t needed = 0;
+  std::string error;
+  while (!q.empty()) {
+    RespRequest req;
+    Result result;
+    try {
+      result = parse(q, req, needed);
+    } catch (const RespParseError& e) {
+      error = e.what();
+      break;
+    }
+    if (result == Result::PARTIAL) {
+      break;
+    }
+    if (result == Result::COMPLETE) {
+      if (batchReads_) {
+        batch.push_back(std::move(req));
+      } else {
+        ctx->fireRead(std::move(req));
+      }
+    }
+  }
+
+  if (error.empty()) {
+    neededLength_ = needed ? q.chainLength() + needed : 0;
+    auto pipeline = ctx->getPipeline();
+    if (pipeline->getReadSizeHint() != needed) {
+      pipeline->setReadSizeHint(needed);
+    }
+  }
+  // The commands before any error go first
+  if (batch.size() == 1) {
+    ctx->fireRead(std::move(batch.front()));
+  } else if (!batch.empty()) {
+    ctx->fireReadBatch(std::move(batch));
+  }
+  if (!error.empty()) {
+    error_ = true;
+    q.move();
+    reset();
+    ctx->fireReadException(make_exception_wrapper<RespParseError>(error));
+  }
+}
+
+RespCodec::Result RespCodec::parse(IOBufQueue& q, RespRequest& req,
+                                   size_t& needed) {
+  io::Cursor c(q.front());
+  if (argCount_ < 0) {
+    if (parsed_ > 0 || io::Cursor(q.front()).read<char>() != '*') {
+      return parseInline(q, req);
+    }
+    int64_t count;
+    auto n = readNumberLine(c, q.chainLength(), '*', count);
+    if (n == 0) {
+      needed = 1;
+      return Result::PARTIAL;
+    }
+    if (count > int64_t(maxArgs_)) {
+      throw RespParseError("Too many arguments");
+    }
+    if (count <= 0) {
+      // Nothing to do, as for Redis
+      q.trimStart(n);
+      return Result::SKIPPED;
+    }
+    parsed_ = n;
+    argCount_ = count;
+  } else {
+    c.skip(parsed_);
+  }
+
+  auto available = q.chainLength() - parsed_;
+  while (int64_t(argRanges_.size()) < argCount_) {
+    int64_t length;
+    auto n = readNumberLine(c, available, '$', length);
+    if (n == 0) {
+      needed = 1;
+      return Result::PARTIAL;
+    }
+    if (length < 0 || uint64_t(length) > maxBulkLength_) {
+      throw RespParseError("Bad bulk string length " +
+                           folly::to<std::string>(length));
+    }
+    // Not parsed again until the whole string is here
+    if (available - n < uint64_t(length) + 2) {
+      needed = length + 2 - (available - n);
+      return Result::PARTIAL;
+    }
+    c.skip(length);
+    if (c.read<char>() != '\r' || c.read<char>() != '\n') {
+      throw RespParseError("Missing CRLF after bulk string");
+    }
+    argRanges_.emplace_back(parsed_ + n, length);
+    parsed_ += n + length + 2;
+    available -= n + length + 2;
+  }
+
+  // Only copied if it was read into more than one buffer
+  req.buf = q.split(parsed_);
+  if (req.buf->isChained()) {
+    req.buf->coalesce();
+  }
+  auto data = reinterpret_cast<const char*>(req.buf->data());
+  for (auto& range : argRanges_) {
+    req.args.emplace_back(data + range.first, range.second);
+  }
+  reset();
+  return Result::COMPLETE;
+}
+
+RespCodec::Result RespCodec::parseInline(IOBufQueue& q, RespRequest& req) {
+  // Picks up the search for the end of the line where it left off
+  size_t end = 0;
+  size_t offset = 0;
+  auto front = q.front();
+  auto buf = front;
+  do {
+    size_t len = buf->length();
+    if (offset + len > parsed_) {
+      size_t start = parsed_ - offset;
+      auto nl = static_cast<const uint8_t*>(
+        memchr(buf->data() + start, '\n', len - start));
+      if (nl) {
+        end = offset + (nl - buf->data()) + 1;
+        break;
+      }
+      parsed_ = offset + len;
+    }
+    offset += len;
+    buf = buf->next();
+  } while (buf != front);
+
+  if (end == 0 ? parsed_ > maxInlineLength_ : end > maxInlineLength_) {
+    throw RespParseError("Inline command too long");
+  }
+  if (end == 0) {
+    return Result::PARTIAL;
+  }
+
+  req.buf = q.split(end);
+  reset();
+  if (req.buf->isChained()) {
+    req.buf->coalesce();
+  }
+  StringPiece line(reinterpret_cast<const char*>(req.buf->data()),
+                   req.buf->length() - 1);
+  if (!line.empty() && line.back() == '\r') {
+    line.pop_back();
+  }
+  while (!line.empty()) {
+    while (!line.empty() && (line.front() == ' ' || line.front() == '\t')) {
+      line.pop_front();
+    }
+    size_t i = 0;
+    while (i < line.size() && line[i] != ' ' && line[i] != '\t') {
+      i++;
+    }
+    if (i > 0) {
+      req.args.push_back(line.subpiece(0, i));
+    }
+    line.advance(i);
+  }
+  return req.args.empty() ? Result::SKIPPED : Result::COMPLETE;
+}
+
+void RespCodec::reset() {
+  parsed_ = 0;
+  argCount_ = -1;
+  argRanges_.clear();
+}
+
+Future<Unit> RespCodec::write(Context* ctx, RespReply reply) {
+  return ctx->fireWrite(encode(std::move(reply)));
+}
+
+std::unique_ptr<IOBuf> RespCodec::encode(RespReply reply) {
+  IOBufQueue out(IOBufQueue::cacheChainLength());
+  encodeTo(reply, out);
+  return out.move();
+}
+
+}} // namespace
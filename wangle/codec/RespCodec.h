@@ -0,0 +1,176 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+
+#include <folly/Range.h>
+#include <folly/small_vector.h>
+
+#include <string>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * A command read by RespCodec: its arguments, the name first, as
+ * StringPieces into buf, which holds the command's bytes.
+ */
+struct RespRequest {
+  std::unique_ptr<IOBuf> buf;
+  folly::small_vector<StringPiece, 8> args;
+};
+
+/**
+ * A reply to write with RespCodec.
+ */
+struct RespReply {
+  enum class Type {
+    SIMPLE_STRING,
+    ERROR,
+    INTEGER,
+    BULK_STRING,
+    // The null bulk string
+    NIL,
+    ARRAY,
+  };
+
+  static RespReply simpleString(std::string s) {
+    RespReply reply(Type::SIMPLE_STRING);
+    reply.text = std::move(s);
+    return reply;
+  }
+
+  static RespReply error(std::string s) {
+    RespReply reply(Type::ERROR);
+    reply.text = std::move(s);
+    return reply;
+  }
+
+  static RespReply integer(int64_t i) {
+    RespReply reply(Type::INTEGER);
+    reply.value = i;
+    return reply;
+  }
+
+  static RespReply bulkString(std::unique_ptr<IOBuf> buf) {
+    RespReply reply(Type::BULK_STRING);
+    reply.bulk = std::move(buf);
+    return reply;
+  }
+
+  static RespReply nil() {
+    return RespReply(Type::NIL);
+  }
+
+  static RespReply array(std::vector<RespReply> elements) {
+    RespReply reply(Type::ARRAY);
+    reply.elements = std::move(elements);
+    return reply;
+  }
+
+  explicit RespReply(Type t) : type(t) {}
+
+  Type type;
+  // Simple strings and errors
+  std::string text;
+  int64_t value{0};
+  std::unique_ptr<IOBuf> bulk;
+  std::vector<RespReply> elements;
+};
+
+class RespParseError : public std::runtime_error {
+ public:
+  explicit RespParseError(const std::string& what)
+      : std::runtime_error(what) {}
+};
+
+/**
+ * The server side of the Redis protocol (RESP): reads commands, either
+ * arrays of bulk strings or inline commands on a line of their own, and
+ * writes replies.
+ *
+ * Commands are parsed incrementally: a command split over several reads
+ * is picked up where the last read left off, and once a bulk string's
+ * length is known, nothing is parsed again until all of it is in, which
+ * is also passed on as the pipeline's read size hint.  Bulk strings are
+ * skipped over by their length, never scanned.  A command is split off
+ * the buffers it was read into with its arguments pointing into it, so
+ * it is only copied when it spans two reads' buffers, and commands of up
+ * to 8 arguments come without any allocation for the arguments.
+ *
+ * With setBatchReads(true), all the commands of a read, such as a
+ * client's pipeline of commands, are handed on with one fireReadBatch().
+ *
+ * Replies are encoded into one buffer, except that bulk strings of
+ * kCopyThreshold bytes or more are chained in rather than copied.
+ *
+ * Malformed input fails with a RespParseError read exception, after
+ * which everything read is dropped; the connection should be closed.
+ */
+class RespCodec : public Handler<IOBufQueue&, RespRequest,
+                                 RespReply, std::unique_ptr<IOBuf>> {
+ public:
+  typedef typename Handler<
+   IOBufQueue&, RespRequest,
+   RespReply, std::unique_ptr<IOBuf>>::Context Context;
+
+  static const size_t kCopyThreshold = 256;
+
+  explicit RespCodec(size_t maxBulkLength = 512 * 1024 * 1024,
+                     size_t maxArgs = 1024 * 1024,
+                     size_t maxInlineLength = 64 * 1024)
+      : maxBulkLength_(maxBulkLength),
+        maxArgs_(maxArgs),
+        maxInlineLength_(maxInlineLength) {}
+
+  void setBatchReads(bool batchReads) {
+    batchReads_ = batchReads;
+  }
+
+  void read(Context* ctx, IOBufQueue& q) override;
+
+  Future<Unit> write(Context* ctx, RespReply reply) override;
+
+  static std::unique_ptr<IOBuf> encode(RespReply reply);
+
+ private:
+  enum class Result {
+    COMPLETE,
+    // Bytes were consumed, but there is no command, e.g. an empty line
+    SKIPPED,
+    PARTIAL,
+  };
+
+  // Parse the command at the front of q; throw RespParseError if it's
+  // malformed
+  Result parse(IOBufQueue& q, RespRequest& req, size_t& needed);
+  Result parseInline(IOBufQueue& q, RespRequest& req);
+  // Forget the progress on the command at the front
+  void reset();
+
+  const size_t maxBulkLength_;
+  const size_t maxArgs_;
+  const size_t maxInlineLength_;
+  bool batchReads_{false};
+  bool error_{false};
+  // What the queue has to hold before parsing is worth trying again
+  size_t neededLength_{0};
+
+  // Progress on the command at the front of the queue: bytes parsed, the
+  // number of arguments (-1 until known), and the offset and length of
+  // those parsed so far
+  size_t parsed_{0};
+  int64_t argCount_{-1};
+  std::vector<std::pair<size_t, size_t>> argRanges_;
+};
+
+}} // namespace
@@ -0,0 +1,140 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/codec/ByteToMessageCodec.h>
+
+#include <folly/Bits.h>
+#include <folly/Conv.h>
+#include <folly/io/Cursor.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <type_traits>
+
+namespace folly { namespace wangle {
+
+/**
+ * LengthFieldBasedFrameDecoder, with its length field's type, offset and
+ * byte order, the length adjustment and the bytes stripped fixed when it
+ * is compiled rather than when it's constructed; see there for what each
+ * one does.  A frame's length is read with one load, and a byte swap for
+ * network byte order, when its header lies in the first buffer, as it
+ * mostly does, and through a Cursor otherwise.  For
+ * LengthFieldBasedFrameDecoder(2, max, 0, 0, 2):
+ *
+ *   StaticLengthFieldFrameDecoder<uint16_t, 0, 0, 2> decoder(max);
+ *
+ * Frames too long are dropped as they arrive, with a read exception, as
+ * that does; contiguous frames and checksums are its alone.
+ */
+template <typename LengthType,
+          uint32_t LengthFieldOffset = 0,
+          int32_t LengthAdjustment = 0,
+          uint32_t InitialBytesToStrip = sizeof(LengthType),
+          bool NetworkByteOrder = true>
+class StaticLengthFieldFrameDecoder : public ByteToMessageCodec {
+  static_assert(std::is_unsigned<LengthType>::value &&
+                sizeof(LengthType) <= sizeof(uint64_t),
+                "The length field is an unsigned integer");
+
+ public:
+  static const size_t kLengthFieldEndOffset =
+    LengthFieldOffset + sizeof(LengthType);
+
+  explicit StaticLengthFieldFrameDecoder(uint64_t maxFrameLength = UINT_MAX)
+      : maxFrameLength_(maxFrameLength) {
+    CHECK(maxFrameLength >= kLengthFieldEndOffset);
+  }
+
+  std::unique_ptr<IOBuf> decode(Context* ctx, IOBufQueue& buf,
+                                size_t& needed) override {
+    if (discardingBytes_ > 0) {
+      discard(buf);
+      if (discardingBytes_ > 0) {
+        return nullptr;
+      }
+    }
+
+    auto available = buf.chainLength();
+    if (available < kLengthFieldEndOffset) {
+      needed = kLengthFieldEndOffset - available;
+      return nullptr;
+    }
+
+    int64_t frameLength = int64_t(readLength(buf.front())) +
+      LengthAdjustment + kLengthFieldEndOffset;
+
+    if (frameLength < int64_t(kLengthFieldEndOffset)) {
+      buf.trimStart(kLengthFieldEndOffset);
+      ctx->fireReadException(make_exception_wrapper<std::runtime_error>(
+                               "Frame too small"));
+      return nullptr;
+    }
+
+    if (uint64_t(frameLength) > maxFrameLength_) {
+      discardingBytes_ = frameLength;
+      discard(buf);
+      ctx->fireReadException(make_exception_wrapper<std::runtime_error>(
+                               "Frame larger than " +
+                               folly::to<std::string>(maxFrameLength_)));
+      return nullptr;
+    }
+
+    if (available < uint64_t(frameLength)) {
+      needed = frameLength - available;
+      return nullptr;
+    }
+
+    if (InitialBytesToStrip > uint64_t(frameLength)) {
+      buf.trimStart(frameLength);
+      ctx->fireReadException(make_exception_wrapper<std::runtime_error>(
+                               "InitialBytesToSkip larger than frame"));
+      return nullptr;
+    }
+
+    buf.trimStart(InitialBytesToStrip);
+    return buf.split(frameLength - InitialBytesToStrip);
+  }
+
+ private:
+  static uint64_t readLength(const IOBuf* front) {
+    LengthType length;
+    if (LIKELY(front->length() >= kLengthFieldEndOffset)) {
+      memcpy(&length, front->data() + LengthFieldOffset, sizeof(length));
+    } else {
+      io::Cursor c(front);
+      c.skip(LengthFieldOffset);
+      c.pull(&length, sizeof(length));
+    }
+    return NetworkByteOrder ? Endian::big(length) : Endian::little(length);
+  }
+
+  void discard(IOBufQueue& buf) {
+    auto n = std::min<uint64_t>(discardingBytes_, buf.chainLength());
+    buf.trimStart(n);
+    discardingBytes_ -= n;
+  }
+
+  const uint64_t maxFrameLength_;
+  // Bytes still to come of a frame that is too long
+  uint64_t discardingBytes_{0};
+};
+
+template <typename LengthType, uint32_t LengthFieldOffset,
+          int32_t LengthAdjustment, uint32_t InitialBytesToStrip,
+          bool NetworkByteOrder>
+const size_t StaticLengthFieldFrameDecoder<
+  LengthType, LengthFieldOffset, LengthAdjustment,
+  InitialBytesToStrip, NetworkByteOrder>::kLengthFieldEndOffset;
+
+}} // namespace
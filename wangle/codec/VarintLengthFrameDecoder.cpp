@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/codec/VarintLengthFrameDecoder.h>
+
+#include <folly/Conv.h>
+#include <folly/io/Cursor.h>
+
+#include <algorithm>
+
+namespace folly { namespace wangle {
+
+const size_t VarintLengthFrameDecoder::kMaxVarintLength;
+
+std::unique_ptr<IOBuf> VarintLengthFrameDecoder::decode(
+  Context* ctx, IOBufQueue& buf, size_t& needed) {
+  if (corrupt_) {
+    buf.move();
+    return nullptr;
+  }
+  if (discarding_ > 0) {
+    auto n = std::min<uint64_t>(discarding_, buf.chainLength());
+    buf.trimStart(n);
+    discarding_ -= n;
+    if (discarding_ > 0) {
+      // No needed, which would keep the bytes until it's all here
+      return nullptr;
+    }
+  }
+
+  auto available = buf.chainLength();
+  if (available == 0) {
+    return nullptr;
+  }
+  folly::io::Cursor c(buf.front());
+  uint64_t frameLength = 0;
+  size_t headerLength = 0;
+  while (true) {
+    if (headerLength == available) {
+      needed = 1;
+      return nullptr;
+    }
+    auto byte = c.read<uint8_t>();
+    frameLength |= uint64_t(byte & 0x7f) << (7 * headerLength);
+    headerLength++;
+    if (!(byte & 0x80)) {
+      break;
+    }
+    if (headerLength == kMaxVarintLength) {
+      corrupt_ = true;
+      buf.move();
+      ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                               "Frame length varint too long"));
+      return nullptr;
+    }
+  }
+
+  if (frameLength > maxFrameLength_) {
+    buf.trimStart(headerLength);
+    discarding_ = frameLength;
+    auto n = std::min<uint64_t>(discarding_, buf.chainLength());
+    buf.trimStart(n);
+    discarding_ -= n;
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Frame larger than " +
+                             folly::to<std::string>(maxFrameLength_)));
+    return nullptr;
+  }
+
+  if (available < headerLength + frameLength) {
+    needed = headerLength + frameLength - available;
+    return nullptr;
+  }
+
+  buf.trimStart(headerLength);
+  if (frameLength == 0) {
+    return IOBuf::create(0);
+  }
+  return buf.split(frameLength);
+}
+
+}} // namespace
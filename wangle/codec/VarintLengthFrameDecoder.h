@@ -0,0 +1,48 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/codec/ByteToMessageCodec.h>
+
+#include <climits>
+
+namespace folly { namespace wangle {
+
+/**
+ * A decoder for frames prefixed with their length as a base 128 varint,
+ * as protobuf's length-delimited streams are: seven bits per byte, least
+ * significant group first, with the high bit set on all bytes but the
+ * last.  The length is read straight across the buffers it was received
+ * in, and the prefix is stripped from the frames.
+ *
+ * A frame longer than maxFrameLength fails with a read exception, and its
+ * bytes are dropped as they arrive rather than buffered.  A length of more
+ * than ten bytes can't be recovered from, so everything after it is
+ * dropped.
+ */
+class VarintLengthFrameDecoder : public ByteToMessageCodec {
+ public:
+  // Longest varint for a 64 bit length
+  static const size_t kMaxVarintLength = 10;
+
+  explicit VarintLengthFrameDecoder(uint64_t maxFrameLength = UINT_MAX)
+      : maxFrameLength_(maxFrameLength) {}
+
+  std::unique_ptr<IOBuf> decode(Context* ctx, IOBufQueue& buf,
+                                size_t& needed) override;
+
+ private:
+  uint64_t maxFrameLength_;
+  // Bytes still to drop of a frame that was too long
+  uint64_t discarding_{0};
+  bool corrupt_{false};
+};
+
+}} // namespace
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/codec/VarintLengthPrepender.h>
+
+#include <wangle/codec/VarintLengthFrameDecoder.h>
+
+#include <cstring>
+
+namespace folly { namespace wangle {
+
+size_t VarintLengthPrepender::writeVarint(uint8_t* dst, uint64_t length) {
+  size_t n = 0;
+  while (length >= 0x80) {
+    dst[n++] = uint8_t(length) | 0x80;
+    length >>= 7;
+  }
+  dst[n++] = uint8_t(length);
+  return n;
+}
+
+Future<Unit> VarintLengthPrepender::write(
+    Context* ctx, std::unique_ptr<IOBuf> buf) {
+  uint8_t varint[VarintLengthFrameDecoder::kMaxVarintLength];
+  auto n = writeVarint(varint, buf->computeChainDataLength());
+
+  if (buf->headroom() >= n && !buf->isSharedOne()) {
+    buf->prepend(n);
+    memcpy(buf->writableData(), varint, n);
+    return ctx->fireWrite(std::move(buf));
+  }
+
+  auto len = IOBuf::create(n);
+  memcpy(len->writableData(), varint, n);
+  len->append(n);
+  len->prependChain(std::move(buf));
+  return ctx->fireWrite(std::move(len));
+}
+
+}} // namespace
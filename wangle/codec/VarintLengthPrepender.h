@@ -0,0 +1,31 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/codec/ByteToMessageCodec.h>
+
+namespace folly { namespace wangle {
+
+/**
+ * An encoder prepending the length of each message as a base 128 varint,
+ * for VarintLengthFrameDecoder.  Like LengthFieldPrepender, it writes the
+ * length into the message's headroom when there's room and it isn't
+ * shared, as in buffers from LengthFieldPrepender::createWithHeadroom()
+ * for lengths of up to 2^56 bytes.
+ */
+class VarintLengthPrepender : public OutboundBytesToBytesHandler {
+ public:
+  Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf) override;
+
+  // Writes length as a varint at dst, returning its size
+  static size_t writeVarint(uint8_t* dst, uint64_t length);
+};
+
+}} // namespace
@@ -0,0 +1,333 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/WebSocketFrameCodec.h>
+
+#include <folly/Random.h>
+#include <folly/io/Cursor.h>
+
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace folly { namespace wangle {
+
+namespace {
+
+const uint8_t kFin = 0x80;
+const uint8_t kReserved = 0x70;
+const uint8_t kMasked = 0x80;
+
+bool isControl(WebSocketOpcode opcode) {
+  return uint8_t(opcode) & 0x8;
+}
+
+bool isValid(WebSocketOpcode opcode) {
+  switch (opcode) {
+    case WebSocketOpcode::CONTINUATION:
+    case WebSocketOpcode::TEXT:
+    case WebSocketOpcode::BINARY:
+    case WebSocketOpcode::CLOSE:
+    case WebSocketOpcode::PING:
+    case WebSocketOpcode::PONG:
+      return true;
+  }
+  return false;
+}
+
+}
+
+WebSocketFrame WebSocketFrame::close(WebSocketCloseCode code,
+                                     StringPiece reason) {
+  auto buf = IOBuf::create(2 + reason.size());
+  auto p = buf->writableData();
+  p[0] = uint16_t(code) >> 8;
+  p[1] = uint16_t(code);
+  memcpy(p + 2, reason.data(), reason.size());
+  buf->append(2 + reason.size());
+  return WebSocketFrame(WebSocketOpcode::CLOSE, std::move(buf));
+}
+
+WebSocketCloseCode WebSocketFrame::getCloseCode() const {
+  if (opcode != WebSocketOpcode::CLOSE || !payload ||
+      payload->computeChainDataLength() < 2) {
+    return WebSocketCloseCode::NO_STATUS;
+  }
+  return WebSocketCloseCode(io::Cursor(payload.get()).readBE<uint16_t>());
+}
+
+size_t WebSocketFrameCodec::mask(uint8_t* data, size_t length,
+                                 const uint8_t* key, size_t keyOffset) {
+  // The key, lined up with data
+  uint8_t k[8];
+  for (size_t i = 0; i < 8; i++) {
+    k[i] = key[(keyOffset + i) & 3];
+  }
+  size_t i = 0;
+#if defined(__AVX2__)
+  uint32_t k32;
+  memcpy(&k32, k, 4);
+  auto k256 = _mm256_set1_epi32(int(k32));
+  for (; i + 32 <= length; i += 32) {
+    auto p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), k256));
+  }
+#elif defined(__SSE2__)
+  uint32_t k32;
+  memcpy(&k32, k, 4);
+  auto k128 = _mm_set1_epi32(int(k32));
+  for (; i + 32 <= length; i += 32) {
+    auto p = reinterpret_cast<__m128i*>(data + i);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k128));
+    _mm_storeu_si128(p + 1, _mm_xor_si128(_mm_loadu_si128(p + 1), k128));
+  }
+#endif
+  uint64_t k64;
+  memcpy(&k64, k, 8);
+  for (; i + 8 <= length; i += 8) {
+    uint64_t v;
+    memcpy(&v, data + i, 8);
+    v ^= k64;
+    memcpy(data + i, &v, 8);
+  }
+  for (; i < length; i++) {
+    data[i] ^= k[i & 3];
+  }
+  return (keyOffset + length) & 3;
+}
+
+size_t WebSocketFrameCodec::writeHeader(uint8_t* out, WebSocketOpcode opcode,
+                                        uint64_t length, const uint8_t* key) {
+  size_t n = 2;
+  out[0] = kFin | uint8_t(opcode);
+  uint8_t maskBit = key ? kMasked : 0;
+  if (length < 126) {
+    out[1] = maskBit | length;
+  } else if (length <= 0xffff) {
+    out[1] = maskBit | 126;
+    out[2] = length >> 8;
+    out[3] = length;
+    n = 4;
+  } else {
+    out[1] = maskBit | 127;
+    for (int i = 0; i < 8; i++) {
+      out[2 + i] = length >> (56 - 8 * i);
+    }
+    n = 10;
+  }
+  if (key) {
+    memcpy(out + n, key, 4);
+    n += 4;
+  }
+  return n;
+}
+
+std::unique_ptr<IOBuf> WebSocketFrameCodec::encode(WebSocketFrame frame) {
+  uint64_t length =
+    frame.payload ? frame.payload->computeChainDataLength() : 0;
+  auto buf = IOBuf::create(kMaxHeaderSize);
+  buf->append(writeHeader(buf->writableData(), frame.opcode, length,
+                          nullptr));
+  if (length > 0) {
+    buf->prependChain(std::move(frame.payload));
+  }
+  return buf;
+}
+
+void WebSocketFrameCodec::read(Context* ctx, IOBufQueue& q) {
+  while (!failed_ && !closeRead_ && q.chainLength() >= 2) {
+    io::Cursor c(q.front());
+    auto b0 = c.read<uint8_t>();
+    auto b1 = c.read<uint8_t>();
+    bool fin = b0 & kFin;
+    auto opcode = WebSocketOpcode(b0 & 0xf);
+    bool masked = b1 & kMasked;
+    uint64_t length = b1 & 0x7f;
+    size_t headerSize = 2 + (length == 126 ? 2 : length == 127 ? 8 : 0) +
+      (masked ? 4 : 0);
+    if (q.chainLength() < headerSize) {
+      break;
+    }
+    if (length == 126) {
+      length = c.readBE<uint16_t>();
+    } else if (length == 127) {
+      length = c.readBE<uint64_t>();
+    }
+
+    if ((b0 & kReserved) || !isValid(opcode)) {
+      fail(ctx, WebSocketCloseCode::PROTOCOL_ERROR, "Bad frame header");
+      break;
+    }
+    if (masked != (direction_ == Direction::SERVER)) {
+      fail(ctx, WebSocketCloseCode::PROTOCOL_ERROR,
+           masked ? "Masked frame from the server"
+                  : "Unmasked frame from the client");
+      break;
+    }
+    if (isControl(opcode)) {
+      if (!fin || length > kMaxControlPayload) {
+        fail(ctx, WebSocketCloseCode::PROTOCOL_ERROR, "Bad control frame");
+        break;
+      }
+    } else if ((opcode == WebSocketOpcode::CONTINUATION) !=
+               (messageOpcode_ != WebSocketOpcode::CONTINUATION)) {
+      fail(ctx, WebSocketCloseCode::PROTOCOL_ERROR,
+           "Fragments out of order");
+      break;
+    } else if (length > maxMessageSize_ ||
+               message_.chainLength() + length > maxMessageSize_) {
+      // Before any of it is buffered
+      fail(ctx, WebSocketCloseCode::MESSAGE_TOO_BIG, "Message too long");
+      break;
+    }
+    if (q.chainLength() < headerSize + length) {
+      break;
+    }
+
+    uint8_t key[4];
+    if (masked) {
+      c.pull(key, 4);
+    }
+    q.trimStart(headerSize);
+    auto payload = length > 0 ? q.split(length) : IOBuf::create(0);
+    if (masked) {
+      bool shared = false;
+      auto buf = payload.get();
+      do {
+        shared = shared || buf->isShared();
+        buf = buf->next();
+      } while (buf != payload.get());
+      if (shared) {
+        // Someone else's bytes, or read-only ones, e.g. mapped by a
+        // zero-copy read, so unmasked into a copy
+        auto copy = IOBuf::create(length);
+        io::Cursor(payload.get()).pull(copy->writableData(), length);
+        copy->append(length);
+        payload = std::move(copy);
+      }
+      size_t offset = 0;
+      buf = payload.get();
+      do {
+        offset = mask(buf->writableData(), buf->length(), key, offset);
+        buf = buf->next();
+      } while (buf != payload.get());
+    }
+    readFrame(ctx, opcode, fin, std::move(payload));
+  }
+  if (failed_ || closeRead_) {
+    q.move();
+  }
+}
+
+void WebSocketFrameCodec::readFrame(Context* ctx, WebSocketOpcode opcode,
+                                    bool fin,
+                                    std::unique_ptr<IOBuf> payload) {
+  switch (opcode) {
+    case WebSocketOpcode::PING:
+      if (!closeSent_) {
+        write(ctx, WebSocketFrame(WebSocketOpcode::PONG, std::move(payload)));
+      }
+      return;
+    case WebSocketOpcode::CLOSE: {
+      if (payload->computeChainDataLength() == 1) {
+        fail(ctx, WebSocketCloseCode::PROTOCOL_ERROR, "Bad close frame");
+        return;
+      }
+      closeRead_ = true;
+      WebSocketFrame frame(opcode, std::move(payload));
+      if (!closeSent_) {
+        auto code = frame.getCloseCode();
+        write(ctx, code == WebSocketCloseCode::NO_STATUS
+                ? WebSocketFrame(WebSocketOpcode::CLOSE, nullptr)
+                : WebSocketFrame::close(code));
+      }
+      ctx->fireRead(std::move(frame));
+      return;
+    }
+    case WebSocketOpcode::PONG:
+      ctx->fireRead(WebSocketFrame(opcode, std::move(payload)));
+      return;
+    default:
+      break;
+  }
+
+  if (opcode != WebSocketOpcode::CONTINUATION) {
+    if (fin) {
+      // The usual case: a message in one frame
+      ctx->fireRead(WebSocketFrame(opcode, std::move(payload)));
+      return;
+    }
+    messageOpcode_ = opcode;
+    fragments_ = 0;
+  }
+  // Empty ones add nothing, and small ones little but a buffer each, so
+  // neither is bounded by maxMessageSize
+  if (!payload->empty()) {
+    if (++fragments_ > kMaxFragments) {
+      fail(ctx, WebSocketCloseCode::POLICY_VIOLATION,
+           "Too many fragments in a message");
+      return;
+    }
+    message_.append(std::move(payload));
+  }
+  if (fin) {
+    WebSocketFrame frame(messageOpcode_,
+                         message_.empty() ? IOBuf::create(0) :
+                                            message_.move());
+    messageOpcode_ = WebSocketOpcode::CONTINUATION;
+    ctx->fireRead(std::move(frame));
+  }
+}
+
+void WebSocketFrameCodec::fail(Context* ctx, WebSocketCloseCode code,
+                               const std::string& what) {
+  failed_ = true;
+  message_.move();
+  if (!closeSent_) {
+    write(ctx, WebSocketFrame::close(code));
+  }
+  ctx->fireReadException(make_exception_wrapper<WebSocketError>(code, what));
+}
+
+Future<Unit> WebSocketFrameCodec::write(Context* ctx, WebSocketFrame frame) {
+  if (frame.opcode == WebSocketOpcode::CLOSE) {
+    closeSent_ = true;
+  }
+  if (direction_ == Direction::SERVER) {
+    if (frame.encoded) {
+      return ctx->fireWrite(std::move(frame.payload));
+    }
+    return ctx->fireWrite(encode(std::move(frame)));
+  }
+
+  if (frame.encoded) {
+    return makeFuture<Unit>(std::invalid_argument(
+      "Clients have to mask what they write"));
+  }
+  // Masked into a copy, as the payload may be shared
+  uint64_t length =
+    frame.payload ? frame.payload->computeChainDataLength() : 0;
+  auto k32 = folly::Random::rand32();
+  uint8_t key[4];
+  memcpy(key, &k32, 4);
+  auto buf = IOBuf::create(kMaxHeaderSize + length);
+  auto out = buf->writableData();
+  auto n = writeHeader(out, frame.opcode, length, key);
+  if (length > 0) {
+    io::Cursor(frame.payload.get()).pull(out + n, length);
+    mask(out + n, length, key, 0);
+  }
+  buf->append(n + length);
+  return ctx->fireWrite(std::move(buf));
+}
+
+}} // namespace
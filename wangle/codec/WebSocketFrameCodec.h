@@ -0,0 +1,195 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+
+#include <folly/Range.h>
+
+#include <stdexcept>
+
+namespace folly { namespace wangle {
+
+enum class WebSocketOpcode : uint8_t {
+  CONTINUATION = 0x0,
+  TEXT = 0x1,
+  BINARY = 0x2,
+  CLOSE = 0x8,
+  PING = 0x9,
+  PONG = 0xa,
+};
+
+// Status codes of CLOSE frames (RFC 6455 7.4.1)
+enum class WebSocketCloseCode : uint16_t {
+  NORMAL = 1000,
+  GOING_AWAY = 1001,
+  PROTOCOL_ERROR = 1002,
+  UNSUPPORTED_DATA = 1003,
+  NO_STATUS = 1005,
+  INVALID_DATA = 1007,
+  POLICY_VIOLATION = 1008,
+  MESSAGE_TOO_BIG = 1009,
+  INTERNAL_ERROR = 1011,
+};
+
+/**
+ * A WebSocket connection error; the codec has sent a CLOSE frame with
+ * code already.
+ */
+class WebSocketError : public std::runtime_error {
+ public:
+  WebSocketError(WebSocketCloseCode code, const std::string& what)
+      : std::runtime_error(what), code_(code) {}
+
+  WebSocketCloseCode getCode() const {
+    return code_;
+  }
+
+ private:
+  WebSocketCloseCode code_;
+};
+
+/**
+ * A message, or control frame, as read and written by WebSocketFrameCodec.
+ * Messages read come whole, however they were fragmented, and unmasked.
+ */
+struct WebSocketFrame {
+  static WebSocketFrame text(std::unique_ptr<IOBuf> buf) {
+    return WebSocketFrame(WebSocketOpcode::TEXT, std::move(buf));
+  }
+
+  static WebSocketFrame binary(std::unique_ptr<IOBuf> buf) {
+    return WebSocketFrame(WebSocketOpcode::BINARY, std::move(buf));
+  }
+
+  static WebSocketFrame close(
+      WebSocketCloseCode code = WebSocketCloseCode::NORMAL,
+      StringPiece reason = StringPiece());
+
+  static WebSocketFrame ping(std::unique_ptr<IOBuf> buf = nullptr) {
+    return WebSocketFrame(WebSocketOpcode::PING, std::move(buf));
+  }
+
+  /**
+   * The bytes of a frame from WebSocketFrameCodec::encode(), written as
+   * they are; a server's way to send one message to many connections.
+   */
+  static WebSocketFrame preEncoded(std::unique_ptr<IOBuf> buf) {
+    WebSocketFrame frame(WebSocketOpcode::BINARY, std::move(buf));
+    frame.encoded = true;
+    return frame;
+  }
+
+  WebSocketFrame() = default;
+  WebSocketFrame(WebSocketOpcode op, std::unique_ptr<IOBuf> buf)
+      : opcode(op), payload(std::move(buf)) {}
+
+  // A CLOSE frame's status code, NO_STATUS if it has none
+  WebSocketCloseCode getCloseCode() const;
+
+  WebSocketOpcode opcode{WebSocketOpcode::BINARY};
+  // Null for none
+  std::unique_ptr<IOBuf> payload;
+  bool encoded{false};
+};
+
+/**
+ * Decodes the frames of a WebSocket connection, past the HTTP upgrade,
+ * into WebSocketFrames, and encodes those written (RFC 6455).
+ *
+ * A frame is split off the buffers it was read into once all of it is
+ * in, without coalescing, however its header and payload fall across
+ * them; the fragments of a message are chained together and handed on
+ * as one message when the last of them is in, up to maxMessageSize,
+ * with the control frames between them handed on as they come, and no
+ * more than kMaxFragments of them that aren't empty.  The server unmasks
+ * what the client sent in place, a 32-byte block at a time with SSE2 or
+ * AVX2 where there is one, unless a buffer is shared, when it unmasks a
+ * copy; the client masks what it writes into a copy, with a random key a
+ * frame.
+ *
+ * PINGs are answered with a PONG here; PONGs and CLOSEs are handed on,
+ * a CLOSE first answered with one, if we haven't sent ours, after which
+ * everything read is dropped.  TEXT messages aren't checked for UTF-8.
+ *
+ * Protocol errors, and messages over maxMessageSize, which fail as soon
+ * as the frame's header says so, send a CLOSE and fail with a
+ * WebSocketError read exception; the connection should be closed.
+ *
+ * To broadcast, encode each message once, with encode(), in the
+ * BroadcastHandler's processRead(), so that every subscriber writes the
+ * same encoded bytes: ObservingHandler writes them to the socket as they
+ * are, and a pipeline with the codec in it writes them as
+ * WebSocketFrame::preEncoded(buf->clone()).
+ */
+class WebSocketFrameCodec : public Handler<IOBufQueue&, WebSocketFrame,
+                                           WebSocketFrame,
+                                           std::unique_ptr<IOBuf>> {
+ public:
+  typedef typename Handler<
+   IOBufQueue&, WebSocketFrame,
+   WebSocketFrame, std::unique_ptr<IOBuf>>::Context Context;
+
+  enum class Direction {
+    SERVER,
+    CLIENT,
+  };
+
+  explicit WebSocketFrameCodec(Direction direction,
+                               uint64_t maxMessageSize = 16 * 1024 * 1024)
+      : direction_(direction),
+        maxMessageSize_(maxMessageSize) {}
+
+  void read(Context* ctx, IOBufQueue& q) override;
+
+  Future<Unit> write(Context* ctx, WebSocketFrame frame) override;
+
+  /**
+   * frame as a server sends it, unmasked and unfragmented: a header, with
+   * the payload chained on rather than copied.
+   */
+  static std::unique_ptr<IOBuf> encode(WebSocketFrame frame);
+
+  /**
+   * XORs length bytes at data with the 4-byte masking key, starting at
+   * byte keyOffset of it; returns the offset to carry on from, for a
+   * payload across several buffers.
+   */
+  static size_t mask(uint8_t* data, size_t length, const uint8_t* key,
+                     size_t keyOffset);
+
+ private:
+  static const size_t kMaxHeaderSize = 14;
+  static const size_t kMaxControlPayload = 125;
+  // Non-empty ones, in a message
+  static const size_t kMaxFragments = 4096;
+
+  // Writes a frame header to out, returning its length
+  static size_t writeHeader(uint8_t* out, WebSocketOpcode opcode,
+                            uint64_t length, const uint8_t* key);
+
+  void readFrame(Context* ctx, WebSocketOpcode opcode, bool fin,
+                 std::unique_ptr<IOBuf> payload);
+  void fail(Context* ctx, WebSocketCloseCode code, const std::string& what);
+
+  const Direction direction_;
+  const uint64_t maxMessageSize_;
+  bool failed_{false};
+  bool closeRead_{false};
+  bool closeSent_{false};
+
+  // A fragmented message, as far as it's been read
+  IOBufQueue message_{IOBufQueue::cacheChainLength()};
+  WebSocketOpcode messageOpcode_{WebSocketOpcode::CONTINUATION};
+  size_t fragments_{0};
+};
+
+}} // namespace
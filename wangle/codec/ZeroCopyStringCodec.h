@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+
+#include <folly/Range.h>
+
+namespace folly { namespace wangle {
+
+/*
+ * The text of a frame, as a StringPiece into the buffer it was read into,
+ * which it keeps alive.
+ */
+class StringFrame {
+ public:
+  explicit StringFrame(std::unique_ptr<IOBuf> buf)
+      : buf_(std::move(buf)) {
+    DCHECK(!buf_->isChained());
+  }
+
+  StringPiece str() const {
+    return StringPiece(reinterpret_cast<const char*>(buf_->data()),
+                       buf_->length());
+  }
+
+  operator StringPiece() const {
+    return str();
+  }
+
+  // A copy, for when the text has to outlive the buffer
+  std::string toString() const {
+    return str().str();
+  }
+
+  std::unique_ptr<IOBuf> releaseBuffer() {
+    return std::move(buf_);
+  }
+
+ private:
+  std::unique_ptr<IOBuf> buf_;
+};
+
+/*
+ * ZeroCopyStringCodec converts a pipeline from IOBufs to StringFrames on
+ * the way in and from std::strings on the way out, without the copies
+ * StringCodec makes.  A frame read in one buffer is handed on as is; only
+ * one split over several buffers is coalesced.  A string written is moved
+ * into the IOBuf's ownership, unless it's shorter than kCopyThreshold,
+ * where a copy is cheaper than the extra allocation.
+ */
+class ZeroCopyStringCodec
+    : public Handler<std::unique_ptr<IOBuf>, StringFrame,
+                     std::string, std::unique_ptr<IOBuf>> {
+ public:
+  typedef typename Handler<
+   std::unique_ptr<IOBuf>, StringFrame,
+   std::string, std::unique_ptr<IOBuf>>::Context Context;
+
+  static const size_t kCopyThreshold = 256;
+
+  void read(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    if (buf->isChained()) {
+      buf->coalesce();
+    }
+    ctx->fireRead(StringFrame(std::move(buf)));
+  }
+
+  Future<Unit> write(Context* ctx, std::string msg) override {
+    if (msg.size() < kCopyThreshold) {
+      return ctx->fireWrite(IOBuf::copyBuffer(msg.data(), msg.size()));
+    }
+    auto owned = new std::string(std::move(msg));
+    auto buf = IOBuf::takeOwnership(
+      &(*owned)[0], owned->size(),
+      [] (void*, void* userData) {
+        delete static_cast<std::string*>(userData);
+      },
+      owned);
+    return ctx->fireWrite(std::move(buf));
+  }
+};
+
+}} // namespace
@@ -0,0 +1,158 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/AffinityThreadFactory.h>
+
+#include <folly/FileUtil.h>
+#include <folly/MoveWrapper.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace folly { namespace wangle {
+
+#ifdef __linux__
+// From linux/mempolicy.h
+static const int kMpolPreferred = 1;
+#endif
+
+// CPUs in a sysfs cpu list file, e.g. "0-3,8-11"; empty if unreadable
+static std::vector<int> readCpuList(const char* path) {
+  std::vector<int> cpus;
+  std::string cpulist;
+  if (!folly::readFile(path, cpulist)) {
+    return cpus;
+  }
+  std::vector<folly::StringPiece> ranges;
+  folly::split(',', folly::trimWhitespace(cpulist), ranges);
+  for (auto range : ranges) {
+    if (range.empty()) {
+      continue;
+    }
+    folly::StringPiece first, last;
+    if (folly::split('-', range, first, last)) {
+      for (int cpu = folly::to<int>(first); cpu <= folly::to<int>(last);
+           cpu++) {
+        cpus.push_back(cpu);
+      }
+    } else {
+      cpus.push_back(folly::to<int>(range));
+    }
+  }
+  return cpus;
+}
+
+AffinityThreadFactory::AffinityThreadFactory(
+    folly::StringPiece prefix,
+    std::vector<int> cpus)
+  : NamedThreadFactory(prefix) {
+  for (auto cpu : cpus) {
+    placements_.push_back(Placement{{cpu}, -1});
+  }
+}
+
+AffinityThreadFactory::AffinityThreadFactory(
+    folly::StringPiece prefix,
+    std::vector<Placement> placements)
+  : NamedThreadFactory(prefix),
+    placements_(std::move(placements)) {}
+
+std::shared_ptr<AffinityThreadFactory> AffinityThreadFactory::forNumaNodes(
+    folly::StringPiece prefix,
+    const std::vector<int>& nodes,
+    bool localMemory) {
+  std::vector<Placement> placements;
+  for (auto node : nodes) {
+    auto cpus = getNumaNodeCpus(node);
+    if (cpus.empty()) {
+      LOG(WARNING) << "No CPUs found for NUMA node " << node;
+      continue;
+    }
+    placements.push_back(Placement{std::move(cpus), localMemory ? node : -1});
+  }
+  return std::shared_ptr<AffinityThreadFactory>(
+      new AffinityThreadFactory(prefix, std::move(placements)));
+}
+
+std::thread AffinityThreadFactory::newThread(Func&& func) {
+  if (placements_.empty()) {
+    return NamedThreadFactory::newThread(std::move(func));
+  }
+  auto placement = placements_[nextPlacement_++ % placements_.size()];
+  auto moveFunc = folly::makeMoveWrapper(std::move(func));
+  return NamedThreadFactory::newThread([placement, moveFunc]() mutable {
+    place(placement);
+    (*moveFunc)();
+  });
+}
+
+void AffinityThreadFactory::place(const Placement& placement) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (auto cpu : placement.cpus) {
+    CPU_SET(cpu, &set);
+  }
+  int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rc != 0) {
+    LOG(ERROR) << "Failed to set thread affinity: " << folly::errnoStr(rc);
+  }
+
+  if (placement.memoryNode >= 0) {
+    unsigned long mask = 0;
+    bool preferred = false;
+    if (placement.memoryNode < int(sizeof(mask) * 8)) {
+      mask = 1UL << placement.memoryNode;
+      // The kernel ignores the last bit of maxnode, hence the + 1
+      preferred = syscall(SYS_set_mempolicy, kMpolPreferred, &mask,
+                          sizeof(mask) * 8 + 1) == 0;
+    }
+    if (!preferred) {
+      LOG(ERROR) << "Failed to prefer memory of NUMA node "
+                 << placement.memoryNode;
+    }
+  }
+#endif
+}
+
+std::vector<int> AffinityThreadFactory::getNumaNodeCpus(int node) {
+  auto path = folly::to<std::string>(
+      "/sys/devices/system/node/node", node, "/cpulist");
+  return readCpuList(path.c_str());
+}
+
+std::vector<int> AffinityThreadFactory::getIsolatedCpus() {
+  return readCpuList("/sys/devices/system/cpu/isolated");
+}
+
+std::vector<int> AffinityThreadFactory::getThreadCpus(
+    std::thread::native_handle_type t) {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(t, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+#endif
+  return cpus;
+}
+
+}} // folly::wangle
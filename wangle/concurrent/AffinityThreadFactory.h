@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <wangle/concurrent/NamedThreadFactory.h>
+
+namespace folly { namespace wangle {
+
+/*
+ * A NamedThreadFactory that also pins each new thread to a set of CPUs
+ * before running its function, so anything the thread allocates on startup
+ * (its EventBase, for example) is first touched on the right node.
+ *
+ * Threads are placed round robin: with a CPU list, thread i is pinned to
+ * cpus[i % cpus.size()]; with a list of NUMA nodes, thread i may run on any
+ * CPU of nodes[i % nodes.size()] and, if localMemory is set, prefers that
+ * node's memory.
+ *
+ * The resulting placement can be read back from the
+ * ThreadPoolExecutor::ThreadHandle of each pool thread.
+ *
+ * Only supported on Linux; elsewhere threads are created unpinned.
+ */
+class AffinityThreadFactory : public NamedThreadFactory {
+ public:
+  AffinityThreadFactory(folly::StringPiece prefix, std::vector<int> cpus);
+
+  static std::shared_ptr<AffinityThreadFactory> forNumaNodes(
+      folly::StringPiece prefix,
+      const std::vector<int>& nodes,
+      bool localMemory = true);
+
+  std::thread newThread(Func&& func) override;
+
+  // CPUs of a NUMA node, from /sys/devices/system/node; empty if unknown
+  static std::vector<int> getNumaNodeCpus(int node);
+
+  // CPUs kept from the scheduler with isolcpus=, e.g. for spinning threads
+  static std::vector<int> getIsolatedCpus();
+
+  // CPUs the given thread is allowed to run on; empty if unknown
+  static std::vector<int> getThreadCpus(std::thread::native_handle_type t);
+
+ private:
+  struct Placement {
+    std::vector<int> cpus;
+    // Node to prefer for memory allocations, or -1
+    int memoryNode;
+  };
+
+  AffinityThreadFactory(
+      folly::StringPiece prefix,
+      std::vector<Placement> placements);
+
+  static void place(const Placement& placement);
+
+  std::vector<Placement> placements_;
+  std::atomic<size_t> nextPlacement_{0};
+};
+
+}} // folly::wangle
@@ -12,8 +12,25 @@
 
 #include <glog/logging.h>
 
+#include <exception>
+#include <vector>
+
 namespace folly { namespace wangle {
 
+// Thrown when adding to a bounded queue that is full.  It only carries a
+// static message, so throwing it under overload doesn't allocate.
+class QueueFullException : public std::exception {
+ public:
+  explicit QueueFullException(const char* what) : what_(what) {}
+
+  const char* what() const noexcept override {
+    return what_;
+  }
+
+ private:
+  const char* what_;
+};
+
 template <class T>
 class BlockingQueue {
  public:
@@ -22,11 +39,37 @@ class BlockingQueue {
   virtual void addWithPriority(T item, int8_t priority) {
     add(std::move(item));
   }
+  // Like add() and addWithPriority(), but return false instead of throwing
+  // if the queue is full, in which case item is left untouched.  Unbounded
+  // queues don't need to override these.
+  virtual bool tryAdd(T& item) {
+    add(std::move(item));
+    return true;
+  }
+  virtual bool tryAddWithPriority(T& item, int8_t priority) {
+    return tryAdd(item);
+  }
+  // Removes the item that has been queued longest at the given priority
+  // without blocking.  Returns false if there is none, or if the queue
+  // doesn't support it.
+  virtual bool tryTakeOldest(T& item, int8_t priority) {
+    return false;
+  }
+  // Queues should override this to wake consumers once for the whole batch
+  virtual void addBatch(std::vector<T> items) {
+    for (auto& item : items) {
+      add(std::move(item));
+    }
+  }
   virtual uint8_t getNumPriorities() {
     return 1;
   }
   virtual T take() = 0;
   virtual size_t size() = 0;
+  // Number of items queued at priorities higher than the given one
+  virtual size_t sizeAbove(int8_t priority) {
+    return 0;
+  }
 };
 
 }} // folly::wangle
@@ -10,9 +10,24 @@
 
 #include <wangle/concurrent/CPUThreadPoolExecutor.h>
 #include <wangle/concurrent/PriorityLifoSemMPMCQueue.h>
+#include <folly/detail/MemoryIdler.h>
+
+#include <limits>
+#include <thread>
 
 namespace folly { namespace wangle {
 
+using folly::detail::MemoryIdler;
+
+namespace {
+
+int64_t steadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
 const size_t CPUThreadPoolExecutor::kDefaultMaxQueueSize = 1 << 14;
 
 CPUThreadPoolExecutor::CPUThreadPoolExecutor(
@@ -63,6 +78,8 @@ CPUThreadPoolExecutor::CPUThreadPoolExecutor(
           std::move(threadFactory)) {}
 
 CPUThreadPoolExecutor::~CPUThreadPoolExecutor() {
+  disableAutoscaling();
+  setIdleMemoryRelease(std::chrono::milliseconds(0));
   stop();
   CHECK(threadsToStop_ == 0);
 }
@@ -75,9 +92,30 @@ void CPUThreadPoolExecutor::add(
     Func func,
     std::chrono::milliseconds expiration,
     Func expireCallback) {
-  // TODO handle enqueue failure, here and in other add() callsites
-  taskQueue_->add(
-      CPUTask(std::move(func), expiration, std::move(expireCallback)));
+  addTask(
+      CPUTask(std::move(func), expiration, std::move(expireCallback)),
+      false,
+      Executor::MID_PRI);
+}
+
+void CPUThreadPoolExecutor::addTaskFunc(
+    TaskFunc func,
+    std::chrono::milliseconds expiration,
+    Func expireCallback) {
+  addTask(
+      CPUTask(std::move(func), expiration, std::move(expireCallback)),
+      false,
+      Executor::MID_PRI);
+}
+
+void CPUThreadPoolExecutor::addBatch(std::vector<Func>&& funcs) {
+  std::vector<CPUTask> tasks;
+  tasks.reserve(funcs.size());
+  for (auto& func : funcs) {
+    tasks.emplace_back(std::move(func), std::chrono::milliseconds(0), nullptr);
+  }
+  funcs.clear();
+  taskQueue_->addBatch(std::move(tasks));
 }
 
 void CPUThreadPoolExecutor::addWithPriority(Func func, int8_t priority) {
@@ -90,11 +128,97 @@ void CPUThreadPoolExecutor::add(
     std::chrono::milliseconds expiration,
     Func expireCallback) {
   CHECK(getNumPriorities() > 0);
-  taskQueue_->addWithPriority(
+  addTask(
       CPUTask(std::move(func), expiration, std::move(expireCallback)),
+      true,
       priority);
 }
 
+void CPUThreadPoolExecutor::addTask(
+    CPUTask task,
+    bool withPriority,
+    int8_t priority) {
+  if (UNLIKELY(!tryAddTask(task, withPriority, priority)) &&
+      !handleQueueFull(task, withPriority, priority)) {
+    rejectedCount_++;
+    throw QueueFullException("CPUThreadPoolExecutor queue full");
+  }
+}
+
+bool CPUThreadPoolExecutor::tryAddTask(
+    CPUTask& task,
+    bool withPriority,
+    int8_t priority) {
+  return withPriority ?
+    taskQueue_->tryAddWithPriority(task, priority) :
+    taskQueue_->tryAdd(task);
+}
+
+bool CPUThreadPoolExecutor::handleQueueFull(
+    CPUTask& task,
+    bool withPriority,
+    int8_t priority) {
+  switch (queueFullPolicy_.load(std::memory_order_relaxed)) {
+    case QueueFullPolicy::THROW:
+      return false;
+
+    case QueueFullPolicy::BLOCK: {
+      blockedCount_++;
+      auto timeout = std::chrono::milliseconds(blockTimeoutMs_.load());
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+      // MPMCQueue has no timed write, so poll with a bounded backoff
+      auto backoff = std::chrono::microseconds(1);
+      while (!tryAddTask(task, withPriority, priority)) {
+        if (timeout.count() > 0 &&
+            std::chrono::steady_clock::now() >= deadline) {
+          return false;
+        }
+        std::this_thread::sleep_for(backoff);
+        backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+      }
+      return true;
+    }
+
+    case QueueFullPolicy::CALLER_RUNS:
+      callerRunsCount_++;
+      task.func_();
+      return true;
+
+    case QueueFullPolicy::DROP_OLDEST: {
+      CPUTask oldest;
+      while (taskQueue_->tryTakeOldest(oldest, priority)) {
+        if (UNLIKELY(oldest.poison)) {
+          // Never drop a thread's stop request; put it back and give up
+          while (!taskQueue_->tryAddWithPriority(oldest, priority)) {
+            std::this_thread::yield();
+          }
+          return false;
+        }
+        droppedCount_++;
+        if (oldest.expireCallback_ != nullptr) {
+          oldest.expireCallback_();
+        }
+        // Another add() may have taken the freed slot, so keep dropping
+        if (tryAddTask(task, withPriority, priority)) {
+          return true;
+        }
+      }
+      return false;
+    }
+  }
+  return false;
+}
+
+CPUThreadPoolExecutor::QueueFullStats
+CPUThreadPoolExecutor::getQueueFullStats() {
+  QueueFullStats stats;
+  stats.rejected = rejectedCount_.load(std::memory_order_relaxed);
+  stats.blocked = blockedCount_.load(std::memory_order_relaxed);
+  stats.callerRuns = callerRunsCount_.load(std::memory_order_relaxed);
+  stats.dropped = droppedCount_.load(std::memory_order_relaxed);
+  return stats;
+}
+
 uint8_t CPUThreadPoolExecutor::getNumPriorities() const {
   return taskQueue_->getNumPriorities();
 }
@@ -104,11 +228,35 @@ CPUThreadPoolExecutor::getTaskQueue() {
   return taskQueue_.get();
 }
 
+ThreadPoolExecutor::ThreadPtr CPUThreadPoolExecutor::makeThread() {
+  return std::make_shared<CPUThread>(this);
+}
+
 void CPUThreadPoolExecutor::threadRun(std::shared_ptr<Thread> thread) {
+  auto cpuThread = static_cast<CPUThread*>(thread.get());
   thread->startupBaton.post();
   while (1) {
+    const bool trackIdle =
+      idleReleaseTimeoutMs_.load(std::memory_order_relaxed) > 0;
+    if (trackIdle) {
+      cpuThread->waitingSinceNs.store(steadyNowNs(), std::memory_order_relaxed);
+    }
     auto task = taskQueue_->take();
+    const int64_t waitingSince = trackIdle ?
+      cpuThread->waitingSinceNs.exchange(0, std::memory_order_relaxed) : 0;
+    if (UNLIKELY(task.idleProbe)) {
+      releaseIdleMemory(cpuThread, waitingSince);
+      continue;
+    }
     if (UNLIKELY(task.poison)) {
+      // A queue with starvation protection can hand out a poison pill
+      // while work is still queued above it; put the pill back behind it
+      if (isJoin_ && taskQueue_->sizeAbove(Executor::LO_PRI) > 0) {
+        while (!taskQueue_->tryAddWithPriority(task, Executor::LO_PRI)) {
+          std::this_thread::yield();
+        }
+        continue;
+      }
       CHECK(threadsToStop_-- > 0);
       for (auto& o : observers_) {
         o->threadStopped(thread.get());
@@ -117,7 +265,21 @@ void CPUThreadPoolExecutor::threadRun(std::shared_ptr<Thread> thread) {
       stoppedThreads_.add(thread);
       return;
     } else {
-      runTask(thread, std::move(task));
+      if (autoscaling_.load(std::memory_order_relaxed)) {
+        int64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - task.enqueueTime_).count();
+        // Racy, but only has to be roughly right
+        if (wait > maxWaitNs_.load(std::memory_order_relaxed)) {
+          maxWaitNs_.store(wait, std::memory_order_relaxed);
+        }
+      }
+      if (trackIdle) {
+        cpuThread->memoryReleased.store(false, std::memory_order_relaxed);
+      }
+      runTask(
+          thread,
+          std::move(task),
+          codelEnabled_.load(std::memory_order_relaxed) ? &codel_ : nullptr);
     }
 
     if (UNLIKELY(threadsToStop_ > 0 && !isJoin_)) {
@@ -131,6 +293,179 @@ void CPUThreadPoolExecutor::threadRun(std::shared_ptr<Thread> thread) {
   }
 }
 
+void CPUThreadPoolExecutor::setAutoscaling(
+    size_t minThreads,
+    size_t maxThreads,
+    std::chrono::milliseconds targetWaitTime,
+    std::chrono::milliseconds idleTimeout) {
+  CHECK(minThreads <= maxThreads);
+  CHECK(targetWaitTime > std::chrono::milliseconds(0));
+  std::lock_guard<std::mutex> guard(autoscaleMutex_);
+  autoscaleMinThreads_ = minThreads;
+  autoscaleMaxThreads_ = maxThreads;
+  autoscaleTargetWait_ = targetWaitTime;
+  autoscaleIdleTimeout_ = idleTimeout;
+  if (!autoscaleRunning_) {
+    autoscaleRunning_ = true;
+    autoscaling_ = true;
+    autoscaleThread_ = std::thread([this]() { autoscaleRun(); });
+  }
+}
+
+void CPUThreadPoolExecutor::disableAutoscaling() {
+  {
+    std::lock_guard<std::mutex> guard(autoscaleMutex_);
+    if (!autoscaleRunning_) {
+      return;
+    }
+    autoscaleRunning_ = false;
+    autoscaling_ = false;
+  }
+  autoscaleCv_.notify_all();
+  autoscaleThread_.join();
+}
+
+void CPUThreadPoolExecutor::autoscaleRun() {
+  auto windowStart = std::chrono::steady_clock::now();
+  auto minIdle = std::numeric_limits<size_t>::max();
+  std::unique_lock<std::mutex> lock(autoscaleMutex_);
+  while (autoscaleRunning_) {
+    auto minThreads = autoscaleMinThreads_;
+    auto maxThreads = autoscaleMaxThreads_;
+    auto targetWait = autoscaleTargetWait_;
+    auto idleTimeout = autoscaleIdleTimeout_;
+    lock.unlock();
+
+    {
+      RWSpinLock::WriteHolder guard(&threadListLock_);
+      const auto n = threadList_.get().size();
+      size_t idle = 0;
+      for (auto& thread : threadList_.get()) {
+        if (thread->idle) {
+          idle++;
+        }
+      }
+      const auto pending = getPendingTaskCount();
+      const std::chrono::nanoseconds maxWait(
+          maxWaitNs_.exchange(0, std::memory_order_relaxed));
+      const auto now = std::chrono::steady_clock::now();
+
+      if (n < minThreads) {
+        addThreads(minThreads - n);
+      } else if (n > maxThreads) {
+        // Joining, so only idle threads, through poison pills, go away
+        removeThreads(n - maxThreads, true);
+      } else if ((maxWait > targetWait || n == 0) && pending > 0 &&
+                 n < maxThreads) {
+        addThreads(std::min<uint64_t>(
+            maxThreads - n,
+            std::max<uint64_t>(1, std::min<uint64_t>(n, pending))));
+        windowStart = now;
+        minIdle = std::numeric_limits<size_t>::max();
+      } else {
+        minIdle = std::min(minIdle, idle);
+        if (now - windowStart >= idleTimeout) {
+          if (minIdle > 0 && n > minThreads) {
+            removeThreads(std::min(minIdle, n - minThreads), true);
+          }
+          windowStart = now;
+          minIdle = std::numeric_limits<size_t>::max();
+        }
+      }
+    }
+
+    lock.lock();
+    autoscaleCv_.wait_for(lock, targetWait, [&]() {
+      return !autoscaleRunning_;
+    });
+  }
+}
+
+void CPUThreadPoolExecutor::releaseIdleMemory(
+    CPUThread* thread,
+    int64_t waitingSinceNs) {
+  const int64_t timeoutNs = std::chrono::duration_cast<
+    std::chrono::nanoseconds>(std::chrono::milliseconds(
+      idleReleaseTimeoutMs_.load(std::memory_order_relaxed))).count();
+  if (waitingSinceNs == 0 || timeoutNs == 0 ||
+      thread->memoryReleased.load(std::memory_order_relaxed) ||
+      steadyNowNs() - waitingSinceNs < timeoutNs) {
+    return;
+  }
+  MemoryIdler::flushLocalMallocCaches();
+  MemoryIdler::unmapUnusedStack(MemoryIdler::kDefaultStackToRetain);
+  thread->memoryReleased.store(true, std::memory_order_relaxed);
+  idleReleaseCount_++;
+}
+
+void CPUThreadPoolExecutor::setIdleMemoryRelease(
+    std::chrono::milliseconds idleTimeout) {
+  {
+    std::lock_guard<std::mutex> guard(idleReleaseMutex_);
+    idleReleaseTimeoutMs_ = idleTimeout.count();
+    if (idleTimeout.count() > 0) {
+      if (!idleReleaseRunning_) {
+        idleReleaseRunning_ = true;
+        idleReleaseThread_ = std::thread([this]() { idleReleaseRun(); });
+      }
+      return;
+    }
+    if (!idleReleaseRunning_) {
+      return;
+    }
+    idleReleaseRunning_ = false;
+  }
+  idleReleaseCv_.notify_all();
+  idleReleaseThread_.join();
+}
+
+void CPUThreadPoolExecutor::idleReleaseRun() {
+  std::unique_lock<std::mutex> lock(idleReleaseMutex_);
+  while (idleReleaseRunning_) {
+    const std::chrono::milliseconds timeout(idleReleaseTimeoutMs_.load());
+    lock.unlock();
+
+    size_t waiting = 0;
+    bool overdue = false;
+    {
+      RWSpinLock::ReadHolder guard(&threadListLock_);
+      const auto now = steadyNowNs();
+      const auto timeoutNs =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+      for (auto& thread : threadList_.get()) {
+        auto cpuThread = static_cast<CPUThread*>(thread.get());
+        auto since = cpuThread->waitingSinceNs.load(std::memory_order_relaxed);
+        if (since == 0) {
+          continue;
+        }
+        waiting++;
+        if (!cpuThread->memoryReleased.load(std::memory_order_relaxed) &&
+            now - since >= timeoutNs) {
+          overdue = true;
+        }
+      }
+    }
+    // The queue wakes the most recent waiters first, so an overdue thread
+    // is only reached by waking every waiting thread
+    if (overdue) {
+      for (size_t i = 0; i < waiting; i++) {
+        CPUTask probe(nullptr, std::chrono::milliseconds(0), nullptr);
+        probe.idleProbe = true;
+        if (!taskQueue_->tryAddWithPriority(probe, Executor::LO_PRI)) {
+          // A full queue has no idle threads to wake
+          break;
+        }
+      }
+    }
+
+    lock.lock();
+    idleReleaseCv_.wait_for(
+        lock,
+        std::max(timeout / 2, std::chrono::milliseconds(1)),
+        [&]() { return !idleReleaseRunning_; });
+  }
+}
+
 void CPUThreadPoolExecutor::stopThreads(size_t n) {
   CHECK(stoppedThreads_.size() == 0);
   threadsToStop_ = n;
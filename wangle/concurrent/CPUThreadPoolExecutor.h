@@ -12,12 +12,18 @@
 
 #include <wangle/concurrent/ThreadPoolExecutor.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace folly { namespace wangle {
 
 class CPUThreadPoolExecutor : public ThreadPoolExecutor {
  public:
   struct CPUTask;
 
+  // The other constructors' queues allocate their full capacity up front;
+  // queues of SegmentedMPMCQueues only allocate what they hold
   CPUThreadPoolExecutor(
       size_t numThreads,
       std::unique_ptr<BlockingQueue<CPUTask>> taskQueue,
@@ -50,6 +56,13 @@ CPUThreadPoolExecutor(
       std::chrono::milliseconds expiration,
       Func expireCallback = nullptr) override;
 
+  void addTaskFunc(
+      TaskFunc func,
+      std::chrono::milliseconds expiration = std::chrono::milliseconds(0),
+      Func expireCallback = nullptr) override;
+
+  void addBatch(std::vector<Func>&& funcs) override;
+
   void addWithPriority(Func func, int8_t priority) override;
   void add(
       Func func,
@@ -59,21 +72,116 @@ CPUThreadPoolExecutor(
 
   uint8_t getNumPriorities() const override;
 
+  /*
+   * Admission control for overload: with codel enabled, every dequeued
+   * task's queueing delay is fed to a Codel instance, and while it reports
+   * overload, tasks that were added with an expireCallback are shed by
+   * calling it instead of running them.  Tasks added without one can't be
+   * told they were dropped, so they always run.
+   */
+  void setCodelEnabled(bool enabled) {
+    codelEnabled_ = enabled;
+  }
+
+  // 0 = no queueing delay, 100 = at the codel limit; see Codel::getLoad()
+  int getCodelLoad() {
+    return codel_.getLoad();
+  }
+
+  /*
+   * What add() does when the task queue is full:
+   *  - THROW: throws QueueFullException (the default)
+   *  - BLOCK: waits up to blockTimeout (forever if 0) for room, then throws
+   *  - CALLER_RUNS: runs the task on the calling thread instead
+   *  - DROP_OLDEST: expires the task queued longest at the same priority,
+   *    calling its expireCallback, to make room.  Throws if the queue
+   *    doesn't support it.
+   * addBatch() always throws.
+   */
+  enum class QueueFullPolicy {
+    THROW,
+    BLOCK,
+    CALLER_RUNS,
+    DROP_OLDEST,
+  };
+
+  void setQueueFullPolicy(
+      QueueFullPolicy policy,
+      std::chrono::milliseconds blockTimeout = std::chrono::milliseconds(0)) {
+    queueFullPolicy_ = policy;
+    blockTimeoutMs_ = blockTimeout.count();
+  }
+
+  // How often each QueueFullPolicy action was taken
+  struct QueueFullStats {
+    QueueFullStats() : rejected(0), blocked(0), callerRuns(0), dropped(0) {}
+    uint64_t rejected, blocked, callerRuns, dropped;
+  };
+
+  QueueFullStats getQueueFullStats();
+
+  /*
+   * Resize the pool automatically between minThreads and maxThreads.
+   *
+   * Every targetWaitTime, if some task waited longer than that in the
+   * queue since the last check and tasks are still pending, threads are
+   * added: one per pending task, but at most doubling the pool.  Threads
+   * that stayed idle for a whole idleTimeout without the pool growing are
+   * retired.  Explicit setNumThreads() calls are overridden at the next
+   * check.
+   */
+  void setAutoscaling(
+      size_t minThreads,
+      size_t maxThreads,
+      std::chrono::milliseconds targetWaitTime,
+      std::chrono::milliseconds idleTimeout);
+
+  // Stops resizing, keeping the current number of threads
+  void disableAutoscaling();
+
+  /*
+   * Give back the memory that idle threads pin: once a thread has waited
+   * idleTimeout for work, it flushes its malloc thread cache and madvises
+   * away the unused part of its stack, as IOThreadPoolExecutor threads do
+   * when their event loop idles.  It does so once per idle period.
+   *
+   * Threads blocked in the task queue can't time out, so a control thread
+   * checks every idleTimeout / 2 and, if some thread is overdue, wakes all
+   * waiting threads with placeholder tasks; only the overdue ones release
+   * anything.  0 disables this.
+   */
+  void setIdleMemoryRelease(std::chrono::milliseconds idleTimeout);
+
+  // Number of times a thread gave its memory back
+  uint64_t getIdleMemoryReleaseCount() {
+    return idleReleaseCount_.load(std::memory_order_relaxed);
+  }
+
   struct CPUTask : public ThreadPoolExecutor::Task {
     // Must be noexcept move constructible so it can be used in MPMCQueue
     explicit CPUTask(
-        Func&& f,
+        TaskFunc&& f,
         std::chrono::milliseconds expiration,
         Func&& expireCallback)
       : Task(std::move(f), expiration, std::move(expireCallback)),
-        poison(false) {}
+        poison(false),
+        idleProbe(false) {}
     CPUTask()
       : Task(nullptr, std::chrono::milliseconds(0), nullptr),
-        poison(true) {}
-    CPUTask(CPUTask&& o) noexcept : Task(std::move(o)), poison(o.poison) {}
-    CPUTask(const CPUTask&) = default;
-    CPUTask& operator=(const CPUTask&) = default;
+        poison(true),
+        idleProbe(false) {
+      // Whatever request stops the pool, its thread's pill never expires
+      expiration_ = std::chrono::milliseconds(0);
+      deadline_ = RequestDeadline::none();
+    }
+    CPUTask(CPUTask&& o) noexcept
+      : Task(std::move(o)),
+        poison(o.poison),
+        idleProbe(o.idleProbe) {}
+    CPUTask& operator=(CPUTask&&) = default;
     bool poison;
+    // Only wakes the thread that takes it, see setIdleMemoryRelease()
+    bool idleProbe;
   };
 
   static const size_t kDefaultMaxQueueSize;
@@ -82,12 +190,63 @@ CPUThreadPoolExecutor(
   BlockingQueue<CPUTask>* getTaskQueue();
 
  private:
+  struct CPUThread : public Thread {
+    explicit CPUThread(CPUThreadPoolExecutor* pool)
+      : Thread(pool),
+        waitingSinceNs(0),
+        memoryReleased(false) {}
+    // steady_clock time this thread started waiting for a task, 0 if it
+    // isn't waiting
+    std::atomic<int64_t> waitingSinceNs;
+    // Set once it gave its memory back, until it runs a task again
+    std::atomic<bool> memoryReleased;
+  };
+
+  ThreadPtr makeThread() override;
+
+  void addTask(CPUTask task, bool withPriority, int8_t priority);
+  bool tryAddTask(CPUTask& task, bool withPriority, int8_t priority);
+  // Returns false if task should be rejected
+  bool handleQueueFull(CPUTask& task, bool withPriority, int8_t priority);
+
   void threadRun(ThreadPtr thread) override;
+  void autoscaleRun();
+  void idleReleaseRun();
+  void releaseIdleMemory(CPUThread* thread, int64_t waitingSinceNs);
   void stopThreads(size_t n) override;
   uint64_t getPendingTaskCount() override;
 
   std::unique_ptr<BlockingQueue<CPUTask>> taskQueue_;
   std::atomic<ssize_t> threadsToStop_{0};
+  std::atomic<bool> codelEnabled_{false};
+  Codel codel_;
+  std::atomic<QueueFullPolicy> queueFullPolicy_{QueueFullPolicy::THROW};
+  std::atomic<int64_t> blockTimeoutMs_{0};
+  std::atomic<uint64_t> rejectedCount_{0};
+  std::atomic<uint64_t> blockedCount_{0};
+  std::atomic<uint64_t> callerRunsCount_{0};
+  std::atomic<uint64_t> droppedCount_{0};
+
+  // Guards the autoscale settings below it
+  std::mutex autoscaleMutex_;
+  std::condition_variable autoscaleCv_;
+  bool autoscaleRunning_{false};
+  size_t autoscaleMinThreads_{0};
+  size_t autoscaleMaxThreads_{0};
+  std::chrono::milliseconds autoscaleTargetWait_{0};
+  std::chrono::milliseconds autoscaleIdleTimeout_{0};
+  std::thread autoscaleThread_;
+  std::atomic<bool> autoscaling_{false};
+  // Longest queueing delay seen since the last autoscale check
+  std::atomic<int64_t> maxWaitNs_{0};
+
+  // Guards the idle release settings below it
+  std::mutex idleReleaseMutex_;
+  std::condition_variable idleReleaseCv_;
+  bool idleReleaseRunning_{false};
+  std::thread idleReleaseThread_;
+  std::atomic<int64_t> idleReleaseTimeoutMs_{0};
+  std::atomic<uint64_t> idleReleaseCount_{0};
 };
 
 }} // folly::wangle
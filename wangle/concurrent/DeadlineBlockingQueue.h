@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+#include <wangle/concurrent/BlockingQueue.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/*
+ * Earliest deadline first queue of ThreadPoolExecutor tasks, e.g.
+ * CPUThreadPoolExecutor::CPUTask.
+ *
+ * A task added with an expiration is due at enqueueTime_ + expiration_.
+ * Tasks without one are due defaultDeadline after they were queued, so
+ * they still run under a steady stream of tasks with deadlines; with the
+ * default of 0 they only run once no task with a deadline is queued, in
+ * FIFO order.  Ties run in FIFO order as well.  Poison pills are never
+ * due, so stopping threads doesn't jump ahead of queued work.
+ *
+ * Since the earliest deadlines are taken first, tasks that can no longer
+ * make theirs collect at the front.  take() sweeps all of them at once
+ * and calls their expireCallback_ on the calling thread, outside the
+ * lock, so overloaded workers only pick up tasks that can still make it.
+ * Swept tasks don't reach the executor, so they aren't reported in its
+ * TaskStats.  add() to a full queue sweeps before giving up.
+ */
+template <class T>
+class DeadlineBlockingQueue : public BlockingQueue<T> {
+ public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  explicit DeadlineBlockingQueue(
+      size_t maxCapacity,
+      std::chrono::milliseconds defaultDeadline =
+          std::chrono::milliseconds(0))
+    : maxCapacity_(maxCapacity),
+      defaultDeadline_(defaultDeadline) {}
+
+  void add(T item) override {
+    if (!tryAdd(item)) {
+      throw QueueFullException("DeadlineBlockingQueue full, can't add item");
+    }
+  }
+
+  bool tryAdd(T& item) override {
+    std::vector<T> expired;
+    bool added = false;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (queue_.size() >= maxCapacity_) {
+        sweepLocked(std::chrono::steady_clock::now(), expired);
+      }
+      if (queue_.size() < maxCapacity_) {
+        auto deadline = getDeadline(item);
+        queue_.emplace(deadline, std::move(item));
+        added = true;
+      }
+    }
+    if (added) {
+      cv_.notify_one();
+    }
+    runExpired(expired);
+    return added;
+  }
+
+  void addBatch(std::vector<T> items) override {
+    size_t added = 0;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      for (auto& item : items) {
+        if (queue_.size() >= maxCapacity_) {
+          break;
+        }
+        auto deadline = getDeadline(item);
+        queue_.emplace(deadline, std::move(item));
+        added++;
+      }
+    }
+    if (added > 0) {
+      cv_.notify_all();
+    }
+    if (added < items.size()) {
+      throw QueueFullException("DeadlineBlockingQueue full, can't add item");
+    }
+  }
+
+  // Drops the task with the latest deadline, which is the least urgent
+  bool tryTakeOldest(T& item, int8_t priority) override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (queue_.empty()) {
+      return false;
+    }
+    auto it = std::prev(queue_.end());
+    item = std::move(it->second);
+    queue_.erase(it);
+    return true;
+  }
+
+  T take() override {
+    std::vector<T> expired;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return !queue_.empty(); });
+        sweepLocked(std::chrono::steady_clock::now(), expired);
+        if (!queue_.empty()) {
+          auto it = queue_.begin();
+          T item(std::move(it->second));
+          queue_.erase(it);
+          lock.unlock();
+          runExpired(expired);
+          return item;
+        }
+      }
+      // Everything queued had expired
+      runExpired(expired);
+    }
+  }
+
+  // Expires all overdue tasks now; returns how many there were
+  size_t expireOverdue() {
+    std::vector<T> expired;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      sweepLocked(std::chrono::steady_clock::now(), expired);
+    }
+    auto n = expired.size();
+    runExpired(expired);
+    return n;
+  }
+
+  // Number of tasks expired by this queue rather than run
+  uint64_t getExpiredCount() {
+    return expiredCount_.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() {
+    return maxCapacity_;
+  }
+
+  size_t size() override {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return queue_.size();
+  }
+
+ private:
+  TimePoint getDeadline(const T& item) {
+    if (isPoison(item, 0)) {
+      return TimePoint::max();
+    }
+    if (item.expiration_ > std::chrono::milliseconds(0)) {
+      return item.enqueueTime_ + item.expiration_;
+    }
+    if (defaultDeadline_ > std::chrono::milliseconds(0)) {
+      return item.enqueueTime_ + defaultDeadline_;
+    }
+    return TimePoint::max();
+  }
+
+  // Only some task types, e.g. CPUTask, have poison pills
+  template <class U>
+  static auto isPoison(const U& item, int) -> decltype(bool(item.poison)) {
+    return item.poison;
+  }
+
+  template <class U>
+  static bool isPoison(const U&, long) {
+    return false;
+  }
+
+  // Moves the tasks whose expiration has passed out of the queue.  Only
+  // the front, up to now, needs looking at; tasks there without an
+  // expiration are merely late and stay.
+  // Prerequisite: mutex_ locked
+  void sweepLocked(TimePoint now, std::vector<T>& expired) {
+    auto end = queue_.upper_bound(now);
+    auto it = queue_.begin();
+    while (it != end) {
+      if (it->second.expiration_ > std::chrono::milliseconds(0)) {
+        expired.push_back(std::move(it->second));
+        it = queue_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  void runExpired(std::vector<T>& expired) {
+    if (expired.empty()) {
+      return;
+    }
+    expiredCount_.fetch_add(expired.size(), std::memory_order_relaxed);
+    for (auto& item : expired) {
+      if (item.expireCallback_ != nullptr) {
+        item.expireCallback_();
+      }
+    }
+    expired.clear();
+  }
+
+  const size_t maxCapacity_;
+  const std::chrono::milliseconds defaultDeadline_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::multimap<TimePoint, T> queue_;
+  std::atomic<uint64_t> expiredCount_{0};
+};
+
+}} // folly::wangle
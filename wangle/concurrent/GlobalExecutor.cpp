@@ -9,20 +9,33 @@
  */
 
 #include <folly/Singleton.h>
+#include <folly/ThreadLocal.h>
 #include <wangle/concurrent/IOExecutor.h>
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
 #include <folly/futures/InlineExecutor.h>
 
+#include <atomic>
+
 using namespace folly;
 using namespace folly::wangle;
 
 namespace {
 
+// What a thread last got of a global executor, good while the generation,
+// bumped by each set, is unchanged.  A weak reference, as the global one.
+template <class Exe>
+struct ExecutorCache {
+  uint64_t generation{0};
+  std::weak_ptr<Exe> executor;
+};
+
 // lock protecting global CPU executor
 struct CPUExecutorLock {};
 Singleton<RWSpinLock, CPUExecutorLock> globalCPUExecutorLock;
 // global CPU executor
 Singleton<std::weak_ptr<Executor>> globalCPUExecutor;
+std::atomic<uint64_t> globalCPUExecutorGeneration{1};
+ThreadLocal<ExecutorCache<Executor>> cpuExecutorCache;
 // default global CPU executor is an InlineExecutor
 Singleton<std::shared_ptr<InlineExecutor>> globalInlineExecutor(
     []{
@@ -35,6 +48,8 @@ struct IOExecutorLock {};
 Singleton<RWSpinLock, IOExecutorLock> globalIOExecutorLock;
 // global IO executor
 Singleton<std::weak_ptr<IOExecutor>> globalIOExecutor;
+std::atomic<uint64_t> globalIOExecutorGeneration{1};
+ThreadLocal<ExecutorCache<IOExecutor>> ioExecutorCache;
 // default global IO executor is an IOThreadPoolExecutor
 Singleton<std::shared_ptr<IOThreadPoolExecutor>> globalIOThreadPool(
     []{
@@ -49,7 +64,7 @@ Singleton<std::shared_ptr<IOThreadPoolExecutor>> globalIOThreadPool(
 namespace folly { namespace wangle {
 
 template <class Exe, class DefaultExe, class LockTag>
-std::shared_ptr<Exe> getExecutor(
+std::shared_ptr<Exe> getExecutorSlow(
     Singleton<std::weak_ptr<Exe>>& sExecutor,
     Singleton<std::shared_ptr<DefaultExe>>& sDefaultExecutor,
     Singleton<RWSpinLock, LockTag>& sExecutorLock) {
@@ -74,34 +89,69 @@ std::shared_ptr<Exe> getExecutor(
   return executor;
 }
 
+// Off the thread's cache, without the lock, unless the executor was set
+// since or the cached one is gone.  That still writes to the executor's
+// control block, which all getters share: lock() takes the reference with
+// a compare-and-swap, as returning a shared_ptr needs some atomic write;
+// what's saved is the lock's two.  A cache filled in a race with a set is
+// of the generation before it, so the next call fills it again.
+template <class Exe, class DefaultExe, class LockTag>
+std::shared_ptr<Exe> getExecutor(
+    Singleton<std::weak_ptr<Exe>>& sExecutor,
+    Singleton<std::shared_ptr<DefaultExe>>& sDefaultExecutor,
+    Singleton<RWSpinLock, LockTag>& sExecutorLock,
+    std::atomic<uint64_t>& generation,
+    ThreadLocal<ExecutorCache<Exe>>& threadCache) {
+  auto& cache = *threadCache;
+  auto current = generation.load(std::memory_order_acquire);
+  if (cache.generation == current) {
+    if (auto executor = cache.executor.lock()) {
+      return executor;
+    }
+  }
+  auto executor = getExecutorSlow(sExecutor, sDefaultExecutor, sExecutorLock);
+  cache.executor = executor;
+  cache.generation = current;
+  return executor;
+}
+
 template <class Exe, class LockTag>
 void setExecutor(
     std::shared_ptr<Exe> executor,
     Singleton<std::weak_ptr<Exe>>& sExecutor,
-    Singleton<RWSpinLock, LockTag>& sExecutorLock) {
-  RWSpinLock::WriteHolder guard(sExecutorLock.get());
-  *sExecutor.get() = std::move(executor);
+    Singleton<RWSpinLock, LockTag>& sExecutorLock,
+    std::atomic<uint64_t>& generation) {
+  {
+    RWSpinLock::WriteHolder guard(sExecutorLock.get());
+    *sExecutor.get() = std::move(executor);
+  }
+  generation.fetch_add(1, std::memory_order_release);
 }
 
 std::shared_ptr<Executor> getCPUExecutor() {
   return getExecutor(
       globalCPUExecutor,
       globalInlineExecutor,
-      globalCPUExecutorLock);
+      globalCPUExecutorLock,
+      globalCPUExecutorGeneration,
+      cpuExecutorCache);
 }
 
 void setCPUExecutor(std::shared_ptr<Executor> executor) {
   setExecutor(
       std::move(executor),
       globalCPUExecutor,
-      globalCPUExecutorLock);
+      globalCPUExecutorLock,
+      globalCPUExecutorGeneration);
 }
 
 std::shared_ptr<IOExecutor> getIOExecutor() {
   return getExecutor(
       globalIOExecutor,
       globalIOThreadPool,
-      globalIOExecutorLock);
+      globalIOExecutorLock,
+      globalIOExecutorGeneration,
+      ioExecutorCache);
 }
 
 EventBase* getEventBase() {
@@ -112,7 +162,8 @@ void setIOExecutor(std::shared_ptr<IOExecutor> executor) {
   setExecutor(
       std::move(executor),
       globalIOExecutor,
-      globalIOExecutorLock);
+      globalIOExecutorLock,
+      globalIOExecutorGeneration);
 }
 
 }} // folly::wangle
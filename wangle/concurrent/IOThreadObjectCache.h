@@ -0,0 +1,155 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Baton.h>
+#include <folly/io/async/EventBase.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+
+namespace folly { namespace wangle {
+
+/*
+ * One T per thread of an IOThreadPoolExecutor, e.g. a client pool per
+ * event loop.
+ *
+ * Unlike IOObjectCache, objects are built eagerly, on each thread's
+ * EventBase, as the pool starts the thread, and destroyed there when the
+ * thread stops.  They are kept in a flat array indexed by
+ * IOThreadPoolExecutor::getThreadIndex(), so get() from a pool thread is a
+ * thread local lookup and an array index, with no map and no refcounting.
+ *
+ * Use create() to build one; it registers itself as an Observer of the
+ * pool until detach() is called.
+ */
+template <class T>
+class IOThreadObjectCache : public ThreadPoolExecutor::Observer {
+ public:
+  typedef std::function<std::unique_ptr<T>(EventBase*)> TFactory;
+
+  static const size_t kDefaultMaxThreads = 256;
+
+  static std::shared_ptr<IOThreadObjectCache> create(
+      std::shared_ptr<IOThreadPoolExecutor> executor,
+      TFactory factory,
+      size_t maxThreads = kDefaultMaxThreads) {
+    std::shared_ptr<IOThreadObjectCache> cache(new IOThreadObjectCache(
+        executor, std::move(factory), maxThreads));
+    cache->self_ = cache;
+    // Builds the objects of the threads already running
+    executor->addObserver(cache);
+    return cache;
+  }
+
+  ~IOThreadObjectCache() {
+    for (size_t i = 0; i < maxThreads_; i++) {
+      DCHECK(slots_[i].object.load() == nullptr)
+        << "IOThreadObjectCache destroyed without detach()";
+    }
+  }
+
+  // Destroys all objects and stops following the pool's threads
+  void detach() {
+    executor_->removeObserver(self_.lock());
+  }
+
+  /*
+   * The calling thread's object if it is a pool thread, otherwise the
+   * object of a thread picked by the pool.  The reference stays valid as
+   * long as that thread's event loop runs.  A thread's object only exists
+   * once the setNumThreads() call that started it has returned.
+   */
+  T& get() {
+    auto index = executor_->getCurrentThreadIndex();
+    if (index >= 0) {
+      auto object = slots_[index].object.load(std::memory_order_acquire);
+      DCHECK(object);
+      return *object;
+    }
+    return getForEventBase(executor_->getEventBase());
+  }
+
+  // The object for one of the pool's event bases
+  T& getForEventBase(EventBase* evb) {
+    for (size_t i = 0; i < maxThreads_; i++) {
+      if (slots_[i].eventBase.load(std::memory_order_acquire) == evb) {
+        auto object = slots_[i].object.load(std::memory_order_acquire);
+        if (object) {
+          return *object;
+        }
+      }
+    }
+    throw std::runtime_error("No object for EventBase");
+  }
+
+  void threadStarted(ThreadPoolExecutor::ThreadHandle* h) override {
+    auto index = IOThreadPoolExecutor::getThreadIndex(h);
+    CHECK(index < maxThreads_) << "More than " << maxThreads_ << " threads";
+    auto evb = IOThreadPoolExecutor::getEventBase(h);
+    T* object = nullptr;
+    runInEventBase(evb, [&]() {
+      object = factory_(evb).release();
+    });
+    slots_[index].object.store(object, std::memory_order_release);
+    slots_[index].eventBase.store(evb, std::memory_order_release);
+  }
+
+  void threadStopped(ThreadPoolExecutor::ThreadHandle* h) override {
+    auto index = IOThreadPoolExecutor::getThreadIndex(h);
+    auto evb = IOThreadPoolExecutor::getEventBase(h);
+    slots_[index].eventBase.store(nullptr, std::memory_order_release);
+    auto object = slots_[index].object.exchange(nullptr);
+    runInEventBase(evb, [&]() {
+      delete object;
+    });
+  }
+
+ private:
+  IOThreadObjectCache(
+      std::shared_ptr<IOThreadPoolExecutor> executor,
+      TFactory factory,
+      size_t maxThreads)
+    : executor_(std::move(executor)),
+      factory_(std::move(factory)),
+      maxThreads_(maxThreads),
+      slots_(new Slot[maxThreads]) {}
+
+  // Runs f on evb's thread and waits for it
+  static void runInEventBase(EventBase* evb, const std::function<void()>& f) {
+    if (evb->isInEventBaseThread()) {
+      f();
+      return;
+    }
+    Baton<> done;
+    evb->runInEventBaseThread([&]() {
+      f();
+      done.post();
+    });
+    done.wait();
+  }
+
+  struct Slot {
+    Slot() : eventBase(nullptr), object(nullptr) {}
+    std::atomic<EventBase*> eventBase;
+    std::atomic<T*> object;
+  };
+
+  std::shared_ptr<IOThreadPoolExecutor> executor_;
+  std::weak_ptr<IOThreadObjectCache> self_;
+  TFactory factory_;
+  const size_t maxThreads_;
+  std::unique_ptr<Slot[]> slots_;
+};
+
+}} // folly::wangle
@@ -11,26 +11,42 @@
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
 
 #include <folly/MoveWrapper.h>
+#include <folly/Random.h>
 #include <glog/logging.h>
 
 #include <folly/detail/MemoryIdler.h>
 
+#include <thread>
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
 namespace folly { namespace wangle {
 
 using folly::detail::MemoryIdler;
 
 /* Class that will free jemalloc caches and madvise the stack away
- * if the event loop is unused for some period of time
+ * if the event loop is unused for some period of time.  It stands by
+ * while the loop spins, which keeps it from ever being idle anyway.
  */
 class MemoryIdlerTimeout
     : public AsyncTimeout , public EventBase::LoopCallback {
  public:
-  explicit MemoryIdlerTimeout(EventBase* b) : AsyncTimeout(b), base_(b) {}
+  MemoryIdlerTimeout(EventBase* b, const std::atomic<int64_t>* spinWaitUs)
+    : AsyncTimeout(b), base_(b), spinWaitUs_(spinWaitUs) {}
 
   void timeoutExpired() noexcept override { idled = true; }
 
   void runLoopCallback() noexcept override {
-    if (idled) {
+    if (spinWaitUs_->load(std::memory_order_relaxed) > 0) {
+      // Rescheduling the timeout on every pass would cost more than
+      // spinning saves
+      if (isScheduled()) {
+        cancelTimeout();
+      }
+      idled = false;
+    } else if (idled) {
       MemoryIdler::flushLocalMallocCaches();
       MemoryIdler::unmapUnusedStack(MemoryIdler::kDefaultStackToRetain);
 
@@ -51,16 +67,121 @@ class MemoryIdlerTimeout
   }
  private:
   EventBase* base_;
+  const std::atomic<int64_t>* spinWaitUs_;
   bool idled{false};
 } ;
 
+/* Times the iterations of an IO thread's event loop, which it hooks like
+ * MemoryIdlerTimeout, and publishes them with the thread's CPU time and
+ * task figures once per interval.  With no interval set, it only checks
+ * for one as the loop goes round, so the loop can stay idle, and
+ * MemoryIdlerTimeout fire.  Everything but publishing the result happens
+ * on the IO thread only.
+ */
+class IOThreadPoolExecutor::EventLoopStatsCollector
+    : public AsyncTimeout, public EventBase::LoopCallback {
+ public:
+  EventLoopStatsCollector(IOThreadPoolExecutor* pool, IOThread* thread)
+    : AsyncTimeout(thread->eventBase),
+      pool_(pool),
+      thread_(thread) {
+    thread_->eventBase->runBeforeLoop(this);
+  }
+
+  ~EventLoopStatsCollector() {
+    cancelLoopCallback();
+  }
+
+  void runLoopCallback() noexcept override {
+    thread_->eventBase->runBeforeLoop(this);
+    auto interval = getInterval();
+    if (interval <= 0) {
+      cancelTimeout();
+      lastIteration_ = std::chrono::steady_clock::time_point();
+      return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (!isScheduled()) {
+      // Turned on; the first window starts now
+      window_ = EventLoopStats();
+      windowStart_ = now;
+      windowCpuTime_ = getThreadCpuTime();
+      scheduleTimeout(interval);
+    }
+    if (lastIteration_ != std::chrono::steady_clock::time_point()) {
+      auto loopTime = now - lastIteration_;
+      window_.loopTime.addValue(loopTime);
+      window_.iterations++;
+      window_.maxLoopTime = std::max(
+          window_.maxLoopTime,
+          std::chrono::duration_cast<std::chrono::nanoseconds>(loopTime));
+    }
+    lastIteration_ = now;
+  }
+
+  void timeoutExpired() noexcept override {
+    publish();
+    auto interval = getInterval();
+    if (interval > 0) {
+      scheduleTimeout(interval);
+    }
+  }
+
+ private:
+  static std::chrono::nanoseconds getThreadCpuTime() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+      return std::chrono::nanoseconds(0);
+    }
+    return std::chrono::seconds(ts.tv_sec) +
+      std::chrono::nanoseconds(ts.tv_nsec);
+  }
+
+  int64_t getInterval() const {
+    return pool_->eventLoopStatsIntervalMs_.load(std::memory_order_relaxed);
+  }
+
+  void publish() {
+    auto now = std::chrono::steady_clock::now();
+    auto cpuTime = getThreadCpuTime();
+    window_.threadIndex = thread_->index;
+    window_.wallTime = now - windowStart_;
+    window_.busyTime = cpuTime - windowCpuTime_;
+    window_.maxTaskWaitTime = thread_->maxWaitTime;
+    window_.maxTaskRunTime = thread_->maxRunTime;
+    window_.pendingTasks = thread_->pendingTasks;
+    thread_->maxWaitTime = std::chrono::nanoseconds(0);
+    thread_->maxRunTime = std::chrono::nanoseconds(0);
+    {
+      std::lock_guard<std::mutex> guard(thread_->loopStatsLock);
+      thread_->loopStats = window_;
+    }
+    pool_->eventLoopStatsSubject_->onNext(window_);
+
+    window_ = EventLoopStats();
+    windowStart_ = now;
+    windowCpuTime_ = cpuTime;
+  }
+
+  IOThreadPoolExecutor* pool_;
+  IOThread* thread_;
+  EventLoopStats window_;
+  std::chrono::steady_clock::time_point windowStart_;
+  std::chrono::nanoseconds windowCpuTime_;
+  std::chrono::steady_clock::time_point lastIteration_;
+};
+
 IOThreadPoolExecutor::IOThreadPoolExecutor(
     size_t numThreads,
     std::shared_ptr<ThreadFactory> threadFactory,
-    EventBaseManager* ebm)
+    EventBaseManager* ebm,
+    std::shared_ptr<ThreadSelector> threadSelector)
   : ThreadPoolExecutor(numThreads, std::move(threadFactory)),
-    nextThread_(0),
+    threadSelector_(std::move(threadSelector)),
     eventBaseManager_(ebm) {
+  if (!threadSelector_) {
+    threadSelector_ = std::make_shared<RoundRobinThreadSelector>();
+  }
   addThreads(numThreads);
   CHECK(threadList_.get().size() == numThreads);
 }
@@ -77,17 +198,24 @@ void IOThreadPoolExecutor::add(
     Func func,
     std::chrono::milliseconds expiration,
     Func expireCallback) {
-  RWSpinLock::ReadHolder{&threadListLock_};
-  if (threadList_.get().empty()) {
-    throw std::runtime_error("No threads available");
-  }
-  auto ioThread = pickThread();
+  addTaskFunc(std::move(func), expiration, std::move(expireCallback));
+}
+
+void IOThreadPoolExecutor::addTaskFunc(
+    TaskFunc func,
+    std::chrono::milliseconds expiration,
+    Func expireCallback) {
+  SnapshotGuard guard(this);
+  auto ioThread = pickThread(guard.threads());
 
+  // The task holds func inline, so this is the only allocation, for the
+  // EventBase's std::function
   auto moveTask = folly::makeMoveWrapper(
       Task(std::move(func), expiration, std::move(expireCallback)));
   auto wrappedFunc = [ioThread, moveTask] () mutable {
     runTask(ioThread, std::move(*moveTask));
     ioThread->pendingTasks--;
+    ioThread->tasksRun++;
   };
 
   ioThread->pendingTasks++;
@@ -97,17 +225,198 @@ void IOThreadPoolExecutor::add(
   }
 }
 
+void IOThreadPoolExecutor::addBatch(std::vector<Func>&& funcs) {
+  if (funcs.empty()) {
+    return;
+  }
+  SnapshotGuard guard(this);
+
+  // Group the tasks by the thread pickThread() assigns them to
+  std::vector<std::pair<std::shared_ptr<IOThread>, std::vector<Task>>> batches;
+  for (auto& func : funcs) {
+    auto ioThread = pickThread(guard.threads());
+    auto it = std::find_if(batches.begin(), batches.end(),
+        [&](const std::pair<std::shared_ptr<IOThread>, std::vector<Task>>& b) {
+          return b.first == ioThread;
+        });
+    if (it == batches.end()) {
+      batches.emplace_back(ioThread, std::vector<Task>());
+      it = batches.end() - 1;
+    }
+    it->second.emplace_back(
+        std::move(func), std::chrono::milliseconds(0), nullptr);
+  }
+  funcs.clear();
+
+  for (auto& batch : batches) {
+    auto ioThread = batch.first;
+    size_t numTasks = batch.second.size();
+    auto moveTasks = folly::makeMoveWrapper(std::move(batch.second));
+    auto wrappedFunc = [ioThread, moveTasks] () mutable {
+      for (auto& task : *moveTasks) {
+        runTask(ioThread, std::move(task));
+        ioThread->pendingTasks--;
+      }
+      ioThread->tasksRun += moveTasks->size();
+    };
+
+    ioThread->pendingTasks += numTasks;
+    if (!ioThread->eventBase->runInEventBaseThread(std::move(wrappedFunc))) {
+      ioThread->pendingTasks -= numTasks;
+      throw std::runtime_error("Unable to run func in event base thread");
+    }
+  }
+}
+
 std::shared_ptr<IOThreadPoolExecutor::IOThread>
-IOThreadPoolExecutor::pickThread() {
+IOThreadPoolExecutor::pickThread(const ThreadVector& threads) {
   if (*thisThread_) {
     return *thisThread_;
   }
-  auto thread = threadList_.get()[nextThread_++ % threadList_.get().size()];
-  return std::static_pointer_cast<IOThread>(thread);
+  if (threads.empty()) {
+    throw std::runtime_error("No threads available");
+  }
+  auto i = threadSelector_->select(ThreadLoads(threads));
+  DCHECK(i < threads.size());
+  return std::static_pointer_cast<IOThread>(threads[i % threads.size()]);
+}
+
+IOThreadPoolExecutor::SnapshotReader::SnapshotReader(
+    IOThreadPoolExecutor* p)
+  : pool(p) {
+  std::lock_guard<std::mutex> g(pool->readersLock_);
+  pool->readerList_.push_back(this);
+}
+
+IOThreadPoolExecutor::SnapshotReader::~SnapshotReader() {
+  std::lock_guard<std::mutex> g(pool->readersLock_);
+  auto& readers = pool->readerList_;
+  readers.erase(std::find(readers.begin(), readers.end(), this));
+}
+
+IOThreadPoolExecutor::SnapshotGuard::SnapshotGuard(
+    IOThreadPoolExecutor* pool) {
+  reader_ = pool->readers_.get();
+  if (!reader_) {
+    reader_ = new SnapshotReader(pool);
+    pool->readers_.reset(reader_);
+  }
+  reader_->active.store(true, std::memory_order_relaxed);
+  // Pairs with the fence in publishSnapshot(): either the publisher sees
+  // us active, or we see its new version
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto version = pool->snapshotVersion_.load(std::memory_order_relaxed);
+  if (!reader_->snapshot ||
+      version != reader_->version.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> g(pool->snapshotLock_);
+    reader_->snapshot = pool->snapshot_;
+    reader_->version.store(
+        pool->snapshotVersion_.load(std::memory_order_relaxed),
+        std::memory_order_release);
+  }
+}
+
+void IOThreadPoolExecutor::publishSnapshot(ThreadVector threads) {
+  uint64_t version;
+  {
+    std::lock_guard<std::mutex> g(snapshotLock_);
+    snapshot_ = std::make_shared<const ThreadVector>(std::move(threads));
+    version = snapshotVersion_.load(std::memory_order_relaxed) + 1;
+    snapshotVersion_.store(version, std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  // Wait out submitters that may still be using an older snapshot
+  std::lock_guard<std::mutex> g(readersLock_);
+  for (auto reader : readerList_) {
+    while (reader->active.load(std::memory_order_acquire) &&
+           reader->version.load(std::memory_order_acquire) < version) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+size_t RoundRobinThreadSelector::select(
+    const IOThreadPoolExecutor::ThreadLoads& threads) {
+  return cursor_->next++ % threads.size();
+}
+
+RoundRobinThreadSelector::Cursor::Cursor()
+  : next(folly::Random::rand32()) {}
+
+size_t IOThreadPoolExecutor::ThreadLoads::getPendingTasks(size_t i) const {
+  return static_cast<IOThread*>(threads_[i].get())->pendingTasks.load(
+      std::memory_order_relaxed);
+}
+
+int IOThreadPoolExecutor::ThreadLoads::getNumaNode(size_t i) const {
+  return static_cast<IOThread*>(threads_[i].get())->numaNode;
+}
+
+int IOThreadPoolExecutor::getCurrentNumaNode() {
+#ifdef SYS_getcpu
+  unsigned cpu, node;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+    return node;
+  }
+#endif
+  return -1;
+}
+
+size_t LeastPendingTasksThreadSelector::select(
+    const IOThreadPoolExecutor::ThreadLoads& threads) {
+  // Start at a random thread so ties don't all land on the same one
+  size_t n = threads.size();
+  size_t best = folly::Random::rand32(n);
+  size_t bestLoad = threads.getPendingTasks(best);
+  for (size_t j = 1; j < n && bestLoad > 0; j++) {
+    size_t i = (best + j) % n;
+    size_t load = threads.getPendingTasks(i);
+    if (load < bestLoad) {
+      best = i;
+      bestLoad = load;
+    }
+  }
+  return best;
+}
+
+size_t PowerOfTwoChoicesThreadSelector::select(
+    const IOThreadPoolExecutor::ThreadLoads& threads) {
+  size_t n = threads.size();
+  size_t a = folly::Random::rand32(n);
+  size_t b = folly::Random::rand32(n);
+  return threads.getPendingTasks(b) < threads.getPendingTasks(a) ? b : a;
+}
+
+size_t NumaLocalThreadSelector::select(
+    const IOThreadPoolExecutor::ThreadLoads& threads) {
+  int node = IOThreadPoolExecutor::getCurrentNumaNode();
+  if (node >= 0) {
+    size_t n = threads.size();
+    size_t start = folly::Random::rand32(n);
+    size_t best = n;
+    size_t bestLoad = 0;
+    for (size_t j = 0; j < n; j++) {
+      size_t i = (start + j) % n;
+      if (threads.getNumaNode(i) != node) {
+        continue;
+      }
+      size_t load = threads.getPendingTasks(i);
+      if (best == n || load < bestLoad) {
+        best = i;
+        bestLoad = load;
+      }
+    }
+    if (best < n) {
+      return best;
+    }
+  }
+  return fallback_->select(threads);
 }
 
 EventBase* IOThreadPoolExecutor::getEventBase() {
-  return pickThread()->eventBase;
+  SnapshotGuard guard(this);
+  return pickThread(guard.threads())->eventBase;
 }
 
 EventBase* IOThreadPoolExecutor::getEventBase(
@@ -121,46 +430,153 @@ EventBase* IOThreadPoolExecutor::getEventBase(
   return nullptr;
 }
 
+size_t IOThreadPoolExecutor::getThreadIndex(
+    ThreadPoolExecutor::ThreadHandle* h) {
+  auto thread = dynamic_cast<IOThread*>(h);
+  CHECK(thread);
+  return thread->index;
+}
+
+ssize_t IOThreadPoolExecutor::getCurrentThreadIndex() {
+  auto& thread = *thisThread_;
+  return thread ? thread->index : -1;
+}
+
+IOThreadPoolExecutor::EventLoopStats
+IOThreadPoolExecutor::getEventLoopStats(
+    ThreadPoolExecutor::ThreadHandle* h) {
+  auto thread = dynamic_cast<IOThread*>(h);
+  CHECK(thread);
+  std::lock_guard<std::mutex> guard(thread->loopStatsLock);
+  return thread->loopStats;
+}
+
+void IOThreadPoolExecutor::setSpinWait(std::chrono::microseconds spinWait) {
+  spinWaitUs_.store(spinWait.count(), std::memory_order_relaxed);
+  // Threads blocked in their event loop switch over once woken up; the
+  // listed ones are all running, as stopped ones are removed under the
+  // write lock
+  RWSpinLock::ReadHolder guard(&threadListLock_);
+  for (auto& thread : threadList_.get()) {
+    std::static_pointer_cast<IOThread>(thread)->eventBase->terminateLoopSoon();
+  }
+}
+
+void IOThreadPoolExecutor::setEventLoopStatsInterval(
+    std::chrono::milliseconds interval) {
+  eventLoopStatsIntervalMs_.store(interval.count(), std::memory_order_relaxed);
+  // Picked up as the loops go round, so wake them like setSpinWait()
+  RWSpinLock::ReadHolder guard(&threadListLock_);
+  for (auto& thread : threadList_.get()) {
+    std::static_pointer_cast<IOThread>(thread)->eventBase->terminateLoopSoon();
+  }
+}
+
 EventBaseManager* IOThreadPoolExecutor::getEventBaseManager() {
   return eventBaseManager_;
 }
 
 std::shared_ptr<ThreadPoolExecutor::Thread>
 IOThreadPoolExecutor::makeThread() {
-  return std::make_shared<IOThread>(this);
+  auto thread = std::make_shared<IOThread>(this);
+  auto it = std::find(usedIndices_.begin(), usedIndices_.end(), false);
+  thread->index = it - usedIndices_.begin();
+  if (it == usedIndices_.end()) {
+    usedIndices_.push_back(true);
+  } else {
+    *it = true;
+  }
+  return thread;
 }
 
 void IOThreadPoolExecutor::threadRun(ThreadPtr thread) {
   const auto ioThread = std::static_pointer_cast<IOThread>(thread);
   ioThread->eventBase = eventBaseManager_->getEventBase();
+  ioThread->numaNode = getCurrentNumaNode();
   thisThread_.reset(new std::shared_ptr<IOThread>(ioThread));
 
-  auto idler = new MemoryIdlerTimeout(ioThread->eventBase);
+  auto idler = new MemoryIdlerTimeout(ioThread->eventBase, &spinWaitUs_);
   ioThread->eventBase->runBeforeLoop(idler);
 
+  auto loopStats = folly::make_unique<EventLoopStatsCollector>(
+      this, ioThread.get());
+
   thread->startupBaton.post();
   while (ioThread->shouldRun) {
-    ioThread->eventBase->loopForever();
+    if (spinWaitUs_.load(std::memory_order_relaxed) > 0) {
+      spinLoop(ioThread.get());
+    } else {
+      ioThread->eventBase->loopForever();
+    }
   }
   if (isJoin_) {
-    while (ioThread->pendingTasks > 0) {
+    auto deadline = joinDeadline_;
+    if (deadline != std::chrono::steady_clock::time_point::max()) {
+      // Wakes loopOnce() at the deadline if no task does first
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          deadline - std::chrono::steady_clock::now());
+      ioThread->eventBase->tryRunAfterDelay(
+          [] {}, std::max<int64_t>(left.count() + 1, 0));
+    }
+    while (ioThread->pendingTasks > 0 && isJoin_ &&
+           std::chrono::steady_clock::now() < deadline) {
       ioThread->eventBase->loopOnce();
     }
   }
+  // Needs the EventBase to cancel its timeout
+  loopStats.reset();
   stoppedThreads_.add(ioThread);
 
   ioThread->eventBase = nullptr;
   eventBaseManager_->clearEventBase();
 }
 
+// Returns once the thread is stopped or spinning is turned off
+void IOThreadPoolExecutor::spinLoop(IOThread* thread) {
+  auto eventBase = thread->eventBase;
+  while (thread->shouldRun) {
+    auto spinWait = std::chrono::microseconds(
+        spinWaitUs_.load(std::memory_order_relaxed));
+    if (spinWait.count() == 0) {
+      return;
+    }
+    auto deadline = std::chrono::steady_clock::now() + spinWait;
+    auto tasksRun = thread->tasksRun;
+    while (thread->shouldRun) {
+      eventBase->loopOnce(EVLOOP_NONBLOCK);
+      auto now = std::chrono::steady_clock::now();
+      if (thread->tasksRun != tasksRun) {
+        tasksRun = thread->tasksRun;
+        deadline = now + spinWait;
+      } else if (now >= deadline) {
+        break;
+      }
+    }
+    if (thread->shouldRun) {
+      // Nothing to do for a whole spinWait, wait for the next event
+      eventBase->loopOnce();
+    }
+  }
+}
+
+// threadListLock_ is writelocked
+void IOThreadPoolExecutor::threadsAdded() {
+  publishSnapshot(threadList_.get());
+}
+
 // threadListLock_ is writelocked
 void IOThreadPoolExecutor::stopThreads(size_t n) {
+  // Stop handing out the threads before they go away
+  const auto& threads = threadList_.get();
+  publishSnapshot(ThreadVector(threads.begin() + n, threads.end()));
+
   for (size_t i = 0; i < n; i++) {
     const auto ioThread = std::static_pointer_cast<IOThread>(
         threadList_.get()[i]);
     for (auto& o : observers_) {
       o->threadStopped(ioThread.get());
     }
+    usedIndices_[ioThread->index] = false;
     ioThread->shouldRun = false;
     ioThread->eventBase->terminateLoopSoon();
   }
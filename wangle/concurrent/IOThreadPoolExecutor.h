@@ -10,21 +10,63 @@
 
 #pragma once
 
+#include <folly/ThreadLocal.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <wangle/concurrent/IOExecutor.h>
 #include <wangle/concurrent/ThreadPoolExecutor.h>
 
+#include <atomic>
+#include <mutex>
+#include <vector>
+
 namespace folly { namespace wangle {
 
 // N.B. For this thread pool, stop() behaves like join() because outstanding
 // tasks belong to the event base and will be executed upon its destruction.
 class IOThreadPoolExecutor : public ThreadPoolExecutor, public IOExecutor {
  public:
+  /*
+   * The pool's threads as seen by a ThreadSelector.  Indices are only
+   * meaningful for the duration of the select() call they are passed to.
+   */
+  class ThreadLoads {
+   public:
+    size_t size() const {
+      return threads_.size();
+    }
+
+    // Tasks waiting for or running in thread i's event base
+    size_t getPendingTasks(size_t i) const;
+
+    // NUMA node thread i started on, or -1 if unknown
+    int getNumaNode(size_t i) const;
+
+   private:
+    friend class IOThreadPoolExecutor;
+    explicit ThreadLoads(const std::vector<ThreadPtr>& threads)
+      : threads_(threads) {}
+
+    const std::vector<ThreadPtr>& threads_;
+  };
+
+  /*
+   * Chooses the thread for add() and getEventBase() calls made from outside
+   * the pool; calls made from a pool thread always stay on that thread.
+   * select() may be called from several threads at once.
+   */
+  class ThreadSelector {
+   public:
+    virtual ~ThreadSelector() = default;
+    virtual size_t select(const ThreadLoads& threads) = 0;
+  };
+
+  // threadSelector defaults to a RoundRobinThreadSelector
   explicit IOThreadPoolExecutor(
       size_t numThreads,
       std::shared_ptr<ThreadFactory> threadFactory =
           std::make_shared<NamedThreadFactory>("IOThreadPool"),
-      EventBaseManager* ebm = folly::EventBaseManager::get());
+      EventBaseManager* ebm = folly::EventBaseManager::get(),
+      std::shared_ptr<ThreadSelector> threadSelector = nullptr);
 
   ~IOThreadPoolExecutor();
 
@@ -34,32 +76,244 @@ class IOThreadPoolExecutor : public ThreadPoolExecutor, public IOExecutor {
       std::chrono::milliseconds expiration,
       Func expireCallback = nullptr) override;
 
+  void addTaskFunc(
+      TaskFunc func,
+      std::chrono::milliseconds expiration = std::chrono::milliseconds(0),
+      Func expireCallback = nullptr) override;
+
+  // Spreads funcs over the threads with a single wakeup per event base
+  void addBatch(std::vector<Func>&& funcs) override;
+
   EventBase* getEventBase() override;
 
   static EventBase* getEventBase(ThreadPoolExecutor::ThreadHandle*);
 
+  /*
+   * Dense index of a pool thread: running threads always have distinct
+   * indices below numThreads(), and a stopped thread's index is reused by
+   * the next thread started.  Meant for per thread arrays, see
+   * IOThreadObjectCache.
+   */
+  static size_t getThreadIndex(ThreadPoolExecutor::ThreadHandle*);
+
+  // Index of the calling thread if it is one of this pool's, or -1
+  ssize_t getCurrentThreadIndex();
+
   EventBaseManager* getEventBaseManager();
 
+  std::shared_ptr<ThreadSelector> getThreadSelector() {
+    return threadSelector_;
+  }
+
+  // NUMA node of the CPU the calling thread is running on, or -1
+  static int getCurrentNumaNode();
+
+  /*
+   * What an IO thread's event loop did over one stats interval.
+   *
+   * Loop iterations are timed from the start of one to the start of the
+   * next, so idle waiting is included; a loop that is never idle for long
+   * has short iterations.  busyTime is the thread's CPU time, so
+   * busyTime / wallTime is the share of the interval spent running rather
+   * than waiting.  The task figures cover tasks added through this pool,
+   * which wait in the EventBase's NotificationQueue before they run.
+   */
+  struct EventLoopStats {
+    EventLoopStats()
+      : threadIndex(0),
+        iterations(0),
+        maxLoopTime(0),
+        busyTime(0),
+        wallTime(0),
+        maxTaskWaitTime(0),
+        maxTaskRunTime(0),
+        pendingTasks(0) {}
+
+    double getBusyRatio() const {
+      return wallTime.count() > 0 ?
+        double(busyTime.count()) / wallTime.count() : 0;
+    }
+
+    // See getThreadIndex()
+    size_t threadIndex;
+    TaskLatencyHistogram loopTime;
+    uint64_t iterations;
+    std::chrono::nanoseconds maxLoopTime;
+    std::chrono::nanoseconds busyTime;
+    std::chrono::nanoseconds wallTime;
+    std::chrono::nanoseconds maxTaskWaitTime;
+    std::chrono::nanoseconds maxTaskRunTime;
+    // Tasks queued or running on the thread at the end of the interval
+    size_t pendingTasks;
+  };
+
+  // The last complete interval of a pool thread
+  static EventLoopStats getEventLoopStats(ThreadPoolExecutor::ThreadHandle*);
+
+  // Called by each thread, on that thread, at the end of every interval
+  Subscription<EventLoopStats> subscribeToEventLoopStats(
+      const ObserverPtr<EventLoopStats>& observer) {
+    return eventLoopStatsSubject_->subscribe(observer);
+  }
+
+  // Off, and no timer armed, until set; zero turns it off again
+  void setEventLoopStatsInterval(std::chrono::milliseconds interval);
+
+  /*
+   * Busy polling: each IO thread keeps running its event loop without
+   * blocking until spinWait has passed since it last woke up or ran a
+   * task, and only then blocks.  Tasks and socket events arriving in the
+   * meantime are picked up without the cost of a wakeup, at the price of
+   * keeping the threads' CPUs busy; so this suits pools with cores of
+   * their own, e.g. made with AffinityThreadFactory and
+   * AffinityThreadFactory::getIsolatedCpus().  Spinning threads don't run
+   * MemoryIdlerTimeout, as they are never idle for long.
+   *
+   * Zero, the default, always blocks.  Takes effect right away; compare
+   * getTaskStatsHistograms().waitTime with and without it.
+   */
+  void setSpinWait(std::chrono::microseconds spinWait);
+
+  std::chrono::microseconds getSpinWait() const {
+    return std::chrono::microseconds(
+        spinWaitUs_.load(std::memory_order_relaxed));
+  }
+
  private:
   struct FOLLY_ALIGN_TO_AVOID_FALSE_SHARING IOThread : public Thread {
     IOThread(IOThreadPoolExecutor* pool)
       : Thread(pool),
         shouldRun(true),
-        pendingTasks(0) {};
+        pendingTasks(0),
+        numaNode(-1),
+        index(0),
+        tasksRun(0) {};
     std::atomic<bool> shouldRun;
     std::atomic<size_t> pendingTasks;
+    int numaNode;
+    size_t index;
+    // Only touched by the thread itself, to tell when spinning found work
+    uint64_t tasksRun;
     EventBase* eventBase;
+    std::mutex loopStatsLock;
+    EventLoopStats loopStats;
+  };
+
+  class EventLoopStatsCollector;
+
+  /*
+   * Submitters pick threads from a copy-on-write snapshot of the running
+   * threads instead of taking threadListLock_.  Each submitting thread
+   * caches the snapshot and only touches shared state when its version
+   * changes.  Before threads are stopped, a new snapshot without them is
+   * published and publishSnapshot() waits, RCU style, until no submitter
+   * is still inside a SnapshotGuard for an older version.
+   */
+  typedef std::vector<ThreadPtr> ThreadVector;
+
+  struct SnapshotReader {
+    explicit SnapshotReader(IOThreadPoolExecutor* pool);
+    ~SnapshotReader();
+
+    IOThreadPoolExecutor* pool;
+    std::atomic<bool> active{false};
+    std::atomic<uint64_t> version{0};
+    std::shared_ptr<const ThreadVector> snapshot;
+  };
+
+  class SnapshotGuard {
+   public:
+    explicit SnapshotGuard(IOThreadPoolExecutor* pool);
+    ~SnapshotGuard() {
+      reader_->active.store(false, std::memory_order_release);
+    }
+
+    const ThreadVector& threads() const {
+      return *reader_->snapshot;
+    }
+
+   private:
+    SnapshotReader* reader_;
   };
 
   ThreadPtr makeThread() override;
-  std::shared_ptr<IOThread> pickThread();
+  std::shared_ptr<IOThread> pickThread(const ThreadVector& threads);
   void threadRun(ThreadPtr thread) override;
+  void spinLoop(IOThread* thread);
+  void threadsAdded() override;
   void stopThreads(size_t n) override;
   uint64_t getPendingTaskCount() override;
+  void publishSnapshot(ThreadVector threads);
 
-  size_t nextThread_;
+  std::shared_ptr<ThreadSelector> threadSelector_;
   ThreadLocal<std::shared_ptr<IOThread>> thisThread_;
+  // Which thread indices are taken; threadListLock_ writelocked
+  std::vector<bool> usedIndices_;
   EventBaseManager* eventBaseManager_;
+  std::shared_ptr<Subject<EventLoopStats>> eventLoopStatsSubject_{
+    std::make_shared<Subject<EventLoopStats>>()};
+  std::atomic<int64_t> eventLoopStatsIntervalMs_{0};
+  std::atomic<int64_t> spinWaitUs_{0};
+
+  std::mutex snapshotLock_;
+  std::shared_ptr<const ThreadVector> snapshot_{
+    std::make_shared<const ThreadVector>()};
+  std::atomic<uint64_t> snapshotVersion_{0};
+  std::mutex readersLock_;
+  std::vector<SnapshotReader*> readerList_;
+  // Declared after readerList_, which the readers remove themselves from
+  ThreadLocalPtr<SnapshotReader> readers_;
+};
+
+/*
+ * Cycles through the threads in order.  Each submitting thread keeps its
+ * own cursor, starting at a random thread, so submitters don't share a
+ * counter.
+ */
+class RoundRobinThreadSelector : public IOThreadPoolExecutor::ThreadSelector {
+ public:
+  size_t select(const IOThreadPoolExecutor::ThreadLoads& threads) override;
+
+ private:
+  struct Cursor {
+    Cursor();
+    size_t next;
+  };
+
+  ThreadLocal<Cursor> cursor_;
+};
+
+// Picks the thread with the fewest pending tasks, scanning every thread
+class LeastPendingTasksThreadSelector
+    : public IOThreadPoolExecutor::ThreadSelector {
+ public:
+  size_t select(const IOThreadPoolExecutor::ThreadLoads& threads) override;
+};
+
+// Picks the less loaded of two random threads
+class PowerOfTwoChoicesThreadSelector
+    : public IOThreadPoolExecutor::ThreadSelector {
+ public:
+  size_t select(const IOThreadPoolExecutor::ThreadLoads& threads) override;
+};
+
+/*
+ * Picks the least loaded thread on the caller's NUMA node, falling back to
+ * another selector when the node is unknown or has no threads.  Threads are
+ * assigned to the node they started on, so this works best when the
+ * threads are pinned.
+ */
+class NumaLocalThreadSelector : public IOThreadPoolExecutor::ThreadSelector {
+ public:
+  explicit NumaLocalThreadSelector(
+      std::shared_ptr<IOThreadPoolExecutor::ThreadSelector> fallback =
+          std::make_shared<PowerOfTwoChoicesThreadSelector>())
+    : fallback_(std::move(fallback)) {}
+
+  size_t select(const IOThreadPoolExecutor::ThreadLoads& threads) override;
+
+ private:
+  std::shared_ptr<IOThreadPoolExecutor::ThreadSelector> fallback_;
 };
 
 }} // folly::wangle
@@ -0,0 +1,170 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/InlineOrOffloadExecutor.h>
+
+#include <folly/MoveWrapper.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <glog/logging.h>
+
+#include <typeinfo>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+int64_t steadyNowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t toNs(std::chrono::microseconds us) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(us).count();
+}
+
+}
+
+const std::string& InlineOrOffloadExecutor::TaskType::getName() const {
+  CHECK(stats_);
+  return stats_->name;
+}
+
+std::chrono::nanoseconds
+InlineOrOffloadExecutor::TaskType::getAverageRunTime() const {
+  CHECK(stats_);
+  return std::chrono::nanoseconds(
+      stats_->averageNs.load(std::memory_order_relaxed));
+}
+
+bool InlineOrOffloadExecutor::TaskType::isInline() const {
+  CHECK(stats_);
+  return stats_->runInline.load(std::memory_order_relaxed);
+}
+
+InlineOrOffloadExecutor::InlineOrOffloadExecutor(
+    std::shared_ptr<Executor> offload,
+    Options options)
+    : offload_(std::move(offload)),
+      options_(options) {
+  CHECK(offload_);
+  CHECK(options_.inlineThreshold <= options_.offloadThreshold);
+}
+
+InlineOrOffloadExecutor::TaskType
+InlineOrOffloadExecutor::newTaskType(std::string name) {
+  return TaskType(std::make_shared<TypeStats>(std::move(name)));
+}
+
+void InlineOrOffloadExecutor::add(Func func) {
+  numOffloaded_.fetch_add(1, std::memory_order_relaxed);
+  offload_->add(std::move(func));
+}
+
+void InlineOrOffloadExecutor::add(const TaskType& type, Func func) {
+  CHECK(type.stats_);
+  auto& stats = *type.stats_;
+  if (stats.runInline.load(std::memory_order_relaxed)) {
+    auto evb = EventBaseManager::get()->getExistingEventBase();
+    if (evb && evb->isInEventBaseThread()) {
+      auto& budget = *loopBudget_;
+      if (budget.evb != evb) {
+        budget.cancelLoopCallback();
+        budget.evb = evb;
+        budget.spentNs = 0;
+      }
+      if (budget.running) {
+        // Added by an inline task: run it once that's done, starting over
+        numDeferred_.fetch_add(1, std::memory_order_relaxed);
+        auto stats = type.stats_;
+        auto moveFunc = folly::makeMoveWrapper(std::move(func));
+        evb->runInLoop([this, stats, moveFunc]() mutable {
+          add(TaskType(stats), std::move(*moveFunc));
+        });
+        return;
+      }
+      if (budget.spentNs < toNs(options_.loopBudget)) {
+        // Starts the budget over once this loop iteration is done
+        if (!budget.isLoopCallbackScheduled()) {
+          evb->runInLoop(&budget);
+        }
+        numInline_.fetch_add(1, std::memory_order_relaxed);
+        // Charged before it runs, then corrected
+        auto estimateNs = stats.averageNs.load(std::memory_order_relaxed);
+        budget.spentNs += estimateNs;
+        budget.running = true;
+        auto runNs = run(stats, options_, func);
+        budget.running = false;
+        budget.spentNs += runNs - estimateNs;
+        return;
+      }
+      numOverBudget_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  offload(type.stats_, std::move(func));
+}
+
+void InlineOrOffloadExecutor::offload(
+    const std::shared_ptr<TypeStats>& stats,
+    Func func) {
+  numOffloaded_.fetch_add(1, std::memory_order_relaxed);
+  // Both may outlive this
+  auto options = options_;
+  auto moveFunc = folly::makeMoveWrapper(std::move(func));
+  offload_->add([stats, options, moveFunc]() mutable {
+    run(*stats, options, *moveFunc);
+  });
+}
+
+int64_t InlineOrOffloadExecutor::run(
+    TypeStats& stats,
+    const Options& options,
+    Func& func) {
+  auto start = steadyNowNs();
+  try {
+    func();
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "InlineOrOffloadExecutor: task of type " << stats.name
+               << " threw unhandled " << typeid(e).name() << " exception "
+               << e.what();
+  } catch (...) {
+    LOG(ERROR) << "InlineOrOffloadExecutor: task of type " << stats.name
+               << " threw unhandled non-exception object";
+  }
+  auto runNs = steadyNowNs() - start;
+  record(stats, options, runNs);
+  return runNs;
+}
+
+void InlineOrOffloadExecutor::record(
+    TypeStats& stats,
+    const Options& options,
+    int64_t runNs) {
+  // Racy between the threads running the type's tasks, but only has to be
+  // roughly right
+  auto samples = stats.samples.load(std::memory_order_relaxed);
+  auto average = stats.averageNs.load(std::memory_order_relaxed);
+  average = samples == 0 ? runNs : average + (runNs - average) / 8;
+  stats.averageNs.store(average, std::memory_order_relaxed);
+  if (samples < options.minSamples) {
+    stats.samples.store(++samples, std::memory_order_relaxed);
+    if (samples < options.minSamples) {
+      return;
+    }
+  }
+  if (stats.runInline.load(std::memory_order_relaxed)) {
+    if (average > toNs(options.offloadThreshold)) {
+      stats.runInline.store(false, std::memory_order_relaxed);
+    }
+  } else if (average < toNs(options.inlineThreshold)) {
+    stats.runInline.store(true, std::memory_order_relaxed);
+  }
+}
+
+}} // namespace
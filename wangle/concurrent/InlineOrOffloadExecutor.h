@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Executor.h>
+#include <folly/ThreadLocal.h>
+#include <folly/io/async/EventBase.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+namespace folly { namespace wangle {
+
+/**
+ * An executor for the small bits of CPU work handlers hand off from their
+ * IO threads, which often cost less than the two thread hops of running
+ * them on a CPU pool and coming back.  Tasks are added with the TaskType
+ * they're of, and each type's run time is tracked as a moving average,
+ * wherever its tasks run.  A type averaging under inlineThreshold runs
+ * inline when added from an EventBase's thread, until it averages over
+ * offloadThreshold, which is kept above it so that a type near the line
+ * doesn't flip back and forth; other types, and tasks added from elsewhere,
+ * go to the offload executor.  No more than loopBudget of each loop
+ * iteration of an EventBase is spent inline, the rest of the iteration's
+ * tasks being offloaded, so IO latency stays bounded however many come.
+ * A task is charged its type's average up front, and a task added from
+ * inside an inline one is deferred to the loop's next iteration instead of
+ * nesting, so chains of tasks adding tasks can't run unbounded inline.
+ *
+ *   auto parse = executor->newTaskType("parse");
+ *   executor->add(parse, [=] { ... });
+ *
+ * Tasks added without a type are offloaded.  Destroy the executor once the
+ * EventBases it ran tasks inline on aren't looping anymore.
+ */
+class InlineOrOffloadExecutor : public Executor {
+  struct TypeStats;
+
+ public:
+  struct Options {
+    std::chrono::microseconds inlineThreshold{20};
+    std::chrono::microseconds offloadThreshold{50};
+    std::chrono::microseconds loopBudget{500};
+    // Runs of a new type timed on the offload executor before it can go
+    // inline
+    uint32_t minSamples{16};
+  };
+
+  // Cheap to copy, and to be kept for the life of the tasks' source
+  class TaskType {
+   public:
+    TaskType() = default;
+
+    const std::string& getName() const;
+
+    // Moving average of the type's tasks' run times
+    std::chrono::nanoseconds getAverageRunTime() const;
+
+    // Whether its tasks run inline, on their EventBase's thread
+    bool isInline() const;
+
+   private:
+    friend class InlineOrOffloadExecutor;
+
+    explicit TaskType(std::shared_ptr<TypeStats> stats)
+        : stats_(std::move(stats)) {}
+
+    std::shared_ptr<TypeStats> stats_;
+  };
+
+  explicit InlineOrOffloadExecutor(std::shared_ptr<Executor> offload)
+      : InlineOrOffloadExecutor(std::move(offload), Options()) {}
+
+  InlineOrOffloadExecutor(std::shared_ptr<Executor> offload,
+                          Options options);
+
+  TaskType newTaskType(std::string name);
+
+  void add(Func func) override;
+  void add(const TaskType& type, Func func);
+
+  uint64_t getNumInline() const {
+    return numInline_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumOffloaded() const {
+    return numOffloaded_.load(std::memory_order_relaxed);
+  }
+
+  // Tasks offloaded for want of loop budget
+  uint64_t getNumOverBudget() const {
+    return numOverBudget_.load(std::memory_order_relaxed);
+  }
+
+  // Tasks added from inside an inline task, run from the loop instead
+  uint64_t getNumDeferred() const {
+    return numDeferred_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct TypeStats {
+    explicit TypeStats(std::string n) : name(std::move(n)) {}
+
+    const std::string name;
+    std::atomic<int64_t> averageNs{0};
+    std::atomic<uint32_t> samples{0};
+    std::atomic<bool> runInline{false};
+  };
+
+  // Inline time spent in the current loop iteration, on one thread
+  class LoopBudget : public EventBase::LoopCallback {
+   public:
+    void runLoopCallback() noexcept override {
+      spentNs = 0;
+    }
+
+    EventBase* evb{nullptr};
+    int64_t spentNs{0};
+    // Whether an inline task is running
+    bool running{false};
+  };
+
+  void offload(const std::shared_ptr<TypeStats>& stats, Func func);
+  // Returns how long func took
+  static int64_t run(TypeStats& stats, const Options& options, Func& func);
+  static void record(TypeStats& stats, const Options& options,
+                     int64_t runNs);
+
+  const std::shared_ptr<Executor> offload_;
+  const Options options_;
+  ThreadLocal<LoopBudget> loopBudget_;
+  std::atomic<uint64_t> numInline_{0};
+  std::atomic<uint64_t> numOffloaded_{0};
+  std::atomic<uint64_t> numOverBudget_{0};
+  std::atomic<uint64_t> numDeferred_{0};
+};
+
+}} // namespace
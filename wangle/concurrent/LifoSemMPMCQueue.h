@@ -15,16 +15,46 @@
 
 namespace folly { namespace wangle {
 
-template <class T>
+// Queue may also be a SegmentedMPMCQueue, which only allocates the
+// capacity it uses
+template <class T, class Queue = MPMCQueue<T>>
 class LifoSemMPMCQueue : public BlockingQueue<T> {
  public:
   explicit LifoSemMPMCQueue(size_t max_capacity) : queue_(max_capacity) {}
 
   void add(T item) override {
+    if (!tryAdd(item)) {
+      throw QueueFullException("LifoSemMPMCQueue full, can't add item");
+    }
+  }
+
+  bool tryAdd(T& item) override {
     if (!queue_.write(std::move(item))) {
-      throw std::runtime_error("LifoSemMPMCQueue full, can't add item");
+      return false;
     }
     sem_.post();
+    return true;
+  }
+
+  // Leaves an extra post on sem_, which take() tolerates
+  bool tryTakeOldest(T& item, int8_t priority) override {
+    return queue_.read(item);
+  }
+
+  void addBatch(std::vector<T> items) override {
+    uint32_t added = 0;
+    for (auto& item : items) {
+      if (!queue_.write(std::move(item))) {
+        if (added > 0) {
+          sem_.post(added);
+        }
+        throw QueueFullException("LifoSemMPMCQueue full, can't add item");
+      }
+      added++;
+    }
+    if (added > 0) {
+      sem_.post(added);
+    }
   }
 
   T take() override {
@@ -45,7 +75,7 @@ class LifoSemMPMCQueue : public BlockingQueue<T> {
 
  private:
   LifoSem sem_;
-  MPMCQueue<T> queue_;
+  Queue queue_;
 };
 
 }} // folly::wangle
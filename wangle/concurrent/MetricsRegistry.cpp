@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/MetricsRegistry.h>
+
+#include <glog/logging.h>
+
+namespace folly { namespace wangle {
+
+const size_t MetricsRegistry::kMaxCounters;
+const size_t MetricsRegistry::kMaxHistograms;
+
+MetricsRegistry& MetricsRegistry::getDefault() {
+  static auto registry = new MetricsRegistry();
+  return *registry;
+}
+
+MetricsRegistry::Counter MetricsRegistry::counter(const std::string& name) {
+  std::lock_guard<std::mutex> g(lock_);
+  auto it = counterIds_.find(name);
+  if (it == counterIds_.end()) {
+    CHECK_LT(counterIds_.size(), kMaxCounters) << "Too many counters";
+    it = counterIds_.emplace(name, counterIds_.size()).first;
+  }
+  return Counter(this, it->second);
+}
+
+MetricsRegistry::Histogram MetricsRegistry::histogram(
+    const std::string& name) {
+  std::lock_guard<std::mutex> g(lock_);
+  auto it = histogramIds_.find(name);
+  if (it == histogramIds_.end()) {
+    CHECK_LT(histogramIds_.size(), kMaxHistograms) << "Too many histograms";
+    it = histogramIds_.emplace(name, histogramIds_.size()).first;
+  }
+  return Histogram(this, it->second);
+}
+
+void MetricsRegistry::setGauge(const std::string& name,
+                               std::function<int64_t()> gauge) {
+  std::lock_guard<std::mutex> g(lock_);
+  gauges_[name] = std::move(gauge);
+}
+
+void MetricsRegistry::removeGauge(const std::string& name) {
+  std::lock_guard<std::mutex> g(lock_);
+  gauges_.erase(name);
+}
+
+MetricsRegistry::Snapshot MetricsRegistry::getSnapshot() {
+  Snapshot s;
+  std::lock_guard<std::mutex> g(lock_);
+  for (const auto& counter : counterIds_) {
+    uint64_t total = 0;
+    for (const auto& shard : shards_) {
+      total += shard->counters[counter.second].load(std::memory_order_relaxed);
+    }
+    s.counters[counter.first] = total;
+  }
+  for (const auto& histogram : histogramIds_) {
+    auto& total = s.histograms[histogram.first];
+    for (const auto& shard : shards_) {
+      total.merge(shard->histograms[histogram.second]);
+    }
+  }
+  for (const auto& gauge : gauges_) {
+    s.gauges[gauge.first] = gauge.second();
+  }
+  return s;
+}
+
+uint64_t MetricsRegistry::getCounter(size_t id) {
+  std::lock_guard<std::mutex> g(lock_);
+  uint64_t total = 0;
+  for (const auto& shard : shards_) {
+    total += shard->counters[id].load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+TaskLatencyHistogram MetricsRegistry::getHistogram(size_t id) {
+  std::lock_guard<std::mutex> g(lock_);
+  TaskLatencyHistogram total;
+  for (const auto& shard : shards_) {
+    total.merge(shard->histograms[id]);
+  }
+  return total;
+}
+
+void MetricsRegistry::attach(LocalShard& local) {
+  std::lock_guard<std::mutex> g(lock_);
+  local.registry = this;
+  if (!freeShards_.empty()) {
+    local.shard = freeShards_.back();
+    freeShards_.pop_back();
+    return;
+  }
+  shards_.emplace_back(new Shard());
+  local.shard = shards_.back().get();
+}
+
+MetricsRegistry::LocalShard::~LocalShard() {
+  if (shard) {
+    std::lock_guard<std::mutex> g(registry->lock_);
+    registry->freeShards_.push_back(shard);
+  }
+}
+
+}} // namespace
@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/concurrent/TaskLatencyHistogram.h>
+
+#include <folly/Likely.h>
+#include <folly/ThreadLocal.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * Named counters, latency histograms and gauges, for the subsystems of a
+ * server to report into and for whoever exports its stats to read all at
+ * once.  getDefault() is the one wangle's own report into:
+ *
+ *   acceptor.connections         connections accepted and ready
+ *   acceptor.accept_errors       failed accepts, mostly from running out
+ *                                of file descriptors
+ *   acceptor.ssl_handshakes      SSL handshakes done, and failed or
+ *   acceptor.ssl_handshake_errors  dropped
+ *   acceptor.pending_ssl_handshakes  (gauge) in progress, on all threads
+ *   connections.added            connections a ConnectionManager took on,
+ *   connections.removed          and let go of
+ *   executor.tasks_run           tasks a ThreadPoolExecutor ran, and
+ *   executor.tasks_expired       those that expired instead
+ *   executor.task_wait_time      (histogram) their time in the queue
+ *   socket.bytes_read            through AsyncSocketHandlers
+ *   socket.bytes_written
+ *   codec.frames_decoded         by ByteToMessageCodecs
+ *
+ * Counters and histograms are sharded by thread: each thread that records
+ * into a registry gets a shard of its own, so recording is a relaxed load
+ * and store to memory no other thread writes, with no atomic
+ * read-modify-write and no cacheline bouncing.  Reading them adds up the
+ * shards, costing a lock and a pass over them; shards of threads that
+ * have exited keep their counts, and are reused by new threads.  Gauges
+ * are functions, called when read, for values that already live elsewhere
+ * such as queue depths.
+ *
+ * Handles to counters and histograms are looked up by name once, and are
+ * then good for as long as the registry.
+ */
+class MetricsRegistry {
+ public:
+  static const size_t kMaxCounters = 256;
+  static const size_t kMaxHistograms = 16;
+
+  class Counter {
+   public:
+    Counter() = default;
+
+    void add(uint64_t n = 1) const {
+      auto& c = registry_->getShard()->counters[id_];
+      c.store(c.load(std::memory_order_relaxed) + n,
+              std::memory_order_relaxed);
+    }
+
+    // The total over all threads
+    uint64_t get() const {
+      return registry_->getCounter(id_);
+    }
+
+   private:
+    friend class MetricsRegistry;
+
+    Counter(MetricsRegistry* registry, size_t id)
+        : registry_(registry), id_(id) {}
+
+    MetricsRegistry* registry_{nullptr};
+    size_t id_{0};
+  };
+
+  class Histogram {
+   public:
+    Histogram() = default;
+
+    void addValue(std::chrono::nanoseconds value) const {
+      registry_->getShard()->histograms[id_].addValue(value);
+    }
+
+    TaskLatencyHistogram get() const {
+      return registry_->getHistogram(id_);
+    }
+
+   private:
+    friend class MetricsRegistry;
+
+    Histogram(MetricsRegistry* registry, size_t id)
+        : registry_(registry), id_(id) {}
+
+    MetricsRegistry* registry_{nullptr};
+    size_t id_{0};
+  };
+
+  struct Snapshot {
+    std::map<std::string, uint64_t> counters;
+    std::map<std::string, TaskLatencyHistogram> histograms;
+    std::map<std::string, int64_t> gauges;
+  };
+
+  MetricsRegistry() = default;
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  // The process's, never destroyed
+  static MetricsRegistry& getDefault();
+
+  // The one of that name, made the first time it's asked for; at most
+  // kMaxCounters and kMaxHistograms of them
+  Counter counter(const std::string& name);
+  Histogram histogram(const std::string& name);
+
+  // Replaces any gauge of that name.  Called under the registry's lock,
+  // from whichever thread reads it, so it mustn't use the registry.
+  void setGauge(const std::string& name, std::function<int64_t()> gauge);
+  void removeGauge(const std::string& name);
+
+  Snapshot getSnapshot();
+
+ private:
+  // Each its own allocation of some 32KB, written by one thread, so only
+  // its first and last bytes can share a cacheline with anything else
+  struct Shard {
+    std::atomic<uint64_t> counters[kMaxCounters];
+    TaskLatencyHistogram histograms[kMaxHistograms];
+
+    Shard() {
+      for (auto& counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  // A thread's shard, given back when the thread exits
+  struct LocalShard {
+    ~LocalShard();
+
+    MetricsRegistry* registry{nullptr};
+    Shard* shard{nullptr};
+  };
+
+  Shard* getShard() {
+    auto& local = *local_;
+    if (UNLIKELY(!local.shard)) {
+      attach(local);
+    }
+    return local.shard;
+  }
+
+  void attach(LocalShard& local);
+  uint64_t getCounter(size_t id);
+  TaskLatencyHistogram getHistogram(size_t id);
+
+  std::mutex lock_;
+  std::map<std::string, size_t> counterIds_;
+  std::map<std::string, size_t> histogramIds_;
+  std::map<std::string, std::function<int64_t()>> gauges_;
+  // Every shard made, in use or not
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::vector<Shard*> freeShards_;
+  // Destroyed first, giving the shards back while the rest is still there
+  ThreadLocal<LocalShard> local_;
+};
+
+}} // namespace
@@ -10,45 +10,120 @@
 
 #pragma once
 #include <wangle/concurrent/BlockingQueue.h>
+#include <folly/Bits.h>
 #include <folly/LifoSem.h>
 #include <folly/MPMCQueue.h>
+#include <folly/ThreadLocal.h>
+
+#include <atomic>
+#include <memory>
 
 namespace folly { namespace wangle {
 
-template <class T>
+/**
+ * A LifoSem-backed blocking queue with one MPMCQueue per priority.
+ *
+ * A bitmap of possibly nonempty priorities lets take() go straight to the
+ * highest priority that has work, and lets size() skip empty ones, instead
+ * of probing every MPMCQueue.  Bits are set by add() after writing an item
+ * and cleared by a take() that finds the queue empty, which then reads the
+ * queue once more so that a racing add() can't leave an item unmarked.
+ *
+ * Strict priority can starve the lower priorities under sustained load.
+ * setStarvationInterval(n) makes every n-th take() of each thread serve
+ * the lowest nonempty priority instead; the takes are counted per thread,
+ * so the consumers don't all write to one shared counter.
+ *
+ * Each priority's Queue gets the full capacity; a SegmentedMPMCQueue only
+ * allocates what is used of it, which matters with many priorities.
+ */
+template <class T, class Queue = MPMCQueue<T>>
 class PriorityLifoSemMPMCQueue : public BlockingQueue<T> {
  public:
-  explicit PriorityLifoSemMPMCQueue(uint8_t numPriorities, size_t capacity) {
+  explicit PriorityLifoSemMPMCQueue(uint8_t numPriorities, size_t capacity)
+    : numWords_((numPriorities + kBitsPerWord - 1) / kBitsPerWord),
+      nonEmpty_(new std::atomic<uint64_t>[numWords_]) {
     queues_.reserve(numPriorities);
-    for (int8_t i = 0; i < numPriorities; i++) {
+    for (size_t i = 0; i < numPriorities; i++) {
       queues_.emplace_back(capacity);
     }
+    for (size_t i = 0; i < numWords_; i++) {
+      nonEmpty_[i].store(0, std::memory_order_relaxed);
+    }
   }
 
   uint8_t getNumPriorities() override {
     return queues_.size();
   }
 
+  // 0, the default, disables starvation protection
+  void setStarvationInterval(uint32_t n) {
+    starvationInterval_ = n;
+  }
+
   // Add at medium priority by default
   void add(T item) override {
     addWithPriority(std::move(item), Executor::MID_PRI);
   }
 
   void addWithPriority(T item, int8_t priority) override {
-    int mid = getNumPriorities() / 2;
-    size_t queue = priority < 0 ?
-                   std::max(0, mid + priority) :
-                   std::min(getNumPriorities() - 1, mid + priority);
-    CHECK(queue < queues_.size());
+    if (!tryAddWithPriority(item, priority)) {
+      throw QueueFullException("LifoSemMPMCQueue full, can't add item");
+    }
+  }
+
+  bool tryAdd(T& item) override {
+    return tryAddWithPriority(item, Executor::MID_PRI);
+  }
+
+  bool tryAddWithPriority(T& item, int8_t priority) override {
+    auto queue = getQueueIndex(priority);
     if (!queues_[queue].write(std::move(item))) {
-      throw std::runtime_error("LifoSemMPMCQueue full, can't add item");
+      return false;
     }
+    markNonEmpty(queue);
     sem_.post();
+    return true;
+  }
+
+  // Leaves an extra post on sem_, which take() tolerates
+  bool tryTakeOldest(T& item, int8_t priority) override {
+    return queues_[getQueueIndex(priority)].read(item);
+  }
+
+  // Adds all items at medium priority
+  void addBatch(std::vector<T> items) override {
+    int mid = getNumPriorities() / 2;
+    uint32_t added = 0;
+    for (auto& item : items) {
+      if (!queues_[mid].write(std::move(item))) {
+        if (added > 0) {
+          markNonEmpty(mid);
+          sem_.post(added);
+        }
+        throw QueueFullException("LifoSemMPMCQueue full, can't add item");
+      }
+      added++;
+    }
+    if (added > 0) {
+      markNonEmpty(mid);
+      sem_.post(added);
+    }
   }
 
   T take() override {
     T item;
     while (true) {
+      auto interval = starvationInterval_.load(std::memory_order_relaxed);
+      if (interval > 0 && ++*takes_ % interval == 0 &&
+          tryTakeLowest(item)) {
+        return item;
+      }
+      if (tryTakeHighest(item)) {
+        return item;
+      }
+      // The bitmap is only a hint while adds race with us, so make sure
+      // everything is empty before sleeping
       for (auto it = queues_.rbegin(); it != queues_.rend(); it++) {
         if (it->read(item)) {
           return item;
@@ -59,16 +134,100 @@ class PriorityLifoSemMPMCQueue : public BlockingQueue<T> {
   }
 
   size_t size() override {
-    size_t size = 0;
-    for (auto& q : queues_) {
-      size += q.size();
-    }
-    return size;
+    return sizeFrom(0);
+  }
+
+  size_t sizeAbove(int8_t priority) override {
+    return sizeFrom(getQueueIndex(priority) + 1);
   }
 
  private:
+  static const size_t kBitsPerWord = 64;
+
+  size_t getQueueIndex(int8_t priority) {
+    int mid = getNumPriorities() / 2;
+    size_t queue = priority < 0 ?
+                   std::max(0, mid + priority) :
+                   std::min(getNumPriorities() - 1, mid + priority);
+    CHECK(queue < queues_.size());
+    return queue;
+  }
+
+  void markNonEmpty(size_t queue) {
+    auto& word = nonEmpty_[queue / kBitsPerWord];
+    auto bit = uint64_t(1) << (queue % kBitsPerWord);
+    // Skip the read-modify-write in the common, already marked, case
+    if (!(word.load(std::memory_order_seq_cst) & bit)) {
+      word.fetch_or(bit, std::memory_order_seq_cst);
+    }
+  }
+
+  bool tryRead(size_t queue, T& item) {
+    if (queues_[queue].read(item)) {
+      return true;
+    }
+    auto& word = nonEmpty_[queue / kBitsPerWord];
+    word.fetch_and(~(uint64_t(1) << (queue % kBitsPerWord)),
+                   std::memory_order_seq_cst);
+    // An add() may have written its item before we cleared its bit
+    if (queues_[queue].read(item)) {
+      markNonEmpty(queue);
+      return true;
+    }
+    return false;
+  }
+
+  bool tryTakeHighest(T& item) {
+    for (size_t w = numWords_; w-- > 0; ) {
+      auto bits = nonEmpty_[w].load(std::memory_order_seq_cst);
+      while (bits) {
+        size_t bit = folly::findLastSet(bits) - 1;
+        if (tryRead(w * kBitsPerWord + bit, item)) {
+          return true;
+        }
+        bits &= ~(uint64_t(1) << bit);
+      }
+    }
+    return false;
+  }
+
+  bool tryTakeLowest(T& item) {
+    for (size_t w = 0; w < numWords_; w++) {
+      auto bits = nonEmpty_[w].load(std::memory_order_seq_cst);
+      while (bits) {
+        size_t bit = folly::findFirstSet(bits) - 1;
+        if (tryRead(w * kBitsPerWord + bit, item)) {
+          return true;
+        }
+        bits &= ~(uint64_t(1) << bit);
+      }
+    }
+    return false;
+  }
+
+  // Approximate number of items at queue index first or above
+  size_t sizeFrom(size_t first) {
+    ssize_t size = 0;
+    for (size_t w = first / kBitsPerWord; w < numWords_; w++) {
+      auto bits = nonEmpty_[w].load(std::memory_order_relaxed);
+      if (w == first / kBitsPerWord) {
+        bits &= ~uint64_t(0) << (first % kBitsPerWord);
+      }
+      while (bits) {
+        size_t bit = folly::findFirstSet(bits) - 1;
+        size += queues_[w * kBitsPerWord + bit].size();
+        bits &= bits - 1;
+      }
+    }
+    return size > 0 ? size : 0;
+  }
+
   LifoSem sem_;
-  std::vector<MPMCQueue<T>> queues_;
+  std::vector<Queue> queues_;
+  const size_t numWords_;
+  std::unique_ptr<std::atomic<uint64_t>[]> nonEmpty_;
+  std::atomic<uint32_t> starvationInterval_{0};
+  ThreadLocal<uint32_t> takes_;
 };
 
 }} // folly::wangle
@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/RequestDeadline.h>
+
+#include <folly/Portability.h>
+
+#include <algorithm>
+#include <limits>
+
+namespace folly { namespace wangle {
+
+namespace {
+
+const int64_t kNone = std::numeric_limits<int64_t>::max();
+
+// Read for every task added to an executor, so a plain thread local rather
+// than a ThreadLocal; in nanoseconds of the steady clock
+FOLLY_TLS int64_t deadlineNs = kNone;
+
+void set(RequestDeadline::TimePoint deadline) {
+  deadlineNs = deadline == RequestDeadline::none()
+    ? kNone
+    : std::chrono::duration_cast<std::chrono::nanoseconds>(
+        deadline.time_since_epoch()).count();
+}
+
+}
+
+RequestDeadline::TimePoint RequestDeadline::get() {
+  if (deadlineNs == kNone) {
+    return none();
+  }
+  return TimePoint(std::chrono::duration_cast<Clock::duration>(
+    std::chrono::nanoseconds(deadlineNs)));
+}
+
+std::chrono::milliseconds RequestDeadline::remaining(TimePoint now) {
+  auto deadline = get();
+  if (deadline == none()) {
+    return std::chrono::milliseconds::max();
+  }
+  if (now >= deadline) {
+    return std::chrono::milliseconds(0);
+  }
+  auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    deadline - now);
+  return std::chrono::milliseconds((left.count() + 999999) / 1000000);
+}
+
+RequestDeadline::TimePoint RequestDeadline::within(
+    std::chrono::milliseconds timeout, TimePoint now) {
+  auto deadline = get();
+  if (deadline - now <= timeout) {
+    return deadline;
+  }
+  return now + timeout;
+}
+
+RequestDeadline::Guard::Guard(TimePoint deadline) : saved_(get()) {
+  set(deadline);
+}
+
+RequestDeadline::Guard::~Guard() {
+  set(saved_);
+}
+
+}} // namespace
@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+
+namespace folly { namespace wangle {
+
+/**
+ * Thrown, through a request's Future, when its deadline passed before it
+ * was done
+ */
+class DeadlineExceeded : public std::runtime_error {
+ public:
+  DeadlineExceeded() : std::runtime_error("Request deadline exceeded") {}
+};
+
+/**
+ * The deadline of the request the current thread is working on, by which
+ * its client stops waiting for it, so nothing more need be done for it;
+ * none() when there's none.
+ *
+ * The server dispatchers set it as they hand a request to their service,
+ * so the service and its filters see it for as long as they run there.
+ * Tasks added to a ThreadPoolExecutor take it with them: one added with an
+ * expireCallback and still queued at the deadline expires rather than
+ * run, and one that runs sees it again.  The client dispatchers fail
+ * requests made past it, and time the others out at it at the latest.
+ * Code that carries on a request from a callback elsewhere, such as a
+ * timer or an EventBase, takes get() along and sets it again with a Guard.
+ */
+class RequestDeadline {
+ public:
+  typedef std::chrono::steady_clock Clock;
+  typedef Clock::time_point TimePoint;
+
+  static TimePoint none() {
+    return TimePoint::max();
+  }
+
+  static TimePoint get();
+
+  static bool isSet() {
+    return get() != none();
+  }
+
+  static bool expired(TimePoint now = Clock::now()) {
+    return now >= get();
+  }
+
+  // Until the deadline, rounded up to a whole millisecond; 0 once it's
+  // passed, and max() when there's none
+  static std::chrono::milliseconds remaining(TimePoint now = Clock::now());
+
+  // The earlier of the deadline and timeout from now, for a Guard
+  static TimePoint within(std::chrono::milliseconds timeout,
+                          TimePoint now = Clock::now());
+
+  /**
+   * Sets the current thread's deadline to `deadline`, and back to what it
+   * was when destroyed
+   */
+  class Guard {
+   public:
+    explicit Guard(TimePoint deadline);
+    ~Guard();
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    TimePoint saved_;
+  };
+};
+
+}} // namespace
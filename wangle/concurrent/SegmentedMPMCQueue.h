@@ -0,0 +1,187 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/SmallLocks.h>
+#include <glog/logging.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+namespace folly { namespace wangle {
+
+/**
+ * A bounded multi-producer multi-consumer FIFO that only allocates memory
+ * for what it holds, unlike MPMCQueue, which allocates all of its capacity
+ * up front.  Items live in fixed-size segments that are allocated as the
+ * queue grows and freed as it drains; one drained segment is kept around,
+ * so a queue that hovers around a segment boundary doesn't allocate on
+ * every write.  An empty queue that was never written to allocates nothing.
+ *
+ * write() and read() have the same semantics as MPMCQueue's, so this can
+ * be used as the Queue of LifoSemMPMCQueue and PriorityLifoSemMPMCQueue.
+ * They take a spin lock for a few instructions each, which costs some
+ * throughput against MPMCQueue when many threads hammer the same queue.
+ */
+template <class T>
+class SegmentedMPMCQueue {
+  static_assert(std::is_nothrow_move_constructible<T>::value,
+                "SegmentedMPMCQueue needs noexcept move constructible items");
+
+ public:
+  static const size_t kDefaultSegmentSize = 256;
+
+  explicit SegmentedMPMCQueue(size_t capacity,
+                              size_t segmentSize = kDefaultSegmentSize)
+    : capacity_(capacity),
+      segmentSize_(segmentSize) {
+    CHECK(segmentSize_ > 0);
+    lock_.init();
+  }
+
+  // Like MPMCQueue's, not safe while other threads use either queue
+  SegmentedMPMCQueue(SegmentedMPMCQueue&& other) noexcept
+    : capacity_(other.capacity_),
+      segmentSize_(other.segmentSize_),
+      head_(other.head_),
+      tail_(other.tail_),
+      spare_(other.spare_),
+      segments_(other.segments_) {
+    lock_.init();
+    size_.store(other.size_.load(std::memory_order_relaxed),
+                std::memory_order_relaxed);
+    other.head_ = other.tail_ = other.spare_ = nullptr;
+    other.segments_ = 0;
+    other.size_.store(0, std::memory_order_relaxed);
+  }
+
+  SegmentedMPMCQueue(const SegmentedMPMCQueue&) = delete;
+  SegmentedMPMCQueue& operator=(const SegmentedMPMCQueue&) = delete;
+
+  ~SegmentedMPMCQueue() {
+    while (head_) {
+      auto segment = head_;
+      head_ = segment->next;
+      for (auto i = segment->readIndex; i < segment->writeIndex; i++) {
+        segment->slot(i)->~T();
+      }
+      freeSegment(segment);
+    }
+    freeSegment(spare_);
+  }
+
+  // False, leaving item alone, if the queue is at capacity
+  bool write(T&& item) {
+    std::lock_guard<MicroSpinLock> g(lock_);
+    auto size = size_.load(std::memory_order_relaxed);
+    if (size_t(size) >= capacity_) {
+      return false;
+    }
+    if (!tail_ || tail_->writeIndex == segmentSize_) {
+      auto segment = spare_ ? spare_ : allocateSegment();
+      spare_ = nullptr;
+      if (tail_) {
+        tail_->next = segment;
+      } else {
+        head_ = segment;
+      }
+      tail_ = segment;
+    }
+    new (tail_->slot(tail_->writeIndex++)) T(std::move(item));
+    size_.store(size + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  // False if the queue is empty
+  bool read(T& item) {
+    std::lock_guard<MicroSpinLock> g(lock_);
+    auto size = size_.load(std::memory_order_relaxed);
+    if (size == 0) {
+      return false;
+    }
+    auto p = head_->slot(head_->readIndex++);
+    item = std::move(*p);
+    p->~T();
+    size_.store(size - 1, std::memory_order_relaxed);
+    if (head_->readIndex == head_->writeIndex) {
+      auto drained = head_;
+      head_ = drained->next;
+      if (!head_) {
+        tail_ = nullptr;
+      }
+      drained->readIndex = drained->writeIndex = 0;
+      drained->next = nullptr;
+      if (spare_) {
+        freeSegment(drained);
+      } else {
+        spare_ = drained;
+      }
+    }
+    return true;
+  }
+
+  ssize_t size() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+  size_t capacity() const {
+    return capacity_;
+  }
+
+  // Allocated segments, including the spare one
+  size_t getAllocatedSegments() const {
+    std::lock_guard<MicroSpinLock> g(lock_);
+    return segments_;
+  }
+
+ private:
+  struct Segment {
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+    explicit Segment(size_t size) : slots(new Slot[size]) {}
+
+    T* slot(size_t i) {
+      return reinterpret_cast<T*>(&slots[i]);
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    size_t readIndex{0};
+    size_t writeIndex{0};
+    Segment* next{nullptr};
+  };
+
+  Segment* allocateSegment() {
+    segments_++;
+    return new Segment(segmentSize_);
+  }
+
+  void freeSegment(Segment* segment) {
+    if (segment) {
+      segments_--;
+      delete segment;
+    }
+  }
+
+  const size_t capacity_;
+  const size_t segmentSize_;
+  mutable MicroSpinLock lock_;
+  // Items are read from head_ and written to tail_; both are null when
+  // the queue is empty
+  Segment* head_{nullptr};
+  Segment* tail_{nullptr};
+  Segment* spare_{nullptr};
+  size_t segments_{0};
+  std::atomic<ssize_t> size_{0};
+};
+
+}} // folly::wangle
@@ -0,0 +1,209 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace folly { namespace wangle {
+
+/*
+ * Move-only void() callable, used as the body of executor tasks.
+ *
+ * Unlike std::function, whose inline buffer fits about two pointers, it
+ * stores callables of up to kInlineSize bytes (six pointers, e.g. a
+ * lambda capturing a few pointers and a shared_ptr) next to it without
+ * allocating, and since it never copies, it can hold move-only captures.
+ * A std::function fits inline, so wrapping one is free as well.
+ * Larger callables, or ones whose move constructor may throw, go on the
+ * heap.
+ */
+class TaskFunc {
+ public:
+  static const size_t kInlineSize = 6 * sizeof(void*);
+
+  TaskFunc() noexcept : ops_(nullptr) {}
+
+  /* implicit */ TaskFunc(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+  template <
+    class F,
+    class = typename std::enable_if<!std::is_same<
+      typename std::decay<F>::type, TaskFunc>::value>::type>
+  /* implicit */ TaskFunc(F&& f) : ops_(nullptr) {
+    typedef typename std::decay<F>::type Fn;
+    if (isEmpty(f)) {
+      return;
+    }
+    init<Fn>(std::forward<F>(f), Inline<Fn>());
+  }
+
+  TaskFunc(TaskFunc&& other) noexcept : ops_(nullptr) {
+    moveFrom(other);
+  }
+
+  TaskFunc& operator=(TaskFunc&& other) noexcept {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  TaskFunc& operator=(std::nullptr_t) noexcept {
+    reset();
+    return *this;
+  }
+
+  TaskFunc(const TaskFunc&) = delete;
+  TaskFunc& operator=(const TaskFunc&) = delete;
+
+  ~TaskFunc() {
+    reset();
+  }
+
+  // Throws std::bad_function_call if empty, like std::function
+  void operator()() {
+    if (!ops_) {
+      throw std::bad_function_call();
+    }
+    ops_->call(&storage_);
+  }
+
+  explicit operator bool() const noexcept {
+    return ops_ != nullptr;
+  }
+
+  // Whether the callable is stored without a heap allocation
+  bool isInline() const noexcept {
+    return ops_ && ops_->isInline;
+  }
+
+ private:
+  typedef typename std::aligned_storage<kInlineSize>::type Storage;
+
+  struct Ops {
+    void (*call)(void* storage);
+    // Move constructs into to and destroys from
+    void (*move)(void* from, void* to);
+    void (*destroy)(void* storage);
+    bool isInline;
+  };
+
+  template <class Fn>
+  struct Inline : std::integral_constant<bool,
+    sizeof(Fn) <= sizeof(Storage) &&
+    std::alignment_of<Storage>::value % std::alignment_of<Fn>::value == 0 &&
+    std::is_nothrow_move_constructible<Fn>::value> {};
+
+  template <class Fn>
+  struct InlineOps {
+    static void call(void* s) {
+      (*static_cast<Fn*>(s))();
+    }
+    static void move(void* from, void* to) {
+      new (to) Fn(std::move(*static_cast<Fn*>(from)));
+      static_cast<Fn*>(from)->~Fn();
+    }
+    static void destroy(void* s) {
+      static_cast<Fn*>(s)->~Fn();
+    }
+    static const Ops ops;
+  };
+
+  template <class Fn>
+  struct HeapOps {
+    static void call(void* s) {
+      (**static_cast<Fn**>(s))();
+    }
+    static void move(void* from, void* to) {
+      *static_cast<Fn**>(to) = *static_cast<Fn**>(from);
+    }
+    static void destroy(void* s) {
+      delete *static_cast<Fn**>(s);
+    }
+    static const Ops ops;
+  };
+
+  template <class Fn, class F>
+  void init(F&& f, std::true_type /* inline */) {
+    new (&storage_) Fn(std::forward<F>(f));
+    ops_ = &InlineOps<Fn>::ops;
+  }
+
+  template <class Fn, class F>
+  void init(F&& f, std::false_type /* inline */) {
+    *reinterpret_cast<Fn**>(&storage_) = new Fn(std::forward<F>(f));
+    ops_ = &HeapOps<Fn>::ops;
+  }
+
+  template <class Fn>
+  static bool isEmpty(const Fn&) {
+    return false;
+  }
+
+  template <class Sig>
+  static bool isEmpty(const std::function<Sig>& f) {
+    return !f;
+  }
+
+  template <class R>
+  static bool isEmpty(R (*f)()) {
+    return f == nullptr;
+  }
+
+  void moveFrom(TaskFunc& other) noexcept {
+    if (other.ops_) {
+      other.ops_->move(&other.storage_, &storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+  }
+
+  void reset() noexcept {
+    if (ops_) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  const Ops* ops_;
+  Storage storage_;
+};
+
+template <class Fn>
+const TaskFunc::Ops TaskFunc::InlineOps<Fn>::ops = {
+  &TaskFunc::InlineOps<Fn>::call,
+  &TaskFunc::InlineOps<Fn>::move,
+  &TaskFunc::InlineOps<Fn>::destroy,
+  true,
+};
+
+template <class Fn>
+const TaskFunc::Ops TaskFunc::HeapOps<Fn>::ops = {
+  &TaskFunc::HeapOps<Fn>::call,
+  &TaskFunc::HeapOps<Fn>::move,
+  &TaskFunc::HeapOps<Fn>::destroy,
+  false,
+};
+
+inline bool operator==(const TaskFunc& f, std::nullptr_t) {
+  return !f;
+}
+
+inline bool operator!=(const TaskFunc& f, std::nullptr_t) {
+  return bool(f);
+}
+
+}} // folly::wangle
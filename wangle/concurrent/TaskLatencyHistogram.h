@@ -0,0 +1,128 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <folly/Bits.h>
+
+namespace folly { namespace wangle {
+
+/**
+ * Fixed-size, log-linear latency histogram.
+ *
+ * Each power of two range of nanoseconds is split into kSubBuckets linear
+ * buckets, so every recorded value is known to within 25%, from 1ns up to
+ * the full range of a 64 bit count, without ever allocating.
+ *
+ * addValue() may only be called by a single thread at a time; it does no
+ * read-modify-write, just a relaxed load and store per bucket.
+ * addValueShared() is for histograms written from several threads.  Any
+ * thread may read the histogram, or a copy of it, concurrently.
+ */
+class TaskLatencyHistogram {
+ public:
+  static const size_t kSubBuckets = 4;
+  // One bucket each for values below kSubBuckets, then kSubBuckets for
+  // each exponent from 2 to 63
+  static const size_t kNumBuckets = 63 * kSubBuckets;
+
+  TaskLatencyHistogram() {
+    for (auto& bucket : buckets_) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  TaskLatencyHistogram(const TaskLatencyHistogram& other) {
+    *this = other;
+  }
+
+  TaskLatencyHistogram& operator=(const TaskLatencyHistogram& other) {
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      buckets_[i].store(other.getBucketCount(i), std::memory_order_relaxed);
+    }
+    return *this;
+  }
+
+  void addValue(std::chrono::nanoseconds value) {
+    auto& bucket = buckets_[getBucketIndex(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+                 std::memory_order_relaxed);
+  }
+
+  // An atomic increment, for callers on more than one thread
+  void addValueShared(std::chrono::nanoseconds value) {
+    buckets_[getBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Not safe to call concurrently with addValue() on this histogram
+  void merge(const TaskLatencyHistogram& other) {
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      buckets_[i].store(getBucketCount(i) + other.getBucketCount(i),
+                        std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t getBucketCount(size_t i) const {
+    return buckets_[i].load(std::memory_order_relaxed);
+  }
+
+  uint64_t count() const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      total += getBucketCount(i);
+    }
+    return total;
+  }
+
+  // Lower bound of the bucket holding the given percentile (0 to 100)
+  std::chrono::nanoseconds getPercentile(double pct) const {
+    auto total = count();
+    if (total == 0) {
+      return std::chrono::nanoseconds(0);
+    }
+    uint64_t rank = pct >= 100 ? total : uint64_t(total * pct / 100);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      seen += getBucketCount(i);
+      if (seen >= rank && seen > 0) {
+        return getBucketMin(i);
+      }
+    }
+    return getBucketMin(kNumBuckets - 1);
+  }
+
+  static size_t getBucketIndex(std::chrono::nanoseconds value) {
+    uint64_t v = value.count() > 0 ? value.count() : 0;
+    if (v < kSubBuckets) {
+      return v;
+    }
+    // Position of the highest set bit, at least 2 here
+    size_t exponent = folly::findLastSet(v) - 1;
+    size_t sub = (v >> (exponent - 2)) & (kSubBuckets - 1);
+    return (exponent - 1) * kSubBuckets + sub;
+  }
+
+  static std::chrono::nanoseconds getBucketMin(size_t i) {
+    if (i < kSubBuckets) {
+      return std::chrono::nanoseconds(i);
+    }
+    size_t exponent = i / kSubBuckets + 1;
+    uint64_t sub = i % kSubBuckets;
+    return std::chrono::nanoseconds(
+        (uint64_t(1) << exponent) + (sub << (exponent - 2)));
+  }
+
+ private:
+  std::atomic<uint64_t> buckets_[kNumBuckets];
+};
+
+}} // folly::wangle
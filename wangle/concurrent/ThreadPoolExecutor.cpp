@@ -9,9 +9,33 @@
  */
 
 #include <wangle/concurrent/ThreadPoolExecutor.h>
+#include <wangle/concurrent/AffinityThreadFactory.h>
+#include <wangle/concurrent/MetricsRegistry.h>
+
+#include <folly/tracing/StaticTracepoint.h>
 
 namespace folly { namespace wangle {
 
+namespace {
+
+struct Metrics {
+  MetricsRegistry::Counter tasksRun;
+  MetricsRegistry::Counter tasksExpired;
+  MetricsRegistry::Histogram taskWaitTime;
+};
+
+// In the default registry, for all pools
+const Metrics& metrics() {
+  static const Metrics m = {
+    MetricsRegistry::getDefault().counter("executor.tasks_run"),
+    MetricsRegistry::getDefault().counter("executor.tasks_expired"),
+    MetricsRegistry::getDefault().histogram("executor.task_wait_time"),
+  };
+  return m;
+}
+
+}
+
 ThreadPoolExecutor::ThreadPoolExecutor(
     size_t numThreads,
     std::shared_ptr<ThreadFactory> threadFactory)
@@ -23,30 +47,56 @@ ThreadPoolExecutor::~ThreadPoolExecutor() {
 }
 
 ThreadPoolExecutor::Task::Task(
-    Func&& func,
+    TaskFunc&& func,
     std::chrono::milliseconds expiration,
     Func&& expireCallback)
     : func_(std::move(func)),
       expiration_(expiration),
-      expireCallback_(std::move(expireCallback)) {
+      expireCallback_(std::move(expireCallback)),
+      deadline_(RequestDeadline::get()) {
   // Assume that the task in enqueued on creation
   enqueueTime_ = std::chrono::steady_clock::now();
+  FOLLY_SDT(wangle, executor_task_enqueue,
+            enqueueTime_.time_since_epoch().count());
+  if (deadline_ != RequestDeadline::none() && expireCallback_ != nullptr) {
+    // Expire it by the deadline, and let deadline ordered queues know.
+    // Tasks without an expireCallback, such as Future continuations, have
+    // to run whatever the deadline, or nothing would know they didn't
+    auto left = std::max(RequestDeadline::remaining(enqueueTime_),
+                         std::chrono::milliseconds(1));
+    if (expiration_.count() <= 0 || left < expiration_) {
+      expiration_ = left;
+    }
+  }
 }
 
 void ThreadPoolExecutor::runTask(
     const ThreadPtr& thread,
-    Task&& task) {
+    Task&& task,
+    Codel* codel) {
   thread->idle = false;
   auto startTime = std::chrono::steady_clock::now();
   task.stats_.waitTime = startTime - task.enqueueTime_;
-  if (task.expiration_ > std::chrono::milliseconds(0) &&
-      task.stats_.waitTime >= task.expiration_) {
+  // The enqueue time identifies the task across the probes
+  FOLLY_SDT(wangle, executor_task_dequeue,
+            task.enqueueTime_.time_since_epoch().count(),
+            startTime.time_since_epoch().count());
+  bool shed = codel &&
+    codel->overloaded(std::chrono::duration_cast<std::chrono::microseconds>(
+        task.stats_.waitTime)) &&
+    task.expireCallback_ != nullptr;
+  bool pastDeadline = startTime >= task.deadline_ &&
+    task.expireCallback_ != nullptr;
+  if (shed || pastDeadline ||
+      (task.expiration_ > std::chrono::milliseconds(0) &&
+       task.stats_.waitTime >= task.expiration_)) {
     task.stats_.expired = true;
     if (task.expireCallback_ != nullptr) {
       task.expireCallback_();
     }
   } else {
     try {
+      RequestDeadline::Guard g(task.deadline_);
       task.func_();
     } catch (const std::exception& e) {
       LOG(ERROR) << "ThreadPoolExecutor: func threw unhandled " <<
@@ -57,8 +107,25 @@ void ThreadPoolExecutor::runTask(
     }
     task.stats_.runTime = std::chrono::steady_clock::now() - startTime;
   }
+  FOLLY_SDT(wangle, executor_task_done,
+            task.enqueueTime_.time_since_epoch().count(),
+            task.stats_.expired, task.stats_.runTime.count());
   thread->idle = true;
-  thread->taskStatsSubject->onNext(std::move(task.stats_));
+  auto& m = metrics();
+  (task.stats_.expired ? m.tasksExpired : m.tasksRun).add();
+  m.taskWaitTime.addValue(task.stats_.waitTime);
+  thread->taskStatsHistograms.waitTime.addValue(task.stats_.waitTime);
+  thread->maxWaitTime = std::max(thread->maxWaitTime, task.stats_.waitTime);
+  if (!task.stats_.expired) {
+    thread->taskStatsHistograms.runTime.addValue(task.stats_.runTime);
+    thread->maxRunTime = std::max(thread->maxRunTime, task.stats_.runTime);
+  }
+  auto sampleRate =
+    thread->taskStatsSampleRate.load(std::memory_order_relaxed);
+  if (sampleRate > 0 && ++thread->tasksSinceSample >= sampleRate) {
+    thread->tasksSinceSample = 0;
+    thread->taskStatsSubject->onNext(std::move(task.stats_));
+  }
 }
 
 size_t ThreadPoolExecutor::numThreads() {
@@ -67,7 +134,7 @@ size_t ThreadPoolExecutor::numThreads() {
 }
 
 void ThreadPoolExecutor::setNumThreads(size_t n) {
-  RWSpinLock::WriteHolder{&threadListLock_};
+  RWSpinLock::WriteHolder guard(&threadListLock_);
   const auto current = threadList_.get().size();
   if (n > current ) {
     addThreads(n - current);
@@ -92,7 +159,10 @@ void ThreadPoolExecutor::addThreads(size_t n) {
   }
   for (auto& thread : newThreads) {
     thread->startupBaton.wait();
+    thread->cpus_ =
+      AffinityThreadFactory::getThreadCpus(thread->handle.native_handle());
   }
+  threadsAdded();
   for (auto& o : observers_) {
     for (auto& thread : newThreads) {
       o->threadStarted(thread.get());
@@ -101,31 +171,79 @@ void ThreadPoolExecutor::addThreads(size_t n) {
 }
 
 // threadListLock_ is writelocked
-void ThreadPoolExecutor::removeThreads(size_t n, bool isJoin) {
+void ThreadPoolExecutor::removeThreads(
+    size_t n,
+    bool isJoin,
+    std::chrono::steady_clock::time_point deadline,
+    std::vector<std::thread::id>* overran) {
   CHECK(n <= threadList_.get().size());
   CHECK(stoppedThreads_.size() == 0);
+  // The first n are the ones stopped; kept to tell which overran
+  std::vector<ThreadPtr> stopping(
+      threadList_.get().begin(), threadList_.get().begin() + n);
   isJoin_ = isJoin;
+  joinDeadline_ = deadline;
   stopThreads(n);
+  // Overruns are recorded once, at the deadline; then the rest are waited
+  // for without one
+  bool timedOut = false;
   for (size_t i = 0; i < n; i++) {
-    auto thread = stoppedThreads_.take();
+    auto thread = timedOut ?
+      stoppedThreads_.take() : stoppedThreads_.takeUntil(deadline);
+    if (!thread) {
+      timedOut = true;
+      // Past the deadline: whoever is left drops the tasks still queued
+      isJoin_ = false;
+      for (auto& t : stopping) {
+        if (t) {
+          LOG(WARNING) << "Thread " << t->id << " still draining tasks at "
+                       << "the join deadline";
+          if (overran) {
+            overran->push_back(t->handle.get_id());
+          }
+        }
+      }
+      FOLLY_SDT(wangle, thread_pool_join_overrun, n - i);
+      thread = stoppedThreads_.take();
+    }
+    for (auto& t : stopping) {
+      if (t == thread) {
+        t = nullptr;
+      }
+    }
     thread->handle.join();
+    stoppedTaskStatsHistograms_.waitTime.merge(
+        thread->taskStatsHistograms.waitTime);
+    stoppedTaskStatsHistograms_.runTime.merge(
+        thread->taskStatsHistograms.runTime);
     threadList_.remove(thread);
   }
+  joinDeadline_ = std::chrono::steady_clock::time_point::max();
   CHECK(stoppedThreads_.size() == 0);
 }
 
 void ThreadPoolExecutor::stop() {
-  RWSpinLock::WriteHolder{&threadListLock_};
+  RWSpinLock::WriteHolder guard(&threadListLock_);
   removeThreads(threadList_.get().size(), false);
   CHECK(threadList_.get().size() == 0);
 }
 
 void ThreadPoolExecutor::join() {
-  RWSpinLock::WriteHolder{&threadListLock_};
+  RWSpinLock::WriteHolder guard(&threadListLock_);
   removeThreads(threadList_.get().size(), true);
   CHECK(threadList_.get().size() == 0);
 }
 
+std::vector<std::thread::id> ThreadPoolExecutor::join(
+    std::chrono::milliseconds timeout) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::vector<std::thread::id> overran;
+  RWSpinLock::WriteHolder guard(&threadListLock_);
+  removeThreads(threadList_.get().size(), true, deadline, &overran);
+  CHECK(threadList_.get().size() == 0);
+  return overran;
+}
+
 ThreadPoolExecutor::PoolStats ThreadPoolExecutor::getPoolStats() {
   RWSpinLock::ReadHolder{&threadListLock_};
   ThreadPoolExecutor::PoolStats stats;
@@ -142,27 +260,53 @@ ThreadPoolExecutor::PoolStats ThreadPoolExecutor::getPoolStats() {
   return stats;
 }
 
+void ThreadPoolExecutor::setTaskStatsSampleRate(uint32_t n) {
+  RWSpinLock::ReadHolder guard(&threadListLock_);
+  taskStatsSampleRate_ = n;
+  for (auto& thread : threadList_.get()) {
+    thread->taskStatsSampleRate = n;
+  }
+}
+
+ThreadPoolExecutor::TaskStatsHistograms
+ThreadPoolExecutor::getTaskStatsHistograms() {
+  RWSpinLock::ReadHolder guard(&threadListLock_);
+  auto histograms = stoppedTaskStatsHistograms_;
+  for (auto& thread : threadList_.get()) {
+    histograms.waitTime.merge(thread->taskStatsHistograms.waitTime);
+    histograms.runTime.merge(thread->taskStatsHistograms.runTime);
+  }
+  return histograms;
+}
+
 std::atomic<uint64_t> ThreadPoolExecutor::Thread::nextId(0);
 
 void ThreadPoolExecutor::StoppedThreadQueue::add(
     ThreadPoolExecutor::ThreadPtr item) {
   std::lock_guard<std::mutex> guard(mutex_);
   queue_.push(std::move(item));
-  sem_.post();
+  cv_.notify_one();
 }
 
 ThreadPoolExecutor::ThreadPtr ThreadPoolExecutor::StoppedThreadQueue::take() {
-  while(1) {
-    {
-      std::lock_guard<std::mutex> guard(mutex_);
-      if (queue_.size() > 0) {
-        auto item = std::move(queue_.front());
-        queue_.pop();
-        return item;
-      }
+  return takeUntil(std::chrono::steady_clock::time_point::max());
+}
+
+ThreadPoolExecutor::ThreadPtr
+ThreadPoolExecutor::StoppedThreadQueue::takeUntil(
+    std::chrono::steady_clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (queue_.empty()) {
+    if (deadline == std::chrono::steady_clock::time_point::max()) {
+      cv_.wait(lock);
+    } else if (cv_.wait_until(lock, deadline) == std::cv_status::timeout &&
+               queue_.empty()) {
+      return nullptr;
     }
-    sem_.wait();
   }
+  auto item = std::move(queue_.front());
+  queue_.pop();
+  return item;
 }
 
 size_t ThreadPoolExecutor::StoppedThreadQueue::size() {
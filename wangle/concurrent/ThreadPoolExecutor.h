@@ -10,16 +10,24 @@
 
 #pragma once
 #include <folly/Executor.h>
+#include <wangle/concurrent/Codel.h>
 #include <wangle/concurrent/LifoSemMPMCQueue.h>
 #include <wangle/concurrent/NamedThreadFactory.h>
+#include <wangle/concurrent/RequestDeadline.h>
+#include <wangle/concurrent/TaskFunc.h>
+#include <wangle/concurrent/TaskLatencyHistogram.h>
 #include <wangle/deprecated/rx/Observable.h>
 #include <folly/Baton.h>
 #include <folly/Memory.h>
 #include <folly/RWSpinLock.h>
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <queue>
+#include <thread>
+#include <vector>
 
 #include <glog/logging.h>
 
@@ -39,6 +47,26 @@ class ThreadPoolExecutor : public virtual Executor {
       std::chrono::milliseconds expiration,
       Func expireCallback) = 0;
 
+  /*
+   * Like add(), but func is stored in the task as is rather than through a
+   * std::function: lambdas of up to TaskFunc::kInlineSize bytes are queued
+   * without allocating, and move-only ones can be added.
+   */
+  virtual void addTaskFunc(
+      TaskFunc func,
+      std::chrono::milliseconds expiration = std::chrono::milliseconds(0),
+      Func expireCallback = nullptr) = 0;
+
+  /*
+   * Adds all of funcs, waking the pool once for the whole batch instead of
+   * once per task where the implementation allows it.
+   */
+  virtual void addBatch(std::vector<Func>&& funcs) {
+    for (auto& func : funcs) {
+      add(std::move(func));
+    }
+  }
+
   void setThreadFactory(std::shared_ptr<ThreadFactory> threadFactory) {
     CHECK(numThreads() == 0);
     threadFactory_ = std::move(threadFactory);
@@ -57,6 +85,13 @@ class ThreadPoolExecutor : public virtual Executor {
    */
   void stop();
   void join();
+  /*
+   * join(), within timeout: threads still running queued tasks once it has
+   * passed leave the rest, as for stop(), when the task each is on is done.
+   * All the threads are signalled at once and drain in parallel.  Returns
+   * the ids of those that overran the deadline, which are logged too.
+   */
+  std::vector<std::thread::id> join(std::chrono::milliseconds timeout);
 
   struct PoolStats {
     PoolStats() : threadCount(0), idleThreadCount(0), activeThreadCount(0),
@@ -79,6 +114,24 @@ class ThreadPoolExecutor : public virtual Executor {
     return taskStatsSubject_->subscribe(observer);
   }
 
+  /*
+   * Only pass 1 in n tasks' TaskStats to subscribeToTaskStats() observers;
+   * 0 stops calling them at all.  The latency histograms below still see
+   * every task.  Defaults to 1.
+   */
+  void setTaskStatsSampleRate(uint32_t n);
+
+  // Expired tasks only count towards waitTime, so the number of them is
+  // waitTime.count() - runTime.count()
+  struct TaskStatsHistograms {
+    TaskLatencyHistogram waitTime;
+    TaskLatencyHistogram runTime;
+  };
+
+  // Wait and run times of every task run so far, summed over all threads,
+  // including ones that have since been stopped
+  TaskStatsHistograms getTaskStatsHistograms();
+
   /**
    * Base class for threads created with ThreadPoolExecutor.
    * Some subclasses have methods that operate on these
@@ -87,6 +140,16 @@ class ThreadPoolExecutor : public virtual Executor {
   class ThreadHandle {
    public:
     virtual ~ThreadHandle() = default;
+
+    // CPUs this thread may run on, as set up by its ThreadFactory (see
+    // AffinityThreadFactory); empty if unknown
+    const std::vector<int>& getCpus() const {
+      return cpus_;
+    }
+
+   protected:
+    friend class ThreadPoolExecutor;
+    std::vector<int> cpus_;
   };
 
   /**
@@ -114,14 +177,20 @@ class ThreadPoolExecutor : public virtual Executor {
   // Prerequisite: threadListLock_ writelocked
   void addThreads(size_t n);
   // Prerequisite: threadListLock_ writelocked
-  void removeThreads(size_t n, bool isJoin);
+  void removeThreads(
+      size_t n,
+      bool isJoin,
+      std::chrono::steady_clock::time_point deadline =
+          std::chrono::steady_clock::time_point::max(),
+      std::vector<std::thread::id>* overran = nullptr);
 
   struct FOLLY_ALIGN_TO_AVOID_FALSE_SHARING Thread : public ThreadHandle {
     explicit Thread(ThreadPoolExecutor* pool)
       : id(nextId++),
         handle(),
         idle(true),
-        taskStatsSubject(pool->taskStatsSubject_) {}
+        taskStatsSubject(pool->taskStatsSubject_),
+        taskStatsSampleRate(pool->taskStatsSampleRate_.load()) {}
 
     virtual ~Thread() = default;
 
@@ -131,23 +200,39 @@ class ThreadPoolExecutor : public virtual Executor {
     bool idle;
     Baton<> startupBaton;
     std::shared_ptr<Subject<TaskStats>> taskStatsSubject;
+    std::atomic<uint32_t> taskStatsSampleRate;
+    uint32_t tasksSinceSample{0};
+    // Written only by this thread
+    TaskStatsHistograms taskStatsHistograms;
+    // Longest task wait and run times since whoever reports them last
+    // reset them; only touched by this thread
+    std::chrono::nanoseconds maxWaitTime{0};
+    std::chrono::nanoseconds maxRunTime{0};
   };
 
   typedef std::shared_ptr<Thread> ThreadPtr;
 
   struct Task {
     explicit Task(
-        Func&& func,
+        TaskFunc&& func,
         std::chrono::milliseconds expiration,
         Func&& expireCallback);
-    Func func_;
+    TaskFunc func_;
     TaskStats stats_;
     std::chrono::steady_clock::time_point enqueueTime_;
     std::chrono::milliseconds expiration_;
     Func expireCallback_;
+    // The RequestDeadline it was added under, and runs under; only tasks
+    // with an expireCallback expire by it
+    RequestDeadline::TimePoint deadline_;
   };
 
-  static void runTask(const ThreadPtr& thread, Task&& task);
+  // If codel is given, it is fed the task's queueing delay, and tasks with
+  // an expireCallback are expired instead of run while it is overloaded
+  static void runTask(
+      const ThreadPtr& thread,
+      Task&& task,
+      Codel* codel = nullptr);
 
   // The function that will be bound to pool threads. It must call
   // thread->startupBaton.post() when it's ready to consume work.
@@ -162,6 +247,11 @@ class ThreadPoolExecutor : public virtual Executor {
     return std::make_shared<Thread>(this);
   }
 
+  // Called once threads added to threadList_ have started, before the
+  // observers are told about them
+  // Prerequisite: threadListLock_ writelocked
+  virtual void threadsAdded() {}
+
   // Prerequisite: threadListLock_ readlocked
   virtual uint64_t getPendingTaskCount() = 0;
 
@@ -207,10 +297,12 @@ class ThreadPoolExecutor : public virtual Executor {
    public:
     void add(ThreadPtr item) override;
     ThreadPtr take() override;
+    // nullptr if none stopped by deadline
+    ThreadPtr takeUntil(std::chrono::steady_clock::time_point deadline);
     size_t size() override;
 
    private:
-    LifoSem sem_;
+    std::condition_variable cv_;
     std::mutex mutex_;
     std::queue<ThreadPtr> queue_;
   };
@@ -220,8 +312,15 @@ class ThreadPoolExecutor : public virtual Executor {
   RWSpinLock threadListLock_;
   StoppedThreadQueue stoppedThreads_;
   std::atomic<bool> isJoin_; // whether the current downsizing is a join
+  // When a joining downsizing gives up on queued tasks; set before the
+  // threads are stopped
+  std::chrono::steady_clock::time_point joinDeadline_{
+      std::chrono::steady_clock::time_point::max()};
 
   std::shared_ptr<Subject<TaskStats>> taskStatsSubject_;
+  std::atomic<uint32_t> taskStatsSampleRate_{1};
+  // Histograms of threads that have been removed from threadList_
+  TaskStatsHistograms stoppedTaskStatsHistograms_;
   std::vector<std::shared_ptr<Observer>> observers_;
 };
 
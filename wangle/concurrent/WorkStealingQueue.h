@@ -0,0 +1,349 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+#include <wangle/concurrent/BlockingQueue.h>
+#include <folly/LifoSem.h>
+#include <folly/MPMCQueue.h>
+#include <folly/Memory.h>
+#include <folly/ThreadLocal.h>
+#include <folly/detail/CacheLocality.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * A BlockingQueue for pools where tasks mostly submit more tasks.
+ *
+ * Each consuming thread claims one of numDeques Chase-Lev deques the first
+ * time it calls take().  Items it adds afterwards are pushed onto its own
+ * deque, which it pops LIFO without touching any shared cacheline.  Items
+ * added from other threads, and all items added with a priority (which
+ * includes the executor's poison pills), go through a shared MPMCQueue.
+ *
+ * take() tries the thread's own deque, then steals from the other deques,
+ * and only then reads the shared queue.  Items on the deques live in nodes
+ * that each thread caches once it has taken them, up to dequeCapacity of
+ * them, so a thread feeding its own deque doesn't allocate.  Because
+ * threads stopping the pool are fed poison pills through the shared queue,
+ * a thread only sees one once no deque has work left, so joins still
+ * drain every task.
+ *
+ * Priorities are not supported; getNumPriorities() is 1.
+ */
+template <class T>
+class WorkStealingQueue : public BlockingQueue<T> {
+ public:
+  explicit WorkStealingQueue(
+      size_t numDeques,
+      size_t dequeCapacity = 1024,
+      size_t maxCapacity = 1 << 14)
+    : maxCachedNodes_(dequeCapacity),
+      queue_(maxCapacity) {
+    CHECK(dequeCapacity > 0 && (dequeCapacity & (dequeCapacity - 1)) == 0)
+      << "dequeCapacity must be a power of two";
+    deques_.reserve(numDeques);
+    for (size_t i = 0; i < numDeques; i++) {
+      deques_.push_back(folly::make_unique<Deque>(i, dequeCapacity));
+    }
+  }
+
+  void add(T item) override {
+    if (!tryAdd(item)) {
+      throw QueueFullException("WorkStealingQueue full, can't add item");
+    }
+  }
+
+  void addWithPriority(T item, int8_t priority) override {
+    if (!tryAddWithPriority(item, priority)) {
+      throw QueueFullException("WorkStealingQueue full, can't add item");
+    }
+  }
+
+  bool tryAdd(T& item) override {
+    auto registration = local_.get();
+    if (registration && registration->deque) {
+      auto ptr = newItem(registration, item);
+      if (registration->deque->push(ptr)) {
+        notify();
+        return true;
+      }
+      // Own deque is full, spill to the shared queue
+      item = std::move(*ptr);
+      deleteItem(registration, ptr);
+    }
+    return tryAddWithPriority(item, 0);
+  }
+
+  bool tryAddWithPriority(T& item, int8_t priority) override {
+    if (!queue_.write(std::move(item))) {
+      return false;
+    }
+    notify();
+    return true;
+  }
+
+  void addBatch(std::vector<T> items) override {
+    auto registration = local_.get();
+    auto deque = registration ? registration->deque : nullptr;
+    size_t added = 0;
+    for (auto& item : items) {
+      if (deque) {
+        auto ptr = newItem(registration, item);
+        if (deque->push(ptr)) {
+          added++;
+          continue;
+        }
+        item = std::move(*ptr);
+        deleteItem(registration, ptr);
+      }
+      if (!queue_.write(std::move(item))) {
+        notify(added);
+        throw QueueFullException("WorkStealingQueue full, can't add item");
+      }
+      added++;
+    }
+    notify(added);
+  }
+
+  T take() override {
+    auto registration = getRegistration();
+    T item;
+    while (true) {
+      if (tryTake(registration, item)) {
+        return item;
+      }
+      // Announce ourselves before the final check, so that an add() racing
+      // with it either is seen by the check or sees us and posts
+      waiters_.fetch_add(1, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (tryTake(registration, item)) {
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return item;
+      }
+      sem_.wait();
+      waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  size_t size() override {
+    ssize_t size = queue_.size();
+    for (auto& deque : deques_) {
+      size += deque->size();
+    }
+    return size > 0 ? size : 0;
+  }
+
+ private:
+  // Uninitialized storage for an item on a deque
+  typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Node;
+
+  // Chase-Lev deque of fixed capacity.  push() and pop() may only be called
+  // by the owning thread, steal() by any thread.
+  class Deque {
+   public:
+    Deque(size_t index, size_t capacity)
+      : index(index),
+        mask_(capacity - 1),
+        buffer_(new std::atomic<T*>[capacity]()) {}
+
+    ~Deque() {
+      while (auto ptr = pop()) {
+        ptr->~T();
+        delete reinterpret_cast<Node*>(ptr);
+      }
+    }
+
+    bool push(T* ptr) {
+      auto b = bottom_.load(std::memory_order_relaxed);
+      auto t = top_.load(std::memory_order_acquire);
+      if (b - t > mask_) {
+        return false;
+      }
+      buffer_[b & mask_].store(ptr, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    T* pop() {
+      auto b = bottom_.load(std::memory_order_relaxed) - 1;
+      bottom_.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto t = top_.load(std::memory_order_relaxed);
+      T* ptr = nullptr;
+      if (t <= b) {
+        ptr = buffer_[b & mask_].load(std::memory_order_relaxed);
+        if (t == b) {
+          // Last item, race the stealers for it
+          if (!top_.compare_exchange_strong(
+                  t, t + 1,
+                  std::memory_order_seq_cst,
+                  std::memory_order_relaxed)) {
+            ptr = nullptr;
+          }
+          bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+      } else {
+        bottom_.store(b + 1, std::memory_order_relaxed);
+      }
+      return ptr;
+    }
+
+    // Returns nullptr only if the deque was seen empty
+    T* steal() {
+      while (true) {
+        auto t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+          return nullptr;
+        }
+        auto ptr = buffer_[t & mask_].load(std::memory_order_relaxed);
+        if (top_.compare_exchange_strong(
+                t, t + 1,
+                std::memory_order_seq_cst,
+                std::memory_order_relaxed)) {
+          return ptr;
+        }
+      }
+    }
+
+    ssize_t size() {
+      return bottom_.load(std::memory_order_relaxed) -
+        top_.load(std::memory_order_relaxed);
+    }
+
+    const size_t index;
+    std::atomic<bool> owned{false};
+
+   private:
+    const int64_t mask_;
+    std::unique_ptr<std::atomic<T*>[]> buffer_;
+    FOLLY_ALIGN_TO_AVOID_FALSE_SHARING std::atomic<int64_t> top_{0};
+    FOLLY_ALIGN_TO_AVOID_FALSE_SHARING std::atomic<int64_t> bottom_{0};
+  };
+
+  // Releases the thread's deque, and frees its cached nodes, when the
+  // thread exits
+  struct Registration {
+    explicit Registration(Deque* d) : deque(d) {}
+    ~Registration() {
+      if (deque) {
+        deque->owned.store(false, std::memory_order_release);
+      }
+      for (auto node : nodes) {
+        delete node;
+      }
+    }
+    Deque* deque;
+    std::vector<Node*> nodes;
+  };
+
+  Registration* getRegistration() {
+    auto registration = local_.get();
+    if (!registration) {
+      Deque* claimed = nullptr;
+      for (auto& deque : deques_) {
+        bool owned = false;
+        if (deque->owned.compare_exchange_strong(owned, true)) {
+          claimed = deque.get();
+          break;
+        }
+      }
+      // Threads beyond numDeques only use the shared queue
+      registration = new Registration(claimed);
+      local_.reset(registration);
+    }
+    return registration;
+  }
+
+  // Moves item into a node from the thread's cache
+  T* newItem(Registration* registration, T& item) {
+    Node* node;
+    if (registration->nodes.empty()) {
+      node = new Node;
+    } else {
+      node = registration->nodes.back();
+      registration->nodes.pop_back();
+    }
+    try {
+      return new (node) T(std::move(item));
+    } catch (...) {
+      registration->nodes.push_back(node);
+      throw;
+    }
+  }
+
+  // Destroys the item and keeps its node for the thread's next newItem()
+  void deleteItem(Registration* registration, T* ptr) {
+    ptr->~T();
+    auto node = reinterpret_cast<Node*>(ptr);
+    if (registration->nodes.size() < maxCachedNodes_) {
+      registration->nodes.push_back(node);
+    } else {
+      delete node;
+    }
+  }
+
+  bool tryTake(Registration* registration, T& item) {
+    auto deque = registration->deque;
+    T* ptr = deque ? deque->pop() : nullptr;
+    if (!ptr) {
+      ptr = steal(deque);
+    }
+    if (ptr) {
+      item = std::move(*ptr);
+      deleteItem(registration, ptr);
+      return true;
+    }
+    return queue_.read(item);
+  }
+
+  T* steal(Deque* self) {
+    size_t n = deques_.size();
+    size_t start = self ? self->index + 1 : 0;
+    for (size_t i = 0; i < n; i++) {
+      auto victim = deques_[(start + i) % n].get();
+      if (victim == self) {
+        continue;
+      }
+      if (auto ptr = victim->steal()) {
+        return ptr;
+      }
+    }
+    return nullptr;
+  }
+
+  // Wakes up to n waiting consumers
+  void notify(size_t n = 1) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto waiters = std::min(n, waiters_.load(std::memory_order_relaxed));
+    if (waiters > 0) {
+      sem_.post(waiters);
+    }
+  }
+
+  const size_t maxCachedNodes_;
+  LifoSem sem_;
+  MPMCQueue<T> queue_;
+  std::vector<std::unique_ptr<Deque>> deques_;
+  FOLLY_ALIGN_TO_AVOID_FALSE_SHARING std::atomic<size_t> waiters_{0};
+  // Declared last, so registrations are destroyed before the deques
+  ThreadLocalPtr<Registration> local_;
+};
+
+}} // folly::wangle
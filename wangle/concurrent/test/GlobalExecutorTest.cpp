@@ -12,6 +12,8 @@
 #include <wangle/concurrent/GlobalExecutor.h>
 #include <wangle/concurrent/IOExecutor.h>
 
+#include <thread>
+
 using namespace folly::wangle;
 
 TEST(GlobalExecutorTest, GlobalCPUExecutor) {
@@ -77,3 +79,26 @@ TEST(GlobalExecutorTest, GlobalIOExecutor) {
   // weak reference to dummy has expired
   getIOExecutor()->add(f);
 }
+
+TEST(GlobalExecutorTest, SetFromAnotherThread) {
+  class DummyExecutor : public folly::Executor {
+   public:
+    void add(folly::Func f) override {
+      count++;
+    }
+    int count{0};
+  };
+
+  // Cached on this thread
+  auto before = getCPUExecutor();
+  auto dummy = std::make_shared<DummyExecutor>();
+  std::thread([&] { setCPUExecutor(dummy); }).join();
+  getCPUExecutor()->add([]{});
+  EXPECT_EQ(1, dummy->count);
+
+  auto other = std::make_shared<DummyExecutor>();
+  std::thread([&] { setCPUExecutor(other); }).join();
+  getCPUExecutor()->add([]{});
+  EXPECT_EQ(1, dummy->count);
+  EXPECT_EQ(1, other->count);
+}
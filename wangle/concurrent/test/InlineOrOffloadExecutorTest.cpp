@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/InlineOrOffloadExecutor.h>
+
+#include <folly/io/async/EventBaseManager.h>
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace folly;
+using namespace folly::wangle;
+
+namespace {
+
+// Runs what it's given when told to
+class QueueExecutor : public Executor {
+ public:
+  void add(Func func) override {
+    funcs.push_back(std::move(func));
+  }
+
+  size_t runAll() {
+    auto toRun = std::move(funcs);
+    funcs.clear();
+    for (auto& func : toRun) {
+      func();
+    }
+    return toRun.size();
+  }
+
+  std::vector<Func> funcs;
+};
+
+void burn(std::chrono::microseconds time) {
+  auto end = std::chrono::steady_clock::now() + time;
+  while (std::chrono::steady_clock::now() < end) {
+  }
+}
+
+InlineOrOffloadExecutor::Options testOptions() {
+  InlineOrOffloadExecutor::Options options;
+  options.inlineThreshold = std::chrono::microseconds(1000);
+  options.offloadThreshold = std::chrono::microseconds(5000);
+  options.loopBudget = std::chrono::microseconds(20000);
+  options.minSamples = 1;
+  return options;
+}
+
+}
+
+TEST(InlineOrOffloadExecutorTest, ShortTasksGoInline) {
+  // Not looping, so this is its thread
+  EventBaseManager::get()->getEventBase();
+  auto offload = std::make_shared<QueueExecutor>();
+  InlineOrOffloadExecutor executor(offload, testOptions());
+  auto type = executor.newTaskType("short");
+  int runs = 0;
+
+  executor.add(type, [&] { runs++; });
+  EXPECT_EQ(0, runs);
+  EXPECT_EQ(1, offload->runAll());
+  EXPECT_EQ(1, runs);
+  EXPECT_TRUE(type.isInline());
+
+  executor.add(type, [&] { runs++; });
+  EXPECT_EQ(2, runs);
+  EXPECT_EQ(1, executor.getNumInline());
+  EXPECT_EQ(1, executor.getNumOffloaded());
+
+  // Not from an EventBase's thread
+  std::thread([&] { executor.add(type, [&] { runs++; }); }).join();
+  EXPECT_EQ(2, runs);
+  EXPECT_EQ(1, offload->runAll());
+  EXPECT_EQ(3, runs);
+
+  // Untyped
+  executor.add([&] { runs++; });
+  EXPECT_EQ(1, offload->runAll());
+  EXPECT_EQ(4, runs);
+}
+
+TEST(InlineOrOffloadExecutorTest, LongTasksAreOffloaded) {
+  EventBaseManager::get()->getEventBase();
+  auto offload = std::make_shared<QueueExecutor>();
+  InlineOrOffloadExecutor executor(offload, testOptions());
+  auto type = executor.newTaskType("long");
+
+  for (int i = 0; i < 3; i++) {
+    executor.add(type, [] { burn(std::chrono::microseconds(10000)); });
+    EXPECT_EQ(1, offload->runAll());
+  }
+  EXPECT_FALSE(type.isInline());
+  EXPECT_GE(type.getAverageRunTime(), std::chrono::milliseconds(10));
+  EXPECT_EQ(0, executor.getNumInline());
+}
+
+TEST(InlineOrOffloadExecutorTest, Hysteresis) {
+  EventBaseManager::get()->getEventBase();
+  auto offload = std::make_shared<QueueExecutor>();
+  InlineOrOffloadExecutor executor(offload, testOptions());
+  auto type = executor.newTaskType("growing");
+
+  executor.add(type, [] {});
+  offload->runAll();
+  ASSERT_TRUE(type.isInline());
+
+  // Between the thresholds: stays inline
+  executor.add(type, [] { burn(std::chrono::microseconds(2000)); });
+  EXPECT_TRUE(offload->funcs.empty());
+  EXPECT_TRUE(type.isInline());
+
+  // Well over: goes back to being offloaded
+  while (type.isInline()) {
+    executor.add(type, [] { burn(std::chrono::microseconds(20000)); });
+    EventBaseManager::get()->getEventBase()->loopOnce(EVLOOP_NONBLOCK);
+  }
+  executor.add(type, [] {});
+  EXPECT_EQ(1, offload->funcs.size());
+}
+
+TEST(InlineOrOffloadExecutorTest, LoopBudget) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  auto offload = std::make_shared<QueueExecutor>();
+  auto options = testOptions();
+  options.loopBudget = std::chrono::microseconds(100);
+  InlineOrOffloadExecutor executor(offload, options);
+  auto type = executor.newTaskType("short");
+  executor.add(type, [] {});
+  offload->runAll();
+  ASSERT_TRUE(type.isInline());
+
+  // The first one uses up the iteration's budget
+  executor.add(type, [] { burn(std::chrono::microseconds(200)); });
+  executor.add(type, [] {});
+  EXPECT_EQ(1, executor.getNumInline());
+  EXPECT_EQ(1, executor.getNumOverBudget());
+  EXPECT_EQ(1, offload->runAll());
+
+  evb->loopOnce(EVLOOP_NONBLOCK);
+  executor.add(type, [] {});
+  EXPECT_EQ(2, executor.getNumInline());
+}
+
+TEST(InlineOrOffloadExecutorTest, TaskAddingTasksIsDeferred) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  auto offload = std::make_shared<QueueExecutor>();
+  InlineOrOffloadExecutor executor(offload, testOptions());
+  auto type = executor.newTaskType("chain");
+  executor.add(type, [] {});
+  offload->runAll();
+  ASSERT_TRUE(type.isInline());
+
+  // Each link adds the next, and so must not be running when it starts
+  int links = 0;
+  bool running = false;
+  std::function<void()> link = [&] {
+    EXPECT_FALSE(running);
+    running = true;
+    if (++links < 10000) {
+      executor.add(type, link);
+    }
+    running = false;
+  };
+  executor.add(type, link);
+  EXPECT_EQ(1, links);
+  while (links < 10000) {
+    evb->loopOnce(EVLOOP_NONBLOCK);
+    offload->runAll();
+  }
+  EXPECT_GT(executor.getNumDeferred(), 0);
+}
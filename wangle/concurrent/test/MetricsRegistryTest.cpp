@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/MetricsRegistry.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace folly::wangle;
+using std::chrono::microseconds;
+
+TEST(MetricsRegistryTest, Counters) {
+  MetricsRegistry registry;
+  auto a = registry.counter("a");
+  auto b = registry.counter("b");
+  a.add();
+  a.add(2);
+  // The same name is the same counter
+  registry.counter("b").add(5);
+  EXPECT_EQ(3, a.get());
+  EXPECT_EQ(5, b.get());
+
+  // Summed over threads, including ones gone
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 1000; j++) {
+        a.add();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(4003, a.get());
+  std::thread([&] { a.add(); }).join();
+  EXPECT_EQ(4004, a.get());
+}
+
+TEST(MetricsRegistryTest, Snapshot) {
+  MetricsRegistry registry;
+  registry.counter("requests").add(2);
+  auto latency = registry.histogram("latency");
+  latency.addValue(microseconds(10));
+  std::thread([&] { latency.addValue(microseconds(100)); }).join();
+  int64_t depth = 7;
+  registry.setGauge("depth", [&] { return depth; });
+
+  auto s = registry.getSnapshot();
+  EXPECT_EQ(2, s.counters["requests"]);
+  EXPECT_EQ(2, s.histograms["latency"].count());
+  EXPECT_EQ(2, latency.get().count());
+  EXPECT_EQ(7, s.gauges["depth"]);
+
+  depth = 8;
+  EXPECT_EQ(8, registry.getSnapshot().gauges["depth"]);
+  registry.removeGauge("depth");
+  EXPECT_EQ(0, registry.getSnapshot().gauges.count("depth"));
+}
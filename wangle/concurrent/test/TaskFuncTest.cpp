@@ -0,0 +1,82 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/TaskFunc.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+
+using folly::wangle::TaskFunc;
+
+namespace {
+
+// Move-only, which std::function can't hold
+struct AddTo {
+  AddTo(int* t, int n) : total(t), amount(new int(n)) {}
+  void operator()() {
+    *total += *amount;
+  }
+  int* total;
+  std::unique_ptr<int> amount;
+};
+
+}
+
+TEST(TaskFuncTest, Empty) {
+  TaskFunc f;
+  EXPECT_FALSE(f);
+  EXPECT_TRUE(f == nullptr);
+  EXPECT_THROW(f(), std::bad_function_call);
+  TaskFunc g((std::function<void()>()));
+  EXPECT_TRUE(g == nullptr);
+}
+
+TEST(TaskFuncTest, Inline) {
+  int total = 0;
+  void* a = &total;
+  void* b = &total;
+  void* c = &total;
+  void* d = &total;
+  TaskFunc f([&total, a, b, c, d]() { total++; });
+  EXPECT_TRUE(f.isInline());
+  f();
+  EXPECT_EQ(1, total);
+
+  // Whole std::functions fit too
+  std::function<void()> sf = [&total]() { total++; };
+  TaskFunc g(std::move(sf));
+  EXPECT_TRUE(g.isInline());
+  g();
+  EXPECT_EQ(2, total);
+}
+
+TEST(TaskFuncTest, Heap) {
+  int total = 0;
+  char big[TaskFunc::kInlineSize] = {1};
+  TaskFunc f([&total, big]() { total += big[0]; });
+  EXPECT_FALSE(f.isInline());
+  TaskFunc g(std::move(f));
+  EXPECT_FALSE(f);
+  g();
+  EXPECT_EQ(1, total);
+}
+
+TEST(TaskFuncTest, MoveOnly) {
+  int total = 0;
+  TaskFunc f(AddTo(&total, 5));
+  EXPECT_TRUE(f.isInline());
+  TaskFunc g;
+  g = std::move(f);
+  EXPECT_FALSE(f);
+  g();
+  EXPECT_EQ(5, total);
+  g = nullptr;
+  EXPECT_FALSE(g);
+}
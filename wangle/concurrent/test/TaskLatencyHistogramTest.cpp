@@ -0,0 +1,46 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/TaskLatencyHistogram.h>
+#include <gtest/gtest.h>
+
+using folly::wangle::TaskLatencyHistogram;
+using std::chrono::nanoseconds;
+
+TEST(TaskLatencyHistogramTest, Buckets) {
+  for (uint64_t v : {0UL, 1UL, 3UL, 4UL, 7UL, 8UL, 1000UL, 1000000UL,
+                     (1UL << 63), ~0UL}) {
+    auto i = TaskLatencyHistogram::getBucketIndex(nanoseconds(v));
+    ASSERT_LT(i, TaskLatencyHistogram::kNumBuckets);
+    auto min = uint64_t(TaskLatencyHistogram::getBucketMin(i).count());
+    EXPECT_LE(min, v);
+    // Within 25% of the value
+    EXPECT_LE(v - min, v / 4);
+  }
+  EXPECT_EQ(0, TaskLatencyHistogram::getBucketIndex(nanoseconds(-5)));
+}
+
+TEST(TaskLatencyHistogramTest, Percentiles) {
+  TaskLatencyHistogram h;
+  EXPECT_EQ(nanoseconds(0), h.getPercentile(50));
+  for (int i = 0; i < 99; i++) {
+    h.addValue(nanoseconds(100));
+  }
+  h.addValue(nanoseconds(1000000));
+  EXPECT_EQ(100, h.count());
+  EXPECT_GE(nanoseconds(100), h.getPercentile(50));
+  EXPECT_LT(nanoseconds(75), h.getPercentile(99));
+  EXPECT_LT(nanoseconds(750000), h.getPercentile(100));
+
+  TaskLatencyHistogram copy(h);
+  copy.merge(h);
+  EXPECT_EQ(200, copy.count());
+  EXPECT_EQ(100, h.count());
+}
@@ -0,0 +1,265 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/Baton.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+#include <wangle/concurrent/LifoSemMPMCQueue.h>
+#include <wangle/concurrent/PriorityLifoSemMPMCQueue.h>
+#include <wangle/concurrent/SegmentedMPMCQueue.h>
+#include <wangle/concurrent/WorkStealingQueue.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+using namespace folly;
+using namespace folly::wangle;
+using folly::BenchmarkSuspender;
+
+DEFINE_int32(threads, 32, "Number of pool threads");
+DEFINE_int32(fanout, 64, "Tasks spawned by each root task");
+
+static const size_t kQueueCapacity = 1 << 20;
+
+typedef CPUThreadPoolExecutor::CPUTask CPUTask;
+
+// iters root tasks are submitted from outside the pool, and each of them
+// submits FLAGS_fanout children from inside the pool
+void fanOut(uint iters, std::unique_ptr<BlockingQueue<CPUTask>> queue) {
+  if (iters == 0) {
+    return;
+  }
+  BenchmarkSuspender bs;
+  CPUThreadPoolExecutor tpe(FLAGS_threads, std::move(queue));
+  std::atomic<uint64_t> remaining(uint64_t(iters) * (FLAGS_fanout + 1));
+  Baton<> done;
+  auto finish = [&]() {
+    if (--remaining == 0) {
+      done.post();
+    }
+  };
+  auto root = [&]() {
+    for (int i = 0; i < FLAGS_fanout; i++) {
+      tpe.add(finish);
+    }
+    finish();
+  };
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    tpe.add(root);
+  }
+  done.wait();
+  bs.rehire();
+}
+
+BENCHMARK(lifoSemMPMCQueueFanOut, iters) {
+  fanOut(iters, folly::make_unique<LifoSemMPMCQueue<CPUTask>>(
+      kQueueCapacity));
+}
+
+BENCHMARK_RELATIVE(segmentedQueueFanOut, iters) {
+  fanOut(iters, folly::make_unique<
+      LifoSemMPMCQueue<CPUTask, SegmentedMPMCQueue<CPUTask>>>(
+          kQueueCapacity));
+}
+
+BENCHMARK_RELATIVE(workStealingQueueFanOut, iters) {
+  fanOut(iters, folly::make_unique<WorkStealingQueue<CPUTask>>(
+      FLAGS_threads, 1024, kQueueCapacity));
+}
+
+BENCHMARK_DRAW_LINE();
+
+// Single threaded add and take by a thread that has already taken from
+// the queue, which for WorkStealingQueue is the own deque's path
+template <class Queue, class... Args>
+void ownThreadAddTake(uint iters, Args&&... args) {
+  BenchmarkSuspender bs;
+  Queue queue(std::forward<Args>(args)...);
+  // The first take() claims a deque
+  queue.add(CPUTask());
+  queue.take();
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    queue.add(CPUTask());
+    auto task = queue.take();
+    doNotOptimizeAway(task.poison);
+  }
+  bs.rehire();
+}
+
+BENCHMARK(lifoSemMPMCQueueOwnThread, iters) {
+  ownThreadAddTake<LifoSemMPMCQueue<CPUTask>>(iters, kQueueCapacity);
+}
+
+BENCHMARK_RELATIVE(workStealingQueueOwnThread, iters) {
+  ownThreadAddTake<WorkStealingQueue<CPUTask>>(
+      iters, 1, 1024, kQueueCapacity);
+}
+
+BENCHMARK_DRAW_LINE();
+
+// iters batches of FLAGS_fanout tasks submitted from outside the pool
+void submit(ThreadPoolExecutor& tpe, uint iters, bool batch) {
+  if (iters == 0) {
+    return;
+  }
+  std::atomic<uint64_t> remaining(uint64_t(iters) * FLAGS_fanout);
+  Baton<> done;
+  auto finish = [&]() {
+    if (--remaining == 0) {
+      done.post();
+    }
+  };
+
+  for (uint i = 0; i < iters; i++) {
+    if (batch) {
+      std::vector<Func> funcs(FLAGS_fanout, finish);
+      tpe.addBatch(std::move(funcs));
+    } else {
+      for (int j = 0; j < FLAGS_fanout; j++) {
+        tpe.add(finish);
+      }
+    }
+  }
+  done.wait();
+}
+
+void cpuSubmit(uint iters, bool batch) {
+  BenchmarkSuspender bs;
+  CPUThreadPoolExecutor tpe(
+      FLAGS_threads,
+      folly::make_unique<LifoSemMPMCQueue<CPUTask>>(kQueueCapacity));
+  bs.dismiss();
+  submit(tpe, iters, batch);
+  bs.rehire();
+}
+
+void ioSubmit(uint iters, bool batch) {
+  BenchmarkSuspender bs;
+  IOThreadPoolExecutor tpe(FLAGS_threads);
+  bs.dismiss();
+  submit(tpe, iters, batch);
+  bs.rehire();
+}
+
+BENCHMARK(cpuAdd, iters) {
+  cpuSubmit(iters, false);
+}
+
+BENCHMARK_RELATIVE(cpuAddBatch, iters) {
+  cpuSubmit(iters, true);
+}
+
+BENCHMARK(ioAdd, iters) {
+  ioSubmit(iters, false);
+}
+
+BENCHMARK_RELATIVE(ioAddBatch, iters) {
+  ioSubmit(iters, true);
+}
+
+BENCHMARK_DRAW_LINE();
+
+// iters tasks submitted to an IO pool, split over numSubmitters threads
+void ioAddFromThreads(uint iters, size_t numSubmitters) {
+  if (iters < numSubmitters) {
+    return;
+  }
+  BenchmarkSuspender bs;
+  IOThreadPoolExecutor tpe(FLAGS_threads);
+  size_t perSubmitter = iters / numSubmitters;
+  std::atomic<uint64_t> remaining(perSubmitter * numSubmitters);
+  Baton<> done;
+  auto finish = [&]() {
+    if (--remaining == 0) {
+      done.post();
+    }
+  };
+  std::vector<std::thread> submitters;
+  bs.dismiss();
+
+  for (size_t i = 0; i < numSubmitters; i++) {
+    submitters.emplace_back([&]() {
+      for (size_t j = 0; j < perSubmitter; j++) {
+        tpe.add(finish);
+      }
+    });
+  }
+  for (auto& submitter : submitters) {
+    submitter.join();
+  }
+  done.wait();
+  bs.rehire();
+}
+
+BENCHMARK_PARAM(ioAddFromThreads, 1);
+BENCHMARK_RELATIVE_PARAM(ioAddFromThreads, 4);
+BENCHMARK_RELATIVE_PARAM(ioAddFromThreads, 16);
+
+BENCHMARK_DRAW_LINE();
+
+// Round trips to a single IO thread that spins for up to spinUs between
+// tasks, which run once the previous one is done.  The wait time
+// distribution shows what the wakeups cost.
+void ioWakeup(uint iters, size_t spinUs) {
+  BenchmarkSuspender bs;
+  IOThreadPoolExecutor tpe(1);
+  tpe.setSpinWait(std::chrono::microseconds(spinUs));
+  Baton<> done;
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    tpe.add([&]() { done.post(); });
+    done.wait();
+    done.reset();
+  }
+
+  bs.rehire();
+  auto waitTime = tpe.getTaskStatsHistograms().waitTime;
+  LOG(INFO) << "spin " << spinUs << "us: wait p50 "
+            << waitTime.getPercentile(50).count() << "ns, p99 "
+            << waitTime.getPercentile(99).count() << "ns, p99.9 "
+            << waitTime.getPercentile(99.9).count() << "ns";
+}
+
+BENCHMARK_PARAM(ioWakeup, 0);
+BENCHMARK_RELATIVE_PARAM(ioWakeup, 50);
+BENCHMARK_RELATIVE_PARAM(ioWakeup, 1000);
+
+BENCHMARK_DRAW_LINE();
+
+// Single threaded add and take of low priority items, which used to probe
+// every higher priority's MPMCQueue on each take
+void priorityTake(uint iters, size_t numPriorities) {
+  BenchmarkSuspender bs;
+  PriorityLifoSemMPMCQueue<int> queue(numPriorities, 1024);
+  int64_t sum = 0;
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; i++) {
+    queue.addWithPriority(i, Executor::LO_PRI);
+    sum += queue.take();
+  }
+  doNotOptimizeAway(sum);
+}
+
+BENCHMARK_PARAM(priorityTake, 1);
+BENCHMARK_RELATIVE_PARAM(priorityTake, 8);
+BENCHMARK_RELATIVE_PARAM(priorityTake, 64);
+BENCHMARK_RELATIVE_PARAM(priorityTake, 255);
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
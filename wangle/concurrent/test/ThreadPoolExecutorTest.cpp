@@ -8,13 +8,23 @@
  *
  */
 
+#include <wangle/concurrent/AffinityThreadFactory.h>
 #include <wangle/concurrent/FutureExecutor.h>
 #include <wangle/concurrent/ThreadPoolExecutor.h>
 #include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <wangle/concurrent/DeadlineBlockingQueue.h>
+#include <wangle/concurrent/IOThreadObjectCache.h>
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
+#include <wangle/concurrent/LifoSemMPMCQueue.h>
+#include <wangle/concurrent/PriorityLifoSemMPMCQueue.h>
+#include <wangle/concurrent/RequestDeadline.h>
+#include <wangle/concurrent/SegmentedMPMCQueue.h>
+#include <wangle/concurrent/WorkStealingQueue.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <set>
+
 using namespace folly;
 using namespace folly::wangle;
 using namespace std::chrono;
@@ -119,6 +129,104 @@ TEST(ThreadPoolExecutorTest, IOJoin) {
   join<IOThreadPoolExecutor>();
 }
 
+template <class TPE>
+static void joinWithTimeout() {
+  {
+    TPE tpe(4);
+    std::atomic<int> completed(0);
+    for (int i = 0; i < 100; i++) {
+      tpe.add([&](){ completed++; });
+    }
+    EXPECT_TRUE(tpe.join(std::chrono::seconds(10)).empty());
+    EXPECT_EQ(100, completed);
+  }
+
+  // A couple of seconds' worth of tasks
+  TPE tpe(4);
+  std::atomic<int> completed(0);
+  for (int i = 0; i < 1000; i++) {
+    tpe.add([&](){
+      burnMs(10)();
+      completed++;
+    });
+  }
+  auto start = std::chrono::steady_clock::now();
+  auto overran = tpe.join(std::chrono::milliseconds(100));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+  EXPECT_FALSE(overran.empty());
+  EXPECT_LE(overran.size(), 4);
+  // Each reported once
+  std::set<std::thread::id> distinct(overran.begin(), overran.end());
+  EXPECT_EQ(overran.size(), distinct.size());
+  EXPECT_LT(completed, 1000);
+  EXPECT_EQ(0, tpe.numThreads());
+}
+
+TEST(ThreadPoolExecutorTest, CPUJoinWithTimeout) {
+  joinWithTimeout<CPUThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOJoinWithTimeout) {
+  joinWithTimeout<IOThreadPoolExecutor>();
+}
+
+template <class TPE>
+static void addBatch() {
+  TPE tpe(10);
+  std::atomic<int> completed(0);
+  std::vector<Func> funcs;
+  for (int i = 0; i < 1000; i++) {
+    funcs.push_back([&](){ completed++; });
+  }
+  tpe.addBatch(std::move(funcs));
+  tpe.join();
+  EXPECT_EQ(1000, completed);
+}
+
+TEST(ThreadPoolExecutorTest, CPUAddBatch) {
+  addBatch<CPUThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOAddBatch) {
+  addBatch<IOThreadPoolExecutor>();
+}
+
+static void threadSelector(
+    std::shared_ptr<IOThreadPoolExecutor::ThreadSelector> selector) {
+  IOThreadPoolExecutor tpe(
+      10,
+      std::make_shared<NamedThreadFactory>("IOThreadPool"),
+      EventBaseManager::get(),
+      selector);
+  EXPECT_EQ(selector, tpe.getThreadSelector());
+  std::atomic<int> completed(0);
+  auto f = [&](){
+    burnMs(1)();
+    completed++;
+  };
+  for (int i = 0; i < 1000; i++) {
+    tpe.add(f);
+  }
+  tpe.join();
+  EXPECT_EQ(1000, completed);
+}
+
+TEST(ThreadPoolExecutorTest, RoundRobinThreadSelector) {
+  threadSelector(std::make_shared<RoundRobinThreadSelector>());
+}
+
+TEST(ThreadPoolExecutorTest, LeastPendingTasksThreadSelector) {
+  threadSelector(std::make_shared<LeastPendingTasksThreadSelector>());
+}
+
+TEST(ThreadPoolExecutorTest, PowerOfTwoChoicesThreadSelector) {
+  threadSelector(std::make_shared<PowerOfTwoChoicesThreadSelector>());
+}
+
+TEST(ThreadPoolExecutorTest, NumaLocalThreadSelector) {
+  threadSelector(std::make_shared<NumaLocalThreadSelector>());
+}
+
 template <class TPE>
 static void resizeUnderLoad() {
   TPE tpe(10);
@@ -201,6 +309,37 @@ TEST(ThreadPoolExecutorTest, IOTaskStats) {
   taskStats<IOThreadPoolExecutor>();
 }
 
+template <class TPE>
+static void taskStatsHistograms() {
+  TPE tpe(2);
+  tpe.setTaskStatsSampleRate(4);
+  std::atomic<int> c(0);
+  auto s = tpe.subscribeToTaskStats(
+      Observer<ThreadPoolExecutor::TaskStats>::create(
+          [&](ThreadPoolExecutor::TaskStats stats) {
+        c++;
+      }));
+  for (int i = 0; i < 8; i++) {
+    tpe.add(burnMs(1));
+  }
+  tpe.join();
+  // Each thread reports every 4th of its own tasks
+  EXPECT_GE(2, c);
+  auto histograms = tpe.getTaskStatsHistograms();
+  EXPECT_EQ(8, histograms.waitTime.count());
+  EXPECT_EQ(8, histograms.runTime.count());
+  // Buckets only bound a value to within 25%
+  EXPECT_LE(microseconds(750), histograms.runTime.getPercentile(100));
+}
+
+TEST(ThreadPoolExecutorTest, CPUTaskStatsHistograms) {
+  taskStatsHistograms<CPUThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOTaskStatsHistograms) {
+  taskStatsHistograms<IOThreadPoolExecutor>();
+}
+
 template <class TPE>
 static void expiration() {
   TPE tpe(1);
@@ -234,6 +373,51 @@ TEST(ThreadPoolExecutorTest, IOExpiration) {
   expiration<IOThreadPoolExecutor>();
 }
 
+template <class TPE>
+static void requestDeadline() {
+  TPE tpe(1);
+  std::atomic<int> ran(0);
+  std::atomic<int> expired(0);
+  auto expireCb = [&] () { expired++; };
+  auto deadline = RequestDeadline::Clock::now() + seconds(60);
+  {
+    // Runs under the deadline it was added under
+    RequestDeadline::Guard g(deadline);
+    tpe.add([&] () {
+      EXPECT_EQ(deadline, RequestDeadline::get());
+      ran++;
+    }, milliseconds(0), expireCb);
+  }
+  EXPECT_FALSE(RequestDeadline::isSet());
+  tpe.add(burnMs(10));
+  {
+    // Expires, being still queued at its deadline
+    RequestDeadline::Guard g(RequestDeadline::Clock::now() + milliseconds(5));
+    tpe.add([&] () { ran++; }, seconds(60), expireCb);
+  }
+  tpe.add(burnMs(10));
+  {
+    // Runs all the same, having no expireCallback to tell anyone it didn't
+    auto shortDeadline = RequestDeadline::Clock::now() + milliseconds(5);
+    RequestDeadline::Guard g(shortDeadline);
+    tpe.add([&] () {
+      EXPECT_EQ(shortDeadline, RequestDeadline::get());
+      ran++;
+    });
+  }
+  tpe.join();
+  EXPECT_EQ(2, ran);
+  EXPECT_EQ(1, expired);
+}
+
+TEST(ThreadPoolExecutorTest, CPURequestDeadline) {
+  requestDeadline<CPUThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IORequestDeadline) {
+  requestDeadline<IOThreadPoolExecutor>();
+}
+
 template <typename TPE>
 static void futureExecutor() {
   FutureExecutor<TPE> fe(2);
@@ -383,3 +567,500 @@ TEST(ThreadPoolExecutorTest, AddWithPriority) {
 
   EXPECT_EQ(7, c);
 }
+
+static void workStealingFanOut(size_t numThreads, size_t numDeques) {
+  CPUThreadPoolExecutor tpe(
+      numThreads,
+      folly::make_unique<WorkStealingQueue<CPUThreadPoolExecutor::CPUTask>>(
+          numDeques));
+  std::atomic<int> completed(0);
+  auto child = [&](){
+    completed++;
+  };
+  auto root = [&](){
+    // Submitted from a pool thread, so these go onto its own deque
+    for (int i = 0; i < 10; i++) {
+      tpe.add(child);
+    }
+    completed++;
+  };
+  for (int i = 0; i < 100; i++) {
+    tpe.add(root);
+  }
+  tpe.join();
+  EXPECT_EQ(1100, completed);
+}
+
+TEST(ThreadPoolExecutorTest, WorkStealingJoin) {
+  workStealingFanOut(10, 10);
+}
+
+TEST(ThreadPoolExecutorTest, WorkStealingMoreThreadsThanDeques) {
+  workStealingFanOut(10, 2);
+}
+
+class CpuObserver : public ThreadPoolExecutor::Observer {
+ public:
+  void threadStarted(ThreadPoolExecutor::ThreadHandle* h) override {
+    std::lock_guard<std::mutex> g(lock_);
+    cpus_.push_back(h->getCpus());
+  }
+  void threadStopped(ThreadPoolExecutor::ThreadHandle*) override {}
+
+  std::vector<std::vector<int>> getCpus() {
+    std::lock_guard<std::mutex> g(lock_);
+    return cpus_;
+  }
+
+ private:
+  std::mutex lock_;
+  std::vector<std::vector<int>> cpus_;
+};
+
+TEST(ThreadPoolExecutorTest, AffinityThreadFactory) {
+  auto allowed = AffinityThreadFactory::getThreadCpus(pthread_self());
+  if (allowed.empty()) {
+    return;
+  }
+  auto observer = std::make_shared<CpuObserver>();
+  CPUThreadPoolExecutor tpe(
+      0,
+      std::make_shared<AffinityThreadFactory>(
+          "Pinned", std::vector<int>{allowed.front()}));
+  tpe.addObserver(observer);
+  tpe.setNumThreads(2);
+  auto cpus = observer->getCpus();
+  ASSERT_EQ(2, cpus.size());
+  for (auto& threadCpus : cpus) {
+    EXPECT_EQ(std::vector<int>{allowed.front()}, threadCpus);
+  }
+  tpe.removeObserver(observer);
+  tpe.join();
+}
+
+TEST(ThreadPoolExecutorTest, CodelShedding) {
+  CPUThreadPoolExecutor tpe(1);
+  tpe.setCodelEnabled(true);
+  std::atomic<int> completed(0);
+  std::atomic<int> shed(0);
+  auto f = [&](){
+    burnMs(1)();
+    completed++;
+  };
+  auto expire = [&](){
+    shed++;
+  };
+  // Every task waits well over the codel target, so once an interval has
+  // passed the remaining ones are shed
+  tpe.add(burnMs(50));
+  for (int i = 0; i < 300; i++) {
+    tpe.add(f, std::chrono::milliseconds(0), expire);
+  }
+  tpe.join();
+  EXPECT_EQ(300, completed + shed);
+  EXPECT_LT(0, shed);
+  EXPECT_LT(0, completed);
+}
+
+// A pool with one thread stuck on a task and a queue of two tasks
+struct FullPool {
+  typedef LifoSemMPMCQueue<CPUThreadPoolExecutor::CPUTask> Queue;
+
+  FullPool() : tpe(1, folly::make_unique<Queue>(2)) {
+    tpe.add([&](){
+      started.post();
+      release.wait();
+    });
+    started.wait();
+    tpe.add([&](){ ran++; }, milliseconds(0), [&](){ expired++; });
+    tpe.add([&](){ ran++; }, milliseconds(0), [&](){ expired++; });
+  }
+
+  ~FullPool() {
+    unblock();
+    tpe.join();
+  }
+
+  void unblock() {
+    if (!released.exchange(true)) {
+      release.post();
+    }
+  }
+
+  folly::Baton<> started;
+  folly::Baton<> release;
+  std::atomic<bool> released{false};
+  std::atomic<int> ran{0};
+  std::atomic<int> expired{0};
+  CPUThreadPoolExecutor tpe;
+};
+
+TEST(ThreadPoolExecutorTest, QueueFullThrow) {
+  FullPool pool;
+  EXPECT_THROW(pool.tpe.add([](){}), QueueFullException);
+  EXPECT_EQ(1, pool.tpe.getQueueFullStats().rejected);
+}
+
+TEST(ThreadPoolExecutorTest, QueueFullBlock) {
+  FullPool pool;
+  pool.tpe.setQueueFullPolicy(
+      CPUThreadPoolExecutor::QueueFullPolicy::BLOCK, milliseconds(10));
+  EXPECT_THROW(pool.tpe.add([](){}), QueueFullException);
+  std::thread releaser([&](){
+    std::this_thread::sleep_for(milliseconds(10));
+    pool.unblock();
+  });
+  pool.tpe.setQueueFullPolicy(CPUThreadPoolExecutor::QueueFullPolicy::BLOCK);
+  pool.tpe.add([&](){ pool.ran++; });
+  releaser.join();
+  auto stats = pool.tpe.getQueueFullStats();
+  EXPECT_EQ(2, stats.blocked);
+  EXPECT_EQ(1, stats.rejected);
+}
+
+TEST(ThreadPoolExecutorTest, QueueFullCallerRuns) {
+  FullPool pool;
+  pool.tpe.setQueueFullPolicy(
+      CPUThreadPoolExecutor::QueueFullPolicy::CALLER_RUNS);
+  auto caller = std::this_thread::get_id();
+  std::thread::id runner;
+  pool.tpe.add([&](){ runner = std::this_thread::get_id(); });
+  EXPECT_EQ(caller, runner);
+  EXPECT_EQ(1, pool.tpe.getQueueFullStats().callerRuns);
+}
+
+TEST(ThreadPoolExecutorTest, QueueFullDropOldest) {
+  FullPool pool;
+  pool.tpe.setQueueFullPolicy(
+      CPUThreadPoolExecutor::QueueFullPolicy::DROP_OLDEST);
+  pool.tpe.add([&](){ pool.ran++; });
+  EXPECT_EQ(1, pool.expired);
+  EXPECT_EQ(1, pool.tpe.getQueueFullStats().dropped);
+  pool.unblock();
+  pool.tpe.join();
+  EXPECT_EQ(2, pool.ran);
+}
+
+TEST(ThreadPoolExecutorTest, PriorityStarvationInterval) {
+  std::vector<int> order;
+  std::mutex m;
+  auto record = [&](int priority) {
+    return [&, priority]() {
+      std::lock_guard<std::mutex> g(m);
+      order.push_back(priority);
+    };
+  };
+  auto queue = folly::make_unique<
+    PriorityLifoSemMPMCQueue<CPUThreadPoolExecutor::CPUTask>>(3, 100);
+  queue->setStarvationInterval(4);
+  CPUThreadPoolExecutor pool(0, std::move(queue));
+  for (int i = 0; i < 8; i++) {
+    pool.addWithPriority(record(Executor::HI_PRI), Executor::HI_PRI);
+  }
+  pool.addWithPriority(record(Executor::LO_PRI), Executor::LO_PRI);
+  pool.setNumThreads(1);
+  pool.join();
+  ASSERT_EQ(9, order.size());
+  // The low priority task didn't wait for all high priority ones, and the
+  // join still ran everything
+  EXPECT_NE(Executor::LO_PRI, order.back());
+}
+
+TEST(ThreadPoolExecutorTest, IOThreadObjectCache) {
+  struct LoopObject {
+    LoopObject(EventBase* e, std::atomic<int>& live) : evb(e), live_(live) {
+      EXPECT_TRUE(evb->isInEventBaseThread());
+      live_++;
+    }
+    ~LoopObject() {
+      EXPECT_TRUE(evb->isInEventBaseThread());
+      live_--;
+    }
+    EventBase* evb;
+    std::atomic<int>& live_;
+  };
+
+  std::atomic<int> live(0);
+  auto exe = std::make_shared<IOThreadPoolExecutor>(2);
+  auto cache = IOThreadObjectCache<LoopObject>::create(
+      exe,
+      [&](EventBase* evb) {
+        return folly::make_unique<LoopObject>(evb, live);
+      });
+  EXPECT_EQ(2, live);
+  exe->setNumThreads(3);
+  EXPECT_EQ(3, live);
+
+  for (int i = 0; i < 10; i++) {
+    folly::Baton<> done;
+    exe->add([&]() {
+      EXPECT_EQ(EventBaseManager::get()->getEventBase(), cache->get().evb);
+      done.post();
+    });
+    done.wait();
+  }
+  EXPECT_EQ(cache->get().evb, cache->getForEventBase(cache->get().evb).evb);
+
+  exe->setNumThreads(1);
+  EXPECT_EQ(1, live);
+  cache->detach();
+  EXPECT_EQ(0, live);
+}
+
+TEST(ThreadPoolExecutorTest, Autoscaling) {
+  CPUThreadPoolExecutor tpe(1);
+  tpe.setAutoscaling(1, 4, milliseconds(5), milliseconds(50));
+  std::atomic<int> completed(0);
+  for (int i = 0; i < 100; i++) {
+    tpe.add([&](){
+      burnMs(5)();
+      completed++;
+    });
+  }
+  auto waitFor = [](std::function<bool()> cond) {
+    auto deadline = steady_clock::now() + seconds(5);
+    while (!cond() && steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(milliseconds(1));
+    }
+    return cond();
+  };
+  // Queueing delay grows the pool
+  EXPECT_TRUE(waitFor([&]() { return tpe.numThreads() == 4; }));
+  EXPECT_TRUE(waitFor([&]() { return completed == 100; }));
+  // And idleness shrinks it back
+  EXPECT_TRUE(waitFor([&]() { return tpe.numThreads() == 1; }));
+  tpe.disableAutoscaling();
+  tpe.join();
+}
+
+TEST(ThreadPoolExecutorTest, IdleMemoryRelease) {
+  CPUThreadPoolExecutor tpe(4);
+  tpe.setIdleMemoryRelease(milliseconds(10));
+  auto waitFor = [](std::function<bool()> cond) {
+    auto deadline = steady_clock::now() + seconds(5);
+    while (!cond() && steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(milliseconds(1));
+    }
+    return cond();
+  };
+  // Every idle thread releases once...
+  EXPECT_TRUE(waitFor([&]() { return tpe.getIdleMemoryReleaseCount() == 4; }));
+  std::this_thread::sleep_for(milliseconds(50));
+  EXPECT_EQ(4, tpe.getIdleMemoryReleaseCount());
+  // ...and again after it ran a task
+  std::atomic<int> completed(0);
+  tpe.add([&](){ completed++; });
+  EXPECT_TRUE(waitFor([&]() { return tpe.getIdleMemoryReleaseCount() == 5; }));
+  EXPECT_EQ(1, completed);
+  tpe.setIdleMemoryRelease(milliseconds(0));
+  tpe.join();
+}
+
+TEST(ThreadPoolExecutorTest, DeadlineQueueOrder) {
+  typedef CPUThreadPoolExecutor::CPUTask Task;
+  DeadlineBlockingQueue<Task> queue(10);
+  std::vector<int> order;
+  auto push = [&](int id, milliseconds expiration) {
+    queue.add(Task([&order, id]() { order.push_back(id); }, expiration,
+                   nullptr));
+  };
+  push(0, milliseconds(0));
+  push(1, milliseconds(3000));
+  push(2, milliseconds(1000));
+  push(3, milliseconds(2000));
+  EXPECT_EQ(4, queue.size());
+  for (int i = 0; i < 4; i++) {
+    queue.take().func_();
+  }
+  EXPECT_EQ(std::vector<int>({2, 3, 1, 0}), order);
+}
+
+TEST(ThreadPoolExecutorTest, DeadlineQueuePoisonLast) {
+  typedef CPUThreadPoolExecutor::CPUTask Task;
+  DeadlineBlockingQueue<Task> queue(10, milliseconds(1000));
+  queue.add(Task());
+  queue.add(Task([](){}, milliseconds(0), nullptr));
+  queue.add(Task([](){}, milliseconds(3000), nullptr));
+  // The pill was queued first, and would have been due first by the
+  // default deadline
+  EXPECT_FALSE(queue.take().poison);
+  EXPECT_FALSE(queue.take().poison);
+  EXPECT_TRUE(queue.take().poison);
+}
+
+TEST(ThreadPoolExecutorTest, DeadlineQueueExpiresInBulk) {
+  typedef CPUThreadPoolExecutor::CPUTask Task;
+  DeadlineBlockingQueue<Task> queue(10);
+  int expired = 0;
+  for (int i = 0; i < 5; i++) {
+    queue.add(Task([](){}, milliseconds(1), [&]() { expired++; }));
+  }
+  bool ran = false;
+  queue.add(Task([&]() { ran = true; }, milliseconds(10000), nullptr));
+  std::this_thread::sleep_for(milliseconds(5));
+  // One take() expires everything overdue and returns the live task
+  queue.take().func_();
+  EXPECT_TRUE(ran);
+  EXPECT_EQ(5, expired);
+  EXPECT_EQ(5, queue.getExpiredCount());
+  EXPECT_EQ(0, queue.size());
+}
+
+TEST(ThreadPoolExecutorTest, DeadlineQueueWithPool) {
+  CPUThreadPoolExecutor tpe(
+      2,
+      folly::make_unique<DeadlineBlockingQueue<CPUThreadPoolExecutor::CPUTask>>(
+          100));
+  std::atomic<int> completed(0);
+  for (int i = 0; i < 10; i++) {
+    tpe.add([&]() { completed++; }, milliseconds(10000));
+    tpe.add([&]() { completed++; });
+  }
+  tpe.join();
+  EXPECT_EQ(20, completed);
+}
+
+template <class TPE>
+static void addTaskFunc() {
+  TPE tpe(2);
+  std::atomic<int> completed(0);
+  for (int i = 0; i < 10; i++) {
+    auto amount = folly::make_unique<int>(i);
+    // Move-only, so it couldn't go through add()
+    struct AddTo {
+      void operator()() {
+        (*completed) += *amount;
+      }
+      std::atomic<int>* completed;
+      std::unique_ptr<int> amount;
+    } f{&completed, std::move(amount)};
+    tpe.addTaskFunc(std::move(f));
+  }
+  tpe.join();
+  EXPECT_EQ(45, completed);
+}
+
+TEST(ThreadPoolExecutorTest, CPUAddTaskFunc) {
+  addTaskFunc<CPUThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOAddTaskFunc) {
+  addTaskFunc<IOThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOEventLoopStats) {
+  IOThreadPoolExecutor tpe(0);
+  tpe.setEventLoopStatsInterval(milliseconds(10));
+  tpe.setNumThreads(1);
+  std::mutex lock;
+  std::vector<IOThreadPoolExecutor::EventLoopStats> reports;
+  auto s = tpe.subscribeToEventLoopStats(
+      Observer<IOThreadPoolExecutor::EventLoopStats>::create(
+          [&](IOThreadPoolExecutor::EventLoopStats stats) {
+        std::lock_guard<std::mutex> g(lock);
+        reports.push_back(stats);
+      }));
+  // Keeps the CPU busy, unlike burnMs()
+  tpe.add([]() {
+    auto end = steady_clock::now() + milliseconds(5);
+    while (steady_clock::now() < end) {}
+  });
+  auto deadline = steady_clock::now() + seconds(5);
+  bool found = false;
+  while (!found && steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(milliseconds(1));
+    std::lock_guard<std::mutex> g(lock);
+    for (auto& stats : reports) {
+      if (stats.maxTaskRunTime >= milliseconds(5)) {
+        EXPECT_LT(0, stats.iterations);
+        EXPECT_EQ(stats.iterations, stats.loopTime.count());
+        EXPECT_LE(milliseconds(5), stats.maxLoopTime);
+        EXPECT_LT(0, stats.getBusyRatio());
+        EXPECT_GE(1.01, stats.getBusyRatio());
+        found = true;
+      }
+    }
+  }
+  EXPECT_TRUE(found);
+  tpe.join();
+}
+
+TEST(ThreadPoolExecutorTest, IOEventLoopStatsOptIn) {
+  IOThreadPoolExecutor tpe(1);
+  std::atomic<int> reports(0);
+  auto s = tpe.subscribeToEventLoopStats(
+      Observer<IOThreadPoolExecutor::EventLoopStats>::create(
+          [&](IOThreadPoolExecutor::EventLoopStats) { reports++; }));
+  // Off by default, so the idle loop isn't woken up for it
+  std::this_thread::sleep_for(milliseconds(50));
+  EXPECT_EQ(0, reports);
+
+  // The blocked loop picks it up
+  tpe.setEventLoopStatsInterval(milliseconds(5));
+  auto deadline = steady_clock::now() + seconds(5);
+  while (reports == 0 && steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  EXPECT_LT(0, reports);
+  tpe.join();
+}
+
+TEST(ThreadPoolExecutorTest, IOSpinWait) {
+  IOThreadPoolExecutor tpe(2);
+  auto runAll = [&](size_t n) {
+    std::atomic<size_t> completed(0);
+    for (size_t i = 0; i < n; i++) {
+      tpe.add([&]() { completed++; });
+    }
+    while (completed < n) {
+      std::this_thread::yield();
+    }
+  };
+  tpe.setSpinWait(microseconds(500));
+  EXPECT_EQ(microseconds(500), tpe.getSpinWait());
+  runAll(100);
+  // Past the spin budget, so the threads block and are woken up again
+  std::this_thread::sleep_for(milliseconds(5));
+  runAll(100);
+
+  tpe.setSpinWait(microseconds(0));
+  runAll(100);
+  EXPECT_EQ(300, tpe.getTaskStatsHistograms().waitTime.count());
+  tpe.setSpinWait(microseconds(500));
+  // Stopping interrupts the spinning
+  tpe.stop();
+}
+
+TEST(ThreadPoolExecutorTest, SegmentedMPMCQueue) {
+  SegmentedMPMCQueue<int> queue(10, 4);
+  EXPECT_EQ(0, queue.getAllocatedSegments());
+  for (int i = 0; i < 10; i++) {
+    int item = i;
+    EXPECT_TRUE(queue.write(std::move(item)));
+  }
+  int item = 10;
+  EXPECT_FALSE(queue.write(std::move(item)));
+  EXPECT_EQ(10, queue.size());
+  EXPECT_EQ(3, queue.getAllocatedSegments());
+  for (int i = 0; i < 10; i++) {
+    EXPECT_TRUE(queue.read(item));
+    EXPECT_EQ(i, item);
+  }
+  EXPECT_FALSE(queue.read(item));
+  EXPECT_EQ(0, queue.size());
+  // Only the spare is left
+  EXPECT_EQ(1, queue.getAllocatedSegments());
+}
+
+TEST(ThreadPoolExecutorTest, SegmentedQueuePool) {
+  typedef CPUThreadPoolExecutor::CPUTask CPUTask;
+  CPUThreadPoolExecutor tpe(4, folly::make_unique<
+    PriorityLifoSemMPMCQueue<CPUTask, SegmentedMPMCQueue<CPUTask>>>(
+        3, CPUThreadPoolExecutor::kDefaultMaxQueueSize));
+  std::atomic<int> completed(0);
+  for (int i = 0; i < 1000; i++) {
+    tpe.addWithPriority([&]() { completed++; }, i % 3 - 1);
+  }
+  tpe.join();
+  EXPECT_EQ(1000, completed);
+}
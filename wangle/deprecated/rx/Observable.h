@@ -14,21 +14,34 @@
 #include <wangle/deprecated/rx/Subject.h>
 #include <wangle/deprecated/rx/Subscription.h>
 
+#include <folly/Likely.h>
 #include <folly/RWSpinLock.h>
+#include <folly/ScopeGuard.h>
 #include <folly/SmallLocks.h>
-#include <folly/ThreadLocal.h>
 #include <folly/small_vector.h>
 #include <folly/Executor.h>
 #include <folly/Memory.h>
-#include <map>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 namespace folly { namespace wangle {
 
+/// Observers are kept in an immutable list that subscribing and
+/// unsubscribing replace with an updated copy, RCU style.  Notifying counts
+/// itself in a reader count while it calls the observers of the current
+/// list, without taking any lock, so observers may subscribe and
+/// unsubscribe, or notify again, from their callbacks; the lists replaced
+/// meanwhile are freed once no notification is running.  With no
+/// observers, notifying is a single atomic load, and with one it calls the
+/// observer without going through the list.
 template <class T, size_t InlineObservers>
 class Observable {
  public:
-  Observable() : nextSubscriptionId_{1} {}
+  Observable()
+    : nextSubscriptionId_{1},
+      observers_(new ObserverList()) {}
 
   // TODO perhaps we want to provide this #5283229
   Observable(Observable&& other) = delete;
@@ -37,6 +50,7 @@ class Observable {
     if (unsubscriber_) {
       unsubscriber_->disable();
     }
+    delete observers_.load(std::memory_order_relaxed);
   }
 
   // The next three methods subscribe the given Observer to this Observable.
@@ -53,8 +67,8 @@ class Observable {
   // caller is responsible for ensuring that the given Observer outlives this
   // Observable. This might be useful in high performance environments where
   // allocations must be kept to a minimum. Template parameter InlineObservers
-  // specifies how many observers can been subscribed inline without any
-  // allocations (it's just the size of a folly::small_vector).
+  // specifies how many observers fit in the observer list's own allocation
+  // (it's just the size of a folly::small_vector).
   virtual Subscription<T> subscribe(ObserverPtr<T> observer) {
     return subscribeImpl(observer, false);
   }
@@ -64,15 +78,9 @@ class Observable {
   }
 
   virtual void observe(Observer<T>* observer) {
-    if (inCallback_ && *inCallback_) {
-      if (!newObservers_) {
-        newObservers_.reset(new ObserverList());
-      }
-      newObservers_->push_back(observer);
-    } else {
-      RWSpinLock::WriteHolder{&observersLock_};
-      observers_.push_back(observer);
-    }
+    updateObservers([&](ObserverList& observers) {
+      observers.push_back(Entry{0, nullptr, observer});
+    });
   }
 
   // TODO unobserve(ObserverPtr<T>), unobserve(Observer<T>*)
@@ -139,67 +147,77 @@ class Observable {
   // Observer<T>* as its argument.
   template <class F>
   void forEachObserver(F f) {
-    if (UNLIKELY(!inCallback_)) {
-      inCallback_.reset(new bool{false});
+    if (LIKELY(numObservers_.load(std::memory_order_acquire) == 0)) {
+      return;
     }
-    CHECK(!(*inCallback_));
-    *inCallback_ = true;
-
-    {
-      RWSpinLock::ReadHolder rh(observersLock_);
-      for (auto o : observers_) {
-        f(o);
-      }
-
-      for (auto& kv : subscribers_) {
-        f(kv.second.get());
+    // Keeps the list, and so its observers, alive even if they are
+    // unsubscribed meanwhile, which is why they get this update
+    readers_.fetch_add(1);
+    SCOPE_EXIT {
+      if (readers_.fetch_sub(1) == 1 &&
+          UNLIKELY(hasRetired_.load(std::memory_order_relaxed))) {
+        reclaim();
       }
+    };
+    if (auto observer = single_.load()) {
+      f(observer);
+      return;
     }
-
-    if (UNLIKELY((newObservers_ && !newObservers_->empty()) ||
-                 (newSubscribers_ && !newSubscribers_->empty()) ||
-                 (oldSubscribers_ && !oldSubscribers_->empty()))) {
-      {
-        RWSpinLock::WriteHolder wh(observersLock_);
-        if (newObservers_) {
-          for (auto observer : *(newObservers_)) {
-            observers_.push_back(observer);
-          }
-          newObservers_->clear();
-        }
-        if (newSubscribers_) {
-          for (auto& kv : *(newSubscribers_)) {
-            subscribers_.insert(std::move(kv));
-          }
-          newSubscribers_->clear();
-        }
-        if (oldSubscribers_) {
-          for (auto id : *(oldSubscribers_)) {
-            subscribers_.erase(id);
-          }
-          oldSubscribers_->clear();
-        }
-      }
+    for (auto& entry : *observers_.load()) {
+      f(entry.observer);
     }
-    *inCallback_ = false;
   }
 
  private:
+  // Subscribed with an id, or observed by pointer with id 0
+  struct Entry {
+    uint64_t id;
+    ObserverPtr<T> owned;
+    Observer<T>* observer;
+  };
+
+  typedef folly::small_vector<Entry, InlineObservers> ObserverList;
+
   Subscription<T> subscribeImpl(ObserverPtr<T> observer, bool indefinite) {
     auto subscription = makeSubscription(indefinite);
-    typename SubscriberMap::value_type kv{subscription.id_, std::move(observer)};
-    if (inCallback_ && *inCallback_) {
-      if (!newSubscribers_) {
-        newSubscribers_.reset(new SubscriberMap());
-      }
-      newSubscribers_->insert(std::move(kv));
-    } else {
-      RWSpinLock::WriteHolder{&observersLock_};
-      subscribers_.insert(std::move(kv));
-    }
+    auto id = subscription.id_;
+    updateObservers([&](ObserverList& observers) {
+      auto raw = observer.get();
+      observers.push_back(Entry{id, std::move(observer), raw});
+    });
     return subscription;
   }
 
+  // Publishes a copy of the observer list changed by g.  The old one is
+  // retired until no notification can still be using it: one that counted
+  // itself in after the check of readers_ sees the new list.
+  template <class G>
+  void updateObservers(G g) {
+    std::lock_guard<MicroSpinLock> guard(observersLock_);
+    // Only written under observersLock_, so a relaxed read will do
+    auto observers = folly::make_unique<ObserverList>(
+        *observers_.load(std::memory_order_relaxed));
+    g(*observers);
+    numObservers_.store(observers->size(), std::memory_order_release);
+    single_.store(observers->size() == 1 ? observers->front().observer
+                                         : nullptr);
+    retired_.emplace_back(observers_.exchange(observers.release()));
+    if (readers_.load() == 0) {
+      retired_.clear();
+    }
+    hasRetired_.store(!retired_.empty(), std::memory_order_relaxed);
+  }
+
+  // By the last notification out, unless an update is under way, which
+  // retires its lists itself
+  void reclaim() {
+    std::unique_lock<MicroSpinLock> guard(observersLock_, std::try_to_lock);
+    if (guard.owns_lock() && readers_.load() == 0) {
+      retired_.clear();
+      hasRetired_.store(false, std::memory_order_relaxed);
+    }
+  }
+
   class Unsubscriber {
    public:
     explicit Unsubscriber(Observable* observable) : observable_(observable) {
@@ -230,22 +248,14 @@ class Observable {
   friend class Subscription<T>;
 
   void unsubscribe(uint64_t id) {
-    if (inCallback_ && *inCallback_) {
-      if (!oldSubscribers_) {
-        oldSubscribers_.reset(new std::vector<uint64_t>());
-      }
-      if (newSubscribers_) {
-        auto it = newSubscribers_->find(id);
-        if (it != newSubscribers_->end()) {
-          newSubscribers_->erase(it);
+    updateObservers([&](ObserverList& observers) {
+      for (auto it = observers.begin(); it != observers.end(); ++it) {
+        if (it->id == id) {
+          observers.erase(it);
           return;
         }
       }
-      oldSubscribers_->push_back(id);
-    } else {
-      RWSpinLock::WriteHolder{&observersLock_};
-      subscribers_.erase(id);
-    }
+    });
   }
 
   Subscription<T> makeSubscription(bool indefinite) {
@@ -263,17 +273,17 @@ class Observable {
   }
 
   std::atomic<uint64_t> nextSubscriptionId_;
-  RWSpinLock observersLock_;
-  folly::ThreadLocalPtr<bool> inCallback_;
-
-  typedef folly::small_vector<Observer<T>*, InlineObservers> ObserverList;
-  ObserverList observers_;
-  folly::ThreadLocalPtr<ObserverList> newObservers_;
-
-  typedef std::map<uint64_t, ObserverPtr<T>> SubscriberMap;
-  SubscriberMap subscribers_;
-  folly::ThreadLocalPtr<SubscriberMap> newSubscribers_;
-  folly::ThreadLocalPtr<std::vector<uint64_t>> oldSubscribers_;
+  // Serializes updates of observers_ and retired_; notifying doesn't take
+  // it
+  MicroSpinLock observersLock_{0};
+  std::atomic<const ObserverList*> observers_;
+  // Its only observer, while it has exactly one
+  std::atomic<Observer<T>*> single_{nullptr};
+  std::atomic<size_t> numObservers_{0};
+  // Notifications running
+  std::atomic<size_t> readers_{0};
+  std::vector<std::unique_ptr<const ObserverList>> retired_;
+  std::atomic<bool> hasRetired_{false};
 };
 
 }}
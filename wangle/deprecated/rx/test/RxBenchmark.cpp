@@ -13,9 +13,13 @@
 #include <wangle/deprecated/rx/Subject.h>
 #include <gflags/gflags.h>
 
+#include <thread>
+
 using namespace folly::wangle;
 using folly::BenchmarkSuspender;
 
+DEFINE_int32(notifiers, 4, "Threads notifying at once in notifyFromThreads");
+
 static std::unique_ptr<Observer<int>> makeObserver() {
   return Observer<int>::create([&] (int x) {});
 }
@@ -120,6 +124,45 @@ void notifyInlineObservers(uint iters, int N) {
   }
 }
 
+// One subject notified iters times, as ThreadPoolExecutor does for each
+// task, usually with no observers at all
+void notifyRepeatedly(uint iters, int N) {
+  BenchmarkSuspender bs;
+  Subject<int> subject;
+  std::vector<Subscription<int>> subscriptions;
+  for (int i = 0; i < N; i++) {
+    subscriptions.push_back(subject.subscribe(makeObserver()));
+  }
+  bs.dismiss();
+  for (uint iter = 0; iter < iters; iter++) {
+    subject.onNext(42);
+  }
+  bs.rehire();
+}
+
+// The same, from several threads at once
+void notifyFromThreads(uint iters, int N) {
+  BenchmarkSuspender bs;
+  Subject<int> subject;
+  std::vector<Subscription<int>> subscriptions;
+  for (int i = 0; i < N; i++) {
+    subscriptions.push_back(subject.subscribe(makeObserver()));
+  }
+  std::vector<std::thread> threads;
+  bs.dismiss();
+  for (int t = 0; t < FLAGS_notifiers; t++) {
+    threads.emplace_back([&]() {
+      for (uint iter = 0; iter < iters / FLAGS_notifiers; iter++) {
+        subject.onNext(42);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  bs.rehire();
+}
+
 BENCHMARK_PARAM(subscribeAndUnsubscribe, 1);
 BENCHMARK_RELATIVE_PARAM(subscribe, 1);
 BENCHMARK_RELATIVE_PARAM(observe, 1);
@@ -142,6 +185,14 @@ BENCHMARK_DRAW_LINE();
 BENCHMARK_PARAM(notifySubscribers, 1000);
 BENCHMARK_RELATIVE_PARAM(notifyInlineObservers, 1000);
 
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(notifyRepeatedly, 0);
+BENCHMARK_RELATIVE_PARAM(notifyRepeatedly, 1);
+BENCHMARK_RELATIVE_PARAM(notifyRepeatedly, 3);
+BENCHMARK_RELATIVE_PARAM(notifyFromThreads, 0);
+BENCHMARK_RELATIVE_PARAM(notifyFromThreads, 1);
+
 int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
   folly::runBenchmarks();
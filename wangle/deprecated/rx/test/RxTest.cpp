@@ -148,6 +148,32 @@ TEST(RxTest, SubscribeUnsubscribeDuringCallback) {
   EXPECT_EQ(0, innerCount);
 }
 
+TEST(RxTest, NotifyDuringCallback) {
+  // Observers get the nested update while handling the outer one
+  Subject<int> subject;
+  std::vector<int> received;
+  auto s1 = subject.subscribe(Observer<int>::create([&] (int x) {
+    received.push_back(x);
+    if (x == 1) {
+      subject.onNext(2);
+    }
+  }));
+  subject.onNext(1);
+  EXPECT_EQ((std::vector<int>{1, 2}), received);
+}
+
+TEST(RxTest, NoObservers) {
+  Subject<int> subject;
+  subject.onNext(1);
+  int count = 0;
+  {
+    auto s1 = subject.subscribe(incrementer(count));
+    subject.onNext(2);
+  }
+  subject.onNext(3);
+  EXPECT_EQ(1, count);
+}
+
 // Move only type
 typedef std::unique_ptr<int> MO;
 static MO makeMO() { return folly::make_unique<int>(1); }
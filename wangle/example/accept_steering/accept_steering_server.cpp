@@ -19,6 +19,8 @@ using namespace folly;
 using namespace folly::wangle;
 
 DEFINE_int32(port, 23, "test server port");
+DEFINE_bool(lightweight_routing, false,
+            "read routing data with a socket read callback, not a pipeline");
 
 /**
  * A simple server that hashes connections to worker threads
@@ -30,17 +32,9 @@ class NaiveRoutingDataHandler : public RoutingDataHandler<char> {
   NaiveRoutingDataHandler(uint64_t connId, Callback* cob)
       : RoutingDataHandler<char>(connId, cob) {}
 
-  bool parseRoutingData(folly::IOBufQueue& bufQueue,
-                        RoutingData& routingData) override {
-    if (bufQueue.chainLength() == 0) {
-      return false;
-    }
-
-    auto buf = bufQueue.move();
-    buf->coalesce();
+  bool peekRoutingData(folly::io::Cursor cursor, char& routingData) override {
     // Use the first byte for hashing to a worker
-    routingData.routingData = buf->data()[0];
-    routingData.bufQueue.append(std::move(buf));
+    routingData = cursor.read<char>();
     return true;
   }
 };
@@ -95,7 +89,8 @@ int main(int argc, char** argv) {
   ServerBootstrap<DefaultPipeline> server;
   server.pipeline(
       std::make_shared<AcceptRoutingPipelineFactory<DefaultPipeline, char>>(
-          &server, routingHandlerFactory, childPipelineFactory));
+          &server, routingHandlerFactory, childPipelineFactory,
+          FLAGS_lightweight_routing));
   server.bind(FLAGS_port);
   server.waitForStop();
 
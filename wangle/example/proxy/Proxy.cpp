@@ -13,6 +13,7 @@
 #include <wangle/bootstrap/ClientBootstrap.h>
 #include <wangle/bootstrap/ServerBootstrap.h>
 #include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/RelayHandler.h>
 
 using namespace folly;
 using namespace folly::wangle;
@@ -20,87 +21,46 @@ using namespace folly::wangle;
 DEFINE_int32(port, 1080, "proxy server port");
 DEFINE_string(remote_host, "127.0.0.1", "remote host");
 DEFINE_int32(remote_port, 23, "remote port");
-
-class ProxyBackendHandler : public InboundBytesToBytesHandler {
- public:
-  explicit ProxyBackendHandler(DefaultPipeline* frontendPipeline) :
-      frontendPipeline_(frontendPipeline) {}
-
-  void read(Context* ctx, IOBufQueue& q) override {
-    frontendPipeline_->write(q.move());
-  }
-
-  void readEOF(Context* ctx) override {
-    LOG(INFO) << "Connection closed by remote host";
-    frontendPipeline_->close();
-  }
-
-  void readException(Context* ctx, exception_wrapper e) override {
-    LOG(ERROR) << "Remote error: " << exceptionStr(e);
-    frontendPipeline_->close();
-  }
-
- private:
-  DefaultPipeline* frontendPipeline_;
-};
+DEFINE_bool(splice, true, "splice the relayed bytes between the sockets");
+DEFINE_int32(warm_connections, 0,
+             "connections to the remote host kept ready on each IO thread");
 
 class ProxyBackendPipelineFactory : public PipelineFactory<DefaultPipeline> {
  public:
-  explicit ProxyBackendPipelineFactory(DefaultPipeline* frontendPipeline) :
-      frontendPipeline_(frontendPipeline) {}
-
   DefaultPipeline::UniquePtr newPipeline(std::shared_ptr<AsyncSocket> sock) {
     DefaultPipeline::UniquePtr pipeline(new DefaultPipeline);
     pipeline->addBack(AsyncSocketHandler(sock));
-    pipeline->addBack(ProxyBackendHandler(frontendPipeline_));
+    pipeline->addBack(RelayHandler(FLAGS_splice));
     pipeline->finalize();
 
     return std::move(pipeline);
   }
- private:
-  DefaultPipeline* frontendPipeline_;
 };
 
+// Connects to the remote host for each client, and relays the two
 class ProxyFrontendHandler : public BytesToBytesHandler {
  public:
-  explicit ProxyFrontendHandler(SocketAddress remoteAddress) :
-      remoteAddress_(remoteAddress) {}
+  ProxyFrontendHandler(std::shared_ptr<ConnectionPool> pool,
+                       RelayHandler* relay) :
+      pool_(pool), relay_(relay) {}
 
   void read(Context* ctx, IOBufQueue& q) override {
-    backendPipeline_->write(q.move());
-  }
-
-  void readEOF(Context* ctx) override {
-    LOG(INFO) << "Connection closed by local host";
-    backendPipeline_->close().then([this, ctx](){
-      this->close(ctx);
-    });
-  }
-
-  void readException(Context* ctx, exception_wrapper e) override {
-    LOG(ERROR) << "Local error: " << exceptionStr(e);
-    backendPipeline_->close().then([this, ctx](){
-      this->close(ctx);
-    });
+    // The RelayHandler before this one keeps all the bytes
   }
 
   void transportActive(Context* ctx) override {
-    if (backendPipeline_) {
-      // Already connected
+    if (connecting_) {
       return;
     }
-
-    // Pause reading from the socket until remote connection succeeds
-    auto frontendPipeline = dynamic_cast<DefaultPipeline*>(ctx->getPipeline());
-    frontendPipeline->transportInactive();
-
-    client_.pipelineFactory(
-        std::make_shared<ProxyBackendPipelineFactory>(frontendPipeline));
-    client_.connect(remoteAddress_)
-      .then([this, frontendPipeline](DefaultPipeline* pipeline){
-        backendPipeline_ = pipeline;
-        // Resume read
-        frontendPipeline->transportActive();
+    connecting_ = true;
+
+    // The client's bytes are held by the relay until the remote host is
+    // connected
+    client_.pipelineFactory(std::make_shared<ProxyBackendPipelineFactory>());
+    client_.connectionPool(pool_);
+    client_.connect(pool_->getAddress())
+      .then([this](DefaultPipeline* pipeline){
+        RelayHandler::relay(relay_, pipeline->getHandler<RelayHandler>(1));
       })
       .onError([this, ctx](const std::exception& e){
         LOG(ERROR) << "Connect error: " << exceptionStr(e);
@@ -109,34 +69,48 @@ class ProxyFrontendHandler : public BytesToBytesHandler {
   }
 
  private:
-  SocketAddress remoteAddress_;
+  std::shared_ptr<ConnectionPool> pool_;
+  RelayHandler* relay_;
+  bool connecting_{false};
   ClientBootstrap<DefaultPipeline> client_;
-  DefaultPipeline* backendPipeline_;
 };
 
 class ProxyFrontendPipelineFactory : public PipelineFactory<DefaultPipeline> {
  public:
-  explicit ProxyFrontendPipelineFactory(SocketAddress remoteAddress) :
-      remoteAddress_(remoteAddress) {}
+  explicit ProxyFrontendPipelineFactory(std::shared_ptr<ConnectionPool> pool) :
+      pool_(pool) {}
 
   DefaultPipeline::UniquePtr newPipeline(std::shared_ptr<AsyncSocket> sock) {
+    auto relay = std::make_shared<RelayHandler>(FLAGS_splice);
     DefaultPipeline::UniquePtr pipeline(new DefaultPipeline);
     pipeline->addBack(AsyncSocketHandler(sock));
-    pipeline->addBack(std::make_shared<ProxyFrontendHandler>(remoteAddress_));
+    pipeline->addBack(relay);
+    pipeline->addBack(
+      std::make_shared<ProxyFrontendHandler>(pool_, relay.get()));
     pipeline->finalize();
 
     return std::move(pipeline);
   }
  private:
-  SocketAddress remoteAddress_;
+  std::shared_ptr<ConnectionPool> pool_;
 };
 
 int main(int argc, char** argv) {
   google::ParseCommandLineFlags(&argc, &argv, true);
 
+  // Before the pool, which is then left to the pipeline factory and goes
+  // with the server; each IO thread's connections in it are dropped as
+  // the thread's EventBase is destroyed
   ServerBootstrap<DefaultPipeline> server;
-  server.childPipeline(std::make_shared<ProxyFrontendPipelineFactory>(
-      SocketAddress(FLAGS_remote_host, FLAGS_remote_port)));
+
+  // An IO thread keeps warm connections to the remote host once it has
+  // had a client
+  ConnectionPool::Options options;
+  options.minIdle = FLAGS_warm_connections;
+  auto pool = std::make_shared<ConnectionPool>(
+      SocketAddress(FLAGS_remote_host, FLAGS_remote_port), options);
+
+  server.childPipeline(std::make_shared<ProxyFrontendPipelineFactory>(pool));
   server.bind(FLAGS_port);
   server.waitForStop();
 
@@ -28,7 +28,7 @@
 
 using namespace folly;
 using namespace folly::wangle;
-using thrift::test::Bonk;
+using thrift::test::cpp2::Bonk;
 
 DEFINE_int32(port, 8080, "test server port");
 
@@ -17,30 +17,58 @@
 #pragma once
 
 #include <wangle/channel/Handler.h>
+#include <wangle/codec/LengthFieldPrepender.h>
 
-#include <thrift/test/gen-cpp/ThriftTest.h>
-#include <thrift/lib/cpp/util/ThriftSerializer.h>
+#include <thrift/lib/cpp2/protocol/Serializer.h>
+#include <thrift/test/gen-cpp2/ThriftTest_types.h>
+
+#include <algorithm>
 
 // Do some serialization / deserialization using thrift.
 // A real rpc server would probably use generated client/server stubs
-class SerializeHandler : public folly::wangle::Handler<
-  std::unique_ptr<folly::IOBuf>, thrift::test::Bonk,
-  thrift::test::Bonk, std::unique_ptr<folly::IOBuf>> {
+//
+// Messages are serialized straight into the buffer that goes out, which
+// has headroom for LengthFieldPrepender's length and is sized after the
+// last message, and deserialized from the frame's IOBuf chain as it was
+// read; the payload isn't copied on either side.
+template <class T, class Serializer = apache::thrift::CompactSerializer>
+class ThriftSerializeHandler : public folly::wangle::Handler<
+  std::unique_ptr<folly::IOBuf>, T,
+  T, std::unique_ptr<folly::IOBuf>> {
  public:
+  typedef typename folly::wangle::Handler<
+    std::unique_ptr<folly::IOBuf>, T,
+    T, std::unique_ptr<folly::IOBuf>>::Context Context;
+
+  // Smallest buffer to start serializing into
+  static const size_t kMinBufferSize = 256;
+
   virtual void read(Context* ctx, std::unique_ptr<folly::IOBuf> msg) override {
-    thrift::test::Bonk received;
-    ser.deserialize<thrift::test::Bonk>(msg->moveToFbString(), &received);
-    ctx->fireRead(received);
+    T received;
+    try {
+      Serializer::deserialize(msg.get(), received);
+    } catch (const std::exception& e) {
+      ctx->fireReadException(
+        folly::make_exception_wrapper<std::runtime_error>(e.what()));
+      return;
+    }
+    ctx->fireRead(std::move(received));
   }
 
-  virtual folly::Future<folly::Unit> write(
-    Context* ctx, thrift::test::Bonk b) override {
-
-    std::string out;
-    ser.serialize<thrift::test::Bonk>(b, &out);
-    return ctx->fireWrite(folly::IOBuf::copyBuffer(out));
+  virtual folly::Future<folly::Unit> write(Context* ctx, T b) override {
+    folly::IOBufQueue out(folly::IOBufQueue::cacheChainLength());
+    out.append(folly::wangle::LengthFieldPrepender::createWithHeadroom(
+                 std::max<size_t>(lastSize_, kMinBufferSize)));
+    Serializer::serialize(b, &out);
+    lastSize_ = out.chainLength();
+    return ctx->fireWrite(out.move());
   }
 
  private:
-  apache::thrift::util::ThriftSerializerCompact<> ser;
+  size_t lastSize_{0};
 };
+
+template <class T, class Serializer>
+const size_t ThriftSerializeHandler<T, Serializer>::kMinBufferSize;
+
+typedef ThriftSerializeHandler<thrift::test::cpp2::Bonk> SerializeHandler;
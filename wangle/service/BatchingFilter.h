@@ -0,0 +1,188 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/service/Service.h>
+
+#include <folly/futures/Future.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBaseManager.h>
+
+#include <functional>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * A service filter coalescing requests into batched requests to a
+ * service taking many at once, such as a multi-get.  Requests are held
+ * until maxBatchSize of them are waiting, or maxDelay after the first,
+ * or, with no maxDelay, until the end of the EventBase loop iteration they
+ * came in, so requests made from one event's callbacks go together.  The
+ * combiner makes one BatchReq of the requests, and the splitter takes its
+ * response apart into one response per request, in the same order; if it
+ * returns the wrong number, or the batch fails, every request in it fails.
+ *
+ * Requests, and the close, have to be on the filter's EventBase thread.
+ */
+template <typename Req, typename Resp, typename BatchReq, typename BatchResp>
+class BatchingFilter : public ServiceFilter<Req, Resp, BatchReq, BatchResp> {
+ public:
+  typedef std::function<BatchReq(std::vector<Req>)> Combiner;
+  typedef std::function<std::vector<Resp>(BatchResp)> Splitter;
+
+  struct Options {
+    size_t maxBatchSize{64};
+    // Zero to send at the end of the loop iteration
+    std::chrono::milliseconds maxDelay{0};
+  };
+
+  BatchingFilter(std::shared_ptr<Service<BatchReq, BatchResp>> service,
+                 Combiner combiner,
+                 Splitter splitter,
+                 Options options,
+                 EventBase* evb = nullptr)
+      : ServiceFilter<Req, Resp, BatchReq, BatchResp>(std::move(service)),
+        combiner_(std::move(combiner)),
+        splitter_(std::make_shared<Splitter>(std::move(splitter))),
+        options_(options),
+        evb_(evb ? evb : EventBaseManager::get()->getEventBase()),
+        timeout_(this) {
+    CHECK_GT(options_.maxBatchSize, 0);
+  }
+
+  ~BatchingFilter() {
+    flush();
+  }
+
+  Future<Resp> operator()(Req req) override {
+    DCHECK(evb_->isInEventBaseThread());
+    requests_.push_back(std::move(req));
+    promises_.emplace_back();
+    auto f = promises_.back().getFuture();
+    if (requests_.size() >= options_.maxBatchSize) {
+      flush();
+    } else if (requests_.size() == 1) {
+      if (options_.maxDelay > std::chrono::milliseconds(0)) {
+        timeout_.scheduleTimeout(options_.maxDelay.count());
+      } else {
+        evb_->runInLoop(&loopCallback_);
+      }
+    }
+    return f;
+  }
+
+  Future<Unit> close() override {
+    flush();
+    return this->service_->close();
+  }
+
+  // Sends the requests waiting now, if any
+  void flush() {
+    timeout_.cancelTimeout();
+    loopCallback_.cancelLoopCallback();
+    if (requests_.empty()) {
+      return;
+    }
+    auto promises = std::make_shared<std::vector<Promise<Resp>>>(
+      std::move(promises_));
+    promises_.clear();
+    std::vector<Req> requests;
+    requests.swap(requests_);
+    numBatches_++;
+
+    auto f = [&] () -> Future<BatchResp> {
+      try {
+        return (*this->service_)(combiner_(std::move(requests)));
+      } catch (const std::exception& e) {
+        return makeFuture<BatchResp>(
+          make_exception_wrapper<std::runtime_error>(e.what()));
+      }
+    }();
+    auto splitter = splitter_;
+    f.then([promises, splitter] (Try<BatchResp>&& t) {
+      if (t.hasException()) {
+        failAll(*promises, t.exception());
+        return;
+      }
+      std::vector<Resp> responses;
+      try {
+        responses = (*splitter)(std::move(t.value()));
+      } catch (const std::exception& e) {
+        failAll(*promises,
+                make_exception_wrapper<std::runtime_error>(e.what()));
+        return;
+      }
+      if (responses.size() != promises->size()) {
+        failAll(*promises, make_exception_wrapper<std::runtime_error>(
+          "Batch response doesn't match its requests"));
+        return;
+      }
+      for (size_t i = 0; i < responses.size(); i++) {
+        (*promises)[i].setValue(std::move(responses[i]));
+      }
+    });
+  }
+
+  // Requests waiting for their batch to go out
+  size_t getNumWaiting() const {
+    return requests_.size();
+  }
+
+  uint64_t getNumBatches() const {
+    return numBatches_;
+  }
+
+ private:
+  class Timeout : public AsyncTimeout {
+   public:
+    explicit Timeout(BatchingFilter* filter)
+        : AsyncTimeout(filter->evb_), filter_(filter) {}
+
+    void timeoutExpired() noexcept override {
+      filter_->flush();
+    }
+
+   private:
+    BatchingFilter* filter_;
+  };
+
+  class LoopCallback : public EventBase::LoopCallback {
+   public:
+    explicit LoopCallback(BatchingFilter* filter) : filter_(filter) {}
+
+    void runLoopCallback() noexcept override {
+      filter_->flush();
+    }
+
+   private:
+    BatchingFilter* filter_;
+  };
+
+  static void failAll(std::vector<Promise<Resp>>& promises,
+                      const exception_wrapper& ew) {
+    for (auto& promise : promises) {
+      promise.setException(ew);
+    }
+  }
+
+  Combiner combiner_;
+  std::shared_ptr<Splitter> splitter_;
+  const Options options_;
+  EventBase* evb_;
+  std::vector<Req> requests_;
+  std::vector<Promise<Resp>> promises_;
+  uint64_t numBatches_{0};
+  Timeout timeout_;
+  LoopCallback loopCallback_{this};
+};
+
+}} // namespace
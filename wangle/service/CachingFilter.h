@@ -0,0 +1,185 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/service/Service.h>
+
+#include <folly/EvictingCacheMap.h>
+#include <folly/Hash.h>
+#include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
+#include <folly/futures/SharedPromise.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * A service filter for idempotent lookups, sending identical requests
+ * only once at a time: requests arriving while one like them is in
+ * flight share its response.  Requests are identified by a key from the
+ * user's function, so the key has to tell apart requests with different
+ * responses, for example a 64 bit hash of everything in the request.
+ *
+ * Successful responses may also be kept for a while, in an LRU cache of
+ * cacheCapacity responses, split into shards with a lock each, for ttl.
+ * Failures are never kept.  Resp has to be copyable.
+ */
+template <typename Req, typename Resp = Req>
+class CachingFilter : public ServiceFilter<Req, Resp> {
+ public:
+  typedef std::function<uint64_t(const Req&)> KeyFunction;
+
+  struct Options {
+    // Cached responses at most; 0 only coalesces requests in flight
+    size_t cacheCapacity{0};
+    std::chrono::milliseconds ttl{1000};
+    size_t numShards{16};
+  };
+
+  CachingFilter(std::shared_ptr<Service<Req, Resp>> service,
+                KeyFunction keyFunction,
+                Options options)
+      : ServiceFilter<Req, Resp>(std::move(service)),
+        keyFunction_(std::move(keyFunction)),
+        state_(std::make_shared<State>(options)) {}
+
+  Future<Resp> operator()(Req req) override {
+    auto key = keyFunction_(req);
+    auto state = state_;
+    auto& shard = state->getShard(key);
+    std::shared_ptr<SharedPromise<Resp>> promise;
+    {
+      std::lock_guard<std::mutex> g(shard.lock);
+      if (state->caching) {
+        auto it = shard.cache.find(key);
+        if (it != shard.cache.end()) {
+          if (std::chrono::steady_clock::now() < it->second.expires) {
+            state->hits.fetch_add(1, std::memory_order_relaxed);
+            return makeFuture(it->second.response);
+          }
+          shard.cache.erase(key);
+        }
+      }
+      auto& inFlight = shard.inFlight[key];
+      if (inFlight) {
+        state->coalesced.fetch_add(1, std::memory_order_relaxed);
+        return inFlight->getFuture();
+      }
+      inFlight = std::make_shared<SharedPromise<Resp>>();
+      promise = inFlight;
+    }
+    state->misses.fetch_add(1, std::memory_order_relaxed);
+    auto f = promise->getFuture();
+    // A service throwing instead of failing its future would leave the
+    // key in flight for good, with every later request like it waiting
+    auto thrown = folly::makeGuard([&] {
+      {
+        std::lock_guard<std::mutex> g(shard.lock);
+        shard.inFlight.erase(key);
+      }
+      promise->setException(
+        std::runtime_error("CachingFilter: service threw"));
+    });
+    (*this->service_)(std::move(req)).then(
+      [state, key, promise] (Try<Resp>&& t) {
+        auto& s = state->getShard(key);
+        {
+          std::lock_guard<std::mutex> g(s.lock);
+          s.inFlight.erase(key);
+          if (state->caching && t.hasValue()) {
+            s.cache.set(key, Entry{
+              t.value(),
+              std::chrono::steady_clock::now() + state->options.ttl});
+          }
+        }
+        promise->setTry(std::move(t));
+      });
+    thrown.dismiss();
+    return f;
+  }
+
+  // Drops all cached responses; requests in flight still coalesce
+  void clear() {
+    for (auto& shard : state_->shards) {
+      std::lock_guard<std::mutex> g(shard->lock);
+      shard->cache.clear();
+    }
+  }
+
+  uint64_t getNumHits() const {
+    return state_->hits.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumMisses() const {
+    return state_->misses.load(std::memory_order_relaxed);
+  }
+
+  // Requests answered by another in flight
+  uint64_t getNumCoalesced() const {
+    return state_->coalesced.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Entry {
+    Resp response;
+    std::chrono::steady_clock::time_point expires;
+  };
+
+  struct Shard {
+    explicit Shard(size_t capacity) : cache(capacity) {}
+
+    std::mutex lock;
+    EvictingCacheMap<uint64_t, Entry> cache;
+    std::unordered_map<uint64_t, std::shared_ptr<SharedPromise<Resp>>>
+      inFlight;
+  };
+
+  // Kept by requests past the filter's lifetime
+  struct State {
+    explicit State(const Options& o)
+        : options(o),
+          caching(o.cacheCapacity > 0 &&
+                  o.ttl > std::chrono::milliseconds(0)) {
+      CHECK_GT(options.numShards, 0);
+      // At least one per shard, which EvictingCacheMap needs
+      auto capacity = std::max<size_t>(
+        1, (options.cacheCapacity + options.numShards - 1) /
+           options.numShards);
+      for (size_t i = 0; i < options.numShards; i++) {
+        shards.emplace_back(new Shard(capacity));
+      }
+    }
+
+    Shard& getShard(uint64_t key) {
+      return *shards[hash::twang_mix64(key) % shards.size()];
+    }
+
+    const Options options;
+    const bool caching;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+    std::atomic<uint64_t> coalesced{0};
+  };
+
+  KeyFunction keyFunction_;
+  std::shared_ptr<State> state_;
+};
+
+}} // namespace
@@ -0,0 +1,244 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/service/Service.h>
+
+#include <folly/futures/Future.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+namespace folly { namespace wangle {
+
+/**
+ * Thrown, through a request's Future, when a CircuitBreakerFilter is open
+ */
+class CircuitOpenException : public std::runtime_error {
+ public:
+  CircuitOpenException() : std::runtime_error("Circuit breaker open") {}
+};
+
+enum class CircuitState {
+  // Requests go through, and their outcomes are counted
+  CLOSED,
+  // Requests fail fast
+  OPEN,
+  // A few probe requests go through, to see if the backend is back
+  HALF_OPEN,
+};
+
+/**
+ * A service filter that stops sending requests to a backend that fails
+ * most of them, or is too slow, so they fail fast with
+ * CircuitOpenException rather than tie up connections until they time
+ * out.
+ *
+ * Outcomes are counted over a sliding window, in ten buckets of time.
+ * Once minRequests are in it and at least failureRatio of them failed,
+ * the breaker opens for openTime.  After that it's half open: up to
+ * halfOpenProbes requests go through at once, and as many successes in
+ * a row close it, while a failure opens it again.  isAvailable() is false
+ * while requests would be failed, so load balancers pass it over.
+ */
+template <typename Req, typename Resp = Req>
+class CircuitBreakerFilter : public ServiceFilter<Req, Resp> {
+ public:
+  struct Options {
+    double failureRatio{0.5};
+    uint64_t minRequests{20};
+    std::chrono::milliseconds window{10000};
+    // Responses slower than this count as failures; 0 for none
+    std::chrono::milliseconds slowThreshold{0};
+    std::chrono::milliseconds openTime{5000};
+    uint32_t halfOpenProbes{1};
+    // Which responses are failures; exceptions, by default
+    std::function<bool(const Try<Resp>&)> isFailure;
+  };
+
+  CircuitBreakerFilter(std::shared_ptr<Service<Req, Resp>> service,
+                       Options options)
+      : ServiceFilter<Req, Resp>(std::move(service)),
+        shared_(std::make_shared<Shared>(std::move(options))) {}
+
+  Future<Resp> operator()(Req req) override {
+    auto shared = shared_;
+    auto start = std::chrono::steady_clock::now();
+    bool probe = false;
+    if (!shared->admit(start, probe)) {
+      shared->rejected.fetch_add(1, std::memory_order_relaxed);
+      return makeFuture<Resp>(make_exception_wrapper<CircuitOpenException>());
+    }
+    return (*this->service_)(std::move(req)).then(
+      [shared, start, probe] (Try<Resp>&& t) {
+        auto now = std::chrono::steady_clock::now();
+        auto& options = shared->options;
+        bool failed = options.isFailure ? options.isFailure(t)
+                                        : t.hasException();
+        if (options.slowThreshold.count() > 0 &&
+            now - start > options.slowThreshold) {
+          failed = true;
+        }
+        shared->record(now, failed, probe);
+        return std::move(t.value());
+      });
+  }
+
+  bool isAvailable() override {
+    return shared_->wouldAdmit(std::chrono::steady_clock::now()) &&
+      this->service_->isAvailable();
+  }
+
+  CircuitState getState() const {
+    std::lock_guard<std::mutex> g(shared_->lock);
+    return shared_->state;
+  }
+
+  // Requests failed fast
+  uint64_t getNumRejected() const {
+    return shared_->rejected.load(std::memory_order_relaxed);
+  }
+
+  // Times the breaker opened
+  uint64_t getNumTrips() const {
+    return shared_->trips.load(std::memory_order_relaxed);
+  }
+
+ private:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  // Kept by requests past the filter's lifetime
+  struct Shared {
+    static const size_t kBuckets = 10;
+
+    explicit Shared(Options o)
+        : options(std::move(o)),
+          bucketLength(std::max<int64_t>(
+            1, std::chrono::duration_cast<std::chrono::nanoseconds>(
+              options.window).count() / kBuckets)) {}
+
+    bool wouldAdmit(TimePoint now) {
+      std::lock_guard<std::mutex> g(lock);
+      switch (state) {
+        case CircuitState::CLOSED:
+          return true;
+        case CircuitState::OPEN:
+          return now >= openUntil;
+        default:
+          return probesInFlight < options.halfOpenProbes;
+      }
+    }
+
+    bool admit(TimePoint now, bool& probe) {
+      std::lock_guard<std::mutex> g(lock);
+      if (state == CircuitState::OPEN) {
+        if (now < openUntil) {
+          return false;
+        }
+        state = CircuitState::HALF_OPEN;
+        probesInFlight = 0;
+        probeSuccesses = 0;
+      }
+      if (state == CircuitState::HALF_OPEN) {
+        if (probesInFlight >= options.halfOpenProbes) {
+          return false;
+        }
+        probesInFlight++;
+        probe = true;
+      }
+      return true;
+    }
+
+    void record(TimePoint now, bool failed, bool probe) {
+      std::lock_guard<std::mutex> g(lock);
+      if (probe) {
+        probesInFlight--;
+        if (state != CircuitState::HALF_OPEN) {
+          return;
+        }
+        if (failed) {
+          open(now);
+        } else if (++probeSuccesses >= options.halfOpenProbes) {
+          state = CircuitState::CLOSED;
+          for (auto& bucket : buckets) {
+            bucket = Bucket();
+          }
+        }
+        return;
+      }
+      if (state != CircuitState::CLOSED) {
+        // Sent before it opened
+        return;
+      }
+
+      int64_t epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        now.time_since_epoch()).count() / bucketLength;
+      auto& bucket = buckets[epoch % kBuckets];
+      if (bucket.epoch != epoch) {
+        bucket = Bucket();
+        bucket.epoch = epoch;
+      }
+      bucket.requests++;
+      if (!failed) {
+        return;
+      }
+      bucket.failures++;
+      uint64_t requests = 0;
+      uint64_t failures = 0;
+      for (auto& b : buckets) {
+        if (b.epoch > epoch - int64_t(kBuckets)) {
+          requests += b.requests;
+          failures += b.failures;
+        }
+      }
+      if (requests >= options.minRequests &&
+          failures >= options.failureRatio * requests) {
+        open(now);
+      }
+    }
+
+    void open(TimePoint now) {
+      state = CircuitState::OPEN;
+      openUntil = now + options.openTime;
+      trips.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    struct Bucket {
+      int64_t epoch{-1};
+      uint64_t requests{0};
+      uint64_t failures{0};
+    };
+
+    const Options options;
+    // In nanoseconds
+    const int64_t bucketLength;
+
+    std::mutex lock;
+    CircuitState state{CircuitState::CLOSED};
+    TimePoint openUntil;
+    uint32_t probesInFlight{0};
+    uint32_t probeSuccesses{0};
+    Bucket buckets[kBuckets];
+
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> trips{0};
+  };
+
+  std::shared_ptr<Shared> shared_;
+};
+
+template <typename Req, typename Resp>
+const size_t CircuitBreakerFilter<Req, Resp>::Shared::kBuckets;
+
+}} // namespace
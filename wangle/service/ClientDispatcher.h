@@ -10,26 +10,48 @@
 
 #pragma once
 
+#include <folly/futures/FutureException.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <folly/io/async/HHWheelTimer.h>
+#include <folly/sorted_vector_types.h>
 #include <wangle/channel/Handler.h>
+#include <wangle/concurrent/RequestDeadline.h>
 #include <wangle/service/Service.h>
 
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+
 namespace folly { namespace wangle {
 
 /**
- * Dispatch a request, satisfying Promise `p` with the response;
- * the returned Future is satisfied when the response is received:
- * only one request is allowed at a time.
+ * Thrown, through a request's Future, when a client dispatcher already has
+ * as many requests in flight as it allows
  */
-template <typename Pipeline, typename Req, typename Resp = Req>
-class SerialClientDispatcher : public HandlerAdapter<Req, Resp>
-                             , public Service<Req, Resp> {
+class TooManyPendingRequests : public std::runtime_error {
  public:
-  typedef typename HandlerAdapter<Req, Resp>::Context Context;
+  TooManyPendingRequests()
+      : std::runtime_error("Too many requests in flight") {}
+};
 
-  ~SerialClientDispatcher() {
+/**
+ * What the client dispatchers share: adding themselves to the pipeline
+ * they send requests on.  Dispatcher is the concrete dispatcher type, by
+ * which the pipeline knows its handlers.
+ */
+template <typename Dispatcher, typename Pipeline, typename Req,
+          typename Resp = Req>
+class ClientDispatcherBase : public HandlerAdapter<Resp, Req>
+                           , public Service<Req, Resp> {
+ public:
+  typedef typename HandlerAdapter<Resp, Req>::Context Context;
+
+  ~ClientDispatcherBase() {
     if (pipeline_) {
       try {
-        pipeline_->remove(this).finalize();
+        pipeline_->remove(static_cast<Dispatcher*>(this)).finalize();
       } catch (const std::invalid_argument& e) {
         // not in pipeline; this is fine
       }
@@ -38,16 +60,44 @@ class SerialClientDispatcher : public HandlerAdapter<Req, Resp>
 
   void setPipeline(Pipeline* pipeline) {
     try {
-      pipeline->template remove<SerialClientDispatcher>();
+      pipeline->template remove<Dispatcher>();
     } catch (const std::invalid_argument& e) {
       // no existing dispatcher; this is fine
     }
     pipeline_ = pipeline;
-    pipeline_->addBack(this);
+    pipeline_->addBack(static_cast<Dispatcher*>(this));
     pipeline_->finalize();
   }
 
-  void read(Context* ctx, Req in) override {
+  virtual Future<Unit> close() override {
+    return HandlerAdapter<Resp, Req>::close(nullptr);
+  }
+
+  virtual Future<Unit> close(Context* ctx) override {
+    return HandlerAdapter<Resp, Req>::close(ctx);
+  }
+
+  void detachPipeline(Context* ctx) override {
+    pipeline_ = nullptr;
+  }
+
+ protected:
+  Pipeline* pipeline_{nullptr};
+};
+
+/**
+ * Dispatch a request, satisfying Promise `p` with the response;
+ * the returned Future is satisfied when the response is received:
+ * only one request is allowed at a time.
+ */
+template <typename Pipeline, typename Req, typename Resp = Req>
+class SerialClientDispatcher
+    : public ClientDispatcherBase<SerialClientDispatcher<Pipeline, Req, Resp>,
+                                  Pipeline, Req, Resp> {
+ public:
+  typedef typename HandlerAdapter<Resp, Req>::Context Context;
+
+  void read(Context* ctx, Resp in) override {
     DCHECK(p_);
     p_->setValue(std::move(in));
     p_ = none;
@@ -55,29 +105,264 @@ class SerialClientDispatcher : public HandlerAdapter<Req, Resp>
 
   virtual Future<Resp> operator()(Req arg) override {
     CHECK(!p_);
-    DCHECK(pipeline_);
+    DCHECK(this->pipeline_);
+    if (RequestDeadline::expired()) {
+      return makeFuture<Resp>(DeadlineExceeded());
+    }
 
     p_ = Promise<Resp>();
     auto f = p_->getFuture();
-    pipeline_->write(std::move(arg));
+    this->pipeline_->write(std::move(arg));
     return f;
   }
 
-  virtual Future<Unit> close() override {
-    return HandlerAdapter<Req, Resp>::close(nullptr);
+ private:
+  folly::Optional<Promise<Resp>> p_;
+};
+
+/**
+ * The limits and timeouts of the pipelined and multiplexed dispatchers,
+ * whose requests wait on the wheel timer of the dispatcher's EventBase.
+ * Used from that EventBase only.
+ */
+template <typename Resp>
+class PendingClientRequests {
+ public:
+  // At most this many requests in flight; more fail TooManyPendingRequests
+  void setMaxPendingRequests(size_t maxPending) {
+    maxPending_ = maxPending;
   }
 
-  virtual Future<Unit> close(Context* ctx) override {
-    return HandlerAdapter<Req, Resp>::close(ctx);
+  // Fail requests without a response after timeout with TimedOut; zero, the
+  // default, for no timeout.  Those made under a RequestDeadline time out
+  // by it at the latest, and fail with DeadlineExceeded once it's passed.
+  void setRequestTimeout(std::chrono::milliseconds timeout) {
+    timeout_ = timeout;
   }
 
-  void detachPipeline(Context* ctx) override {
-    pipeline_ = nullptr;
+ protected:
+  class Request : public HHWheelTimer::Callback {
+   public:
+    explicit Request(std::function<void(Request*)> onTimeout)
+        : onTimeout_(std::move(onTimeout)) {}
+
+    void timeoutExpired() noexcept override {
+      timedOut = true;
+      // onTimeout may destroy this, and the promise's callbacks may issue
+      // another request, which should find the dispatcher up to date
+      auto onTimeout = std::move(onTimeout_);
+      auto p = std::move(promise);
+      onTimeout(this);
+      p.setException(TimedOut());
+    }
+
+    Promise<Resp> promise;
+    uint32_t id{0};
+    bool timedOut{false};
+
+   private:
+    std::function<void(Request*)> onTimeout_;
+  };
+
+  void startTimeout(Request* request) {
+    auto timeout = timeout_;
+    if (RequestDeadline::isSet()) {
+      auto left = RequestDeadline::remaining();
+      if (timeout.count() <= 0 || left < timeout) {
+        timeout = left;
+      }
+    }
+    if (timeout.count() <= 0) {
+      return;
+    }
+    if (!timer_) {
+      timer_.reset(new HHWheelTimer(EventBaseManager::get()->getEventBase()));
+    }
+    timer_->scheduleTimeout(request, timeout);
+  }
+
+  static void fulfill(std::unique_ptr<Request> request, Resp resp) {
+    request->cancelTimeout();
+    request->promise.setValue(std::move(resp));
+  }
+
+  static void fail(std::unique_ptr<Request> request, exception_wrapper ew) {
+    request->cancelTimeout();
+    if (!request->timedOut) {
+      request->promise.setException(std::move(ew));
+    }
+  }
+
+  size_t maxPending_{std::numeric_limits<size_t>::max()};
+  std::chrono::milliseconds timeout_{0};
+  HHWheelTimer::UniquePtr timer_;
+};
+
+/**
+ * Dispatch requests without waiting for the responses to the ones before,
+ * for protocols that answer requests in order without request IDs.  Each
+ * response fulfills the oldest pending request.  A request that times out
+ * keeps its place in line until its response arrives, so that later
+ * responses still match up.
+ */
+template <typename Pipeline, typename Req, typename Resp = Req>
+class PipelinedClientDispatcher
+    : public ClientDispatcherBase<
+        PipelinedClientDispatcher<Pipeline, Req, Resp>, Pipeline, Req, Resp>
+    , public PendingClientRequests<Resp> {
+ public:
+  typedef typename HandlerAdapter<Resp, Req>::Context Context;
+  typedef typename PendingClientRequests<Resp>::Request Request;
+
+  ~PipelinedClientDispatcher() {
+    failAll(make_exception_wrapper<std::runtime_error>("Dispatcher gone"));
+  }
+
+  void read(Context* ctx, Resp in) override {
+    if (pending_.empty()) {
+      LOG(ERROR) << "PipelinedClientDispatcher: response with no request";
+      return;
+    }
+    auto request = std::move(pending_.front());
+    pending_.pop_front();
+    if (!request->timedOut) {
+      this->fulfill(std::move(request), std::move(in));
+    }
+  }
+
+  void readEOF(Context* ctx) override {
+    failAll(make_exception_wrapper<std::runtime_error>("Connection closed"));
+    ctx->fireReadEOF();
+  }
+
+  void readException(Context* ctx, exception_wrapper e) override {
+    failAll(e);
+    ctx->fireReadException(std::move(e));
+  }
+
+  virtual Future<Resp> operator()(Req arg) override {
+    DCHECK(this->pipeline_);
+    if (RequestDeadline::expired()) {
+      return makeFuture<Resp>(DeadlineExceeded());
+    }
+    if (pending_.size() >= this->maxPending_) {
+      return makeFuture<Resp>(TooManyPendingRequests());
+    }
+    // Nothing to do on timeout but fail the promise
+    pending_.emplace_back(new Request([] (Request*) {}));
+    auto request = pending_.back().get();
+    auto f = request->promise.getFuture();
+    this->startTimeout(request);
+    this->pipeline_->write(std::move(arg));
+    return f;
+  }
+
+  // Requests written and not yet answered, including timed out ones
+  size_t getNumPending() const {
+    return pending_.size();
   }
 
  private:
-  Pipeline* pipeline_{nullptr};
-  folly::Optional<Promise<Resp>> p_;
+  void failAll(exception_wrapper ew) {
+    auto pending = std::move(pending_);
+    pending_.clear();
+    for (auto& request : pending) {
+      this->fail(std::move(request), ew);
+    }
+  }
+
+  std::deque<std::unique_ptr<Request>> pending_;
+};
+
+/**
+ * Dispatch requests of multiplexed protocols, whose responses carry the ID
+ * of their request, and may come back in any order.  requestId and
+ * responseId get the protocol's IDs out of requests and responses; each
+ * request in flight needs an ID of its own.  A request that times out is
+ * forgotten, and its response dropped if it ever arrives.
+ */
+template <typename Pipeline, typename Req, typename Resp = Req>
+class MultiplexClientDispatcher
+    : public ClientDispatcherBase<
+        MultiplexClientDispatcher<Pipeline, Req, Resp>, Pipeline, Req, Resp>
+    , public PendingClientRequests<Resp> {
+ public:
+  typedef typename HandlerAdapter<Resp, Req>::Context Context;
+  typedef typename PendingClientRequests<Resp>::Request Request;
+
+  MultiplexClientDispatcher(std::function<uint32_t(const Req&)> requestId,
+                            std::function<uint32_t(const Resp&)> responseId)
+      : requestId_(std::move(requestId)),
+        responseId_(std::move(responseId)) {}
+
+  ~MultiplexClientDispatcher() {
+    failAll(make_exception_wrapper<std::runtime_error>("Dispatcher gone"));
+  }
+
+  void read(Context* ctx, Resp in) override {
+    auto it = pending_.find(responseId_(in));
+    if (it == pending_.end()) {
+      VLOG(4) << "MultiplexClientDispatcher: dropping response to request "
+              << responseId_(in) << ", timed out or unknown";
+      return;
+    }
+    auto request = std::move(it->second);
+    pending_.erase(it);
+    this->fulfill(std::move(request), std::move(in));
+  }
+
+  void readEOF(Context* ctx) override {
+    failAll(make_exception_wrapper<std::runtime_error>("Connection closed"));
+    ctx->fireReadEOF();
+  }
+
+  void readException(Context* ctx, exception_wrapper e) override {
+    failAll(e);
+    ctx->fireReadException(std::move(e));
+  }
+
+  virtual Future<Resp> operator()(Req arg) override {
+    DCHECK(this->pipeline_);
+    if (RequestDeadline::expired()) {
+      return makeFuture<Resp>(DeadlineExceeded());
+    }
+    if (pending_.size() >= this->maxPending_) {
+      return makeFuture<Resp>(TooManyPendingRequests());
+    }
+    auto id = requestId_(arg);
+    if (pending_.count(id)) {
+      return makeFuture<Resp>(std::invalid_argument(
+        "Request ID already in flight"));
+    }
+    std::unique_ptr<Request> request(new Request([this] (Request* r) {
+      pending_.erase(r->id);
+    }));
+    request->id = id;
+    auto f = request->promise.getFuture();
+    this->startTimeout(request.get());
+    pending_.emplace(id, std::move(request));
+    this->pipeline_->write(std::move(arg));
+    return f;
+  }
+
+  size_t getNumPending() const {
+    return pending_.size();
+  }
+
+ private:
+  void failAll(exception_wrapper ew) {
+    auto pending = std::move(pending_);
+    pending_.clear();
+    for (auto& entry : pending) {
+      this->fail(std::move(entry.second), ew);
+    }
+  }
+
+  std::function<uint32_t(const Req&)> requestId_;
+  std::function<uint32_t(const Resp&)> responseId_;
+  // A flat map: IDs are mostly handed out in increasing order, so inserts
+  // land at the end, and there are at most maxPending_ of them
+  sorted_vector_map<uint32_t, std::unique_ptr<Request>> pending_;
 };
 
 }} // namespace
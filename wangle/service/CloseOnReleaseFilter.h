@@ -40,6 +40,10 @@ class CloseOnReleaseFilter : public ServiceFilter<Req, Resp> {
       return makeFuture();
     }
   }
+
+  bool isAvailable() override {
+    return !released && this->service_->isAvailable();
+  }
  private:
   std::atomic<bool> released{false};
 };
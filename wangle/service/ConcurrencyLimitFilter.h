@@ -0,0 +1,230 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/service/Service.h>
+
+#include <folly/ScopeGuard.h>
+#include <folly/futures/Future.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+namespace folly { namespace wangle {
+
+/**
+ * Thrown, through a request's Future, when a ConcurrencyLimitFilter
+ * already has as many requests in flight as its limit allows
+ */
+class ConcurrencyLimitExceeded : public std::runtime_error {
+ public:
+  ConcurrencyLimitExceeded()
+      : std::runtime_error("Concurrency limit exceeded") {}
+};
+
+/**
+ * How many requests a ConcurrencyLimitFilter lets through at once.  May
+ * learn from each response; onSample() is called from whichever thread
+ * completes the request.
+ */
+class ConcurrencyLimit {
+ public:
+  virtual ~ConcurrencyLimit() = default;
+
+  virtual size_t getLimit() const = 0;
+
+  // A response took latency, with inFlight requests out as it was sent
+  virtual void onSample(std::chrono::nanoseconds latency,
+                        size_t inFlight,
+                        bool ok) {}
+};
+
+class FixedConcurrencyLimit : public ConcurrencyLimit {
+ public:
+  explicit FixedConcurrencyLimit(size_t limit) : limit_(limit) {}
+
+  size_t getLimit() const override {
+    return limit_;
+  }
+
+ private:
+  const size_t limit_;
+};
+
+/**
+ * A limit tuned as TCP Vegas tunes its window: the queue at the backend
+ * is estimated as limit * (1 - minLatency / latency), where minLatency is
+ * the lowest latency seen lately, taken as that of an unloaded backend.
+ * The limit grows while the queue is under alpha, and shrinks while it's
+ * over beta, or on errors.  So it settles at what the backend can serve
+ * without queueing, and drops as soon as latency rises.
+ */
+class VegasConcurrencyLimit : public ConcurrencyLimit {
+ public:
+  struct Options {
+    size_t initialLimit{20};
+    size_t minLimit{1};
+    size_t maxLimit{1000};
+    // Queue estimate to grow the limit under, and to shrink it over
+    double alpha{3};
+    double beta{6};
+    // minLatency is forgotten after this many samples, so it follows
+    // backends whose unloaded latency rises
+    uint64_t minLatencyWindow{1000};
+  };
+
+  explicit VegasConcurrencyLimit(Options options)
+      : options_(options),
+        limit_(options.initialLimit) {}
+
+  size_t getLimit() const override {
+    return limit_.load(std::memory_order_relaxed);
+  }
+
+  // Samples arriving while another is being applied are dropped, so
+  // responses never wait on each other
+  void onSample(std::chrono::nanoseconds latency,
+                size_t inFlight,
+                bool ok) override {
+    std::unique_lock<std::mutex> g(lock_, std::try_to_lock);
+    if (!g.owns_lock()) {
+      return;
+    }
+    double limit = limit_.load(std::memory_order_relaxed);
+    if (!ok) {
+      // Multiplicative decrease, as for a loss, by at least one so that
+      // small limits, which 10% of rounds away, still go down
+      setLimit(std::min(limit - 1, std::round(limit * 0.9)));
+      return;
+    }
+    if (++samples_ >= options_.minLatencyWindow) {
+      samples_ = 0;
+      minLatency_ = std::chrono::nanoseconds::max();
+    }
+    if (latency.count() <= 0) {
+      return;
+    }
+    minLatency_ = std::min(minLatency_, latency);
+    // Only samples with the limit near full say anything about growing it
+    if (inFlight * 2 < limit) {
+      return;
+    }
+    double queue = limit * (1 - double(minLatency_.count()) / latency.count());
+    if (queue < options_.alpha) {
+      setLimit(limit + 1);
+    } else if (queue > options_.beta) {
+      setLimit(limit - 1);
+    }
+  }
+
+ private:
+  void setLimit(double limit) {
+    auto rounded = size_t(std::lround(std::max(0.0, limit)));
+    auto l = std::max<size_t>(options_.minLimit,
+                              std::min<size_t>(options_.maxLimit, rounded));
+    limit_.store(l, std::memory_order_relaxed);
+  }
+
+  const Options options_;
+  std::atomic<size_t> limit_;
+  std::mutex lock_;
+  uint64_t samples_{0};
+  std::chrono::nanoseconds minLatency_{std::chrono::nanoseconds::max()};
+};
+
+/**
+ * A service filter failing requests fast, with ConcurrencyLimitExceeded,
+ * once as many requests are in flight as its limit allows, so an
+ * overloaded backend sheds load rather than queueing requests into
+ * their timeouts.  With a VegasConcurrencyLimit, the limit adapts to the
+ * latency seen.
+ */
+template <typename Req, typename Resp = Req>
+class ConcurrencyLimitFilter : public ServiceFilter<Req, Resp> {
+ public:
+  ConcurrencyLimitFilter(std::shared_ptr<Service<Req, Resp>> service,
+                         std::shared_ptr<ConcurrencyLimit> limit)
+      : ServiceFilter<Req, Resp>(std::move(service)),
+        state_(std::make_shared<State>(std::move(limit))) {}
+
+  ConcurrencyLimitFilter(std::shared_ptr<Service<Req, Resp>> service,
+                         size_t limit)
+      : ConcurrencyLimitFilter(
+          std::move(service),
+          std::make_shared<FixedConcurrencyLimit>(limit)) {}
+
+  Future<Resp> operator()(Req req) override {
+    auto state = state_;
+    auto limit = state->limit->getLimit();
+    auto inFlight = state->inFlight.fetch_add(1, std::memory_order_relaxed);
+    if (inFlight >= limit) {
+      state->inFlight.fetch_sub(1, std::memory_order_relaxed);
+      state->rejected.fetch_add(1, std::memory_order_relaxed);
+      return makeFuture<Resp>(
+        make_exception_wrapper<ConcurrencyLimitExceeded>());
+    }
+    state->accepted.fetch_add(1, std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    // A service throwing would otherwise hold its slot for good
+    auto thrown = folly::makeGuard([&] {
+      state->inFlight.fetch_sub(1, std::memory_order_relaxed);
+    });
+    auto f = (*this->service_)(std::move(req)).then(
+      [state, start, inFlight] (Try<Resp>&& t) {
+        state->inFlight.fetch_sub(1, std::memory_order_relaxed);
+        state->limit->onSample(std::chrono::steady_clock::now() - start,
+                               inFlight + 1, t.hasValue());
+        return std::move(t.value());
+      });
+    thrown.dismiss();
+    return f;
+  }
+
+  bool isAvailable() override {
+    return getInFlight() < state_->limit->getLimit() &&
+      this->service_->isAvailable();
+  }
+
+  size_t getInFlight() const {
+    return state_->inFlight.load(std::memory_order_relaxed);
+  }
+
+  size_t getLimit() const {
+    return state_->limit->getLimit();
+  }
+
+  uint64_t getNumAccepted() const {
+    return state_->accepted.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumRejected() const {
+    return state_->rejected.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Kept by requests past the filter's lifetime
+  struct State {
+    explicit State(std::shared_ptr<ConcurrencyLimit> l)
+        : limit(std::move(l)) {}
+
+    std::shared_ptr<ConcurrencyLimit> limit;
+    std::atomic<size_t> inFlight{0};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> rejected{0};
+  };
+
+  std::shared_ptr<State> state_;
+};
+
+}} // namespace
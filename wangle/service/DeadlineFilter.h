@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/concurrent/RequestDeadline.h>
+#include <wangle/service/Service.h>
+
+#include <atomic>
+#include <chrono>
+
+namespace folly { namespace wangle {
+
+/**
+ * A service filter failing requests whose RequestDeadline has passed with
+ * DeadlineExceeded, rather than doing work whose result nobody waits for
+ * any more.  Put it where the work starts, such as ahead of a hop to a
+ * CPU pool, or of a client.  Given a timeout, it also brings each
+ * request's deadline in to at most that from when it arrives, for the
+ * service after it.
+ */
+template <typename Req, typename Resp = Req>
+class DeadlineFilter : public ServiceFilter<Req, Resp> {
+ public:
+  explicit DeadlineFilter(
+      std::shared_ptr<Service<Req, Resp>> service,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+      : ServiceFilter<Req, Resp>(std::move(service)),
+        timeout_(timeout) {}
+
+  Future<Resp> operator()(Req req) override {
+    auto now = RequestDeadline::Clock::now();
+    if (RequestDeadline::expired(now)) {
+      expired_.fetch_add(1, std::memory_order_relaxed);
+      return makeFuture<Resp>(make_exception_wrapper<DeadlineExceeded>());
+    }
+    if (timeout_.count() <= 0) {
+      return (*this->service_)(std::move(req));
+    }
+    RequestDeadline::Guard g(RequestDeadline::within(timeout_, now));
+    return (*this->service_)(std::move(req));
+  }
+
+  // Requests failed as their deadline had passed
+  uint64_t getNumExpired() const {
+    return expired_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  const std::chrono::milliseconds timeout_;
+  std::atomic<uint64_t> expired_{0};
+};
+
+}} // namespace
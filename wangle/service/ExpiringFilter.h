@@ -1,10 +1,24 @@
 #pragma once
 
+#include <folly/io/async/EventBaseManager.h>
+#include <folly/io/async/HHWheelTimer.h>
+
+#include <atomic>
+
 namespace folly { namespace wangle {
 /**
  * A service filter that expires the self service after a certain
  * amount of idle time, or after a maximum amount of time total.
  * Idle timeout is cancelled when any requests are outstanding.
+ *
+ * By default the timeouts are on an HHWheelTimer of the EventBase given,
+ * or of the constructing thread's, with one callback for each that is
+ * scheduled once: requests only count themselves and note when they're
+ * done, and the idle callback, when it fires early, reschedules itself for
+ * the rest of the time.  Requests may then come from any thread; the
+ * filter is constructed and destroyed on the EventBase's thread.  Given a
+ * Timekeeper instead, the timeouts are futures::sleep()s, restarted as
+ * requests come and go.
  */
 
 template <typename Req, typename Resp = Req>
@@ -15,7 +29,32 @@ class ExpiringFilter : public ServiceFilter<Req, Resp> {
                  = std::chrono::milliseconds(0),
                   std::chrono::milliseconds maxTime
                  = std::chrono::milliseconds(0),
-                 Timekeeper* timekeeper = nullptr)
+                 EventBase* evb = nullptr)
+  : ServiceFilter<Req, Resp>(service)
+  , idleTimeoutTime_(idleTimeoutTime)
+  , maxTime_(maxTime)
+  , timekeeper_(nullptr) {
+    if (idleTimeoutTime_ <= std::chrono::milliseconds(0) &&
+        maxTime_ <= std::chrono::milliseconds(0)) {
+      return;
+    }
+    if (!evb) {
+      evb = EventBaseManager::get()->getEventBase();
+    }
+    timer_.reset(new HHWheelTimer(evb));
+    if (maxTime_ > std::chrono::milliseconds(0)) {
+      timer_->scheduleTimeout(&maxCallback_, maxTime_);
+    }
+    if (idleTimeoutTime_ > std::chrono::milliseconds(0)) {
+      touch();
+      timer_->scheduleTimeout(&idleCallback_, idleTimeoutTime_);
+    }
+  }
+
+  ExpiringFilter(std::shared_ptr<Service<Req, Resp>> service,
+                 std::chrono::milliseconds idleTimeoutTime,
+                 std::chrono::milliseconds maxTime,
+                 Timekeeper* timekeeper)
   : ServiceFilter<Req, Resp>(service)
   , idleTimeoutTime_(idleTimeoutTime)
   , maxTime_(maxTime)
@@ -43,6 +82,10 @@ class ExpiringFilter : public ServiceFilter<Req, Resp> {
     if (requests_ != 0) {
       return;
     }
+    if (timer_) {
+      touch();
+      return;
+    }
     if (idleTimeoutTime_ > std::chrono::milliseconds(0)) {
       idleTimeout_ = futures::sleep(idleTimeoutTime_, timekeeper_);
       idleTimeout_.then([this](){
@@ -52,10 +95,15 @@ class ExpiringFilter : public ServiceFilter<Req, Resp> {
   };
 
   virtual Future<Resp> operator()(Req req) override {
-    if (!idleTimeout_.isReady()) {
+    if (!timer_ && !idleTimeout_.isReady()) {
       idleTimeout_.cancel();
     }
-    requests_++;
+    if (requests_.fetch_add(1) & kIdleExpired) {
+      // Lost the race with the idle timeout, which is closing the service
+      requests_--;
+      return makeFuture<Resp>(
+        make_exception_wrapper<std::runtime_error>("Service expired"));
+    }
     return (*this->service_)(std::move(req)).ensure([this](){
         requests_--;
         startIdleTimer();
@@ -63,12 +111,70 @@ class ExpiringFilter : public ServiceFilter<Req, Resp> {
   }
 
  private:
+  class Callback : public HHWheelTimer::Callback {
+   public:
+    Callback(ExpiringFilter* filter, bool idle)
+        : filter_(filter), idle_(idle) {}
+
+    void timeoutExpired() noexcept override {
+      if (idle_) {
+        filter_->idleTimeoutExpired();
+      } else {
+        filter_->close();
+      }
+    }
+
+   private:
+    ExpiringFilter* filter_;
+    bool idle_;
+  };
+
+  // Set in requests_ once idle, after which no request can start
+  static constexpr uint32_t kIdleExpired = 1u << 31;
+
+  static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void touch() {
+    lastActiveNs_.store(nowNs(), std::memory_order_relaxed);
+  }
+
+  void idleTimeoutExpired() {
+    if (requests_.load() != 0) {
+      // A request done later restarts the idle time
+      timer_->scheduleTimeout(&idleCallback_, idleTimeoutTime_);
+      return;
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+      idleTimeoutTime_ - std::chrono::nanoseconds(
+        nowNs() - lastActiveNs_.load(std::memory_order_relaxed)));
+    if (remaining > std::chrono::milliseconds(0)) {
+      timer_->scheduleTimeout(&idleCallback_, remaining);
+      return;
+    }
+    uint32_t idle = 0;
+    if (!requests_.compare_exchange_strong(idle, kIdleExpired)) {
+      // A request just started
+      timer_->scheduleTimeout(&idleCallback_, idleTimeoutTime_);
+      return;
+    }
+    this->close();
+  }
+
   Future<Unit> idleTimeout_;
   Future<Unit> maxTimeout_;
   std::chrono::milliseconds idleTimeoutTime_{0};
   std::chrono::milliseconds maxTime_{0};
   Timekeeper* timekeeper_;
-  uint32_t requests_{0};
+  std::atomic<uint32_t> requests_{0};
+  // Only with an EventBase; the callbacks go before the timer
+  HHWheelTimer::UniquePtr timer_;
+  Callback idleCallback_{this, true};
+  Callback maxCallback_{this, false};
+  // When the last request finished, whichever thread it was on
+  std::atomic<int64_t> lastActiveNs_{0};
 };
 
 }} // namespace
@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/MoveWrapper.h>
+#include <folly/experimental/fibers/FiberManagerMap.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/channel/Handler.h>
+#include <wangle/service/ServerDispatcher.h>
+#include <wangle/service/Service.h>
+
+namespace folly { namespace wangle {
+
+/**
+ * Dispatch each request on its own fiber, run by the FiberManager of the
+ * connection's EventBase (the same one FiberIOExecutor uses).
+ *
+ * The service may block its fiber, e.g. on futures via fibers::await, while
+ * the EventBase keeps serving other requests and connections, so
+ * blocking-style service code doesn't need to hop to a CPU pool and back.
+ * Responses are written as they complete, which may be out of order.
+ *
+ * opts, e.g. the fiber stack size and the maximum number of pooled
+ * fibers, only take effect if this is the first user of the EventBase's
+ * FiberManager.
+ */
+template <typename Req, typename Resp = Req>
+class FiberServerDispatcher : public HandlerAdapter<Req, Resp>
+                            , public ServerRequestDeadlines<Req> {
+ public:
+
+  typedef typename HandlerAdapter<Req, Resp>::Context Context;
+
+  explicit FiberServerDispatcher(
+      Service<Req, Resp>* service,
+      const fibers::FiberManager::Options& opts =
+          fibers::FiberManager::Options())
+      : service_(service),
+        opts_(opts) {}
+
+  void read(Context* ctx, Req in) override {
+    auto& fm = fibers::getFiberManager(
+        *EventBaseManager::get()->getEventBase(), opts_);
+    // Keep the pipeline, and so ctx and this handler, alive until the
+    // request is done
+    DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+    auto deadline = this->deadlineOf(in);
+    auto moveIn = folly::makeMoveWrapper(std::move(in));
+    fm.addTask([this, ctx, dg, moveIn, deadline]() mutable {
+      auto t = awaitResponse(dispatch(std::move(*moveIn), deadline));
+      if (t.hasException()) {
+        LOG(ERROR) << "FiberServerDispatcher: service threw "
+                   << t.exception().what();
+        ctx->fireClose();
+        return;
+      }
+      ctx->fireWrite(std::move(t.value()));
+    });
+  }
+
+ private:
+  // The deadline is the thread's, which runs other fibers while this one
+  // waits, so it's set only while the service is called
+  Future<Resp> dispatch(Req in, RequestDeadline::TimePoint deadline) {
+    RequestDeadline::Guard g(deadline);
+    return (*service_)(std::move(in));
+  }
+
+  // Suspends the current fiber, not the thread, until f completes
+  static Try<Resp> awaitResponse(Future<Resp> f) {
+    if (f.isReady()) {
+      return std::move(f.getTry());
+    }
+    return fibers::await([&](fibers::Promise<Try<Resp>> p) {
+      auto moveP = folly::makeMoveWrapper(std::move(p));
+      f.then([moveP](Try<Resp>&& t) mutable {
+        moveP->setValue(std::move(t));
+      });
+    });
+  }
+
+  Service<Req, Resp>* service_;
+  fibers::FiberManager::Options opts_;
+};
+
+}} // namespace
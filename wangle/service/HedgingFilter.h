@@ -0,0 +1,223 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/concurrent/TaskLatencyHistogram.h>
+#include <wangle/service/Service.h>
+
+#include <folly/futures/Future.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace folly { namespace wangle {
+
+/**
+ * A service filter sending a backup request to a second service when the
+ * first hasn't answered within a budget, either fixed or a percentile of
+ * the latencies seen so far.  Whichever response comes first is returned,
+ * and the other request is cancelled.
+ *
+ * Hedges are capped at a fraction of requests: each request earns that
+ * fraction of a hedge, up to a small burst, and each hedge spends one.
+ * When a backend is slow for everyone, the filter then adds only that
+ * fraction to its load.
+ *
+ * Requests are copied for the backup, so Req has to be copyable.
+ */
+template <typename Req, typename Resp = Req>
+class HedgingFilter : public ServiceFilter<Req, Resp> {
+ public:
+  struct Options {
+    // The hedge budget, or, with a percentile, the budget until
+    // minSamples latencies have been seen
+    std::chrono::milliseconds budget{10};
+    // Percentile (0 to 100) of latency to use as the budget; 0 for fixed
+    double percentile{0};
+    uint64_t minSamples{100};
+    // Hedges per request at most, over time
+    double maxHedgeRatio{0.05};
+    // Hedges allowed at once beyond the ratio
+    uint32_t maxHedgeBurst{10};
+    Timekeeper* timekeeper{nullptr};
+  };
+
+  HedgingFilter(std::shared_ptr<Service<Req, Resp>> primary,
+                std::shared_ptr<Service<Req, Resp>> backup,
+                Options options)
+      : ServiceFilter<Req, Resp>(std::move(primary)),
+        backup_(std::move(backup)),
+        shared_(std::make_shared<Shared>(options)) {}
+
+  Future<Resp> operator()(Req req) override {
+    auto shared = shared_;
+    shared->onRequest();
+    auto attempt = std::make_shared<Attempt>();
+    auto result = attempt->promise.getFuture();
+    auto start = std::chrono::steady_clock::now();
+
+    auto primary = (*this->service_)(req).then(
+      [attempt, shared, start] (Try<Resp>&& t) {
+        attempt->finish(std::move(t), true, *shared, start);
+      });
+    std::lock_guard<std::recursive_mutex> g(attempt->lock);
+    if (attempt->done) {
+      return result;
+    }
+    attempt->primary = std::move(primary);
+
+    auto backup = backup_;
+    attempt->timer = futures::sleep(shared->getBudget(),
+                                    shared->options.timekeeper).then(
+      [attempt, shared, backup, req, start] () mutable {
+        std::lock_guard<std::recursive_mutex> lg(attempt->lock);
+        if (attempt->done || !shared->takeHedge()) {
+          return;
+        }
+        attempt->backup = (*backup)(std::move(req)).then(
+          [attempt, shared, start] (Try<Resp>&& t) {
+            attempt->finish(std::move(t), false, *shared, start);
+          });
+      });
+    return result;
+  }
+
+  uint64_t getNumRequests() const {
+    return shared_->requests.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumHedges() const {
+    return shared_->hedges.load(std::memory_order_relaxed);
+  }
+
+  // Hedged requests answered first by the backup
+  uint64_t getNumBackupWins() const {
+    return shared_->backupWins.load(std::memory_order_relaxed);
+  }
+
+  std::chrono::milliseconds getBudget() const {
+    return shared_->getBudget();
+  }
+
+ private:
+  // Kept by requests past the filter's lifetime
+  struct Shared {
+    // Hedge credits are in thousandths of a hedge
+    static const int64_t kCreditsPerHedge = 1000;
+    // Budget is recomputed from the histogram every this many samples
+    static const uint64_t kBudgetInterval = 64;
+
+    explicit Shared(const Options& o)
+        : options(o),
+          budgetMs(o.budget.count()),
+          credits(o.maxHedgeBurst * kCreditsPerHedge) {}
+
+    void onRequest() {
+      requests.fetch_add(1, std::memory_order_relaxed);
+      int64_t earned = options.maxHedgeRatio * kCreditsPerHedge;
+      int64_t max = options.maxHedgeBurst * kCreditsPerHedge;
+      auto c = credits.load(std::memory_order_relaxed);
+      while (c < max && !credits.compare_exchange_weak(
+               c, std::min(c + earned, max), std::memory_order_relaxed)) {
+      }
+    }
+
+    bool takeHedge() {
+      auto c = credits.load(std::memory_order_relaxed);
+      do {
+        if (c < kCreditsPerHedge) {
+          return false;
+        }
+      } while (!credits.compare_exchange_weak(
+                 c, c - kCreditsPerHedge, std::memory_order_relaxed));
+      hedges.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    void addLatency(std::chrono::nanoseconds latency) {
+      latencies.addValueShared(latency);
+      if (options.percentile <= 0) {
+        return;
+      }
+      auto n = samples.fetch_add(1, std::memory_order_relaxed) + 1;
+      if (n >= options.minSamples && n % kBudgetInterval == 0) {
+        auto budget = std::chrono::duration_cast<std::chrono::milliseconds>(
+          latencies.getPercentile(options.percentile));
+        // Never zero, which would hedge everything the cap allows
+        budgetMs.store(std::max<int64_t>(budget.count(), 1),
+                       std::memory_order_relaxed);
+      }
+    }
+
+    std::chrono::milliseconds getBudget() const {
+      return std::chrono::milliseconds(
+        budgetMs.load(std::memory_order_relaxed));
+    }
+
+    Options options;
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> hedges{0};
+    std::atomic<uint64_t> backupWins{0};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<int64_t> budgetMs;
+    std::atomic<int64_t> credits;
+    TaskLatencyHistogram latencies;
+  };
+
+  // One request, with its backup if sent
+  struct Attempt {
+    void finish(Try<Resp>&& t, bool fromPrimary, Shared& shared,
+                std::chrono::steady_clock::time_point start) {
+      {
+        std::lock_guard<std::recursive_mutex> g(lock);
+        if (done) {
+          return;
+        }
+        done = true;
+        // Cancelling may complete the loser here, which finds done set
+        if (fromPrimary) {
+          timer.cancel();
+          backup.cancel();
+        } else {
+          primary.cancel();
+        }
+      }
+      if (t.hasValue()) {
+        shared.addLatency(std::chrono::steady_clock::now() - start);
+        if (!fromPrimary) {
+          shared.backupWins.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+      promise.setTry(std::move(t));
+    }
+
+    // Recursive, as callbacks may run inline while it's held: on a ready
+    // backup response, or on the loser as it's cancelled
+    std::recursive_mutex lock;
+    bool done{false};
+    Promise<Resp> promise;
+    Future<Unit> primary;
+    Future<Unit> backup;
+    Future<Unit> timer;
+  };
+
+  std::shared_ptr<Service<Req, Resp>> backup_;
+  std::shared_ptr<Shared> shared_;
+};
+
+template <typename Req, typename Resp>
+const int64_t HedgingFilter<Req, Resp>::Shared::kCreditsPerHedge;
+template <typename Req, typename Resp>
+const uint64_t HedgingFilter<Req, Resp>::Shared::kBudgetInterval;
+
+}} // namespace
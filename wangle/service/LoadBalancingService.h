@@ -0,0 +1,238 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/service/Service.h>
+
+#include <folly/Hash.h>
+#include <folly/Random.h>
+#include <folly/futures/Future.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <vector>
+
+namespace folly { namespace wangle {
+
+/**
+ * A service spreading requests over a fixed set of backend services.
+ * Backends which aren't isAvailable() are skipped, and requests fail only
+ * if none is available.  Picking a backend takes no locks and doesn't
+ * allocate.
+ *
+ * Policies:
+ *  - kPowerOfTwoChoices: of two backends picked at random, the one with
+ *    fewer outstanding requests
+ *  - kLeastLatency: as above, but weighing outstanding requests by each
+ *    backend's moving average latency, so slow backends get less
+ *  - kConsistentHash: by a key of the request, on a ring with several
+ *    points per backend, so a key keeps its backend while it's available,
+ *    and only the keys of an unavailable backend move
+ */
+template <typename Req, typename Resp = Req>
+class LoadBalancingService : public Service<Req, Resp> {
+ public:
+  typedef std::shared_ptr<Service<Req, Resp>> ServicePtr;
+  typedef std::function<uint64_t(const Req&)> KeyFunction;
+
+  enum class Policy {
+    kPowerOfTwoChoices,
+    kLeastLatency,
+    kConsistentHash,
+  };
+
+  // Points on the hash ring per backend
+  static const size_t kRingPointsPerBackend = 64;
+
+  LoadBalancingService(std::vector<ServicePtr> services,
+                       Policy policy = Policy::kPowerOfTwoChoices,
+                       KeyFunction keyFunction = nullptr)
+      : policy_(policy),
+        keyFunction_(std::move(keyFunction)) {
+    CHECK(!services.empty());
+    CHECK(policy_ != Policy::kConsistentHash || keyFunction_);
+    for (auto& service : services) {
+      backends_.push_back(std::make_shared<Backend>(std::move(service)));
+    }
+    if (policy_ == Policy::kConsistentHash) {
+      for (size_t i = 0; i < backends_.size(); i++) {
+        for (size_t p = 0; p < kRingPointsPerBackend; p++) {
+          ring_.emplace_back(hash::twang_mix64((uint64_t(i) << 32) | p), i);
+        }
+      }
+      std::sort(ring_.begin(), ring_.end());
+    }
+  }
+
+  Future<Resp> operator()(Req req) override {
+    auto backend = pick(req);
+    if (!backend) {
+      return makeFuture<Resp>(
+        make_exception_wrapper<std::runtime_error>("No backend available"));
+    }
+    auto b = backends_[*backend];
+    b->outstanding.fetch_add(1, std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    return (*b->service)(std::move(req)).ensure([b, start] {
+      b->outstanding.fetch_sub(1, std::memory_order_relaxed);
+      b->addLatency(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start));
+    });
+  }
+
+  Future<Unit> close() override {
+    std::vector<Future<Unit>> closes;
+    for (auto& backend : backends_) {
+      closes.push_back(backend->service->close());
+    }
+    return collectAll(closes).then([] {});
+  }
+
+  bool isAvailable() override {
+    for (auto& backend : backends_) {
+      if (backend->service->isAvailable()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t getNumBackends() const {
+    return backends_.size();
+  }
+
+  uint32_t getOutstanding(size_t backend) const {
+    return backends_[backend]->outstanding.load(std::memory_order_relaxed);
+  }
+
+  // 0 until the backend's first response
+  std::chrono::microseconds getLatency(size_t backend) const {
+    return std::chrono::microseconds(std::max<int64_t>(
+      0, backends_[backend]->latencyUs.load(std::memory_order_relaxed)));
+  }
+
+ private:
+  struct Backend {
+    explicit Backend(ServicePtr s) : service(std::move(s)) {}
+
+    // Weight of each new sample in the moving average, as 1/kEwmaDivisor
+    static const int64_t kEwmaDivisor = 8;
+    // latencyUs before the first sample, which may well be 0
+    static const int64_t kUnsampled = -1;
+
+    // Racing updates may drop a sample, which doesn't matter for an estimate
+    void addLatency(std::chrono::microseconds sample) {
+      int64_t avg = latencyUs.load(std::memory_order_relaxed);
+      avg = avg == kUnsampled ? sample.count()
+                              : avg + (sample.count() - avg) / kEwmaDivisor;
+      latencyUs.store(avg, std::memory_order_relaxed);
+    }
+
+    ServicePtr service;
+    std::atomic<uint32_t> outstanding{0};
+    std::atomic<int64_t> latencyUs{kUnsampled};
+  };
+
+  // The backend for req, or none if none is available
+  Optional<size_t> pick(const Req& req) {
+    if (policy_ == Policy::kConsistentHash) {
+      return pickByHash(keyFunction_(req));
+    }
+    size_t n = backends_.size();
+    size_t first = folly::Random::rand32(n);
+    if (n == 1) {
+      return available(first) ? Optional<size_t>(first) : none;
+    }
+    // Distinct from first
+    size_t second = (first + 1 + folly::Random::rand32(n - 1)) % n;
+    bool firstOk = available(first);
+    bool secondOk = available(second);
+    if (firstOk && secondOk) {
+      return cost(second) < cost(first) ? second : first;
+    } else if (firstOk) {
+      return first;
+    } else if (secondOk) {
+      return second;
+    }
+    for (size_t i = 1; i < n; i++) {
+      size_t next = (first + i) % n;
+      if (available(next)) {
+        return next;
+      }
+    }
+    return none;
+  }
+
+  Optional<size_t> pickByHash(uint64_t key) {
+    auto h = hash::twang_mix64(key);
+    auto it = std::lower_bound(
+      ring_.begin(), ring_.end(), std::make_pair(h, size_t(0)));
+    // Clockwise to the first point of an available backend
+    for (size_t i = 0; i < ring_.size(); i++, it++) {
+      if (it == ring_.end()) {
+        it = ring_.begin();
+      }
+      if (available(it->second)) {
+        return it->second;
+      }
+    }
+    return none;
+  }
+
+  bool available(size_t backend) {
+    return backends_[backend]->service->isAvailable();
+  }
+
+  // Expected wait for a new request; lower is better
+  double cost(size_t backend) const {
+    const auto& b = *backends_[backend];
+    double outstanding = b.outstanding.load(std::memory_order_relaxed);
+    if (policy_ == Policy::kPowerOfTwoChoices) {
+      return outstanding;
+    }
+    auto latency = b.latencyUs.load(std::memory_order_relaxed);
+    if (latency == Backend::kUnsampled) {
+      // As fast as the fastest, so it gets some, but not all of them
+      latency = getFastestLatency();
+    }
+    // Under a microsecond still counts the outstanding requests
+    return (outstanding + 1) * std::max<int64_t>(latency, 1);
+  }
+
+  // Of the sampled backends; 1 if there are none
+  int64_t getFastestLatency() const {
+    int64_t fastest = std::numeric_limits<int64_t>::max();
+    for (const auto& b : backends_) {
+      auto latency = b->latencyUs.load(std::memory_order_relaxed);
+      if (latency != Backend::kUnsampled) {
+        fastest = std::min(fastest, latency);
+      }
+    }
+    return fastest == std::numeric_limits<int64_t>::max() ? 1 : fastest;
+  }
+
+  Policy policy_;
+  KeyFunction keyFunction_;
+  std::vector<std::shared_ptr<Backend>> backends_;
+  // (hash, backend) points, sorted
+  std::vector<std::pair<uint64_t, size_t>> ring_;
+};
+
+template <typename Req, typename Resp>
+const size_t LoadBalancingService<Req, Resp>::kRingPointsPerBackend;
+
+template <typename Req, typename Resp>
+const int64_t LoadBalancingService<Req, Resp>::Backend::kUnsampled;
+
+}} // namespace
@@ -0,0 +1,314 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/concurrent/IOObjectCache.h>
+#include <wangle/service/CloseOnReleaseFilter.h>
+#include <wangle/service/ExpiringFilter.h>
+#include <wangle/service/Service.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+
+namespace folly { namespace wangle {
+
+/**
+ * A pool of connected services, all doing their IO on one EventBase, so
+ * that requests borrow a warm connection instead of connecting (and doing
+ * a TLS handshake) on the request path.
+ *
+ * acquire() hands out a lease on an idle service, connecting a new one if
+ * there is none and the pool isn't full, or else waiting for one to be
+ * released.  Closing the lease, or dropping it, puts the service back.
+ * Services are dropped as they fail the health check, and each is wrapped
+ * in an ExpiringFilter, which closes it after the idle timeout or maximum
+ * lifetime.  The pool connects in the background to keep minIdle services
+ * ready.  May be used from any thread.
+ */
+template <typename Req, typename Resp = Req>
+class ServicePool
+    : public std::enable_shared_from_this<ServicePool<Req, Resp>> {
+ public:
+  typedef std::shared_ptr<Service<Req, Resp>> ServicePtr;
+  // Connects a new service whose IO runs on the EventBase given; runs there
+  typedef std::function<Future<ServicePtr>(EventBase*)> Connector;
+
+  struct Options {
+    // Ready services to keep, connecting ahead of requests
+    size_t minIdle{0};
+    // Services to have at most, idle, leased and connecting
+    size_t maxSize{std::numeric_limits<size_t>::max()};
+    // Zero for none; see ExpiringFilter
+    std::chrono::milliseconds idleTimeout{0};
+    std::chrono::milliseconds maxLifetime{0};
+    // Whether a service can still be used; isAvailable() if not set
+    std::function<bool(Service<Req, Resp>&)> healthCheck;
+  };
+
+  ServicePool(EventBase* evb, Connector connector, Options options)
+      : evb_(evb),
+        connector_(std::move(connector)),
+        options_(std::move(options)) {
+    if (!options_.healthCheck) {
+      options_.healthCheck = [] (Service<Req, Resp>& service) {
+        return service.isAvailable();
+      };
+    }
+  }
+
+  ~ServicePool() {
+    for (auto& waiter : waiters_) {
+      waiter.setException(std::runtime_error("Service pool gone"));
+    }
+    for (auto& service : idle_) {
+      discard(std::move(service));
+    }
+  }
+
+  Future<ServicePtr> acquire() {
+    std::unique_lock<std::mutex> g(lock_);
+    while (!idle_.empty()) {
+      auto service = std::move(idle_.front());
+      idle_.pop_front();
+      if (options_.healthCheck(*service)) {
+        numLeased_++;
+        g.unlock();
+        replenish();
+        return makeFuture(lease(std::move(service)));
+      }
+      discard(std::move(service));
+    }
+    if (size() >= options_.maxSize) {
+      waiters_.emplace_back();
+      return waiters_.back().getFuture();
+    }
+    numConnecting_++;
+    g.unlock();
+
+    auto self = this->shared_from_this();
+    return connect().then([self] (Try<ServicePtr>&& t) {
+      {
+        std::lock_guard<std::mutex> lg(self->lock_);
+        self->numConnecting_--;
+        if (t.hasValue()) {
+          self->numLeased_++;
+        }
+      }
+      return self->lease(std::move(t.value()));
+    });
+  }
+
+  size_t getNumIdle() {
+    std::lock_guard<std::mutex> g(lock_);
+    return idle_.size();
+  }
+
+  size_t getNumLeased() {
+    std::lock_guard<std::mutex> g(lock_);
+    return numLeased_;
+  }
+
+ private:
+  /**
+   * A service borrowed from the pool; closing it returns the service to
+   * the pool rather than closing it
+   */
+  class Lease : public ServiceFilter<Req, Resp> {
+   public:
+    Lease(ServicePtr service, std::shared_ptr<ServicePool> pool)
+        : ServiceFilter<Req, Resp>(std::move(service)),
+          pool_(std::move(pool)) {}
+
+    // The last reference to the lease, so nothing else uses service_
+    ~Lease() {
+      close();
+      pool_->destroy(std::move(this->service_));
+    }
+
+    Future<Resp> operator()(Req req) override {
+      if (released_) {
+        return makeFuture<Resp>(
+          make_exception_wrapper<std::runtime_error>("Service released"));
+      }
+      return (*this->service_)(std::move(req));
+    }
+
+    Future<Unit> close() override {
+      if (!released_.exchange(true)) {
+        // Copied: a request on another thread may still be using service_
+        pool_->release(this->service_);
+      }
+      return makeFuture();
+    }
+
+    bool isAvailable() override {
+      return !released_ && this->service_->isAvailable();
+    }
+
+   private:
+    std::shared_ptr<ServicePool> pool_;
+    std::atomic<bool> released_{false};
+  };
+
+  // Idle, leased and connecting
+  size_t size() const {
+    return idle_.size() + numLeased_ + numConnecting_;
+  }
+
+  ServicePtr lease(ServicePtr service) {
+    return std::make_shared<Lease>(std::move(service),
+                                   this->shared_from_this());
+  }
+
+  // Connects on evb_, wrapping the result for pooling
+  Future<ServicePtr> connect() {
+    auto connector = connector_;
+    auto evb = evb_;
+    auto idleTimeout = options_.idleTimeout;
+    auto maxLifetime = options_.maxLifetime;
+    return via(evb).then([connector, evb] {
+      return connector(evb);
+    }).then([evb, idleTimeout, maxLifetime] (ServicePtr service)
+            -> ServicePtr {
+      // The expiring filter's close() reaches the CloseOnReleaseFilter,
+      // after which the service fails the default health check
+      return std::make_shared<ExpiringFilter<Req, Resp>>(
+        std::make_shared<CloseOnReleaseFilter<Req, Resp>>(std::move(service)),
+        idleTimeout, maxLifetime, evb);
+    });
+  }
+
+  // Closes a service, and lets it go on evb_, where its timers are
+  void discard(ServicePtr service) {
+    service->close();
+    destroy(std::move(service));
+  }
+
+  // Drops a reference on evb_, in case it is the last one
+  void destroy(ServicePtr service) {
+    if (evb_->isInEventBaseThread()) {
+      return;
+    }
+    evb_->runInEventBaseThread([service] () mutable {
+      service.reset();
+    });
+  }
+
+  void release(ServicePtr service) {
+    std::unique_lock<std::mutex> g(lock_);
+    numLeased_--;
+    if (!options_.healthCheck(*service)) {
+      g.unlock();
+      discard(std::move(service));
+      replenish();
+      // Room for one more; let a waiter connect
+      wakeWaiter();
+      return;
+    }
+    if (!waiters_.empty()) {
+      auto waiter = std::move(waiters_.front());
+      waiters_.pop_front();
+      numLeased_++;
+      g.unlock();
+      waiter.setValue(lease(std::move(service)));
+      return;
+    }
+    idle_.push_back(std::move(service));
+  }
+
+  // Connects for the first waiter, if there's room now
+  void wakeWaiter() {
+    std::unique_lock<std::mutex> g(lock_);
+    if (waiters_.empty() || size() >= options_.maxSize) {
+      return;
+    }
+    auto waiter = std::move(waiters_.front());
+    waiters_.pop_front();
+    g.unlock();
+    acquire().then([waiter] (Try<ServicePtr>&& t) mutable {
+      waiter.setTry(std::move(t));
+    });
+  }
+
+  // Connects in the background up to minIdle ready services
+  void replenish() {
+    std::unique_lock<std::mutex> g(lock_);
+    while (idle_.size() + numConnecting_ < options_.minIdle &&
+           size() < options_.maxSize) {
+      numConnecting_++;
+      g.unlock();
+      auto self = this->shared_from_this();
+      connect().then([self] (Try<ServicePtr>&& t) {
+        std::unique_lock<std::mutex> lg(self->lock_);
+        self->numConnecting_--;
+        if (t.hasException()) {
+          LOG(ERROR) << "Unable to connect service for pool: "
+                     << t.exception().what();
+          return;
+        }
+        // As if it had been leased, so it goes to a waiter if there is one
+        self->numLeased_++;
+        lg.unlock();
+        self->release(std::move(t.value()));
+      });
+      g.lock();
+    }
+  }
+
+  EventBase* evb_;
+  Connector connector_;
+  Options options_;
+  std::mutex lock_;
+  std::deque<ServicePtr> idle_;
+  size_t numLeased_{0};
+  size_t numConnecting_{0};
+  std::deque<Promise<ServicePtr>> waiters_;
+};
+
+/**
+ * A ServiceFactory that leases services from per-EventBase pools of warm,
+ * connected services, rather than connecting for each one.  The
+ * EventBases are those of the global IOExecutor, one picked per call much
+ * as IOObjectCache does (which keeps the pools, one per calling thread and
+ * EventBase).  Closing the service returned puts it back in its pool.
+ *
+ * The ClientBootstrap passed to operator() is ignored; connector makes
+ * connections.
+ */
+template <typename Pipeline, typename Req, typename Resp = Req>
+class PooledServiceFactory : public ServiceFactory<Pipeline, Req, Resp> {
+ public:
+  typedef ServicePool<Req, Resp> Pool;
+
+  PooledServiceFactory(typename Pool::Connector connector,
+                       typename Pool::Options options)
+      : pools_([connector, options] (EventBase* evb) {
+          return std::make_shared<Pool>(evb, connector, options);
+        }) {}
+
+  Future<std::shared_ptr<Service<Req, Resp>>> operator()(
+    std::shared_ptr<ClientBootstrap<Pipeline>> client) override {
+    return pools_.get()->acquire();
+  }
+
+  // The calling thread's pool for one of the IOExecutor's EventBases
+  std::shared_ptr<Pool> getPool() {
+    return pools_.get();
+  }
+
+ private:
+  IOObjectCache<Pool> pools_;
+};
+
+}} // namespace
@@ -0,0 +1,163 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/concurrent/RequestDeadline.h>
+#include <wangle/service/CircuitBreakerFilter.h>
+#include <wangle/service/ConcurrencyLimitFilter.h>
+#include <wangle/service/Service.h>
+
+#include <folly/futures/Future.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace folly { namespace wangle {
+
+/**
+ * A service filter retrying failed requests, up to maxRetries times each,
+ * within a retry budget: each request earns maxRetryRatio of a retry, up
+ * to maxRetryBurst, and each retry spends one.  So retries are at most
+ * that fraction of requests over time, and when a backend fails for
+ * everyone they add only that fraction to its load, rather than
+ * multiplying it by the number of attempts.
+ *
+ * Retries are of exceptions, save those of a CircuitBreakerFilter or a
+ * ConcurrencyLimitFilter failing fast, which would only spend the budget,
+ * and DeadlineExceeded, unless isRetryable says otherwise.  With a
+ * backoff, the nth retry waits backoff * 2^(n-1) first.  No retry is made
+ * that would start past the request's RequestDeadline, and each attempt
+ * is made under it.  Requests are copied for each attempt, so Req has to
+ * be copyable.
+ */
+template <typename Req, typename Resp = Req>
+class RetryFilter : public ServiceFilter<Req, Resp> {
+ public:
+  struct Options {
+    uint32_t maxRetries{2};
+    // Retries per request at most, over time
+    double maxRetryRatio{0.1};
+    // Retries allowed at once beyond the ratio
+    uint32_t maxRetryBurst{10};
+    std::chrono::milliseconds backoff{0};
+    Timekeeper* timekeeper{nullptr};
+    std::function<bool(const exception_wrapper&)> isRetryable;
+  };
+
+  RetryFilter(std::shared_ptr<Service<Req, Resp>> service, Options options)
+      : ServiceFilter<Req, Resp>(std::move(service)),
+        shared_(std::make_shared<Shared>(std::move(options))) {}
+
+  Future<Resp> operator()(Req req) override {
+    shared_->onRequest();
+    return attempt(shared_, this->service_, std::move(req), 0,
+                   RequestDeadline::get());
+  }
+
+  uint64_t getNumRequests() const {
+    return shared_->requests.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumRetries() const {
+    return shared_->retries.load(std::memory_order_relaxed);
+  }
+
+  // Retries not made for want of budget
+  uint64_t getNumBudgetExhausted() const {
+    return shared_->exhausted.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Kept by requests past the filter's lifetime
+  struct Shared {
+    // Retry credits are in thousandths of a retry
+    static const int64_t kCreditsPerRetry = 1000;
+
+    explicit Shared(Options o)
+        : options(std::move(o)),
+          credits(options.maxRetryBurst * kCreditsPerRetry) {}
+
+    void onRequest() {
+      requests.fetch_add(1, std::memory_order_relaxed);
+      int64_t earned = options.maxRetryRatio * kCreditsPerRetry;
+      int64_t max = options.maxRetryBurst * kCreditsPerRetry;
+      auto c = credits.load(std::memory_order_relaxed);
+      while (c < max && !credits.compare_exchange_weak(
+               c, std::min(c + earned, max), std::memory_order_relaxed)) {
+      }
+    }
+
+    bool takeRetry() {
+      auto c = credits.load(std::memory_order_relaxed);
+      do {
+        if (c < kCreditsPerRetry) {
+          exhausted.fetch_add(1, std::memory_order_relaxed);
+          return false;
+        }
+      } while (!credits.compare_exchange_weak(
+                 c, c - kCreditsPerRetry, std::memory_order_relaxed));
+      retries.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    bool isRetryable(const exception_wrapper& e) const {
+      if (options.isRetryable) {
+        return options.isRetryable(e);
+      }
+      return !e.is_compatible_with<CircuitOpenException>() &&
+        !e.is_compatible_with<ConcurrencyLimitExceeded>() &&
+        !e.is_compatible_with<DeadlineExceeded>();
+    }
+
+    const Options options;
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> exhausted{0};
+    std::atomic<int64_t> credits;
+  };
+
+  static Future<Resp> attempt(std::shared_ptr<Shared> shared,
+                              std::shared_ptr<Service<Req, Resp>> service,
+                              Req req, uint32_t retries,
+                              RequestDeadline::TimePoint deadline) {
+    RequestDeadline::Guard g(deadline);
+    auto& s = *service;
+    return s(req).then(
+      [shared, service, req, retries, deadline] (Try<Resp>&& t) mutable {
+        auto& options = shared->options;
+        auto delay = options.backoff * (1 << std::min<uint32_t>(retries, 16));
+        if (!t.hasException() || retries >= options.maxRetries ||
+            !shared->isRetryable(t.exception()) ||
+            deadline - RequestDeadline::Clock::now() <= delay ||
+            !shared->takeRetry()) {
+          return makeFuture<Resp>(std::move(t));
+        }
+        if (delay.count() == 0) {
+          return attempt(std::move(shared), std::move(service),
+                         std::move(req), retries + 1, deadline);
+        }
+        return futures::sleep(delay, options.timekeeper).then(
+          [shared, service, req, retries, deadline] () mutable {
+            return attempt(std::move(shared), std::move(service),
+                           std::move(req), retries + 1, deadline);
+          });
+      });
+  }
+
+  std::shared_ptr<Shared> shared_;
+};
+
+template <typename Req, typename Resp>
+const int64_t RetryFilter<Req, Resp>::Shared::kCreditsPerRetry;
+
+}} // namespace
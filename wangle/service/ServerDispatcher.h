@@ -10,17 +10,60 @@
 
 #pragma once
 
+#include <folly/Optional.h>
+#include <folly/io/async/EventBaseManager.h>
 #include <wangle/channel/Handler.h>
+#include <wangle/concurrent/RequestDeadline.h>
 #include <wangle/service/Service.h>
 
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+
 namespace folly { namespace wangle {
 
+/**
+ * The RequestDeadline the server dispatchers give each request as they
+ * hand it to their service: that of deadlineFunc, for protocols whose
+ * requests carry their client's, else the request timeout from when it
+ * was read, else none.
+ */
+template <typename Req>
+class ServerRequestDeadlines {
+ public:
+  void setRequestTimeout(std::chrono::milliseconds timeout) {
+    timeout_ = timeout;
+  }
+
+  void setDeadlineFunc(
+      std::function<RequestDeadline::TimePoint(const Req&)> deadlineFunc) {
+    deadlineFunc_ = std::move(deadlineFunc);
+  }
+
+ protected:
+  RequestDeadline::TimePoint deadlineOf(const Req& req) const {
+    if (deadlineFunc_) {
+      return deadlineFunc_(req);
+    }
+    if (timeout_.count() > 0) {
+      return RequestDeadline::Clock::now() + timeout_;
+    }
+    return RequestDeadline::none();
+  }
+
+ private:
+  std::chrono::milliseconds timeout_{0};
+  std::function<RequestDeadline::TimePoint(const Req&)> deadlineFunc_;
+};
+
 /**
  * Dispatch requests from pipeline one at a time synchronously.
  * Concurrent requests are queued in the pipeline.
  */
 template <typename Req, typename Resp = Req>
-class SerialServerDispatcher : public HandlerAdapter<Req, Resp> {
+class SerialServerDispatcher : public HandlerAdapter<Req, Resp>
+                             , public ServerRequestDeadlines<Req> {
  public:
 
   typedef typename HandlerAdapter<Req, Resp>::Context Context;
@@ -29,6 +72,7 @@ class SerialServerDispatcher : public HandlerAdapter<Req, Resp> {
       : service_(service) {}
 
   void read(Context* ctx, Req in) override {
+    RequestDeadline::Guard g(this->deadlineOf(in));
     auto resp = (*service_)(std::move(in)).get();
     ctx->fireWrite(std::move(resp));
   }
@@ -38,4 +82,150 @@ class SerialServerDispatcher : public HandlerAdapter<Req, Resp> {
   Service<Req, Resp>* service_;
 };
 
+/**
+ * Dispatch requests from pipeline as they arrive, without waiting for the
+ * responses to the ones before, and write the responses back in the order
+ * of the requests, as protocols that pipeline without request IDs expect.
+ * A response that completes ahead of an earlier one is held until that one
+ * is written.
+ *
+ * Responses may complete on any thread; they are written from the
+ * connection's EventBase.  If one fails, the connection is closed.
+ */
+template <typename Req, typename Resp = Req>
+class PipelinedServerDispatcher : public HandlerAdapter<Req, Resp>
+                                , public ServerRequestDeadlines<Req> {
+ public:
+
+  typedef typename HandlerAdapter<Req, Resp>::Context Context;
+
+  explicit PipelinedServerDispatcher(Service<Req, Resp>* service)
+      : service_(service) {}
+
+  void read(Context* ctx, Req in) override {
+    auto id = nextRequestId_++;
+    pending_.emplace_back();
+    RequestDeadline::Guard g(this->deadlineOf(in));
+    // A service throwing instead of failing its future would leave the
+    // slot empty for good, with every later response held behind it
+    auto f = [&] () -> Future<Resp> {
+      try {
+        return (*service_)(std::move(in));
+      } catch (const std::exception& e) {
+        return makeFuture<Resp>(
+          make_exception_wrapper<std::runtime_error>(e.what()));
+      }
+    }();
+    if (f.isReady()) {
+      onResponse(ctx, id, std::move(f.getTry()));
+      return;
+    }
+    // Keep the pipeline, and so ctx and this handler, alive until the
+    // request is done
+    DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+    f.via(EventBaseManager::get()->getEventBase())
+      .then([this, ctx, dg, id](Try<Resp>&& t) {
+        onResponse(ctx, id, std::move(t));
+      });
+  }
+
+  // Requests whose responses haven't been written yet
+  size_t getNumPending() const {
+    return pending_.size();
+  }
+
+ private:
+  void onResponse(Context* ctx, uint64_t id, Try<Resp>&& t) {
+    if (id < nextWriteId_) {
+      // Dropped along with the rest when an earlier request failed
+      return;
+    }
+    if (t.hasException()) {
+      LOG(ERROR) << "PipelinedServerDispatcher: service threw "
+                 << t.exception().what();
+      // Nothing after it can be written in order any more
+      nextWriteId_ = nextRequestId_;
+      pending_.clear();
+      ctx->fireClose();
+      return;
+    }
+    pending_[id - nextWriteId_] = std::move(t.value());
+    while (!pending_.empty() && pending_.front()) {
+      auto resp = std::move(*pending_.front());
+      pending_.pop_front();
+      nextWriteId_++;
+      ctx->fireWrite(std::move(resp));
+    }
+  }
+
+  Service<Req, Resp>* service_;
+  // Responses for requests nextWriteId_ onwards, as they complete
+  std::deque<Optional<Resp>> pending_;
+  uint64_t nextRequestId_{0};
+  uint64_t nextWriteId_{0};
+};
+
+/**
+ * Dispatch requests from pipeline as they arrive, and write each response
+ * as soon as it completes, in whatever order that is.  For multiplexed
+ * protocols, where the codec puts the ID of the request in its response,
+ * from which the client matches them up.
+ *
+ * Responses may complete on any thread; they are written from the
+ * connection's EventBase.  If one fails, the connection is closed, since
+ * the client would otherwise wait on it forever; save with
+ * DeadlineExceeded, as the client has given up on it already.  For the
+ * same reason requests read past their deadline are dropped unanswered.
+ */
+template <typename Req, typename Resp = Req>
+class MultiplexServerDispatcher : public HandlerAdapter<Req, Resp>
+                                , public ServerRequestDeadlines<Req> {
+ public:
+
+  typedef typename HandlerAdapter<Req, Resp>::Context Context;
+
+  explicit MultiplexServerDispatcher(Service<Req, Resp>* service)
+      : service_(service) {}
+
+  void read(Context* ctx, Req in) override {
+    RequestDeadline::Guard g(this->deadlineOf(in));
+    if (RequestDeadline::expired()) {
+      numExpired_++;
+      return;
+    }
+    auto f = (*service_)(std::move(in));
+    if (f.isReady()) {
+      onResponse(ctx, std::move(f.getTry()));
+      return;
+    }
+    DelayedDestruction::DestructorGuard dg(ctx->getPipeline());
+    f.via(EventBaseManager::get()->getEventBase())
+      .then([ctx, dg](Try<Resp>&& t) {
+        onResponse(ctx, std::move(t));
+      });
+  }
+
+  // Requests dropped unanswered, as their deadline had passed
+  uint64_t getNumExpired() const {
+    return numExpired_;
+  }
+
+ private:
+  static void onResponse(Context* ctx, Try<Resp>&& t) {
+    if (t.hasException()) {
+      if (t.exception().template is_compatible_with<DeadlineExceeded>()) {
+        return;
+      }
+      LOG(ERROR) << "MultiplexServerDispatcher: service threw "
+                 << t.exception().what();
+      ctx->fireClose();
+      return;
+    }
+    ctx->fireWrite(std::move(t.value()));
+  }
+
+  Service<Req, Resp>* service_;
+  uint64_t numExpired_{0};
+};
+
 }} // namespace
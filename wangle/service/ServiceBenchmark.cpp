@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <wangle/service/FiberServerDispatcher.h>
+#include <wangle/service/Service.h>
+#include <gflags/gflags.h>
+
+using namespace folly;
+using namespace folly::wangle;
+using folly::BenchmarkSuspender;
+
+DEFINE_int32(requests_per_loop, 16, "Requests read per event loop");
+
+class WriteCounter final : public OutboundHandler<int> {
+ public:
+  Future<Unit> write(Context* ctx, int msg) override {
+    count++;
+    return makeFuture();
+  }
+
+  uint64_t count{0};
+};
+
+class IncrementService final : public Service<int, int> {
+ public:
+  Future<int> operator()(int req) override {
+    return req + 1;
+  }
+};
+
+// Same work, but hops to a CPU pool and back to the EventBase as servers
+// with blocking service code do today
+class HopService final : public Service<int, int> {
+ public:
+  HopService(Executor* cpu, EventBase* evb) : cpu_(cpu), evb_(evb) {}
+
+  Future<int> operator()(int req) override {
+    return via(cpu_).then([req]() {
+      return req + 1;
+    }).via(evb_);
+  }
+
+ private:
+  Executor* cpu_;
+  EventBase* evb_;
+};
+
+// Writes each response once its future completes
+class AsyncServerDispatcher final : public HandlerAdapter<int, int> {
+ public:
+  explicit AsyncServerDispatcher(Service<int, int>* service)
+    : service_(service) {}
+
+  void read(Context* ctx, int in) override {
+    (*service_)(in).then([ctx](int resp) {
+      ctx->fireWrite(resp);
+    });
+  }
+
+ private:
+  Service<int, int>* service_;
+};
+
+template <class Dispatcher>
+void dispatch(uint iters, Service<int, int>* service, EventBase* evb) {
+  BenchmarkSuspender bs;
+  WriteCounter counter;
+  Pipeline<int, int> pipeline;
+  pipeline.addBack(&counter).addBack(Dispatcher(service)).finalize();
+  bs.dismiss();
+
+  for (uint i = 0; i < iters; ) {
+    for (int j = 0; j < FLAGS_requests_per_loop && i < iters; j++, i++) {
+      pipeline.read(i);
+    }
+    evb->loopOnce(EVLOOP_NONBLOCK);
+  }
+  while (counter.count < iters) {
+    evb->loopOnce();
+  }
+  bs.rehire();
+}
+
+BENCHMARK(executorHop, iters) {
+  BenchmarkSuspender bs;
+  auto evb = EventBaseManager::get()->getEventBase();
+  CPUThreadPoolExecutor cpu(1);
+  HopService service(&cpu, evb);
+  bs.dismiss();
+  dispatch<AsyncServerDispatcher>(iters, &service, evb);
+  bs.rehire();
+}
+
+BENCHMARK_RELATIVE(fiberPerRequest, iters) {
+  BenchmarkSuspender bs;
+  auto evb = EventBaseManager::get()->getEventBase();
+  IncrementService service;
+  bs.dismiss();
+  dispatch<FiberServerDispatcher<int, int>>(iters, &service, evb);
+  bs.rehire();
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Open-loop load against an echo server over loopback, through the whole
+// Service stack: ServerBootstrap, a length-prefixed string codec, and each
+// kind of dispatcher.  Requests are scheduled at a fixed rate whether or
+// not earlier ones are done, and latency counts from when each one was
+// due, so time spent queued behind a slow response counts too.
+
+#include <folly/Conv.h>
+#include <folly/Memory.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/bootstrap/ClientBootstrap.h>
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+#include <wangle/codec/StringCodec.h>
+#include <wangle/concurrent/TaskLatencyHistogram.h>
+#include <wangle/service/ClientDispatcher.h>
+#include <wangle/service/ServerDispatcher.h>
+#include <wangle/service/Service.h>
+#include <gflags/gflags.h>
+
+#include <deque>
+
+using namespace folly;
+using namespace folly::wangle;
+
+DEFINE_string(dispatcher, "all", "serial, pipelined, multiplex or all");
+DEFINE_int32(qps, 20000, "Requests per second, over all connections");
+DEFINE_int32(connections, 4, "Connections to the server");
+DEFINE_int32(concurrency, 64,
+             "Requests in flight per connection, for dispatchers allowing "
+             "more than one");
+DEFINE_int32(duration_ms, 5000, "How long to send requests for");
+DEFINE_int32(payload_bytes, 64, "Bytes in each request after its ID");
+
+typedef Pipeline<IOBufQueue&, std::string> StringPipeline;
+
+// Requests and responses start with their ID, for the multiplexers
+const size_t kIdDigits = 8;
+
+uint32_t getId(const std::string& msg) {
+  return folly::to<uint32_t>(StringPiece(msg).subpiece(0, kIdDigits));
+}
+
+class EchoService : public Service<std::string> {
+ public:
+  Future<std::string> operator()(std::string req) override {
+    return req;
+  }
+};
+
+template <typename Dispatcher>
+class ServerPipelineFactory : public PipelineFactory<StringPipeline> {
+ public:
+  std::unique_ptr<StringPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    std::unique_ptr<StringPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new StringPipeline);
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(LengthFieldBasedFrameDecoder());
+    pipeline->addBack(LengthFieldPrepender());
+    pipeline->addBack(StringCodec());
+    pipeline->addBack(Dispatcher(&service_));
+    pipeline->finalize();
+    return pipeline;
+  }
+
+ private:
+  EchoService service_;
+};
+
+class ClientPipelineFactory : public PipelineFactory<StringPipeline> {
+ public:
+  std::unique_ptr<StringPipeline, folly::DelayedDestruction::Destructor>
+  newPipeline(std::shared_ptr<AsyncSocket> sock) override {
+    std::unique_ptr<StringPipeline, folly::DelayedDestruction::Destructor>
+      pipeline(new StringPipeline);
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(LengthFieldBasedFrameDecoder());
+    pipeline->addBack(LengthFieldPrepender());
+    pipeline->addBack(StringCodec());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+struct Connection {
+  std::unique_ptr<ClientBootstrap<StringPipeline>> client;
+  std::unique_ptr<Service<std::string>> dispatcher;
+  size_t maxOutstanding;
+  size_t outstanding{0};
+  // When each request waiting to go out was due
+  std::deque<std::chrono::steady_clock::time_point> backlog;
+};
+
+// Sends requests at FLAGS_qps from the EventBase's thread until
+// FLAGS_duration_ms is up and every response is in
+class LoadGenerator : public AsyncTimeout {
+ public:
+  LoadGenerator(EventBase* evb, std::vector<Connection>* connections)
+      : AsyncTimeout(evb),
+        evb_(evb),
+        connections_(connections),
+        payload_(FLAGS_payload_bytes, 'x') {}
+
+  void run() {
+    start_ = std::chrono::steady_clock::now();
+    scheduleTimeout(1);
+    evb_->loopForever();
+  }
+
+  void timeoutExpired() noexcept override {
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    auto duration = std::chrono::milliseconds(FLAGS_duration_ms);
+    if (elapsed > duration) {
+      elapsed = duration;
+    }
+    uint64_t due = uint64_t(FLAGS_qps) *
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() /
+      1000000;
+    for (; scheduled_ < due; scheduled_++) {
+      auto& conn = (*connections_)[scheduled_ % connections_->size()];
+      conn.backlog.push_back(start_ + std::chrono::microseconds(
+        scheduled_ * 1000000 / FLAGS_qps));
+      pump(conn);
+    }
+    if (elapsed < duration) {
+      scheduleTimeout(1);
+    } else {
+      finishedScheduling_ = true;
+      checkDone();
+    }
+  }
+
+  const TaskLatencyHistogram& getLatencies() const {
+    return latencies_;
+  }
+
+  uint64_t getNumCompleted() const {
+    return completed_;
+  }
+
+  uint64_t getNumFailed() const {
+    return failed_;
+  }
+
+ private:
+  void pump(Connection& conn) {
+    while (conn.outstanding < conn.maxOutstanding && !conn.backlog.empty()) {
+      auto due = conn.backlog.front();
+      conn.backlog.pop_front();
+      conn.outstanding++;
+      auto id = folly::to<std::string>(nextId_++ % 100000000);
+      auto req = std::string(kIdDigits - id.size(), '0') + id + payload_;
+      (*conn.dispatcher)(std::move(req)).then(
+        [this, &conn, due] (Try<std::string>&& t) {
+          conn.outstanding--;
+          if (t.hasValue()) {
+            latencies_.addValue(std::chrono::steady_clock::now() - due);
+            completed_++;
+          } else {
+            failed_++;
+          }
+          pump(conn);
+          checkDone();
+        });
+    }
+  }
+
+  void checkDone() {
+    if (finishedScheduling_ && completed_ + failed_ == scheduled_) {
+      evb_->terminateLoopSoon();
+    }
+  }
+
+  EventBase* evb_;
+  std::vector<Connection>* connections_;
+  const std::string payload_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t scheduled_{0};
+  uint64_t completed_{0};
+  uint64_t failed_{0};
+  uint32_t nextId_{0};
+  bool finishedScheduling_{false};
+  TaskLatencyHistogram latencies_;
+};
+
+std::unique_ptr<Service<std::string>> newClientDispatcher(
+    const std::string& type, StringPipeline* pipeline) {
+  if (type == "serial") {
+    auto dispatcher = folly::make_unique<
+      SerialClientDispatcher<StringPipeline, std::string>>();
+    dispatcher->setPipeline(pipeline);
+    return std::move(dispatcher);
+  } else if (type == "pipelined") {
+    auto dispatcher = folly::make_unique<
+      PipelinedClientDispatcher<StringPipeline, std::string>>();
+    dispatcher->setPipeline(pipeline);
+    return std::move(dispatcher);
+  }
+  auto dispatcher = folly::make_unique<
+    MultiplexClientDispatcher<StringPipeline, std::string>>(getId, getId);
+  dispatcher->setPipeline(pipeline);
+  return std::move(dispatcher);
+}
+
+std::shared_ptr<PipelineFactory<StringPipeline>> newServerPipelineFactory(
+    const std::string& type) {
+  if (type == "serial") {
+    return std::make_shared<ServerPipelineFactory<
+      SerialServerDispatcher<std::string>>>();
+  } else if (type == "pipelined") {
+    return std::make_shared<ServerPipelineFactory<
+      PipelinedServerDispatcher<std::string>>>();
+  }
+  return std::make_shared<ServerPipelineFactory<
+    MultiplexServerDispatcher<std::string>>>();
+}
+
+void runOne(const std::string& type) {
+  ServerBootstrap<StringPipeline> server;
+  server.childPipeline(newServerPipelineFactory(type));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  auto evb = EventBaseManager::get()->getEventBase();
+  std::vector<Connection> connections(FLAGS_connections);
+  for (auto& conn : connections) {
+    conn.client = folly::make_unique<ClientBootstrap<StringPipeline>>();
+    conn.client->pipelineFactory(std::make_shared<ClientPipelineFactory>());
+    auto pipeline = conn.client->connect(address).getVia(evb);
+    conn.dispatcher = newClientDispatcher(type, pipeline);
+    // The serial dispatchers take one request at a time
+    conn.maxOutstanding = type == "serial" ? 1 : FLAGS_concurrency;
+  }
+
+  LoadGenerator generator(evb, &connections);
+  generator.run();
+
+  auto& latencies = generator.getLatencies();
+  auto us = [&] (double pct) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      latencies.getPercentile(pct)).count();
+  };
+  printf("%-10s %10.0f req/s  p50 %8ldus  p99 %8ldus  p999 %8ldus  "
+         "failed %lu\n",
+         type.c_str(),
+         generator.getNumCompleted() * 1000.0 / FLAGS_duration_ms,
+         us(50), us(99), us(99.9),
+         generator.getNumFailed());
+
+  for (auto& conn : connections) {
+    conn.dispatcher->close();
+  }
+  server.stop();
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  std::vector<std::string> types;
+  if (FLAGS_dispatcher == "all") {
+    types = {"serial", "pipelined", "multiplex"};
+  } else {
+    types = {FLAGS_dispatcher};
+  }
+  for (auto& type : types) {
+    runOne(type);
+  }
+  return 0;
+}
@@ -12,11 +12,24 @@
 
 #include <wangle/codec/StringCodec.h>
 #include <wangle/codec/ByteToMessageCodec.h>
+#include <wangle/service/BatchingFilter.h>
+#include <wangle/service/CachingFilter.h>
 #include <wangle/service/ClientDispatcher.h>
+#include <wangle/service/FiberServerDispatcher.h>
 #include <wangle/service/ServerDispatcher.h>
 #include <wangle/service/Service.h>
+#include <wangle/service/CircuitBreakerFilter.h>
 #include <wangle/service/CloseOnReleaseFilter.h>
+#include <wangle/service/ConcurrencyLimitFilter.h>
+#include <wangle/service/DeadlineFilter.h>
 #include <wangle/service/ExpiringFilter.h>
+#include <wangle/service/HedgingFilter.h>
+#include <wangle/service/LoadBalancingService.h>
+#include <wangle/service/PooledServiceFactory.h>
+#include <wangle/service/RetryFilter.h>
+
+#include <atomic>
+#include <thread>
 
 namespace folly {
 
@@ -318,6 +331,778 @@ TEST(ServiceFilter, NoIdleDuringRequests) {
   EXPECT_EQ(3, timekeeper.promises_.size());
 }
 
+class DelayedService : public Service<std::string, std::string> {
+ public:
+  Future<std::string> operator()(std::string req) override {
+    if (req == "wait") {
+      return promise_.getFuture();
+    }
+    return req;
+  }
+
+  Promise<std::string> promise_;
+};
+
+class WriteRecorder : public OutboundHandler<std::string> {
+ public:
+  Future<Unit> write(Context*, std::string msg) override {
+    writes.push_back(msg);
+    return makeFuture();
+  }
+
+  Future<Unit> close(Context*) override {
+    closes++;
+    return makeFuture();
+  }
+
+  std::vector<std::string> writes;
+  int closes{0};
+};
+
+TEST(ServiceFilter, ExpiringIdleOnTimer) {
+  EventBase evb;
+  auto service = std::make_shared<DelayedService>();
+  auto closeOnReleaseService =
+    std::make_shared<CloseOnReleaseFilter<std::string, std::string>>(service);
+  ExpiringFilter<std::string, std::string> expiringService(
+    closeOnReleaseService,
+    std::chrono::milliseconds(20),
+    std::chrono::milliseconds(0),
+    &evb);
+
+  // Not idle while waiting, for longer than the idle time
+  auto f = expiringService("wait");
+  evb.runAfterDelay([&] { evb.terminateLoopSoon(); }, 100);
+  evb.loopForever();
+  EXPECT_TRUE(closeOnReleaseService->isAvailable());
+
+  service->promise_.setValue("done");
+  EXPECT_EQ("done", f.value());
+  while (closeOnReleaseService->isAvailable()) {
+    evb.loopOnce();
+  }
+  EXPECT_TRUE(expiringService("test").getTry().hasException());
+}
+
+TEST(ServiceFilter, ExpiringIdleRequestsFromOtherThread) {
+  EventBase evb;
+  auto closeOnReleaseService =
+    std::make_shared<CloseOnReleaseFilter<std::string, std::string>>(
+      std::make_shared<EchoService>());
+  ExpiringFilter<std::string, std::string> expiringService(
+    closeOnReleaseService,
+    std::chrono::milliseconds(20),
+    std::chrono::milliseconds(0),
+    &evb);
+
+  // Kept busy from another thread for longer than the idle time
+  std::atomic<bool> stop{false};
+  std::thread client([&] {
+    while (!stop) {
+      EXPECT_EQ("test", expiringService("test").value());
+    }
+  });
+  evb.runAfterDelay([&] { evb.terminateLoopSoon(); }, 100);
+  evb.loopForever();
+  stop = true;
+  client.join();
+  EXPECT_TRUE(closeOnReleaseService->isAvailable());
+
+  while (closeOnReleaseService->isAvailable()) {
+    evb.loopOnce();
+  }
+  EXPECT_TRUE(expiringService("test").getTry().hasException());
+}
+
+TEST(Wangle, FiberServerDispatcher) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  DelayedService service;
+  WriteRecorder recorder;
+  Pipeline<std::string, std::string> pipeline;
+  pipeline
+    .addBack(&recorder)
+    .addBack(FiberServerDispatcher<std::string, std::string>(&service))
+    .finalize();
+
+  pipeline.read("wait");
+  pipeline.read("echo");
+  evb->loopOnce();
+  // The waiting request only suspended its fiber
+  ASSERT_EQ(1, recorder.writes.size());
+  EXPECT_EQ("echo", recorder.writes[0]);
+
+  service.promise_.setValue("done");
+  evb->loopOnce();
+  ASSERT_EQ(2, recorder.writes.size());
+  EXPECT_EQ("done", recorder.writes[1]);
+}
+
+TEST(Wangle, PipelinedServerDispatcher) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  DelayedService service;
+  WriteRecorder recorder;
+  Pipeline<std::string, std::string> pipeline;
+  pipeline
+    .addBack(&recorder)
+    .addBack(PipelinedServerDispatcher<std::string, std::string>(&service))
+    .finalize();
+
+  pipeline.read("wait");
+  pipeline.read("echo");
+  // The second response is held for the first
+  EXPECT_EQ(0, recorder.writes.size());
+
+  service.promise_.setValue("done");
+  evb->loopOnce();
+  ASSERT_EQ(2, recorder.writes.size());
+  EXPECT_EQ("done", recorder.writes[0]);
+  EXPECT_EQ("echo", recorder.writes[1]);
+}
+
+TEST(Wangle, MultiplexServerDispatcher) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  DelayedService service;
+  WriteRecorder recorder;
+  Pipeline<std::string, std::string> pipeline;
+  pipeline
+    .addBack(&recorder)
+    .addBack(MultiplexServerDispatcher<std::string, std::string>(&service))
+    .finalize();
+
+  pipeline.read("wait");
+  pipeline.read("echo");
+  ASSERT_EQ(1, recorder.writes.size());
+  EXPECT_EQ("echo", recorder.writes[0]);
+
+  service.promise_.setValue("done");
+  evb->loopOnce();
+  ASSERT_EQ(2, recorder.writes.size());
+  EXPECT_EQ("done", recorder.writes[1]);
+}
+
+TEST(Wangle, MultiplexServerDispatcherDeadline) {
+  DelayedService service;
+  WriteRecorder recorder;
+  Pipeline<std::string, std::string> pipeline;
+  MultiplexServerDispatcher<std::string, std::string> dispatcher(&service);
+  dispatcher.setDeadlineFunc([] (const std::string& req) {
+    auto now = RequestDeadline::Clock::now();
+    return req == "late" ? now - std::chrono::milliseconds(1)
+                         : now + std::chrono::seconds(60);
+  });
+  pipeline
+    .addBack(&recorder)
+    .addBack(&dispatcher)
+    .finalize();
+
+  // Dropped unanswered, its client having given up on it
+  pipeline.read("late");
+  EXPECT_EQ(0, recorder.writes.size());
+  EXPECT_EQ(1, dispatcher.getNumExpired());
+  pipeline.read("echo");
+  ASSERT_EQ(1, recorder.writes.size());
+  EXPECT_EQ("echo", recorder.writes[0]);
+}
+
+TEST(Wangle, PipelinedClientDispatcher) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  WriteRecorder recorder;
+  Pipeline<std::string, std::string> pipeline;
+  pipeline.addBack(&recorder);
+  PipelinedClientDispatcher<Pipeline<std::string, std::string>, std::string>
+    dispatcher;
+  dispatcher.setPipeline(&pipeline);
+  dispatcher.setMaxPendingRequests(2);
+
+  auto f1 = dispatcher("a");
+  auto f2 = dispatcher("b");
+  EXPECT_TRUE(dispatcher("c").getTry().hasException());
+  EXPECT_EQ((std::vector<std::string>{"a", "b"}), recorder.writes);
+
+  // Responses fulfill requests in order
+  pipeline.read("ra");
+  EXPECT_EQ("ra", f1.value());
+  EXPECT_FALSE(f2.isReady());
+
+  dispatcher.setRequestTimeout(std::chrono::milliseconds(1));
+  auto f3 = dispatcher("d");
+  while (!f3.isReady()) {
+    evb->loopOnce();
+  }
+  EXPECT_THROW(f3.value(), TimedOut);
+  // The timed out request still takes its response
+  pipeline.read("rb");
+  pipeline.read("rd");
+  EXPECT_EQ("rb", f2.value());
+  EXPECT_EQ(0, dispatcher.getNumPending());
+}
+
+TEST(Wangle, MultiplexClientDispatcher) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  WriteRecorder recorder;
+  Pipeline<std::string, std::string> pipeline;
+  pipeline.addBack(&recorder);
+  // The ID is the first character
+  auto getId = [] (const std::string& msg) { return uint32_t(msg[0]); };
+  MultiplexClientDispatcher<Pipeline<std::string, std::string>, std::string>
+    dispatcher(getId, getId);
+  dispatcher.setPipeline(&pipeline);
+
+  auto f1 = dispatcher("1req");
+  auto f2 = dispatcher("2req");
+  EXPECT_TRUE(dispatcher("1again").getTry().hasException());
+
+  // In any order
+  pipeline.read("2resp");
+  EXPECT_FALSE(f1.isReady());
+  EXPECT_EQ("2resp", f2.value());
+  pipeline.read("1resp");
+  EXPECT_EQ("1resp", f1.value());
+
+  dispatcher.setRequestTimeout(std::chrono::milliseconds(1));
+  auto f3 = dispatcher("3req");
+  while (!f3.isReady()) {
+    evb->loopOnce();
+  }
+  EXPECT_THROW(f3.value(), TimedOut);
+  EXPECT_EQ(0, dispatcher.getNumPending());
+  // A late response is dropped
+  pipeline.read("3resp");
+}
+
+TEST(Wangle, ServicePool) {
+  EventBase evb;
+  int connects = 0;
+  bool healthy = true;
+  ServicePool<std::string>::Options options;
+  options.maxSize = 1;
+  options.healthCheck = [&] (Service<std::string, std::string>&) {
+    return healthy;
+  };
+  auto pool = std::make_shared<ServicePool<std::string>>(
+    &evb,
+    [&] (EventBase*) {
+      connects++;
+      return makeFuture<std::shared_ptr<Service<std::string, std::string>>>(
+        std::make_shared<EchoService>());
+    },
+    options);
+
+  auto s1 = pool->acquire().getVia(&evb);
+  EXPECT_EQ("test", (*s1)("test").value());
+  EXPECT_EQ(1, pool->getNumLeased());
+
+  // Full, so this waits for s1
+  auto f2 = pool->acquire();
+  EXPECT_FALSE(f2.isReady());
+  s1->close();
+  EXPECT_TRUE((*s1)("test").getTry().hasException());
+  auto s2 = f2.value();
+  EXPECT_EQ("test", (*s2)("test").value());
+
+  // Dropping the lease puts the service back, for reuse
+  s2.reset();
+  EXPECT_EQ(1, pool->getNumIdle());
+  auto s3 = pool->acquire().value();
+  EXPECT_EQ(1, connects);
+
+  // An unhealthy service is closed rather than kept
+  healthy = false;
+  s3.reset();
+  EXPECT_EQ(0, pool->getNumIdle());
+  EXPECT_EQ(0, pool->getNumLeased());
+  healthy = true;
+  pool->acquire().getVia(&evb);
+  EXPECT_EQ(2, connects);
+}
+
+TEST(Wangle, LoadBalancingPowerOfTwo) {
+  auto slow = std::make_shared<DelayedService>();
+  auto fast = std::make_shared<DelayedService>();
+  LoadBalancingService<std::string> lb({slow, fast});
+
+  // Whichever gets it, the other then has fewer outstanding
+  auto f = lb("wait");
+  size_t busy = lb.getOutstanding(0) == 1 ? 0 : 1;
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ("test", lb("test").value());
+  }
+  EXPECT_EQ(1, lb.getOutstanding(busy));
+  (busy == 0 ? slow : fast)->promise_.setValue("done");
+  EXPECT_EQ("done", f.value());
+  EXPECT_EQ(0, lb.getOutstanding(busy));
+}
+
+class CountingService : public Service<std::string, std::string> {
+ public:
+  explicit CountingService(int* count) : count_(count) {}
+  Future<std::string> operator()(std::string req) override {
+    (*count_)++;
+    return req;
+  }
+ private:
+  int* count_;
+};
+
+TEST(Wangle, LoadBalancingConsistentHash) {
+  std::vector<std::shared_ptr<CloseOnReleaseFilter<std::string>>> backends;
+  std::vector<std::shared_ptr<Service<std::string, std::string>>> services;
+  std::vector<int> counts(3);
+  for (auto& count : counts) {
+    backends.push_back(std::make_shared<CloseOnReleaseFilter<std::string>>(
+      std::make_shared<CountingService>(&count)));
+    services.push_back(backends.back());
+  }
+  LoadBalancingService<std::string> lb(
+    services,
+    LoadBalancingService<std::string>::Policy::kConsistentHash,
+    [] (const std::string& req) { return uint64_t(req.size()); });
+
+  // A key keeps to one backend
+  for (int i = 0; i < 5; i++) {
+    lb("key");
+  }
+  auto owner = std::find(counts.begin(), counts.end(), 5) - counts.begin();
+  ASSERT_LT(owner, 3);
+
+  // Until it's unavailable
+  backends[owner]->close();
+  EXPECT_EQ("key", lb("key").value());
+  EXPECT_EQ(5, counts[owner]);
+
+  for (auto& backend : backends) {
+    backend->close();
+  }
+  EXPECT_FALSE(lb.isAvailable());
+  EXPECT_TRUE(lb("key").getTry().hasException());
+}
+
+class PendingService : public Service<std::string, std::string> {
+ public:
+  Future<std::string> operator()(std::string req) override {
+    promises_.emplace_back();
+    return promises_.back().getFuture();
+  }
+
+  std::deque<Promise<std::string>> promises_;
+};
+
+TEST(Wangle, LoadBalancingLeastLatencyUnsampled) {
+  // Before any response, backends are weighed by outstanding requests
+  // rather than all costing nothing
+  auto a = std::make_shared<PendingService>();
+  auto b = std::make_shared<PendingService>();
+  LoadBalancingService<std::string> lb(
+    {a, b}, LoadBalancingService<std::string>::Policy::kLeastLatency);
+  std::vector<Future<std::string>> fs;
+  for (int i = 0; i < 10; i++) {
+    fs.push_back(lb("test"));
+  }
+  EXPECT_EQ(5, a->promises_.size());
+  EXPECT_EQ(5, b->promises_.size());
+  EXPECT_EQ(std::chrono::microseconds(0), lb.getLatency(0));
+
+  for (auto& p : a->promises_) {
+    p.setValue("done");
+  }
+  for (auto& p : b->promises_) {
+    p.setValue("done");
+  }
+}
+
+TEST(ServiceFilter, Hedging) {
+  TimekeeperTester timekeeper;
+  auto primary = std::make_shared<PendingService>();
+  auto backup = std::make_shared<PendingService>();
+  HedgingFilter<std::string>::Options options;
+  options.maxHedgeRatio = 0;
+  options.maxHedgeBurst = 1;
+  options.timekeeper = &timekeeper;
+  HedgingFilter<std::string> hedging(primary, backup, options);
+
+  // Answered in time, so no hedge
+  auto f1 = hedging("1");
+  primary->promises_[0].setValue("primary");
+  EXPECT_EQ("primary", f1.value());
+  EXPECT_TRUE(backup->promises_.empty());
+
+  // Late, so the backup goes out and wins
+  auto f2 = hedging("2");
+  timekeeper.promises_[1].setValue();
+  ASSERT_EQ(1, backup->promises_.size());
+  backup->promises_[0].setValue("backup");
+  EXPECT_EQ("backup", f2.value());
+  primary->promises_[1].setValue("late");
+  EXPECT_EQ(1, hedging.getNumBackupWins());
+
+  // The burst is spent, and no requests earn more
+  auto f3 = hedging("3");
+  timekeeper.promises_[2].setValue();
+  EXPECT_EQ(1, backup->promises_.size());
+  primary->promises_[2].setValue("primary");
+  EXPECT_EQ("primary", f3.value());
+  EXPECT_EQ(3, hedging.getNumRequests());
+  EXPECT_EQ(1, hedging.getNumHedges());
+}
+
+TEST(ServiceFilter, ConcurrencyLimit) {
+  auto service = std::make_shared<PendingService>();
+  ConcurrencyLimitFilter<std::string> limited(service, 2);
+
+  auto f1 = limited("1");
+  auto f2 = limited("2");
+  EXPECT_FALSE(limited.isAvailable());
+  EXPECT_THROW(limited("3").value(), ConcurrencyLimitExceeded);
+  EXPECT_EQ(1, limited.getNumRejected());
+
+  service->promises_[0].setValue("1");
+  EXPECT_EQ("1", f1.value());
+  EXPECT_EQ(1, limited.getInFlight());
+  auto f3 = limited("3");
+  EXPECT_FALSE(f3.isReady());
+  EXPECT_EQ(3, limited.getNumAccepted());
+}
+
+class ThrowingService : public Service<std::string, std::string> {
+ public:
+  Future<std::string> operator()(std::string req) override {
+    calls++;
+    if (req == "throw") {
+      throw std::runtime_error("threw");
+    }
+    return req;
+  }
+
+  int calls{0};
+};
+
+TEST(Wangle, PipelinedServerDispatcherServiceThrows) {
+  ThrowingService service;
+  WriteRecorder recorder;
+  Pipeline<std::string, std::string> pipeline;
+  PipelinedServerDispatcher<std::string, std::string> dispatcher(&service);
+  pipeline
+    .addBack(&recorder)
+    .addBack(&dispatcher)
+    .finalize();
+
+  pipeline.read("ok");
+  ASSERT_EQ(1, recorder.writes.size());
+  // Closes the connection like a failed response, instead of leaving a
+  // slot that holds every later response
+  pipeline.read("throw");
+  EXPECT_EQ(1, recorder.closes);
+  EXPECT_EQ(0, dispatcher.getNumPending());
+  pipeline.read("later");
+  ASSERT_EQ(2, recorder.writes.size());
+  EXPECT_EQ("later", recorder.writes[1]);
+  EXPECT_EQ(3, service.calls);
+}
+
+TEST(ServiceFilter, ConcurrencyLimitServiceThrows) {
+  auto service = std::make_shared<ThrowingService>();
+  ConcurrencyLimitFilter<std::string> limited(service, 1);
+  EXPECT_THROW(limited("throw"), std::runtime_error);
+  EXPECT_EQ(0, limited.getInFlight());
+  EXPECT_EQ("ok", limited("ok").value());
+}
+
+TEST(ServiceFilter, VegasConcurrencyLimit) {
+  VegasConcurrencyLimit::Options options;
+  options.initialLimit = 10;
+  VegasConcurrencyLimit limit(options);
+  auto ms = [] (int n) {
+    return std::chrono::nanoseconds(std::chrono::milliseconds(n));
+  };
+
+  // Latency at its minimum while full: no queue, so room to grow
+  limit.onSample(ms(10), 10, true);
+  limit.onSample(ms(10), 11, true);
+  EXPECT_EQ(12, limit.getLimit());
+
+  // Latency tripled: two thirds of the requests are queued
+  limit.onSample(ms(30), 12, true);
+  EXPECT_EQ(11, limit.getLimit());
+
+  // Mostly idle samples don't move it
+  limit.onSample(ms(10), 1, true);
+  EXPECT_EQ(11, limit.getLimit());
+
+  limit.onSample(ms(10), 11, false);
+  EXPECT_EQ(10, limit.getLimit());
+}
+
+TEST(ServiceFilter, VegasConcurrencyLimitSmallDecrease) {
+  VegasConcurrencyLimit::Options options;
+  options.initialLimit = 5;
+  options.minLimit = 2;
+  VegasConcurrencyLimit limit(options);
+  auto ms = [] (int n) {
+    return std::chrono::nanoseconds(std::chrono::milliseconds(n));
+  };
+
+  // 10% of a small limit rounds to nothing, but errors still shrink it
+  limit.onSample(ms(10), 5, false);
+  EXPECT_EQ(4, limit.getLimit());
+  limit.onSample(ms(10), 4, false);
+  limit.onSample(ms(10), 3, false);
+  EXPECT_EQ(2, limit.getLimit());
+  limit.onSample(ms(10), 2, false);
+  EXPECT_EQ(2, limit.getLimit());
+}
+
+class MultiGetService
+    : public Service<std::vector<std::string>, std::vector<std::string>> {
+ public:
+  Future<std::vector<std::string>> operator()(
+    std::vector<std::string> req) override {
+    batches.push_back(req.size());
+    return req;
+  }
+
+  std::vector<size_t> batches;
+};
+
+TEST(ServiceFilter, Batching) {
+  EventBase evb;
+  auto service = std::make_shared<MultiGetService>();
+  typedef BatchingFilter<std::string, std::string,
+                         std::vector<std::string>,
+                         std::vector<std::string>> Batching;
+  Batching::Options options;
+  options.maxBatchSize = 3;
+  Batching batching(
+    service,
+    [] (std::vector<std::string> reqs) { return reqs; },
+    [] (std::vector<std::string> resps) { return resps; },
+    options,
+    &evb);
+
+  // A full batch goes at once
+  auto f1 = batching("1");
+  auto f2 = batching("2");
+  EXPECT_EQ(2, batching.getNumWaiting());
+  auto f3 = batching("3");
+  EXPECT_EQ((std::vector<size_t>{3}), service->batches);
+  EXPECT_EQ("1", f1.value());
+  EXPECT_EQ("3", f3.value());
+
+  // The rest at the end of the loop
+  auto f4 = batching("4");
+  auto f5 = batching("5");
+  EXPECT_FALSE(f4.isReady());
+  evb.loopOnce();
+  EXPECT_EQ((std::vector<size_t>{3, 2}), service->batches);
+  EXPECT_EQ("4", f4.value());
+  EXPECT_EQ("5", f5.value());
+  EXPECT_EQ(2, batching.getNumBatches());
+}
+
+TEST(ServiceFilter, Caching) {
+  auto service = std::make_shared<PendingService>();
+  CachingFilter<std::string>::Options options;
+  options.cacheCapacity = 10;
+  options.ttl = std::chrono::milliseconds(60000);
+  CachingFilter<std::string> caching(
+    service,
+    [] (const std::string& req) { return std::hash<std::string>()(req); },
+    options);
+
+  // The second waits on the first
+  auto f1 = caching("a");
+  auto f2 = caching("a");
+  auto f3 = caching("b");
+  EXPECT_EQ(2, service->promises_.size());
+  EXPECT_EQ(1, caching.getNumCoalesced());
+  service->promises_[0].setValue("A");
+  EXPECT_EQ("A", f1.value());
+  EXPECT_EQ("A", f2.value());
+
+  // Then it's cached
+  EXPECT_EQ("A", caching("a").value());
+  EXPECT_EQ(1, caching.getNumHits());
+  EXPECT_EQ(2, caching.getNumMisses());
+
+  // Failures aren't
+  service->promises_[1].setException(std::runtime_error("failed"));
+  EXPECT_TRUE(f3.getTry().hasException());
+  caching("b");
+  EXPECT_EQ(3, service->promises_.size());
+
+  caching.clear();
+  caching("a");
+  EXPECT_EQ(4, service->promises_.size());
+}
+
+TEST(ServiceFilter, CachingServiceThrows) {
+  auto service = std::make_shared<ThrowingService>();
+  CachingFilter<std::string> caching(
+    service,
+    [] (const std::string& req) { return std::hash<std::string>()(req); },
+    CachingFilter<std::string>::Options());
+
+  EXPECT_THROW(caching("throw"), std::runtime_error);
+  // Not left in flight, so the next one goes to the service again
+  EXPECT_THROW(caching("throw"), std::runtime_error);
+  EXPECT_EQ(2, service->calls);
+  EXPECT_EQ(0, caching.getNumCoalesced());
+  EXPECT_EQ("ok", caching("ok").value());
+}
+
+TEST(ServiceFilter, CircuitBreaker) {
+  auto service = std::make_shared<PendingService>();
+  CircuitBreakerFilter<std::string>::Options options;
+  options.minRequests = 4;
+  options.openTime = std::chrono::milliseconds(20);
+  CircuitBreakerFilter<std::string> breaker(service, options);
+
+  // Too few requests to trip it
+  breaker("1");
+  breaker("2");
+  breaker("3");
+  service->promises_[0].setValue("ok");
+  service->promises_[1].setException(std::runtime_error("failed"));
+  service->promises_[2].setException(std::runtime_error("failed"));
+  EXPECT_EQ(CircuitState::CLOSED, breaker.getState());
+
+  // Then most of them fail
+  breaker("4");
+  service->promises_[3].setValue("ok");
+  EXPECT_EQ(CircuitState::CLOSED, breaker.getState());
+  breaker("5");
+  service->promises_[4].setException(std::runtime_error("failed"));
+  EXPECT_EQ(CircuitState::OPEN, breaker.getState());
+  EXPECT_EQ(1, breaker.getNumTrips());
+
+  // So requests fail fast
+  EXPECT_FALSE(breaker.isAvailable());
+  EXPECT_THROW(breaker("6").value(), CircuitOpenException);
+  EXPECT_EQ(5, service->promises_.size());
+  EXPECT_EQ(1, breaker.getNumRejected());
+
+  // Until one probe goes through, and closes it
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  EXPECT_TRUE(breaker.isAvailable());
+  auto probe = breaker("7");
+  EXPECT_EQ(CircuitState::HALF_OPEN, breaker.getState());
+  EXPECT_THROW(breaker("8").value(), CircuitOpenException);
+  service->promises_[5].setValue("ok");
+  EXPECT_EQ("ok", probe.value());
+  EXPECT_EQ(CircuitState::CLOSED, breaker.getState());
+  breaker("9");
+  EXPECT_EQ(7, service->promises_.size());
+}
+
+TEST(ServiceFilter, Retry) {
+  auto service = std::make_shared<PendingService>();
+  RetryFilter<std::string>::Options options;
+  options.maxRetries = 2;
+  options.maxRetryRatio = 0;
+  options.maxRetryBurst = 3;
+  RetryFilter<std::string> retry(service, options);
+
+  // Retried until it succeeds
+  auto f1 = retry("1");
+  service->promises_[0].setException(std::runtime_error("failed"));
+  EXPECT_EQ(2, service->promises_.size());
+  service->promises_[1].setValue("ok");
+  EXPECT_EQ("ok", f1.value());
+
+  // Or it's out of retries
+  auto f2 = retry("2");
+  service->promises_[2].setException(std::runtime_error("failed"));
+  service->promises_[3].setException(std::runtime_error("failed"));
+  service->promises_[4].setException(std::runtime_error("failed"));
+  EXPECT_EQ(5, service->promises_.size());
+  EXPECT_THROW(f2.value(), std::runtime_error);
+  EXPECT_EQ(3, retry.getNumRetries());
+
+  // Or the budget is
+  auto f3 = retry("3");
+  service->promises_[5].setException(std::runtime_error("failed"));
+  EXPECT_EQ(6, service->promises_.size());
+  EXPECT_TRUE(f3.getTry().hasException());
+  EXPECT_EQ(1, retry.getNumBudgetExhausted());
+  EXPECT_EQ(3, retry.getNumRequests());
+}
+
+TEST(ServiceFilter, RetryNotCircuitOpen) {
+  auto service = std::make_shared<PendingService>();
+  RetryFilter<std::string>::Options options;
+  RetryFilter<std::string> retry(service, options);
+
+  auto f = retry("1");
+  service->promises_[0].setException(CircuitOpenException());
+  EXPECT_EQ(1, service->promises_.size());
+  EXPECT_THROW(f.value(), CircuitOpenException);
+  EXPECT_EQ(0, retry.getNumRetries());
+}
+
+class DeadlineService : public Service<std::string, std::string> {
+ public:
+  Future<std::string> operator()(std::string req) override {
+    deadlines_.push_back(RequestDeadline::get());
+    return makeFuture(std::move(req));
+  }
+
+  std::vector<RequestDeadline::TimePoint> deadlines_;
+};
+
+TEST(ServiceFilter, Deadline) {
+  auto service = std::make_shared<DeadlineService>();
+  DeadlineFilter<std::string> filter(service);
+  DeadlineFilter<std::string> timeout(service, std::chrono::seconds(1));
+
+  // No deadline, none set
+  EXPECT_EQ("a", filter("a").value());
+  EXPECT_EQ(RequestDeadline::none(), service->deadlines_[0]);
+
+  // The timeout sets one
+  auto before = RequestDeadline::Clock::now();
+  timeout("b");
+  EXPECT_LE(before + std::chrono::seconds(1), service->deadlines_[1]);
+  EXPECT_FALSE(RequestDeadline::isSet());
+
+  // Or keeps the request's, if sooner
+  auto deadline = RequestDeadline::Clock::now() + std::chrono::milliseconds(5);
+  {
+    RequestDeadline::Guard g(deadline);
+    timeout("c");
+    EXPECT_EQ(deadline, service->deadlines_[2]);
+  }
+
+  // Past it, requests fail fast
+  {
+    RequestDeadline::Guard g(RequestDeadline::Clock::now());
+    EXPECT_THROW(filter("d").value(), DeadlineExceeded);
+    EXPECT_THROW(timeout("d").value(), DeadlineExceeded);
+  }
+  EXPECT_EQ(3, service->deadlines_.size());
+  EXPECT_EQ(1, filter.getNumExpired());
+  EXPECT_EQ(1, timeout.getNumExpired());
+}
+
+TEST(ServiceFilter, RetryDeadline) {
+  auto service = std::make_shared<PendingService>();
+  RetryFilter<std::string>::Options options;
+  RetryFilter<std::string> retry(service, options);
+
+  // No retry would make it in time
+  Future<std::string> f = makeFuture<std::string>("");
+  {
+    RequestDeadline::Guard g(
+      RequestDeadline::Clock::now() + std::chrono::milliseconds(1));
+    f = retry("1");
+  }
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  service->promises_[0].setException(std::runtime_error("failed"));
+  EXPECT_EQ(1, service->promises_.size());
+  EXPECT_TRUE(f.getTry().hasException());
+  EXPECT_EQ(0, retry.getNumRetries());
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   google::InitGoogleLogging(argv[0]);
@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/AsyncCryptoProvider.h>
+
+#include <glog/logging.h>
+
+namespace folly {
+
+namespace {
+
+// Keeps the socket alive until the handshake is resumed
+struct OffloadedOperation {
+  OffloadedOperation(AsyncSSLSocket* sock,
+                     PrivateKeyOffload::Operation o,
+                     PrivateKeyOffload::Completion c)
+    : sslSocket(sock),
+      guard(new DelayedDestruction::DestructorGuard(sock)),
+      eventBase(sock->getEventBase()),
+      op(std::move(o)),
+      completion(std::move(c)) {}
+
+  AsyncSSLSocket* sslSocket;
+  std::unique_ptr<DelayedDestruction::DestructorGuard> guard;
+  EventBase* eventBase;
+  PrivateKeyOffload::Operation op;
+  PrivateKeyOffload::Completion completion;
+  std::string result;
+  bool ok{false};
+};
+
+void resume(std::shared_ptr<OffloadedOperation> operation) {
+  operation->completion(std::move(operation->result), operation->ok);
+  if (operation->sslSocket->good()) {
+    operation->sslSocket->restartSSLAccept();
+  }
+  // Here rather than wherever the last reference goes
+  operation->guard.reset();
+}
+
+}
+
+bool PrivateKeyOffload::offload(AsyncSSLSocket* sslSocket,
+                                Operation op,
+                                Completion completion) {
+  auto operation = std::make_shared<OffloadedOperation>(
+    sslSocket, std::move(op), std::move(completion));
+  try {
+    executor_->add([operation] {
+      try {
+        operation->result = operation->op();
+        operation->ok = true;
+      } catch (const std::exception& ex) {
+        LOG(ERROR) << "Private key operation failed: " << ex.what();
+      }
+      auto eventBase = operation->eventBase;
+      if (!eventBase->runInEventBaseThread([operation] {
+            resume(operation);
+          })) {
+        // The socket's thread is gone along with its handshake
+        LOG(ERROR) << "Unable to resume handshake after private key "
+                   << "operation";
+      }
+    });
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Unable to offload private key operation: " << ex.what();
+    return false;
+  }
+  return true;
+}
+
+}
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/ssl/SSLContextConfig.h>
+
+#include <folly/Executor.h>
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/SSLContext.h>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace folly {
+
+/**
+ * Performs the private key operations of SSL contexts whose keys don't live
+ * in this process (SSLContextConfig::isLocalPrivateKey false), e.g. on a
+ * remote key server.  SSLContextManager hands it each such context once
+ * its certificates are loaded, and the provider installs whatever key
+ * method the linked OpenSSL offers for suspending a handshake on a private
+ * key operation.  With such a method, the handshake is resumed with
+ * AsyncSSLSocket::restartSSLAccept() once the result is in, as for
+ * external session cache lookups; PrivateKeyOffload does that part.
+ */
+class AsyncCryptoProvider {
+ public:
+  virtual ~AsyncCryptoProvider() = default;
+
+  virtual void enableAsyncCrypto(
+    const std::shared_ptr<SSLContext>& sslCtx,
+    const SSLContextConfig& ctxConfig) = 0;
+};
+
+/**
+ * Runs private key operations for handshakes on an executor, such as a CPU
+ * thread pool or the client of a key server, and resumes each handshake in
+ * its socket's EventBase when the operation is done.
+ */
+class PrivateKeyOffload {
+ public:
+  // Computes the signature or decryption; run on the executor
+  typedef std::function<std::string()> Operation;
+  // Takes the operation's result, or the error, in the socket's thread,
+  // right before the handshake resumes
+  typedef std::function<void(std::string result, bool ok)> Completion;
+
+  explicit PrivateKeyOffload(std::shared_ptr<folly::Executor> executor)
+    : executor_(std::move(executor)) {}
+
+  /**
+   * Start an operation for the handshake on sslSocket, which has to be
+   * suspended until the completion runs.  Returns false if the operation
+   * could not be queued.
+   */
+  bool offload(AsyncSSLSocket* sslSocket, Operation op,
+               Completion completion);
+
+ private:
+  std::shared_ptr<folly::Executor> executor_;
+};
+
+}
@@ -0,0 +1,255 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/CountingSSLStats.h>
+
+#include <cstring>
+
+namespace folly {
+
+namespace {
+
+const char* const kOtherCipher = "other";
+
+double ratio(uint64_t part, uint64_t total) {
+  return total ? double(part) / total : 0;
+}
+
+}
+
+const size_t CountingSSLStats::kMaxCiphers;
+
+double CountingSSLStats::Snapshot::getResumptionRate() const {
+  auto resumed = sessionIDResumptions + ticketResumptions;
+  return ratio(resumed, resumed + fullHandshakes);
+}
+
+double CountingSSLStats::Snapshot::getSessionCacheHitRate() const {
+  return ratio(sessionCacheHits, sessionCacheHits + sessionCacheMisses);
+}
+
+CountingSSLStats::CountingSSLStats() {
+  for (auto& counter : counters_) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+  for (auto& slot : ciphers_) {
+    slot.name.store(nullptr, std::memory_order_relaxed);
+    slot.fullHandshakes.store(0, std::memory_order_relaxed);
+    slot.totalLatencyUs.store(0, std::memory_order_relaxed);
+  }
+  ciphers_[kMaxCiphers - 1].name.store(kOtherCipher,
+                                       std::memory_order_relaxed);
+}
+
+CountingSSLStats::Snapshot CountingSSLStats::getSnapshot() const {
+  Snapshot s;
+  s.fullHandshakes = get(FULL_HANDSHAKES);
+  s.sessionIDResumptions = get(SESSION_ID_RESUMPTIONS);
+  s.ticketResumptions = get(TICKET_RESUMPTIONS);
+  s.handshakeErrors = get(HANDSHAKE_ERRORS);
+  s.handshakeTimeouts = get(HANDSHAKE_TIMEOUTS);
+  s.handshakesDropped = get(HANDSHAKES_DROPPED);
+  s.fullHandshakeLatency = fullHandshakeLatency_;
+  s.resumedHandshakeLatency = resumedHandshakeLatency_;
+  s.acceptLatency = acceptLatency_;
+  for (const auto& slot : ciphers_) {
+    auto name = slot.name.load(std::memory_order_acquire);
+    auto handshakes = slot.fullHandshakes.load(std::memory_order_relaxed);
+    if (!name || handshakes == 0) {
+      continue;
+    }
+    s.ciphers.push_back(CipherStats{
+      name,
+      handshakes,
+      std::chrono::microseconds(
+        slot.totalLatencyUs.load(std::memory_order_relaxed))});
+  }
+
+  s.sessionsNew = get(SESSIONS_NEW);
+  s.sessionCacheHits = get(SESSION_CACHE_HITS);
+  s.sessionCacheMisses = get(SESSION_CACHE_MISSES);
+  s.foreignSessionHits = get(FOREIGN_SESSION_HITS);
+  s.sessionsRemoved = get(SESSIONS_REMOVED);
+  s.sessionsFreed = get(SESSIONS_FREED);
+  s.sessionSetErrors = get(SESSION_SET_ERRORS);
+  s.sessionGetErrors = get(SESSION_GET_ERRORS);
+  s.ticketsIssued = get(TICKETS_ISSUED);
+  s.ticketKeyHits = get(TICKET_KEY_HITS);
+  s.ticketKeyMisses = get(TICKET_KEY_MISSES);
+  s.clientRenegotiations = get(CLIENT_RENEGOTIATIONS);
+
+  s.upstreamConnections = get(UPSTREAM_CONNECTIONS);
+  s.upstreamHandshakes = get(UPSTREAM_HANDSHAKES);
+  s.upstreamErrors = get(UPSTREAM_ERRORS);
+  s.upstreamVerifyErrors = get(UPSTREAM_VERIFY_ERRORS);
+  s.cryptoExternalAttempts = get(CRYPTO_EXTERNAL_ATTEMPTS);
+  s.cryptoExternalConnAlreadyClosed = get(CRYPTO_EXTERNAL_CONN_ALREADY_CLOSED);
+  s.cryptoExternalApplicationExceptions =
+    get(CRYPTO_EXTERNAL_APPLICATION_EXCEPTIONS);
+  s.cryptoExternalSuccesses = get(CRYPTO_EXTERNAL_SUCCESSES);
+  s.cryptoExternalTotalDuration = get(CRYPTO_EXTERNAL_TOTAL_DURATION);
+  s.cryptoLocalAttempts = get(CRYPTO_LOCAL_ATTEMPTS);
+  s.cryptoLocalSuccesses = get(CRYPTO_LOCAL_SUCCESSES);
+  return s;
+}
+
+CountingSSLStats::CipherSlot&
+CountingSSLStats::getCipherSlot(const char* cipher) {
+  for (size_t i = 0; i < kMaxCiphers - 1; i++) {
+    auto& slot = ciphers_[i];
+    auto name = slot.name.load(std::memory_order_acquire);
+    if (!name) {
+      // Claim it; whoever wins, the slot now has a name to compare
+      const char* expected = nullptr;
+      if (slot.name.compare_exchange_strong(expected, cipher,
+                                            std::memory_order_acq_rel)) {
+        return slot;
+      }
+      name = expected;
+    }
+    if (name == cipher || strcmp(name, cipher) == 0) {
+      return slot;
+    }
+  }
+  return ciphers_[kMaxCiphers - 1];
+}
+
+void CountingSSLStats::recordSSLHandshake(bool success,
+                                          SSLErrorEnum error,
+                                          SSLResumeEnum resume,
+                                          const char* cipher,
+                                          std::chrono::microseconds latency)
+  noexcept {
+  if (!success) {
+    switch (error) {
+      case SSLErrorEnum::TIMEOUT:
+        increment(HANDSHAKE_TIMEOUTS);
+        break;
+      case SSLErrorEnum::DROPPED:
+        increment(HANDSHAKES_DROPPED);
+        break;
+      default:
+        increment(HANDSHAKE_ERRORS);
+        break;
+    }
+    return;
+  }
+
+  switch (resume) {
+    case SSLResumeEnum::RESUME_SESSION_ID:
+      increment(SESSION_ID_RESUMPTIONS);
+      resumedHandshakeLatency_.addValueShared(latency);
+      return;
+    case SSLResumeEnum::RESUME_TICKET:
+      increment(TICKET_RESUMPTIONS);
+      resumedHandshakeLatency_.addValueShared(latency);
+      return;
+    default:
+      break;
+  }
+  increment(FULL_HANDSHAKES);
+  fullHandshakeLatency_.addValueShared(latency);
+  if (cipher) {
+    auto& slot = getCipherSlot(cipher);
+    slot.fullHandshakes.fetch_add(1, std::memory_order_relaxed);
+    slot.totalLatencyUs.fetch_add(latency.count(), std::memory_order_relaxed);
+  }
+}
+
+void CountingSSLStats::recordSSLAcceptLatency(int64_t latency) noexcept {
+  acceptLatency_.addValueShared(std::chrono::milliseconds(latency));
+}
+
+void CountingSSLStats::recordTLSTicket(bool ticketNew, bool ticketHit)
+  noexcept {
+  if (ticketNew) {
+    increment(TICKETS_ISSUED);
+  } else {
+    increment(ticketHit ? TICKET_KEY_HITS : TICKET_KEY_MISSES);
+  }
+}
+
+void CountingSSLStats::recordSSLSession(bool sessionNew, bool sessionHit,
+                                        bool foreign) noexcept {
+  if (sessionNew) {
+    increment(SESSIONS_NEW);
+    return;
+  }
+  increment(sessionHit ? SESSION_CACHE_HITS : SESSION_CACHE_MISSES);
+  if (sessionHit && foreign) {
+    increment(FOREIGN_SESSION_HITS);
+  }
+}
+
+void CountingSSLStats::recordSSLSessionRemove() noexcept {
+  increment(SESSIONS_REMOVED);
+}
+
+void CountingSSLStats::recordSSLSessionFree(uint32_t freed) noexcept {
+  increment(SESSIONS_FREED, freed);
+}
+
+void CountingSSLStats::recordSSLSessionSetError(uint32_t err) noexcept {
+  increment(SESSION_SET_ERRORS);
+}
+
+void CountingSSLStats::recordSSLSessionGetError(uint32_t err) noexcept {
+  increment(SESSION_GET_ERRORS);
+}
+
+void CountingSSLStats::recordClientRenegotiation() noexcept {
+  increment(CLIENT_RENEGOTIATIONS);
+}
+
+void CountingSSLStats::recordSSLUpstreamConnection(bool handshake) noexcept {
+  increment(UPSTREAM_CONNECTIONS);
+  if (handshake) {
+    increment(UPSTREAM_HANDSHAKES);
+  }
+}
+
+void CountingSSLStats::recordSSLUpstreamConnectionError(bool verifyError)
+  noexcept {
+  increment(UPSTREAM_ERRORS);
+  if (verifyError) {
+    increment(UPSTREAM_VERIFY_ERRORS);
+  }
+}
+
+void CountingSSLStats::recordCryptoSSLExternalAttempt() noexcept {
+  increment(CRYPTO_EXTERNAL_ATTEMPTS);
+}
+
+void CountingSSLStats::recordCryptoSSLExternalConnAlreadyClosed() noexcept {
+  increment(CRYPTO_EXTERNAL_CONN_ALREADY_CLOSED);
+}
+
+void CountingSSLStats::recordCryptoSSLExternalApplicationException()
+  noexcept {
+  increment(CRYPTO_EXTERNAL_APPLICATION_EXCEPTIONS);
+}
+
+void CountingSSLStats::recordCryptoSSLExternalSuccess() noexcept {
+  increment(CRYPTO_EXTERNAL_SUCCESSES);
+}
+
+void CountingSSLStats::recordCryptoSSLExternalDuration(uint64_t duration)
+  noexcept {
+  increment(CRYPTO_EXTERNAL_TOTAL_DURATION, duration);
+}
+
+void CountingSSLStats::recordCryptoSSLLocalAttempt() noexcept {
+  increment(CRYPTO_LOCAL_ATTEMPTS);
+}
+
+void CountingSSLStats::recordCryptoSSLLocalSuccess() noexcept {
+  increment(CRYPTO_LOCAL_SUCCESSES);
+}
+
+}
@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/concurrent/TaskLatencyHistogram.h>
+#include <wangle/ssl/SSLStats.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace folly {
+
+/**
+ * An SSLStats that keeps counters and latency histograms in memory, for
+ * ServerSocketConfig::sslStats.  One instance may be shared by the acceptors
+ * of all threads, along with their session caches and ticket key managers:
+ * every record is a relaxed atomic increment, and getSnapshot() reads
+ * without locking, from any thread.
+ *
+ * Handshake latency runs from accept to the end of the handshake, so it
+ * includes network round trips as well as CPU.  Per cipher, the count and
+ * total latency of full handshakes stand in for the CPU each costs.
+ */
+class CountingSSLStats : public SSLStats {
+ public:
+  // Ciphers beyond this many are counted under the last one, "other"
+  static const size_t kMaxCiphers = 32;
+
+  struct CipherStats {
+    const char* name;
+    uint64_t fullHandshakes;
+    std::chrono::microseconds totalLatency;
+  };
+
+  struct Snapshot {
+    // Handshakes through the acceptors
+    uint64_t fullHandshakes{0};
+    uint64_t sessionIDResumptions{0};
+    uint64_t ticketResumptions{0};
+    uint64_t handshakeErrors{0};
+    uint64_t handshakeTimeouts{0};
+    uint64_t handshakesDropped{0};
+    folly::wangle::TaskLatencyHistogram fullHandshakeLatency;
+    folly::wangle::TaskLatencyHistogram resumedHandshakeLatency;
+    folly::wangle::TaskLatencyHistogram acceptLatency;
+    std::vector<CipherStats> ciphers;
+
+    // Session cache lookups, and stores of new sessions
+    uint64_t sessionsNew{0};
+    uint64_t sessionCacheHits{0};
+    uint64_t sessionCacheMisses{0};
+    uint64_t foreignSessionHits{0};
+    uint64_t sessionsRemoved{0};
+    uint64_t sessionsFreed{0};
+    uint64_t sessionSetErrors{0};
+    uint64_t sessionGetErrors{0};
+
+    // Tickets issued, and lookups of the keys of tickets presented
+    uint64_t ticketsIssued{0};
+    uint64_t ticketKeyHits{0};
+    uint64_t ticketKeyMisses{0};
+
+    uint64_t clientRenegotiations{0};
+
+    // Upstream
+    uint64_t upstreamConnections{0};
+    uint64_t upstreamHandshakes{0};
+    uint64_t upstreamErrors{0};
+    uint64_t upstreamVerifyErrors{0};
+    uint64_t cryptoExternalAttempts{0};
+    uint64_t cryptoExternalConnAlreadyClosed{0};
+    uint64_t cryptoExternalApplicationExceptions{0};
+    uint64_t cryptoExternalSuccesses{0};
+    uint64_t cryptoExternalTotalDuration{0};
+    uint64_t cryptoLocalAttempts{0};
+    uint64_t cryptoLocalSuccesses{0};
+
+    // Successful handshakes that were resumptions, 0 to 1
+    double getResumptionRate() const;
+    // Session cache lookups that found the session, 0 to 1
+    double getSessionCacheHitRate() const;
+  };
+
+  CountingSSLStats();
+
+  Snapshot getSnapshot() const;
+
+  // SSLStats
+  void recordSSLAcceptLatency(int64_t latency) noexcept override;
+  void recordTLSTicket(bool ticketNew, bool ticketHit) noexcept override;
+  void recordSSLSession(bool sessionNew, bool sessionHit, bool foreign)
+    noexcept override;
+  void recordSSLSessionRemove() noexcept override;
+  void recordSSLSessionFree(uint32_t freed) noexcept override;
+  void recordSSLSessionSetError(uint32_t err) noexcept override;
+  void recordSSLSessionGetError(uint32_t err) noexcept override;
+  void recordClientRenegotiation() noexcept override;
+  void recordSSLHandshake(bool success,
+                          SSLErrorEnum error,
+                          SSLResumeEnum resume,
+                          const char* cipher,
+                          std::chrono::microseconds latency)
+    noexcept override;
+
+  void recordSSLUpstreamConnection(bool handshake) noexcept override;
+  void recordSSLUpstreamConnectionError(bool verifyError) noexcept override;
+  void recordCryptoSSLExternalAttempt() noexcept override;
+  void recordCryptoSSLExternalConnAlreadyClosed() noexcept override;
+  void recordCryptoSSLExternalApplicationException() noexcept override;
+  void recordCryptoSSLExternalSuccess() noexcept override;
+  void recordCryptoSSLExternalDuration(uint64_t duration) noexcept override;
+  void recordCryptoSSLLocalAttempt() noexcept override;
+  void recordCryptoSSLLocalSuccess() noexcept override;
+
+ private:
+  enum Counter {
+    FULL_HANDSHAKES,
+    SESSION_ID_RESUMPTIONS,
+    TICKET_RESUMPTIONS,
+    HANDSHAKE_ERRORS,
+    HANDSHAKE_TIMEOUTS,
+    HANDSHAKES_DROPPED,
+    SESSIONS_NEW,
+    SESSION_CACHE_HITS,
+    SESSION_CACHE_MISSES,
+    FOREIGN_SESSION_HITS,
+    SESSIONS_REMOVED,
+    SESSIONS_FREED,
+    SESSION_SET_ERRORS,
+    SESSION_GET_ERRORS,
+    TICKETS_ISSUED,
+    TICKET_KEY_HITS,
+    TICKET_KEY_MISSES,
+    CLIENT_RENEGOTIATIONS,
+    UPSTREAM_CONNECTIONS,
+    UPSTREAM_HANDSHAKES,
+    UPSTREAM_ERRORS,
+    UPSTREAM_VERIFY_ERRORS,
+    CRYPTO_EXTERNAL_ATTEMPTS,
+    CRYPTO_EXTERNAL_CONN_ALREADY_CLOSED,
+    CRYPTO_EXTERNAL_APPLICATION_EXCEPTIONS,
+    CRYPTO_EXTERNAL_SUCCESSES,
+    CRYPTO_EXTERNAL_TOTAL_DURATION,
+    CRYPTO_LOCAL_ATTEMPTS,
+    CRYPTO_LOCAL_SUCCESSES,
+    NUM_COUNTERS
+  };
+
+  struct CipherSlot {
+    // OpenSSL's own name for the cipher, which outlives any handshake
+    std::atomic<const char*> name;
+    std::atomic<uint64_t> fullHandshakes;
+    std::atomic<uint64_t> totalLatencyUs;
+  };
+
+  void increment(Counter counter, uint64_t n = 1) {
+    counters_[counter].fetch_add(n, std::memory_order_relaxed);
+  }
+
+  uint64_t get(Counter counter) const {
+    return counters_[counter].load(std::memory_order_relaxed);
+  }
+
+  CipherSlot& getCipherSlot(const char* cipher);
+
+  std::atomic<uint64_t> counters_[NUM_COUNTERS];
+  folly::wangle::TaskLatencyHistogram fullHandshakeLatency_;
+  folly::wangle::TaskLatencyHistogram resumedHandshakeLatency_;
+  folly::wangle::TaskLatencyHistogram acceptLatency_;
+  CipherSlot ciphers_[kMaxCiphers];
+};
+
+}
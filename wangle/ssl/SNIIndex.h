@@ -0,0 +1,125 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/Range.h>
+
+#include <cctype>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace folly {
+
+class SSLContext;
+
+/**
+ * Maps the domain names of certificates to their SSL context for SNI.  Names
+ * are lowercased once when they are added, so a lookup lowercases the
+ * server name into a buffer on the stack, then hashes and compares plain
+ * bytes, without allocating.  A wildcard "*.example.com" is stored as
+ * ".example.com", and matches names exactly one label below it.
+ */
+class SNIIndex {
+ public:
+  // Longest DNS name
+  static const size_t kMaxNameLength = 255;
+
+  /**
+   * Adds a name, with any "*" already stripped off wildcards.  Returns the
+   * context already added for the name, if any, in which case this one
+   * isn't added.
+   */
+  std::shared_ptr<SSLContext> insert(folly::StringPiece name,
+                                     std::shared_ptr<SSLContext> ctx) {
+    char buf[kMaxNameLength];
+    auto key = lowercase(name, buf);
+    if (key.empty()) {
+      return nullptr;
+    }
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+      return it->second;
+    }
+    names_.emplace_back(key.data(), key.size());
+    map_.emplace(folly::StringPiece(names_.back()), std::move(ctx));
+    return nullptr;
+  }
+
+  // The context for exactly this name
+  std::shared_ptr<SSLContext> getExact(folly::StringPiece name) const {
+    char buf[kMaxNameLength];
+    return find(lowercase(name, buf));
+  }
+
+  // The context for a wildcard one level above name
+  std::shared_ptr<SSLContext> getBySuffix(folly::StringPiece name) const {
+    auto dot = name.find('.');
+    if (dot == folly::StringPiece::npos) {
+      return nullptr;
+    }
+    return getExact(name.subpiece(dot));
+  }
+
+  // An exact match, or else a wildcard one; the server name callback's
+  // lookup, which lowercases the name only once
+  std::shared_ptr<SSLContext> get(folly::StringPiece name) const {
+    char buf[kMaxNameLength];
+    auto key = lowercase(name, buf);
+    auto ctx = find(key);
+    if (ctx) {
+      return ctx;
+    }
+    auto dot = key.find('.');
+    if (dot == folly::StringPiece::npos) {
+      return nullptr;
+    }
+    return find(key.subpiece(dot));
+  }
+
+  size_t size() const {
+    return map_.size();
+  }
+
+  void clear() {
+    map_.clear();
+    names_.clear();
+  }
+
+ private:
+  // Empty if the name is too long to be a DNS name
+  static folly::StringPiece lowercase(folly::StringPiece name, char* buf) {
+    if (name.size() > kMaxNameLength) {
+      return folly::StringPiece();
+    }
+    for (size_t i = 0; i < name.size(); i++) {
+      buf[i] = ::tolower(name[i]);
+    }
+    return folly::StringPiece(buf, name.size());
+  }
+
+  std::shared_ptr<SSLContext> find(folly::StringPiece key) const {
+    if (key.empty()) {
+      return nullptr;
+    }
+    auto it = map_.find(key);
+    return it == map_.end() ? nullptr : it->second;
+  }
+
+  // Owns the keys; a deque doesn't move its elements as it grows
+  std::deque<std::string> names_;
+  std::unordered_map<
+    folly::StringPiece,
+    std::shared_ptr<SSLContext>,
+    folly::StringPieceHash> map_;
+};
+
+} // namespace
@@ -11,6 +11,9 @@
 
 #include <chrono>
 #include <cstdint>
+#include <folly/Executor.h>
+#include <memory>
+#include <string>
 
 namespace folly {
 
@@ -18,6 +21,22 @@ struct SSLCacheOptions {
   std::chrono::seconds sslCacheTimeout;
   uint64_t maxSSLCacheSize;
   uint64_t sslCacheFlushSize;
+  // Sessions each thread caches in front of the shared cache; 0 for none
+  uint64_t maxThreadCacheSize;
+  // See SSLSessionCacheManager::setExternalLookupTimeout() and
+  // setMaxPendingLookups(); 0 for no limit
+  std::chrono::milliseconds externalLookupTimeout;
+  uint64_t maxPendingExternalLookups;
+  // Store new sessions in the external cache from this executor instead of
+  // the IO thread, see SSLSessionWriteBehind; sessions beyond
+  // maxWriteBehindQueue waiting are dropped, 0 for no limit
+  std::shared_ptr<folly::Executor> writeBehindExecutor;
+  uint64_t maxWriteBehindQueue;
+  // Keep the local cache across restarts in this file, of at most
+  // maxSnapshotBytes, 0 for SSLSessionCacheSnapshot::kDefaultMaxBytes; see
+  // SSLSessionCacheManager::loadSnapshot()
+  std::string snapshotPath;
+  uint64_t maxSnapshotBytes;
 };
 
 }
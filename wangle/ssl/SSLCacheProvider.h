@@ -11,6 +11,8 @@
 
 #include <folly/io/async/AsyncSSLSocket.h>
 
+#include <vector>
+
 namespace folly {
 
 class SSLSessionCacheManager;
@@ -64,6 +66,25 @@ public:
   virtual bool getAsync(const std::string& sessionId,
                         CacheContext* context) = 0;
 
+  /**
+   * Retrieve several sessions at once, e.g. with one multi-get round trip,
+   * calling back for each of them as getAsync() does.
+   * @param contexts    One per session ID to fetch
+   * @return the contexts whose lookup could not be initiated, which get
+   *         no callback.  By default each session is fetched with
+   *         getAsync().
+   */
+  virtual std::vector<CacheContext*> getMultiAsync(
+      const std::vector<CacheContext*>& contexts) {
+    std::vector<CacheContext*> failed;
+    for (auto context : contexts) {
+      if (!getAsync(context->sessionId, context)) {
+        failed.push_back(context);
+      }
+    }
+    return failed;
+  }
+
 };
 
 }
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/SSLClientSessionCache.h>
+
+#include <ctime>
+
+namespace folly {
+
+SSLClientSessionCache::SSLClientSessionCache(uint32_t maxSize,
+                                             uint32_t shards)
+    // Evicted one at a time, as a client stores a session per handshake
+    : cache_(shards, maxSize, shards) {}
+
+std::string SSLClientSessionCache::getKey(const SocketAddress& address,
+                                          const std::string& serverName) {
+  return address.describe() + "/" + serverName;
+}
+
+SSL_SESSION* SSLClientSessionCache::lookup(const std::string& key) {
+  auto session = cache_.lookupSession(key);
+  if (!session) {
+    return nullptr;
+  }
+  auto expiry = SSL_SESSION_get_time(session) +
+    SSL_SESSION_get_timeout(session);
+  if (expiry <= time(nullptr)) {
+    SSL_SESSION_free(session);
+    cache_.removeSession(key);
+    return nullptr;
+  }
+  return session;
+}
+
+void SSLClientSessionCache::store(const std::string& key,
+                                  SSL_SESSION* session) {
+  cache_.storeSession(key, session, nullptr);
+}
+
+void SSLClientSessionCache::remove(const std::string& key) {
+  cache_.removeSession(key);
+}
+
+} // namespace
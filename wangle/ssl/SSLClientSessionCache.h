@@ -0,0 +1,48 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/ssl/SSLSessionCacheManager.h>
+
+#include <folly/SocketAddress.h>
+
+#include <string>
+
+namespace folly {
+
+/**
+ * The last session of each server a client connected to, with its ticket
+ * if the server sent one, to resume the next connection to it with.  Kept
+ * in a ShardedLocalSSLSessionCache keyed by destination, so the IO threads
+ * share it.  See ClientBootstrap::sslContext().
+ */
+class SSLClientSessionCache : private boost::noncopyable {
+ public:
+  explicit SSLClientSessionCache(uint32_t maxSize = 4096,
+                                 uint32_t shards = 16);
+
+  // A server is the address and the name asked for in SNI, if any
+  static std::string getKey(const SocketAddress& address,
+                            const std::string& serverName);
+
+  // A new reference to the unexpired session of key, or nullptr
+  SSL_SESSION* lookup(const std::string& key);
+
+  // Takes over the caller's reference, replacing any earlier session
+  void store(const std::string& key, SSL_SESSION* session);
+
+  // E.g. once a connection resuming the session fails
+  void remove(const std::string& key);
+
+ private:
+  ShardedLocalSSLSessionCache cache_;
+};
+
+} // namespace
@@ -83,6 +83,9 @@ struct SSLContextConfig {
   std::string eccCurveName;
   // Ciphers to negotiate if TLS version >= 1.1
   std::string tls11Ciphers{""};
+  // TLS 1.3 cipher suites, which OpenSSL configures apart from the others;
+  // empty for OpenSSL's default.  Needs OpenSSL 1.1.1
+  std::string tls13CipherSuites;
   // Weighted lists of NPN strings to advertise
   std::list<folly::SSLContext::NextProtocolsItem>
       nextProtocols;
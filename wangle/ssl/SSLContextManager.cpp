@@ -13,7 +13,9 @@
 #include <wangle/ssl/DHParam.h>
 #include <wangle/ssl/PasswordInFile.h>
 #include <wangle/ssl/SSLCacheOptions.h>
+#include <wangle/ssl/SSLHandshakeAdmission.h>
 #include <wangle/ssl/SSLSessionCacheManager.h>
+#include <wangle/ssl/SSLSessionWriteBehind.h>
 #include <wangle/ssl/SSLUtil.h>
 #include <wangle/ssl/TLSTicketKeyManager.h>
 #include <wangle/ssl/TLSTicketKeySeeds.h>
@@ -21,10 +23,14 @@
 #include <folly/Conv.h>
 #include <folly/ScopeGuard.h>
 #include <folly/String.h>
+#include <algorithm>
 #include <functional>
+#include <limits>
+#include <set>
 #include <openssl/asn1.h>
 #include <openssl/ssl.h>
 #include <string>
+#include <sys/stat.h>
 #include <folly/io/async/EventBase.h>
 
 #define OPENSSL_MISSING_FEATURE(name) \
@@ -142,9 +148,84 @@ std::string flattenList(const std::list<std::string>& list) {
   return s;
 }
 
+// A file's path, with its mtime and size if it exists
+std::string fileFingerprint(const std::string& path) {
+  struct stat st;
+  if (path.empty() || stat(path.c_str(), &st) != 0) {
+    return path;
+  }
+  return folly::to<string>(path, "@", st.st_mtime, "/", st.st_size);
+}
+
+/**
+ * A config's fingerprint: its settings, along with those of its files, so
+ * that replacing a certificate on disk changes it.
+ */
+std::string configFingerprint(const SSLContextConfig& ctxConfig) {
+  auto fingerprint = folly::to<string>(
+    static_cast<int>(ctxConfig.sslVersion), "|",
+    ctxConfig.sessionCacheEnabled, ctxConfig.sessionTicketEnabled,
+    ctxConfig.isLocalPrivateKey, ctxConfig.isDefault, "|",
+    ctxConfig.sslCiphers, "|",
+    ctxConfig.tls11Ciphers, "|",
+    ctxConfig.tls13CipherSuites, "|",
+    ctxConfig.eccCurveName, "|",
+    fileFingerprint(ctxConfig.clientCAFile));
+  for (const auto& item : ctxConfig.nextProtocols) {
+    folly::toAppend("|", item.weight, ":", flattenList(item.protocols),
+                    &fingerprint);
+  }
+  for (const auto& cert : ctxConfig.certificates) {
+    folly::toAppend("|", fileFingerprint(cert.certPath),
+                    ",", fileFingerprint(cert.keyPath),
+                    ",", fileFingerprint(cert.passwordPath),
+                    &fingerprint);
+  }
+  return fingerprint;
+}
+
 }
 
-SSLContextManager::~SSLContextManager() = default;
+/**
+ * A reload in flight.  Owns copies of everything, as loading may happen on
+ * another thread after the caller is gone.
+ */
+struct SSLContextManager::Reload {
+  struct Entry {
+    SSLContextConfig config;
+    std::string fingerprint;
+    std::shared_ptr<SSLContext> ctx;
+    std::string commonName;
+    // To be reused, rather than loaded again
+    bool reused{false};
+  };
+
+  std::vector<Entry> entries;
+  SSLCacheOptions cacheOptions;
+  bool haveTicketSeeds{false};
+  TLSTicketKeySeeds ticketSeeds;
+  folly::SocketAddress vipAddress;
+  std::shared_ptr<SSLCacheProvider> externalCache;
+  uint64_t generation{0};
+  std::exception_ptr error;
+
+  // Loads the entries not being reused
+  void load() {
+    try {
+      for (auto& entry : entries) {
+        if (!entry.reused) {
+          entry.ctx = loadSSLContext(entry.config, entry.commonName);
+        }
+      }
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+};
+
+SSLContextManager::~SSLContextManager() {
+  *alive_ = false;
+}
 
 SSLContextManager::SSLContextManager(
   EventBase* eventBase,
@@ -152,6 +233,7 @@ SSLContextManager::SSLContextManager(
   bool strict,
   SSLStats* stats) :
     stats_(stats),
+    alive_(std::make_shared<bool>(true)),
     eventBase_(eventBase),
     strict_(strict) {
 }
@@ -162,9 +244,192 @@ void SSLContextManager::addSSLContextConfig(
   const TLSTicketKeySeeds* ticketSeeds,
   const folly::SocketAddress& vipAddress,
   const std::shared_ptr<SSLCacheProvider>& externalCache) {
+  auto fingerprint = configFingerprint(ctxConfig);
+  std::string commonName;
+  auto sslCtx = loadSSLContext(ctxConfig, commonName);
+  attachSSLContext(sslCtx, commonName, ctxConfig, cacheOptions, ticketSeeds,
+                   vipAddress, externalCache);
+  fingerprints_[fingerprint] = sslCtx;
+}
+
+void SSLContextManager::resetSSLContextConfigs(
+  const std::vector<SSLContextConfig>& ctxConfigs,
+  const SSLCacheOptions& cacheOptions,
+  const TLSTicketKeySeeds* ticketSeeds,
+  const folly::SocketAddress& vipAddress,
+  const std::shared_ptr<SSLCacheProvider>& externalCache,
+  folly::Executor* loader) {
+  auto reload = std::make_shared<Reload>();
+  reload->cacheOptions = cacheOptions;
+  if (ticketSeeds_) {
+    ticketSeeds = ticketSeeds_.get();
+  }
+  if (ticketSeeds) {
+    reload->haveTicketSeeds = true;
+    reload->ticketSeeds = *ticketSeeds;
+  }
+  reload->vipAddress = vipAddress;
+  reload->externalCache = externalCache;
+  reload->generation = ++reloadGeneration_;
+
+  size_t numReused = 0;
+  std::set<std::string> seen;
+  for (const auto& ctxConfig : ctxConfigs) {
+    Reload::Entry entry;
+    entry.config = ctxConfig;
+    entry.fingerprint = configFingerprint(ctxConfig);
+    // Would share the one context, and its managers, with that before it
+    if (!seen.insert(entry.fingerprint).second) {
+      VLOG(2) << "Skipping a duplicate SSL context config";
+      continue;
+    }
+    auto it = fingerprints_.find(entry.fingerprint);
+    if (it != fingerprints_.end()) {
+      entry.ctx = it->second;
+      entry.reused = true;
+      numReused++;
+    }
+    reload->entries.push_back(std::move(entry));
+  }
+  VLOG(2) << "Reloading SSL contexts: reusing " << numReused << " of "
+          << reload->entries.size();
+
+  if (!loader) {
+    reload->load();
+    swapSSLContexts(*reload);
+    return;
+  }
+
+  CHECK(eventBase_);
+  auto eventBase = eventBase_;
+  auto alive = alive_;
+  loader->add([this, reload, eventBase, alive] {
+    reload->load();
+    eventBase->runInEventBaseThread([this, reload, alive] {
+      if (!*alive) {
+        return;
+      }
+      if (reload->generation != reloadGeneration_) {
+        VLOG(2) << "Dropping SSL context reload overtaken by a later one";
+        return;
+      }
+      try {
+        swapSSLContexts(*reload);
+      } catch (const std::exception& ex) {
+        LOG(ERROR) << "Keeping current SSL contexts: "
+                   << folly::exceptionStr(ex);
+      }
+    });
+  });
+}
+
+void SSLContextManager::swapSSLContexts(Reload& reload) {
+  if (reload.error) {
+    std::rethrow_exception(reload.error);
+  }
+
+  auto oldCtxs = std::move(ctxs_);
+  auto oldSessionCacheManagers = std::move(sessionCacheManagers_);
+  auto oldTicketManagers = std::move(ticketManagers_);
+  auto oldDefaultCtx = std::move(defaultCtx_);
+  auto oldSNIIndex = std::move(sniIndex_);
+  auto oldFingerprints = std::move(fingerprints_);
+  auto oldNoMatchFn = std::move(noMatchFn_);
+  ctxs_.clear();
+  sessionCacheManagers_.clear();
+  ticketManagers_.clear();
+  defaultCtx_.reset();
+  sniIndex_.clear();
+  fingerprints_.clear();
+  noMatchFn_ = nullptr;
+
+  auto findOld = [&] (const std::shared_ptr<SSLContext>& ctx) {
+    auto it = std::find(oldCtxs.begin(), oldCtxs.end(), ctx);
+    CHECK(it != oldCtxs.end());
+    return it - oldCtxs.begin();
+  };
+
+  try {
+    for (auto& entry : reload.entries) {
+      if (entry.reused) {
+        auto i = findOld(entry.ctx);
+        ctxSetupSNI(entry.ctx, entry.config);
+        insert(entry.ctx,
+               std::move(oldSessionCacheManagers[i]),
+               std::move(oldTicketManagers[i]),
+               entry.config.isDefault);
+      } else {
+        attachSSLContext(entry.ctx, entry.commonName, entry.config,
+                         reload.cacheOptions,
+                         reload.haveTicketSeeds ? &reload.ticketSeeds : nullptr,
+                         reload.vipAddress, reload.externalCache);
+      }
+      fingerprints_[entry.fingerprint] = entry.ctx;
+    }
+    if (!defaultCtx_) {
+      throw std::runtime_error("No default X509 among the SSL contexts");
+    }
+  } catch (...) {
+    // Hand the reused contexts' managers back, and put it all back
+    for (size_t i = 0; i < ctxs_.size(); i++) {
+      auto it = std::find(oldCtxs.begin(), oldCtxs.end(), ctxs_[i]);
+      if (it != oldCtxs.end()) {
+        auto j = it - oldCtxs.begin();
+        oldSessionCacheManagers[j] = std::move(sessionCacheManagers_[i]);
+        oldTicketManagers[j] = std::move(ticketManagers_[i]);
+      }
+    }
+    ctxs_ = std::move(oldCtxs);
+    sessionCacheManagers_ = std::move(oldSessionCacheManagers);
+    ticketManagers_ = std::move(oldTicketManagers);
+    defaultCtx_ = std::move(oldDefaultCtx);
+    sniIndex_ = std::move(oldSNIIndex);
+    fingerprints_ = std::move(oldFingerprints);
+    noMatchFn_ = std::move(oldNoMatchFn);
+    throw;
+  }
+
+  // What's left of the old set may still be in use by handshakes
+  for (size_t i = 0; i < oldCtxs.size(); i++) {
+    if (std::find(ctxs_.begin(), ctxs_.end(), oldCtxs[i]) != ctxs_.end()) {
+      continue;
+    }
+    retired_.push_back(RetiredContext{
+      std::move(oldCtxs[i]),
+      std::move(oldSessionCacheManagers[i]),
+      std::move(oldTicketManagers[i])});
+  }
+  // Those no handshake was using go right away
+  purgeRetiredContexts();
+  VLOG(2) << "Swapped in " << ctxs_.size() << " SSL contexts, "
+          << retired_.size() << " retired still in use";
+}
+
+void SSLContextManager::purgeRetiredContexts() {
+  retired_.erase(
+    std::remove_if(retired_.begin(), retired_.end(),
+                   [] (const RetiredContext& retired) {
+                     return retired.ctx.use_count() == 1;
+                   }),
+    retired_.end());
+  if (retired_.empty() || purgeScheduled_ || !eventBase_) {
+    return;
+  }
+  purgeScheduled_ = true;
+  auto alive = alive_;
+  eventBase_->runAfterDelay([this, alive] {
+    if (*alive) {
+      purgeScheduled_ = false;
+      purgeRetiredContexts();
+    }
+  }, kRetiredPurgeIntervalMs);
+}
+
+shared_ptr<SSLContext> SSLContextManager::loadSSLContext(
+  const SSLContextConfig& ctxConfig,
+  std::string& commonName) {
 
   unsigned numCerts = 0;
-  std::string commonName;
   std::string lastCertPath;
   std::unique_ptr<std::list<std::string>> subjectAltName;
   auto sslCtx = std::make_shared<SSLContext>(ctxConfig.sslVersion);
@@ -253,9 +518,6 @@ void SSLContextManager::addSSLContextConfig(
       }
     }
   }
-  if (!ctxConfig.isLocalPrivateKey) {
-    enableAsyncCrypto(sslCtx);
-  }
 
   // Let the server pick the highest performing cipher from among the client's
   // choices.
@@ -306,6 +568,20 @@ void SSLContextManager::addSSLContextConfig(
       throw std::runtime_error(msg);
     }
   }
+  return sslCtx;
+}
+
+void SSLContextManager::attachSSLContext(
+  shared_ptr<SSLContext> sslCtx,
+  const std::string& commonName,
+  const SSLContextConfig& ctxConfig,
+  const SSLCacheOptions& cacheOptions,
+  const TLSTicketKeySeeds* ticketSeeds,
+  const folly::SocketAddress& vipAddress,
+  const std::shared_ptr<SSLCacheProvider>& externalCache) {
+  if (!ctxConfig.isLocalPrivateKey) {
+    enableAsyncCrypto(sslCtx, ctxConfig);
+  }
 
   // - start - SSL session cache config
   // the internal cache never does what we want (per-thread-per-vip).
@@ -327,6 +603,23 @@ void SSLContextManager::addSSLContextConfig(
         eventBase_,
         stats_,
         externalCache);
+    sessionCacheManager->setThreadCacheSize(cacheOptions.maxThreadCacheSize);
+    if (!cacheOptions.snapshotPath.empty()) {
+      SSLSessionCacheManager::loadSnapshot(cacheOptions.snapshotPath,
+                                           cacheOptions.maxSnapshotBytes);
+    }
+    sessionCacheManager->setExternalLookupTimeout(
+      cacheOptions.externalLookupTimeout);
+    sessionCacheManager->setMaxPendingLookups(
+      cacheOptions.maxPendingExternalLookups);
+    if (externalCache && cacheOptions.writeBehindExecutor) {
+      sessionCacheManager->setWriteBehind(SSLSessionWriteBehind::create(
+        externalCache,
+        cacheOptions.writeBehindExecutor,
+        cacheOptions.maxWriteBehindQueue > 0 ?
+          cacheOptions.maxWriteBehindQueue :
+          std::numeric_limits<size_t>::max()));
+    }
   }
   // - end - SSL session cache config
 
@@ -355,6 +648,11 @@ SSLContext::ServerNameCallbackResult
 SSLContextManager::serverNameCallback(SSL* ssl) {
   shared_ptr<SSLContext> ctx;
 
+  // Before any private key operation, which is what a full handshake costs
+  if (handshakeAdmission_ && !handshakeAdmission_->admit(ssl)) {
+    return SSLContext::SERVER_NAME_NOT_FOUND_ALERT_FATAL;
+  }
+
   const char* sn = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
   if (!sn) {
     VLOG(6) << "Server Name (tlsext_hostname) is missing";
@@ -370,21 +668,10 @@ SSLContextManager::serverNameCallback(SSL* ssl) {
   AsyncSSLSocket* sslSocket = AsyncSSLSocket::getFromSSL(ssl);
   CHECK(sslSocket);
 
-  DNString dnstr(sn, snLen);
-
   uint32_t count = 0;
   do {
-    // Try exact match first
-    ctx = getSSLCtx(dnstr);
-    if (ctx) {
-      sslSocket->switchServerSSLContext(ctx);
-      if (clientHelloTLSExtStats_) {
-        clientHelloTLSExtStats_->recordMatch();
-      }
-      return SSLContext::SERVER_NAME_FOUND;
-    }
-
-    ctx = getSSLCtxBySuffix(dnstr);
+    // Exact match first, then a wildcard one level up
+    ctx = sniIndex_.get(folly::StringPiece(sn, snLen));
     if (ctx) {
       sslSocket->switchServerSSLContext(ctx);
       if (clientHelloTLSExtStats_) {
@@ -451,6 +738,21 @@ SSLContextManager::ctxSetupByOpensslFeature(
 #endif
   }
 
+  // TLS 1.3, which SSLContext's SSLv23 method negotiates where OpenSSL has
+  // it.  Early data stays off, OpenSSL's default, as AsyncSSLSocket has no
+  // SSL_read_early_data() path to take it
+  if (!ctxConfig.tls13CipherSuites.empty()) {
+#ifdef TLS1_3_VERSION
+    if (!SSL_CTX_set_ciphersuites(sslCtx->getSSLCtx(),
+                                  ctxConfig.tls13CipherSuites.c_str())) {
+      throw std::runtime_error(folly::to<string>(
+        "Invalid TLS 1.3 cipher suites: ", ctxConfig.tls13CipherSuites));
+    }
+#else
+    OPENSSL_MISSING_FEATURE(TLS13);
+#endif
+  }
+
   // NPN (Next Protocol Negotiation)
   if (!ctxConfig.nextProtocols.empty()) {
 #ifdef OPENSSL_NPN_NEGOTIATED
@@ -460,7 +762,13 @@ SSLContextManager::ctxSetupByOpensslFeature(
 #endif
   }
 
-  // SNI
+  ctxSetupSNI(sslCtx, ctxConfig);
+}
+
+void
+SSLContextManager::ctxSetupSNI(
+  shared_ptr<folly::SSLContext> sslCtx,
+  const SSLContextConfig& ctxConfig) {
 #ifdef PROXYGEN_HAVE_SERVERNAMECALLBACK
   noMatchFn_ = ctxConfig.sniNoMatchFn;
   if (ctxConfig.isDefault) {
@@ -482,8 +790,8 @@ SSLContextManager::ctxSetupByOpensslFeature(
 
 void
 SSLContextManager::insert(shared_ptr<SSLContext> sslCtx,
-                          std::unique_ptr<SSLSessionCacheManager> smanager,
-                          std::unique_ptr<TLSTicketKeyManager> tmanager,
+                          std::unique_ptr<SSLSessionCacheManager>&& smanager,
+                          std::unique_ptr<TLSTicketKeyManager>&& tmanager,
                           bool defaultFallback) {
   X509* x509 = getX509(sslCtx->getSSLCtx());
   auto guard = folly::makeGuard([x509] { X509_free(x509); });
@@ -584,51 +892,45 @@ SSLContextManager::insertSSLCtxByDomainNameImpl(const char* dn, size_t len,
                     "(after removing any preceding '*')");
   }
 
-  DNString dnstr(dn, len);
-  const auto v = dnMap_.find(dnstr);
-  if (v == dnMap_.end()) {
-    dnMap_.emplace(dnstr, sslCtx);
-  } else if (v->second == sslCtx) {
+  auto existing = sniIndex_.insert(folly::StringPiece(dn, len), sslCtx);
+  if (!existing) {
+    return;
+  } else if (existing == sslCtx) {
     VLOG(6)<< "Duplicate CN or subject alternative name found in the same X509."
       "  Ignore the later name.";
   } else {
     throw std::runtime_error("Duplicate CN or subject alternative name found: \"" +
-                             std::string(dnstr.c_str()) + "\"");
+                             std::string(dn, len) + "\"");
   }
 }
 
 shared_ptr<SSLContext>
 SSLContextManager::getSSLCtxBySuffix(const DNString& dnstr) const
 {
-  size_t dot;
-
-  if ((dot = dnstr.find_first_of(".")) != DNString::npos) {
-    DNString suffixDNStr(dnstr, dot);
-    const auto v = dnMap_.find(suffixDNStr);
-    if (v != dnMap_.end()) {
-      VLOG(6) << folly::stringPrintf("\"%s\" is a willcard match to \"%s\"",
-                                     dnstr.c_str(), suffixDNStr.c_str());
-      return v->second;
-    }
+  auto ctx = sniIndex_.getBySuffix(folly::StringPiece(dnstr.data(),
+                                                      dnstr.size()));
+  if (ctx) {
+    VLOG(6) << folly::stringPrintf("\"%s\" is a willcard match",
+                                   dnstr.c_str());
+  } else {
+    VLOG(6) << folly::stringPrintf("\"%s\" is not a wildcard match",
+                                   dnstr.c_str());
   }
-
-  VLOG(6) << folly::stringPrintf("\"%s\" is not a wildcard match",
-                                 dnstr.c_str());
-  return shared_ptr<SSLContext>();
+  return ctx;
 }
 
 shared_ptr<SSLContext>
 SSLContextManager::getSSLCtx(const DNString& dnstr) const
 {
-  const auto v = dnMap_.find(dnstr);
-  if (v == dnMap_.end()) {
+  auto ctx = sniIndex_.getExact(folly::StringPiece(dnstr.data(),
+                                                   dnstr.size()));
+  if (ctx) {
+    VLOG(6) << folly::stringPrintf("\"%s\" is an exact match", dnstr.c_str());
+  } else {
     VLOG(6) << folly::stringPrintf("\"%s\" is not an exact match",
                                    dnstr.c_str());
-    return shared_ptr<SSLContext>();
-  } else {
-    VLOG(6) << folly::stringPrintf("\"%s\" is an exact match", dnstr.c_str());
-    return v->second;
   }
+  return ctx;
 }
 
 shared_ptr<SSLContext>
@@ -641,6 +943,12 @@ SSLContextManager::reloadTLSTicketKeys(
   const std::vector<std::string>& oldSeeds,
   const std::vector<std::string>& currentSeeds,
   const std::vector<std::string>& newSeeds) {
+  if (!ticketSeeds_) {
+    ticketSeeds_ = folly::make_unique<TLSTicketKeySeeds>();
+  }
+  ticketSeeds_->oldSeeds = oldSeeds;
+  ticketSeeds_->currentSeeds = currentSeeds;
+  ticketSeeds_->newSeeds = newSeeds;
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
   for (auto& tmgr: ticketManagers_) {
     tmgr->setTLSTicketKeySeeds(oldSeeds, currentSeeds, newSeeds);
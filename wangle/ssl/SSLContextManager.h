@@ -9,14 +9,18 @@
  */
 #pragma once
 
+#include <folly/Executor.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/SSLContext.h>
 
 #include <glog/logging.h>
 #include <list>
+#include <map>
 #include <memory>
 #include <wangle/ssl/SSLContextConfig.h>
 #include <wangle/ssl/SSLSessionCacheManager.h>
+#include <wangle/ssl/AsyncCryptoProvider.h>
+#include <wangle/ssl/SNIIndex.h>
 #include <wangle/ssl/TLSTicketKeySeeds.h>
 #include <wangle/acceptor/DomainNameMisc.h>
 #include <vector>
@@ -27,6 +31,7 @@ class SocketAddress;
 class SSLContext;
 class ClientHelloExtStats;
 struct SSLCacheOptions;
+class SSLHandshakeAdmission;
 class SSLStats;
 class TLSTicketKeyManager;
 struct TLSTicketKeySeeds;
@@ -58,6 +63,48 @@ class SSLContextManager {
     const folly::SocketAddress& vipAddress,
     const std::shared_ptr<SSLCacheProvider> &externalCache);
 
+  /**
+   * Replace the current X509s with those in ctxConfigs, e.g. after
+   * certificates were renewed on disk.  A config whose settings and files
+   * (by mtime and size) are unchanged since it was added keeps its
+   * SSLContext, along with the session cache and ticket keys of that
+   * context; only the others are loaded again.  Loading, which parses
+   * certificates and keys, happens on loader if given, and the new set is
+   * swapped in later in this manager's EventBase; otherwise it all happens
+   * here.  Must be called in the manager's EventBase thread.
+   *
+   * Configs identical to one before them in ctxConfigs are skipped.
+   * Handshakes under way keep the SSLContext they started with, which stays
+   * alive, along with its session cache, until they are done.  If any
+   * config fails to load, the current set stays; the error is thrown, or
+   * logged when loading on loader.  Of overlapping reloads, only the last
+   * one is swapped in.
+   *
+   * cacheOptions, ticketSeeds and externalCache only apply to the contexts
+   * that are loaded again.  Once reloadTLSTicketKeys() has been called, the
+   * seeds it was given are used instead of ticketSeeds.
+   */
+  void resetSSLContextConfigs(
+    const std::vector<SSLContextConfig>& ctxConfigs,
+    const SSLCacheOptions& cacheOptions,
+    const TLSTicketKeySeeds* ticketSeeds,
+    const folly::SocketAddress& vipAddress,
+    const std::shared_ptr<SSLCacheProvider>& externalCache,
+    folly::Executor* loader = nullptr);
+
+  // Those new connections get, and those only handshakes under way still
+  // use, since the last reset
+  size_t getNumSSLContexts() const {
+    return ctxs_.size();
+  }
+
+  size_t getNumRetiredSSLContexts() const {
+    return retired_.size();
+  }
+
+  // How often those are checked for handshakes still using them
+  static const uint32_t kRetiredPurgeIntervalMs = 1000;
+
   /**
    * Get the default SSL_CTX for a VIP
    */
@@ -101,7 +148,34 @@ class SSLContextManager {
     clientHelloTLSExtStats_ = stats;
   }
 
+  /**
+   * Performs the private key operations of contexts whose key isn't local;
+   * has to be set before adding any of those.
+   */
+  void setAsyncCryptoProvider(std::shared_ptr<AsyncCryptoProvider> provider) {
+    asyncCryptoProvider_ = std::move(provider);
+  }
+
+  /**
+   * Ask admission, at each ClientHello, whether to go on with the
+   * handshake; nullptr for no admission control.  Needs SNI support.
+   */
+  void setHandshakeAdmission(SSLHandshakeAdmission* admission) {
+    handshakeAdmission_ = admission;
+  }
+
  protected:
+  virtual void enableAsyncCrypto(
+    const std::shared_ptr<SSLContext>& sslCtx,
+    const SSLContextConfig& ctxConfig) {
+    if (asyncCryptoProvider_) {
+      asyncCryptoProvider_->enableAsyncCrypto(sslCtx, ctxConfig);
+    } else {
+      enableAsyncCrypto(sslCtx);
+    }
+  }
+  // For subclasses that predate AsyncCryptoProvider; overriding just this
+  // one hides the other, so they need a using-declaration for it too
   virtual void enableAsyncCrypto(
     const std::shared_ptr<SSLContext>& sslCtx) {
     LOG(FATAL) << "Unsupported in base SSLContextManager";
@@ -111,10 +185,46 @@ class SSLContextManager {
  private:
   SSLContextManager(const SSLContextManager&) = delete;
 
+  struct Reload;
+
+  /**
+   * Loads the certificates and keys of ctxConfig into a new SSLContext and
+   * sets its options; touches nothing else, so may run on any thread.
+   * Sets commonName to that of the certificates.
+   */
+  static std::shared_ptr<SSLContext> loadSSLContext(
+    const SSLContextConfig& ctxConfig,
+    std::string& commonName);
+
+  /**
+   * Sets up the session cache and ticket keys of a loaded SSLContext and
+   * adds it for SNI.
+   */
+  void attachSSLContext(
+    std::shared_ptr<SSLContext> sslCtx,
+    const std::string& commonName,
+    const SSLContextConfig& ctxConfig,
+    const SSLCacheOptions& cacheOptions,
+    const TLSTicketKeySeeds* ticketSeeds,
+    const folly::SocketAddress& vipAddress,
+    const std::shared_ptr<SSLCacheProvider>& externalCache);
+
+  // Swaps in the contexts of a reload, once they are all loaded
+  void swapSSLContexts(Reload& reload);
+
+  // Frees the retired contexts no handshake uses any longer, and checks
+  // again later while some still are
+  void purgeRetiredContexts();
+
   void ctxSetupByOpensslFeature(
     std::shared_ptr<SSLContext> sslCtx,
     const SSLContextConfig& ctxConfig);
 
+  // The part of ctxSetupByOpensslFeature to redo for a reused context
+  void ctxSetupSNI(
+    std::shared_ptr<SSLContext> sslCtx,
+    const SSLContextConfig& ctxConfig);
+
   /**
    * Callback function from openssl to find the right X509 to
    * use during SSL handshake
@@ -137,9 +247,9 @@ class SSLContextManager {
    *    The wildcard name must be _prefixed_ by '*.'.  It errors out whenever
    *    it sees '*' in any other locations.
    *
-   * 3. It uses one std::unordered_map<DomainName, SSL_CTX> object to
-   *    do this.  For wildcard name like "*.facebook.com", ".facebook.com"
-   *    is used as the key.
+   * 3. It uses one SNIIndex, a hash map of lowercased names, to do this.
+   *    For wildcard name like "*.facebook.com", ".facebook.com" is used
+   *    as the key.
    *
    * 4. After getting tlsext_hostname from the client hello message, it
    *    will do a full string search first and then try one level up to
@@ -148,10 +258,12 @@ class SSLContextManager {
    *     domain name with the wildcard name in the server X509].
    */
 
+  // Takes the managers only once nothing can throw, so a failed insert
+  // leaves them with the caller
   void insert(
     std::shared_ptr<SSLContext> sslCtx,
-    std::unique_ptr<SSLSessionCacheManager> cmanager,
-    std::unique_ptr<TLSTicketKeyManager> tManager,
+    std::unique_ptr<SSLSessionCacheManager>&& cmanager,
+    std::unique_ptr<TLSTicketKeyManager>&& tManager,
     bool defaultFallback);
 
   /**
@@ -165,18 +277,42 @@ class SSLContextManager {
 
   std::shared_ptr<SSLContext> defaultCtx_;
 
+  /**
+   * The context of each config, by what the config and its files were when
+   * the context was loaded, for resetSSLContextConfigs to reuse
+   */
+  std::map<std::string, std::shared_ptr<SSLContext>> fingerprints_;
+
+  /**
+   * Contexts no longer in use for new connections, kept with their session
+   * cache and ticket key managers until the handshakes using them are done
+   */
+  struct RetiredContext {
+    std::shared_ptr<SSLContext> ctx;
+    std::unique_ptr<SSLSessionCacheManager> sessionCacheManager;
+    std::unique_ptr<TLSTicketKeyManager> ticketManager;
+  };
+  std::vector<RetiredContext> retired_;
+  bool purgeScheduled_{false};
+
+  // The seeds of the last reloadTLSTicketKeys(), for contexts loaded later
+  std::unique_ptr<TLSTicketKeySeeds> ticketSeeds_;
+
+  // Tells reloads loading on another thread whether this is still around
+  std::shared_ptr<bool> alive_;
+  uint64_t reloadGeneration_{0};
+
   /**
    * Container to store the (DomainName -> SSL_CTX) mapping
    */
-  std::unordered_map<
-    DNString,
-    std::shared_ptr<SSLContext>,
-    DNStringHash> dnMap_;
+  SNIIndex sniIndex_;
 
   EventBase* eventBase_;
   ClientHelloExtStats* clientHelloTLSExtStats_{nullptr};
+  SSLHandshakeAdmission* handshakeAdmission_{nullptr};
   SSLContextConfig::SNINoMatchFn noMatchFn_;
   bool strict_{true};
+  std::shared_ptr<AsyncCryptoProvider> asyncCryptoProvider_;
 };
 
 } // namespace
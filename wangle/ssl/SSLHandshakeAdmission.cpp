@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/SSLHandshakeAdmission.h>
+
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <glog/logging.h>
+
+namespace folly {
+
+bool SSLHandshakeAdmission::admit(SSL* ssl) {
+  auto sock = AsyncSSLSocket::getFromSSL(ssl);
+  auto it = pending_.find(sock);
+  if (it == pending_.end()) {
+    // Not one of the acceptor's handshakes
+    return true;
+  }
+  auto delay = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - it->second.acceptTime);
+  if (admit(delay, SSL_session_reused(ssl))) {
+    return true;
+  }
+  it->second.shed = true;
+  return false;
+}
+
+bool SSLHandshakeAdmission::admit(std::chrono::microseconds delay,
+                                  bool resumed) {
+  bool overloaded = codel_.overloaded(delay);
+  if (!overloaded || resumed) {
+    return true;
+  }
+  VLOG(4) << "Turning away full SSL handshake after "
+          << delay.count() << "us in queue";
+  numShed_++;
+  return false;
+}
+
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/concurrent/Codel.h>
+
+#include <openssl/ssl.h>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+
+namespace folly {
+
+class AsyncSSLSocket;
+
+/**
+ * Admission control for the SSL handshakes of one acceptor, sized by how
+ * busy its thread actually is rather than by a count.  Each handshake's
+ * queueing delay, from accept until its ClientHello gets processed, is fed
+ * to Codel; this grows with the CPU the handshakes ahead of it take, so a
+ * few full RSA handshakes weigh as much as many resumptions.  While Codel
+ * reports a standing queue, full handshakes are turned away at the
+ * ClientHello, before any private key operation, and resumptions (by
+ * session ID or ticket), which are cheap, still go through.  That drains
+ * the queue again, after which full handshakes are let back in.
+ *
+ * Used from the acceptor's thread only.
+ */
+class SSLHandshakeAdmission {
+ public:
+  // A handshake was accepted at acceptTime
+  void onAccept(const AsyncSSLSocket* sock,
+                std::chrono::steady_clock::time_point acceptTime) {
+    pending_[sock] = Pending{acceptTime, false};
+  }
+
+  /**
+   * Whether to go on with the handshake whose ClientHello, for ssl, is
+   * being processed.
+   */
+  bool admit(SSL* ssl);
+
+  /**
+   * Whether to go on with a handshake that waited delay for its ClientHello
+   * to be processed.  Feeds delay to Codel.
+   */
+  bool admit(std::chrono::microseconds delay, bool resumed);
+
+  /**
+   * The handshake on sock is done, one way or the other.  Returns whether
+   * it was turned away by admit().
+   */
+  bool onHandshakeDone(const AsyncSSLSocket* sock) {
+    auto it = pending_.find(sock);
+    if (it == pending_.end()) {
+      return false;
+    }
+    bool shed = it->second.shed;
+    pending_.erase(it);
+    return shed;
+  }
+
+  // Full handshakes turned away
+  uint64_t getNumShed() const {
+    return numShed_;
+  }
+
+  // How close the queue is to where shedding starts, 0 to 100
+  int getLoad() {
+    return codel_.getLoad();
+  }
+
+ private:
+  struct Pending {
+    std::chrono::steady_clock::time_point acceptTime;
+    bool shed;
+  };
+
+  folly::wangle::Codel codel_;
+  std::unordered_map<const AsyncSSLSocket*, Pending> pending_;
+  uint64_t numShed_{0};
+};
+
+}
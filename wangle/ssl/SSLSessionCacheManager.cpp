@@ -10,10 +10,14 @@
 #include <wangle/ssl/SSLSessionCacheManager.h>
 
 #include <wangle/ssl/SSLCacheProvider.h>
+#include <wangle/ssl/SSLSessionCacheSnapshot.h>
 #include <wangle/ssl/SSLStats.h>
 #include <wangle/ssl/SSLUtil.h>
 
+#include <algorithm>
+#include <thread>
 #include <folly/io/async/EventBase.h>
+#include <folly/tracing/StaticTracepoint.h>
 
 #ifndef NO_LIB_GFLAGS
 #include <gflags/gflags.h>
@@ -24,7 +28,7 @@ using std::shared_ptr;
 
 namespace {
 
-const uint32_t NUM_CACHE_BUCKETS = 16;
+const uint32_t NUM_CACHE_BUCKETS = 64;
 
 // We use the default ID generator which fills the maximum ID length
 // for the protocol.  16 bytes for SSLv2 or 32 for SSLv3+
@@ -44,22 +48,130 @@ namespace folly {
 int SSLSessionCacheManager::sExDataIndex_ = -1;
 shared_ptr<ShardedLocalSSLSessionCache> SSLSessionCacheManager::sCache_;
 std::mutex SSLSessionCacheManager::sCacheLock_;
+string SSLSessionCacheManager::sSnapshotPath_;
+uint64_t SSLSessionCacheManager::sMaxSnapshotBytes_ = 0;
 
 LocalSSLSessionCache::LocalSSLSessionCache(uint32_t maxCacheSize,
                                            uint32_t cacheCullSize)
-    : sessionCache(maxCacheSize, cacheCullSize) {
-  sessionCache.setPruneHook(std::bind(
-                              &LocalSSLSessionCache::pruneSessionCallback,
-                              this, std::placeholders::_1,
-                              std::placeholders::_2));
+    : slots_(maxCacheSize),
+      cullSize_(std::max<uint32_t>(cacheCullSize, 1)) {
+  index_.reserve(maxCacheSize);
+  freeSlots_.reserve(maxCacheSize);
+  for (size_t i = maxCacheSize; i > 0; i--) {
+    freeSlots_.push_back(i - 1);
+  }
+}
+
+LocalSSLSessionCache::~LocalSSLSessionCache() {
+  for (auto& slot : slots_) {
+    if (slot.session) {
+      SSL_SESSION_free(slot.session);
+    }
+  }
+}
+
+SSL_SESSION* LocalSSLSessionCache::lookupSession(const string& sessionId) {
+  folly::RWSpinLock::ReadHolder g(lock_);
+  auto itr = index_.find(sessionId);
+  if (itr == index_.end()) {
+    return nullptr;
+  }
+  auto& slot = slots_[itr->second];
+  // Only store when it changes, not to bounce the cache line around
+  if (!slot.referenced.load(std::memory_order_relaxed)) {
+    slot.referenced.store(true, std::memory_order_relaxed);
+  }
+  CRYPTO_add(&slot.session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+  return slot.session;
+}
+
+uint32_t LocalSSLSessionCache::storeSession(const string& sessionId,
+                                            SSL_SESSION* session) {
+  if (!session) {
+    return 0;
+  }
+  folly::RWSpinLock::WriteHolder g(lock_);
+  auto itr = index_.find(sessionId);
+  if (itr != index_.end()) {
+    // This can happen in race conditions
+    auto& slot = slots_[itr->second];
+    SSL_SESSION_free(slot.session);
+    slot.session = session;
+    slot.referenced.store(true, std::memory_order_relaxed);
+    return 0;
+  }
+
+  uint32_t removed = 0;
+  if (freeSlots_.empty()) {
+    // Make room for the next few sessions as well
+    for (uint32_t i = 0; i < cullSize_ && index_.size() > 0; i++) {
+      freeSlots_.push_back(evictOne());
+      ++removed;
+    }
+  }
+  auto i = freeSlots_.back();
+  freeSlots_.pop_back();
+  auto& slot = slots_[i];
+  slot.sessionId = sessionId;
+  slot.session = session;
+  // New sessions get one trip around the clock before being evicted
+  slot.referenced.store(true, std::memory_order_relaxed);
+  index_.emplace(sessionId, i);
+  return removed;
+}
+
+void LocalSSLSessionCache::removeSession(const string& sessionId) {
+  folly::RWSpinLock::WriteHolder g(lock_);
+  auto itr = index_.find(sessionId);
+  if (itr != index_.end()) {
+    auto i = itr->second;
+    index_.erase(itr);
+    clearSlot(i);
+    freeSlots_.push_back(i);
+  }
+}
+
+size_t LocalSSLSessionCache::size() {
+  folly::RWSpinLock::ReadHolder g(lock_);
+  return index_.size();
 }
 
-void LocalSSLSessionCache::pruneSessionCallback(const string& sessionId,
-                                                SSL_SESSION* session) {
+void LocalSSLSessionCache::snapshot(
+    std::vector<std::pair<string, SSL_SESSION*>>& out) {
+  folly::RWSpinLock::ReadHolder g(lock_);
+  for (const auto& entry : index_) {
+    auto session = slots_[entry.second].session;
+    CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+    out.emplace_back(entry.first, session);
+  }
+}
+
+size_t LocalSSLSessionCache::evictOne() {
+  while (true) {
+    auto i = hand_;
+    hand_ = (hand_ + 1) % slots_.size();
+    auto& slot = slots_[i];
+    if (!slot.session) {
+      continue;
+    }
+    if (slot.referenced.load(std::memory_order_relaxed)) {
+      slot.referenced.store(false, std::memory_order_relaxed);
+      continue;
+    }
+    index_.erase(slot.sessionId);
+    clearSlot(i);
+    return i;
+  }
+}
+
+void LocalSSLSessionCache::clearSlot(size_t i) {
+  auto& slot = slots_[i];
   VLOG(4) << "Free SSL session from local cache; id="
-          << SSLUtil::hexlify(sessionId);
-  SSL_SESSION_free(session);
-  ++removedSessions_;
+          << SSLUtil::hexlify(slot.sessionId);
+  SSL_SESSION_free(slot.session);
+  slot.session = nullptr;
+  slot.sessionId.clear();
+  slot.referenced.store(false, std::memory_order_relaxed);
 }
 
 
@@ -76,7 +188,8 @@ SSLSessionCacheManager::SSLSessionCacheManager(
   const std::shared_ptr<SSLCacheProvider>& externalCache):
     ctx_(ctx),
     stats_(stats),
-    externalCache_(externalCache) {
+    externalCache_(externalCache),
+    eventBase_(eventBase) {
 
   SSL_CTX* sslCtx = ctx->getSSLCtx();
 
@@ -104,13 +217,105 @@ SSLSessionCacheManager::SSLSessionCacheManager(
 }
 
 SSLSessionCacheManager::~SSLSessionCacheManager() {
+  // Lookups batched but not yet sent
+  lookupBatch_.cancelLoopCallback();
+  for (auto cacheCtx : lookupBatch_.contexts) {
+    delete cacheCtx;
+  }
+  if (threadCache_) {
+    // EvictingCacheMap dtor doesn't free values
+    threadCache_->clear();
+  }
+}
+
+void SSLSessionCacheManager::setThreadCacheSize(size_t size) {
+  if (threadCache_) {
+    threadCache_->clear();
+    threadCache_.reset();
+  }
+  if (size == 0) {
+    return;
+  }
+  threadCache_.reset(new ThreadCache(size));
+  threadCache_->setPruneHook([] (const string&, SSL_SESSION* session) {
+    SSL_SESSION_free(session);
+  });
+}
+
+SSL_SESSION* SSLSessionCacheManager::lookupThreadCache(
+    const string& sessionId) {
+  if (!threadCache_) {
+    return nullptr;
+  }
+  auto itr = threadCache_->find(sessionId);
+  if (itr == threadCache_->end()) {
+    return nullptr;
+  }
+  CRYPTO_add(&itr->second->references, 1, CRYPTO_LOCK_SSL_SESSION);
+  return itr->second;
+}
+
+void SSLSessionCacheManager::storeThreadCache(const string& sessionId,
+                                              SSL_SESSION* session) {
+  if (!threadCache_ || !session) {
+    return;
+  }
+  removeThreadCache(sessionId);
+  CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+  threadCache_->set(sessionId, session);
+}
+
+void SSLSessionCacheManager::removeThreadCache(const string& sessionId) {
+  if (!threadCache_) {
+    return;
+  }
+  auto itr = threadCache_->find(sessionId);
+  if (itr != threadCache_->end()) {
+    // EvictingCacheMap doesn't free on erase or overwrite
+    SSL_SESSION_free(itr->second);
+    threadCache_->erase(sessionId);
+  }
 }
 
 void SSLSessionCacheManager::shutdown() {
   std::lock_guard<std::mutex> g(sCacheLock_);
+  if (sCache_ && !sSnapshotPath_.empty()) {
+    try {
+      auto saved = SSLSessionCacheSnapshot::save(
+        *sCache_, sSnapshotPath_, sMaxSnapshotBytes_);
+      VLOG(2) << "Saved " << saved << " SSL sessions to " << sSnapshotPath_;
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Can't save SSL sessions to " << sSnapshotPath_ << ": "
+                 << ex.what();
+    }
+  }
   sCache_.reset();
 }
 
+void SSLSessionCacheManager::loadSnapshot(const string& path,
+                                          uint64_t maxBytes) {
+  std::shared_ptr<ShardedLocalSSLSessionCache> cache;
+  {
+    std::lock_guard<std::mutex> g(sCacheLock_);
+    if (!sSnapshotPath_.empty() || !sCache_) {
+      return;
+    }
+    sSnapshotPath_ = path;
+    sMaxSnapshotBytes_ = maxBytes;
+    cache = sCache_;
+  }
+  // Decoding takes a while for a large cache, and the IO threads are busy
+  std::thread([cache, path, maxBytes]() {
+    try {
+      auto loaded = SSLSessionCacheSnapshot::load(*cache, path, maxBytes);
+      VLOG(2) << "Loaded " << loaded << " SSL sessions from " << path;
+    } catch (const std::exception& ex) {
+      LOG(WARNING) << "Can't load SSL sessions from " << path << ": "
+                   << ex.what();
+    }
+  }).detach();
+}
+
 shared_ptr<ShardedLocalSSLSessionCache> SSLSessionCacheManager::getLocalCache(
   uint32_t maxCacheSize,
   uint32_t cacheCullSize) {
@@ -145,12 +350,19 @@ int SSLSessionCacheManager::newSession(SSL* ssl, SSL_SESSION* session) {
     stats_->recordSSLSession(true /* new session */, false, false);
   }
 
+  // Before the local cache owns it, and another thread may evict it
+  storeThreadCache(sessionId, session);
   localCache_->storeSession(sessionId, session, stats_);
 
   if (externalCache_) {
     VLOG(4) << "New SSL session: send session to external cache; id=" <<
       SSLUtil::hexlify(sessionId);
-    storeCacheRecord(sessionId, session);
+    if (writeBehind_) {
+      writeBehind_->add(sessionId, session, std::chrono::seconds(
+        SSL_CTX_get_timeout(ctx_->getSSLCtx())));
+    } else {
+      storeCacheRecord(sessionId, session);
+    }
   }
 
   return 1;
@@ -177,6 +389,7 @@ void SSLSessionCacheManager::removeSession(SSL_CTX* ctx,
   // never be called
   VLOG(3) << "Remove SSL session; id=" << SSLUtil::hexlify(sessionId);
 
+  removeThreadCache(sessionId);
   localCache_->removeSession(sessionId);
 
   if (stats_) {
@@ -219,8 +432,17 @@ SSL_SESSION* SSLSessionCacheManager::getSession(SSL* ssl,
 
   assert(sslSocket != nullptr);
 
-  // look it up in the local cache first
-  session = localCache_->lookupSession(sessionId);
+  // look it up in the thread's cache and then in the local cache first
+  session = lookupThreadCache(sessionId);
+  if (session) {
+    ++cacheStats_.threadCacheHits;
+  } else {
+    session = localCache_->lookupSession(sessionId);
+    if (session) {
+      ++cacheStats_.localCacheHits;
+      storeThreadCache(sessionId, session);
+    }
+  }
 #ifdef SSL_SESSION_CB_WOULD_BLOCK
   if (session == nullptr && externalCache_) {
     // external cache might have the session
@@ -230,17 +452,23 @@ SSL_SESSION* SSLSessionCacheManager::getSession(SSL* ssl,
     } else {
       PendingLookupMap::iterator pit = pendingLookups_.find(sessionId);
       if (pit == pendingLookups_.end()) {
-        auto result = pendingLookups_.emplace(sessionId, PendingLookup());
-        // initiate fetch
-        VLOG(4) << "Get SSL session [Pending]: Initiate Fetch; fd=" <<
-          sslSocket->getFd() << " id=" << SSLUtil::hexlify(sessionId);
-        if (lookupCacheRecord(sessionId, sslSocket)) {
-          // response is pending
-          *copyflag = SSL_SESSION_CB_WOULD_BLOCK;
-          return nullptr;
+        if (maxPendingLookups_ > 0 &&
+            pendingLookups_.size() >= maxPendingLookups_) {
+          missReason = "reason: too many pending lookups;";
         } else {
-          missReason = "reason: failed to send lookup request;";
-          pendingLookups_.erase(result.first);
+          auto result = pendingLookups_.emplace(sessionId, PendingLookup());
+          // initiate fetch
+          VLOG(4) << "Get SSL session [Pending]: Initiate Fetch; fd=" <<
+            sslSocket->getFd() << " id=" << SSLUtil::hexlify(sessionId);
+          if (lookupCacheRecord(sessionId, sslSocket, result.first->second)) {
+            // response is pending
+            FOLLY_SDT(wangle, ssl_session_lookup_pending, sslSocket->getFd());
+            *copyflag = SSL_SESSION_CB_WOULD_BLOCK;
+            return nullptr;
+          } else {
+            missReason = "reason: failed to send lookup request;";
+            pendingLookups_.erase(result.first);
+          }
         }
       } else {
         // A lookup was already initiated from this thread
@@ -259,6 +487,7 @@ SSL_SESSION* SSLSessionCacheManager::getSession(SSL* ssl,
         session = pit->second.session; // nullptr if our friend didn't have it
         if (session != nullptr) {
           CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+          ++cacheStats_.externalCacheHits;
         }
       }
     }
@@ -266,6 +495,10 @@ SSL_SESSION* SSLSessionCacheManager::getSession(SSL* ssl,
 #endif
 
   bool hit = (session != nullptr);
+  if (!hit) {
+    ++cacheStats_.misses;
+  }
+  FOLLY_SDT(wangle, ssl_session_lookup, sslSocket->getFd(), hit, foreign);
   if (stats_) {
     stats_->recordSSLSession(false, hit, foreign);
   }
@@ -298,7 +531,8 @@ bool SSLSessionCacheManager::storeCacheRecord(const string& sessionId,
 }
 
 bool SSLSessionCacheManager::lookupCacheRecord(const string& sessionId,
-                                               AsyncSSLSocket* sslSocket) {
+                                               AsyncSSLSocket* sslSocket,
+                                               PendingLookup& pending) {
   auto cacheCtx = new SSLCacheProvider::CacheContext();
   cacheCtx->sessionId = sessionId;
   cacheCtx->session = nullptr;
@@ -306,21 +540,70 @@ bool SSLSessionCacheManager::lookupCacheRecord(const string& sessionId,
   cacheCtx->guard.reset(
       new DelayedDestruction::DestructorGuard(cacheCtx->sslSocket));
   cacheCtx->manager = this;
-  bool res = externalCache_->getAsync(sessionId, cacheCtx);
-  if (!res) {
-    delete cacheCtx;
+  if (!eventBase_) {
+    bool res = externalCache_->getAsync(sessionId, cacheCtx);
+    if (!res) {
+      delete cacheCtx;
+    } else {
+      pending.context = cacheCtx;
+    }
+    return res;
+  }
+
+  pending.context = cacheCtx;
+  if (externalLookupTimeout_.count() > 0) {
+    pending.timeout.reset(new LookupTimeout(this, eventBase_, sessionId));
+    pending.timeout->scheduleTimeout(externalLookupTimeout_.count());
   }
-  return res;
+  lookupBatch_.contexts.push_back(cacheCtx);
+  if (!lookupBatch_.isLoopCallbackScheduled()) {
+    eventBase_->runInLoop(&lookupBatch_);
+  }
+  return true;
 }
 
-void SSLSessionCacheManager::restartSSLAccept(
+void SSLSessionCacheManager::flushLookups() {
+  std::vector<SSLCacheProvider::CacheContext*> contexts;
+  contexts.swap(lookupBatch_.contexts);
+  VLOG(4) << "Sending " << contexts.size() << " external cache lookups";
+  for (auto cacheCtx : externalCache_->getMultiAsync(contexts)) {
+    VLOG(4) << "Get SSL session: failed to send lookup request; id=" <<
+      SSLUtil::hexlify(cacheCtx->sessionId);
+    onGetFailure(cacheCtx);
+  }
+}
+
+void SSLSessionCacheManager::onLookupTimeout(const string& sessionId) {
+  auto pit = pendingLookups_.find(sessionId);
+  if (pit == pendingLookups_.end()) {
+    return;
+  }
+  VLOG(4) << "External cache lookup timed out; id=" <<
+    SSLUtil::hexlify(sessionId);
+  auto cacheCtx = pit->second.context;
+  // The provider still owns the context and will call back with it
+  pit->second.context = nullptr;
+  restartWaiters(pit, cacheCtx->sslSocket, nullptr);
+}
+
+bool SSLSessionCacheManager::restartSSLAccept(
     const SSLCacheProvider::CacheContext* cacheCtx) {
   PendingLookupMap::iterator pit = pendingLookups_.find(cacheCtx->sessionId);
-  CHECK(pit != pendingLookups_.end());
+  if (pit == pendingLookups_.end() || pit->second.context != cacheCtx) {
+    // Timed out, and the clients went on without it
+    return false;
+  }
+  restartWaiters(pit, cacheCtx->sslSocket, cacheCtx->session);
+  return true;
+}
+
+void SSLSessionCacheManager::restartWaiters(PendingLookupMap::iterator pit,
+                                            AsyncSSLSocket* sslSocket,
+                                            SSL_SESSION* session) {
   pit->second.request_in_progress = false;
-  pit->second.session = cacheCtx->session;
+  pit->second.session = session;
   VLOG(7) << "Restart SSL accept";
-  cacheCtx->sslSocket->restartSSLAccept();
+  sslSocket->restartSSLAccept();
   for (const auto& attachedLookup: pit->second.waiters) {
     // Wake up anyone else who was waiting for this session
     VLOG(4) << "Restart SSL accept (waiters) for fd=" <<
@@ -338,9 +621,13 @@ void SSLSessionCacheManager::onGetSuccess(
   restartSSLAccept(cacheCtx);
 
   /* Insert in the LRU after restarting all clients.  The stats logic
-   * in getSession would treat this as a local hit otherwise.
+   * in getSession would treat this as a local hit otherwise.  Sessions that
+   * arrive after the lookup timed out are still worth keeping.
    */
-  localCache_->storeSession(cacheCtx->sessionId, cacheCtx->session, stats_);
+  if (cacheCtx->session) {
+    storeThreadCache(cacheCtx->sessionId, cacheCtx->session);
+    localCache_->storeSession(cacheCtx->sessionId, cacheCtx->session, stats_);
+  }
   delete cacheCtx;
 }
 
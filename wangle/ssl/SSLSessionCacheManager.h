@@ -10,48 +10,77 @@
 #pragma once
 
 #include <wangle/ssl/SSLCacheProvider.h>
+#include <wangle/ssl/SSLSessionWriteBehind.h>
 #include <wangle/ssl/SSLStats.h>
 
+#include <atomic>
 #include <folly/EvictingCacheMap.h>
+#include <folly/RWSpinLock.h>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 #include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBase.h>
 
 namespace folly {
 
 class SSLStats;
 
 /**
- * Basic SSL session cache map: Maps session id -> session
- */
-typedef folly::EvictingCacheMap<std::string, SSL_SESSION*> SSLSessionCacheMap;
-
-/**
- * Holds an SSLSessionCacheMap and associated lock
+ * One shard of the local SSL session cache: a fixed number of slots evicted
+ * in CLOCK order, an approximation of LRU where a lookup only sets the
+ * slot's referenced bit instead of moving it.  Lookups thus take the lock
+ * shared and don't write to anything other threads read, so concurrent
+ * resumptions of sessions in the same shard don't serialize.
  */
 class LocalSSLSessionCache: private boost::noncopyable {
  public:
   LocalSSLSessionCache(uint32_t maxCacheSize, uint32_t cacheCullSize);
 
-  ~LocalSSLSessionCache() {
-    std::lock_guard<std::mutex> g(lock);
-    // EvictingCacheMap dtor doesn't free values
-    sessionCache.clear();
-  }
+  ~LocalSSLSessionCache();
 
-  SSLSessionCacheMap sessionCache;
-  std::mutex lock;
-  uint32_t removedSessions_{0};
+  // A new reference to the session, or nullptr
+  SSL_SESSION* lookupSession(const std::string& sessionId);
 
- private:
+  /**
+   * Takes over the caller's reference, if any; returns how many sessions
+   * it evicted
+   */
+  uint32_t storeSession(const std::string& sessionId, SSL_SESSION* session);
 
-  void pruneSessionCallback(const std::string& sessionId,
-                            SSL_SESSION* session);
+  void removeSession(const std::string& sessionId);
+
+  size_t size();
+
+  // Appends the sessions, each with a new reference, e.g. to save them
+  void snapshot(std::vector<std::pair<std::string, SSL_SESSION*>>& out);
+
+ private:
+  struct Slot {
+    std::string sessionId;
+    SSL_SESSION* session{nullptr};
+    // Set by lookups, cleared as the clock hand passes
+    std::atomic<bool> referenced{false};
+  };
+
+  // Frees an unreferenced slot; lock held exclusively
+  size_t evictOne();
+  void clearSlot(size_t i);
+
+  folly::RWSpinLock lock_;
+  std::vector<Slot> slots_;
+  std::unordered_map<std::string, size_t> index_;
+  // Slots with no session, to be filled before evicting
+  std::vector<size_t> freeSlots_;
+  size_t hand_{0};
+  const uint32_t cullSize_;
 };
 
 /**
- * A sharded LRU for SSL sessions.  The sharding is inteneded to reduce
- * contention for the LRU locks.  Assuming uniform distribution, two workers
- * will contend for the same lock with probability 1 / n_buckets^2.
+ * A sharded cache for SSL sessions.  The sharding is intended to reduce
+ * contention for the shard locks; shards are picked by a hash of the whole
+ * session ID.
  */
 class ShardedLocalSSLSessionCache : private boost::noncopyable {
  public:
@@ -74,56 +103,34 @@ class ShardedLocalSSLSessionCache : private boost::noncopyable {
   }
 
   SSL_SESSION* lookupSession(const std::string& sessionId) {
-    size_t bucket = hash(sessionId);
-    SSL_SESSION* session = nullptr;
-    std::lock_guard<std::mutex> g(caches_[bucket]->lock);
-
-    auto itr = caches_[bucket]->sessionCache.find(sessionId);
-    if (itr != caches_[bucket]->sessionCache.end()) {
-      session = itr->second;
-    }
-
-    if (session) {
-      CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
-    }
-    return session;
+    return caches_[hash(sessionId)]->lookupSession(sessionId);
   }
 
   void storeSession(const std::string& sessionId, SSL_SESSION* session,
                     SSLStats* stats) {
-    size_t bucket = hash(sessionId);
-    SSL_SESSION* oldSession = nullptr;
-    std::lock_guard<std::mutex> g(caches_[bucket]->lock);
-
-    auto itr = caches_[bucket]->sessionCache.find(sessionId);
-    if (itr != caches_[bucket]->sessionCache.end()) {
-      oldSession = itr->second;
-    }
-
-    if (oldSession) {
-      // LRUCacheMap doesn't free on overwrite, so 2x the work for us
-      // This can happen in race conditions
-      SSL_SESSION_free(oldSession);
-    }
-    caches_[bucket]->removedSessions_ = 0;
-    caches_[bucket]->sessionCache.set(sessionId, session, true);
+    auto removed = caches_[hash(sessionId)]->storeSession(sessionId, session);
     if (stats) {
-      stats->recordSSLSessionFree(caches_[bucket]->removedSessions_);
+      stats->recordSSLSessionFree(removed);
     }
   }
 
   void removeSession(const std::string& sessionId) {
-    size_t bucket = hash(sessionId);
-    std::lock_guard<std::mutex> g(caches_[bucket]->lock);
-    caches_[bucket]->sessionCache.erase(sessionId);
+    caches_[hash(sessionId)]->removeSession(sessionId);
+  }
+
+  // All sessions, each with a new reference, one shard locked at a time
+  std::vector<std::pair<std::string, SSL_SESSION*>> snapshot() {
+    std::vector<std::pair<std::string, SSL_SESSION*>> sessions;
+    for (auto& cache : caches_) {
+      cache->snapshot(sessions);
+    }
+    return sessions;
   }
 
  private:
 
-  /* SSL session IDs are 32 bytes of random data, hash based on first 16 bits */
   size_t hash(const std::string& key) {
-    CHECK(key.length() >= 2);
-    return (key[0] << 8 | key[1]) % caches_.size();
+    return std::hash<std::string>()(key) % caches_.size();
   }
 
   std::vector< std::unique_ptr<LocalSSLSessionCache> > caches_;
@@ -144,6 +151,10 @@ struct PendingLookup {
   bool request_in_progress;
   SSL_SESSION* session;
   std::list<AttachedLookup> waiters;
+  // The request this lookup waits for
+  SSLCacheProvider::CacheContext* context{nullptr};
+  // Gives up on the request, if there is a lookup timeout
+  std::unique_ptr<AsyncTimeout> timeout;
 
   PendingLookup() {
     request_in_progress = true;
@@ -161,7 +172,7 @@ typedef std::map<std::string, PendingLookup> PendingLookupMap;
  * to share sessions across instances.
  *
  * There is a single in memory session cache shared by all VIPs.  The cache is
- * split into N buckets (currently 16) with a separate lock per bucket.  The
+ * split into N buckets (currently 64) with a separate lock per bucket.  The
  * VIP ID is hashed and stored as part of the session to handle the
  * (very unlikely) case of session ID collision.
  *
@@ -170,11 +181,16 @@ typedef std::map<std::string, PendingLookup> PendingLookupMap;
  * expiration is equal to the SSL session's expiration.
  *
  * When a resume request is received, SSLSessionCacheManager first looks in the
- * local LRU cache for the VIP.  If there is a miss there, an asynchronous
- * request for this session is dispatched to the external cache.  When the
+ * thread's own small LRU, if it has one, then in the local cache.  If there
+ * is a miss there, an asynchronous request for this session is dispatched to
+ * the external cache.  When the
  * external cache query returns, the LRU cache is updated if the session was
  * found, and the SSL_accept call is resumed.
  *
+ * External cache requests are batched: those started while handling one
+ * event loop iteration go out together through
+ * SSLCacheProvider::getMultiAsync().
+ *
  * If additional resume requests for the same session ID arrive in the same
  * thread while the request is pending, the 2nd - Nth callers attach to the
  * original external cache requests and are resumed when it comes back.  No
@@ -205,10 +221,19 @@ class SSLSessionCacheManager : private boost::noncopyable {
 
   /**
    * Call this on shutdown to release the global instance of the
-   * ShardedLocalSSLSessionCache.
+   * ShardedLocalSSLSessionCache, saving it first to the snapshot file
+   * given to loadSnapshot(), if any.
    */
   static void shutdown();
 
+  /**
+   * Fills the local cache from the snapshot at path, in a thread of its
+   * own, and saves the cache there on shutdown(), so clients resume after
+   * a restart; see SSLSessionCacheSnapshot.  Snapshots are bounded to
+   * maxBytes.  Only the first call in the process counts.
+   */
+  static void loadSnapshot(const std::string& path, uint64_t maxBytes);
+
   /**
    * Callback for ExternalCache to call when an async get succeeds
    * @param context  The context that was passed to the async get request
@@ -225,13 +250,110 @@ class SSLSessionCacheManager : private boost::noncopyable {
    */
   void onGetFailure(SSLCacheProvider::CacheContext* context);
 
+  /**
+   * Keep up to this many recently used sessions in front of the shared
+   * local cache, for this manager only.  Clients that come back to the same
+   * thread then resume without touching the shared cache's locks.  0, the
+   * default, disables it.
+   */
+  void setThreadCacheSize(size_t size);
+
+  /**
+   * Where resumptions found their session; only to be read from the
+   * manager's thread.
+   */
+  struct CacheStats {
+    uint64_t threadCacheHits{0};
+    uint64_t localCacheHits{0};
+    uint64_t externalCacheHits{0};
+    uint64_t misses{0};
+  };
+
+  const CacheStats& getCacheStats() const {
+    return cacheStats_;
+  }
+
+  /**
+   * Resume clients waiting for an external cache lookup with a full
+   * handshake if the lookup takes longer than this; 0, the default, waits
+   * for the external cache however long it takes.
+   */
+  void setExternalLookupTimeout(std::chrono::milliseconds timeout) {
+    externalLookupTimeout_ = timeout;
+  }
+
+  /**
+   * Only wait for this many distinct sessions from the external cache at a
+   * time; clients asking for more get full handshakes.  0, the default,
+   * doesn't limit them.
+   */
+  void setMaxPendingLookups(size_t maxPending) {
+    maxPendingLookups_ = maxPending;
+  }
+
+  /**
+   * Queue new sessions for the external cache on writeBehind instead of
+   * serializing and storing them in the handshake; null goes back to
+   * storing them inline.
+   */
+  void setWriteBehind(std::shared_ptr<SSLSessionWriteBehind> writeBehind) {
+    writeBehind_ = std::move(writeBehind);
+  }
+
  private:
+  // Sends the lookups batched so far, at the end of the loop iteration
+  class LookupBatch : public EventBase::LoopCallback {
+   public:
+    explicit LookupBatch(SSLSessionCacheManager* manager)
+      : manager_(manager) {}
+
+    void runLoopCallback() noexcept override {
+      manager_->flushLookups();
+    }
+
+    std::vector<SSLCacheProvider::CacheContext*> contexts;
+
+   private:
+    SSLSessionCacheManager* manager_;
+  };
+
+  class LookupTimeout : public AsyncTimeout {
+   public:
+    LookupTimeout(SSLSessionCacheManager* manager, EventBase* eventBase,
+                  const std::string& sessionId)
+      : AsyncTimeout(eventBase), manager_(manager), sessionId_(sessionId) {}
+
+    void timeoutExpired() noexcept override {
+      manager_->onLookupTimeout(sessionId_);
+    }
+
+   private:
+    SSLSessionCacheManager* manager_;
+    std::string sessionId_;
+  };
+
+  void flushLookups();
+  void onLookupTimeout(const std::string& sessionId);
+
+  typedef folly::EvictingCacheMap<std::string, SSL_SESSION*> ThreadCache;
+
+  SSL_SESSION* lookupThreadCache(const std::string& sessionId);
+  // Takes a reference of its own
+  void storeThreadCache(const std::string& sessionId, SSL_SESSION* session);
+  void removeThreadCache(const std::string& sessionId);
 
   SSLContext* ctx_;
   std::shared_ptr<ShardedLocalSSLSessionCache> localCache_;
   PendingLookupMap pendingLookups_;
   SSLStats* stats_{nullptr};
   std::shared_ptr<SSLCacheProvider> externalCache_;
+  std::unique_ptr<ThreadCache> threadCache_;
+  CacheStats cacheStats_;
+  EventBase* eventBase_{nullptr};
+  LookupBatch lookupBatch_{this};
+  std::chrono::milliseconds externalLookupTimeout_{0};
+  size_t maxPendingLookups_{0};
+  std::shared_ptr<SSLSessionWriteBehind> writeBehind_;
 
   /**
    * Invoked by openssl when a new SSL session is created
@@ -262,12 +384,18 @@ class SSLSessionCacheManager : private boost::noncopyable {
    * Lookup a session in the external cache for the specified SSL socket.
    */
   bool lookupCacheRecord(const std::string& sessionId,
-                         AsyncSSLSocket* sslSock);
+                         AsyncSSLSocket* sslSock,
+                         PendingLookup& pending);
 
   /**
-   * Restart all clients waiting for the answer to an external cache query
+   * Restart all clients waiting for the answer to an external cache query.
+   * Returns false if they were restarted already, when the query timed out.
    */
-  void restartSSLAccept(const SSLCacheProvider::CacheContext* cacheCtx);
+  bool restartSSLAccept(const SSLCacheProvider::CacheContext* cacheCtx);
+
+  void restartWaiters(PendingLookupMap::iterator pit,
+                      AsyncSSLSocket* sslSocket,
+                      SSL_SESSION* session);
 
   /**
    * Get or create the LRU cache for the given VIP ID
@@ -287,6 +415,8 @@ class SSLSessionCacheManager : private boost::noncopyable {
   static int32_t sExDataIndex_;
   static std::shared_ptr<ShardedLocalSSLSessionCache> sCache_;
   static std::mutex sCacheLock_;
+  static std::string sSnapshotPath_;
+  static uint64_t sMaxSnapshotBytes_;
 };
 
 }
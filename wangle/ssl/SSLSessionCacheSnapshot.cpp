@@ -0,0 +1,187 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/SSLSessionCacheSnapshot.h>
+
+#include <folly/Exception.h>
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace folly {
+
+namespace {
+
+const uint32_t kMagic = 0x57535343;
+const uint32_t kVersion = 1;
+const size_t kHeaderSize = 8;
+// Expiry, ID length and DER length ahead of each session
+const size_t kRecordHeaderSize = 16;
+// Pages decoded are dropped from the mapping in steps of this
+const size_t kReleaseSize = 1024 * 1024;
+
+template <class T>
+void put(std::string& buf, T value) {
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <class T>
+T get(const uint8_t* p) {
+  T value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+}
+
+size_t SSLSessionCacheSnapshot::save(ShardedLocalSSLSessionCache& cache,
+                                     const std::string& path,
+                                     uint64_t maxBytes) {
+  if (maxBytes == 0) {
+    maxBytes = kDefaultMaxBytes;
+  }
+  auto sessions = cache.snapshot();
+  SCOPE_EXIT {
+    for (auto& entry : sessions) {
+      SSL_SESSION_free(entry.second);
+    }
+  };
+
+  const int64_t now = time(nullptr);
+  std::string buf;
+  put(buf, kMagic);
+  put(buf, kVersion);
+  size_t saved = 0;
+  for (auto& entry : sessions) {
+    auto session = entry.second;
+    int64_t expiry = SSL_SESSION_get_time(session) +
+      SSL_SESSION_get_timeout(session);
+    if (expiry <= now) {
+      continue;
+    }
+    auto len = i2d_SSL_SESSION(session, nullptr);
+    if (len <= 0) {
+      continue;
+    }
+    const auto& id = entry.first;
+    if (buf.size() + kRecordHeaderSize + id.size() + len > maxBytes) {
+      break;
+    }
+    put(buf, expiry);
+    put(buf, uint32_t(id.size()));
+    put(buf, uint32_t(len));
+    buf.append(id);
+    auto offset = buf.size();
+    buf.resize(offset + len);
+    auto p = reinterpret_cast<unsigned char*>(&buf[offset]);
+    i2d_SSL_SESSION(session, &p);
+    saved++;
+  }
+
+  // Never a partly written file under path
+  auto tmpPath = path + ".tmp";
+  int fd = openNoInt(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd == -1) {
+    throwSystemError("can't create ", tmpPath);
+  }
+  auto written = writeFull(fd, buf.data(), buf.size());
+  auto writeErr = errno;
+  closeNoInt(fd);
+  if (written != ssize_t(buf.size())) {
+    unlink(tmpPath.c_str());
+    throwSystemErrorExplicit(writeErr, "can't write ", tmpPath);
+  }
+  checkUnixError(rename(tmpPath.c_str(), path.c_str()),
+                 "can't rename ", tmpPath);
+  return saved;
+}
+
+size_t SSLSessionCacheSnapshot::load(ShardedLocalSSLSessionCache& cache,
+                                     const std::string& path,
+                                     uint64_t maxBytes) {
+  if (maxBytes == 0) {
+    maxBytes = kDefaultMaxBytes;
+  }
+  int fd = openNoInt(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    if (errno == ENOENT) {
+      return 0;
+    }
+    throwSystemError("can't open ", path);
+  }
+  SCOPE_EXIT {
+    closeNoInt(fd);
+  };
+  struct stat st;
+  checkUnixError(fstat(fd, &st), "can't stat ", path);
+  size_t size = std::min<uint64_t>(st.st_size, maxBytes);
+  if (size < kHeaderSize) {
+    return 0;
+  }
+  auto map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    throwSystemError("can't map ", path);
+  }
+  SCOPE_EXIT {
+    munmap(map, size);
+  };
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  auto begin = static_cast<const uint8_t*>(map);
+  auto end = begin + size;
+  if (get<uint32_t>(begin) != kMagic || get<uint32_t>(begin + 4) != kVersion) {
+    throw std::runtime_error(path + " isn't an SSL session cache snapshot");
+  }
+  const int64_t now = time(nullptr);
+  size_t loaded = 0;
+  auto released = begin;
+  auto p = begin + kHeaderSize;
+  while (size_t(end - p) >= kRecordHeaderSize) {
+    auto expiry = get<int64_t>(p);
+    auto idLen = get<uint32_t>(p + 8);
+    auto derLen = get<uint32_t>(p + 12);
+    p += kRecordHeaderSize;
+    if (size_t(end - p) < uint64_t(idLen) + derLen) {
+      LOG(WARNING) << path << " ends within a session";
+      break;
+    }
+    std::string id(reinterpret_cast<const char*>(p), idLen);
+    p += idLen;
+    auto der = p;
+    p += derLen;
+    if (expiry <= now) {
+      continue;
+    }
+    auto session = d2i_SSL_SESSION(nullptr, &der, derLen);
+    if (session) {
+      cache.storeSession(id, session, nullptr);
+      loaded++;
+    }
+    if (size_t(p - released) >= kReleaseSize) {
+      // Whole pages only, from the start of the mapping
+      auto upTo = begin + (p - begin) / kReleaseSize * kReleaseSize;
+      madvise(const_cast<uint8_t*>(released), upTo - released,
+              MADV_DONTNEED);
+      released = upTo;
+    }
+  }
+  return loaded;
+}
+
+} // namespace
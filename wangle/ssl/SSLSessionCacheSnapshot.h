@@ -0,0 +1,48 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/ssl/SSLSessionCacheManager.h>
+
+#include <cstdint>
+#include <string>
+
+namespace folly {
+
+/**
+ * Saves a local SSL session cache to a file and loads it back, so a
+ * restarted server resumes the sessions of its returning clients.  Each
+ * session is kept DER-encoded (i2d_SSL_SESSION) with its ID and expiry;
+ * those expired by the time they're saved or loaded are skipped.
+ *
+ * Files are written whole under a temporary name and renamed over path,
+ * and read through a read-only mapping released as it's decoded.  Neither
+ * goes beyond maxBytes, 0 for kDefaultMaxBytes, and a file cut short only
+ * loses its last session.  Both block, so call them off the IO threads.
+ */
+class SSLSessionCacheSnapshot {
+ public:
+  static const uint64_t kDefaultMaxBytes = 64 * 1024 * 1024;
+
+  // Returns how many sessions it saved; throws std::system_error
+  static size_t save(ShardedLocalSSLSessionCache& cache,
+                     const std::string& path,
+                     uint64_t maxBytes = 0);
+
+  /**
+   * Returns how many sessions it loaded, 0 without a file; throws
+   * std::system_error, or std::runtime_error if it isn't a snapshot
+   */
+  static size_t load(ShardedLocalSSLSessionCache& cache,
+                     const std::string& path,
+                     uint64_t maxBytes = 0);
+};
+
+} // namespace
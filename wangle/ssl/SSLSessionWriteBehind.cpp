@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/SSLSessionWriteBehind.h>
+
+#include <glog/logging.h>
+
+namespace folly {
+
+SSLSessionWriteBehind::~SSLSessionWriteBehind() {
+  // Only reached with no flush() queued, which holds a reference
+  for (auto& entry : queue_) {
+    SSL_SESSION_free(entry.session);
+  }
+}
+
+bool SSLSessionWriteBehind::add(const std::string& sessionId,
+                                SSL_SESSION* session,
+                                std::chrono::seconds expiration) {
+  bool scheduleFlush = false;
+  {
+    std::lock_guard<std::mutex> g(lock_);
+    if (queue_.size() >= maxQueued_) {
+      numDropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+    queue_.push_back(Entry{sessionId, session, expiration});
+    queueDepth_.store(queue_.size(), std::memory_order_relaxed);
+    if (!flushScheduled_) {
+      flushScheduled_ = true;
+      scheduleFlush = true;
+    }
+  }
+
+  if (scheduleFlush) {
+    auto self = shared_from_this();
+    try {
+      executor_->add([self] { self->flush(); });
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Unable to queue SSL session writes: " << ex.what();
+      // Run it here rather than stall the queue
+      flush();
+    }
+  }
+  return true;
+}
+
+void SSLSessionWriteBehind::flush() {
+  std::vector<Entry> batch;
+  {
+    std::lock_guard<std::mutex> g(lock_);
+    batch.swap(queue_);
+    queueDepth_.store(0, std::memory_order_relaxed);
+    flushScheduled_ = false;
+  }
+
+  VLOG(4) << "Writing " << batch.size() << " SSL sessions to external cache";
+  std::string sessionString;
+  for (auto& entry : batch) {
+    uint32_t sessionLen = i2d_SSL_SESSION(entry.session, nullptr);
+    sessionString.resize(sessionLen);
+    uint8_t* cp = (uint8_t *)sessionString.data();
+    i2d_SSL_SESSION(entry.session, &cp);
+    SSL_SESSION_free(entry.session);
+    if (!externalCache_->setAsync(entry.sessionId, sessionString,
+                                  entry.expiration)) {
+      numFailed_.fetch_add(1, std::memory_order_relaxed);
+    }
+    numWritten_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+}
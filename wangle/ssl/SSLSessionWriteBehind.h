@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/ssl/SSLCacheProvider.h>
+
+#include <atomic>
+#include <chrono>
+#include <folly/Executor.h>
+#include <memory>
+#include <mutex>
+#include <openssl/ssl.h>
+#include <vector>
+
+namespace folly {
+
+/**
+ * Stores new SSL sessions in an external cache off the IO thread: add()
+ * only queues a reference to the session, and a task on the executor
+ * serializes everything queued so far and hands it to setAsync().  So the
+ * provider's setAsync() has to be safe to call from the executor's
+ * threads.
+ *
+ * When more than maxQueued sessions are waiting, new ones are dropped;
+ * they stay in the local cache, they just can't be resumed elsewhere.
+ */
+class SSLSessionWriteBehind
+    : public std::enable_shared_from_this<SSLSessionWriteBehind> {
+ public:
+  static std::shared_ptr<SSLSessionWriteBehind> create(
+      std::shared_ptr<SSLCacheProvider> externalCache,
+      std::shared_ptr<folly::Executor> executor,
+      size_t maxQueued) {
+    return std::shared_ptr<SSLSessionWriteBehind>(new SSLSessionWriteBehind(
+      std::move(externalCache), std::move(executor), maxQueued));
+  }
+
+  ~SSLSessionWriteBehind();
+
+  /**
+   * Queue a session to be stored; takes a reference of its own.  Returns
+   * false if the session was dropped.
+   */
+  bool add(const std::string& sessionId, SSL_SESSION* session,
+           std::chrono::seconds expiration);
+
+  // Sessions waiting to be written
+  size_t getQueueDepth() const {
+    return queueDepth_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumDropped() const {
+    return numDropped_.load(std::memory_order_relaxed);
+  }
+
+  // Sessions handed to the external cache, successfully or not
+  uint64_t getNumWritten() const {
+    return numWritten_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumFailed() const {
+    return numFailed_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Entry {
+    std::string sessionId;
+    SSL_SESSION* session;
+    std::chrono::seconds expiration;
+  };
+
+  SSLSessionWriteBehind(std::shared_ptr<SSLCacheProvider> externalCache,
+                        std::shared_ptr<folly::Executor> executor,
+                        size_t maxQueued)
+    : externalCache_(std::move(externalCache)),
+      executor_(std::move(executor)),
+      maxQueued_(maxQueued) {}
+
+  void flush();
+
+  const std::shared_ptr<SSLCacheProvider> externalCache_;
+  const std::shared_ptr<folly::Executor> executor_;
+  const size_t maxQueued_;
+
+  std::mutex lock_;
+  std::vector<Entry> queue_;
+  // Whether a flush() is queued on the executor
+  bool flushScheduled_{false};
+
+  std::atomic<size_t> queueDepth_{0};
+  std::atomic<uint64_t> numDropped_{0};
+  std::atomic<uint64_t> numWritten_{0};
+  std::atomic<uint64_t> numFailed_{0};
+};
+
+}
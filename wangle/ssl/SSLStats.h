@@ -9,6 +9,10 @@
  */
 #pragma once
 
+#include <wangle/ssl/SSLUtil.h>
+
+#include <chrono>
+
 namespace folly {
 
 class SSLStats {
@@ -25,6 +29,13 @@ class SSLStats {
   virtual void recordSSLSessionSetError(uint32_t err) noexcept = 0;
   virtual void recordSSLSessionGetError(uint32_t err) noexcept = 0;
   virtual void recordClientRenegotiation() noexcept = 0;
+  // A handshake the acceptor finished, successfully or not.  cipher is
+  // null unless one was negotiated.
+  virtual void recordSSLHandshake(bool success,
+                                  SSLErrorEnum error,
+                                  SSLResumeEnum resume,
+                                  const char* cipher,
+                                  std::chrono::microseconds latency) noexcept {}
 
   // upstream
   virtual void recordSSLUpstreamConnection(bool handshake) noexcept = 0;
@@ -26,6 +26,13 @@ namespace {
 const int kTLSTicketKeyNameLen = 4;
 const int kTLSTicketKeySaltLen = 12;
 
+// Key names are the start of a hash already, so their bits index keys
+uint32_t keyNameBits(const unsigned char* keyName) {
+  uint32_t bits;
+  memcpy(&bits, keyName, sizeof(bits));
+  return bits;
+}
+
 }
 
 namespace folly {
@@ -90,7 +97,7 @@ TLSTicketKeyManager::processTicket(SSL* ssl, unsigned char* keyName,
     memcpy(keyName + kTLSTicketKeyNameLen, salt, kTLSTicketKeySaltLen);
 
     // Create the unique keys by hashing with the salt
-    makeUniqueKeys(key->keySource_, sizeof(key->keySource_), salt, output);
+    makeUniqueKeys(key, salt, output);
     // This relies on the fact that SHA256 has 32 bytes of output
     // and that AES-128 keys are 16 bytes
     hmacKey = output;
@@ -120,7 +127,7 @@ TLSTicketKeyManager::processTicket(SSL* ssl, unsigned char* keyName,
 
       // Reconstruct the unique key via the salt
       saltptr = keyName + kTLSTicketKeyNameLen;
-      makeUniqueKeys(key->keySource_, sizeof(key->keySource_), saltptr, output);
+      makeUniqueKeys(key, saltptr, output);
       hmacKey = output;
       aesKey = output + SHA256_DIGEST_LENGTH / 2;
 
@@ -150,6 +157,7 @@ TLSTicketKeyManager::setTLSTicketKeySeeds(
   bool result = true;
 
   activeKeys_.clear();
+  keyIndex_.clear();
   ticketKeys_.clear();
   ticketSeeds_.clear();
   const std::vector<string> *seedList = &oldSeeds;
@@ -173,6 +181,7 @@ TLSTicketKeyManager::setTLSTicketKeySeeds(
   if (!result) {
     VLOG(2) << "One or more seeds failed to decode";
   }
+  buildKeyIndex();
 
   if (ticketKeys_.size() == 0 || activeKeys_.size() == 0) {
     LOG(WARNING) << "No keys configured, falling back to default";
@@ -214,6 +223,9 @@ TLSTicketKeyManager::insertNewKey(TLSTicketSeed* seed, uint32_t hashCount,
             newKey->keySource_, hashCount);
   }
 
+  SHA256_Init(&newKey->keySourceHash_);
+  SHA256_Update(&newKey->keySourceHash_, newKey->keySource_,
+                sizeof(newKey->keySource_));
   newKey->hashCount_ = hashCount;
   newKey->keyName_ = makeKeyName(seed, hashCount, nameBuf);
   newKey->type_ = seed->type_;
@@ -279,24 +291,45 @@ TLSTicketKeyManager::findEncryptionKey() {
 
 TLSTicketKeyManager::TLSTicketKeySource *
 TLSTicketKeyManager::findDecryptionKey(unsigned char* keyName) {
-  string name((char *)keyName, kTLSTicketKeyNameLen);
-  TLSTicketKeySource* key = nullptr;
-  TLSTicketKeyMap::iterator mapit = ticketKeys_.find(name);
-  if (mapit != ticketKeys_.end()) {
-    key = mapit->second.get();
+  if (keyIndex_.empty()) {
+    return nullptr;
   }
-  return key;
+  size_t mask = keyIndex_.size() - 1;
+  for (size_t i = keyNameBits(keyName) & mask; keyIndex_[i];
+       i = (i + 1) & mask) {
+    if (memcmp(keyIndex_[i]->keyName_.data(), keyName,
+               kTLSTicketKeyNameLen) == 0) {
+      return keyIndex_[i];
+    }
+  }
+  return nullptr;
 }
 
 void
-TLSTicketKeyManager::makeUniqueKeys(unsigned char* parentKey,
-                                    size_t keyLen,
+TLSTicketKeyManager::buildKeyIndex() {
+  // At most half full, so that probes stay short and always end
+  size_t size = 2;
+  while (size < 2 * ticketKeys_.size()) {
+    size *= 2;
+  }
+  keyIndex_.assign(size, nullptr);
+  for (auto& entry : ticketKeys_) {
+    auto key = entry.second.get();
+    size_t i = keyNameBits(
+      reinterpret_cast<const unsigned char*>(key->keyName_.data()));
+    while (keyIndex_[i & (size - 1)]) {
+      i++;
+    }
+    keyIndex_[i & (size - 1)] = key;
+  }
+}
+
+void
+TLSTicketKeyManager::makeUniqueKeys(const TLSTicketKeySource* key,
                                     unsigned char* salt,
                                     unsigned char* output) {
-  SHA256_CTX hash_ctx;
-
-  SHA256_Init(&hash_ctx);
-  SHA256_Update(&hash_ctx, parentKey, keyLen);
+  // Same as hashing keySource_ then salt, minus hashing keySource_ again
+  SHA256_CTX hash_ctx = key->keySourceHash_;
   SHA256_Update(&hash_ctx, salt, kTLSTicketKeySaltLen);
   SHA256_Final(output, &hash_ctx);
 }
@@ -105,6 +105,9 @@ class TLSTicketKeyManager : private boost::noncopyable {
     std::string keyName_;
     TLSTicketSeedType type_;
     unsigned char keySource_[SHA256_DIGEST_LENGTH];
+    // SHA256 state after hashing keySource_, where each ticket's unique
+    // keys start from
+    SHA256_CTX keySourceHash_;
   };
 
   /**
@@ -165,10 +168,14 @@ class TLSTicketKeyManager : private boost::noncopyable {
   TLSTicketKeySource* findDecryptionKey(unsigned char* keyName);
 
   /**
-   * Derive a unique key from the parent key and the salt via hashing
+   * Derive a unique key from the key's source and the salt via hashing,
+   * resuming from the key's hash state
    */
-  void makeUniqueKeys(unsigned char* parentKey, size_t keyLen,
-                      unsigned char* salt, unsigned char* output);
+  void makeUniqueKeys(const TLSTicketKeySource* key, unsigned char* salt,
+                      unsigned char* output);
+
+  // Rebuilds keyIndex_ from ticketKeys_
+  void buildKeyIndex();
 
   /**
    * For standalone decryption utility
@@ -187,6 +194,10 @@ class TLSTicketKeyManager : private boost::noncopyable {
   TLSTicketKeyMap ticketKeys_;
   // Key sources that can be used for encryption
   TLSActiveKeyList activeKeys_;
+  // ticketKeys_ as an open addressed table, indexed by the bits of the key
+  // name (itself a hash), for decryption to find a key without allocating
+  // or comparing strings
+  std::vector<TLSTicketKeySource*> keyIndex_;
 
   folly::SSLContext* ctx_;
   uint32_t randState_;
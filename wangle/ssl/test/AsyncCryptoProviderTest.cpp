@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/futures/ManualExecutor.h>
+#include <gtest/gtest.h>
+#include <wangle/ssl/AsyncCryptoProvider.h>
+
+#include <stdexcept>
+
+namespace folly {
+
+TEST(PrivateKeyOffloadTest, CompletesInSocketThread) {
+  EventBase eventBase;
+  auto executor = std::make_shared<ManualExecutor>();
+  PrivateKeyOffload offload(executor);
+  AsyncSSLSocket::UniquePtr sslSocket(
+    new AsyncSSLSocket(std::make_shared<SSLContext>(), &eventBase));
+
+  std::vector<std::pair<std::string, bool>> results;
+  auto record = [&](std::string result, bool ok) {
+    EXPECT_TRUE(eventBase.isInEventBaseThread());
+    results.emplace_back(std::move(result), ok);
+  };
+  EXPECT_TRUE(offload.offload(
+    sslSocket.get(), [] { return std::string("signature"); }, record));
+  EXPECT_TRUE(offload.offload(
+    sslSocket.get(),
+    []() -> std::string { throw std::runtime_error("key server down"); },
+    record));
+
+  // Run on the executor, then handed back to the socket's EventBase
+  EXPECT_EQ(2, executor->run());
+  EXPECT_TRUE(results.empty());
+  eventBase.loopOnce();
+  ASSERT_EQ(2, results.size());
+  EXPECT_EQ(std::make_pair(std::string("signature"), true), results[0]);
+  EXPECT_FALSE(results[1].second);
+}
+
+class RejectingExecutor : public Executor {
+ public:
+  void add(Func) override {
+    throw std::runtime_error("full");
+  }
+};
+
+TEST(PrivateKeyOffloadTest, ExecutorRejects) {
+  EventBase eventBase;
+  PrivateKeyOffload offload(std::make_shared<RejectingExecutor>());
+  AsyncSSLSocket::UniquePtr sslSocket(
+    new AsyncSSLSocket(std::make_shared<SSLContext>(), &eventBase));
+  bool completed = false;
+  EXPECT_FALSE(offload.offload(
+    sslSocket.get(), [] { return std::string(); },
+    [&](std::string, bool) { completed = true; }));
+  eventBase.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_FALSE(completed);
+}
+
+}
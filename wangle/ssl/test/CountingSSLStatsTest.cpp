@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include <wangle/ssl/CountingSSLStats.h>
+
+using namespace folly;
+using std::chrono::microseconds;
+
+TEST(CountingSSLStatsTest, Handshakes) {
+  CountingSSLStats stats;
+  stats.recordSSLHandshake(true, SSLErrorEnum::NO_ERROR,
+                           SSLResumeEnum::HANDSHAKE, "AES128-SHA",
+                           microseconds(3000));
+  stats.recordSSLHandshake(true, SSLErrorEnum::NO_ERROR,
+                           SSLResumeEnum::HANDSHAKE, "AES128-SHA",
+                           microseconds(1000));
+  stats.recordSSLHandshake(true, SSLErrorEnum::NO_ERROR,
+                           SSLResumeEnum::RESUME_TICKET, "AES128-SHA",
+                           microseconds(100));
+  stats.recordSSLHandshake(true, SSLErrorEnum::NO_ERROR,
+                           SSLResumeEnum::RESUME_SESSION_ID, "AES128-SHA",
+                           microseconds(100));
+  stats.recordSSLHandshake(false, SSLErrorEnum::TIMEOUT, SSLResumeEnum::NA,
+                           nullptr, microseconds(5000));
+  stats.recordSSLHandshake(false, SSLErrorEnum::DROPPED, SSLResumeEnum::NA,
+                           nullptr, microseconds(0));
+
+  auto s = stats.getSnapshot();
+  EXPECT_EQ(2, s.fullHandshakes);
+  EXPECT_EQ(1, s.ticketResumptions);
+  EXPECT_EQ(1, s.sessionIDResumptions);
+  EXPECT_EQ(1, s.handshakeTimeouts);
+  EXPECT_EQ(1, s.handshakesDropped);
+  EXPECT_EQ(0, s.handshakeErrors);
+  EXPECT_DOUBLE_EQ(0.5, s.getResumptionRate());
+  EXPECT_EQ(2, s.fullHandshakeLatency.count());
+  EXPECT_EQ(2, s.resumedHandshakeLatency.count());
+
+  // Only full handshakes count towards a cipher's cost
+  ASSERT_EQ(1, s.ciphers.size());
+  EXPECT_STREQ("AES128-SHA", s.ciphers[0].name);
+  EXPECT_EQ(2, s.ciphers[0].fullHandshakes);
+  EXPECT_EQ(microseconds(4000), s.ciphers[0].totalLatency);
+}
+
+TEST(CountingSSLStatsTest, SessionsAndTickets) {
+  CountingSSLStats stats;
+  stats.recordSSLSession(true, false, false);
+  stats.recordSSLSession(false, true, false);
+  stats.recordSSLSession(false, true, true);
+  stats.recordSSLSession(false, false, false);
+  stats.recordSSLSessionFree(3);
+  stats.recordTLSTicket(true, false);
+  stats.recordTLSTicket(false, true);
+  stats.recordTLSTicket(false, false);
+
+  auto s = stats.getSnapshot();
+  EXPECT_EQ(1, s.sessionsNew);
+  EXPECT_EQ(2, s.sessionCacheHits);
+  EXPECT_EQ(1, s.foreignSessionHits);
+  EXPECT_EQ(1, s.sessionCacheMisses);
+  EXPECT_NEAR(2.0 / 3, s.getSessionCacheHitRate(), 1e-9);
+  EXPECT_EQ(3, s.sessionsFreed);
+  EXPECT_EQ(1, s.ticketsIssued);
+  EXPECT_EQ(1, s.ticketKeyHits);
+  EXPECT_EQ(1, s.ticketKeyMisses);
+}
+
+TEST(CountingSSLStatsTest, CiphersBeyondTheLimit) {
+  CountingSSLStats stats;
+  std::vector<std::string> names;
+  for (size_t i = 0; i < CountingSSLStats::kMaxCiphers + 5; i++) {
+    names.push_back("cipher" + std::to_string(i));
+  }
+  for (const auto& name : names) {
+    stats.recordSSLHandshake(true, SSLErrorEnum::NO_ERROR,
+                             SSLResumeEnum::HANDSHAKE, name.c_str(),
+                             microseconds(1));
+  }
+  auto s = stats.getSnapshot();
+  ASSERT_EQ(CountingSSLStats::kMaxCiphers, s.ciphers.size());
+  EXPECT_STREQ("other", s.ciphers.back().name);
+  EXPECT_EQ(6, s.ciphers.back().fullHandshakes);
+}
+
+TEST(CountingSSLStatsTest, ManyThreads) {
+  CountingSSLStats stats;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 10000; j++) {
+        stats.recordSSLHandshake(true, SSLErrorEnum::NO_ERROR,
+                                 SSLResumeEnum::HANDSHAKE, "RC4-MD5",
+                                 microseconds(j));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto s = stats.getSnapshot();
+  EXPECT_EQ(40000, s.fullHandshakes);
+  EXPECT_EQ(40000, s.fullHandshakeLatency.count());
+  ASSERT_EQ(1, s.ciphers.size());
+  EXPECT_EQ(40000, s.ciphers[0].fullHandshakes);
+}
@@ -0,0 +1,94 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// SNI lookups against a large set of certificate names, half of them
+// wildcards, comparing SNIIndex with the DNString map it replaced
+
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <folly/io/async/SSLContext.h>
+#include <wangle/acceptor/DomainNameMisc.h>
+#include <wangle/ssl/SNIIndex.h>
+#include <gflags/gflags.h>
+
+#include <unordered_map>
+#include <vector>
+
+using namespace folly;
+
+DEFINE_int32(names, 100000, "Certificate names");
+
+namespace {
+
+typedef std::unordered_map<DNString, std::shared_ptr<SSLContext>,
+                           DNStringHash> DNMap;
+
+std::shared_ptr<SSLContext> ctx;
+SNIIndex index;
+DNMap dnMap;
+// What clients ask for: exact names, names under wildcards and misses
+std::vector<std::string> serverNames;
+
+void setup() {
+  if (!serverNames.empty()) {
+    return;
+  }
+  ctx = std::make_shared<SSLContext>();
+  for (int i = 0; i < FLAGS_names; i++) {
+    auto name = i % 2 ?
+      to<std::string>(".Tenant", i, ".Example.com") :
+      to<std::string>("www.Site", i, ".example.com");
+    index.insert(name, ctx);
+    dnMap.emplace(DNString(name.data(), name.size()), ctx);
+    serverNames.push_back(i % 2 ?
+      to<std::string>("api", name) :
+      to<std::string>("WWW.site", i, ".example.com"));
+    serverNames.push_back(to<std::string>("unknown", i, ".example.net"));
+  }
+}
+
+}
+
+BENCHMARK(dnStringMap, iters) {
+  BenchmarkSuspender bs;
+  setup();
+  bs.dismiss();
+  size_t found = 0;
+  for (size_t i = 0; i < iters; i++) {
+    const auto& sn = serverNames[i % serverNames.size()];
+    DNString dnstr(sn.data(), sn.size());
+    auto it = dnMap.find(dnstr);
+    if (it == dnMap.end()) {
+      auto dot = dnstr.find_first_of(".");
+      if (dot != DNString::npos) {
+        it = dnMap.find(DNString(dnstr, dot));
+      }
+    }
+    found += it != dnMap.end();
+  }
+  doNotOptimizeAway(found);
+}
+
+BENCHMARK_RELATIVE(sniIndex, iters) {
+  BenchmarkSuspender bs;
+  setup();
+  bs.dismiss();
+  size_t found = 0;
+  for (size_t i = 0; i < iters; i++) {
+    found += bool(index.get(serverNames[i % serverNames.size()]));
+  }
+  doNotOptimizeAway(found);
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,36 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/SSLContext.h>
+#include <gtest/gtest.h>
+#include <wangle/ssl/SNIIndex.h>
+
+namespace folly {
+
+TEST(SNIIndexTest, ExactAndWildcard) {
+  SNIIndex index;
+  auto www = std::make_shared<SSLContext>();
+  auto star = std::make_shared<SSLContext>();
+  EXPECT_FALSE(index.insert("WWW.Example.com", www));
+  EXPECT_FALSE(index.insert(".example.com", star));
+  EXPECT_EQ(www, index.insert("www.example.COM", star));
+  EXPECT_EQ(2, index.size());
+
+  EXPECT_EQ(www, index.get("www.EXAMPLE.com"));
+  EXPECT_EQ(www, index.getExact("www.example.com"));
+  EXPECT_EQ(star, index.get("api.example.com"));
+  EXPECT_EQ(star, index.getBySuffix("API.example.com"));
+  EXPECT_FALSE(index.getExact("api.example.com"));
+  // Wildcards only match one level down
+  EXPECT_FALSE(index.get("example.com"));
+  EXPECT_FALSE(index.get("a.b.example.com"));
+  EXPECT_FALSE(index.get(std::string(300, 'a')));
+}
+
+}
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <wangle/ssl/SSLClientSessionCache.h>
+
+#include <ctime>
+
+namespace folly {
+
+TEST(SSLClientSessionCacheTest, ByServer) {
+  SSL_library_init();
+  SSLClientSessionCache cache;
+  SocketAddress address("127.0.0.1", 443);
+  auto key = SSLClientSessionCache::getKey(address, "a.example.com");
+  EXPECT_NE(key, SSLClientSessionCache::getKey(address, "b.example.com"));
+  EXPECT_EQ(nullptr, cache.lookup(key));
+
+  auto session = SSL_SESSION_new();
+  cache.store(key, session);
+  auto found = cache.lookup(key);
+  EXPECT_EQ(session, found);
+  // The caller's own reference
+  EXPECT_EQ(2, found->references);
+  SSL_SESSION_free(found);
+
+  // A newer session replaces it
+  auto newer = SSL_SESSION_new();
+  cache.store(key, newer);
+  found = cache.lookup(key);
+  EXPECT_EQ(newer, found);
+  SSL_SESSION_free(found);
+
+  cache.remove(key);
+  EXPECT_EQ(nullptr, cache.lookup(key));
+}
+
+TEST(SSLClientSessionCacheTest, DropsExpired) {
+  SSL_library_init();
+  SSLClientSessionCache cache;
+  auto key = SSLClientSessionCache::getKey(
+    SocketAddress("127.0.0.1", 443), "");
+  auto session = SSL_SESSION_new();
+  SSL_SESSION_set_timeout(session, 60);
+  SSL_SESSION_set_time(session, time(nullptr) - 120);
+  cache.store(key, session);
+  EXPECT_EQ(nullptr, cache.lookup(key));
+}
+
+} // namespace
@@ -11,9 +11,15 @@
 #include <folly/io/async/SSLContext.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <wangle/ssl/SSLCacheOptions.h>
 #include <wangle/ssl/SSLContextManager.h>
 #include <wangle/acceptor/DomainNameMisc.h>
 
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <unistd.h>
+
 using std::shared_ptr;
 
 namespace folly {
@@ -84,4 +90,190 @@ TEST(SSLContextManagerTest, Test1)
   eventBase.loop(); // Clean up events before SSLContextManager is destructed
 }
 
+// A self-signed certificate for commonName, and its key
+static void writeCertificate(const std::string& commonName,
+                             const std::string& certPath,
+                             const std::string& keyPath) {
+  EVP_PKEY* key = EVP_PKEY_new();
+  EVP_PKEY_assign_RSA(key, RSA_generate_key(2048, RSA_F4, nullptr, nullptr));
+  X509* cert = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_get_notBefore(cert), 0);
+  X509_gmtime_adj(X509_get_notAfter(cert), 3600);
+  X509_set_pubkey(cert, key);
+  auto name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                             (const unsigned char*)commonName.c_str(),
+                             -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+  X509_sign(cert, key, EVP_sha256());
+
+  FILE* f = fopen(certPath.c_str(), "w");
+  CHECK(f);
+  PEM_write_X509(f, cert);
+  fclose(f);
+  f = fopen(keyPath.c_str(), "w");
+  CHECK(f);
+  PEM_write_PrivateKey(f, key, nullptr, nullptr, 0, nullptr, nullptr);
+  fclose(f);
+  X509_free(cert);
+  EVP_PKEY_free(key);
+}
+
+class SSLContextManagerReloadTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    CHECK(mkdtemp(dir_));
+    write("a", "a.example");
+    write("b", "b.example");
+  }
+
+  void TearDown() override {
+    for (auto name : {"a", "b"}) {
+      unlink(path(name, "cert").c_str());
+      unlink(path(name, "key").c_str());
+    }
+    rmdir(dir_);
+  }
+
+  std::string path(const std::string& name, const std::string& kind) {
+    return std::string(dir_) + "/" + name + "." + kind + ".pem";
+  }
+
+  void write(const std::string& name, const std::string& commonName) {
+    writeCertificate(commonName, path(name, "cert"), path(name, "key"));
+  }
+
+  SSLContextConfig config(const std::string& name, bool isDefault = false) {
+    SSLContextConfig ctxConfig;
+    ctxConfig.setCertificate(path(name, "cert"), path(name, "key"), "");
+    ctxConfig.isDefault = isDefault;
+    return ctxConfig;
+  }
+
+  void add(const SSLContextConfig& ctxConfig) {
+    manager_.addSSLContextConfig(ctxConfig, cacheOptions_, nullptr,
+                                 SocketAddress(), nullptr);
+  }
+
+  void reset(const std::vector<SSLContextConfig>& ctxConfigs) {
+    manager_.resetSSLContextConfigs(ctxConfigs, cacheOptions_, nullptr,
+                                    SocketAddress(), nullptr);
+  }
+
+  shared_ptr<SSLContext> ctx(const char* name) {
+    return manager_.getSSLCtx(DNString(name));
+  }
+
+  char dir_[32] = "/tmp/ssl_ctx_mgr_test_XXXXXX";
+  SSLCacheOptions cacheOptions_;
+  EventBase eventBase_;
+  SSLContextManager manager_{&eventBase_, "vip_ssl_context_manager_test_",
+                             true, nullptr};
+};
+
+TEST_F(SSLContextManagerReloadTest, ReusesUnchanged) {
+  add(config("a", true));
+  add(config("b"));
+  auto a = ctx("a.example");
+  auto b = ctx("b.example");
+  ASSERT_TRUE(a);
+  ASSERT_TRUE(b);
+
+  reset({config("a", true), config("b")});
+  EXPECT_EQ(a, ctx("a.example"));
+  EXPECT_EQ(b, ctx("b.example"));
+  EXPECT_EQ(2, manager_.getNumSSLContexts());
+  EXPECT_EQ(0, manager_.getNumRetiredSSLContexts());
+
+  // Renewed on disk, so loaded again; the old one is kept while in use
+  write("b", "renewed-b.example");
+  reset({config("a", true), config("b")});
+  EXPECT_EQ(a, ctx("a.example"));
+  EXPECT_FALSE(ctx("b.example"));
+  EXPECT_TRUE(ctx("renewed-b.example"));
+  EXPECT_EQ(a, manager_.getDefaultSSLCtx());
+  EXPECT_EQ(1, manager_.getNumRetiredSSLContexts());
+
+  b.reset();
+  eventBase_.runAfterDelay([&] { eventBase_.terminateLoopSoon(); },
+                           SSLContextManager::kRetiredPurgeIntervalMs + 100);
+  eventBase_.loopForever();
+  EXPECT_EQ(0, manager_.getNumRetiredSSLContexts());
+}
+
+TEST_F(SSLContextManagerReloadTest, Duplicates) {
+  add(config("a", true));
+  auto a = ctx("a.example");
+
+  // Each context once, with its managers
+  reset({config("a", true), config("b"), config("b"), config("a", true)});
+  EXPECT_EQ(2, manager_.getNumSSLContexts());
+  EXPECT_EQ(a, ctx("a.example"));
+  auto b = ctx("b.example");
+  ASSERT_TRUE(b);
+
+  reset({config("a", true), config("b")});
+  EXPECT_EQ(2, manager_.getNumSSLContexts());
+  EXPECT_EQ(a, ctx("a.example"));
+  EXPECT_EQ(b, ctx("b.example"));
+
+  reset({config("b"), config("a", true), config("b")});
+  EXPECT_EQ(2, manager_.getNumSSLContexts());
+  EXPECT_EQ(a, manager_.getDefaultSSLCtx());
+  EXPECT_EQ(0, manager_.getNumRetiredSSLContexts());
+}
+
+class RecordingCryptoProvider : public AsyncCryptoProvider {
+ public:
+  void enableAsyncCrypto(const shared_ptr<SSLContext>& sslCtx,
+                         const SSLContextConfig& ctxConfig) override {
+    contexts.push_back(sslCtx);
+    keyPaths.push_back(ctxConfig.certificates[0].keyPath);
+  }
+
+  std::vector<shared_ptr<SSLContext>> contexts;
+  std::vector<std::string> keyPaths;
+};
+
+TEST_F(SSLContextManagerReloadTest, AsyncCryptoProvider) {
+  auto provider = std::make_shared<RecordingCryptoProvider>();
+  manager_.setAsyncCryptoProvider(provider);
+  add(config("a", true));
+  EXPECT_TRUE(provider->contexts.empty());
+
+  auto remote = config("b");
+  remote.isLocalPrivateKey = false;
+  add(remote);
+  ASSERT_EQ(1, provider->contexts.size());
+  EXPECT_EQ(ctx("b.example"), provider->contexts[0]);
+  EXPECT_EQ(path("b", "key"), provider->keyPaths[0]);
+}
+
+// Overrides the overload that predates AsyncCryptoProvider
+class LegacyContextManager : public SSLContextManager {
+ public:
+  using SSLContextManager::SSLContextManager;
+
+  std::vector<shared_ptr<SSLContext>> enabled;
+
+ protected:
+  using SSLContextManager::enableAsyncCrypto;
+
+  void enableAsyncCrypto(const shared_ptr<SSLContext>& sslCtx) override {
+    enabled.push_back(sslCtx);
+  }
+};
+
+TEST_F(SSLContextManagerReloadTest, LegacyAsyncCrypto) {
+  LegacyContextManager legacy(&eventBase_, "vip_ssl_context_manager_test_",
+                              true, nullptr);
+  auto remote = config("a", true);
+  remote.isLocalPrivateKey = false;
+  legacy.addSSLContextConfig(remote, cacheOptions_, nullptr,
+                             SocketAddress(), nullptr);
+  ASSERT_EQ(1, legacy.enabled.size());
+  EXPECT_EQ(legacy.getSSLCtx(DNString("a.example")), legacy.enabled[0]);
+}
+
 }
@@ -0,0 +1,39 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <thread>
+#include <wangle/ssl/SSLHandshakeAdmission.h>
+
+using namespace folly;
+using std::chrono::milliseconds;
+
+TEST(SSLHandshakeAdmissionTest, ShedsFullHandshakesFirst) {
+  SSLHandshakeAdmission admission;
+  EXPECT_TRUE(admission.admit(milliseconds(2), false));
+  std::this_thread::sleep_for(milliseconds(110));
+  // A standing queue through this interval
+  EXPECT_TRUE(admission.admit(milliseconds(50), false));
+  EXPECT_TRUE(admission.admit(milliseconds(50), false));
+  std::this_thread::sleep_for(milliseconds(110));
+  EXPECT_TRUE(admission.admit(milliseconds(50), false));
+
+  // Overloaded: resumptions get in, full handshakes don't
+  EXPECT_TRUE(admission.admit(milliseconds(50), true));
+  EXPECT_FALSE(admission.admit(milliseconds(50), false));
+  EXPECT_EQ(1, admission.getNumShed());
+
+  // Short waits aren't shed even then
+  EXPECT_TRUE(admission.admit(milliseconds(2), false));
+
+  // Once the queue drains, full handshakes are let back in
+  std::this_thread::sleep_for(milliseconds(110));
+  EXPECT_TRUE(admission.admit(milliseconds(2), false));
+  EXPECT_TRUE(admission.admit(milliseconds(50), false));
+}
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Session resumptions per second from the shared local cache, with every
+// thread looking up sessions all over the cache at once
+
+#include <folly/Benchmark.h>
+#include <wangle/ssl/SSLSessionCacheManager.h>
+#include <gflags/gflags.h>
+
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace folly;
+
+DEFINE_int32(sessions, 20480, "Sessions in the cache");
+DEFINE_int32(buckets, 64, "Cache shards");
+
+namespace {
+
+std::string makeSessionId(std::mt19937_64& rng) {
+  std::string id(32, '\0');
+  for (auto& c : id) {
+    c = char(rng());
+  }
+  return id;
+}
+
+void resume(uint iters, size_t numThreads) {
+  BenchmarkSuspender bs;
+  SSL_library_init();
+  ShardedLocalSSLSessionCache cache(FLAGS_buckets, FLAGS_sessions, 1);
+  std::mt19937_64 rng(0);
+  std::vector<std::string> ids;
+  for (int i = 0; i < FLAGS_sessions; i++) {
+    ids.push_back(makeSessionId(rng));
+    cache.storeSession(ids.back(), SSL_SESSION_new(), nullptr);
+  }
+  bs.dismiss();
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < numThreads; t++) {
+    threads.emplace_back([&, t] {
+      std::mt19937_64 pick(t);
+      for (uint i = t; i < iters; i += numThreads) {
+        auto session = cache.lookupSession(ids[pick() % ids.size()]);
+        if (session) {
+          SSL_SESSION_free(session);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+}
+
+BENCHMARK_PARAM(resume, 1)
+BENCHMARK_PARAM(resume, 4)
+BENCHMARK_PARAM(resume, 16)
+BENCHMARK_PARAM(resume, 32)
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/SSLContext.h>
+#include <gtest/gtest.h>
+#include <wangle/ssl/SSLSessionCacheManager.h>
+
+#include <cstring>
+
+namespace folly {
+
+// Drives the manager through the callbacks it installs on its SSL_CTX, as
+// OpenSSL would during handshakes
+class SSLSessionCacheManagerTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ctx_ = std::make_shared<SSLContext>();
+    manager_.reset(new SSLSessionCacheManager(
+      1000, 100, ctx_.get(), SocketAddress(), "", &eventBase_, nullptr,
+      externalCache_));
+    sslSocket_ = AsyncSSLSocket::newSocket(ctx_, &eventBase_);
+    ssl_ = SSL_new(ctx_->getSSLCtx());
+    SSL_set_ex_data(ssl_, AsyncSSLSocket::getSSLExDataIndex(),
+                    sslSocket_.get());
+  }
+
+  void TearDown() override {
+    SSL_free(ssl_);
+    manager_.reset();
+  }
+
+  // Each test has sessions of its own in the process-wide local cache
+  std::string sessionId(char c) {
+    return std::string(SSL_MAX_SSL_SESSION_ID_LENGTH, c);
+  }
+
+  // Owned by the local cache once created
+  SSL_SESSION* newSession(const std::string& id) {
+    auto session = SSL_SESSION_new();
+    memcpy(session->session_id, id.data(), id.size());
+    session->session_id_length = id.size();
+    EXPECT_EQ(1, SSL_CTX_sess_get_new_cb(ctx_->getSSLCtx())(ssl_, session));
+    return session;
+  }
+
+  // The session resumed with, if any; the caller owns a reference to it
+  SSL_SESSION* getSession(const std::string& id) {
+    int copy = 0;
+    return SSL_CTX_sess_get_get_cb(ctx_->getSSLCtx())(
+      ssl_, (unsigned char*)id.data(), id.size(), &copy);
+  }
+
+  // As the external cache hands it back
+  std::string serializedSession(const std::string& id) {
+    auto session = SSL_SESSION_new();
+    session->ssl_version = TLS1_VERSION;
+    memcpy(session->session_id, id.data(), id.size());
+    session->session_id_length = id.size();
+    std::string value(i2d_SSL_SESSION(session, nullptr), '\0');
+    auto p = (uint8_t*)&value[0];
+    i2d_SSL_SESSION(session, &p);
+    SSL_SESSION_free(session);
+    return value;
+  }
+
+  // Of an external cache lookup, freed by the manager's callback
+  SSLCacheProvider::CacheContext* newCacheContext(const std::string& id) {
+    auto cacheCtx = new SSLCacheProvider::CacheContext();
+    cacheCtx->sessionId = id;
+    cacheCtx->session = nullptr;
+    cacheCtx->manager = manager_.get();
+    cacheCtx->sslSocket = sslSocket_.get();
+    cacheCtx->guard.reset(
+      new DelayedDestruction::DestructorGuard(sslSocket_.get()));
+    return cacheCtx;
+  }
+
+  void removeSession(SSL_SESSION* session) {
+    SSL_CTX_sess_get_remove_cb(ctx_->getSSLCtx())(ctx_->getSSLCtx(),
+                                                  session);
+  }
+
+  EventBase eventBase_;
+  std::shared_ptr<SSLContext> ctx_;
+  std::shared_ptr<SSLCacheProvider> externalCache_;
+  std::unique_ptr<SSLSessionCacheManager> manager_;
+  std::shared_ptr<AsyncSSLSocket> sslSocket_;
+  SSL* ssl_{nullptr};
+};
+
+TEST_F(SSLSessionCacheManagerTest, ThreadCacheInFront) {
+  manager_->setThreadCacheSize(1);
+  auto& stats = manager_->getCacheStats();
+  auto first = sessionId('t');
+  auto second = sessionId('u');
+
+  auto session = newSession(first);
+  // The local cache's reference, and the thread cache's
+  EXPECT_EQ(2, session->references);
+  auto found = getSession(first);
+  EXPECT_EQ(session, found);
+  SSL_SESSION_free(found);
+  EXPECT_EQ(1, stats.threadCacheHits);
+  EXPECT_EQ(0, stats.localCacheHits);
+
+  // Pushed out of the thread cache, which lets go of it, by a newer one
+  newSession(second);
+  EXPECT_EQ(1, session->references);
+  found = getSession(first);
+  EXPECT_EQ(session, found);
+  SSL_SESSION_free(found);
+  EXPECT_EQ(1, stats.localCacheHits);
+
+  // And back in it, once found in the local cache
+  found = getSession(first);
+  EXPECT_EQ(session, found);
+  SSL_SESSION_free(found);
+  EXPECT_EQ(2, stats.threadCacheHits);
+  EXPECT_EQ(2, session->references);
+
+  EXPECT_EQ(nullptr, getSession(sessionId('v')));
+  EXPECT_EQ(1, stats.misses);
+
+  // Removed from both caches
+  removeSession(session);
+  EXPECT_EQ(nullptr, getSession(first));
+  EXPECT_EQ(2, stats.misses);
+  EXPECT_EQ(2, stats.threadCacheHits);
+}
+
+TEST_F(SSLSessionCacheManagerTest, ThreadCacheReleasesSessions) {
+  manager_->setThreadCacheSize(4);
+  auto session = newSession(sessionId('w'));
+  EXPECT_EQ(2, session->references);
+  manager_.reset();
+  EXPECT_EQ(1, session->references);
+}
+
+TEST_F(SSLSessionCacheManagerTest, NoThreadCache) {
+  auto& stats = manager_->getCacheStats();
+  auto id = sessionId('x');
+  auto session = newSession(id);
+  EXPECT_EQ(1, session->references);
+  auto found = getSession(id);
+  EXPECT_EQ(session, found);
+  SSL_SESSION_free(found);
+  EXPECT_EQ(0, stats.threadCacheHits);
+  EXPECT_EQ(1, stats.localCacheHits);
+}
+
+class RecordingCacheProvider : public SSLCacheProvider {
+ public:
+  bool setAsync(const std::string& sessionId,
+                const std::string& value,
+                std::chrono::seconds expiration) override {
+    return true;
+  }
+
+  bool getAsync(const std::string& sessionId,
+                CacheContext* context) override {
+    requested.push_back(sessionId);
+    return sessionId != "unreachable";
+  }
+
+  std::vector<std::string> requested;
+};
+
+TEST(SSLCacheProviderTest, DefaultGetMultiAsync) {
+  RecordingCacheProvider provider;
+  SSLCacheProvider::CacheContext a, b, c;
+  a.sessionId = "a";
+  b.sessionId = "unreachable";
+  c.sessionId = "c";
+  // One getAsync() each, with those that couldn't be sent handed back
+  auto failed = provider.getMultiAsync({&a, &b, &c});
+  EXPECT_EQ((std::vector<std::string>{"a", "unreachable", "c"}),
+            provider.requested);
+  ASSERT_EQ(1, failed.size());
+  EXPECT_EQ(&b, failed[0]);
+}
+
+TEST_F(SSLSessionCacheManagerTest, LateExternalSessionCached) {
+  // No lookup waits for it anymore, e.g. as it timed out, but the next
+  // client with it resumes
+  auto id = sessionId('y');
+  manager_->onGetSuccess(newCacheContext(id), serializedSession(id));
+  auto found = getSession(id);
+  ASSERT_NE(nullptr, found);
+  SSL_SESSION_free(found);
+  EXPECT_EQ(1, manager_->getCacheStats().localCacheHits);
+}
+
+TEST_F(SSLSessionCacheManagerTest, FailedExternalLookupNotCached) {
+  auto id = sessionId('z');
+  manager_->onGetFailure(newCacheContext(id));
+  EXPECT_EQ(nullptr, getSession(id));
+  EXPECT_EQ(1, manager_->getCacheStats().misses);
+}
+
+}
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <wangle/ssl/SSLSessionCacheSnapshot.h>
+
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace folly {
+
+namespace {
+
+std::string snapshotPath() {
+  return "/tmp/SSLSessionCacheSnapshotTest." + std::to_string(getpid());
+}
+
+SSL_SESSION* newSession(int64_t age = 0) {
+  auto session = SSL_SESSION_new();
+  SSL_SESSION_set_timeout(session, 600);
+  SSL_SESSION_set_time(session, time(nullptr) - age);
+  return session;
+}
+
+bool has(ShardedLocalSSLSessionCache& cache, const std::string& id) {
+  auto session = cache.lookupSession(id);
+  if (session) {
+    SSL_SESSION_free(session);
+  }
+  return session;
+}
+
+}
+
+TEST(SSLSessionCacheSnapshotTest, Roundtrip) {
+  SSL_library_init();
+  auto path = snapshotPath();
+  ShardedLocalSSLSessionCache cache(4, 100, 10);
+  cache.storeSession("a", newSession(), nullptr);
+  cache.storeSession("b", newSession(), nullptr);
+  // Past its timeout
+  cache.storeSession("old", newSession(1000), nullptr);
+  EXPECT_EQ(2, SSLSessionCacheSnapshot::save(cache, path));
+
+  ShardedLocalSSLSessionCache restarted(4, 100, 10);
+  EXPECT_EQ(2, SSLSessionCacheSnapshot::load(restarted, path));
+  EXPECT_TRUE(has(restarted, "a"));
+  EXPECT_TRUE(has(restarted, "b"));
+  EXPECT_FALSE(has(restarted, "old"));
+  unlink(path.c_str());
+
+  // Nothing saved yet
+  EXPECT_EQ(0, SSLSessionCacheSnapshot::load(restarted, path));
+}
+
+TEST(SSLSessionCacheSnapshotTest, BoundedAndTruncated) {
+  SSL_library_init();
+  auto path = snapshotPath();
+  ShardedLocalSSLSessionCache cache(1, 100, 10);
+  for (int i = 0; i < 10; i++) {
+    cache.storeSession(std::to_string(i), newSession(), nullptr);
+  }
+  EXPECT_EQ(10, SSLSessionCacheSnapshot::save(cache, path));
+  struct stat st;
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+
+  // Only the first half fits
+  ShardedLocalSSLSessionCache small(1, 100, 10);
+  auto saved = SSLSessionCacheSnapshot::save(cache, path, st.st_size / 2);
+  EXPECT_GT(saved, 0);
+  EXPECT_LT(saved, 10);
+  EXPECT_EQ(saved, SSLSessionCacheSnapshot::load(small, path));
+
+  // A file cut short loses its last session
+  ASSERT_EQ(0, stat(path.c_str(), &st));
+  ASSERT_EQ(0, truncate(path.c_str(), st.st_size - 1));
+  ShardedLocalSSLSessionCache cut(1, 100, 10);
+  EXPECT_EQ(saved - 1, SSLSessionCacheSnapshot::load(cut, path));
+  unlink(path.c_str());
+}
+
+TEST(SSLSessionCacheSnapshotTest, NotASnapshot) {
+  auto path = snapshotPath();
+  auto file = fopen(path.c_str(), "w");
+  ASSERT_TRUE(file);
+  fputs("garbage!", file);
+  fclose(file);
+  ShardedLocalSSLSessionCache cache(1, 100, 10);
+  EXPECT_THROW(SSLSessionCacheSnapshot::load(cache, path),
+               std::runtime_error);
+  unlink(path.c_str());
+}
+
+} // namespace
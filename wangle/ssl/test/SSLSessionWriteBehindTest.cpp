@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/futures/ManualExecutor.h>
+#include <gtest/gtest.h>
+#include <wangle/ssl/SSLSessionWriteBehind.h>
+
+namespace folly {
+
+class RecordingCacheProvider : public SSLCacheProvider {
+ public:
+  bool setAsync(const std::string& sessionId,
+                const std::string& value,
+                std::chrono::seconds expiration) override {
+    stored.push_back(sessionId);
+    return true;
+  }
+
+  bool getAsync(const std::string& sessionId,
+                CacheContext* context) override {
+    return false;
+  }
+
+  std::vector<std::string> stored;
+};
+
+TEST(SSLSessionWriteBehindTest, WritesInBatchesOffThread) {
+  SSL_library_init();
+  auto cache = std::make_shared<RecordingCacheProvider>();
+  auto executor = std::make_shared<ManualExecutor>();
+  auto writeBehind = SSLSessionWriteBehind::create(cache, executor, 16);
+
+  auto session = SSL_SESSION_new();
+  EXPECT_TRUE(writeBehind->add("a", session, std::chrono::seconds(60)));
+  EXPECT_TRUE(writeBehind->add("b", session, std::chrono::seconds(60)));
+  EXPECT_EQ(2, writeBehind->getQueueDepth());
+  EXPECT_TRUE(cache->stored.empty());
+
+  // Both go out from one task
+  EXPECT_EQ(1, executor->run());
+  EXPECT_EQ((std::vector<std::string>{"a", "b"}), cache->stored);
+  EXPECT_EQ(0, writeBehind->getQueueDepth());
+  EXPECT_EQ(2, writeBehind->getNumWritten());
+
+  // The queue held references of its own
+  EXPECT_EQ(1, session->references);
+  SSL_SESSION_free(session);
+}
+
+TEST(SSLSessionWriteBehindTest, DropsWhenFull) {
+  SSL_library_init();
+  auto cache = std::make_shared<RecordingCacheProvider>();
+  auto executor = std::make_shared<ManualExecutor>();
+  auto writeBehind = SSLSessionWriteBehind::create(cache, executor, 2);
+
+  auto session = SSL_SESSION_new();
+  EXPECT_TRUE(writeBehind->add("a", session, std::chrono::seconds(60)));
+  EXPECT_TRUE(writeBehind->add("b", session, std::chrono::seconds(60)));
+  EXPECT_FALSE(writeBehind->add("c", session, std::chrono::seconds(60)));
+  EXPECT_EQ(1, writeBehind->getNumDropped());
+
+  executor->run();
+  EXPECT_EQ(2, cache->stored.size());
+  EXPECT_TRUE(writeBehind->add("c", session, std::chrono::seconds(60)));
+  executor->run();
+  EXPECT_EQ(3, cache->stored.size());
+  SSL_SESSION_free(session);
+}
+
+}
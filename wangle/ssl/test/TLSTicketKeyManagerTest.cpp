@@ -0,0 +1,199 @@
+/*
+ *  Copyright (c) 2015, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/String.h>
+#include <folly/io/async/SSLContext.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <wangle/ssl/TLSTicketKeyManager.h>
+
+#include <openssl/aes.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+namespace folly {
+
+namespace {
+
+const size_t kNameLen = 4;
+const size_t kSaltLen = 12;
+
+std::string sha256(const std::string& input) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(input.data()), input.size(),
+         digest);
+  return std::string(reinterpret_cast<char*>(digest), sizeof(digest));
+}
+
+std::string unhex(const std::string& hexSeed) {
+  std::string seed;
+  CHECK(unhexlify(hexSeed, seed));
+  return seed;
+}
+
+// The name of the key made from a seed, as the manager makes it
+std::string keyNameOf(const std::string& hexSeed) {
+  auto seedName = sha256(unhex(hexSeed));
+  uint32_t n = 1;
+  return sha256(seedName + std::string(reinterpret_cast<char*>(&n),
+                                       sizeof(n))).substr(0, kNameLen);
+}
+
+uint32_t nameBits(const std::string& keyName) {
+  uint32_t bits;
+  memcpy(&bits, keyName.data(), sizeof(bits));
+  return bits;
+}
+
+// The first n seeds, other than skipped ones, whose key names index the
+// given slot of a table of mask + 1 slots
+std::vector<std::string> seedsForSlot(uint32_t slot, uint32_t mask, size_t n,
+                                      size_t skip = 0) {
+  std::vector<std::string> seeds;
+  for (uint32_t i = 0; seeds.size() < n + skip; i++) {
+    char seed[9];
+    snprintf(seed, sizeof(seed), "%08x", i);
+    if ((nameBits(keyNameOf(seed)) & mask) == slot) {
+      seeds.push_back(seed);
+    }
+  }
+  seeds.erase(seeds.begin(), seeds.begin() + skip);
+  return seeds;
+}
+
+class TLSTicketKeyManagerTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ssl_ = SSL_new(ctx_.getSSLCtx());
+    HMAC_CTX_init(&hmac_);
+    EVP_CIPHER_CTX_init(&cipher_);
+  }
+
+  void TearDown() override {
+    EVP_CIPHER_CTX_cleanup(&cipher_);
+    HMAC_CTX_cleanup(&hmac_);
+    SSL_free(ssl_);
+  }
+
+  // Runs the ticket key callback, as OpenSSL does for each ticket
+  int process(unsigned char* keyName, int encrypt) {
+    EVP_CIPHER_CTX_cleanup(&cipher_);
+    EVP_CIPHER_CTX_init(&cipher_);
+    HMAC_CTX_cleanup(&hmac_);
+    HMAC_CTX_init(&hmac_);
+    return TLSTicketKeyManager::callback(ssl_, keyName, iv_, &cipher_,
+                                         &hmac_, encrypt);
+  }
+
+  bool canDecrypt(const std::string& name) {
+    unsigned char keyName[kNameLen + kSaltLen] = {0};
+    memcpy(keyName, name.data(), kNameLen);
+    return process(keyName, 0) == 1;
+  }
+
+  // The HMAC of data under the key the callback last set up
+  std::string mac(const std::string& data) {
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    unsigned int len = 0;
+    HMAC_Update(&hmac_, reinterpret_cast<const unsigned char*>(data.data()),
+                data.size());
+    HMAC_Final(&hmac_, digest, &len);
+    return std::string(reinterpret_cast<char*>(digest), len);
+  }
+
+  SSLContext ctx_;
+  TLSTicketKeyManager manager_{&ctx_, nullptr};
+  SSL* ssl_{nullptr};
+  HMAC_CTX hmac_;
+  EVP_CIPHER_CTX cipher_;
+  unsigned char iv_[AES_BLOCK_SIZE];
+};
+
+}
+
+TEST_F(TLSTicketKeyManagerTest, UniqueKeysFromHashState) {
+  const std::string seed = "0123456789abcdef";
+  ASSERT_TRUE(manager_.setTLSTicketKeySeeds({}, {seed}, {}));
+  unsigned char keyName[kNameLen + kSaltLen];
+  ASSERT_EQ(1, process(keyName, 1));
+  EXPECT_EQ(keyNameOf(seed),
+            std::string(reinterpret_cast<char*>(keyName), kNameLen));
+
+  // SHA256(source || salt), where the key's source is SHA256(seed): the
+  // first half keys the HMAC, the second the AES cipher
+  auto salt = std::string(reinterpret_cast<char*>(keyName) + kNameLen,
+                          kSaltLen);
+  auto expected = sha256(sha256(unhex(seed)) + salt);
+  const std::string data = "ticket";
+  unsigned char expectedMac[SHA256_DIGEST_LENGTH];
+  unsigned int expectedMacLen = 0;
+  HMAC(EVP_sha256(), expected.data(), SHA256_DIGEST_LENGTH / 2,
+       reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+       expectedMac, &expectedMacLen);
+  auto encryptMac = mac(data);
+  EXPECT_EQ(std::string(reinterpret_cast<char*>(expectedMac), expectedMacLen),
+            encryptMac);
+
+  unsigned char block[AES_BLOCK_SIZE] = {0};
+  unsigned char encrypted[2 * AES_BLOCK_SIZE];
+  unsigned char expectedEncrypted[2 * AES_BLOCK_SIZE];
+  int len = 0;
+  int expectedLen = 0;
+  EVP_EncryptUpdate(&cipher_, encrypted, &len, block, sizeof(block));
+  EVP_CIPHER_CTX check;
+  EVP_CIPHER_CTX_init(&check);
+  EVP_EncryptInit_ex(
+    &check, EVP_aes_128_cbc(), nullptr,
+    reinterpret_cast<const unsigned char*>(expected.data()) +
+      SHA256_DIGEST_LENGTH / 2,
+    iv_);
+  EVP_EncryptUpdate(&check, expectedEncrypted, &expectedLen, block,
+                    sizeof(block));
+  EVP_CIPHER_CTX_cleanup(&check);
+  ASSERT_EQ(expectedLen, len);
+  EXPECT_EQ(0, memcmp(expectedEncrypted, encrypted, len));
+
+  // Decryption derives the same keys from the ticket's name
+  ASSERT_EQ(1, process(keyName, 0));
+  EXPECT_EQ(encryptMac, mac(data));
+}
+
+// Six keys index a table of 16 slots; all of these take the last one, so
+// the probes for the later ones wrap around
+TEST_F(TLSTicketKeyManagerTest, EveryKeyFoundWithCollidingNames) {
+  auto seeds = seedsForSlot(15, 15, 6);
+  ASSERT_TRUE(manager_.setTLSTicketKeySeeds({seeds[0], seeds[1]},
+                                            {seeds[2], seeds[3]},
+                                            {seeds[4], seeds[5]}));
+  for (const auto& seed : seeds) {
+    EXPECT_TRUE(canDecrypt(keyNameOf(seed))) << seed;
+  }
+}
+
+TEST_F(TLSTicketKeyManagerTest, UnknownNamesMiss) {
+  auto seeds = seedsForSlot(15, 15, 6);
+  ASSERT_TRUE(manager_.setTLSTicketKeySeeds({seeds[0], seeds[1]},
+                                            {seeds[2], seeds[3]},
+                                            {seeds[4], seeds[5]}));
+  // One probing past every configured key, and one landing in an empty slot
+  auto collides = seedsForSlot(15, 15, 1, 6)[0];
+  auto empty = seedsForSlot(3, 15, 1)[0];
+  EXPECT_FALSE(canDecrypt(keyNameOf(collides)));
+  EXPECT_FALSE(canDecrypt(keyNameOf(empty)));
+}
+
+}
+#endif